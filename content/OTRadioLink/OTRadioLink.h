@@ -27,6 +27,8 @@ Author(s) / Copyright (s): Damon Hart-Davis 2015--2016
 #include "utility/OTRadioLink_FrameType.h"
 #include "utility/OTRadioLink_SecureableFrameType.h"
 #include "utility/OTRadioLink_SecureableFrameType_V0p2Impl.h"
+#include "utility/OTRadioLink_SecureableFrameType_Batch.h"
+#include "utility/OTRadioLink_SecureableFrameType_RXCounterCache.h"
 
 // Radio Link base class definition.
 #include "utility/OTRadioLink_OTRadioLink.h"
@@ -34,4 +36,7 @@ Author(s) / Copyright (s): Damon Hart-Davis 2015--2016
 // Radio Link Null class definition.
 #include "utility/OTRadioLink_OTNullRadioLink.h"
 
+// Demultiplexing of received frames by type into per-type queues.
+#include "utility/OTRadioLink_FrameDemux.h"
+
 #endif
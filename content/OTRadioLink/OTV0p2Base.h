@@ -96,6 +96,8 @@ Author(s) / Copyright (s): Damon Hart-Davis 2015--2016
 
 // Basic security support.
 #include "utility/OTV0P2BASE_Security.h"
+// Node association lookup and RAM index.
+#include "utility/OTV0P2BASE_NodeAssociations.h"
 
 // Entropy management.
 #include "utility/OTV0P2BASE_Entropy.h"
@@ -0,0 +1,39 @@
+/*
+The OpenTRV project licenses this file to you
+under the Apache Licence, Version 2.0 (the "Licence");
+you may not use this file except in compliance
+with the Licence. You may obtain a copy of the Licence at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing,
+software distributed under the Licence is distributed on an
+"AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+KIND, either express or implied. See the Licence for the
+specific language governing permissions and limitations
+under the Licence.
+
+Author(s) / Copyright (s): Damon Hart-Davis 2013--2016
+                           Milenko Alcin 2016
+*/
+
+/*
+ * PRIVATE to the OTRFM23BLink driver: do not include from elsewhere.
+ *
+ * Off AVR the driver and its 'ISR' are called from a single thread,
+ * eg against a simulated radio, so locking out interrupts is a no-op:
+ * this supplies no-op ATOMIC_BLOCK()/ATOMIC_RESTORESTATE if none are defined.
+ * OTRFM23BLink_OTRFM23BLink.h removes them again at its end
+ * (so that they do not leak into later headers)
+ * and so this deliberately has no include guard.
+ *
+ * Not for AVR: use <util/atomic.h>.
+ */
+
+#ifndef ARDUINO_ARCH_AVR
+#ifndef ATOMIC_BLOCK
+#define OTRFM23BLINK_HOSTED_ATOMIC
+#define ATOMIC_RESTORESTATE
+#define ATOMIC_BLOCK(type) for(bool _atomicToDo = true; _atomicToDo; _atomicToDo = false)
+#endif
+#endif
@@ -21,11 +21,13 @@ Author(s) / Copyright (s): Damon Hart-Davis 2013--2016
 /*
  * OpenTRV RFM23B Radio Link base class.
  *
- * Currently V0p2/AVR ONLY.
+ * Targets V0p2/AVR; see the header for use off AVR.
  */
 
 #ifdef ARDUINO_ARCH_AVR
 #include <util/atomic.h>
+#elif !defined(PROGMEM)
+#define PROGMEM // Off AVR configurations are in ordinary memory.
 #endif
 
 #include <OTV0p2Base.h>
@@ -33,6 +35,7 @@ Author(s) / Copyright (s): Damon Hart-Davis 2013--2016
 
 #include "OTRFM23BLink_OTRFM23BLink.h"
 #include "OTV0P2BASE_Sleep.h"
+#include "OTRFM23BLink_HostedAtomic.h" // After the driver header, which removes its own copy.
 
 namespace OTRFM23BLink {
 
@@ -41,7 +44,7 @@ namespace OTRFM23BLink {
 // Too long may allow overruns, too short may make long-frame reception hard.
 void OTRFM23BLinkBase::setMaxTypicalFrameBytes(const uint8_t _maxTypicalFrameBytes)
     {
-    maxTypicalFrameBytes = max(1, min(_maxTypicalFrameBytes, 63));
+    maxTypicalFrameBytes = OTV0P2BASE::fnconstrain(_maxTypicalFrameBytes, (uint8_t)1, (uint8_t)63);
     }
 
 // Returns true if RFM23 appears to be correctly connected.
@@ -85,8 +88,13 @@ void OTRFM23BLinkBase::_registerBlockSetup(const uint8_t registerValues[][2])
         const bool neededEnable = _upSPI_();
         for( ; ; )
             {
+#ifdef ARDUINO_ARCH_AVR
             const uint8_t reg = pgm_read_byte(&(registerValues[0][0]));
             const uint8_t val = pgm_read_byte(&(registerValues[0][1]));
+#else
+            const uint8_t reg = registerValues[0][0];
+            const uint8_t val = registerValues[0][1];
+#endif
             if(0xff == reg) { break; }
 #if 0 && defined(V0P2BASE_DEBUG)
             V0P2BASE_DEBUG_SERIAL_PRINT_FLASHSTRING("RFM23 reg 0x");
@@ -125,12 +133,8 @@ void OTRFM23BLinkBase::_queueFrameInTXFIFO(const uint8_t *bptr, uint8_t buflen)
         // Clear the TX FIFO.
         _clearTXFIFO();
 
-        // Select RFM23B for duration of batch/burst write.
-        _SELECT_();
-        _wr(REG_FIFO | 0x80); // Start burst write to TX FIFO.
-        while(buflen-- > 0) { _wr(*bptr++); }
-        // Burst write finished; deselect RFM23B.
-        _DESELECT_();
+        // Burst write to TX FIFO, keeping the RFM23B selected throughout.
+        _burstWrite_(REG_FIFO, bptr, buflen);
 
         if(neededEnable) { _downSPI_(); }
         }
@@ -159,7 +163,7 @@ bool OTRFM23BLinkBase::_TXFIFO()
 
     // RFM23B data sheet claims up to 800uS from standby to TX; be conservative,
     //::OTV0P2BASE::_delay_x4(250); // Spin CPU for ~1ms; does not depend on timer1, etc.
-    OTV0P2BASE_busy_spin_delay(1000);
+    _delay1ms();
 
     // Repeatedly nap until packet sent, with upper bound of ~120ms on TX time in case there is a problem.
     // (TX time is ~1.6ms per byte at 5000bps.)
@@ -172,7 +176,7 @@ bool OTRFM23BLinkBase::_TXFIFO()
         // Spin CPU for ~1ms; does not depend on timer1, delay(), millis(), etc, Arduino support.
 //        ::OTV0P2BASE::_delay_x4(250);
         // FIXME: RFM23B probably unlikely to exceed 80kbps, thus at least 100uS per byte, so no point sleeping much less.
-        OTV0P2BASE_busy_spin_delay(1000);
+        _delay1ms();
         // FIXME: don't have nap() support yet // nap(WDTO_15MS, true); // Sleep in low power mode for a short time waiting for bits to be sent...
         const uint8_t status = _readReg8Bit_(REG_INT_STATUS1); // TODO: could use nIRQ instead if available.
         if(status & 4) { result = true; break; } // Packet sent!
@@ -229,7 +233,9 @@ bool OTRFM23BLinkBase::sendRaw(const uint8_t *const buf, const uint8_t buflen, c
     if(power >= TXmax)
         {
         // Wait a little before retransmission.
-#ifndef OTV0P2BASE_IDLE_NOT_RECOMMENDED
+#if !defined(ARDUINO_ARCH_AVR)
+        for(int i = 15; --i >= 0; ) { _delay1ms(); }
+#elif !defined(OTV0P2BASE_IDLE_NOT_RECOMMENDED)
         ::OTV0P2BASE::_idleCPU(WDTO_15MS, false); // FIXME: make this a configurable delay.
 #else
         ::OTV0P2BASE::nap(WDTO_15MS); // FIXME: make this a configurable delay.
@@ -283,15 +289,21 @@ void OTRFM23BLinkBase::_dolisten()
         // Enable requested RX-related interrupts.
         // Do this regardless of hardware interrupt support on the board.
         // Check if packet handling in RFM23B is enabled and enable interrupts accordingly.
+        // Note where the ISR should find the RX frame length, if anywhere.
         if ( _readReg8Bit_(REG_30_DATA_ACCESS_CONTROL) & RFM23B_ENPACRX )  {
            _writeReg8Bit_(REG_INT_ENABLE1, RFM23B_ENPKVALID);
            _writeReg8Bit_(REG_INT_ENABLE2, 0); 
-           if ((_readReg8Bit_(REG_33_HEADER_CONTROL2) & RFM23B_FIXPKLEN ) == RFM23B_FIXPKLEN ) 
+           if ((_readReg8Bit_(REG_33_HEADER_CONTROL2) & RFM23B_FIXPKLEN ) == RFM23B_FIXPKLEN ) {
               _writeReg8Bit_(REG_3E_PACKET_LENGTH, maxTypicalFrameBytes);
+              rxLengthReg = REG_3E_PACKET_LENGTH;
+           }
+           else
+              rxLengthReg = REG_4B_RECEIVED_PACKET_LENGTH;
         }
         else {
            _writeReg8Bit_(REG_INT_ENABLE1, 0x10); // enrxffafull: Enable RX FIFO Almost Full.
            _writeReg8Bit_(REG_INT_ENABLE2, WAKE_ON_SYNC_RX ? 0x80 : 0); // enswdet: Enable Sync Word Detected.
+           rxLengthReg = 0;
         }
 
         // Clear any current interrupt/status.
@@ -304,39 +316,6 @@ void OTRFM23BLinkBase::_dolisten()
         }
     }
 
-// Put RFM23 into standby, attempt to read bytes from FIFO into supplied buffer.
-// Leaves RFM22 in low-power standby mode.
-// Trailing bytes (more than were actually sent) undefined.
-void OTRFM23BLinkBase::_RXFIFO(uint8_t *buf, const uint8_t bufSize)
-    {
-    // Lock out interrupts.
-    ATOMIC_BLOCK (ATOMIC_RESTORESTATE)
-        {
-        const bool neededEnable = _upSPI_();
-
-        _modeStandby_();
-
-        // Do burst read from RX FIFO.
-        _SELECT_();
-        _io(REG_FIFO & 0x7F);
-        for(int i = 0; i < bufSize; ++i)
-            { *buf++ = _io(0); }
-        _DESELECT_();
-
-        // Clear RX and TX FIFOs simultaneously.
-        _writeReg8Bit_(REG_OP_CTRL2, 3); // FFCLRRX | FFCLRTX
-        _writeReg8Bit_(REG_OP_CTRL2, 0); // Needs both writes to clear.
-        // Disable all interrupts.
-        _writeReg8Bit_(REG_INT_ENABLE1, 0);
-        _writeReg8Bit_(REG_INT_ENABLE2, 0); // TODO: possibly combine in burst write with previous...
-    //    _writeReg16Bit0_(REG_INT_ENABLE1);
-        // Clear any interrupts already/still pending...
-        _clearInterrupts_();
-
-        if(neededEnable) { _downSPI_(); }
-        }
-    }
-
 // Configure radio for transmission via specified channel < nChannels; non-negative.
 void OTRFM23BLinkBase::_setChannel(const uint8_t channel)
     {
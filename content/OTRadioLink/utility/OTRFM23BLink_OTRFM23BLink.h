@@ -20,7 +20,8 @@ Author(s) / Copyright (s): Damon Hart-Davis 2013--2016
 /*
  * OpenTRV RFM23B Radio Link base class.
  *
- * Currently V0p2/AVR ONLY.
+ * Targets V0p2/AVR; off AVR the SPI bus must be supplied as a template parameter,
+ * eg to drive the RFM23B simulator in hosted tests.
  */
 
 #ifndef OTRFM23BLINK_OTRFM23BLINK_H
@@ -31,6 +32,8 @@ Author(s) / Copyright (s): Damon Hart-Davis 2013--2016
 
 #ifdef ARDUINO_ARCH_AVR
 #include <util/atomic.h> // Atomic primitives for AVR.
+#else
+#include "OTRFM23BLink_HostedAtomic.h" // No-op ATOMIC_BLOCK, removed at the end of this header.
 #endif
 
 #ifdef ARDUINO
@@ -57,7 +60,6 @@ namespace OTRFM23BLink
 
     // See end for library of common configurations.
 
-#ifdef ARDUINO_ARCH_AVR
     // Base class for RFM23B radio link hardware driver.
     // Neither re-entrant nor ISR-safe except where stated.
     // Contains elements that do not depend on template parameters.
@@ -104,7 +106,11 @@ namespace OTRFM23BLink
             // This is an array of {0xff, 0xff} terminated register number/value pairs,
             // in Flash/PROGMEM, which is cast to a void* for OTRadioChannelConfig::config.
             // Type of one channel's array of register pairs.
+#ifdef ARDUINO_ARCH_AVR
             typedef const uint8_t RFM23_Reg_Values_t[][2] PROGMEM;
+#else
+            typedef const uint8_t RFM23_Reg_Values_t[][2];
+#endif
 
         protected:
             // Currently configured channel; starts at default 0.
@@ -205,14 +211,21 @@ namespace OTRFM23BLink
             // Too long may allow overruns, too short may make long-frame reception hard.
             volatile uint8_t maxTypicalFrameBytes;
 
+            // Register holding the RX frame length with the packet handler, as set up by _dolisten(),
+            // ie REG_3E_PACKET_LENGTH for fixed or REG_4B_RECEIVED_PACKET_LENGTH for variable length frames;
+            // 0 if the packet handler is not enabled for RX.
+            // Saves the ISR reading configuration registers for each frame.
+            volatile uint8_t rxLengthReg;
+
             // If true then allow RX operations.
             const bool allowRXOps;
 
             // Constructor only available to deriving class.
             OTRFM23BLinkBase(bool _allowRX = true)
-              : _currentChannel(0), lastRXErr(0), maxTypicalFrameBytes(MAX_RX_FRAME_DEFAULT), allowRXOps(_allowRX)
+              : _currentChannel(0), lastRXErr(0), maxTypicalFrameBytes(MAX_RX_FRAME_DEFAULT), rxLengthReg(0), allowRXOps(_allowRX)
               { }
 
+#ifdef ARDUINO_ARCH_AVR
             // Write/read one byte over SPI...
             // SPI must already be configured and running.
             // TODO: convert from busy-wait to sleep, at least in a standby mode, if likely longer than 10s of uS.
@@ -224,6 +237,16 @@ namespace OTRFM23BLink
             // TODO: convert from busy-wait to sleep, at least in a standby mode, if likely longer than 10s of uS.
             // At lowest SPI clock prescale (x2) this is likely to spin for ~16 CPU cycles (8 bits each taking 2 cycles).
             inline void _wr(const uint8_t data) { SPDR = data; while (!(SPSR & _BV(SPIF))) { } }
+            // Spin CPU for ~1ms; does not depend on timer1, delay(), millis(), etc, Arduino support.
+            static inline void _delay1ms() { OTV0P2BASE_busy_spin_delay(1000); }
+#else
+            // Off AVR SPI bytes and busy waits go to the SPI bus type, eg a simulated RFM23B.
+            virtual uint8_t _io_(uint8_t data) const = 0;
+            virtual void _delay_us_(uint16_t us) const = 0;
+            inline uint8_t _io(const uint8_t data) const { return(_io_(data)); }
+            inline void _wr(const uint8_t data) { _io_(data); }
+            inline void _delay1ms() const { _delay_us_(1000); }
+#endif
 
             // Internal routines to enable/disable RFM23B on the the SPI bus.
             // Versions accessible to the base class...
@@ -241,6 +264,14 @@ namespace OTRFM23BLink
             // SPI must already be configured and running.
             // Treat as if this does not alter state, though in some cases it will.
             virtual uint8_t _readReg8Bit_(const uint8_t addr) const = 0;
+            // Burst write of len bytes from buf to successive registers from addr, or to the TX FIFO,
+            // holding nSS asserted throughout.
+            // SPI must already be configured and running.
+            virtual void _burstWrite_(uint8_t addr, const uint8_t *buf, uint8_t len) = 0;
+            // Burst read of len bytes into buf from successive registers from addr, or from the RX FIFO,
+            // holding nSS asserted throughout.
+            // SPI must already be configured and running.
+            virtual void _burstRead_(uint8_t addr, uint8_t *buf, uint8_t len) const = 0;
             // Enter standby mode (consume least possible power but retain register contents).
             // FIFO state and pending interrupts are cleared.
             // Typical consumption in standby 450nA (cf 15nA when shut down, 8.5mA TUNE, 18--80mA RX/TX).
@@ -275,11 +306,6 @@ namespace OTRFM23BLink
             // Does not clear TX FIFO (so possible to re-send immediately).
             bool _TXFIFO();
 
-            // Put RFM23 into standby, attempt to read bytes from FIFO into supplied buffer.
-            // Leaves RFM23 in low-power standby mode.
-            // Trailing bytes (more than were actually sent) undefined.
-            void _RXFIFO(uint8_t *buf, const uint8_t bufSize);
-
             // Switch listening off, on to selected channel.
             // listenChannel will have been set by time this is called.
             virtual void _dolisten();
@@ -354,9 +380,37 @@ namespace OTRFM23BLink
     // Hardwire to I/O pin for RFM23B active-low interrupt RFM_nIRQ_DigitalPin (-1 if none).
     // Set the targetISRRXMinQueueCapacity to at least 2, or 3 if RAM space permits, for busy RF channels.
     // With allowRX == false as much as possible of the receive side is disabled.
+    // The SPI bus to the RFM23B is spi_t, by default the V0p2 hardware SPI with the given pins;
+    // it must be supplied off AVR, eg as RFM23BSimulatorSPI (see OTRFM23BLink_RFM23BSimulator.h).
+    // spi_t has static select(), deselect(), up() and down() (as for _SELECT() etc below)
+    // and irqAsserted() (true when nIRQ is low);
+    // off AVR it must also have io() to write/read a byte and delay_us() to busy-wait.
+#ifdef ARDUINO_ARCH_AVR
+    template <uint8_t SPI_nSS_DigitalPin, int8_t RFM_nIRQ_DigitalPin>
+    struct OTRFM23BLinkHardwareSPI final
+        {
+        // Introduce some delays to allow signals to stabilise if running slow.
+        // From the RFM23B datasheet (S3/p14) tEN & tSS are 20ns so waits shouldn't be necessary for AVR CPU speeds!
+        static const bool runSPISlow = ::OTV0P2BASE::DEFAULT_RUN_SPI_SLOW;
+        static inline void _nSSWait() { OTV0P2BASE_busy_spin_delay(runSPISlow?4:0); }
+        // Wait from SPI select to op, and after op to deselect, and after deselect.
+        static inline void select() { fastDigitalWrite(SPI_nSS_DigitalPin, LOW); _nSSWait(); } // Select/enable RFM23B.
+        static inline void deselect() { _nSSWait(); fastDigitalWrite(SPI_nSS_DigitalPin, HIGH); _nSSWait(); } // Deselect/disable RFM23B.
+        // Power SPI up and down given this particular SPI/RFM23B select line.
+        // Use all other default values.
+        static inline bool up() { return(OTV0P2BASE::t_powerUpSPIIfDisabled<SPI_nSS_DigitalPin, runSPISlow>()); }
+        static inline void down() { OTV0P2BASE::t_powerDownSPI<SPI_nSS_DigitalPin, OTV0P2BASE::V0p2_PIN_SPI_SCK, OTV0P2BASE::V0p2_PIN_SPI_MOSI, OTV0P2BASE::V0p2_PIN_SPI_MISO, runSPISlow>(); }
+        static inline bool irqAsserted() { return(LOW == fastDigitalRead(RFM_nIRQ_DigitalPin)); }
+        };
+#else
+    // No SPI hardware off AVR: spi_t must be given explicitly.
+    template <uint8_t SPI_nSS_DigitalPin, int8_t RFM_nIRQ_DigitalPin>
+    struct OTRFM23BLinkHardwareSPI;
+#endif
 #define OTRFM23BLink_DEFINED
     static const uint8_t DEFAULT_RFM23B_RX_QUEUE_CAPACITY = 3;
-    template <uint8_t SPI_nSS_DigitalPin, int8_t RFM_nIRQ_DigitalPin = -1, uint8_t targetISRRXMinQueueCapacity = 3, bool allowRX = true>
+    template <uint8_t SPI_nSS_DigitalPin, int8_t RFM_nIRQ_DigitalPin = -1, uint8_t targetISRRXMinQueueCapacity = 3, bool allowRX = true,
+              class spi_t = OTRFM23BLinkHardwareSPI<SPI_nSS_DigitalPin, RFM_nIRQ_DigitalPin> >
     class OTRFM23BLink final : public OTRFM23BLinkBase
         {
         private:
@@ -380,31 +434,35 @@ namespace OTRFM23BLink
 //#endif
 
             // Internal routines to enable/disable RFM23B on the the SPI bus.
-            // These depend only on the (constant) SPI_nSS_DigitalPin template parameter
+            // For the hardware SPI these depend only on the (constant) SPI_nSS_DigitalPin template parameter
             // so these should turn into single assembler instructions in principle.
-            // Introduce some delays to allow signals to stabilise if running slow.
-            // From the RFM23B datasheet (S3/p14) tEN & tSS are 20ns so waits shouldn't be necessary for AVR CPU speeds!
-            static const bool runSPISlow = ::OTV0P2BASE::DEFAULT_RUN_SPI_SLOW;
-            inline void _nSSWait() const { OTV0P2BASE_busy_spin_delay(runSPISlow?4:0); }
-            // Wait from SPI select to op, and after op to deselect, and after deselect.
-            inline void _SELECT() const { fastDigitalWrite(SPI_nSS_DigitalPin, LOW); _nSSWait(); } // Select/enable RFM23B.
-            inline void _DESELECT() const { _nSSWait(); fastDigitalWrite(SPI_nSS_DigitalPin, HIGH); _nSSWait(); } // Deselect/disable RFM23B.
+            inline void _SELECT() const { spi_t::select(); } // Select/enable RFM23B.
+            inline void _DESELECT() const { spi_t::deselect(); } // Deselect/disable RFM23B.
             // Versions accessible to the base class...
             virtual void _SELECT_() const { _SELECT(); }
             virtual void _DESELECT_() const { _DESELECT(); }
 
             // Power SPI up and down given this particular SPI/RFM23B select line.
-            // Use all other default values.
             // Inlined non-virtual implementations for speed.
-            inline bool _upSPI() const { return(OTV0P2BASE::t_powerUpSPIIfDisabled<SPI_nSS_DigitalPin, runSPISlow>()); }
-            inline void _downSPI() const { OTV0P2BASE::t_powerDownSPI<SPI_nSS_DigitalPin, OTV0P2BASE::V0p2_PIN_SPI_SCK, OTV0P2BASE::V0p2_PIN_SPI_MOSI, OTV0P2BASE::V0p2_PIN_SPI_MISO, runSPISlow>(); }
+            inline bool _upSPI() const { return(spi_t::up()); }
+            inline void _downSPI() const { spi_t::down(); }
             // Versions accessible to the base class...
             virtual bool _upSPI_() const { return(_upSPI()); }
             virtual void _downSPI_() const { _downSPI(); }
 
+#ifndef ARDUINO_ARCH_AVR
+            // Write/read one byte over SPI.
+            // Inlined non-virtual implementations for speed, hiding those of the base class.
+            inline uint8_t _io(const uint8_t data) const { return(spi_t::io(data)); }
+            inline void _wr(const uint8_t data) { spi_t::io(data); }
+            // SPI bytes and busy waits for the base class.
+            virtual uint8_t _io_(const uint8_t data) const { return(spi_t::io(data)); }
+            virtual void _delay_us_(const uint16_t us) const { spi_t::delay_us(us); }
+#endif
+
             // True if interrupt line is inactive (or doesn't exist).
             // A poll or interrupt service routine can terminate immediately if this is true.
-            inline bool interruptLineIsEnabledAndInactive() const { return(hasInterruptSupport && (LOW != fastDigitalRead(RFM_nIRQ_DigitalPin))); }
+            inline bool interruptLineIsEnabledAndInactive() const { return(hasInterruptSupport && !spi_t::irqAsserted()); }
 
             // Write to 8-bit register on RFM23B.
             // SPI must already be configured and running.
@@ -443,6 +501,32 @@ namespace OTRFM23BLink
             // Version accessible to the base class...
             virtual uint8_t _readReg8Bit_(const uint8_t addr) const { return(_readReg8Bit(addr)); }
 
+            // Burst write of len bytes from buf to successive registers from addr, or to the TX FIFO,
+            // holding nSS asserted throughout.
+            // SPI must already be configured and running.
+            inline void _burstWrite(const uint8_t addr, const uint8_t *buf, uint8_t len)
+                {
+                _SELECT();
+                _wr(addr | 0x80); // Force to write.
+                while(len-- > 0) { _wr(*buf++); }
+                _DESELECT();
+                }
+            // Version accessible to the base class...
+            virtual void _burstWrite_(const uint8_t addr, const uint8_t *buf, const uint8_t len) { _burstWrite(addr, buf, len); }
+
+            // Burst read of len bytes into buf from successive registers from addr, or from the RX FIFO,
+            // holding nSS asserted throughout.
+            // SPI must already be configured and running.
+            inline void _burstRead(const uint8_t addr, uint8_t *buf, uint8_t len) const
+                {
+                _SELECT();
+                _io(addr & 0x7f); // Force to read.
+                while(len-- > 0) { *buf++ = _io(0); }
+                _DESELECT();
+                }
+            // Version accessible to the base class...
+            virtual void _burstRead_(const uint8_t addr, uint8_t *buf, const uint8_t len) const { _burstRead(addr, buf, len); }
+
             // Read from 16-bit big-endian register pair.
             // The result has the first (lower-numbered) register in the most significant byte.
             // Treat as if this does not alter state, though in some cases it will.
@@ -561,11 +645,63 @@ V0P2BASE_DEBUG_SERIAL_PRINTLN_FLASHSTRING("RFM23 reset...");
                 if(neededEnable) { _downSPI(); }
                 }
 
+            // Return to RX after reading a frame, with the channel, RX FIFO threshold and interrupt enables
+            // left as set up by _dolisten(), clearing both FIFOs and any pending interrupts.
+            // Much quicker than a full _dolisten() for the ISR.
+            // SPI must already be configured and running.
+            inline void _restartRX()
+                {
+                // Clear RX and TX FIFOs simultaneously.
+                _writeReg8Bit(REG_OP_CTRL2, 3); // FFCLRRX | FFCLRTX
+                _writeReg8Bit(REG_OP_CTRL2, 0); // Needs both writes to clear.
+                // Clear any interrupts already/still pending...
+                _clearInterrupts();
+                _modeRX();
+                }
+
+            // Read a received frame of lengthRX bytes from the RX FIFO into the RX queue,
+            // if there is space and any RX filter accepts it, then return to RX.
+            // Reads only the bytes of the frame, in one burst.
+            // SPI must already be configured and running.
+            inline void _RXFIFOToQueue(uint8_t lengthRX)
+                {
+                // Stop anything more arriving in the RX FIFO while reading it.
+                _modeStandby();
+                // If there is space in the queue then read in the frame, else discard it.
+                volatile uint8_t *const bufferRX = (lengthRX > MaxRXMsgLen) ? NULL :
+                    queueRX._getRXBufForInbound();
+                if(NULL != bufferRX)
+                    {
+                    // Read the entire frame.
+                    _burstRead(REG_FIFO, (uint8_t *)bufferRX, lengthRX);
+                    // If an RX filter is present then apply it.
+                    quickFrameFilter_t *const f = filterRXISR;
+                    if((NULL != f) && !f(bufferRX, lengthRX))
+                        {
+                        ++filteredRXedMessageCountRecent; // Drop the frame: filter didn't like it.
+                        queueRX._loadedBuf(0); // Don't queue this frame...
+                        }
+                    else
+                        {
+                        queueRX._loadedBuf(lengthRX); // Queue message.
+                        }
+                    }
+                else
+                    {
+                    // DISCARD/drop frame that there is no room to RX.
+                    ++droppedRXedMessageCountRecent;
+                    lastRXErr = RXErr_DroppedFrame;
+                    }
+                // Clear up and go back to listening...
+                _restartRX();
+                }
+
             // Common handling of polling and ISR code.
             // NOT RENTRANT: interrupts must be blocked when this is called.
             // Keeping everything inline helps allow better ISR code generation
             // (less register pushes/pops since all use can be seen by the compiler).
-            // Keeping this small minimises service time.
+            // Keeping this small minimises service time:
+            // SPI is powered up once, and the only per-byte work is the burst read of the frame itself.
             // This does NOT attempt to interpret or filter inbound messages, just queues them.
             // Ensures radio is in RX mode at exit if listening is enabled.
             void _poll()
@@ -576,59 +712,22 @@ V0P2BASE_DEBUG_SERIAL_PRINTLN_FLASHSTRING("RFM23 reset...");
                 // Nothing to do if not listening at the moment.
                 if(-1 == getListenChannel()) { return; }
 
+                const bool neededEnable = _upSPI();
+
                 // See what has arrived, if anything.
-                const uint16_t status = _readStatusBoth();
-
-                // We need to check if RFM23B is in packet mode and based on that 
-                // we select interrupt routine.
-                const bool neededEnable = _upSPI_();
-                const uint8_t rxMode = _readReg8Bit_(REG_30_DATA_ACCESS_CONTROL);
-                if(neededEnable) { _downSPI_(); }
-                if(rxMode & RFM23B_ENPACRX)
+                // Reading the status clears the interrupts.
+                const uint16_t status = _readReg16Bit(REG_INT_STATUS1);
+
+                // _dolisten() noted whether the RFM23B is in packet mode
+                // and where to find the frame length.
+                const uint8_t lengthReg = rxLengthReg;
+                if(0 != lengthReg)
                   {
                   // Packet-handling mode...
                     if(status & RFM23B_IPKVALID) // Packet received OK
                         {
-                        const bool neededEnable = _upSPI();
-                        // Extract packet/frame length...
-                        uint8_t lengthRX; 
-                        // Number of bytes to read depends whether fixed of variable packet length
-                        if ((_readReg8Bit_(REG_33_HEADER_CONTROL2) & RFM23B_FIXPKLEN ) == RFM23B_FIXPKLEN ) 
-                           lengthRX = _readReg8Bit(REG_3E_PACKET_LENGTH);
-                        else
-                           lengthRX = _readReg8Bit(REG_4B_RECEIVED_PACKET_LENGTH);
-                        if(neededEnable) { _downSPI(); }
-                        // Received frame.
-                        // If there is space in the queue then read in the frame, else discard it.
-                        volatile uint8_t *const bufferRX = (lengthRX > MaxRXMsgLen) ? NULL :
-                            queueRX._getRXBufForInbound();
-                        if(NULL != bufferRX)
-                            {
-                            // Attempt to read the entire frame.
-                            _RXFIFO((uint8_t *)bufferRX, MaxRXMsgLen);
-                            // If an RX filter is present then apply it.
-                            quickFrameFilter_t *const f = filterRXISR;
-                            if((NULL != f) && !f(bufferRX, lengthRX))
-                                {
-                                ++filteredRXedMessageCountRecent; // Drop the frame: filter didn't like it.
-                                queueRX._loadedBuf(0); // Don't queue this frame...
-                                }
-                            else
-                                {
-                                queueRX._loadedBuf(lengthRX); // Queue message.
-                                }
-                            }
-                        else
-                            {
-                            // DISCARD/drop frame that there is no room to RX.
-                            uint8_t tmpbuf[1];
-                            _RXFIFO(tmpbuf, sizeof(tmpbuf));
-                            ++droppedRXedMessageCountRecent;
-                            lastRXErr = RXErr_DroppedFrame;
-                            }
-                        // Clear up and force back to listening...
-                        _dolisten();
-                        //return;
+                        // Extract packet/frame length and read in the frame.
+                        _RXFIFOToQueue(_readReg8Bit(lengthReg));
                         }
 #if 0 && defined(MILENKO_DEBUG)
                     // Preamble received
@@ -654,41 +753,12 @@ V0P2BASE_DEBUG_SERIAL_PRINTLN_FLASHSTRING("RFM23 reset...");
                         lastRXErr = RXErr_RXOverrun;
                         // Reset and force back to listening...
                         _dolisten();
-                        return;
                         }
                     else if(status & 0x1000)
                         {
                         // Received frame.
-                        // If there is space in the queue then read in the frame, else discard it.
-                        volatile uint8_t *const bufferRX = queueRX._getRXBufForInbound();
-                        if(NULL != bufferRX)
-                            {
-                            // Attempt to read the entire frame.
-                            _RXFIFO((uint8_t *)bufferRX, MaxRXMsgLen);
-                            uint8_t lengthRX = MaxRXMsgLen; // Not very clever yet!
-                            // If an RX filter is present then apply it.
-                            quickFrameFilter_t *const f = filterRXISR;
-                            if((NULL != f) && !f(bufferRX, lengthRX))
-                                {
-                                ++filteredRXedMessageCountRecent; // Drop the frame: filter didn't like it.
-                                queueRX._loadedBuf(0); // Don't queue this frame...
-                                }
-                            else
-                                {
-                                queueRX._loadedBuf(lengthRX); // Queue message.
-                                }
-                            }
-                        else
-                            {
-                            // DISCARD/drop frame that there is no room to RX.
-                            uint8_t tmpbuf[1];
-                            _RXFIFO(tmpbuf, sizeof(tmpbuf));
-                            ++droppedRXedMessageCountRecent;
-                            lastRXErr = RXErr_DroppedFrame;
-                            }
-                        // Clear up and force back to listening...
-                        _dolisten();
-                        return;
+                        // Read in the whole FIFO since the frame length is not known.
+                        _RXFIFOToQueue(MaxRXMsgLen); // Not very clever yet!
                         }
                     else if(WAKE_ON_SYNC_RX && (status & 0x80))
                         {
@@ -698,9 +768,10 @@ V0P2BASE_DEBUG_SERIAL_PRINTLN_FLASHSTRING("RFM23 reset...");
     ////    syncSeen = true;
                         // Keep waiting for rest of message...
                         // At this point in theory we could know exactly how long to wait.
-                        return;
                         }
                     }
+
+                if(neededEnable) { _downSPI(); }
                 }
 
         public:
@@ -757,13 +828,14 @@ V0P2BASE_DEBUG_SERIAL_PRINTLN_FLASHSTRING("RFM23 reset...");
             //    RSSI [231] ~ [0.5..20]dB 0.5 dB Steps
             uint8_t getRSSI() const
                 {
+                uint8_t rssi;
                 ATOMIC_BLOCK (ATOMIC_RESTORESTATE)
                     {
                     const bool neededEnable = _upSPI();
-                    const uint8_t rssi = _readReg8Bit(REG_RSSI);
+                    rssi = _readReg8Bit(REG_RSSI);
                     if(neededEnable) { _downSPI(); }
-                    return(rssi);
                     }
+                return(rssi);
                 }
 
             // Get current mode.
@@ -773,13 +845,14 @@ V0P2BASE_DEBUG_SERIAL_PRINTLN_FLASHSTRING("RFM23 reset...");
             // Units as per RFM23B.
             uint8_t getMode() const
                 {
+                uint8_t mode;
                 ATOMIC_BLOCK (ATOMIC_RESTORESTATE)
                     {
                     const bool neededEnable = _upSPI();
-                    const uint8_t mode = 0xf & _readReg8Bit(REG_OP_CTRL1);
+                    mode = 0xf & _readReg8Bit(REG_OP_CTRL1);
                     if(neededEnable) { _downSPI(); }
-                    return(mode);
                     }
+                return(mode);
                 }
 
             // Fetches the current inbound RX minimum queue capacity and maximum RX (and TX) raw message size.
@@ -844,8 +917,15 @@ V0P2BASE_DEBUG_SERIAL_PRINTLN_FLASHSTRING("RFM23 reset...");
     // Full register settings for 868.0MHz (EU band 48) GFSK 49.26 kbps.
     // Full config including all default values, so safe for dynamic switching.
     extern const OTRFM23BLinkBase::RFM23_Reg_Values_t StandardRegSettingsJeeLabs;
-#endif // ARDUINO_ARCH_AVR
 
 
     }
+
+// Remove any no-op ATOMIC_BLOCK() from OTRFM23BLink_HostedAtomic.h so as not to leak it.
+#ifdef OTRFM23BLINK_HOSTED_ATOMIC
+#undef OTRFM23BLINK_HOSTED_ATOMIC
+#undef ATOMIC_BLOCK
+#undef ATOMIC_RESTORESTATE
+#endif
+
 #endif
@@ -0,0 +1,397 @@
+/*
+The OpenTRV project licenses this file to you
+under the Apache Licence, Version 2.0 (the "Licence");
+you may not use this file except in compliance
+with the Licence. You may obtain a copy of the Licence at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing,
+software distributed under the Licence is distributed on an
+"AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+KIND, either express or implied. See the Licence for the
+specific language governing permissions and limitations
+under the Licence.
+
+Author(s) / Copyright (s): Damon Hart-Davis 2016
+*/
+
+/*
+ * Register-level simulated RFM23B for hosted tests and benchmarks.
+ */
+
+#ifndef ARDUINO_ARCH_AVR
+
+#include <string.h>
+#include <algorithm>
+#include "OTRFM23BLink_RFM23BSimulator.h"
+
+
+namespace OTRFM23BLink
+    {
+
+
+constexpr uint8_t RFM23BSimulator::FIFO_SIZE;
+
+// Power-on reset.
+void RFM23BSimulator::reset()
+    {
+    memset(regs, 0, sizeof(regs));
+    // Non-zero defaults as per the datasheet for the registers modelled.
+    regs[REG_DEVICE_TYPE] = 0x08;
+    regs[REG_DEVICE_VERSION] = 0x06;
+    regs[REG_INT_ENABLE2] = ICHIPRDY | IPOR;
+    regs[REG_INT_STATUS2] = ICHIPRDY | IPOR;
+    regs[REG_OP_CTRL1] = 0x01; // XTON: ready mode.
+    regs[REG_DATA_ACCESS_CONTROL] = 0x8d;
+    regs[0x32] = 0x0c;
+    regs[REG_HEADER_CONTROL2] = 0x22;
+    regs[REG_PREAMBLE_LENGTH] = 0x08;
+    regs[0x35] = 0x2a;
+    regs[0x36] = 0x2d;
+    regs[0x37] = 0xd4;
+    regs[0x6d] = 0x18;
+    regs[REG_TX_DATA_RATE1] = 0x0a;
+    regs[REG_TX_DATA_RATE0] = 0x3d;
+    regs[REG_MOD_CTRL1] = 0x0c;
+    regs[REG_RX_FIFO_CTRL] = 0x37;
+    rxFIFO.clear();
+    txFIFO.clear();
+    txActive = false;
+    rxLocked = false;
+    rssi = 0;
+    updateIRQ(t);
+    }
+
+// Data rate from registers 0x6e, 0x6f and 0x70, in bits per second.
+uint32_t RFM23BSimulator::dataRate() const
+    {
+    const uint32_t txdr = ((uint32_t)regs[REG_TX_DATA_RATE1] << 8) | regs[REG_TX_DATA_RATE0];
+    const bool scaled = (0 != (regs[REG_MOD_CTRL1] & 0x20)); // txdtrtscale, for rates below 30kbps.
+    const unsigned shift = scaled ? 21 : 16;
+    return((uint32_t)((((uint64_t)txdr * 1000000U) + (1U << (shift - 1))) >> shift));
+    }
+
+// Duration of the given number of bits at the configured data rate, doubled with Manchester coding.
+uint64_t RFM23BSimulator::bitsUs(const uint32_t bits) const
+    {
+    const uint64_t txdr = std::max(1U, ((uint32_t)regs[REG_TX_DATA_RATE1] << 8) | regs[REG_TX_DATA_RATE0]);
+    const bool scaled = (0 != (regs[REG_MOD_CTRL1] & 0x20));
+    const bool manchester = (0 != (regs[REG_MOD_CTRL1] & 0x02));
+    const uint64_t n = ((uint64_t)bits << (scaled ? 21 : 16)) << (manchester ? 1 : 0);
+    return((n + txdr - 1) / txdr);
+    }
+
+// Preamble (in nibbles, 9 bits), sync word, and in packet mode any header and the length byte.
+uint32_t RFM23BSimulator::leadBits(const bool packet) const
+    {
+    const uint8_t hc2 = regs[REG_HEADER_CONTROL2];
+    const uint32_t preambleNibbles = ((uint32_t)(hc2 & 1) << 8) | regs[REG_PREAMBLE_LENGTH];
+    uint32_t bytes = 1 + ((hc2 >> 1) & 3);
+    if(packet)
+        {
+        bytes += std::min(4, (hc2 >> 4) & 7);
+        if(0 == (hc2 & 0x08)) { ++bytes; } // Variable length.
+        }
+    return((4 * preambleNibbles) + (8 * bytes));
+    }
+
+// CRC in packet mode.
+uint32_t RFM23BSimulator::trailBits(const bool packet) const
+    { return((packet && (0 != (regs[REG_DATA_ACCESS_CONTROL] & ENCRC))) ? 16 : 0); }
+
+// Time of the next RX or TX event, or UINT64_MAX if none.
+uint64_t RFM23BSimulator::nextEventAt() const
+    {
+    uint64_t n = UINT64_MAX;
+    if(txActive) { n = txDoneAt; }
+    if(rxLocked)
+        {
+        uint64_t r;
+        if(!rxSynced) { r = rxDataAt; }
+        else if(packetRX() && (rxBytes >= rxFrame.data.size()))
+            { r = rxDataAt + bitsUs((8 * (uint32_t)rxFrame.data.size()) + trailBits(true)); }
+        else { r = rxByteAt(rxBytes); }
+        n = std::min(n, r);
+        }
+    else if(!air.empty()) { n = std::min(n, air.front().start); }
+    return(n);
+    }
+
+// Process all events up to now, in time order.
+void RFM23BSimulator::process()
+    {
+    for( ; ; )
+        {
+        const uint64_t e = nextEventAt();
+        if(e > t) { return; }
+
+        if(txActive && (txDoneAt == e))
+            {
+            txActive = false;
+            TXFrame f;
+            f.at = e;
+            const size_t n = packetTX() ? std::min(txFIFO.size(), (size_t)regs[REG_TX_PACKET_LENGTH]) : txFIFO.size();
+            f.data.assign(txFIFO.begin(), txFIFO.begin() + n);
+            f.txPower = regs[0x6d];
+            sent.push_back(f);
+            ++stats.txFrames;
+            regs[REG_INT_STATUS1] |= IPKSENT;
+            regs[REG_OP_CTRL1] &= ~TXON; // Back to ready mode.
+            updateIRQ(e);
+            continue;
+            }
+
+        if(rxLocked)
+            {
+            const size_t len = rxFrame.data.size();
+            if(!rxSynced)
+                {
+                rxSynced = true;
+                regs[REG_INT_STATUS2] |= IPREAVAL | ISWDET;
+                updateIRQ(e);
+                }
+            else if(packetRX() && (rxBytes >= len))
+                {
+                // Valid packet: the receiver reverts to ready mode unless in multi-packet mode.
+                regs[REG_RX_PACKET_LENGTH] = (uint8_t)len;
+                regs[REG_INT_STATUS1] |= IPKVALID;
+                ++stats.rxFrames;
+                rxLocked = false;
+                if(0 == (regs[REG_OP_CTRL2] & RXMPK)) { regs[REG_OP_CTRL1] &= ~RXON; }
+                updateIRQ(e);
+                }
+            else
+                {
+                // Without the packet handler the receiver keeps clocking in (zero) noise after the frame.
+                const uint8_t b = (rxBytes < len) ? rxFrame.data[rxBytes] : 0;
+                ++rxBytes;
+                if(!rxPush(b, e)) { ++stats.rxOverflows; rxLocked = false; }
+                else if(!packetRX() && (rxBytes == len)) { ++stats.rxFrames; }
+                }
+            continue;
+            }
+
+        // Start of the next frame on the air.
+        const AirFrame f = air.front();
+        air.pop_front();
+        const uint64_t end = f.start + frameAirtimeUs((uint8_t)f.data.size());
+        const bool collides = (f.start < busyUntil);
+        busyUntil = std::max(busyUntil, end);
+        if(collides) { ++stats.collided; continue; }
+        // The receiver must be listening from the start of the preamble.
+        if(!isRX() || txActive || (f.start < rxReadyAt)) { ++stats.missed; continue; }
+        rxFrame = f;
+        rxLocked = true;
+        rxSynced = false;
+        rxBytes = 0;
+        rxDataAt = f.start + bitsUs(leadBits(packetRX()));
+        rssi = f.rssi;
+        }
+    }
+
+// Push a byte into the RX FIFO at the given time; false on overflow.
+bool RFM23BSimulator::rxPush(const uint8_t b, const uint64_t at)
+    {
+    if(rxFIFO.size() >= FIFO_SIZE)
+        {
+        regs[REG_INT_STATUS1] |= IFFERROR;
+        updateIRQ(at);
+        return(false); // FAIL
+        }
+    rxFIFO.push_back(b);
+    if(rxFIFO.size() >= (size_t)(regs[REG_RX_FIFO_CTRL] & 0x3f)) { regs[REG_INT_STATUS1] |= IRXFFAFULL; }
+    updateIRQ(at);
+    return(true);
+    }
+
+// Stop receiving, eg on leaving RX mode.
+void RFM23BSimulator::rxAbort()
+    {
+    if(!rxLocked) { return; }
+    // Without the packet handler, only a frame not yet fully clocked in is cut short.
+    if(packetRX() || (rxBytes < rxFrame.data.size())) { ++stats.aborted; }
+    rxLocked = false;
+    }
+
+// Note any change in nIRQ.
+void RFM23BSimulator::updateIRQ(const uint64_t at)
+    {
+    const bool i = irq();
+    if(i && !irqWas) { irqAt = at; }
+    irqWas = i;
+    }
+
+// Register read with side effects.
+uint8_t RFM23BSimulator::readReg(const uint8_t r)
+    {
+    switch(r)
+        {
+        case REG_INT_STATUS1: case REG_INT_STATUS2:
+            {
+            // Reading interrupt status clears it.
+            const uint8_t v = regs[r];
+            regs[r] = 0;
+            updateIRQ(t);
+            return(v);
+            }
+        case REG_DEVICE_STATUS:
+            {
+            const uint8_t cps = txActive ? 2 : (isRX() ? 1 : 0);
+            return((uint8_t)(cps | (rxFIFO.empty() ? 0x20 : 0))); // rxffem when RX FIFO empty.
+            }
+        case REG_RSSI:
+            {
+            if(isRX() && (t >= rxReadyAt)) { rssi = rxLocked ? rxFrame.rssi : noiseRSSI; }
+            return(rssi);
+            }
+        case REG_FIFO:
+            {
+            if(rxFIFO.empty())
+                {
+                regs[REG_INT_STATUS1] |= IFFERROR; // Underflow.
+                updateIRQ(t);
+                return(0);
+                }
+            const uint8_t b = rxFIFO.front();
+            rxFIFO.pop_front();
+            return(b);
+            }
+        default: return(regs[r]);
+        }
+    }
+
+// Register write with side effects.
+void RFM23BSimulator::writeReg(const uint8_t r, const uint8_t v)
+    {
+    switch(r)
+        {
+        // Read-only.
+        case REG_DEVICE_TYPE: case REG_DEVICE_VERSION: case REG_DEVICE_STATUS:
+        case REG_INT_STATUS1: case REG_INT_STATUS2: case REG_RSSI: case REG_RX_PACKET_LENGTH:
+            return;
+        case REG_INT_ENABLE1: case REG_INT_ENABLE2:
+            regs[r] = v;
+            updateIRQ(t);
+            return;
+        case REG_OP_CTRL1:
+            {
+            if(0 != (v & SWRES)) { rxAbort(); reset(); return; }
+            const uint8_t prev = regs[r];
+            regs[r] = v;
+            if((0 != (prev & RXON)) && (0 == (v & RXON))) { rxAbort(); }
+            if((0 == (prev & RXON)) && (0 != (v & RXON))) { rxReadyAt = t + settleUs; }
+            if(txActive && (0 == (v & TXON))) { txActive = false; } // TX abandoned.
+            else if(!txActive && (0 == (prev & TXON)) && (0 != (v & TXON)))
+                {
+                rxAbort();
+                const size_t n = packetTX() ? std::min(txFIFO.size(), (size_t)regs[REG_TX_PACKET_LENGTH]) : txFIFO.size();
+                txActive = true;
+                txDoneAt = t + settleUs + bitsUs(leadBits(packetTX()) + (8 * (uint32_t)n) + trailBits(packetTX()));
+                }
+            return;
+            }
+        case REG_OP_CTRL2:
+            if(0 != (v & FFCLRRX)) { rxFIFO.clear(); }
+            if(0 != (v & FFCLRTX)) { txFIFO.clear(); }
+            regs[r] = v;
+            return;
+        case REG_FIFO:
+            if(txFIFO.size() >= FIFO_SIZE)
+                {
+                regs[REG_INT_STATUS1] |= IFFERROR; // Overflow.
+                updateIRQ(t);
+                return;
+                }
+            txFIFO.push_back(v);
+            return;
+        default:
+            regs[r] = v;
+            return;
+        }
+    }
+
+// Advance virtual time, processing any frames on the air.
+void RFM23BSimulator::advance(const uint64_t us)
+    {
+    t += us;
+    process();
+    }
+
+// Advance virtual time until nIRQ is asserted (returning true) or by maxUs (returning false).
+bool RFM23BSimulator::advanceUntilIRQ(const uint64_t maxUs)
+    {
+    const uint64_t end = t + maxUs;
+    while(!irq())
+        {
+        const uint64_t e = nextEventAt();
+        if(e >= end) { t = end; process(); return(irq()); }
+        t = std::max(t, e);
+        process();
+        }
+    return(true);
+    }
+
+// Put a frame on the air starting at startUs.
+void RFM23BSimulator::sendOnAir(const uint64_t startUs, const uint8_t *const frame, const uint8_t len, const uint8_t frameRSSI)
+    {
+    AirFrame f;
+    f.start = startUs;
+    if(NULL != frame) { f.data.assign(frame, frame + len); }
+    f.rssi = frameRSSI;
+    const auto pos = std::upper_bound(air.begin(), air.end(), startUs,
+        [](const uint64_t s, const AirFrame &a) { return(s < a.start); });
+    air.insert(pos, f);
+    process();
+    }
+
+// Account for target CPU cycles, advancing virtual time.
+void RFM23BSimulator::spend(const uint32_t cycles)
+    {
+    stats.cycles += cycles;
+    cycleFraction += 1000000ULL * cycles;
+    t += cycleFraction / cpuHz;
+    cycleFraction %= cpuHz;
+    }
+
+void RFM23BSimulator::select()
+    {
+    spend(spiSelectCycles);
+    if(selected || !spiOn) { ++stats.busErrors; }
+    selected = true;
+    hasAddr = false;
+    ++stats.spiTransactions;
+    }
+
+void RFM23BSimulator::deselect()
+    {
+    selected = false;
+    hasAddr = false;
+    }
+
+// Write and read one byte: the first after select is the address (top bit set to write).
+// Successive bytes of a burst access successive registers, except for the FIFO.
+uint8_t RFM23BSimulator::io(const uint8_t data)
+    {
+    spend(spiByteCycles);
+    ++stats.spiBytes;
+    process();
+    if(!spiOn || !selected) { ++stats.busErrors; return(0xff); } // FAIL
+    if(!hasAddr)
+        {
+        hasAddr = true;
+        writing = (0 != (data & 0x80));
+        addr = data & 0x7f;
+        return(0);
+        }
+    uint8_t result = 0;
+    if(writing) { writeReg(addr, data); }
+    else { result = readReg(addr); }
+    if(REG_FIFO != addr) { addr = (addr + 1) & 0x7f; }
+    return(result);
+    }
+
+
+    }
+
+#endif // ARDUINO_ARCH_AVR
@@ -0,0 +1,314 @@
+/*
+The OpenTRV project licenses this file to you
+under the Apache Licence, Version 2.0 (the "Licence");
+you may not use this file except in compliance
+with the Licence. You may obtain a copy of the Licence at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing,
+software distributed under the Licence is distributed on an
+"AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+KIND, either express or implied. See the Licence for the
+specific language governing permissions and limitations
+under the Licence.
+
+Author(s) / Copyright (s): Damon Hart-Davis 2016
+*/
+
+/*
+ * Register-level simulated RFM23B (Si4431) on an SPI bus, for hosted tests and benchmarks
+ * of OTRFM23BLink, so that sendRaw(), the RX interrupt handling and the RX queue can run off AVR.
+ *
+ * Models the SPI register protocol (with burst access and auto-increment, except for the FIFO),
+ * the TX and RX FIFOs with almost-full threshold and overflow/underflow error,
+ * the interrupt status and enable registers and the nIRQ line,
+ * the packet handler (variable-length RX/TX, preamble/sync/length/CRC airtime)
+ * and RSSI, with the data rate taken from the configured registers.
+ * Not modelled: headers, fixed-length RX, CRC checking and auto-TX.
+ *
+ * The simulator runs on virtual time (in microseconds)
+ * advanced by the test, by SPI activity and by the driver's busy waits.
+ * SPI activity is costed in CPU cycles of the target (by default a V0p2 at 1MHz)
+ * so that the cycles taken by driver routines such as the ISR can be measured.
+ * Frames 'on the air' are received only if the receiver was in RX mode for the whole frame.
+ *
+ * Not for AVR: uses heap allocation.
+ */
+
+#ifndef OTRFM23BLINK_RFM23BSIMULATOR_H
+#define OTRFM23BLINK_RFM23BSIMULATOR_H
+
+#ifndef ARDUINO_ARCH_AVR
+
+#include <stddef.h>
+#include <stdint.h>
+#include <deque>
+#include <vector>
+
+
+namespace OTRFM23BLink
+    {
+
+
+    // Simulated RFM23B.
+    //
+    // After the last data byte of a valid packet is received
+    // (and in packet mode its CRC bytes, if enabled, have been sent)
+    // ipkvalid is set, the length is in register 0x4b,
+    // and the receiver reverts to ready mode unless rxmpk is set in register 8.
+    // Without the packet handler, bytes following the frame (noise after sync)
+    // keep being clocked into the RX FIFO until RX mode is left, and overflow sets ifferr.
+    // A TX sends the TX FIFO (or in packet mode, the first register 0x3e bytes of it)
+    // and sets ipksent; the TX FIFO is left intact so that it can be resent.
+    class RFM23BSimulator final
+        {
+        public:
+            // Register numbers and bits used by the simulator.
+            static constexpr uint8_t REG_DEVICE_TYPE = 0;
+            static constexpr uint8_t REG_DEVICE_VERSION = 1;
+            static constexpr uint8_t REG_DEVICE_STATUS = 2;
+            static constexpr uint8_t REG_INT_STATUS1 = 3;
+            static constexpr uint8_t REG_INT_STATUS2 = 4;
+            static constexpr uint8_t REG_INT_ENABLE1 = 5;
+            static constexpr uint8_t REG_INT_ENABLE2 = 6;
+            static constexpr uint8_t REG_OP_CTRL1 = 7;
+            static constexpr uint8_t REG_OP_CTRL2 = 8;
+            static constexpr uint8_t REG_RSSI = 0x26;
+            static constexpr uint8_t REG_DATA_ACCESS_CONTROL = 0x30;
+            static constexpr uint8_t REG_HEADER_CONTROL2 = 0x33;
+            static constexpr uint8_t REG_PREAMBLE_LENGTH = 0x34;
+            static constexpr uint8_t REG_TX_PACKET_LENGTH = 0x3e;
+            static constexpr uint8_t REG_RX_PACKET_LENGTH = 0x4b;
+            static constexpr uint8_t REG_TX_DATA_RATE1 = 0x6e;
+            static constexpr uint8_t REG_TX_DATA_RATE0 = 0x6f;
+            static constexpr uint8_t REG_MOD_CTRL1 = 0x70;
+            static constexpr uint8_t REG_RX_FIFO_CTRL = 0x7e;
+            static constexpr uint8_t REG_FIFO = 0x7f;
+
+            // REG_INT_STATUS1.
+            static constexpr uint8_t IFFERROR = 0x80;
+            static constexpr uint8_t IRXFFAFULL = 0x10;
+            static constexpr uint8_t IPKSENT = 0x04;
+            static constexpr uint8_t IPKVALID = 0x02;
+            // REG_INT_STATUS2.
+            static constexpr uint8_t ISWDET = 0x80;
+            static constexpr uint8_t IPREAVAL = 0x40;
+            static constexpr uint8_t ICHIPRDY = 0x02;
+            static constexpr uint8_t IPOR = 0x01;
+            // REG_OP_CTRL1.
+            static constexpr uint8_t SWRES = 0x80;
+            static constexpr uint8_t TXON = 0x08;
+            static constexpr uint8_t RXON = 0x04;
+            // REG_OP_CTRL2.
+            static constexpr uint8_t RXMPK = 0x10;
+            static constexpr uint8_t FFCLRRX = 0x02;
+            static constexpr uint8_t FFCLRTX = 0x01;
+            // REG_DATA_ACCESS_CONTROL.
+            static constexpr uint8_t ENPACRX = 0x80;
+            static constexpr uint8_t ENPACTX = 0x08;
+            static constexpr uint8_t ENCRC = 0x04;
+
+            // Size of each FIFO in bytes.
+            static constexpr uint8_t FIFO_SIZE = 64;
+
+            // A frame transmitted.
+            struct TXFrame
+                {
+                // Time the TX completed.
+                uint64_t at;
+                // Frame content, as from the TX FIFO.
+                std::vector<uint8_t> data;
+                // TX power register at the time.
+                uint8_t txPower;
+                };
+
+            // Counts of activity.
+            struct Stats
+                {
+                // SPI transactions (selects) and bytes, including the address byte.
+                uint32_t spiTransactions = 0;
+                uint32_t spiBytes = 0;
+                // Target CPU cycles spent driving SPI, as per the cost model.
+                uint64_t cycles = 0;
+                // SPI misuse, eg bytes sent while SPI is powered down or the device is not selected.
+                uint32_t busErrors = 0;
+                // Frames received completely into the RX FIFO.
+                uint32_t rxFrames = 0;
+                // Frames on the air while the receiver was not listening.
+                uint32_t missed = 0;
+                // Frames starting while the receiver was busy with another.
+                uint32_t collided = 0;
+                // Frames cut short by leaving RX mode.
+                uint32_t aborted = 0;
+                // RX FIFO overflows.
+                uint32_t rxOverflows = 0;
+                // Frames transmitted.
+                uint32_t txFrames = 0;
+                };
+
+            // Target CPU clock, and cost model of SPI access in CPU cycles; virtual time advances by these cycles.
+            // The defaults are for the V0p2 at 1MHz with SPI clock at fosc/2:
+            // 16 cycles to shift each byte plus loading SPDR and polling SPIF,
+            // and for each select/deselect pair the port writes and call overheads.
+            uint32_t cpuHz = 1000000;
+            uint16_t spiByteCycles = 18;
+            uint16_t spiSelectCycles = 8;
+            // Time from ready to receiving or transmitting (PLL settling).
+            uint32_t settleUs = 200;
+            // RSSI with no frame being received.
+            uint8_t noiseRSSI = 40;
+            // Frames transmitted, oldest first.
+            std::vector<TXFrame> sent;
+
+        private:
+            // A frame on the air.
+            struct AirFrame
+                {
+                uint64_t start;
+                std::vector<uint8_t> data;
+                uint8_t rssi;
+                };
+
+            uint8_t regs[128];
+            uint64_t t = 0;
+            // Fraction of a microsecond of CPU cycles not yet added to t, scaled by cpuHz.
+            uint64_t cycleFraction = 0;
+
+            bool spiOn = false;
+            bool selected = false;
+            // Register address for the next byte of an SPI transaction, and if a write; hasAddr is false before the address byte.
+            bool hasAddr = false;
+            bool writing = false;
+            uint8_t addr = 0;
+
+            std::deque<uint8_t> rxFIFO;
+            std::vector<uint8_t> txFIFO;
+
+            // Time the receiver is ready in RX mode.
+            uint64_t rxReadyAt = 0;
+            // Time the TX in progress completes, if transmitting.
+            bool txActive = false;
+            uint64_t txDoneAt = 0;
+
+            // Frames yet to be received, in order of start time.
+            std::deque<AirFrame> air;
+            // Frame being received (including any following noise without the packet handler).
+            bool rxLocked = false;
+            AirFrame rxFrame;
+            // True once the sync word of rxFrame has been seen.
+            bool rxSynced = false;
+            // Bytes of rxFrame clocked in, and time of the first data bit.
+            size_t rxBytes = 0;
+            uint64_t rxDataAt = 0;
+            // End of the frame being (or last) received; frames starting before this collide.
+            uint64_t busyUntil = 0;
+            // Last RSSI measured.
+            uint8_t rssi = 0;
+
+            // nIRQ state and when it was last asserted.
+            bool irqWas = false;
+            uint64_t irqAt = 0;
+
+            Stats stats;
+
+            bool packetRX() const { return(0 != (regs[REG_DATA_ACCESS_CONTROL] & ENPACRX)); }
+            bool packetTX() const { return(0 != (regs[REG_DATA_ACCESS_CONTROL] & ENPACTX)); }
+            // Bits on the air before the first data byte, and after the last.
+            uint32_t leadBits(bool packet) const;
+            uint32_t trailBits(bool packet) const;
+            // Duration of the given number of bits at the configured data rate (and coding).
+            uint64_t bitsUs(uint32_t bits) const;
+            // Time the given RX byte of the frame being received is complete.
+            uint64_t rxByteAt(size_t i) const { return(rxDataAt + bitsUs(8 * (uint32_t)(i + 1))); }
+            // Time of the next RX or TX event, or UINT64_MAX if none.
+            uint64_t nextEventAt() const;
+
+            // Account for target CPU cycles, advancing virtual time.
+            void spend(uint32_t cycles);
+            // Process all events up to now.
+            void process();
+            // Push a byte into the RX FIFO at the given time; false on overflow.
+            bool rxPush(uint8_t b, uint64_t at);
+            // Stop receiving, eg on leaving RX mode.
+            void rxAbort();
+            // Register access with side effects.
+            uint8_t readReg(uint8_t r);
+            void writeReg(uint8_t r, uint8_t v);
+            // Note any change in nIRQ.
+            void updateIRQ(uint64_t at);
+
+        public:
+            RFM23BSimulator() { reset(); }
+
+            // Power-on reset: registers to their defaults, FIFOs empty and in ready mode with ichiprdy and ipor set.
+            // Virtual time and frames on the air are kept.
+            void reset();
+
+            // Virtual time in microseconds.
+            uint64_t now() const { return(t); }
+            // Advance virtual time, processing any frames on the air.
+            void advance(uint64_t us);
+            // Advance virtual time until nIRQ is asserted (returning true) or by maxUs (returning false).
+            bool advanceUntilIRQ(uint64_t maxUs);
+
+            // Put a frame on the air starting at startUs, received with the given RSSI if listening.
+            // In packet mode the frame is the payload only, without the length and CRC.
+            void sendOnAir(uint64_t startUs, const uint8_t *frame, uint8_t len, uint8_t frameRSSI = 160);
+            // Put a frame on the air starting now.
+            void sendOnAir(const uint8_t *frame, uint8_t len, uint8_t frameRSSI = 160) { sendOnAir(t, frame, len, frameRSSI); }
+            // Time on the air of a frame with len bytes of payload with the current configuration.
+            uint64_t frameAirtimeUs(uint8_t len) const { return(bitsUs(leadBits(packetRX()) + (8 * (uint32_t)len) + trailBits(packetRX()))); }
+            // Data rate from registers 0x6e, 0x6f and 0x70, in bits per second.
+            uint32_t dataRate() const;
+
+            // True while nIRQ is asserted (low), ie an enabled interrupt is pending.
+            bool irq() const
+                { return(0 != ((regs[REG_INT_STATUS1] & regs[REG_INT_ENABLE1]) | (regs[REG_INT_STATUS2] & regs[REG_INT_ENABLE2]))); }
+            // Time nIRQ was last asserted.
+            uint64_t getIRQAt() const { return(irqAt); }
+            // True if in RX mode (including while settling), or TX mode.
+            bool isRX() const { return(0 != (regs[REG_OP_CTRL1] & RXON)); }
+            bool isTX() const { return(txActive); }
+            // Register value without side effects, eg without clearing interrupt status.
+            uint8_t peekReg(const uint8_t r) const { return(regs[r & 0x7f]); }
+            // Bytes waiting in the RX FIFO.
+            size_t rxFIFOLevel() const { return(rxFIFO.size()); }
+
+            const Stats &getStats() const { return(stats); }
+
+            // SPI interface as used by RFM23BSimulatorSPI.
+            // Power SPI up, returning true if it was down.
+            bool spiUp() { const bool wasOff = !spiOn; spiOn = true; return(wasOff); }
+            void spiDown() { spiOn = false; }
+            void select();
+            void deselect();
+            // Write and read one byte: the first after select is the address (top bit set to write).
+            uint8_t io(uint8_t data);
+        };
+
+    // SPI bus to an RFM23BSimulator for the spi_t parameter of OTRFM23BLink.
+    // Each distinct id gives an independent bus; if sim is NULL the bus reads as no device fitted.
+    template<int id = 0>
+    class RFM23BSimulatorSPI final
+        {
+        public:
+            // Simulator to forward to.
+            static RFM23BSimulator *sim;
+
+            static void select() { if(NULL != sim) { sim->select(); } }
+            static void deselect() { if(NULL != sim) { sim->deselect(); } }
+            static uint8_t io(const uint8_t data) { return((NULL == sim) ? 0 : sim->io(data)); }
+            static bool up() { return((NULL == sim) ? false : sim->spiUp()); }
+            static void down() { if(NULL != sim) { sim->spiDown(); } }
+            static bool irqAsserted() { return((NULL != sim) && sim->irq()); }
+            static void delay_us(const uint16_t us) { if(NULL != sim) { sim->advance(us); } }
+        };
+    template<int id> RFM23BSimulator *RFM23BSimulatorSPI<id>::sim = NULL;
+
+
+    }
+
+#endif // ARDUINO_ARCH_AVR
+
+#endif
@@ -20,7 +20,8 @@ Author(s) / Copyright (s): Deniz Erbilgin 2016
 /*
  * OpenTRV RN2483 LoRA Radio Link base class.
  *
- * Currently V0p2/AVR ONLY.
+ * Templated on the serial type and speed so that it can also be built hosted,
+ * eg against a simulated module.
  */
 
 //Collection of useful links:
@@ -33,9 +34,9 @@ Author(s) / Copyright (s): Deniz Erbilgin 2016
 
 
 /**
- * @brief   Set dev addr on line 215 of OTRN2483Link_OTRN2483Link.cpp
- *          Set data rate on line 57 of OTRN2483Link_OTRN2483Link.cpp
- *          Set adaptive data rate by uncommmenting #define RN2483_ENABLE_ADR below and setting limits on line 55 of #define RN2483_ENABLE_ADR
+ * @brief   Set dev addr and keys in OTRN2483LinkBase::DEV_ADDR, APP_SKEY and NWK_SKEY in OTRN2483Link_OTRN2483Link.cpp
+ *          Set data rate in OTRN2483LinkBase::DEFAULT_DATA_RATE below
+ *          Set adaptive data rate by uncommmenting #define RN2483_ENABLE_ADR below and setting limits in OTRN2483LinkBase::ADR_MIN_DATA_RATE/ADR_MAX_DATA_RATE
  * @todo    - Add config functionality
  *          - Move commands to progmem
  *          - Add intelligent way of utilising device eeprom (w/ mac save)
@@ -71,7 +72,6 @@ namespace OTRN2483Link
 {
 
 
-#ifdef ARDUINO_ARCH_AVR
 /**
  * @struct  OTRN2483LinkConfig
  * @brief   Structure containing config data for OTRN2483LinkConfig
@@ -98,6 +98,7 @@ typedef struct OTRN2483LinkConfig {
      */
     char get(const uint8_t *src) const{
         char c = 0;
+#ifdef ARDUINO_ARCH_AVR
         switch (bEEPROM) {
         case true:
             c = eeprom_read_byte(src);
@@ -106,80 +107,90 @@ typedef struct OTRN2483LinkConfig {
             c = pgm_read_byte(src);
             break;
         }
+#else
+        c = *src;
+#endif // ARDUINO_ARCH_AVR
         return c;
     }
 } OTRN2483LinkConfig_t;
 
-
 /**
- * @brief   This is a class that extends OTRadioLink to communicate via LoRaWAN
- *          using the RN2483 radio module.
+ * @brief   Tracks LoRaWAN (EU868) duty cycle budgets for each channel, in whole seconds.
+ * @param   channels    number of channels enabled in the module, all in the 1% sub-band
+ *                      (the three default channels 868.1, 868.3 and 868.5 MHz).
+ * @note    As in the RN2483, each channel gets an equal share of the sub-band's budget,
+ *          so after a transmission the channel used is off for channels * 100 times the time on air.
+ *          The module picks the channel, so the first free one is charged here.
+ *          Times are rounded up and a second added to allow for the granularity of the clock.
  */
-#define OTRN2483Link_DEFINED
-class OTRN2483Link final : public OTRadioLink::OTRadioLink
+template<uint8_t channels>
+class OTRN2483DutyCycleScheduler final
 {
 public:
-	// Public interface
-    OTRN2483Link(uint8_t _nRstPin, uint8_t rxPin, uint8_t txPin);
-
-    void preinit(const void */*preconfig*/) {};
-    bool begin();
-    bool end();
-
-    bool sendRaw(const uint8_t *buf, uint8_t buflen, int8_t channel = 0, TXpower power = TXnormal, bool listenAfter = false);
-//    bool queueToSend(const uint8_t *buf, uint8_t buflen, int8_t channel = 0, TXpower power = TXnormal);
-    inline bool isAvailable(){ return bAvailable; };     // checks radio is there independant of power state
-    bool handleInterruptSimple() { return true;};
-
-    /**
-     * @brief   Unused. For compatibility with OTRadioLink.
-     */
-    void poll();
-    void getCapacity(uint8_t &queueRXMsgsMin, uint8_t &maxRXMsgLen, uint8_t &maxTXMsgLen) const;
-    uint8_t getRXMsgsQueued() const;
-    const volatile uint8_t *peekRXMsg() const;
-    void removeRXMsg() {};
-
+    static_assert(channels > 0, "must have at least one channel");
+    // Multiple of the time on air for which a channel is off after use.
+    static const constexpr uint16_t offFactor = 100 * channels;
 
 private:
-// Private methods
-    // Serial
-    uint8_t read();
-    uint8_t timedBlockingRead(char *data, uint8_t length);
-    void write(const char *data, uint8_t length);
-    void print(const char data);
-    void print(const uint8_t value);	// todo change this so it prints in hex?
-    void print(const char *string);
-    void print(const void *src);
-
-    // Commands
-    void factoryReset();
-    void reset();
-    void setBaud();
-    void setDevAddr(const uint8_t *address);
-    void setKeys(const uint8_t *appKey, const uint8_t *networkKey);
-    void joinABP();
-    bool getStatus();
-    void save();
-    void setDataRate(uint8_t dataRate);
-    void setAdaptiveDataRate(uint8_t minRate, uint8_t maxRate);
-    void setTxPower(uint8_t power);
-
-    // Setup
-    bool _doconfig() { return true; };
-
-    // misc
-    bool getHex(const uint8_t *string, uint8_t *output, uint8_t outputLen);
-
-// Private consts and variables
-    const OTRN2483LinkConfig *config;  // Pointer to radio config
-    OTV0P2BASE::OTSoftSerial ser;
-    static const uint16_t baud = 2400;	 // OTSoftSer baud rate. todo switch to template to allow higher speed
-    bool bAvailable;
-    const uint8_t nRstPin;
+    // Seconds until each channel is free again.
+    uint16_t waitS[channels];
 
+public:
+    OTRN2483DutyCycleScheduler() { reset(); }
+    // Mark all channels free, eg after a module reset.
+    void reset() { memset(waitS, 0, sizeof(waitS)); }
+    // Note the passing of elapsedS seconds.
+    void tick(const uint8_t elapsedS)
+    {
+        for(uint8_t i = 0; i < channels; ++i) { waitS[i] = (waitS[i] > elapsedS) ? (waitS[i] - elapsedS) : 0; }
+    }
+    // Seconds until a channel is free, 0 if one is free now.
+    uint16_t getWaitS() const
+    {
+        uint16_t w = waitS[0];
+        for(uint8_t i = 1; i < channels; ++i) { if(waitS[i] < w) { w = waitS[i]; } }
+        return(w);
+    }
+    // True if a transmission may start now.
+    bool canSend() const { return(0 == getWaitS()); }
+    // Charge a transmission of airtimeUs to the first free channel (else that next free).
+    void sent(const uint32_t airtimeUs)
+    {
+        uint8_t c = 0;
+        for(uint8_t i = 1; i < channels; ++i) { if(waitS[i] < waitS[c]) { c = i; } }
+        const uint32_t ms = (airtimeUs + 999) / 1000;
+        const uint32_t s = ((ms * offFactor) + 999) / 1000 + 1;
+        waitS[c] = (s > 0xffff) ? 0xffff : (uint16_t)s;
+    }
+    // Hold all channels off for at least s seconds, eg when the module reports no free channel.
+    void holdOff(const uint16_t s)
+    {
+        for(uint8_t i = 0; i < channels; ++i) { if(waitS[i] < s) { waitS[i] = s; } }
+    }
+};
+
+/**
+ * @brief   Enum containing major states of the RN2483 link.
+ */
+enum OTRN2483LinkState
+{
+    INIT = 0,       // Resync autobaud; then configure.
+    CONFIGURE,      // Set up for the network, a command at a time.
+    JOIN,           // Join by ABP.
+    IDLE,           // Waiting for frames, and for the duty cycle budget to send them.
+    SENDING,        // Sending a (possibly coalesced) frame.
+    GET_DATA_RATE,  // Getting the data rate, which may have been changed by ADR.
+    ASLEEP,         // Module asleep after sending.
+    WAKING          // Waking the module to send.
+};
 
-    static const char SYS_START[5];	  // Beginning of "sys" command set
+/**
+ * @brief   String constants and values not dependent on the template parameters.
+ */
+class OTRN2483LinkBase : public OTRadioLink::OTRadioLink
+{
+protected:
+    static const char SYS_START[5];   // Beginning of "sys" command set
     static const char SYS_SLEEP[7];   // Sleep mode
     static const char SYS_RESET[6]; // todo this can be removed on board with working reset line
 
@@ -193,22 +204,548 @@ private:
     static const char MAC_SET_CH[4];  // Channel stuff
     static const char MAC_SET_DRRANGE[9]; // Set data rate range
     static const char MAC_POWER[9]; // Set Tx power
+    static const char DEV_ADDR[9];    // OpenTRV has temporarily reserved the block 02:01:11:xx. TODO this will be stored as number in config
+    static const char APP_SKEY[33];   // Specific to the OpenTRV server and should be kept secret. TODO this will be stored as number in config
+    static const char NWK_SKEY[33];   // The Things Network key. TODO this will be stored as number in config
 #endif // RN2483_CONFIG_IN_EEPROM
     static const char MAC_JOINABP[9]; // Join LoRaWAN network by ABP (activation by personalisation)
     static const char MAC_STATUS[7];
-    static const char MAC_SEND[12];		// Sends an unconfirmed packet on channel 1
+    static const char MAC_GET_DR[3];  // Get data rate.
+    static const char MAC_SEND[12];     // Sends an unconfirmed packet on channel 1
     static const char MAC_SAVE[5];
 
     static const char RN2483_SET[5];  // Set command
     static const char RN2483_GET[5];  // Get command
     static const char RN2483_END[3];  // End of command (CR LF)
 
+public:
+    // Max reliable baud to talk to RN2483 over OTSoftSerial2; the RN2483 autobauds.
+    static const constexpr uint16_t RN2483_MAX_baud = 9600;
+    // Data rate used without ADR: 0 is SF12 to 5 is SF7.
+    // Minimum data rate that allows us to send our packets at 240s intervals is SF11.
+    static const constexpr uint8_t DEFAULT_DATA_RATE = 1;
+    // Data rate range with ADR.
+    static const constexpr uint8_t ADR_MIN_DATA_RATE = 1;
+    static const constexpr uint8_t ADR_MAX_DATA_RATE = 5;
+    // Largest application payload (EU868) that can be sent at any data rate.
+    static const constexpr uint8_t MIN_MAX_PAYLOAD = 51;
+
+    /**
+     * @brief   Largest application payload that can be sent at the given EU868 data rate.
+     */
+    static uint8_t getMaxPayload(const uint8_t dataRate)
+    {
+        return((dataRate <= 2) ? MIN_MAX_PAYLOAD : ((3 == dataRate) ? 115 : 222));
+    }
+
+    /**
+     * @brief   Time on air of an uplink with the given application payload length at an EU868 data rate.
+     * @param   payloadLen  application payload length; the MAC header, frame header, port and MIC add 13 bytes.
+     * @param   dataRate    0 (SF12) to 5 (SF7), all at 125kHz.
+     * @retval  Time on air in microseconds.
+     * @note    From the Semtech SX1272/3 datasheet with 8 preamble symbols, explicit header, CRC,
+     *          coding rate 4/5 and low data rate optimisation at SF11 and SF12,
+     *          in integer arithmetic with the 12.25 preamble symbols counted in quarters.
+     */
+    static uint32_t getAirtimeUs(const uint8_t payloadLen, const uint8_t dataRate)
+    {
+        const uint8_t sf = 12 - ((dataRate > 5) ? 5 : dataRate);
+        const uint8_t de = (sf >= 11) ? 1 : 0;
+        const int16_t num = (8 * (13 + (int16_t)payloadLen)) - (4 * sf) + 28 + 16;
+        const int16_t den = 4 * (sf - (2 * de));
+        const uint16_t payloadSymbols = 8 + ((num > 0) ? (((num + den - 1) / den) * 5) : 0);
+        // A symbol is 2^SF / 125kHz, ie 2^SF * 8us.
+        return(((uint32_t)(49 + (4 * payloadSymbols)) << sf) * 2);
+    }
+};
+
+/**
+ * @brief   This is a class that extends OTRadioLink to communicate via LoRaWAN
+ *          using the RN2483 radio module.
+ * @param   baud    serial speed; the RN2483 autobauds after a break,
+ *          so this is limited by the serial implementation, eg 9600 with OTSoftSerial2 at 1MHz.
+ * @param   ser_t   serial type, constructed by the link; as well as the Stream interface
+ *          it must provide sendBreak() and begin(unsigned long).
+ * @param   txQueueSlots  number of frames that can be queued for TX, each taking maxTxMsgLen bytes of RAM;
+ *          when full the oldest queued frame is dropped so that the freshest is always sent.
+ * @param   coalesceTX  if true, pack as many queued frames as fit at the current data rate into each uplink,
+ *          each preceded by a length byte (as for OTSIM900Link, so split with OTSIM900Link::OTSIM900CoalescedFrameReader),
+ *          saving airtime and duty cycle budget, and a command exchange, per frame.
+ * @note    poll() never waits for the RN2483: it writes a command when none is outstanding,
+ *          and reads whatever of the responses is available.
+ *          Uplinks are only started when the duty cycle budget allows,
+ *          so the module should not need to refuse them.
+ *          Timing is from the RTC seconds, so poll() must be called at least once a minute,
+ *          and when hosted the RTC must be advanced (with OTV0P2BASE::setSeconds()) for time to pass.
+ */
+#define OTRN2483Link_DEFINED
+template<uint8_t nRstPin, uint8_t rxPin, uint8_t txPin, uint32_t baud,
+class ser_t
+#ifdef OTSoftSerial2_DEFINED
+    = OTV0P2BASE::OTSoftSerial2<rxPin, txPin, baud>
+#endif
+, uint8_t txQueueSlots = 2, bool coalesceTX = false
+>
+class OTRN2483Link final : public OTRN2483LinkBase
+{
+    static_assert(txQueueSlots > 0, "must have at least one TX slot");
+
+public:
+    // Largest frame accepted; all must fit in an uplink at any data rate, with a length byte if coalescing.
+    static const constexpr uint8_t maxTxMsgLen = coalesceTX ? (MIN_MAX_PAYLOAD - 1) : MIN_MAX_PAYLOAD;
+    static const constexpr uint8_t maxTxQueueLength = txQueueSlots;
+    // Number of default channels sharing the 1% duty cycle sub-band.
+    static const constexpr uint8_t dutyCycleChannels = 3;
+
+    OTRN2483Link() : config(NULL), bAvailable(false), state(INIT), configStep(0),
+        dataRate(
+#ifdef RN2483_ENABLE_ADR
+            ADR_MIN_DATA_RATE
+#else
+            DEFAULT_DATA_RATE
+#endif
+            ),
+        txQueueHead(0), txMessageQueue(0), txFrames(0), txPayloadLen(0),
+        lineLen(0), bWaiting(false), bSecondLine(false), waitedS(0), timeoutS(0), lastSecondsLT(0)
+    {
+        memset(txMsgLen, 0, sizeof(txMsgLen));
+    }
+
+    virtual void preinit(const void */*preconfig*/) override { }
+    /**
+     * @brief   Starts the serial port; the module is configured and joined by poll().
+     */
+    virtual bool begin() override
+    {
+#ifdef ARDUINO_ARCH_AVR
+        // init resetPin
+        pinMode(nRstPin, INPUT);    // TODO This is shorting on my board
+#endif
+        ser.begin(baud);
+        state = INIT;
+        bWaiting = false;
+        bAvailable = false;
+        lastSecondsLT = OTV0P2BASE::getSecondsLT();
+        scheduler.reset();
+        return true;
+    }
+    /**
+     * @brief   End LoRaWAN connection
+     */
+    virtual bool end() override { return true; }
+
+    /**
+     * @brief   Queues a raw frame to send; it is sent by poll().
+     * @param   buf Send buffer.
+     */
+    virtual bool sendRaw(const uint8_t *buf, uint8_t buflen, int8_t channel = 0, TXpower power = TXnormal, bool /*listenAfter*/ = false) override
+    {
+        return queueToSend(buf, buflen, channel, power);
+    }
+    /**
+     * @brief   Puts a frame in the queue to send.
+     * @retval  false if the frame is too long,
+     *          or if the queue is full and the oldest frame is being sent, else true.
+     * @note    If the queue is full the oldest frame is dropped, ensuring the freshest is sent.
+     */
+    virtual bool queueToSend(const uint8_t *buf, uint8_t buflen, int8_t /*channel*/ = 0, TXpower /*power*/ = TXnormal) override
+    {
+        if((NULL == buf) || (0 == buflen) || (buflen > maxTxMsgLen)) { return false; } // FAIL
+        if(txMessageQueue >= maxTxQueueLength)
+        {
+            if(0 != txFrames) { return false; } // FAIL
+            popTXQueue();
+        }
+        const uint8_t slot = (txQueueHead + txMessageQueue) % maxTxQueueLength;
+        memcpy(txQueue[slot], buf, buflen);
+        txMsgLen[slot] = buflen;
+        ++txMessageQueue;
+        return true;
+    }
+    /**
+     * @brief   Number of frames currently queued for TX, including any being sent.
+     */
+    uint8_t getTXMsgsQueued() const { return(txMessageQueue); }
+    // checks radio is there independant of power state, ie configured and joined.
+    virtual bool isAvailable() const override { return bAvailable; }
+    virtual bool handleInterruptSimple() override { return true; }
+
+    /**
+     * @brief   Steps the state machine, sending queued frames as the duty cycle allows.
+     * @note    Writes at most one command (and uplink) and reads at most maxBytesPerPoll bytes.
+     */
+    virtual void poll() override
+    {
+        const uint8_t s = OTV0P2BASE::getSecondsLT();
+        const uint8_t elapsedS = (s >= lastSecondsLT) ? (s - lastSecondsLT) : (60 + s - lastSecondsLT);
+        lastSecondsLT = s;
+        scheduler.tick(elapsedS);
+        if(bWaiting) { waitedS = ((uint16_t)waitedS + elapsedS > 0xff) ? 0xff : (waitedS + elapsedS); }
+        else { step(); }
+        for(uint8_t budget = maxBytesPerPoll; bWaiting && (budget > 0); --budget)
+        {
+            const int c = ser.read();
+            if(c < 0) { break; }
+            if('\r' == c) { continue; }
+            if('\n' != c) { if(lineLen < MAX_LINE_CHARS) { line[lineLen++] = (char)c; } continue; }
+            if(0 == lineLen) { continue; }
+            line[lineLen] = '\0';
+            lineLen = 0;
+            onLine();
+        }
+        if(bWaiting && (waitedS > timeoutS)) { onTimeout(); }
+    }
+    virtual void getCapacity(uint8_t &queueRXMsgsMin, uint8_t &maxRXMsgLen, uint8_t &maxTXMsgLen) const override
+    {
+        queueRXMsgsMin = 0;
+        maxRXMsgLen = 0;
+        maxTXMsgLen = maxTxMsgLen;
+    }
+    virtual uint8_t getRXMsgsQueued() const override { return 0; }
+    virtual const volatile uint8_t *peekRXMsg() const override { return NULL; }
+    virtual void removeRXMsg() override { }
+
+    /**
+     * @brief   Data rate used for the next uplink, as set or (with ADR) as last read from the module.
+     */
+    uint8_t getDataRate() const { return(dataRate); }
+    /**
+     * @brief   Seconds until the duty cycle budget allows another uplink.
+     */
+    uint16_t getDutyCycleWaitS() const { return(scheduler.getWaitS()); }
+    // For testing.
+    OTRN2483LinkState _getState() const { return(state); }
+
+private:
+    // Maximum response bytes read in one poll(), to bound its time.
+    static const constexpr uint8_t maxBytesPerPoll = 64;
+    // Significant chars of a response line kept.
+    static const constexpr uint8_t MAX_LINE_CHARS = 16;
+    // Seconds to wait for a response to a command.
+    static const constexpr uint8_t commandTimeoutS = 3;
+    // Seconds to wait for an uplink to complete, including time on air and both receive windows.
+    static const constexpr uint8_t txTimeoutS = 15;
+    // Seconds to hold off if the module finds no free channel.
+    static const constexpr uint16_t noFreeChannelHoldOffS = 10;
+#ifndef RN2483_CONFIG_IN_EEPROM
+    // Number of commands written in CONFIGURE.
+#ifdef RN2483_ENABLE_ADR
+    static const constexpr uint8_t configCommands = 7;
+#else
+    static const constexpr uint8_t configCommands = 4;
+#endif // RN2483_ENABLE_ADR
+#endif // RN2483_CONFIG_IN_EEPROM
+#ifdef RN2483_ALLOW_SLEEP
+    // Sleep time requested, ms; the module is woken early to send.
+    static const constexpr uint32_t sleepMs = 300000; // FIXME sleeps for 5 mins
+#endif // RN2483_ALLOW_SLEEP
+
+    const OTRN2483LinkConfig *config;  // Pointer to radio config
+    ser_t ser;
+    bool bAvailable;
+    OTRN2483LinkState state;
+    uint8_t configStep; // Next command in CONFIGURE.
+    uint8_t dataRate;
+
+    // TX ring buffer, oldest frame at txQueueHead.
+    uint8_t txQueue[txQueueSlots][maxTxMsgLen];
+    uint8_t txMsgLen[txQueueSlots];
+    uint8_t txQueueHead;
+    volatile uint8_t txMessageQueue; // Number of frames currently queued for TX.
+    uint8_t txFrames; // Frames from the head of the queue in the uplink being sent, else 0.
+    uint8_t txPayloadLen; // Application payload length of the uplink being sent.
+    OTRN2483DutyCycleScheduler<dutyCycleChannels> scheduler;
+
+    // Response line being read.
+    char line[MAX_LINE_CHARS + 1];
+    uint8_t lineLen;
+    // True while waiting for a response; bSecondLine once 'ok' has been had for a command with a second response.
+    bool bWaiting;
+    bool bSecondLine;
+    uint8_t waitedS;
+    uint8_t timeoutS;
+    uint8_t lastSecondsLT;
+
+    // Note that a command has been written and wait for its response.
+    void startWaiting(const uint8_t t)
+    {
+        bWaiting = true;
+        bSecondLine = false;
+        waitedS = 0;
+        timeoutS = t;
+        lineLen = 0;
+    }
+
+    // Write the next command if any for the current state.
+    void step()
+    {
+        switch(state)
+        {
+        case INIT:
+            // Break and sync char for autobaud, then straight on with the first command.
+            ser.sendBreak();
+            ser.print('U');
+            configStep = 0;
+            state = CONFIGURE;
+            // Fall through.
+        case CONFIGURE:
+            if(writeConfigCommand(configStep)) { startWaiting(commandTimeoutS); break; }
+            state = JOIN;
+            // Fall through.
+        case JOIN:
+            ser.print(MAC_START);
+            ser.print(MAC_JOINABP); // Join by ABP (activation by personalisation)
+            ser.print(RN2483_END);
+            startWaiting(commandTimeoutS);
+            break;
+        case IDLE:
+            if(0 == txMessageQueue)
+            {
+#ifdef RN2483_ALLOW_SLEEP
+                ser.print(SYS_START);
+                ser.print(SYS_SLEEP);
+                ser.print((unsigned long)sleepMs);
+                ser.print(RN2483_END);
+                state = ASLEEP;
+#endif // RN2483_ALLOW_SLEEP
+                break;
+            }
+            if(!scheduler.canSend()) { break; }
+            writeUplink();
+            state = SENDING;
+            startWaiting(commandTimeoutS);
+            break;
+        case GET_DATA_RATE:
+            ser.print(MAC_START);
+            ser.print(RN2483_GET);
+            ser.print(MAC_GET_DR);
+            ser.print(RN2483_END);
+            startWaiting(commandTimeoutS);
+            break;
+        case ASLEEP:
+            if((0 == txMessageQueue) || !scheduler.canSend()) { break; }
+            // A break wakes the module, which then completes the sleep command.
+            ser.sendBreak();
+            ser.print('U');
+            state = WAKING;
+            startWaiting(commandTimeoutS);
+            break;
+        default:
+            break;
+        }
+    }
+
+    // Handle a complete response line.
+    void onLine()
+    {
+        const bool ok = (0 == strcmp(line, "ok"));
+        switch(state)
+        {
+        case CONFIGURE:
+            bWaiting = false;
+            if(ok) { ++configStep; }
+            else { fail(); }
+            break;
+        case JOIN:
+            if(ok && !bSecondLine) { bSecondLine = true; break; }
+            bWaiting = false;
+            if(bSecondLine && (0 == strcmp(line, "accepted")))
+            {
+                bAvailable = true;
+#ifdef RN2483_ENABLE_ADR
+                state = GET_DATA_RATE;
+#else
+                state = IDLE;
+#endif // RN2483_ENABLE_ADR
+            }
+            else { fail(); }
+            break;
+        case SENDING:
+            if(!bSecondLine)
+            {
+                if(ok)
+                {
+                    // Transmitting now; expect mac_tx_ok, mac_rx or mac_err once done.
+                    scheduler.sent(getAirtimeUs(txPayloadLen, dataRate));
+                    bSecondLine = true;
+                    timeoutS = txTimeoutS;
+                    break;
+                }
+                bWaiting = false;
+                txFrames = 0;
+                state = IDLE;
+                if(0 == strcmp(line, "no_free_ch")) { scheduler.holdOff(noFreeChannelHoldOffS); }
+                else if(0 == strcmp(line, "not_joined")) { state = JOIN; }
+                else if(0 != strcmp(line, "busy")) { dropUplink(); } // eg invalid_data_len: will never go.
+                break;
+            }
+            // Frames are removed from the queue once the uplink completes, whether or not successfully.
+            bWaiting = false;
+            dropUplink();
+#ifdef RN2483_ENABLE_ADR
+            state = GET_DATA_RATE; // Any downlink may have changed the data rate.
+#else
+            state = IDLE;
+#endif // RN2483_ENABLE_ADR
+            break;
+        case GET_DATA_RATE:
+            bWaiting = false;
+            if((line[0] >= '0') && (line[0] <= '5') && ('\0' == line[1])) { dataRate = line[0] - '0'; }
+            state = IDLE;
+            break;
+        case WAKING:
+            bWaiting = false;
+            state = IDLE;
+            break;
+        default:
+            bWaiting = false;
+            break;
+        }
+    }
+
+    // Handle a missing response.
+    void onTimeout()
+    {
+        bWaiting = false;
+        // Frames not known to have been sent are kept.
+        txFrames = 0;
+        // No response from a waking module is OK, eg if it had woken already.
+        if(WAKING == state) { state = IDLE; }
+        else { fail(); }
+    }
+
+    // Start again from autobaud and configuration.
+    void fail()
+    {
+        bAvailable = false;
+        txFrames = 0;
+        state = INIT;
+    }
+
+    // Write configuration command n; false once all written.
+    bool writeConfigCommand(const uint8_t n)
+    {
+#ifndef RN2483_CONFIG_IN_EEPROM
+        if(n >= configCommands) { return false; }
+        ser.print(MAC_START);
+        ser.print(RN2483_SET);
+        switch(n)
+        {
+        case 0:
+            ser.print(MAC_DEVADDR);
+            ser.print(DEV_ADDR);
+            break;
+        case 1:
+            ser.print(MAC_APPSKEY);
+            ser.print(APP_SKEY);
+            break;
+        case 2:
+            ser.print(MAC_NWKSKEY);
+            ser.print(NWK_SKEY);
+            break;
+#ifdef RN2483_ENABLE_ADR
+        // Command reference does not mention this, but adr must be set to on
+        // AND channel data rate ranges must be set, on the 3 default channels.
+        case 3: case 4: case 5:
+            ser.print(MAC_SET_CH);
+            ser.print(MAC_SET_DRRANGE);
+            ser.print((char)('0' + n - 3));
+            ser.print(' ');
+            ser.print((char)('0' + ADR_MIN_DATA_RATE));
+            ser.print(' ');
+            ser.print((char)('0' + ADR_MAX_DATA_RATE));
+            break;
+        case 6:
+            ser.print(MAC_ADR); // Adaptive data rate
+            break;
+#else
+        case 3:
+            ser.print(MAC_SET_DR);
+            ser.print((char)('0' + DEFAULT_DATA_RATE));
+            break;
+#endif // RN2483_ENABLE_ADR
+        default:
+            break;
+        }
+        ser.print(RN2483_END);
+        return true;
+#else
+        (void)n;
+        return false;
+#endif // RN2483_CONFIG_IN_EEPROM
+    }
+
+    // Write an uplink of the frame at the head of the queue, or as many as fit if coalescing.
+    void writeUplink()
+    {
+        txFrames = 0;
+        txPayloadLen = 0;
+        if(coalesceTX)
+        {
+            const uint8_t maxPayload = getMaxPayload(dataRate);
+            while(txFrames < txMessageQueue)
+            {
+                const uint8_t len = txMsgLen[(txQueueHead + txFrames) % maxTxQueueLength] + 1;
+                if(txPayloadLen + len > maxPayload) { break; }
+                txPayloadLen += len;
+                ++txFrames;
+            }
+        }
+        else
+        {
+            txFrames = 1;
+            txPayloadLen = txMsgLen[txQueueHead];
+        }
+        // Frames are converted to hex as written, to avoid a buffer.
+        ser.print(MAC_START);
+        ser.print(MAC_SEND);
+        for(uint8_t i = 0; i < txFrames; ++i)
+        {
+            const uint8_t slot = (txQueueHead + i) % maxTxQueueLength;
+            if(coalesceTX) { printHex(txMsgLen[slot]); }
+            for(uint8_t j = 0; j < txMsgLen[slot]; ++j) { printHex(txQueue[slot][j]); }
+        }
+        ser.print(RN2483_END);
+    }
+
+    // Remove the frames of the uplink just sent from the queue.
+    void dropUplink()
+    {
+        while(txFrames > 0)
+        {
+            popTXQueue();
+            --txFrames;
+        }
+    }
+
+    // Remove the oldest frame from the queue, if any.
+    void popTXQueue()
+    {
+        if(0 == txMessageQueue) { return; }
+        txQueueHead = (txQueueHead + 1) % maxTxQueueLength;
+        --txMessageQueue;
+    }
+
+    // Print a byte as two upper-case hex digits, as the RN2483 takes numbers as HEX values.
+    void printHex(const uint8_t b)
+    {
+        const uint8_t h = b >> 4, l = b & 0xf;
+        ser.print((char)((h <= 9) ? ('0' + h) : ('A' - 10 + h)));
+        ser.print((char)((l <= 9) ? ('0' + l) : ('A' - 10 + l)));
+    }
+
+    // Setup: config is optional as the LoRaWAN settings are currently built in.
+    virtual bool _doconfig() override
+    {
+        if(NULL != channelConfig->config) { config = (const OTRN2483LinkConfig_t *) channelConfig->config; }
+        return true;
+    }
+
     /**
      * @brief   Unused. For compatibility with OTRadioLink.
      */
-    void _dolisten() {};
+    virtual void _dolisten() override { }
 };
-#endif // ARDUINO_ARCH_AVR
 
 
 } // namespace OTRN2483Link
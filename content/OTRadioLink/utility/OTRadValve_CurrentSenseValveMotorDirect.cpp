@@ -47,10 +47,12 @@ void CurrentSenseValveMotorDirect::signalRunSCTTick(const bool opening)
     if(!opening)
       {
       if(ticksFromOpen < MAX_TICKS_FROM_OPEN) { ++ticksFromOpen; }
+      if(ticksClosingSinceEndStop < MAX_TICKS_FROM_OPEN) { ++ticksClosingSinceEndStop; }
       }
     else
       {
       if(ticksReverse < MAX_TICKS_FROM_OPEN) { ++ticksReverse; }
+      if(ticksOpeningSinceEndStop < MAX_TICKS_FROM_OPEN) { ++ticksOpeningSinceEndStop; }
       }
     }
   }
@@ -65,17 +67,23 @@ bool CurrentSenseValveMotorDirect::CalibrationParameters::updateAndCompute(
   {
   ticksFromOpenToClosed = _ticksFromOpenToClosed;
   ticksFromClosedToOpen = _ticksFromClosedToOpen;
+  return(compute(minMotorDRTicks));
+  }
 
+// Compute derived parameters from the current ticks each way.
+// Returns false if they are unusable, though will still try to compute all values.
+bool CurrentSenseValveMotorDirect::CalibrationParameters::compute(const uint8_t minMotorDRTicks)
+  {
   // Compute approx precision in % as min ticks / DR size in range [0,100].
   // Inflate estimate slightly to allow for inertia, etc.
-  const uint16_t minticks = OTV0P2BASE::fnmin(_ticksFromOpenToClosed, _ticksFromClosedToOpen);
+  const uint16_t minticks = OTV0P2BASE::fnmax((uint16_t)1, OTV0P2BASE::fnmin(ticksFromOpenToClosed, ticksFromClosedToOpen));
   approxPrecisionPC = (uint8_t) OTV0P2BASE::fnmin(100UL, (128UL*minMotorDRTicks) / minticks);
 
   // Compute a small conversion ratio back and forth
   // which does not add too much error but allows single dead-reckoning steps
   // to be converted back and forth.
-  uint16_t tfotc = _ticksFromOpenToClosed;
-  uint16_t tfcto = _ticksFromClosedToOpen;
+  uint16_t tfotc = ticksFromOpenToClosed;
+  uint16_t tfcto = ticksFromClosedToOpen;
   while(OTV0P2BASE::fnmax(tfotc, tfcto) > minMotorDRTicks)
     {
     tfotc >>= 1;
@@ -93,6 +101,62 @@ bool CurrentSenseValveMotorDirect::CalibrationParameters::updateAndCompute(
   return(true);
   }
 
+// True if travel estimate est is within the permitted error of the modelled travel.
+static bool endStopEstimatePlausible(const int32_t est, const int32_t model)
+  {
+  const int32_t maxErr = model >> CurrentSenseValveMotorDirect::CalibrationParameters::MAX_END_STOP_ERROR_SHIFT;
+  return((est <= model + maxErr) && (est >= model - maxErr));
+  }
+
+// Refine the ticks each way from an end-stop hit, given the raw ticks run in each direction
+// since the previous end-stop hit (at the open end iff fromOpen), and recompute derived parameters.
+// Estimates are folded in with a simple exponential moving average,
+// with weight 1/2 for a clean run to the other end-stop, else 1/4,
+// so that a single slightly-off hit (eg from overrun within a dead-reckoning pulse) has limited effect.
+bool CurrentSenseValveMotorDirect::CalibrationParameters::updateFromEndStop(
+    const bool fromOpen, const bool hitOpen, const uint16_t ticksClosing, const uint16_t ticksOpening, const uint8_t minMotorDRTicks)
+  {
+  const int32_t tc = ticksFromOpenToClosed;
+  const int32_t to = ticksFromClosedToOpen;
+  if((0 == tc) || (0 == to)) { return(false); } // FAIL: not calibrated.
+  int32_t newTC = tc, newTO = to;
+  if(fromOpen == hitOpen)
+    {
+    // Back at the same end-stop: ticks each way represent the same travel.
+    // Too little travel each way to learn from reliably.
+    if((ticksClosing < (tc >> 2)) || (ticksOpening < (to >> 2))) { return(true); }
+    const int32_t estTO = (int32_t)((((uint32_t)ticksOpening * (uint32_t)tc) + (ticksClosing >> 1)) / ticksClosing);
+    if(!endStopEstimatePlausible(estTO, to)) { return(false); } // FAIL
+    newTO = to + ((estTO - to) / 4);
+    }
+  else if(!hitOpen)
+    {
+    // Closed end-stop reached from open: closing ticks less any opening ticks at the current ratio.
+    const int32_t estTC = (int32_t)ticksClosing - (int32_t)((((uint32_t)ticksOpening * (uint32_t)tc) + (to >> 1)) / (uint32_t)to);
+    if(!endStopEstimatePlausible(estTC, tc)) { return(false); } // FAIL
+    newTC = OTV0P2BASE::fnmin((int32_t)MAX_TICKS_FROM_OPEN, tc + ((estTC - tc) / ((0 == ticksOpening) ? 2 : 4)));
+    newTO = (int32_t)((((uint32_t)to * (uint32_t)newTC) + (tc >> 1)) / (uint32_t)tc);
+    }
+  else
+    {
+    // Open end-stop reached from closed: opening ticks less any closing ticks at the current ratio.
+    const int32_t estTO = (int32_t)ticksOpening - (int32_t)((((uint32_t)ticksClosing * (uint32_t)to) + (tc >> 1)) / (uint32_t)tc);
+    if(!endStopEstimatePlausible(estTO, to)) { return(false); } // FAIL
+    newTO = OTV0P2BASE::fnmin((int32_t)MAX_TICKS_FROM_OPEN, to + ((estTO - to) / ((0 == ticksClosing) ? 2 : 4)));
+    newTC = (int32_t)((((uint32_t)tc * (uint32_t)newTO) + (to >> 1)) / (uint32_t)to);
+    }
+  newTC = OTV0P2BASE::fnmin((int32_t)MAX_TICKS_FROM_OPEN, newTC);
+  newTO = OTV0P2BASE::fnmin((int32_t)MAX_TICKS_FROM_OPEN, newTO);
+  ticksFromOpenToClosed = (uint16_t)newTC;
+  ticksFromClosedToOpen = (uint16_t)newTO;
+  if(compute(minMotorDRTicks)) { return(true); }
+  // Back out an update that leaves the parameters unusable.
+  ticksFromOpenToClosed = (uint16_t)tc;
+  ticksFromClosedToOpen = (uint16_t)to;
+  compute(minMotorDRTicks);
+  return(false); // FAIL
+  }
+
 // Compute reconciliation/adjustment of ticks, and compute % position [0,100].
 // Reconcile any reverse ticks (and adjust with forward ticks if needed).
 // Call after moving the valve in normal mode.
@@ -122,6 +186,30 @@ uint8_t CurrentSenseValveMotorDirect::CalibrationParameters::computePosition(
   return((uint8_t) (((ticksFromOpenToClosed - ticksFromOpen) * 100UL) / ticksFromOpenToClosed));
   }
 
+// Reset internal position markers when an end-stop is hit.
+// First refines the calibration from the travel since the previous end-stop hit, if any,
+// noting a tracking error if that travel was implausible.
+// Also completes any partial recalibration (re-homing).
+void CurrentSenseValveMotorDirect::resetPosition(const bool hitEndstopOpen, const bool tentative)
+    {
+    if(!needsRecalibrating && endStopHitSinceCalibration)
+      {
+      if(!cp.updateFromEndStop(lastEndStopOpen, hitEndstopOpen, ticksClosingSinceEndStop, ticksOpeningSinceEndStop, minMotorDRTicks))
+        { reportTrackingError(); }
+      // A plausible run from the other end-stop shows that tracking is good.
+      else if(lastEndStopOpen != hitEndstopOpen)
+        { trackingErrors = 0; }
+      }
+    resetCurrentPC(hitEndstopOpen, tentative);
+    ticksReverse = 0;
+    ticksFromOpen = hitEndstopOpen ? 0 : cp.getTicksFromOpenToClosed();
+    ticksClosingSinceEndStop = 0;
+    ticksOpeningSinceEndStop = 0;
+    lastEndStopOpen = hitEndstopOpen;
+    endStopHitSinceCalibration = true;
+    needsRehoming = false;
+    }
+
 // Get estimated minimum percentage open for significant flow for this device; strictly positive in range [1,99].
 uint8_t CurrentSenseValveMotorDirect::getMinPercentOpen() const
     {
@@ -166,6 +254,7 @@ bool CurrentSenseValveMotorDirectBinaryOnly::runFastTowardsEndStop(const bool to
   // If end-stop not hit, return false now.
   if(!endStopDetected) { return(false); }
   // Attempt another short pulse to finish the job if there is time.
+  if(getSubCycleTimeFn() > computeSctAbsLimitDR()) { return(true); }
   return(runTowardsEndStop(toOpen));
   }
 
@@ -176,6 +265,9 @@ bool CurrentSenseValveMotorDirectBinaryOnly::runFastTowardsEndStop(const bool to
 // Returns true if end-stop has apparently been hit.
 bool CurrentSenseValveMotorDirectBinaryOnly::runTowardsEndStop(const bool toOpen)
   {
+  // Don't start if there is not time for the run in this sub-cycle,
+  // since the driver may sleep before starting or after stopping on change of direction.
+  if(getSubCycleTimeFn() > computeSctAbsLimitDR()) { return(false); }
   // Clear the end-stop detection flag ready.
   endStopDetected = false;
   // Run motor for fixed time.
@@ -394,6 +486,8 @@ bool CurrentSenseValveMotorDirect::do_valveCalibrating_prop()
     {
     // Note that (re)calibration is needed / in progress.
     needsRecalibrating = true;
+    // Travel before (re)calibration completes is not used to refine it.
+    endStopHitSinceCalibration = false;
 
     // Defer calibration if doing it now would be a bad idea, eg in a bedroom at night.
     if(shouldDeferCalibration())
@@ -509,6 +603,8 @@ OTV0P2BASE::serialPrintlnAndFlush();
 
         // Move to normal valve running state...
         needsRecalibrating = false;
+        needsRehoming = false;
+        trackingErrors = 0;
         resetPosition(true); // Valve is currently fully open.
         changeState(valveNormal);
         return(true);
@@ -543,6 +639,21 @@ bool CurrentSenseValveMotorDirect::do_valveNormal_prop()
     if(inNonProprtionalMode())
         { return(false); } // Fall through.
 
+    // Ask for partial recalibration (re-homing)
+    // once dead-reckoning error may have built up from much travel since the last end-stop hit.
+    if(((uint32_t)ticksClosingSinceEndStop + ticksOpeningSinceEndStop) >
+       (2 * ((uint32_t)cp.getTicksFromOpenToClosed() + cp.getTicksFromClosedToOpen())))
+        { needsRehoming = true; }
+
+    // Partial recalibration: run fast to the nearer end-stop,
+    // refining the calibration on the way, and then resume tracking the target.
+    if(needsRehoming)
+      {
+      const bool toOpen = (currentPC >= 50);
+      if(runFastTowardsEndStop(toOpen)) { resetPosition(toOpen); }
+      return(true); // Leave poll().
+      }
+
     // If the desired target is close to either end
     // then fall back to non-prop behaviour and hit the end stops (fast) instead.
     // Makes ends 'sticky' and allows for some light-weight recalibration to scale ends.
@@ -565,15 +676,9 @@ bool CurrentSenseValveMotorDirect::do_valveNormal_prop()
       const bool hitEndStop = runTowardsEndStop(true);
       recomputePosition();
       // Hit the end-stop, possibly prematurely.
-      if(hitEndStop)
-        {
-        // Report serious tracking error (well before 'fairly open' %).
-        if(currentPC < OTV0P2BASE::fnmin(fairlyOpenPC, (uint8_t)(100 - 8*eps)))
-          { reportTrackingError(); }
-        // Silently auto-adjust when end-stop hit close to expected position.
-        else
-          { resetPosition(true); }
-        }
+      // Re-home there and refine the calibration from the travel since the last end-stop,
+      // which reports a tracking error if the end-stop was hit far from the expected position.
+      if(hitEndStop) { resetPosition(true); }
 #if 0 && defined(V0P2BASE_DEBUG)
 V0P2BASE_DEBUG_SERIAL_PRINTLN_FLASHSTRING("->");
 #endif
@@ -585,14 +690,9 @@ V0P2BASE_DEBUG_SERIAL_PRINTLN_FLASHSTRING("->");
       const bool hitEndStop = runTowardsEndStop(false);
       recomputePosition();
       // Hit the end-stop, possibly prematurely.
-      if(hitEndStop)
-        {
-        // Report serious tracking error.
-        if(currentPC > OTV0P2BASE::fnmax(2*minOpenPC, 8*eps))
-          { reportTrackingError(); }
-        // Silently auto-adjust when end-stop hit close to expected position.
-        else { resetPosition(false); }
-        }
+      // Re-home there and refine the calibration from the travel since the last end-stop,
+      // which reports a tracking error if the end-stop was hit far from the expected position.
+      if(hitEndStop) { resetPosition(false); }
 #if 0 && defined(V0P2BASE_DEBUG)
 V0P2BASE_DEBUG_SERIAL_PRINTLN_FLASHSTRING("-<");
 #endif
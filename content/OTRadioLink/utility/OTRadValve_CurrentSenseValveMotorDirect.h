@@ -360,13 +360,36 @@ class CurrentSenseValveMotorDirect final : public CurrentSenseValveMotorDirectBi
           // A reduced ticks open/closed in ratio to allow small conversions.
           uint8_t tfotcSmall = 0, tfctoSmall = 0;
 
+          // Compute derived parameters from the current ticks each way.
+          // Returns false if they are unusable.
+          bool compute(uint8_t minMotorDRTicks);
+
         public:
+          // Maximum error in travel implied by an end-stop hit for the model to be refined from it,
+          // as a right shift of the modelled travel, ie 2 is 25%.
+          // Larger apparent errors suggest an obstruction or slip, or a missed end-stop.
+          static const constexpr uint8_t MAX_END_STOP_ERROR_SHIFT = 2;
+
           // (Re)populate structure and compute derived parameters.
           // Ensures that all necessary items are gathered at once and none forgotten!
           // Returns true in case of success.
           // May return false and force error state if inputs unusable.
           bool updateAndCompute(uint16_t ticksFromOpenToClosed, uint16_t ticksFromClosedToOpen, uint8_t minMotorDRTicks);
 
+          // Refine the ticks each way from an end-stop hit, given the raw ticks run in each direction
+          // since the previous end-stop hit (at the open end iff fromOpen), and recompute derived parameters.
+          // Allows tracking of slow changes such as slowing with battery voltage droop without full recalibration.
+          //   * Hitting the other end-stop gives the full travel in the direction of the hit
+          //     (taking the current ratio between directions to back out any reverse ticks)
+          //     and both directions are scaled to match;
+          //     a clean run in one direction is given more weight than one with reversals.
+          //   * Returning to the same end-stop after substantial travel both ways
+          //     gives the ratio between directions, and opening ticks are adjusted to match.
+          // Partial moves between end-stops contribute through the ticks accumulated.
+          // Returns false, leaving the model unchanged, if the travel implied is implausible;
+          // returns true otherwise, including when there is too little travel to learn from.
+          bool updateFromEndStop(bool fromOpen, bool hitOpen, uint16_t ticksClosing, uint16_t ticksOpening, uint8_t minMotorDRTicks);
+
           // Get a ticks either way.
           inline uint16_t getTicksFromOpenToClosed() const { return(ticksFromOpenToClosed); }
           inline uint16_t getTicksFromClosedToOpen() const { return(ticksFromClosedToOpen); }
@@ -393,13 +416,22 @@ class CurrentSenseValveMotorDirect final : public CurrentSenseValveMotorDirectBi
     CalibrationParameters cp;
 
     // Set when valve needs (re)calibration, eg because dead-reckoning found to be significantly wrong.
-    // May also need recalibrating after (say) a few weeks to allow for battery/speed droop.
-    // Possibly ignore tracking errors for a minimum interval.
+    // Battery/speed droop is tracked from end-stop hits so should not need full recalibration.
     // May simply switch to 'binary' on/off mode if the calibration is off.
     bool needsRecalibrating = true;
 
-    // Report an apparent serious tracking error that may need full recalibration.
-    void reportTrackingError() { needsRecalibrating = true; }
+    // Set when a partial recalibration is needed, ie re-homing to the nearer end-stop,
+    // eg after much dead-reckoning since the last end-stop hit.
+    // Much quicker and quieter than a full recalibration.
+    bool needsRehoming = false;
+
+    // Consecutive implausible end-stop hits; full recalibration is forced at MAX_TRACKING_ERRORS.
+    uint8_t trackingErrors = 0;
+    // Implausible end-stop hits in a row that force full recalibration; strictly positive.
+    static const constexpr uint8_t MAX_TRACKING_ERRORS = 3;
+
+    // Report an apparent serious tracking error, forcing full recalibration if persistent.
+    void reportTrackingError() { if(++trackingErrors >= MAX_TRACKING_ERRORS) { needsRecalibrating = true; } }
 
     // Current sub-cycle ticks from fully-open (reference) end of travel, towards fully closed.
     // This is nominally ticks in the open-to-closed direction
@@ -414,6 +446,16 @@ class CurrentSenseValveMotorDirect final : public CurrentSenseValveMotorDirectBi
     // Maximum permitted value of ticksFromOpen (and ticksReverse).
     static const uint16_t MAX_TICKS_FROM_OPEN = ~0;
 
+    // Raw ticks run in each direction since the last end-stop hit, to refine the calibration.
+    // Saturate at MAX_TICKS_FROM_OPEN.
+    // ISR-/thread- safe with a mutex.
+    volatile uint16_t ticksClosingSinceEndStop = 0;
+    volatile uint16_t ticksOpeningSinceEndStop = 0;
+    // True if the last end-stop hit was at the open end.
+    bool lastEndStopOpen = true;
+    // True once an end-stop has been hit since (re)calibration, so ticks since then are meaningful.
+    bool endStopHitSinceCalibration = false;
+
     // True if using positional encoder, else using crude dead-reckoning.
     // Only defined once calibration is complete.
     bool usingPositionalEncoder() const { return(false); }
@@ -425,12 +467,8 @@ class CurrentSenseValveMotorDirect final : public CurrentSenseValveMotorDirectBi
     virtual void recomputePosition() override { if(!needsRecalibrating) { currentPC = cp.computePosition(ticksFromOpen, ticksReverse); } }
 
     // Reset internal position markers when an end-stop is hit.
-    virtual void resetPosition(const bool hitEndstopOpen, bool tentative = false) override
-        {
-        resetCurrentPC(hitEndstopOpen, tentative);
-        ticksReverse = 0;
-        ticksFromOpen = hitEndstopOpen ? 0 : cp.getTicksFromOpenToClosed();
-        }
+    // First refines the calibration from the travel since the previous end-stop hit, if any.
+    virtual void resetPosition(bool hitEndstopOpen, bool tentative = false) override;
 
   protected:
     // Do valveCalibrating for proportional drive; returns true to return from poll() immediately.
@@ -474,6 +512,14 @@ class CurrentSenseValveMotorDirect final : public CurrentSenseValveMotorDirectBi
     // If true, proportional mode is not being used and the valve is run to end stops instead.
     // Primarily public to allow whitebox unit testing.
     bool inNonProprtionalMode() const { return(needsRecalibrating); }
+
+    // True if a partial recalibration (re-homing to an end-stop) is pending or in progress.
+    // Primarily public to allow whitebox unit testing.
+    bool isRehoming() const { return(needsRehoming); }
+
+    // Get the calibration parameters as refined in use.
+    // Primarily public to allow whitebox unit testing.
+    const CalibrationParameters &getCalibrationParameters() const { return(cp); }
   };
 
 
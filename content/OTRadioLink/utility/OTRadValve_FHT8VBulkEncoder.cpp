@@ -0,0 +1,62 @@
+/*
+The OpenTRV project licenses this file to you
+under the Apache Licence, Version 2.0 (the "Licence");
+you may not use this file except in compliance
+with the Licence. You may obtain a copy of the Licence at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing,
+software distributed under the Licence is distributed on an
+"AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+KIND, either express or implied. See the Licence for the
+specific language governing permissions and limitations
+under the Licence.
+
+Author(s) / Copyright (s): Damon Hart-Davis 2016
+*/
+
+/*
+ * Hosted bulk pre-encoding of FHT8V valve-set commands for many house codes.
+ */
+
+#ifndef ARDUINO_ARCH_AVR
+
+#include "OTRadValve_FHT8VBulkEncoder.h"
+
+
+// Use namespaces to help avoid collisions.
+namespace OTRadValve
+    {
+
+
+constexpr uint8_t FHT8VBulkEncoder::VALVE_SET_CMD;
+constexpr uint8_t FHT8VBulkEncoder::SLOT_SIZE;
+
+// Encode all valve-set commands for the given house code, returning its index for getFrame() and emit().
+size_t FHT8VBulkEncoder::addHouseCode(const uint8_t hc1, const uint8_t hc2)
+  {
+  const size_t index = getHouseCodeCount();
+  frames.resize((index + 1) * 256 * SLOT_SIZE);
+  lengths.resize((index + 1) * 256);
+  FHT8VRadValveUtil::fht8v_msg_t command;
+  command.hc1 = hc1;
+  command.hc2 = hc2;
+#ifdef OTV0P2BASE_FHT8V_ADR_USED
+  command.address = 0;
+#endif
+  command.command = VALVE_SET_CMD;
+  for(int v = 0; v <= 255; ++v)
+    {
+    const size_t slot = (index << 8) | v;
+    uint8_t *const f = &frames[slot * SLOT_SIZE];
+    command.extension = (uint8_t)v;
+    lengths[slot] = (uint8_t)(FHT8VRadValveUtil::FHT8VCreate200usBitStreamBptr(f, &command) - f);
+    }
+  return(index);
+  }
+
+
+    }
+
+#endif // ARDUINO_ARCH_AVR
@@ -0,0 +1,102 @@
+/*
+The OpenTRV project licenses this file to you
+under the Apache Licence, Version 2.0 (the "Licence");
+you may not use this file except in compliance
+with the Licence. You may obtain a copy of the Licence at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing,
+software distributed under the Licence is distributed on an
+"AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+KIND, either express or implied. See the Licence for the
+specific language governing permissions and limitations
+under the Licence.
+
+Author(s) / Copyright (s): Damon Hart-Davis 2016
+*/
+
+/*
+ * Hosted bulk pre-encoding of FHT8V valve-set commands for many house codes,
+ * eg for a controller driving many FHT8V valves,
+ * so that each command can be emitted with a memcpy() rather than re-encoded.
+ *
+ * Not for AVR: uses heap allocation.
+ */
+
+#ifndef ARDUINO_LIB_OTRADVALVE_FHT8VBULKENCODER_H
+#define ARDUINO_LIB_OTRADVALVE_FHT8VBULKENCODER_H
+
+#ifndef ARDUINO_ARCH_AVR
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+#include "OTRadValve_FHT8VRadValve.h"
+
+
+// Use namespaces to help avoid collisions.
+namespace OTRadValve
+    {
+
+
+// All 256 FHT8V valve-set (0x26) commands pre-encoded for each of a set of house codes.
+// Frames are held in fixed-size slots (with their 0xff terminators) in one contiguous block,
+// 256 slots per house code, about 12kB per house code,
+// and are byte-for-byte as from FHT8VRadValveUtil::FHT8VCreate200usBitStreamBptr().
+class FHT8VBulkEncoder final
+  {
+  public:
+    // Valve-set command.
+    static constexpr uint8_t VALVE_SET_CMD = 0x26;
+    // Size of each frame slot, ie of the longest frame plus terminating 0xff.
+    static constexpr uint8_t SLOT_SIZE = FHT8VRadValveUtil::MIN_FHT8V_200US_BIT_STREAM_BUF_SIZE;
+
+  private:
+    // Encoded frames, 256 slots per house code in order of addition.
+    std::vector<uint8_t> frames;
+    // Length of each frame excluding terminator, one per slot.
+    std::vector<uint8_t> lengths;
+
+  public:
+    // Encode all valve-set commands for the given house code, returning its index for getFrame() and emit().
+    // Adding a house code more than once is allowed and gives it another index.
+    // House code parts should be valid, ie [0,99].
+    size_t addHouseCode(uint8_t hc1, uint8_t hc2);
+
+    // Number of house codes added.
+    size_t getHouseCodeCount() const { return(lengths.size() / 256); }
+
+    // Get the encoded 0xff-terminated frame to set the given house code's valve to the [0,255]-scale value.
+    // Sets len to the frame length excluding the terminator.
+    // The house code index must be valid.
+    const uint8_t *getFrame(const size_t index, const uint8_t value255, uint8_t &len) const
+      {
+      const size_t slot = (index << 8) | value255;
+      len = lengths[slot];
+      return(&frames[slot * SLOT_SIZE]);
+      }
+
+    // Copy the frame to set the given house code's valve to the [0,255]-scale value to bptr.
+    // Output and buffer space required are as for FHT8VRadValveUtil::FHT8VCreate200usBitStreamBptr().
+    // The house code index must be valid.
+    // Returns pointer to the terminating 0xff on exit.
+    uint8_t *emit(uint8_t *const bptr, const size_t index, const uint8_t value255) const
+      {
+      uint8_t len;
+      const uint8_t *const f = getFrame(index, value255, len);
+      memcpy(bptr, f, len + 1);
+      return(bptr + len);
+      }
+
+    // As emit() but with the valve setting as a percentage [0,100], as sent by FHT8VRadValve.
+    uint8_t *emitPercent(uint8_t *const bptr, const size_t index, const uint8_t valvePC) const
+      { return(emit(bptr, index, FHT8VRadValveUtil::convertPercentTo255Scale(valvePC))); }
+  };
+
+
+    }
+
+#endif // ARDUINO_ARCH_AVR
+
+#endif
@@ -28,6 +28,7 @@ Author(s) / Copyright (s): Damon Hart-Davis 2013--2016
 
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <OTV0p2Base.h>
 #include "OTV0P2BASE_CLI.h"
@@ -209,6 +210,71 @@ class FHT8VRadValveUtil
         }
   };
 
+// Small cache of encoded FHT8V frames, to avoid re-encoding the same command each time it is sent.
+// A valve (or a controller for a few valves) cycles through a handful of commands,
+// so most frames can be emitted with a single memcpy().
+// Direct-mapped on the command content; a colliding command simply evicts the previous entry.
+// Each slot takes about 50 bytes of RAM, so keep slots small on AVR; at least one is needed.
+// Not thread-/ISR- safe.
+#define FHT8VEncodedFrameCache_DEFINED
+template <uint8_t slots>
+class FHT8VEncodedFrameCache final
+  {
+  static_assert(slots > 0, "need at least one slot");
+
+  private:
+    struct entry
+      {
+      // Command encoded; only valid if len is non-zero.
+      FHT8VRadValveUtil::fht8v_msg_t command;
+      // Length of encoded frame excluding terminating 0xff; 0 if the slot is empty.
+      uint8_t len;
+      // Encoded frame, 0xff terminated.
+      uint8_t bits[FHT8VRadValveUtil::MIN_FHT8V_200US_BIT_STREAM_BUF_SIZE];
+      };
+    entry cache[slots];
+
+    // Count of emit() calls satisfied from the cache, and of those that had to encode.
+    uint16_t hits, misses;
+
+    static bool sameCommand(const FHT8VRadValveUtil::fht8v_msg_t &a, const FHT8VRadValveUtil::fht8v_msg_t &b)
+      {
+      return((a.hc1 == b.hc1) && (a.hc2 == b.hc2) &&
+#ifdef OTV0P2BASE_FHT8V_ADR_USED
+             (a.address == b.address) &&
+#endif
+             (a.command == b.command) && (a.extension == b.extension));
+      }
+
+  public:
+    FHT8VEncodedFrameCache() : hits(0), misses(0) { clear(); }
+
+    // Empty the cache, eg when the house code changes.
+    void clear() { for(uint8_t i = 0; i < slots; ++i) { cache[i].len = 0; } }
+
+    // Drop-in replacement for FHT8VRadValveUtil::FHT8VCreate200usBitStreamBptr(), with identical output.
+    // Encodes and caches the command if not already cached, then copies the encoded frame to bptr.
+    // Note that a buffer space of at least MIN_FHT8V_200US_BIT_STREAM_BUF_SIZE bytes is needed.
+    // Returns pointer to the terminating 0xff on exit.
+    uint8_t *emit(uint8_t *const bptr, const FHT8VRadValveUtil::fht8v_msg_t *const command)
+      {
+      entry &e = cache[(uint8_t)(command->hc1 + command->hc2 + command->command + command->extension) % slots];
+      if((0 == e.len) || !sameCommand(e.command, *command))
+        {
+        if(misses < 0xffff) { ++misses; }
+        e.command = *command;
+        e.len = (uint8_t)(FHT8VRadValveUtil::FHT8VCreate200usBitStreamBptr(e.bits, command) - e.bits);
+        }
+      else if(hits < 0xffff) { ++hits; }
+      memcpy(bptr, e.bits, e.len + 1);
+      return(bptr + e.len);
+      }
+
+    // Counts of emit() calls satisfied from the cache and that had to encode; saturating.
+    uint16_t getHits() const { return(hits); }
+    uint16_t getMisses() const { return(misses); }
+  };
+
 
 
 #ifdef ARDUINO_ARCH_AVR
@@ -26,23 +26,12 @@ namespace OTRadValve
     {
 
 
-// Simple mean filter.
-// Find mean of group of ints where sum can be computed in an int without loss.
-// TODO: needs a unit test or three.
-template<size_t N> int_fast16_t smallIntMean(const int_fast16_t data[N])
-  {
-  // Extract mean.
-  // Assume values and sum will be nowhere near the limits.
-  int sum = 0;
-  for(int8_t i = N; --i >= 0; ) { sum += data[i]; }
-  // Compute rounded-up mean.
-  return((sum + (int)(N/2)) / (int)N); // Avoid accidental computation as unsigned...
-  }
-
+// Ring buffer index arithmetic relies on this.
+static_assert(0 == (ModelledRadValveState::filterLength & (ModelledRadValveState::filterLength - 1)), "filterLength must be a power of 2");
 
-// Get smoothed raw/unadjusted temperature from the most recent samples.
-int_fast16_t ModelledRadValveState::getSmoothedRecent() const
-  { return(smallIntMean<filterLength>(prevRawTempC16)); }
+// True if adjacent filter entries differ by more than MAX_TEMP_JUMP_C16.
+static inline uint8_t isTempJump(const int_fast16_t a, const int_fast16_t b)
+  { return((abs(a - b) > ModelledRadValveState::MAX_TEMP_JUMP_C16) ? 1 : 0); }
 
 //// Compute an estimate of rate/velocity of temperature change in C/16 per minute/tick.
 //// A positive value indicates that temperature is rising.
@@ -62,12 +51,9 @@ int_fast16_t ModelledRadValveState::getSmoothedRecent() const
 //  return(velocity);
 //  }
 
-// Maximum jump between adjacent readings before forcing filtering; strictly +ve.
-// Too small a value may in some circumstances cap room rate rise to this per minute.
-// Too large a value may fail to sufficiently help damp oscillations and overshoot.
-// As to be at least as large as the minimum temperature sensor precision to avoid false triggering of the filter.
-// Typical values range from 2 (for better-than 1/8C-precision temperature sensor) up to 4.
-static constexpr uint8_t MAX_TEMP_JUMP_C16 = 3; // 3/16C.
+// Out-of-line definitions of constants possibly ODR-used.
+constexpr uint8_t ModelledRadValveState::MAX_TEMP_JUMP_C16;
+constexpr uint8_t ModelledRadValveState::MIN_WINDOW_OPEN_TEMP_FALL_M;
 
 
 // Construct an instance, with sensible defaults, and current (room) temperature from the input state.
@@ -78,11 +64,20 @@ ModelledRadValveState::ModelledRadValveState(const ModelledRadValveInputState &i
   isFiltering(false),
   valveMoved(false),
   cumulativeMovementPC(0),
-  valveTurndownCountdownM(0), valveTurnupCountdownM(0)
+  valveTurndownCountdownM(0), valveTurnupCountdownM(0),
+  prevRawTempHead(0)
   {
   // Fills array exactly as tick() would when !initialised.
   const int_fast16_t rawTempC16 = inputState.refTempC16 - ModelledRadValveInputState::refTempOffsetC16; // Remove adjustment for target centre.
+  fillFilter(rawTempC16);
+  }
+
+// Fill the filter memory with the given temperature.
+void ModelledRadValveState::fillFilter(const int_fast16_t rawTempC16)
+  {
   for(int i = filterLength; --i >= 0; ) { prevRawTempC16[i] = rawTempC16; }
+  prevRawTempJumps = 0;
+  prevRawTempSumC16 = (int)(filterLength * rawTempC16);
   }
 
 // Perform per-minute tasks such as counter and filter updates then recompute valve position.
@@ -99,13 +94,20 @@ void ModelledRadValveState::tick(volatile uint8_t &valvePCOpenRef, const Modelle
   if(!initialised)
     {
     // Fill the filter memory with the current room temperature.
-    for(int i = filterLength; --i >= 0; ) { prevRawTempC16[i] = rawTempC16; }
+    fillFilter(rawTempC16);
     initialised = true;
     }
 
-  // Shift in the latest (raw) temperature.
-  for(int i = filterLength; --i > 0; ) { prevRawTempC16[i] = prevRawTempC16[i-1]; }
-  prevRawTempC16[0] = rawTempC16;
+  // Shift in the latest (raw) temperature, overwriting the oldest,
+  // adjusting the running sum and count of big adjacent jumps to match.
+  const uint8_t oldest = (prevRawTempHead + 1) & (filterLength-1);
+  const int_fast16_t oldestTempC16 = prevRawTempC16[oldest];
+  prevRawTempJumps = (uint8_t)(prevRawTempJumps +
+      isTempJump(rawTempC16, prevRawTempC16[prevRawTempHead]) -
+      isTempJump(prevRawTempC16[(oldest + 1) & (filterLength-1)], oldestTempC16));
+  prevRawTempSumC16 += (int)(rawTempC16 - oldestTempC16);
+  prevRawTempC16[oldest] = rawTempC16;
+  prevRawTempHead = oldest;
 
   // Disable/enable filtering.
   // Allow possible exit from filtering for next time
@@ -116,7 +118,7 @@ void ModelledRadValveState::tick(volatile uint8_t &valvePCOpenRef, const Modelle
   // Force filtering (back) on if any adjacent past readings are wildly different.
   else
     {
-    for(unsigned int i = 1; i < filterLength; ++i) { if(abs(prevRawTempC16[i] - prevRawTempC16[i-1]) > MAX_TEMP_JUMP_C16) { isFiltering = true; break; } }
+    if(0 != prevRawTempJumps) { isFiltering = true; }
     }
 
   // Tick count down timers.
@@ -145,19 +147,48 @@ void ModelledRadValveState::tick(volatile uint8_t &valvePCOpenRef, const Modelle
   valveMoved = changed;
   }
 
+// Capture the state consulted by computeRequiredTRVPercentOpen().
+// The smoothed temperature is only computed when filtering, as only then is it used.
+ModelledRadValveState::Snapshot ModelledRadValveState::getSnapshot() const
+  {
+  Snapshot s;
+  s.alwaysGlacial = alwaysGlacial;
+  s.isFiltering = isFiltering;
+  s.dontTurnup = dontTurnup();
+  s.dontTurndown = dontTurndown();
+  s.smoothedRecentC16 = isFiltering ? getSmoothedRecent() : 0;
+  s.rawDeltaC16 = getRawDelta();
+  s.rawDeltaWindowOpenC16 = getRawDelta(MIN_WINDOW_OPEN_TEMP_FALL_M);
+  return(s);
+  }
+
 // Computes a new valve position given supplied input state including the current valve position; [0,100].
 // Uses no state other than that passed as the arguments (thus is unit testable).
 // Does not alter any of the input state.
+// Nominally called at a regular rate, once per minute.
+// Usually called by tick() which does required state updates afterwards.
+uint8_t ModelledRadValveState::computeRequiredTRVPercentOpen(const uint8_t valvePCOpen, const ModelledRadValveInputState &inputState) const
+  {
+  event_t event = MRVE_NONE;
+  const uint8_t result = computeRequiredTRVPercentOpen(valvePCOpen, inputState, getSnapshot(), event);
+  if(MRVE_NONE != event) { setEvent(event); }
+  return(result);
+  }
+
+// Computes a new valve position given supplied input state including the current valve position; [0,100].
+// Uses no state other than that passed as the arguments (thus is unit testable).
+// Sets event only if a reportable event occurs, else leaves it untouched.
+// Does not alter any of the input state.
 // Uses hysteresis and a proportional control and some other cleverness.
 // Is always willing to turn off quickly, but on slowly (AKA "slow start" algorithm),
 // and tries to eliminate unnecessary 'hunting' which makes noise and uses actuator energy.
 // Nominally called at a regular rate, once per minute.
 // All inputState values should be set to sensible values before starting.
 // Usually called by tick() which does required state updates afterwards.
-uint8_t ModelledRadValveState::computeRequiredTRVPercentOpen(const uint8_t valvePCOpen, const ModelledRadValveInputState &inputState) const
+uint8_t ModelledRadValveState::computeRequiredTRVPercentOpen(const uint8_t valvePCOpen, const ModelledRadValveInputState &inputState, const Snapshot &s, event_t &event)
   {
   // Possibly-adjusted and/or smoothed temperature to use for targeting.
-  const int_fast16_t adjustedTempC16 = isFiltering ? (getSmoothedRecent() + ModelledRadValveInputState::refTempOffsetC16) : inputState.refTempC16;
+  const int_fast16_t adjustedTempC16 = s.isFiltering ? (s.smoothedRecentC16 + ModelledRadValveInputState::refTempOffsetC16) : inputState.refTempC16;
   // When reduced to whole Celsius then fewer bits are needed to cover expected temperatures.
   const int_fast8_t adjustedTempC = (int_fast8_t) (adjustedTempC16 >> 4);
 
@@ -169,7 +200,7 @@ uint8_t ModelledRadValveState::computeRequiredTRVPercentOpen(const uint8_t valve
   if(adjustedTempC < inputState.targetTempC)
     {
     // Don't open if recently turned down, and not in MAKE mode.
-    if(dontTurnup() && !inputState.inBakeMode) { return(valvePCOpen); }
+    if(s.dontTurnup && !inputState.inBakeMode) { return(valvePCOpen); }
     // Usually open up to max.
     return(inputState.maxPCOpen);
     }
@@ -177,7 +208,7 @@ uint8_t ModelledRadValveState::computeRequiredTRVPercentOpen(const uint8_t valve
   else if(adjustedTempC > inputState.targetTempC)
     {
     // Don't close if recently turned up.
-    if(dontTurndown()) { return(valvePCOpen); }
+    if(s.dontTurndown) { return(valvePCOpen); }
     // Usually close up to min.
     return(inputState.minPCOpen);
     }
@@ -193,10 +224,10 @@ uint8_t ModelledRadValveState::computeRequiredTRVPercentOpen(const uint8_t valve
   // and will likely work better with high-thermal-mass / slow-response systems such as UFH.
   // Should be << 100%/min, and probably << 30%/min, given that 30% may be the effective control range of many rad valves.
   static constexpr uint8_t TRV_MIN_SLEW_PC_PER_MIN = 1; // Minimal slew rate (%/min) to keep flow rates as low as possible.
-  static const uint8_t TRV_MAX_SLEW_PC_PER_MIN = alwaysGlacial ? TRV_MIN_SLEW_PC_PER_MIN : 5;
+  const uint8_t TRV_MAX_SLEW_PC_PER_MIN = s.alwaysGlacial ? TRV_MIN_SLEW_PC_PER_MIN : 5;
   // Derived from basic slew values.
-  static const uint8_t TRV_SLEW_PC_PER_MIN_FAST = alwaysGlacial ? TRV_MAX_SLEW_PC_PER_MIN : (OTV0P2BASE::fnmin(20,(2*TRV_MAX_SLEW_PC_PER_MIN))); // Takes >= 5 minutes for full travel.
-  static const uint8_t TRV_SLEW_PC_PER_MIN_VFAST = alwaysGlacial ? TRV_MAX_SLEW_PC_PER_MIN : (OTV0P2BASE::fnmin(34,(4*TRV_MAX_SLEW_PC_PER_MIN))); // Takes >= 3 minutes for full travel.
+  const uint8_t TRV_SLEW_PC_PER_MIN_FAST = s.alwaysGlacial ? TRV_MAX_SLEW_PC_PER_MIN : (OTV0P2BASE::fnmin(20,(2*TRV_MAX_SLEW_PC_PER_MIN))); // Takes >= 5 minutes for full travel.
+  const uint8_t TRV_SLEW_PC_PER_MIN_VFAST = s.alwaysGlacial ? TRV_MAX_SLEW_PC_PER_MIN : (OTV0P2BASE::fnmin(34,(4*TRV_MAX_SLEW_PC_PER_MIN))); // Takes >= 3 minutes for full travel.
 
   // (Well) under temp target: open valve up.
   if(adjustedTempC < inputState.targetTempC)
@@ -255,11 +286,7 @@ uint8_t ModelledRadValveState::computeRequiredTRVPercentOpen(const uint8_t valve
     // Should probably be significantly larger than MAX_TEMP_JUMP_C16 to avoid triggering alongside any filtering.
     // Needs to be be a fast enough fall NOT to be triggered by normal temperature gyrations close to a radiator.
     static constexpr uint8_t MIN_WINDOW_OPEN_TEMP_FALL_C16 = OTV0P2BASE::fnmax(MAX_TEMP_JUMP_C16+2, 5); // Just over 1/4C.
-    // Minutes over which temperature should be falling to trigger 'window open' response; strictly +ve.
-    // TODO-621.
-    // Needs to be be a fast enough fall NOT to be triggered by normal temperature gyrations close to a radiator.
-    // Is capped in practice at the filter length.
-    static constexpr uint8_t MIN_WINDOW_OPEN_TEMP_FALL_M = 13;
+    // The fall is measured over ModelledRadValveState::MIN_WINDOW_OPEN_TEMP_FALL_M minutes (TODO-621).
     //
     // Avoid trying to heat the outside world when a window or door is opened (TODO-621).
     // This is a short-term tactical response to a persistent cold draught,
@@ -292,11 +319,11 @@ uint8_t ModelledRadValveState::computeRequiredTRVPercentOpen(const uint8_t valve
     if(inputState.hasEcoBias &&
        (!inputState.fastResponseRequired) && // Avoid subverting recent manual call for heat.
        (adjustedTempC >= MIN_TARGET_C) &&
-       (getRawDelta() < 0) &&
-       (getRawDelta(MIN_WINDOW_OPEN_TEMP_FALL_M) <= -(int)MIN_WINDOW_OPEN_TEMP_FALL_C16))
+       (s.rawDeltaC16 < 0) &&
+       (s.rawDeltaWindowOpenC16 <= -(int)MIN_WINDOW_OPEN_TEMP_FALL_C16))
         {
-        setEvent(MRVE_DRAUGHT); // Report draught detected.
-        if(!dontTurndown())
+        event = MRVE_DRAUGHT; // Report draught detected.
+        if(!s.dontTurndown)
           {
           // Try to turn down far enough to stop calling for heat immediately.
           if(valvePCOpen >= OTRadValve::DEFAULT_VALVE_PC_SAFER_OPEN)
@@ -318,7 +345,7 @@ uint8_t ModelledRadValveState::computeRequiredTRVPercentOpen(const uint8_t valve
     if(valvePCOpen < inputState.maxPCOpen)
       {
       // Reduce valve hunting: defer re-opening if recently closed.
-      if(dontTurnup()) { return(valvePCOpen); }
+      if(s.dontTurnup) { return(valvePCOpen); }
 
       // True if a long way below target (more than 1C below target).
       const bool vBelowTarget = (adjustedTempC < inputState.targetTempC-1);
@@ -342,7 +369,7 @@ uint8_t ModelledRadValveState::computeRequiredTRVPercentOpen(const uint8_t valve
 //      #endif
                // Don't rush to open the valve
                // if temperature is jittery but is moving in the right direction.
-               (isFiltering && (getRawDelta() > 0)))); // FIXME: maybe redundant w/ GLACIAL_ON_WITH_WIDE_DEADBAND and widenDeadband set when isFiltering is true
+               (s.isFiltering && (s.rawDeltaC16 > 0)))); // FIXME: maybe redundant w/ GLACIAL_ON_WITH_WIDE_DEADBAND and widenDeadband set when isFiltering is true
       if(beGlacial) { return(valvePCOpen + 1); }
 
       // If well below target (and without a wide deadband),
@@ -357,7 +384,7 @@ uint8_t ModelledRadValveState::computeRequiredTRVPercentOpen(const uint8_t valve
       if((valvePCOpen < cappedModeratelyOpen) &&
          (inputState.fastResponseRequired || (vBelowTarget && !inputState.widenDeadband)))
           {
-          setEvent(MRVE_OPENFAST);
+          event = MRVE_OPENFAST;
           return(cappedModeratelyOpen);
           }
 
@@ -385,16 +412,16 @@ uint8_t ModelledRadValveState::computeRequiredTRVPercentOpen(const uint8_t valve
     if(0 != valvePCOpen)
       {
       // Reduce valve hunting: defer re-closing if recently opened.
-      if(dontTurndown()) { return(valvePCOpen); }
+      if(s.dontTurndown) { return(valvePCOpen); }
 
       // True if just above the the proportional range.
       const bool justOverTemp = (adjustedTempC == inputState.targetTempC+1);
 
       // TODO-453: avoid closing the valve at all when the temperature error is small and falling, and there is a widened deadband.
-      if(justOverTemp && inputState.widenDeadband && (getRawDelta() < 0)) { return(valvePCOpen); }
+      if(justOverTemp && inputState.widenDeadband && (s.rawDeltaC16 < 0)) { return(valvePCOpen); }
 
       // TODO-482: glacial close if temperature is jittery and not too far above target.
-      if(justOverTemp && isFiltering) { return(valvePCOpen - 1); }
+      if(justOverTemp && s.isFiltering) { return(valvePCOpen - 1); }
 
       // Continue shutting valve slowly as not yet fully closed.
       // TODO-117: allow very slow final turn off to help systems with poor bypass, ~1% per minute.
@@ -412,7 +439,7 @@ uint8_t ModelledRadValveState::computeRequiredTRVPercentOpen(const uint8_t valve
       // TODO-109: with comfort bias close relatively slowly to reduce wasted effort from minor overshoots.
       // TODO-453: close relatively slowly when temperature error is small (<1C) to reduce wasted effort from minor overshoots.
       // TODO-593: if user is manually adjusting device then attempt to respond quickly.
-      if(((!inputState.hasEcoBias) || justOverTemp || isFiltering) &&
+      if(((!inputState.hasEcoBias) || justOverTemp || s.isFiltering) &&
          (!inputState.fastResponseRequired) &&
          (valvePCOpen > OTV0P2BASE::fnconstrain((uint8_t)(lingerThreshold + TRV_SLEW_PC_PER_MIN_FAST), (uint8_t)TRV_SLEW_PC_PER_MIN_FAST, inputState.maxPCOpen)))
         { return(valvePCOpen - TRV_SLEW_PC_PER_MIN_FAST); }
@@ -465,12 +492,12 @@ uint8_t ModelledRadValveState::computeRequiredTRVPercentOpen(const uint8_t valve
       if(slew < minAbsSlew) { return(valvePCOpen); }
 
       // Reduce valve hunting: defer re-closing if recently opened.
-      if(dontTurndown()) { return(valvePCOpen); }
+      if(s.dontTurndown) { return(valvePCOpen); }
 
       // TODO-453: avoid closing the valve at all when the (raw) temperature is not rising, so as to minimise valve movement.
       // Since the target is the top of the proportional range than nothing within it requires the temperature to be *forced* down.
       // Possibly don't apply this rule at the very top of the range in case filtering is on and the filtered value moves differently to the raw.
-      const int rise = getRawDelta();
+      const int rise = s.rawDeltaC16;
       if(rise < 0) { return(valvePCOpen); }
       if((0 == rise) && inputState.widenDeadband) { return(valvePCOpen); }
 
@@ -485,7 +512,7 @@ uint8_t ModelledRadValveState::computeRequiredTRVPercentOpen(const uint8_t valve
       const bool beGlacial = inputState.glacial ||
 //      #if defined(GLACIAL_ON_WITH_WIDE_DEADBAND)
           // (GLACIAL_ON_WITH_WIDE_DEADBAND: TODO-467)
-          ((inputState.widenDeadband || isFiltering) && (valvePCOpen <= OTRadValve::DEFAULT_VALVE_PC_MODERATELY_OPEN)) ||
+          ((inputState.widenDeadband || s.isFiltering) && (valvePCOpen <= OTRadValve::DEFAULT_VALVE_PC_MODERATELY_OPEN)) ||
 //      #endif
           (lsbits < 8);
       if(beGlacial) { return(valvePCOpen - 1); }
@@ -507,7 +534,7 @@ uint8_t ModelledRadValveState::computeRequiredTRVPercentOpen(const uint8_t valve
     if(slew < minAbsSlew) { return(valvePCOpen); }
 
     // Reduce valve hunting: defer re-opening if recently closed.
-    if(dontTurnup()) { return(valvePCOpen); }
+    if(s.dontTurnup) { return(valvePCOpen); }
 
     // TODO-453: minimise valve movement (and thus noise and battery use).
     // Keeping the temperature steady anywhere in the target proportional range
@@ -516,7 +543,7 @@ uint8_t ModelledRadValveState::computeRequiredTRVPercentOpen(const uint8_t valve
     // If fairly near the final target then also leave the valve as-is (TODO-453 & TODO-451).
     // TODO-1026: minimise movement in dark to avoid disturbing sleep (dark indicated with wide deadband).
     // DHD20161020: reduced lower threshold with wide deadband from 8 to 2 (cf 12 without).
-    const int rise = getRawDelta();
+    const int rise = s.rawDeltaC16;
     if(rise > 0) { return(valvePCOpen); }
     if((0 == rise) && inputState.widenDeadband) { return(valvePCOpen); }
     if((lsbits >= (inputState.widenDeadband ? 2 : 12))) { return(valvePCOpen); }
@@ -116,7 +116,8 @@ struct ModelledRadValveState final
     isFiltering(false),
     valveMoved(false),
     cumulativeMovementPC(0),
-    valveTurndownCountdownM(0), valveTurnupCountdownM(0)
+    valveTurndownCountdownM(0), valveTurnupCountdownM(0),
+    prevRawTempHead(0), prevRawTempJumps(0), prevRawTempSumC16(0)
     { }
 
   // Construct an instance, with sensible defaults, and current (room) temperature from the input state.
@@ -210,24 +211,47 @@ struct ModelledRadValveState final
   // If true then avoid turning down the heat yet.
   bool dontTurndown() const { return(0 != valveTurnupCountdownM); }
 
+  // Maximum jump between adjacent readings before forcing filtering; strictly +ve.
+  // Too small a value may in some circumstances cap room rate rise to this per minute.
+  // Too large a value may fail to sufficiently help damp oscillations and overshoot.
+  // As to be at least as large as the minimum temperature sensor precision to avoid false triggering of the filter.
+  // Typical values range from 2 (for better-than 1/8C-precision temperature sensor) up to 4.
+  static constexpr uint8_t MAX_TEMP_JUMP_C16 = 3; // 3/16C.
+
   // Length of filter memory in ticks; strictly positive.
-  // Must be at least 4, and may be more efficient at a power of 2.
+  // Must be a power of 2 and at least 4.
   static const size_t filterLength = 16;
 
-  // Previous unadjusted temperatures, 0 being the newest, and following ones successively older.
+  // Previous unadjusted temperatures as a ring buffer, newest at prevRawTempHead.
+  // Use getRawTempC16() to access in age order.
   // These values have any target bias removed.
   // Half the filter size times the tick() interval gives an approximate time constant.
   // Note that full response time of a typical mechanical wax-based TRV is ~20mins.
+  // Must not be written other than by tick() and the constructors.
   int_fast16_t prevRawTempC16[filterLength];
+  // Index in prevRawTempC16 of the newest entry; [0,filterLength-1].
+  uint8_t prevRawTempHead;
+  // Count of adjacent entries in prevRawTempC16 (by age) differing by more than MAX_TEMP_JUMP_C16.
+  uint8_t prevRawTempJumps;
+  // Running sum of all entries in prevRawTempC16.
+  int prevRawTempSumC16;
+
+  // Fill the filter memory with the given temperature.
+  void fillFilter(int_fast16_t rawTempC16);
+
+  // Get unadjusted temperature from n ticks ago, 0 being the newest; n in [0,filterLength-1].
+  int_fast16_t getRawTempC16(const uint8_t n) const
+    { return(prevRawTempC16[(prevRawTempHead - n) & (filterLength-1)]); }
 
   // Get smoothed raw/unadjusted temperature from the most recent samples.
-  int_fast16_t getSmoothedRecent() const;
+  int_fast16_t getSmoothedRecent() const
+    { return((prevRawTempSumC16 + (int)(filterLength/2)) / (int)filterLength); } // Avoid accidental computation as unsigned...
 
   // Get last change in temperature (C*16, signed); +ve means rising.
-  int_fast16_t getRawDelta() const { return(prevRawTempC16[0] - prevRawTempC16[1]); }
+  int_fast16_t getRawDelta() const { return(getRawTempC16(0) - getRawTempC16(1)); }
 
   // Get last change in temperature (C*16, signed) from n ticks ago capped to filter length; +ve means rising.
-  int_fast16_t getRawDelta(uint8_t n) const { return(prevRawTempC16[0] - prevRawTempC16[OTV0P2BASE::fnmin((size_t)n, filterLength-1)]); }
+  int_fast16_t getRawDelta(uint8_t n) const { return(getRawTempC16(0) - getRawTempC16((uint8_t)OTV0P2BASE::fnmin((size_t)n, filterLength-1))); }
 
 //  // Compute an estimate of rate/velocity of temperature change in C/16 per minute/tick.
 //  // A positive value indicates that temperature is rising.
@@ -244,6 +268,41 @@ struct ModelledRadValveState final
   // All inputState values should be set to sensible values before starting.
   // Usually called by tick() which does required state updates afterwards.
   uint8_t computeRequiredTRVPercentOpen(uint8_t currentValvePCOpen, const ModelledRadValveInputState &inputState) const;
+
+  // Minutes over which temperature should be falling to trigger 'window open' response; strictly +ve.
+  // TODO-621.
+  // Needs to be be a fast enough fall NOT to be triggered by normal temperature gyrations close to a radiator.
+  // Is capped in practice at the filter length.
+  static constexpr uint8_t MIN_WINDOW_OPEN_TEMP_FALL_M = 13;
+
+  // The retained state consulted by computeRequiredTRVPercentOpen(), by value.
+  // Allows the control logic to be driven from state held elsewhere,
+  // eg in structure-of-arrays form by ModelledRadValveFleet.
+  struct Snapshot final
+    {
+    // As alwaysGlacial.
+    bool alwaysGlacial;
+    // As isFiltering.
+    bool isFiltering;
+    // As dontTurnup() and dontTurndown().
+    bool dontTurnup;
+    bool dontTurndown;
+    // As getSmoothedRecent(); need only be valid when isFiltering is true.
+    int_fast16_t smoothedRecentC16;
+    // As getRawDelta().
+    int_fast16_t rawDeltaC16;
+    // As getRawDelta(MIN_WINDOW_OPEN_TEMP_FALL_M).
+    int_fast16_t rawDeltaWindowOpenC16;
+    };
+
+  // Capture the current state consulted by computeRequiredTRVPercentOpen().
+  Snapshot getSnapshot() const;
+
+  // Computes a new valve position from the supplied snapshot, input state and current valve position; [0,100].
+  // Stateless core of computeRequiredTRVPercentOpen() and thus exactly equivalent to it.
+  // Sets event only if a reportable event occurs, else leaves it untouched.
+  static uint8_t computeRequiredTRVPercentOpen(uint8_t currentValvePCOpen, const ModelledRadValveInputState &inputState,
+                                               const Snapshot &s, event_t &event);
   };
 
 // Sensor, control and stats inputs for computations.
@@ -0,0 +1,190 @@
+/*
+The OpenTRV project licenses this file to you
+under the Apache Licence, Version 2.0 (the "Licence");
+you may not use this file except in compliance
+with the Licence. You may obtain a copy of the Licence at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing,
+software distributed under the Licence is distributed on an
+"AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+KIND, either express or implied. See the Licence for the
+specific language governing permissions and limitations
+under the Licence.
+
+Author(s) / Copyright (s): Damon Hart-Davis 2016
+*/
+
+#ifndef ARDUINO_ARCH_AVR
+
+#include <stdlib.h>
+#include "OTRadValve_ModelledRadValveFleet.h"
+
+
+namespace OTRadValve
+    {
+
+
+// Shared ring index arithmetic relies on this.
+static_assert(0 == (ModelledRadValveFleet::filterLength & (ModelledRadValveFleet::filterLength - 1)), "filterLength must be a power of 2");
+
+constexpr size_t ModelledRadValveFleet::filterLength;
+
+// True if adjacent filter entries differ enough to force filtering on.
+static inline uint8_t isJump(const int_fast16_t a, const int_fast16_t b)
+  { return((abs(a - b) > ModelledRadValveState::MAX_TEMP_JUMP_C16) ? 1 : 0); }
+
+// Create a fleet of the given number of rooms, each with default input state and valve position.
+ModelledRadValveFleet::ModelledRadValveFleet(const size_t _rooms, const bool _alwaysGlacial, const uint8_t initialValvePCOpen) :
+  alwaysGlacial(_alwaysGlacial),
+  rooms(_rooms),
+  head(0),
+  prevRawTempC16(_rooms * filterLength),
+  filterSum(_rooms),
+  jumpCount(_rooms),
+  initialised(_rooms),
+  isFiltering(_rooms),
+  valveMoved(_rooms),
+  lastEvent(_rooms, ModelledRadValveState::MRVE_NONE),
+  cumulativeMovementPC(_rooms),
+  valveTurndownCountdownM(_rooms),
+  valveTurnupCountdownM(_rooms),
+  valvePCOpen(_rooms, initialValvePCOpen),
+  targetTempC(_rooms),
+  minPCOpen(_rooms),
+  maxPCOpen(_rooms),
+  inputFlags(_rooms),
+  refTempC16(_rooms)
+  {
+  const ModelledRadValveInputState defaultInputState;
+  for(size_t r = 0; r < rooms; ++r) { setInputState(r, defaultInputState); }
+  }
+
+// Set all input state for one room.
+void ModelledRadValveFleet::setInputState(const size_t room, const ModelledRadValveInputState &inputState)
+  {
+  targetTempC[room] = inputState.targetTempC;
+  minPCOpen[room] = inputState.minPCOpen;
+  maxPCOpen[room] = inputState.maxPCOpen;
+  inputFlags[room] =
+      (inputState.widenDeadband ? IF_WIDEN_DEADBAND : 0) |
+      (inputState.glacial ? IF_GLACIAL : 0) |
+      (inputState.hasEcoBias ? IF_ECO_BIAS : 0) |
+      (inputState.inBakeMode ? IF_BAKE : 0) |
+      (inputState.fastResponseRequired ? IF_FAST_RESPONSE : 0);
+  refTempC16[room] = inputState.refTempC16;
+  }
+
+// Get all input state for one room.
+ModelledRadValveInputState ModelledRadValveFleet::getInputState(const size_t room) const
+  {
+  ModelledRadValveInputState is;
+  is.targetTempC = targetTempC[room];
+  is.minPCOpen = minPCOpen[room];
+  is.maxPCOpen = maxPCOpen[room];
+  const uint8_t f = inputFlags[room];
+  is.widenDeadband = (0 != (f & IF_WIDEN_DEADBAND));
+  is.glacial = (0 != (f & IF_GLACIAL));
+  is.hasEcoBias = (0 != (f & IF_ECO_BIAS));
+  is.inBakeMode = (0 != (f & IF_BAKE));
+  is.fastResponseRequired = (0 != (f & IF_FAST_RESPONSE));
+  is.refTempC16 = refTempC16[room];
+  return(is);
+  }
+
+// Perform per-minute tasks for all rooms, as ModelledRadValveState::tick() for each.
+// Advancing the shared head makes the oldest entry of every room's filter the slot for the newest.
+void ModelledRadValveFleet::tick()
+  {
+  constexpr size_t mask = filterLength - 1;
+  const uint8_t newHead = (uint8_t)((head + 1) & mask);
+  // Slots (before this tick) of the oldest and second-oldest entries, the oldest being overwritten.
+  const size_t oldest = newHead;
+  const size_t secondOldest = (newHead + 1) & mask;
+  const size_t newest = head;
+  // Slots (after this tick) of entries used by the control logic.
+  const size_t prev1 = head;
+  const size_t prevWindowOpen = (newHead - OTV0P2BASE::fnmin((size_t)ModelledRadValveState::MIN_WINDOW_OPEN_TEMP_FALL_M, filterLength-1)) & mask;
+
+  ModelledRadValveInputState is;
+  for(size_t r = 0; r < rooms; ++r)
+    {
+    int_fast16_t *const f = &prevRawTempC16[r * filterLength];
+    const int_fast16_t rawTempC16 = refTempC16[r] - ModelledRadValveInputState::refTempOffsetC16; // Remove adjustment for target centre.
+
+    // Do some one-off work on first tick for this room.
+    if(!initialised[r])
+      {
+      // Fill the filter memory with the current room temperature.
+      for(size_t i = 0; i < filterLength; ++i) { f[i] = rawTempC16; }
+      filterSum[r] = (int)(filterLength * rawTempC16);
+      jumpCount[r] = 0;
+      initialised[r] = true;
+      }
+
+    // Shift in the latest (raw) temperature, dropping the oldest,
+    // and update the running sum and count of big adjacent steps to match.
+    jumpCount[r] = (uint8_t)(jumpCount[r] + isJump(rawTempC16, f[newest]) - isJump(f[secondOldest], f[oldest]));
+    filterSum[r] += (int)(rawTempC16 - f[oldest]);
+    f[newHead] = rawTempC16;
+
+    // Disable/enable filtering as ModelledRadValveState::tick().
+    const int_fast16_t smoothed = (filterSum[r] + (int)(filterLength/2)) / (int)filterLength;
+    if(isFiltering[r])
+      { if(abs(smoothed - rawTempC16) <= ModelledRadValveState::MAX_TEMP_JUMP_C16) { isFiltering[r] = false; } }
+    else if(0 != jumpCount[r]) { isFiltering[r] = true; }
+
+    // Tick count down timers.
+    if(valveTurndownCountdownM[r] > 0) { --valveTurndownCountdownM[r]; }
+    if(valveTurnupCountdownM[r] > 0) { --valveTurnupCountdownM[r]; }
+
+    // Update the modelled state including the valve position.
+    ModelledRadValveState::Snapshot s;
+    s.alwaysGlacial = alwaysGlacial;
+    s.isFiltering = (0 != isFiltering[r]);
+    s.dontTurnup = (0 != valveTurndownCountdownM[r]);
+    s.dontTurndown = (0 != valveTurnupCountdownM[r]);
+    s.smoothedRecentC16 = smoothed;
+    s.rawDeltaC16 = rawTempC16 - f[prev1];
+    s.rawDeltaWindowOpenC16 = rawTempC16 - f[prevWindowOpen];
+    is.targetTempC = targetTempC[r];
+    is.minPCOpen = minPCOpen[r];
+    is.maxPCOpen = maxPCOpen[r];
+    const uint8_t fl = inputFlags[r];
+    is.widenDeadband = (0 != (fl & IF_WIDEN_DEADBAND));
+    is.glacial = (0 != (fl & IF_GLACIAL));
+    is.hasEcoBias = (0 != (fl & IF_ECO_BIAS));
+    is.inBakeMode = (0 != (fl & IF_BAKE));
+    is.fastResponseRequired = (0 != (fl & IF_FAST_RESPONSE));
+    is.refTempC16 = refTempC16[r];
+    ModelledRadValveState::event_t event = ModelledRadValveState::MRVE_NONE;
+    const uint8_t oldValvePC = valvePCOpen[r];
+    const uint8_t newValvePC = ModelledRadValveState::computeRequiredTRVPercentOpen(oldValvePC, is, s, event);
+    lastEvent[r] = event;
+    const bool changed = (newValvePC != oldValvePC);
+    if(changed)
+      {
+      if(newValvePC > oldValvePC)
+        {
+        // Defer reclosing valve to avoid excessive hunting.
+        valveTurnupCountdownM[r] = DEFAULT_ANTISEEK_VALVE_RECLOSE_DELAY_M;
+        cumulativeMovementPC[r] = (cumulativeMovementPC[r] + (newValvePC - oldValvePC)) & 0xfff;
+        }
+      else
+        {
+        // Defer opening valve to avoid excessive hunting.
+        valveTurndownCountdownM[r] = DEFAULT_ANTISEEK_VALVE_REOPEN_DELAY_M;
+        cumulativeMovementPC[r] = (cumulativeMovementPC[r] + (oldValvePC - newValvePC)) & 0xfff;
+        }
+      valvePCOpen[r] = newValvePC;
+      }
+    valveMoved[r] = changed;
+    }
+  head = newHead;
+  }
+
+
+    }
+
+#endif // ARDUINO_ARCH_AVR
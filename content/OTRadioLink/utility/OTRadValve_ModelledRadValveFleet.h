@@ -0,0 +1,146 @@
+/*
+The OpenTRV project licenses this file to you
+under the Apache Licence, Version 2.0 (the "Licence");
+you may not use this file except in compliance
+with the Licence. You may obtain a copy of the Licence at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing,
+software distributed under the Licence is distributed on an
+"AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+KIND, either express or implied. See the Licence for the
+specific language governing permissions and limitations
+under the Licence.
+
+Author(s) / Copyright (s): Damon Hart-Davis 2016
+*/
+
+/*
+ * Hosted simulation of a fleet of modelled radiator valves,
+ * eg for evaluating control tweaks across thousands of rooms over long periods.
+ *
+ * Not for AVR: uses heap allocation.
+ */
+
+#ifndef ARDUINO_LIB_OTRADVALVE_MODELLEDRADVALVEFLEET_H
+#define ARDUINO_LIB_OTRADVALVE_MODELLEDRADVALVEFLEET_H
+
+#ifndef ARDUINO_ARCH_AVR
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+#include "OTRadValve_ModelledRadValve.h"
+
+
+// Use namespaces to help avoid collisions.
+namespace OTRadValve
+    {
+
+
+// Many ModelledRadValveState instances ticked in lock-step, held as structure-of-arrays.
+// Each room behaves bit-for-bit as a ModelledRadValveState (constructed without initial temperature)
+// whose tick() is called once per fleet tick() with that room's input state and valve position.
+//
+// All rooms' temperature filters are held in one contiguous block, filterLength entries per room;
+// since all rooms tick together each is a ring buffer sharing one head index,
+// so the filters are never shifted.
+// A running sum and a count of adjacent over-MAX_TEMP_JUMP_C16 steps per room
+// make the smoothed value and the filter on/off decision O(1) per room per tick.
+//
+// Input state is also held in parallel arrays, and may be set per room before each tick().
+class ModelledRadValveFleet final
+  {
+  public:
+    // Length of each room's filter in ticks, as for a single valve.
+    static constexpr size_t filterLength = ModelledRadValveState::filterLength;
+
+  private:
+    // True if all rooms are always glacial.
+    const bool alwaysGlacial;
+    // Number of rooms.
+    const size_t rooms;
+
+    // Index into each room's filter of the newest raw temperature; [0,filterLength-1].
+    uint8_t head;
+
+    // All rooms' raw temperature filters, filterLength entries per room.
+    std::vector<int_fast16_t> prevRawTempC16;
+    // Per-room sum of all filter entries.
+    std::vector<int> filterSum;
+    // Per-room count of adjacent filter entries differing by more than MAX_TEMP_JUMP_C16.
+    std::vector<uint8_t> jumpCount;
+
+    // Per-room retained state as in ModelledRadValveState.
+    std::vector<uint8_t> initialised;
+    std::vector<uint8_t> isFiltering;
+    std::vector<uint8_t> valveMoved;
+    std::vector<uint8_t> lastEvent;
+    std::vector<uint16_t> cumulativeMovementPC;
+    std::vector<uint8_t> valveTurndownCountdownM;
+    std::vector<uint8_t> valveTurnupCountdownM;
+    // Per-room current valve position [0,100].
+    std::vector<uint8_t> valvePCOpen;
+
+    // Per-room input state as in ModelledRadValveInputState.
+    std::vector<uint8_t> targetTempC;
+    std::vector<uint8_t> minPCOpen;
+    std::vector<uint8_t> maxPCOpen;
+    std::vector<uint8_t> inputFlags;
+    std::vector<int_fast16_t> refTempC16;
+
+    // Bits in inputFlags.
+    static constexpr uint8_t IF_WIDEN_DEADBAND = 1;
+    static constexpr uint8_t IF_GLACIAL = 2;
+    static constexpr uint8_t IF_ECO_BIAS = 4;
+    static constexpr uint8_t IF_BAKE = 8;
+    static constexpr uint8_t IF_FAST_RESPONSE = 16;
+
+    // Get the filter entry for the given room n ticks old, 0 being the newest; n in [0,filterLength-1].
+    int_fast16_t getRaw(const size_t room, const size_t n) const
+      { return(prevRawTempC16[(room * filterLength) + ((head - n) & (filterLength - 1))]); }
+
+  public:
+    // Create a fleet of the given number of rooms, each with default input state and valve position.
+    // As for ModelledRadValveState, each room's filter is filled from its first tick().
+    ModelledRadValveFleet(size_t rooms, bool alwaysGlacial = false, uint8_t initialValvePCOpen = 0);
+
+    // Number of rooms.
+    size_t size() const { return(rooms); }
+
+    // Set all input state for one room.
+    void setInputState(size_t room, const ModelledRadValveInputState &inputState);
+    // Get all input state for one room.
+    ModelledRadValveInputState getInputState(size_t room) const;
+    // Set just the reference temperature for one room, eg fresh each tick.
+    void setReferenceTemperatures(const size_t room, const int_fast16_t currentTempC16)
+      { refTempC16[room] = currentTempC16 + ModelledRadValveInputState::refTempOffsetC16; }
+    // Set just the target temperature for one room.
+    void setTargetTempC(const size_t room, const uint8_t tC) { targetTempC[room] = tC; }
+
+    // Perform per-minute tasks for all rooms, as ModelledRadValveState::tick() for each.
+    void tick();
+
+    // Per-room state, as the same-named ModelledRadValveState members.
+    uint8_t getValvePCOpen(const size_t room) const { return(valvePCOpen[room]); }
+    void setValvePCOpen(const size_t room, const uint8_t pc) { valvePCOpen[room] = pc; }
+    bool isInitialised(const size_t room) const { return(0 != initialised[room]); }
+    bool getIsFiltering(const size_t room) const { return(0 != isFiltering[room]); }
+    bool getValveMoved(const size_t room) const { return(0 != valveMoved[room]); }
+    ModelledRadValveState::event_t getLastEvent(const size_t room) const { return((ModelledRadValveState::event_t)lastEvent[room]); }
+    uint16_t getCumulativeMovementPC(const size_t room) const { return(cumulativeMovementPC[room]); }
+    uint8_t getValveTurndownCountdownM(const size_t room) const { return(valveTurndownCountdownM[room]); }
+    uint8_t getValveTurnupCountdownM(const size_t room) const { return(valveTurnupCountdownM[room]); }
+    int_fast16_t getRawTempC16(const size_t room, const size_t n) const { return(getRaw(room, n)); }
+    int_fast16_t getSmoothedRecent(const size_t room) const
+      { return((filterSum[room] + (int)(filterLength/2)) / (int)filterLength); }
+    int_fast16_t getRawDelta(const size_t room) const { return(getRaw(room, 0) - getRaw(room, 1)); }
+  };
+
+
+    }
+
+#endif // ARDUINO_ARCH_AVR
+
+#endif
@@ -0,0 +1,225 @@
+/*
+The OpenTRV project licenses this file to you
+under the Apache Licence, Version 2.0 (the "Licence");
+you may not use this file except in compliance
+with the Licence. You may obtain a copy of the Licence at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing,
+software distributed under the Licence is distributed on an
+"AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+KIND, either express or implied. See the Licence for the
+specific language governing permissions and limitations
+under the Licence.
+
+Author(s) / Copyright (s): Damon Hart-Davis 2016
+*/
+
+/*
+ * Physics-based simulated valve motor for hosted tests and benchmarks.
+ */
+
+#ifndef ARDUINO_ARCH_AVR
+
+#include <math.h>
+#include "OTRadValve_ValveMotorSimulator.h"
+
+namespace OTRadValve
+{
+
+
+// Copy of these parameters with manufacturing variance applied, deterministically from seed.
+ValveMotorSimulator::Params ValveMotorSimulator::Params::withVariance(const uint32_t seed) const
+  {
+  Params v(*this);
+  // xorshift32, which must not start from zero.
+  uint32_t s = (seed * 2654435761U) | 1;
+  auto vary = [&s](float &x, const float tolerance)
+    {
+    s ^= s << 13; s ^= s >> 17; s ^= s << 5;
+    x *= 1 + (tolerance * (((s & 0xffff) / 32767.5f) - 1));
+    };
+  vary(v.travelUm, 0.1f);
+  vary(v.contactUm, 0.1f);
+  vary(v.springNm, 0.2f);
+  vary(v.frictionOpeningNm, 0.2f);
+  vary(v.frictionClosingNm, 0.2f);
+  vary(v.motorOhm, 0.05f);
+  vary(v.kE, 0.05f);
+  vary(v.mechTimeConstantMS, 0.05f);
+  vary(v.senseCountsPerA, 0.05f);
+  return(v);
+  }
+
+// Replace the parameters, keeping the pin position (clamped to the new travel).
+void ValveMotorSimulator::setParams(const Params &params)
+  {
+  p = params;
+  // Mechanical time constant is J.R/(kE.kT).
+  inertia = (p.mechTimeConstantMS / 1000) * p.kE * p.kE / (p.motorOhm + p.sourceOhm);
+  setPositionUm(pos);
+  }
+
+// Set the pin position, eg for tests; the motor is left stopped.
+void ValveMotorSimulator::setPositionUm(const double um)
+  {
+  pos = (um < 0) ? 0 : ((um > p.travelUm) ? p.travelUm : um);
+  omega = 0;
+  current = 0;
+  }
+
+// Current sense reading, ADC counts [0,1023].
+uint16_t ValveMotorSimulator::getCurrentReading() const
+  {
+  const double counts = fabs(current) * p.senseCountsPerA;
+  return((counts >= 1023) ? 1023 : (uint16_t)counts);
+  }
+
+// Detect (poll) if end-stop is reached or motor current otherwise very high.
+bool ValveMotorSimulator::isCurrentHigh(const motor_drive mdir) const
+  {
+  const uint16_t miHigh = (motorDriveClosing == mdir) ? p.maxCurrentReadingClosing : p.maxCurrentReadingOpening;
+  return(getCurrentReading() > miHigh);
+  }
+
+// Advance by one integration step of dt seconds with the current drive.
+// The gearbox is taken to be self-locking, so only the motor's own momentum moves it when unpowered.
+void ValveMotorSimulator::step(const double dt)
+  {
+  const bool powered = (motorOff != drive);
+  if(!powered && (0 == omega)) { current = 0; subCycleMS += dt * 1000; return; }
+  const double v = (motorDriveClosing == drive) ? supplyV : ((motorDriveOpening == drive) ? -supplyV : 0);
+  current = powered ? ((v - (p.kE * omega)) / (p.motorOhm + p.sourceOhm)) : 0;
+  stats.energyJ += fabs(supplyV * current) * dt;
+  // Valve spring pushes the pin back towards open once in contact with the stem,
+  // though cannot drive the (self-locking) gearbox when unpowered.
+  const double spring = (!powered || (pos <= p.contactUm)) ? 0 : ((p.springNm * (pos - p.contactUm)) / (p.travelUm - p.contactUm));
+  const double net = (p.kE * current) - spring;
+  // Coulomb friction opposing motion, or any motion about to start.
+  const bool closing = (0 != omega) ? (omega > 0) : (net > 0);
+  const double friction = closing ? p.frictionClosingNm : p.frictionOpeningNm;
+  const double oldOmega = omega;
+  if(0 == omega)
+    {
+    if(fabs(net) > friction) { omega = ((net - (closing ? friction : -friction)) / inertia) * dt; }
+    }
+  else
+    {
+    omega += ((net - (closing ? friction : -friction)) / inertia) * dt;
+    // Friction stops but does not reverse motion.
+    if((omega > 0) != (oldOmega > 0)) { omega = 0; }
+    }
+  pos += ((oldOmega + omega) / 2) * dt * p.umPerRad;
+  // Hard end-stops: withdrawn at 0 and the valve seat at full travel.
+  if(pos <= 0) { pos = 0; if(omega < 0) { omega = 0; } }
+  else if(pos >= p.travelUm) { pos = p.travelUm; if(omega > 0) { omega = 0; } }
+  subCycleMS += dt * 1000;
+  }
+
+// Advance by the given time with the current drive.
+void ValveMotorSimulator::advanceMS(const double ms)
+  {
+  const double stepMS = p.tickMS / p.stepsPerTick;
+  for(double t = 0; t < ms; t += stepMS) { step(stepMS / 1000); }
+  if(!overrun && (subCycleMS >= 256 * (double)p.tickMS)) { overrun = true; ++stats.subCycleOverruns; }
+  }
+
+// Spin for up to maxRunTicks as for ValveMotorDirectV1HardwareDriverBase::spinSCTTicks(),
+// with ticks called back (and high current checked) for dir, and the motor driven as already set.
+// Returns true if aborted early from too little time to start, or by high current (assumed end-stop hit).
+bool ValveMotorSimulator::spinSCTTicks(const uint8_t maxRunTicks, const uint8_t minTicksBeforeAbort, const motor_drive dir, HardwareMotorDriverInterfaceCallbackHandler &callback)
+  {
+  const uint8_t sctStart = getSubCycleTime();
+  uint8_t sct = sctStart;
+  const uint8_t maxTicksBeforeAbsLimit = (p.sctAbsLimit - sct);
+  // Abort immediately if not enough time to do minimum run.
+  if((sct >= p.sctAbsLimit) || (maxTicksBeforeAbsLimit < minTicksBeforeAbort)) { return(true); }
+  const bool stopped = (motorOff == dir);
+  const bool isOpening = (motorDriveOpening == dir);
+  const bool driven = (motorOff != drive);
+  bool currentHigh = false;
+  const uint8_t sctMinRunTime = sctStart + minTicksBeforeAbort;
+  const uint8_t sctMaxRunTime = sctStart + ((maxRunTicks < maxTicksBeforeAbsLimit) ? maxRunTicks : maxTicksBeforeAbsLimit);
+  const double dt = (p.tickMS / p.stepsPerTick) / 1000;
+  // Do minimum run time, NOT checking for end-stop / high current.
+  for( ; ; )
+    {
+    step(dt);
+    const uint8_t newSct = getSubCycleTime();
+    if(newSct != sct)
+      {
+      sct = newSct;
+      if(driven) { ++stats.motorTicks; }
+      if(!stopped) { callback.signalRunSCTTick(isOpening); }
+      if(sct >= sctMinRunTime) { break; }
+      }
+    }
+  // Do as much of requested above-minimum run-time as possible.
+  if(sctMaxRunTime > sctMinRunTime)
+    {
+    for( ; ; )
+      {
+      if(isCurrentHigh(dir)) { currentHigh = true; break; }
+      step(dt);
+      const uint8_t newSct = getSubCycleTime();
+      if(newSct != sct)
+        {
+        sct = newSct;
+        if(driven) { ++stats.motorTicks; }
+        if(!stopped) { callback.signalRunSCTTick(isOpening); }
+        if(sct >= sctMaxRunTime) { break; }
+        }
+      }
+    }
+  if(currentHigh)
+    {
+    ++stats.endStopSignals;
+    const double margin = p.travelUm / 100;
+    if((pos > margin) && (pos < p.travelUm - margin)) { ++stats.falseEndStops; }
+    callback.signalHittingEndStop(isOpening);
+    return(true);
+    }
+  return(false);
+  }
+
+// Run or stop the motor, as for ValveMotorDirectV1HardwareDriver.
+void ValveMotorSimulator::motorRun(const uint8_t maxRunTicks, const motor_drive dir, HardwareMotorDriverInterfaceCallbackHandler &callback)
+  {
+  const motor_drive prevDir = lastDir;
+  switch(dir)
+    {
+    case motorDriveClosing:
+    case motorDriveOpening:
+      {
+      ++stats.runs;
+      if((motorOff != prevDir) && (prevDir != dir)) { ++stats.reversals; }
+      // Enforced sleep on change of direction, with the motor not yet driven.
+      if(prevDir != dir) { drive = motorOff; advanceMS(p.dirChangeNapMS); }
+      drive = dir;
+      // Let the motor run up before watching for high current.
+      const uint8_t runTicks = (maxRunTicks > p.minMotorRunupTicks) ? maxRunTicks : p.minMotorRunupTicks;
+      spinSCTTicks(runTicks, p.minMotorRunupTicks, dir, callback);
+      break;
+      }
+
+    case motorOff: default:
+      {
+      // Power off and let the motor coast to a stop, accumulating ticks to the previous direction if running.
+      drive = motorOff;
+      const bool longerWait = (motorOff != prevDir);
+      spinSCTTicks(!longerWait ? p.minMotorHBridgeSettleTicks : p.minMotorRunupTicks, !longerWait ? 0 : p.minMotorRunupTicks/2, prevDir, callback);
+      // Let H-bridge settle.
+      spinSCTTicks(p.minMotorHBridgeSettleTicks, 0, motorOff, callback);
+      if(prevDir != dir) { advanceMS(p.offNapMS); }
+      break;
+      }
+    }
+  if(!overrun && (subCycleMS >= 256 * (double)p.tickMS)) { overrun = true; ++stats.subCycleOverruns; }
+  lastDir = (dir < motorStateInvalid) ? dir : motorOff;
+  }
+
+
+}
+
+#endif // ARDUINO_ARCH_AVR
@@ -0,0 +1,194 @@
+/*
+The OpenTRV project licenses this file to you
+under the Apache Licence, Version 2.0 (the "Licence");
+you may not use this file except in compliance
+with the Licence. You may obtain a copy of the Licence at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing,
+software distributed under the Licence is distributed on an
+"AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+KIND, either express or implied. See the Licence for the
+specific language governing permissions and limitations
+under the Licence.
+
+Author(s) / Copyright (s): Damon Hart-Davis 2016
+*/
+
+/*
+ * Physics-based simulated valve motor and pin behind HardwareMotorDriverInterface,
+ * for hosted regression and performance runs of the valve motor logic
+ * such as CurrentSenseValveMotorDirect, in place of hand-scripted dummy drivers.
+ *
+ * Models a small brushed DC motor driven from a battery with internal resistance
+ * through a gearbox to the pin, which is resisted by friction
+ * and (once in contact with the valve stem) by the valve spring,
+ * between hard end-stops at fully withdrawn (open) and the valve seat (closed).
+ * Shaft speed thus falls with supply voltage and rises and falls with load,
+ * the current sensed rises with load and spikes at stall (eg at an end-stop) and at start-up,
+ * and the pin coasts briefly after power is removed.
+ *
+ * motorRun() follows the REV7/DORM1 ValveMotorDirectV1HardwareDriver timing:
+ * enforced sleeps on change of direction, a run-up period ignoring high current,
+ * a sub-cycle tick callback per tick while driven (or coasting after a run),
+ * and no start too close to the end of the sub-cycle.
+ * Virtual time is in sub-cycle ticks (fractions of the 2s basic cycle);
+ * the caller starts each sub-cycle (ie each poll) with startSubCycle()
+ * and should supply getSubCycleTime() to the logic under test.
+ *
+ * Manufacturing variance between valve bodies and motors
+ * is modelled by randomly perturbing the nominal parameters.
+ *
+ * Not for AVR: uses floating point heavily.
+ */
+
+#ifndef ARDUINO_LIB_OTRADVALVE_VALVEMOTORSIMULATOR_H_
+#define ARDUINO_LIB_OTRADVALVE_VALVEMOTORSIMULATOR_H_
+
+#ifndef ARDUINO_ARCH_AVR
+
+#include <stdint.h>
+#include "OTRadValve_AbstractRadValve.h"
+
+namespace OTRadValve
+{
+
+
+// Simulated valve motor, gearbox, pin and valve.
+// Position is of the pin in um from fully withdrawn (fully open) towards the valve seat (fully closed).
+class ValveMotorSimulator final : public HardwareMotorDriverInterface
+  {
+  public:
+    // Physical and driver parameters; the defaults are roughly those of a REV7 on a typical TRV body.
+    struct Params
+      {
+      // Full pin travel from withdrawn to the valve seat, um.
+      float travelUm = 2500;
+      // Pin travel before meeting the valve stem and its spring, um.
+      float contactUm = 800;
+      // Motor winding resistance, and battery internal plus H-bridge and sense resistance, ohms.
+      float motorOhm = 5;
+      float sourceOhm = 0.3f;
+      // Motor constant: back-EMF V per rad/s, and equally torque Nm per A.
+      float kE = 0.0029f;
+      // Pin travel per radian of motor shaft rotation, um.
+      float umPerRad = 0.32f;
+      // Friction torque at the motor shaft when opening and when closing (eg with seal drag), Nm.
+      float frictionOpeningNm = 0.25e-3f;
+      float frictionClosingNm = 0.45e-3f;
+      // Valve spring torque at the motor shaft at the valve seat, rising linearly from contact, Nm.
+      float springNm = 0.3e-3f;
+      // Mechanical time constant of the motor and load, ms.
+      float mechTimeConstantMS = 10;
+      // Current sense: ADC counts per A (10-bit ADC against the 1.1V reference, ~2 ohm sense).
+      float senseCountsPerA = 1862;
+      // Current sense threshold counts for an end-stop, closing and opening, as for ValveMotorDirectV1HardwareDriverBase.
+      uint16_t maxCurrentReadingClosing = 600;
+      uint16_t maxCurrentReadingOpening = 450;
+      // Sub-cycle tick length, ms: 2000ms basic cycle in 256 ticks for REV7.
+      float tickMS = 2000.0f / 256;
+      // Ticks to run up (not checking for high current) and for the H-bridge to settle, for REV7.
+      uint8_t minMotorRunupTicks = 4;
+      uint8_t minMotorHBridgeSettleTicks = 1;
+      // Sub-cycle tick beyond which the motor is not started, as computeSctAbsLimit() for REV7.
+      uint8_t sctAbsLimit = 230;
+      // Enforced sleeps on change of direction when starting and stopping, ms.
+      uint8_t dirChangeNapMS = 120;
+      uint8_t offNapMS = 60;
+      // Integration steps per sub-cycle tick.
+      uint8_t stepsPerTick = 4;
+
+      // Copy of these parameters with manufacturing variance applied, deterministically from seed.
+      // Geometry varies by up to 10%, spring and friction by up to 20%,
+      // and motor and sense characteristics by up to 5%.
+      Params withVariance(uint32_t seed) const;
+      };
+
+    // Counts of activity.
+    struct Stats
+      {
+      // Sub-cycle ticks with the motor driven, ie a proxy for motor energy.
+      uint32_t motorTicks = 0;
+      // Energy drawn by the motor from the supply, J.
+      double energyJ = 0;
+      // Calls to motorRun() to drive (not stop) the motor, and changes of direction.
+      uint32_t runs = 0;
+      uint32_t reversals = 0;
+      // End-stop hits (high current) signalled, and those not at an end of travel.
+      uint32_t endStopSignals = 0;
+      uint32_t falseEndStops = 0;
+      // Sub-cycles overrun, ie time left the sub-cycle.
+      uint32_t subCycleOverruns = 0;
+      };
+
+  private:
+    Params p;
+    // Moment of inertia at the shaft, derived from the time constant, kg.m^2.
+    float inertia;
+    // Supply (open-circuit battery) voltage.
+    float supplyV = 3;
+
+    // Pin position, um, and shaft speed, rad/s, positive towards closed.
+    double pos = 0;
+    double omega = 0;
+    // Drive applied, and current at the last step, A (signed as omega).
+    motor_drive drive = motorOff;
+    double current = 0;
+    // Last direction driven, as for the hardware driver.
+    motor_drive lastDir = motorOff;
+
+    // Time within the current sub-cycle, ms.
+    double subCycleMS = 0;
+    bool overrun = false;
+
+    Stats stats;
+
+    // Advance by one integration step of dt seconds with the current drive.
+    void step(double dt);
+    // Advance by the given time, eg for a nap, with the current drive.
+    void advanceMS(double ms);
+    // Spin for up to maxRunTicks as for ValveMotorDirectV1HardwareDriverBase::spinSCTTicks(), with the drive already set.
+    bool spinSCTTicks(uint8_t maxRunTicks, uint8_t minTicksBeforeAbort, motor_drive dir, HardwareMotorDriverInterfaceCallbackHandler &callback);
+
+  public:
+    ValveMotorSimulator() { setParams(Params()); }
+    explicit ValveMotorSimulator(const Params &params) { setParams(params); }
+
+    // Replace the parameters, keeping the pin position (clamped to the new travel).
+    void setParams(const Params &params);
+    const Params &getParams() const { return(p); }
+
+    // Set supply voltage, eg to follow battery droop.
+    void setSupplyMV(const uint16_t mV) { supplyV = mV / 1000.0f; }
+    uint16_t getSupplyMV() const { return((uint16_t)(supplyV * 1000 + 0.5f)); }
+
+    // Start a new sub-cycle (eg a poll of the logic) at the given sub-cycle tick.
+    void startSubCycle(const uint8_t sct = 0) { subCycleMS = sct * (double)p.tickMS; overrun = false; }
+    // Current sub-cycle time [0,255], as for OTV0P2BASE::getSubCycleTime().
+    uint8_t getSubCycleTime() const
+      { const double t = subCycleMS / p.tickMS; return((t >= 255) ? 255 : (uint8_t)t); }
+
+    // Pin position, um from fully withdrawn, and as the percentage open [0,100] over the whole travel.
+    double getPositionUm() const { return(pos); }
+    uint8_t getPositionPC() const { return((uint8_t)(100 - (int)((pos * 100) / p.travelUm + 0.5))); }
+    // Set the pin position, eg for tests; the motor is left stopped.
+    void setPositionUm(double um);
+    // Current sense reading, ADC counts [0,1023].
+    uint16_t getCurrentReading() const;
+
+    const Stats &getStats() const { return(stats); }
+
+    // Detect (poll) if end-stop is reached or motor current otherwise very high.
+    virtual bool isCurrentHigh(motor_drive mdir = motorDriveOpening) const override;
+
+    // Run or stop the motor, as for ValveMotorDirectV1HardwareDriver.
+    virtual void motorRun(uint8_t maxRunTicks, motor_drive dir, HardwareMotorDriverInterfaceCallbackHandler &callback) override;
+  };
+
+
+}
+
+#endif // ARDUINO_ARCH_AVR
+
+#endif /* ARDUINO_LIB_OTRADVALVE_VALVEMOTORSIMULATOR_H_ */
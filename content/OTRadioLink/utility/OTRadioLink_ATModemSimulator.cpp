@@ -0,0 +1,368 @@
+/*
+The OpenTRV project licenses this file to you
+under the Apache Licence, Version 2.0 (the "Licence");
+you may not use this file except in compliance
+with the Licence. You may obtain a copy of the Licence at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing,
+software distributed under the Licence is distributed on an
+"AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+KIND, either express or implied. See the Licence for the
+specific language governing permissions and limitations
+under the Licence.
+
+Author(s) / Copyright (s): Damon Hart-Davis 2016
+*/
+
+/*
+ * Scriptable simulated serial command modem for hosted tests and benchmarks of radio links.
+ */
+
+#ifndef ARDUINO_ARCH_AVR
+
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include "OTRadioLink_ATModemSimulator.h"
+
+
+namespace OTRadioLink
+    {
+
+
+// Longest command line kept; the rest is discarded.
+static const size_t MAX_LINE = 1024;
+
+// Next value from the simulator's generator (xorshift32).
+uint32_t ATModemSimulator::nextRandom()
+    {
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+    return(rng);
+    }
+
+uint32_t ATModemSimulator::nextLatencyUs()
+    {
+    if(latencyMaxUs <= latencyMinUs) { return(latencyMinUs); }
+    return(latencyMinUs + (nextRandom() % (latencyMaxUs - latencyMinUs + 1)));
+    }
+
+// Add a rule; rules are tried in the order added.
+void ATModemSimulator::addRule(const std::string &pattern, CommandHandler handler)
+    {
+    Rule r;
+    r.pattern = pattern;
+    r.handler = handler;
+    rules.push_back(r);
+    }
+
+// Add a rule with a fixed reply.
+void ATModemSimulator::addRule(const std::string &pattern, const std::string &reply)
+    { addRule(pattern, [reply](ATModemSimulator &, const std::string &) { return(reply); }); }
+
+// Run command through the rules as if received, returning the reply.
+std::string ATModemSimulator::dispatch(const std::string &command)
+    {
+    for(const Rule &r : rules)
+        {
+        const size_t n = r.pattern.size();
+        const bool isPrefix = (n > 0) && ('*' == r.pattern[n - 1]);
+        const bool match = isPrefix ? (0 == command.compare(0, n - 1, r.pattern, 0, n - 1)) : (command == r.pattern);
+        if(match) { return(r.handler(*this, command)); }
+        }
+    return(defaultReply);
+    }
+
+// From within a handler, treat the next n bytes written as data to be passed to h.
+void ATModemSimulator::expectData(const size_t n, DataHandler h)
+    {
+    dataRemaining = n;
+    data.clear();
+    dataHandler = h;
+    }
+
+// Send s after delayUs from now, subject to pacing and corruption.
+void ATModemSimulator::sendUnsolicited(const std::string &s, const uint32_t delayUs)
+    {
+    if(inHandler) { pending.push_back(std::make_pair(s, delayUs)); }
+    else { emit(s, delayUs); }
+    }
+
+// Send n random bytes after delayUs from now.
+void ATModemSimulator::injectGarbage(const size_t n, const uint32_t delayUs)
+    {
+    std::string g;
+    for(size_t i = 0; i < n; ++i) { g += (char)nextRandom(); }
+    sendUnsolicited(g, delayUs);
+    }
+
+void ATModemSimulator::emit(const std::string &s, const uint32_t delayUs)
+    {
+    if(s.empty()) { return; }
+    const uint32_t bt = byteTimeUs();
+    uint64_t at = std::max(t + delayUs, outFreeAt);
+    for(const char c : s)
+        {
+        at += bt;
+        uint8_t b = (uint8_t)c;
+        if((garbageRate > 0) && (random01() < garbageRate)) { b = (uint8_t)nextRandom(); ++stats.corrupted; }
+        out.push_back(std::make_pair(at, b));
+        }
+    outFreeAt = at;
+    }
+
+void ATModemSimulator::sendReply(const std::string &reply)
+    {
+    emit(reply, nextLatencyUs() + extraReplyDelayUs);
+    extraReplyDelayUs = 0;
+    std::vector<std::pair<std::string, uint32_t> > p;
+    p.swap(pending);
+    for(const auto &u : p) { emit(u.first, u.second); }
+    }
+
+void ATModemSimulator::handleLine(const std::string &command)
+    {
+    ++stats.commands;
+    if((lossRate > 0) && (random01() < lossRate)) { ++stats.lost; return; }
+    if(echo) { emit(command + "\r\n", 0); }
+    extraReplyDelayUs = 0;
+    inHandler = true;
+    const std::string reply = dispatch(command);
+    inHandler = false;
+    sendReply(reply);
+    }
+
+size_t ATModemSimulator::write(const uint8_t c)
+    {
+    ++stats.bytesIn;
+    // The sender is held up while the byte is sent.
+    t += byteTimeUs();
+    if(!responsive) { return(1); }
+    const bool skipLF = afterCR && ('\n' == c);
+    afterCR = false;
+    if(skipLF) { return(1); }
+    if(0 != dataRemaining)
+        {
+        data += (char)c;
+        if(0 == --dataRemaining)
+            {
+            ++stats.dataBlocks;
+            DataHandler h;
+            h.swap(dataHandler);
+            std::string d;
+            d.swap(data);
+            extraReplyDelayUs = 0;
+            inHandler = true;
+            const std::string reply = h(*this, d);
+            inHandler = false;
+            sendReply(reply);
+            }
+        return(1);
+        }
+    if(('\r' == c) || ('\n' == c))
+        {
+        afterCR = ('\r' == c);
+        if(!line.empty())
+            {
+            std::string command;
+            command.swap(line);
+            handleLine(command);
+            }
+        return(1);
+        }
+    if(line.size() < MAX_LINE) { line += (char)c; }
+    return(1);
+    }
+
+int ATModemSimulator::available()
+    {
+    int n = 0;
+    for(const auto &b : out) { if(b.first > t) { break; } ++n; }
+    return(n);
+    }
+
+int ATModemSimulator::read()
+    {
+    if(out.empty() || (out.front().first > t)) { return(-1); }
+    const uint8_t c = out.front().second;
+    out.pop_front();
+    ++stats.bytesOut;
+    return(c);
+    }
+
+int ATModemSimulator::peek()
+    {
+    if(out.empty() || (out.front().first > t)) { return(-1); }
+    return(out.front().second);
+    }
+
+
+// Text as after 'STATE: ' in the AT+CIPSTATUS reply.
+const char *SIM900CommandSet::ipStateName(const IPState s)
+    {
+    switch(s)
+        {
+        case IP_INITIAL: return("IP INITIAL");
+        case IP_START: return("IP START");
+        case IP_GPRSACT: return("IP GPRSACT");
+        case CONNECT_OK: return("CONNECT OK");
+        case IP_CLOSE: return("IP CLOSE");
+        case PDP_DEACT: return("PDP DEACT");
+        }
+    return("");
+    }
+
+// Restart the modem: unregistered (for registrationDelayUs) with no GPRS context.
+void SIM900CommandSet::reboot()
+    {
+    ipState = IP_INITIAL;
+    registeredAt = ((NULL == sim) ? 0 : sim->now()) + registrationDelayUs;
+    if(NULL != sim) { sim->flushOutput(); }
+    }
+
+// Install the command set on sim, replacing any rules, and turn on echo.
+void SIM900CommandSet::install(ATModemSimulator &s)
+    {
+    typedef ATModemSimulator M;
+    typedef const std::string C;
+    static const std::string OK("\r\nOK\r\n");
+    static const std::string ERROR("\r\nERROR\r\n");
+    sim = &s;
+    s.clearRules();
+    s.setEcho(true);
+    s.setDefaultReply(ERROR);
+    s.addRule("AT", OK);
+    s.addRule("AT+CPIN?", [this](M &, C &) { return(std::string(pinReady ? "\r\n+CPIN: READY\r\n" : "\r\n+CPIN: SIM PIN\r\n") + OK); });
+    s.addRule("AT+CREG?", [this](M &m, C &) { return(std::string("\r\n+CREG: 0,") + ((m.now() >= registeredAt) ? "1" : "2") + "\r\n" + OK); });
+    s.addRule("AT+CSTT=*", [this](M &, C &) { if(IP_INITIAL == ipState) { ipState = IP_START; } return(OK); });
+    s.addRule("AT+CIICR", [this](M &m, C &)
+        {
+        if((IP_START != ipState) || (m.now() < registeredAt)) { return(ERROR); }
+        ipState = IP_GPRSACT;
+        m.addReplyDelay(gprsDelayUs);
+        return(OK);
+        });
+    s.addRule("AT+CIFSR", [this](M &, C &) { return(((IP_GPRSACT == ipState) || (CONNECT_OK == ipState)) ? std::string("\r\n10.0.0.2\r\n") : ERROR); });
+    s.addRule("AT+CIPSTATUS", [this](M &, C &) { return(OK + "\r\nSTATE: " + ipStateName(ipState) + "\r\n"); });
+    s.addRule("AT+CIPSTART=*", [this](M &m, C &)
+        {
+        if((IP_GPRSACT != ipState) && (IP_CLOSE != ipState)) { return(ERROR); }
+        ipState = CONNECT_OK;
+        m.sendUnsolicited("\r\nCONNECT OK\r\n", connectDelayUs);
+        return(OK);
+        });
+    s.addRule("AT+CIPSEND=*", [this](M &m, C &command)
+        {
+        const long n = atol(command.c_str() + 11);
+        if((CONNECT_OK != ipState) || (n <= 0) || (n > 1460)) { return(ERROR); }
+        m.expectData((size_t)n, [this](M &, C &d) { datagrams.push_back(d); return(std::string("\r\nSEND OK\r\n")); });
+        return(std::string("\r\n> "));
+        });
+    s.addRule("AT+CSQ", [this](M &, C &) { return("\r\n+CSQ: " + std::to_string(rssi) + ",0\r\n" + OK); });
+    s.addRule("AT+CIPCLOSE", [this](M &, C &) { if(CONNECT_OK != ipState) { return(ERROR); } ipState = IP_CLOSE; return(std::string("\r\nCLOSE OK\r\n")); });
+    s.addRule("AT+CIPSHUT", [this](M &, C &) { ipState = IP_INITIAL; return(std::string("\r\nSHUT OK\r\n")); });
+    }
+
+
+// Time on air in microseconds of a LoRaWAN frame with the given application payload length at data rate dr.
+// As from the Semtech SX1272/3 datasheet with 8 preamble symbols, explicit header, CRC,
+// and low data rate optimisation at SF11 and SF12.
+uint32_t RN2483CommandSet::airtimeUs(const uint8_t payloadLength, const uint8_t dr)
+    {
+    const int sf = 12 - ((dr > 5) ? 5 : dr);
+    const double tSymUs = (double)(1UL << sf) * 1e6 / 125000;
+    const int de = (sf >= 11) ? 1 : 0;
+    // MAC header, frame header, port and MIC add 13 bytes.
+    const int pl = 13 + payloadLength;
+    const int num = (8 * pl) - (4 * sf) + 28 + 16;
+    const int den = 4 * (sf - (2 * de));
+    const int payloadSymbols = 8 + ((num > 0) ? (((num + den - 1) / den) * 5) : 0);
+    return((uint32_t)(((8 + 4.25 + payloadSymbols) * tSymUs) + 0.5));
+    }
+
+// Parse hex digit, or -1 if not one.
+static int hexDigit(const char c)
+    {
+    if((c >= '0') && (c <= '9')) { return(c - '0'); }
+    if((c >= 'A') && (c <= 'F')) { return(c - 'A' + 10); }
+    if((c >= 'a') && (c <= 'f')) { return(c - 'a' + 10); }
+    return(-1);
+    }
+
+// Handle 'mac tx <cnf|uncnf> <port> <hex data>'.
+std::string RN2483CommandSet::tx(const std::string &args)
+    {
+    static const std::string INVALID("invalid_param\r\n");
+    const size_t typeEnd = args.find(' ');
+    if(std::string::npos == typeEnd) { return(INVALID); }
+    const std::string type(args, 0, typeEnd);
+    if((type != "uncnf") && (type != "cnf")) { return(INVALID); }
+    const size_t portEnd = args.find(' ', typeEnd + 1);
+    if(std::string::npos == portEnd) { return(INVALID); }
+    const int port = atoi(args.c_str() + typeEnd + 1);
+    if((port < 1) || (port > 223)) { return(INVALID); }
+    const std::string hex(args, portEnd + 1);
+    if(0 != (hex.size() & 1)) { return(INVALID); }
+    std::string payload;
+    for(size_t i = 0; i < hex.size(); i += 2)
+        {
+        const int h = hexDigit(hex[i]), l = hexDigit(hex[i + 1]);
+        if((h < 0) || (l < 0)) { return(INVALID); }
+        payload += (char)((h << 4) | l);
+        }
+    // EU868 maximum application payload by data rate.
+    const size_t maxPayload = (dataRate <= 2) ? 51 : ((3 == dataRate) ? 115 : 222);
+    if(payload.size() > maxPayload) { return("invalid_data_len\r\n"); }
+    if(!joined) { return("not_joined\r\n"); }
+    const uint64_t now = sim->now();
+    if(now < txDoneAt) { ++busy; return("busy\r\n"); }
+    channelFreeAt.resize((0 == channels) ? 1 : channels, 0);
+    const auto c = std::find_if(channelFreeAt.begin(), channelFreeAt.end(), [now](const uint64_t f) { return(f <= now); });
+    if(channelFreeAt.end() == c) { ++noFreeChannel; return("no_free_ch\r\n"); }
+    const uint32_t a = airtimeUs((uint8_t)payload.size(), dataRate);
+    *c = now + (uint64_t)(a * (100.0 * channelFreeAt.size() / dutyCyclePercent));
+    txDoneAt = now + a + rxWindowsUs;
+    payloads.push_back(payload);
+    ports.push_back((uint8_t)port);
+    sim->sendUnsolicited("mac_tx_ok\r\n", a + rxWindowsUs);
+    return("ok\r\n");
+    }
+
+// Install the command set on sim, replacing any rules, and turn off echo.
+void RN2483CommandSet::install(ATModemSimulator &s)
+    {
+    typedef ATModemSimulator M;
+    typedef const std::string C;
+    static const std::string OK("ok\r\n");
+    static const std::string INVALID("invalid_param\r\n");
+    static const std::string VERSION("RN2483 1.0.1 Dec 15 2015 09:38:09\r\n");
+    sim = &s;
+    s.clearRules();
+    s.setEcho(false);
+    s.setDefaultReply(INVALID);
+    s.addRule("U*", [](M &m, C &command) { return(m.dispatch(command.substr(1))); });
+    s.addRule("sys reset", [this](M &, C &) { reboot(); return(VERSION); });
+    s.addRule("sys get ver", VERSION);
+    s.addRule("sys sleep *", [](M &m, C &command) { m.addReplyDelay((uint32_t)atol(command.c_str() + 10) * 1000); return(OK); });
+    s.addRule("mac set dr *", [this](M &, C &command)
+        {
+        const int dr = atoi(command.c_str() + 11);
+        if((dr < 0) || (dr > 5)) { return(INVALID); }
+        dataRate = (uint8_t)dr;
+        return(OK);
+        });
+    s.addRule("mac set *", OK);
+    s.addRule("mac join abp", [this](M &m, C &) { joined = true; m.sendUnsolicited("accepted\r\n"); return(OK); });
+    s.addRule("mac get status", [this](M &, C &) { return(std::string(joined ? "0001\r\n" : "0000\r\n")); });
+    s.addRule("mac get dr", [this](M &, C &) { return(std::to_string(dataRate) + "\r\n"); });
+    s.addRule("mac tx *", [this](M &, C &command) { return(tx(command.substr(7))); });
+    s.addRule("mac save", OK);
+    }
+
+
+    }
+
+#endif // ARDUINO_ARCH_AVR
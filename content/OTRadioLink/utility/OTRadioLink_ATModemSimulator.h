@@ -0,0 +1,318 @@
+/*
+The OpenTRV project licenses this file to you
+under the Apache Licence, Version 2.0 (the "Licence");
+you may not use this file except in compliance
+with the Licence. You may obtain a copy of the Licence at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing,
+software distributed under the Licence is distributed on an
+"AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+KIND, either express or implied. See the Licence for the
+specific language governing permissions and limitations
+under the Licence.
+
+Author(s) / Copyright (s): Damon Hart-Davis 2016
+*/
+
+/*
+ * Scriptable simulated serial command modem for hosted tests and benchmarks of radio links,
+ * eg OTSIM900Link and OTRN2483Link, so that their state machines can be tuned off hardware.
+ *
+ * The simulator implements Stream, and runs on virtual time (in microseconds)
+ * advanced by the test (eg between calls to poll()) and by bytes written to it.
+ * It can delay responses, lose commands, corrupt response bytes,
+ * and pace both directions at a given baud rate.
+ * Behaviour for each command is scripted with rules,
+ * and command sets for the SIM900 and RN2483 are provided.
+ *
+ * Not for AVR: uses heap allocation.
+ */
+
+#ifndef ARDUINO_LIB_OTRADIOLINK_ATMODEMSIMULATOR_H
+#define ARDUINO_LIB_OTRADIOLINK_ATMODEMSIMULATOR_H
+
+#ifndef ARDUINO_ARCH_AVR
+
+#include <stddef.h>
+#include <stdint.h>
+#include <deque>
+#include <functional>
+#include <string>
+#include <vector>
+#include <OTV0p2Base.h>
+
+
+namespace OTRadioLink
+    {
+
+
+    // Simulated modem on the far end of a serial line.
+    //
+    // Input is split into command lines at CR or LF (a CR LF pair ends one line),
+    // and each line is passed to the first rule that matches it,
+    // whose reply is sent back after the configured latency.
+    // A rule's handler may instead take the following bytes as binary data (see expectData()),
+    // eg for the body of a SIM900 AT+CIPSEND.
+    //
+    // Each byte written costs one byte time at the configured baud rate,
+    // as for a blocking UART, and reply bytes become readable only once fully sent.
+    // Random effects are from a seeded generator so runs are repeatable.
+    class ATModemSimulator final : public Stream
+        {
+        public:
+            // Handler for a complete command line (without CR/LF); returns the reply, possibly empty.
+            typedef std::function<std::string(ATModemSimulator &sim, const std::string &command)> CommandHandler;
+            // Handler for a complete block of data requested with expectData(); returns the reply, possibly empty.
+            typedef std::function<std::string(ATModemSimulator &sim, const std::string &data)> DataHandler;
+
+            // Counts of activity.
+            struct Stats
+                {
+                // Command lines received, including those lost.
+                uint32_t commands = 0;
+                // Command lines ignored as lost.
+                uint32_t lost = 0;
+                // Blocks of data received.
+                uint32_t dataBlocks = 0;
+                // Bytes written to and read from the simulator.
+                uint32_t bytesIn = 0;
+                uint32_t bytesOut = 0;
+                // Reply bytes corrupted.
+                uint32_t corrupted = 0;
+                };
+
+        private:
+            struct Rule
+                {
+                std::string pattern;
+                CommandHandler handler;
+                };
+            std::vector<Rule> rules;
+            std::string defaultReply;
+
+            bool echo = false;
+            bool responsive = true;
+            unsigned long baud = 0;
+            uint32_t latencyMinUs = 0;
+            uint32_t latencyMaxUs = 0;
+            float lossRate = 0;
+            float garbageRate = 0;
+            uint32_t rng = 1;
+
+            // Virtual time now.
+            uint64_t t = 0;
+            // Reply bytes in order, each with the time it has been fully sent.
+            std::deque<std::pair<uint64_t, uint8_t> > out;
+            // Time the simulated modem's transmitter is next free.
+            uint64_t outFreeAt = 0;
+            // Extra delay for the reply being generated, from addReplyDelay().
+            uint32_t extraReplyDelayUs = 0;
+
+            // True while a handler runs, when sendUnsolicited() output follows the reply, and that output.
+            bool inHandler = false;
+            std::vector<std::pair<std::string, uint32_t> > pending;
+
+            // Command line being received.
+            std::string line;
+            // True immediately after a CR ending a line, to discard any following LF.
+            bool afterCR = false;
+            // Data block being received, and its handler.
+            size_t dataRemaining = 0;
+            std::string data;
+            DataHandler dataHandler;
+
+            Stats stats;
+
+            // Time for one byte (start, 8 data and stop bits) in microseconds; 0 if unpaced.
+            uint32_t byteTimeUs() const { return((0 == baud) ? 0 : (uint32_t)(10000000UL / baud)); }
+            // Random value in [0,1).
+            float random01() { return((nextRandom() >> 8) / (float)(1UL << 24)); }
+            // Reply latency for the next reply.
+            uint32_t nextLatencyUs();
+            // Queue s to be sent starting delayUs from now, or once the transmitter is free if later.
+            void emit(const std::string &s, uint32_t delayUs);
+            // Send the reply from a handler, followed by anything it sent with sendUnsolicited().
+            void sendReply(const std::string &reply);
+            // Handle a complete command line.
+            void handleLine(const std::string &command);
+
+        public:
+            // Next value from the simulator's generator, eg for use by rules.
+            uint32_t nextRandom();
+
+            // Add a rule; rules are tried in the order added.
+            // A pattern ending in '*' matches any command starting with the rest of it,
+            // else the command must match exactly.
+            void addRule(const std::string &pattern, CommandHandler handler);
+            // Add a rule with a fixed reply.
+            void addRule(const std::string &pattern, const std::string &reply);
+            // Reply to commands matching no rule.
+            void setDefaultReply(const std::string &reply) { defaultReply = reply; }
+            // Remove all rules and the default reply.
+            void clearRules() { rules.clear(); defaultReply.clear(); }
+            // Run command through the rules as if received (without echo, loss or latency), returning the reply.
+            std::string dispatch(const std::string &command);
+
+            // If true, each command line is echoed back immediately, as by a SIM900 with ATE1.
+            void setEcho(const bool e) { echo = e; }
+            // Baud rate for pacing, or 0 for no pacing.
+            void setBaud(const unsigned long b) { baud = b; }
+            // Delay before a reply starts, chosen uniformly from [minUs,maxUs] for each reply.
+            void setLatency(const uint32_t minUs, const uint32_t maxUs) { latencyMinUs = minUs; latencyMaxUs = (maxUs < minUs) ? minUs : maxUs; }
+            // Fraction [0,1] of command lines ignored entirely, as if lost on the line.
+            void setLossRate(const float r) { lossRate = r; }
+            // Fraction [0,1] of reply bytes replaced with random values.
+            void setGarbageRate(const float r) { garbageRate = r; }
+            // Seed the random generator (non-zero).
+            void setSeed(const uint32_t s) { rng = (0 == s) ? 1 : s; }
+            // If false the simulator ignores all input, eg as if powered off; queued output is unaffected.
+            void setResponsive(const bool r) { responsive = r; if(!r) { line.clear(); dataRemaining = 0; } }
+            bool isResponsive() const { return(responsive); }
+
+            // From within a handler, treat the next n bytes written as data to be passed to h.
+            void expectData(size_t n, DataHandler h);
+            // From within a handler, delay the reply being generated by a further us.
+            void addReplyDelay(const uint32_t us) { extraReplyDelayUs += us; }
+            // Send s (eg an unsolicited or late result) after delayUs from now, subject to pacing and corruption.
+            void sendUnsolicited(const std::string &s, uint32_t delayUs = 0);
+            // Send n random bytes after delayUs from now.
+            void injectGarbage(size_t n, uint32_t delayUs = 0);
+            // Receive a break, which as a framing error discards any partial command line.
+            void sendBreak() { if(responsive) { line.clear(); } afterCR = false; t += 2 * byteTimeUs(); }
+            // Discard all output not yet read.
+            void flushOutput() { out.clear(); }
+
+            // Virtual time in microseconds.
+            uint64_t now() const { return(t); }
+            // Advance virtual time.
+            void advance(const uint64_t us) { t += us; }
+
+            const Stats &getStats() const { return(stats); }
+
+            // Serial interface as used by the links.
+            void begin(unsigned long) { }
+            void begin() { }
+            virtual size_t write(uint8_t c) override;
+            using Print::write;
+            virtual int available() override;
+            virtual int read() override;
+            virtual int peek() override;
+            virtual void flush() override { }
+        };
+
+    // Stream that forwards to an ATModemSimulator, for use as the serial type of a link
+    // which (like OTSIM900Link) constructs its own serial object.
+    // Each distinct id gives an independent port; if sim is NULL the port behaves as a dead line.
+    template<int id = 0>
+    class ATModemSimulatorPort final : public Stream
+        {
+        public:
+            // Simulator to forward to.
+            static ATModemSimulator *sim;
+
+            void begin(unsigned long) { }
+            void begin() { }
+            virtual size_t write(uint8_t c) override { return((NULL == sim) ? 1 : sim->write(c)); }
+            using Print::write;
+            virtual int available() override { return((NULL == sim) ? 0 : sim->available()); }
+            virtual int read() override { return((NULL == sim) ? -1 : sim->read()); }
+            virtual int peek() override { return((NULL == sim) ? -1 : sim->peek()); }
+            virtual void flush() override { }
+            void sendBreak() { if(NULL != sim) { sim->sendBreak(); } }
+        };
+    template<int id> ATModemSimulator *ATModemSimulatorPort<id>::sim = NULL;
+
+    // SIM900 GSM/GPRS modem command set, as used by OTSIM900Link.
+    //
+    // Tracks the registration and IP (UDP) state as from AT+CIPSTATUS,
+    // and collects datagrams sent with AT+CIPSEND.
+    // Power-key toggles are not visible to the simulator, so tests model a power cycle with reboot().
+    // AT+CSTT is accepted in any state.
+    class SIM900CommandSet final
+        {
+        public:
+            // IP state as reported by AT+CIPSTATUS.
+            enum IPState { IP_INITIAL, IP_START, IP_GPRSACT, CONNECT_OK, IP_CLOSE, PDP_DEACT };
+
+            // Time after reboot() before registered with the network.
+            uint32_t registrationDelayUs = 0;
+            // Extra delay for AT+CIICR to complete.
+            uint32_t gprsDelayUs = 0;
+            // Delay after OK to AT+CIPSTART before CONNECT OK.
+            uint32_t connectDelayUs = 0;
+            // RSSI as reported by AT+CSQ.
+            uint8_t rssi = 14;
+            // If false, AT+CPIN? reports that a PIN is needed.
+            bool pinReady = true;
+            // Bodies of datagrams sent.
+            std::vector<std::string> datagrams;
+
+        private:
+            IPState ipState = IP_INITIAL;
+            uint64_t registeredAt = 0;
+            ATModemSimulator *sim = NULL;
+
+        public:
+            // Install the command set on sim, replacing any rules, and turn on echo; call reboot() first if need be.
+            void install(ATModemSimulator &s);
+            // Restart the modem: unregistered (for registrationDelayUs) with no GPRS context.
+            void reboot();
+            // Lose the GPRS context, as from network action.
+            void dropGPRS() { ipState = PDP_DEACT; }
+            IPState getIPState() const { return(ipState); }
+            // Text as after 'STATE: ' in the AT+CIPSTATUS reply.
+            static const char *ipStateName(IPState s);
+        };
+
+    // RN2483 LoRaWAN modem command set, as used by OTRN2483Link.
+    //
+    // Models EU868 transmissions at the current data rate (125kHz bandwidth, coding rate 4/5),
+    // replying 'ok' to 'mac tx' and then 'mac_tx_ok' once the frame would have been sent,
+    // and 'no_free_ch' if the duty cycle limit would be exceeded.
+    // A leading 'U' (the autobaud sync character after a break) is ignored.
+    class RN2483CommandSet final
+        {
+        public:
+            // Data rate 0 (SF12) to 5 (SF7).
+            uint8_t dataRate = 5;
+            // Duty cycle limit, percent.
+            float dutyCyclePercent = 1;
+            // Channels sharing the duty cycle limit equally, the first free being used for each transmission.
+            // The RN2483 has 3 by default, at 0.33% each.
+            uint8_t channels = 1;
+            // Further delay after the time on air before 'mac_tx_ok', eg for the receive windows.
+            uint32_t rxWindowsUs = 0;
+            // Decoded payloads sent, and the port each was sent on.
+            std::vector<std::string> payloads;
+            std::vector<uint8_t> ports;
+            // Transmissions refused for duty cycle, and as one was in progress.
+            uint32_t noFreeChannel = 0;
+            uint32_t busy = 0;
+
+        private:
+            bool joined = false;
+            // Time each channel is next free, and the time the transmission in progress (if any) completes.
+            std::vector<uint64_t> channelFreeAt;
+            uint64_t txDoneAt = 0;
+            ATModemSimulator *sim = NULL;
+
+            std::string tx(const std::string &args);
+
+        public:
+            // Install the command set on sim, replacing any rules, and turn off echo.
+            void install(ATModemSimulator &s);
+            // Restart the modem: not joined, default data rate, channels free.
+            void reboot() { joined = false; dataRate = 5; channelFreeAt.clear(); txDoneAt = 0; }
+            bool isJoined() const { return(joined); }
+            // Time on air in microseconds of a LoRaWAN frame with the given application payload length at data rate dr.
+            static uint32_t airtimeUs(uint8_t payloadLength, uint8_t dr);
+        };
+
+
+    }
+
+#endif // ARDUINO_ARCH_AVR
+
+#endif
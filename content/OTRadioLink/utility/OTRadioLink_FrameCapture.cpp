@@ -0,0 +1,499 @@
+/*
+The OpenTRV project licenses this file to you
+under the Apache Licence, Version 2.0 (the "Licence");
+you may not use this file except in compliance
+with the Licence. You may obtain a copy of the Licence at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing,
+software distributed under the Licence is distributed on an
+"AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+KIND, either express or implied. See the Licence for the
+specific language governing permissions and limitations
+under the Licence.
+
+Author(s) / Copyright (s): Damon Hart-Davis 2016
+*/
+
+/*
+ * Hosted compact binary capture and replay of received frames.
+ */
+
+#ifndef ARDUINO_ARCH_AVR
+
+#include <string.h>
+#include <algorithm>
+#include <thread>
+
+#include "OTRadioLink_FrameCapture.h"
+
+#include "OTRadioLink_SecureableFrameType.h"
+#include "OTV0P2BASE_JSONStats.h"
+#include "OTV0P2BASE_SimpleBinaryStats.h"
+
+namespace OTRadioLink
+    {
+
+
+constexpr uint32_t FrameCaptureWriter::DEFAULT_FRAMES_PER_INDEX;
+
+// Record kinds, as the first byte of each record.
+// A frame record carries its node bucket in the low bits.
+static const uint8_t kindFrame = 0x80;
+static const uint8_t kindFrameMask = 0xe0;
+static const uint8_t kindIndex = 'I';
+// Maximum length of an encoded 64-bit varint.
+static const uint8_t maxVarintBytes = 10;
+// Frame record bytes after the varint: channel, rssi, len.
+static const uint8_t frameFixedBytes = 3;
+
+static const uint8_t fileMagic[4] = { 'O', 'T', 'F', 'C' };
+static const uint8_t indexMagic[4] = { 'O', 'T', 'F', 'I' };
+
+static void putLE(uint8_t *const p, uint64_t v, const uint8_t n)
+    { for(uint8_t i = 0; i < n; ++i) { p[i] = (uint8_t)v; v >>= 8; } }
+static uint64_t getLE(const uint8_t *const p, const uint8_t n)
+    {
+    uint64_t v = 0;
+    for(uint8_t i = n; i-- > 0; ) { v = (v << 8) | p[i]; }
+    return(v);
+    }
+
+// Decoded index block.
+struct IndexBlock
+    {
+    uint32_t frames;
+    uint32_t bucketMask;
+    uint64_t segmentStart;
+    uint64_t firstMS, lastMS;
+    uint64_t previousIndex;
+    };
+
+static void encodeIndex(uint8_t *const b, const IndexBlock &ib)
+    {
+    memset(b, 0, FrameCaptureIndexBytes);
+    b[0] = kindIndex;
+    putLE(b + 4, ib.frames, 4);
+    putLE(b + 8, ib.bucketMask, 4);
+    putLE(b + 12, ib.segmentStart, 8);
+    putLE(b + 20, ib.firstMS, 8);
+    putLE(b + 28, ib.lastMS, 8);
+    putLE(b + 36, ib.previousIndex, 8);
+    memcpy(b + 44, indexMagic, sizeof(indexMagic));
+    }
+// Returns false if b does not look like an index block.
+static bool decodeIndex(const uint8_t *const b, IndexBlock &ib)
+    {
+    if((kindIndex != b[0]) || (0 != memcmp(b + 44, indexMagic, sizeof(indexMagic)))) { return(false); }
+    ib.frames = (uint32_t)getLE(b + 4, 4);
+    ib.bucketMask = (uint32_t)getLE(b + 8, 4);
+    ib.segmentStart = getLE(b + 12, 8);
+    ib.firstMS = getLE(b + 20, 8);
+    ib.lastMS = getLE(b + 28, 8);
+    ib.previousIndex = getLE(b + 36, 8);
+    return(true);
+    }
+
+static bool isGoodHeader(const uint8_t *const data, const size_t size)
+    {
+    return((NULL != data) && (size >= FrameCaptureHeaderBytes) &&
+        (0 == memcmp(data, fileMagic, sizeof(fileMagic))) && (FrameCaptureVersion == data[4]));
+    }
+
+// Classify the frame buf[0,buflen) with classifyFrame(), returning the first byte of the sender's ID (or 0) in nodeByte.
+// Decodes the header into sfh for secureable frames.
+static FrameDemuxClass classify(const uint8_t *const buf, const uint8_t buflen, SecurableFrameHeader &sfh, uint8_t &nodeByte)
+    {
+    nodeByte = 0;
+    const FrameDemuxClass c = classifyFrame(buf, buflen);
+    switch(c)
+        {
+        case FDC_SECURE:
+        case FDC_SECUREABLE:
+            {
+            // Header already known to be valid and complete within the buffer.
+            sfh.checkAndDecodeSmallFrameHeader(buf, buflen);
+            if(sfh.getIl() > 0) { nodeByte = sfh.id[0]; }
+            break;
+            }
+        case FDC_CC1:
+            {
+            if(buflen > 1) { nodeByte = buf[1]; }
+            break;
+            }
+        case FDC_FULL_STATS:
+            {
+            const uint8_t header = buf[0];
+            if((buflen > 1) && (0 != (header & OTV0P2BASE::MESSAGING_FULL_STATS_HEADER_BITS_ID_PRESENT)))
+                { nodeByte = buf[1] | ((0 != (header & OTV0P2BASE::MESSAGING_FULL_STATS_HEADER_BITS_ID_HIGH)) ? 0x80 : 0); }
+            break;
+            }
+        case FDC_JSON:
+            {
+            // Leading "@" field with at least two hex digits.
+            static const char prefix[] = "{\"@\":\"";
+            const uint8_t pl = sizeof(prefix) - 1;
+            if((buflen >= pl + 2) && (0 == memcmp(buf, prefix, pl)))
+                {
+                uint8_t v = 0;
+                bool ok = true;
+                for(uint8_t i = 0; i < 2; ++i)
+                    {
+                    const uint8_t ch = buf[pl + i];
+                    uint8_t d;
+                    if((ch >= '0') && (ch <= '9')) { d = ch - '0'; }
+                    else if((ch >= 'a') && (ch <= 'f')) { d = ch - 'a' + 10; }
+                    else if((ch >= 'A') && (ch <= 'F')) { d = ch - 'A' + 10; }
+                    else { ok = false; break; }
+                    v = (uint8_t)((v << 4) | d);
+                    }
+                if(ok) { nodeByte = v; }
+                }
+            break;
+            }
+        default: { break; }
+        }
+    return(c);
+    }
+
+static inline uint8_t bucketOf(const uint8_t nodeByte) { return(nodeByte % FrameCaptureNodeBuckets); }
+
+// Fully decode/check a frame already classified as c.
+static bool decodeClassified(const uint8_t *const buf, const uint8_t buflen, const FrameDemuxClass c, const SecurableFrameHeader &sfh)
+    {
+    switch(c)
+        {
+        case FDC_SECURE: { return(true); }
+        case FDC_SECUREABLE: { return(0 != decodeNonsecureSmallFrameRaw(&sfh, buf, buflen)); }
+        case FDC_FULL_STATS:
+            {
+            OTV0P2BASE::FullStatsMessageCore_t content;
+            return(NULL != OTV0P2BASE::decodeFullStatsMessageCore(buf, buflen, OTV0P2BASE::stTXalwaysAll, false, &content));
+            }
+        case FDC_JSON: { return(OTV0P2BASE::checkJSONMsgRXCRC(buf, buflen) > 0); }
+        default: { return(false); }
+        }
+    }
+
+// Node bucket of the frame at the start of buf.
+uint8_t getFrameCaptureNodeBucket(const uint8_t *const buf, const uint8_t buflen)
+    {
+    SecurableFrameHeader sfh;
+    uint8_t nodeByte;
+    classify(buf, buflen, sfh, nodeByte);
+    return(bucketOf(nodeByte));
+    }
+
+FrameCaptureWriter::FrameCaptureWriter(const uint32_t framesPerIndex_)
+  : f(NULL), framesPerIndex((0 == framesPerIndex_) ? 1 : framesPerIndex_),
+    size(0), previousIndex(0), segmentStart(0), segmentFrames(0), bucketMask(0), firstMS(0), lastMS(0)
+    { }
+
+// Open the named capture file for appending, closing any currently open first.
+bool FrameCaptureWriter::open(const char *const path)
+    {
+    close();
+    if(NULL == path) { return(false); } // ERROR
+    // Check any existing content.
+    uint64_t existing = 0;
+    uint64_t lastIndex = 0;
+    FILE *const r = fopen(path, "rb");
+    if(NULL != r)
+        {
+        bool ok = (0 == fseek(r, 0, SEEK_END));
+        const long l = ok ? ftell(r) : -1;
+        if(l < 0) { ok = false; }
+        else { existing = (uint64_t)l; }
+        if(ok && (existing > 0))
+            {
+            uint8_t h[FrameCaptureHeaderBytes];
+            ok = (0 == fseek(r, 0, SEEK_SET)) && (1 == fread(h, sizeof(h), 1, r)) && isGoodHeader(h, sizeof(h));
+            // Must end with an index block, unless just the header.
+            if(ok && (existing > FrameCaptureHeaderBytes))
+                {
+                uint8_t b[FrameCaptureIndexBytes];
+                IndexBlock ib;
+                ok = (existing >= FrameCaptureHeaderBytes + FrameCaptureIndexBytes) &&
+                    (0 == fseek(r, (long)(existing - FrameCaptureIndexBytes), SEEK_SET)) &&
+                    (1 == fread(b, sizeof(b), 1, r)) && decodeIndex(b, ib);
+                lastIndex = existing - FrameCaptureIndexBytes;
+                }
+            }
+        fclose(r);
+        if(!ok) { return(false); } // ERROR: not a cleanly-closed capture.
+        }
+    f = fopen(path, "ab");
+    if(NULL == f) { return(false); } // ERROR
+    size = existing;
+    previousIndex = lastIndex;
+    if(0 == size)
+        {
+        uint8_t h[FrameCaptureHeaderBytes] = { };
+        memcpy(h, fileMagic, sizeof(fileMagic));
+        h[4] = FrameCaptureVersion;
+        if(1 != fwrite(h, sizeof(h), 1, f)) { fclose(f); f = NULL; return(false); } // ERROR
+        size = sizeof(h);
+        }
+    segmentStart = size;
+    segmentFrames = 0;
+    bucketMask = 0;
+    return(true);
+    }
+
+// Close the current segment with an index block if it has any frames.
+bool FrameCaptureWriter::endSegment()
+    {
+    if(0 == segmentFrames) { return(true); }
+    IndexBlock ib;
+    ib.frames = segmentFrames;
+    ib.bucketMask = bucketMask;
+    ib.segmentStart = segmentStart;
+    ib.firstMS = firstMS;
+    ib.lastMS = lastMS;
+    ib.previousIndex = previousIndex;
+    uint8_t b[FrameCaptureIndexBytes];
+    encodeIndex(b, ib);
+    if(1 != fwrite(b, sizeof(b), 1, f)) { return(false); } // ERROR
+    previousIndex = size;
+    size += sizeof(b);
+    segmentStart = size;
+    segmentFrames = 0;
+    bucketMask = 0;
+    return(true);
+    }
+
+// Append a received frame.
+bool FrameCaptureWriter::append(const uint64_t timeMS, const uint8_t channel, const uint8_t rssi, const uint8_t *const buf, const uint8_t buflen)
+    {
+    if((NULL == f) || (NULL == buf)) { return(false); } // ERROR
+    // Time going backwards or a full segment starts a new one.
+    if((segmentFrames > 0) && ((timeMS < lastMS) || (segmentFrames >= framesPerIndex)))
+        { if(!endSegment()) { return(false); } } // ERROR
+    uint8_t h[1 + maxVarintBytes + frameFixedBytes];
+    const uint8_t bucket = getFrameCaptureNodeBucket(buf, buflen);
+    uint8_t n = 0;
+    h[n++] = kindFrame | bucket;
+    uint64_t dt = (0 == segmentFrames) ? timeMS : (timeMS - lastMS);
+    do
+        {
+        const uint8_t b = (uint8_t)(dt & 0x7f);
+        dt >>= 7;
+        h[n++] = (0 == dt) ? b : (b | 0x80);
+        } while(0 != dt);
+    h[n++] = channel;
+    h[n++] = rssi;
+    h[n++] = buflen;
+    if(1 != fwrite(h, n, 1, f)) { return(false); } // ERROR
+    if((buflen > 0) && (1 != fwrite(buf, buflen, 1, f))) { return(false); } // ERROR
+    size += n + buflen;
+    if(0 == segmentFrames) { firstMS = timeMS; }
+    lastMS = timeMS;
+    ++segmentFrames;
+    bucketMask |= (uint32_t)1 << bucket;
+    return(true);
+    }
+
+// End the current segment and flush to the OS.
+bool FrameCaptureWriter::flush()
+    {
+    if(NULL == f) { return(false); } // ERROR
+    const bool ok = endSegment();
+    return((0 == fflush(f)) && ok);
+    }
+
+// End the current segment and close the file; idempotent.
+bool FrameCaptureWriter::close()
+    {
+    if(NULL == f) { return(true); }
+    const bool ok = endSegment();
+    const bool closed = (0 == fclose(f));
+    f = NULL;
+    return(ok && closed);
+    }
+
+// Read all frames in data[0,size).
+FrameCaptureReader::FrameCaptureReader(const uint8_t *const data_, const size_t size)
+  : data(data_), pos(0), end(0), lastMS(0), valid(isGoodHeader(data_, size)), damaged(false)
+    {
+    if(valid) { pos = FrameCaptureHeaderBytes; end = size; }
+    }
+
+// Read just the frames of one segment.
+FrameCaptureReader::FrameCaptureReader(const uint8_t *const data_, const size_t size, const FrameCaptureSegment &segment)
+  : data(data_), pos(0), end(0), lastMS(0), valid(isGoodHeader(data_, size)), damaged(false)
+    {
+    if(valid && (segment.start >= FrameCaptureHeaderBytes) && (segment.start <= segment.end) && (segment.end <= size))
+        { pos = segment.start; end = segment.end; }
+    }
+
+// Get the next frame, returning false at the end of the capture or segment.
+bool FrameCaptureReader::next(FrameCaptureRecord &r)
+    {
+    while(pos < end)
+        {
+        const uint8_t kind = data[pos];
+        if(kindIndex == kind)
+            {
+            // Next segment starts with an absolute time.
+            IndexBlock ib;
+            if((end - pos < FrameCaptureIndexBytes) || !decodeIndex(data + pos, ib)) { break; } // Damaged.
+            pos += FrameCaptureIndexBytes;
+            lastMS = 0;
+            continue;
+            }
+        if(kindFrame != (kind & kindFrameMask)) { break; } // Damaged.
+        size_t p = pos + 1;
+        uint64_t dt = 0;
+        uint8_t shift = 0;
+        bool more = true;
+        while(more && (p < end) && (shift < 7 * maxVarintBytes))
+            {
+            const uint8_t b = data[p++];
+            dt |= (uint64_t)(b & 0x7f) << shift;
+            shift += 7;
+            more = (0 != (b & 0x80));
+            }
+        if(more || (end - p < frameFixedBytes)) { break; } // Damaged.
+        const uint8_t len = data[p + 2];
+        if(end - p - frameFixedBytes < len) { break; } // Damaged.
+        lastMS += dt;
+        r.timeMS = lastMS;
+        r.channel = data[p];
+        r.rssi = data[p + 1];
+        r.bucket = kind & ~kindFrameMask;
+        r.len = len;
+        r.frame = data + p + frameFixedBytes;
+        pos = p + frameFixedBytes + len;
+        return(true);
+        }
+    if(pos < end) { damaged = true; pos = end; }
+    return(false);
+    }
+
+// Scan record headers from the start of the capture to build the segment list.
+static void scanSegments(const uint8_t *const data, const size_t size, std::vector<FrameCaptureSegment> &segments)
+    {
+    segments.clear();
+    FrameCaptureReader reader(data, size);
+    FrameCaptureSegment s = { FrameCaptureHeaderBytes, FrameCaptureHeaderBytes, 0, 0, 0, 0 };
+    FrameCaptureRecord r;
+    while(reader.next(r))
+        {
+        const size_t recordEnd = (size_t)(r.frame - data) + r.len;
+        // An index block straight after the previous frame closes that segment.
+        if((s.frames > 0) && (kindIndex == data[s.end]))
+            {
+            IndexBlock ib;
+            if(decodeIndex(data + s.end, ib)) { s.bucketMask = ib.bucketMask; }
+            segments.push_back(s);
+            s.start = s.end + FrameCaptureIndexBytes;
+            s.frames = 0;
+            }
+        if(0 == s.frames) { s.firstMS = r.timeMS; s.bucketMask = ~(uint32_t)0; }
+        s.end = recordEnd;
+        s.lastMS = r.timeMS;
+        ++s.frames;
+        }
+    if(s.frames > 0)
+        {
+        IndexBlock ib;
+        if((size - s.end >= FrameCaptureIndexBytes) && decodeIndex(data + s.end, ib)) { s.bucketMask = ib.bucketMask; }
+        segments.push_back(s);
+        }
+    }
+
+// Split the capture data[0,size) into segments.
+bool FrameCaptureReader::getSegments(const uint8_t *const data, const size_t size, std::vector<FrameCaptureSegment> &segments)
+    {
+    segments.clear();
+    if(!isGoodHeader(data, size)) { return(false); } // ERROR
+    // Follow the index chain back from the end.
+    size_t at = size - FrameCaptureIndexBytes;
+    bool chained = (size >= (size_t)FrameCaptureHeaderBytes + FrameCaptureIndexBytes);
+    while(chained)
+        {
+        IndexBlock ib;
+        if(!decodeIndex(data + at, ib) || (ib.segmentStart < FrameCaptureHeaderBytes) || (ib.segmentStart >= at) || (0 == ib.frames))
+            { chained = false; break; }
+        const FrameCaptureSegment s = { (size_t)ib.segmentStart, at, ib.frames, ib.bucketMask, ib.firstMS, ib.lastMS };
+        segments.push_back(s);
+        if(FrameCaptureHeaderBytes == ib.segmentStart) { break; } // Reached the first segment.
+        // The previous index block must immediately precede this segment.
+        if(ib.previousIndex + FrameCaptureIndexBytes != ib.segmentStart) { chained = false; break; }
+        at = (size_t)ib.previousIndex;
+        }
+    if(chained) { std::reverse(segments.begin(), segments.end()); }
+    else { scanSegments(data, size, segments); }
+    return(true);
+    }
+
+// Classify and decode the frame buf[0,buflen) as for replay.
+FrameDemuxClass FrameCaptureReplay::decodeFrame(const uint8_t *const buf, const uint8_t buflen, bool &decoded, uint8_t &bucket)
+    {
+    SecurableFrameHeader sfh;
+    uint8_t nodeByte;
+    const FrameDemuxClass c = classify(buf, buflen, sfh, nodeByte);
+    bucket = bucketOf(nodeByte);
+    decoded = decodeClassified(buf, buflen, c, sfh);
+    return(c);
+    }
+
+// Replay one shard of the given segments of the capture data[0,size).
+FrameCaptureReplayStats FrameCaptureReplay::replayShard(const uint8_t *const data, const size_t size,
+        const std::vector<FrameCaptureSegment> &segments, const uint8_t shard, const uint8_t shards) const
+    {
+    FrameCaptureReplayStats stats;
+    if((0 == shards) || (shard >= shards)) { return(stats); } // ERROR
+    // Buckets belonging to this shard.
+    uint32_t mine = 0;
+    for(uint8_t b = shard; b < FrameCaptureNodeBuckets; b += shards) { mine |= (uint32_t)1 << b; }
+    for(const FrameCaptureSegment &s : segments)
+        {
+        if(0 == (s.bucketMask & mine)) { continue; } // None of this shard's nodes.
+        FrameCaptureReader reader(data, size, s);
+        FrameCaptureRecord r;
+        while(reader.next(r))
+            {
+            if(0 == (mine & ((uint32_t)1 << r.bucket))) { continue; }
+            SecurableFrameHeader sfh;
+            uint8_t nodeByte;
+            const FrameDemuxClass c = classify(r.frame, r.len, sfh, nodeByte);
+            const bool decoded = decodeClassified(r.frame, r.len, c, sfh);
+            ++stats.frames;
+            stats.bytes += r.len;
+            ++stats.byClass[c];
+            if(decoded) { ++stats.decoded[c]; }
+            if(r.timeMS < stats.firstMS) { stats.firstMS = r.timeMS; }
+            if(r.timeMS > stats.lastMS) { stats.lastMS = r.timeMS; }
+            if(NULL != handler) { handler(context, r, c, decoded); }
+            }
+        if(reader.isDamaged()) { stats.damaged = true; }
+        }
+    return(stats);
+    }
+
+// Replay the capture data[0,size), returning the combined result of all shards.
+FrameCaptureReplayStats FrameCaptureReplay::replay(const uint8_t *const data, const size_t size) const
+    {
+    FrameCaptureReplayStats total;
+    std::vector<FrameCaptureSegment> segments;
+    if(!FrameCaptureReader::getSegments(data, size, segments)) { total.damaged = true; return(total); } // ERROR
+    const uint8_t shards = std::max<uint8_t>(1, std::min<uint8_t>(threads, FrameCaptureNodeBuckets));
+    if(1 == shards) { return(replayShard(data, size, segments, 0, 1)); }
+    std::vector<FrameCaptureReplayStats> results(shards);
+    std::vector<std::thread> workers;
+    for(uint8_t i = 0; i < shards; ++i)
+        {
+        workers.push_back(std::thread([this, data, size, &segments, &results, i, shards]()
+            { results[i] = replayShard(data, size, segments, i, shards); }));
+        }
+    for(std::thread &t : workers) { t.join(); }
+    for(const FrameCaptureReplayStats &s : results) { total += s; }
+    return(total);
+    }
+
+
+    }
+
+#endif // ARDUINO_ARCH_AVR
@@ -0,0 +1,283 @@
+/*
+The OpenTRV project licenses this file to you
+under the Apache Licence, Version 2.0 (the "Licence");
+you may not use this file except in compliance
+with the Licence. You may obtain a copy of the Licence at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing,
+software distributed under the Licence is distributed on an
+"AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+KIND, either express or implied. See the Licence for the
+specific language governing permissions and limitations
+under the Licence.
+
+Author(s) / Copyright (s): Damon Hart-Davis 2016
+*/
+
+/*
+ * Hosted compact binary capture of received frames,
+ * and fast (optionally multithreaded) replay of captures through the frame decoders,
+ * as a much smaller and quicker alternative to hub text logs from printRXMsg()/dumpRXMsg().
+ *
+ * Capture file layout, all multi-byte values little-endian:
+ *
+ *   header:  'O' 'T' 'F' 'C' version(1) 0 0 0
+ *   then segments, each of one or more frame records followed by one index block.
+ *
+ *   frame record:  kind dt channel rssi len frame[len]
+ *     kind is 0x80 | the frame's node bucket (see getFrameCaptureNodeBucket()),
+ *     so that a replay shard can skip other nodes' frames without decoding them.
+ *     dt is an unsigned LEB128 varint of ms since the previous frame in the segment,
+ *     or since the epoch for the first frame of a segment,
+ *     so each segment can be decoded on its own.
+ *     rssi is the RSSI or error byte as supplied by the radio/caller.
+ *
+ *   index block (FrameCaptureIndexBytes):  'I' 0 0 0 frames(4) bucketMask(4)
+ *     segmentStart(8) firstMS(8) lastMS(8) previousIndex(8) 'O' 'T' 'F' 'I'
+ *     previousIndex is the offset of the previous index block, or 0 if none,
+ *     so a cleanly-closed file can be split into segments from its tail without a scan.
+ *     Bit b of bucketMask is set if the segment has a frame in node bucket b,
+ *     letting a replay shard skip segments with none of its nodes.
+ *
+ * The file is only ever appended to.
+ * A file cut short (eg by a crash) can still be read up to the last complete record.
+ *
+ * Not for AVR: uses heap allocation, stdio and threads.
+ */
+
+#ifndef ARDUINO_LIB_OTRADIOLINK_FRAMECAPTURE_H
+#define ARDUINO_LIB_OTRADIOLINK_FRAMECAPTURE_H
+
+#ifndef ARDUINO_ARCH_AVR
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+
+#include "OTRadioLink_FrameDemux.h"
+
+
+namespace OTRadioLink
+    {
+
+
+    // Capture file format version.
+    static const uint8_t FrameCaptureVersion = 1;
+    // Size of the file header.
+    static const uint8_t FrameCaptureHeaderBytes = 8;
+    // Size of an index block.
+    static const uint8_t FrameCaptureIndexBytes = 48;
+    // Number of node buckets used for sharding and segment masks.
+    static const uint8_t FrameCaptureNodeBuckets = 32;
+
+    // One captured frame.
+    struct FrameCaptureRecord final
+        {
+        // Receive time, ms since the epoch.
+        uint64_t timeMS;
+        // Radio channel received on.
+        uint8_t channel;
+        // RSSI or error byte.
+        uint8_t rssi;
+        // Node bucket, as recorded by the writer.
+        uint8_t bucket;
+        // Frame length and raw frame bytes, pointing into the capture data.
+        uint8_t len;
+        const uint8_t *frame;
+        };
+
+    // One segment of a capture file: frame records followed by their index block.
+    struct FrameCaptureSegment final
+        {
+        // Offset of the first frame record, and of the end of the last.
+        size_t start, end;
+        // Number of frames.
+        uint32_t frames;
+        // Bit b set if any frame is in node bucket b; all set if not known.
+        uint32_t bucketMask;
+        // Time of the first and last frames, ms since the epoch.
+        uint64_t firstMS, lastMS;
+        };
+
+    // Node bucket in [0,FrameCaptureNodeBuckets-1] of the frame at the start of buf,
+    // from the first byte of the sender's ID where it can be found cheaply:
+    //   * secureable frames: first ID byte
+    //   * full stats frames with ID: id0
+    //   * JSON frames starting {"@":"hh: the first two hex digits of the ID
+    //   * CC1 frames: the first house code byte
+    // All frames from a node thus land in the same bucket
+    // (a full stats frame's id0 has the same value as the first byte of the full ID).
+    // Anything else, including anonymous frames, is bucket 0.
+    uint8_t getFrameCaptureNodeBucket(const uint8_t *buf, uint8_t buflen);
+
+    // Append-only writer of capture files.
+    // Frames are buffered by stdio: call flush() or close() to be sure that they are on disc.
+    // An index block is written every framesPerIndex frames, on flush() and on close(),
+    // and where the time goes backwards (eg after a clock correction).
+    // Not thread-safe.
+    class FrameCaptureWriter final
+        {
+        public:
+            // Default number of frames per segment.
+            static constexpr uint32_t DEFAULT_FRAMES_PER_INDEX = 4096;
+
+        private:
+            FILE *f;
+            // Frames per segment.
+            const uint32_t framesPerIndex;
+            // Current file size.
+            uint64_t size;
+            // Offset of the previous index block, or 0 if none.
+            uint64_t previousIndex;
+            // State of the current segment.
+            uint64_t segmentStart;
+            uint32_t segmentFrames;
+            uint32_t bucketMask;
+            uint64_t firstMS, lastMS;
+
+            // Close the current segment with an index block if it has any frames; false on error.
+            bool endSegment();
+
+        public:
+            explicit FrameCaptureWriter(uint32_t framesPerIndex = DEFAULT_FRAMES_PER_INDEX);
+            ~FrameCaptureWriter() { close(); }
+            FrameCaptureWriter(const FrameCaptureWriter &) = delete;
+            FrameCaptureWriter &operator=(const FrameCaptureWriter &) = delete;
+
+            // Open the named capture file for appending, closing any currently open first.
+            // Creates the file if absent or empty.
+            // Refuses (returns false) to extend a file that is not a capture
+            // or that was not cleanly closed, ie does not end with an index block,
+            // to avoid appending to a damaged record.
+            bool open(const char *path);
+
+            // Append a received frame; returns false if not open, buf is NULL, or on a write error.
+            //   * timeMS  receive time, ms since the epoch
+            //   * channel  radio channel received on
+            //   * rssi  RSSI or error byte
+            bool append(uint64_t timeMS, uint8_t channel, uint8_t rssi, const uint8_t *buf, uint8_t buflen);
+
+            // End the current segment and flush to the OS; returns false on error.
+            bool flush();
+
+            // End the current segment and close the file; idempotent.
+            // Returns false on error.
+            bool close();
+
+            // True if a file is open.
+            bool isOpen() const { return(NULL != f); }
+            // Current file size in bytes.
+            uint64_t getSize() const { return(size); }
+        };
+
+    // Streaming reader over a capture held in memory, eg memory-mapped with OTV0P2BASE::MappedFile.
+    // Does no allocation and does not copy frames.
+    // Stops at the first truncated or corrupt record, which is flagged by isDamaged().
+    class FrameCaptureReader final
+        {
+        private:
+            const uint8_t *const data;
+            // Current and end offsets.
+            size_t pos, end;
+            // Time of the previous frame in the segment.
+            uint64_t lastMS;
+            // True if the header is good.
+            bool valid;
+            // True if reading stopped at a damaged record.
+            bool damaged;
+
+        public:
+            // Read all frames in data[0,size).
+            FrameCaptureReader(const uint8_t *data, size_t size);
+            // Read just the frames of one segment, as from getSegments(), of data[0,size).
+            FrameCaptureReader(const uint8_t *data, size_t size, const FrameCaptureSegment &segment);
+
+            // True if the capture header is good.
+            bool isValid() const { return(valid); }
+            // True if reading stopped at a truncated or corrupt record.
+            bool isDamaged() const { return(damaged); }
+
+            // Get the next frame, returning false at the end of the capture or segment.
+            bool next(FrameCaptureRecord &r);
+
+            // Split the capture data[0,size) into segments; returns false if the header is bad.
+            // Uses the index blocks chained back from the end of a cleanly-closed file,
+            // else (or if the chain is inconsistent) scans the record headers,
+            // with any trailing frames not yet indexed making up a final segment with an unknown bucket mask.
+            static bool getSegments(const uint8_t *data, size_t size, std::vector<FrameCaptureSegment> &segments);
+        };
+
+    // Result of a replay.
+    struct FrameCaptureReplayStats final
+        {
+        // Frames replayed, and their total length.
+        uint64_t frames = 0;
+        uint64_t bytes = 0;
+        // Frames of each class.
+        uint64_t byClass[FDC_COUNT] = { };
+        // Frames of each class that decoded successfully:
+        //   * FDC_SECURE  header good (the body cannot be authenticated without keys)
+        //   * FDC_SECUREABLE  decodeNonsecureSmallFrameRaw() including CRC
+        //   * FDC_FULL_STATS  decodeFullStatsMessageCore()
+        //   * FDC_JSON  checkJSONMsgRXCRC()
+        //   * others  never
+        uint64_t decoded[FDC_COUNT] = { };
+        // Time of the earliest and latest frames replayed; firstMS > lastMS if none.
+        uint64_t firstMS = UINT64_MAX;
+        uint64_t lastMS = 0;
+        // True if a damaged record was met.
+        bool damaged = false;
+
+        // Accumulate another result, eg from another shard.
+        FrameCaptureReplayStats &operator+=(const FrameCaptureReplayStats &o)
+            {
+            frames += o.frames; bytes += o.bytes;
+            for(uint8_t c = 0; c < FDC_COUNT; ++c) { byClass[c] += o.byClass[c]; decoded[c] += o.decoded[c]; }
+            if(o.firstMS < firstMS) { firstMS = o.firstMS; }
+            if(o.lastMS > lastMS) { lastMS = o.lastMS; }
+            damaged |= o.damaged;
+            return(*this);
+            }
+        };
+
+    // Replays a capture through the frame decoders, optionally sharded by node across threads.
+    //
+    // Each shard handles the nodes in buckets b where (b % shards) is its number,
+    // and replays their frames in capture order,
+    // so per-node state (eg RX message counters) can be kept by the handler without locking.
+    class FrameCaptureReplay final
+        {
+        public:
+            // Handler for each replayed frame of class c, which decoded successfully if decoded is true.
+            // Called concurrently from the shard threads, each with its own nodes;
+            // r.frame is valid only for the duration of the call.
+            typedef void FrameCaptureHandler_t(void *context, const FrameCaptureRecord &r, FrameDemuxClass c, bool decoded);
+
+            // Replay parameters.
+            // Number of shards, each run on its own thread; [1,FrameCaptureNodeBuckets].
+            uint8_t threads = 1;
+            // Optional handler and its context.
+            FrameCaptureHandler_t *handler = NULL;
+            void *context = NULL;
+
+            // Replay the capture data[0,size), eg memory-mapped, returning the combined result of all shards.
+            FrameCaptureReplayStats replay(const uint8_t *data, size_t size) const;
+
+            // Replay one shard of the given segments of the capture data[0,size).
+            FrameCaptureReplayStats replayShard(const uint8_t *data, size_t size,
+                const std::vector<FrameCaptureSegment> &segments, uint8_t shard, uint8_t shards) const;
+
+            // Classify and decode the frame buf[0,buflen) as for replay, returning its class,
+            // and setting decoded as for FrameCaptureReplayStats::decoded and bucket as getFrameCaptureNodeBucket().
+            static FrameDemuxClass decodeFrame(const uint8_t *buf, uint8_t buflen, bool &decoded, uint8_t &bucket);
+        };
+
+
+    }
+
+#endif // ARDUINO_ARCH_AVR
+
+#endif
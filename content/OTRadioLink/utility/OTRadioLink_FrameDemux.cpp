@@ -0,0 +1,157 @@
+/*
+The OpenTRV project licenses this file to you
+under the Apache Licence, Version 2.0 (the "Licence");
+you may not use this file except in compliance
+with the Licence. You may obtain a copy of the Licence at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing,
+software distributed under the Licence is distributed on an
+"AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+KIND, either express or implied. See the Licence for the
+specific language governing permissions and limitations
+under the Licence.
+
+Author(s) / Copyright (s): Damon Hart-Davis 2016
+*/
+
+/*
+ * Demultiplexing of received frames by protocol/frame type.
+ */
+
+#include "OTRadioLink_FrameDemux.h"
+
+#include "OTRadioLink_SecureableFrameType.h"
+#include "OTRadioLink_OTRadioLink.h"
+
+namespace OTRadioLink
+    {
+
+
+// Classify a received frame at the start of buf, with up to buflen bytes available.
+FrameDemuxClass classifyFrame(const volatile uint8_t *const buf, const uint8_t buflen)
+    {
+    if((NULL == buf) || (0 == buflen)) { return(FDC_UNKNOWN); }
+    // Length-first secureable frame, complete within the buffer.
+    SecurableFrameView sfv;
+    if((0 != sfv.checkAndDecodeSmallFrameHeader(buf, buflen)) && sfv.isComplete())
+        { return(sfv.isSecure() ? FDC_SECURE : FDC_SECUREABLE); }
+    // V0p2 FS20-carrier frames, by leading byte.
+    const uint8_t firstByte = buf[0];
+    switch(firstByte)
+        {
+        case FTp2_CC1Alert:
+        case FTp2_CC1PollAndCmd:
+        case FTp2_CC1PollResponse: { return(FDC_CC1); }
+        case FTp2_FullStatsIDL:
+        case FTp2_FullStatsIDH: { return(FDC_FULL_STATS); }
+        case FTp2_FS20_native: { return(FDC_FS20); }
+        case FTp2_JSONRaw: { return(FDC_JSON); }
+        default: { break; }
+        }
+    return(FDC_UNKNOWN);
+    }
+
+// Length of the frame of class c (as from classifyFrame()) at the start of buf.
+uint8_t getFrameDemuxLength(const volatile uint8_t *const buf, const uint8_t buflen, const FrameDemuxClass c)
+    {
+    if((NULL == buf) || (0 == buflen)) { return(0); }
+    volatile uint8_t len = buflen;
+    switch(c)
+        {
+        // Fixed-length frames.
+        case FDC_CC1: { return((buflen > V0P2_MESSAGING_CC1_BYTES) ? V0P2_MESSAGING_CC1_BYTES : buflen); }
+        // Length-first frames, known by classifyFrame() to be complete within buflen.
+        case FDC_SECURE:
+        case FDC_SECUREABLE: { return((uint8_t)(buf[0] + 1)); }
+        case FDC_JSON:
+            {
+            // Closing '}' has its high bit set and is followed by the CRC.
+            for(uint8_t i = 1; i < buflen; ++i)
+                { if(('}' | 0x80) == buf[i]) { return((i + 2 > buflen) ? buflen : (uint8_t)(i + 2)); } }
+            break; // Unterminated: just trim.
+            }
+        case FDC_FULL_STATS:
+            {
+            if(len > V0P2_MESSAGING_LEADING_FULL_STATS_MAX_BYTES_ON_WIRE) { len = V0P2_MESSAGING_LEADING_FULL_STATS_MAX_BYTES_ON_WIRE; }
+            break;
+            }
+        default: { break; }
+        }
+    frameFilterTrailingZeros(buf, len);
+    return(len);
+    }
+
+// Create with no routes, so all frames are dropped, and default priorities.
+FrameDemux::FrameDemux() : lastServed(FDC_COUNT - 1)
+    {
+    for(uint8_t c = 0; c < FDC_COUNT; ++c)
+        {
+        routes[c].queue = NULL;
+        routes[c].maxLen = 0;
+        routes[c].priority = c;
+        routes[c].handler = NULL;
+        routes[c].context = NULL;
+        routedRecent[c] = 0;
+        droppedRecent[c] = 0;
+        }
+    }
+
+// Set (or with q NULL clear) the route for class c.
+bool FrameDemux::setRoute(const FrameDemuxClass c, ISRRXQueue *const q, FrameHandler_t *const handler, void *const context)
+    { return(setRoute(c, q, handler, context, (uint8_t)c)); }
+bool FrameDemux::setRoute(const FrameDemuxClass c, ISRRXQueue *const q, FrameHandler_t *const handler, void *const context, const uint8_t priority)
+    {
+    if(c >= FDC_COUNT) { return(false); } // ERROR
+    Route &r = routes[c];
+    uint8_t queueMin = 0, maxLen = 0;
+    if(NULL != q) { q->getRXCapacity(queueMin, maxLen); }
+    r.queue = q;
+    r.maxLen = maxLen;
+    r.priority = priority;
+    r.handler = handler;
+    r.context = context;
+    return(true);
+    }
+
+// Dispatch up to maxFrames queued frames to their handlers, highest priority first.
+uint8_t FrameDemux::dispatch(const uint8_t maxFrames)
+    {
+    uint8_t n = 0;
+    while(n < maxFrames)
+        {
+        // Find the highest-priority non-empty queue,
+        // starting just after the class last served so that equal priorities take turns.
+        uint8_t best = FDC_COUNT;
+        for(uint8_t i = 1; i <= FDC_COUNT; ++i)
+            {
+            const uint8_t c = (uint8_t)((lastServed + i) % FDC_COUNT);
+            const Route &r = routes[c];
+            if((NULL == r.queue) || r.queue->isEmpty()) { continue; }
+            if((FDC_COUNT == best) || (r.priority < routes[best].priority)) { best = c; }
+            }
+        if(FDC_COUNT == best) { break; } // Nothing waiting.
+        const Route &r = routes[best];
+        const volatile uint8_t *const msg = r.queue->peekRXMsg();
+        if(NULL != msg)
+            {
+            if(NULL != r.handler) { r.handler(r.context, msg, msg[-1]); }
+            r.queue->removeRXMsg();
+            }
+        lastServed = best;
+        ++n;
+        }
+    return(n);
+    }
+
+// Total frames waiting across all class queues.
+uint8_t FrameDemux::getQueued() const
+    {
+    uint8_t n = 0;
+    for(uint8_t c = 0; c < FDC_COUNT; ++c) { n += getQueued((FrameDemuxClass)c); }
+    return(n);
+    }
+
+
+    }
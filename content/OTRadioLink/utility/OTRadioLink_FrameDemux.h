@@ -0,0 +1,194 @@
+/*
+The OpenTRV project licenses this file to you
+under the Apache Licence, Version 2.0 (the "Licence");
+you may not use this file except in compliance
+with the Licence. You may obtain a copy of the Licence at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing,
+software distributed under the Licence is distributed on an
+"AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+KIND, either express or implied. See the Licence for the
+specific language governing permissions and limitations
+under the Licence.
+
+Author(s) / Copyright (s): Damon Hart-Davis 2016
+*/
+
+/*
+ * Demultiplexing of received frames by protocol/frame type
+ * into per-type bounded queues with registered handlers,
+ * serviced in priority order.
+ */
+
+#ifndef ARDUINO_LIB_OTRADIOLINK_FRAMEDEMUX_H
+#define ARDUINO_LIB_OTRADIOLINK_FRAMEDEMUX_H
+
+#include <stdint.h>
+#include <OTV0p2Base.h>
+
+#include "OTRadioLink_FrameType.h"
+#include "OTRadioLink_ISRRXQueue.h"
+
+
+namespace OTRadioLink
+    {
+
+
+    // Classes of received frame distinguished by the demultiplexer.
+    // The order is the default priority order, highest first.
+    enum FrameDemuxClass
+        {
+        FDC_CC1 = 0,        // Minimal central-control V1 frames: FTp2_CC1Alert, FTp2_CC1PollAndCmd, FTp2_CC1PollResponse.
+        FDC_SECURE,         // Secureable (length-first) frame with the secure bit set in the type.
+        FDC_SECUREABLE,     // Secureable (length-first) frame without the secure bit.
+        FDC_FULL_STATS,     // Standalone V0p2 full stats frame: FTp2_FullStatsIDL, FTp2_FullStatsIDH.
+        FDC_FS20,           // FS20 encoded frame: FTp2_FS20_native.
+        FDC_JSON,           // Raw JSON frame: FTp2_JSONRaw.
+        FDC_UNKNOWN,        // Anything else.
+        FDC_COUNT           // Number of classes; not a valid class.
+        };
+
+    // Classify a received frame at the start of buf, with up to buflen bytes available.
+    // As for the V0p2 RX path, structurally-valid complete secureable frames are recognised first,
+    // then the V0p2 FS20-carrier frame types by their leading byte.
+    // Does only cheap header checks: the handler must still fully validate the frame (CRC, authentication, etc).
+    // ISR-safe.
+    FrameDemuxClass classifyFrame(const volatile uint8_t *buf, uint8_t buflen);
+
+    // Length of the frame of class c (as from classifyFrame()) at the start of buf, in [1,buflen] if buflen > 0.
+    // Radios without hardware packet handling (eg the RFM23B with an OOK carrier)
+    // may hand over a whole fixed-size buffer, with the frame followed by junk or zeros,
+    // so this finds the frame's own length where it can cheaply:
+    //   * FDC_CC1  fixed 8 bytes including CRC
+    //   * FDC_SECURE/FDC_SECUREABLE  length byte plus one
+    //   * FDC_JSON  up to and including the CRC after the closing '}' (with its high bit set)
+    //   * FDC_FULL_STATS  at most 8 bytes, less trailing zeros
+    //   * others  buflen less trailing zeros, as frameFilterTrailingZeros()
+    // ISR-safe.
+    uint8_t getFrameDemuxLength(const volatile uint8_t *buf, uint8_t buflen, FrameDemuxClass c);
+
+    // Demultiplexes received frames into a bounded queue per frame class,
+    // and dispatches them from the main loop to a registered handler per class
+    // in priority order, so that (eg) short CC1 alerts and secure valve frames
+    // are not stuck behind long JSON or FS20 frames in a single RX queue.
+    //
+    // Frames are classified once as they are received, by _route() in the RX ISR
+    // (installed with frameFilterDemux()) and copied into the class queue,
+    // or dropped and counted if that class has no route or its queue is full or too small.
+    // Each class may be given a queue sized for its frames, eg ISRRXQueue1Deep<8> for CC1 frames,
+    // to keep RAM use down.
+    //
+    // dispatch() serves the non-empty queue of highest priority (lowest number),
+    // round-robin between queues of equal priority;
+    // with strict priority a steady flood of higher-priority frames can starve lower ones,
+    // whose queues then fill and drop frames, as counted by getDroppedRecent().
+    //
+    // Routes should be set up before RX starts and not altered while RX is active.
+    class FrameDemux final
+        {
+        public:
+            // Handler for a dequeued frame of msglen bytes at msg, with the context given at registration.
+            // The frame must not be altered and is valid only for the duration of the call.
+            typedef void FrameHandler_t(void *context, const volatile uint8_t *msg, uint8_t msglen);
+
+        private:
+            struct Route
+                {
+                // Bounded queue for this class, or NULL if the class is not accepted.
+                ISRRXQueue *queue;
+                // Maximum frame length accepted by queue.
+                uint8_t maxLen;
+                // Priority; lower is served first.
+                uint8_t priority;
+                // Handler and its context; if NULL frames are discarded when dispatched.
+                FrameHandler_t *handler;
+                void *context;
+                };
+            Route routes[FDC_COUNT];
+
+            // Recent count of frames of each class routed into its queue; wraps after 0xff.
+            // Marked volatile for ISR-/thread- safe access without a lock.
+            volatile uint8_t routedRecent[FDC_COUNT];
+            // Recent count of frames of each class dropped on receipt; wraps after 0xff.
+            // Marked volatile for ISR-/thread- safe access without a lock.
+            volatile uint8_t droppedRecent[FDC_COUNT];
+
+            // Class served last by dispatch(), for round-robin between equal priorities.
+            uint8_t lastServed;
+
+        public:
+            // Create with no routes, so all frames are dropped, and default priorities.
+            FrameDemux();
+
+            // Set (or with q NULL clear) the route for class c.
+            //   * q  bounded queue for frames of this class; must outlive its use here
+            //   * handler  called from dispatch() for each frame of this class, with context; may be NULL
+            //   * priority  lower is served first; defaults to the class number
+            // Returns false if c is invalid.
+            // Not to be called while RX is active.
+            bool setRoute(FrameDemuxClass c, ISRRXQueue *q, FrameHandler_t *handler, void *context = NULL);
+            bool setRoute(FrameDemuxClass c, ISRRXQueue *q, FrameHandler_t *handler, void *context, uint8_t priority);
+
+            // Classify and copy a received frame into its class queue,
+            // trimmed to its own length (see getFrameDemuxLength()) from the buflen bytes supplied.
+            // Returns true if the frame was queued, false if it was dropped (and counted).
+            // If frameLen is not NULL the trimmed length is stored there.
+            // Call from the RX ISR, eg via frameFilterDemux(), or with interrupts blocked.
+            bool _route(const volatile uint8_t *const buf, const uint8_t buflen, uint8_t *const frameLen = NULL)
+                {
+                const FrameDemuxClass fc = classifyFrame(buf, buflen);
+                const uint8_t len = getFrameDemuxLength(buf, buflen, fc);
+                if(NULL != frameLen) { *frameLen = len; }
+                const uint8_t c = (uint8_t)fc;
+                const Route &r = routes[c];
+                volatile uint8_t *const dst = ((NULL == r.queue) || (len > r.maxLen)) ? NULL :
+                    r.queue->_getRXBufForInbound();
+                if(NULL == dst) { ++droppedRecent[c]; return(false); } // Drop: unrouted, too long or no space.
+                for(uint8_t i = 0; i < len; ++i) { dst[i] = buf[i]; }
+                r.queue->_loadedBuf(len);
+                ++routedRecent[c];
+                return(true);
+                }
+
+            // Dispatch up to maxFrames queued frames to their handlers, highest priority first,
+            // removing each from its queue after its handler returns.
+            // Returns the number of frames dispatched; 0 if none were waiting.
+            // Not intended to be called from an ISR.
+            uint8_t dispatch(uint8_t maxFrames = 1);
+
+            // Total frames waiting across all class queues.
+            uint8_t getQueued() const;
+            // Frames waiting in the queue for class c; 0 if c is invalid or unrouted.
+            uint8_t getQueued(FrameDemuxClass c) const
+                { return(((c >= FDC_COUNT) || (NULL == routes[c].queue)) ? 0 : routes[c].queue->getRXMsgsQueued()); }
+
+            // Recent count of frames of class c routed into its queue; wraps after 0xff.
+            // ISR-/thread- safe.
+            uint8_t getRoutedRecent(const FrameDemuxClass c) const { return((c >= FDC_COUNT) ? 0 : routedRecent[c]); }
+            // Recent count of frames of class c dropped on receipt; wraps after 0xff.
+            // ISR-/thread- safe.
+            uint8_t getDroppedRecent(const FrameDemuxClass c) const { return((c >= FDC_COUNT) ? 0 : droppedRecent[c]); }
+        };
+
+    // Quick filter that routes every received frame into the per-class queues of the demultiplexer at *demux.
+    // Always returns false, so that the frame is not also queued by the radio,
+    // which thus counts all frames as filtered: use the demultiplexer's counts instead.
+    // Reduces buflen to the frame's own length, as the quickFrameFilter_t contract allows.
+    // The demultiplexer must have static storage duration, eg:
+    //     static FrameDemux demux;
+    //     rl.setFilterRXISR(frameFilterDemux<&demux>);
+    template<FrameDemux *demux>
+    bool frameFilterDemux(const volatile uint8_t *const buf, volatile uint8_t &buflen)
+        {
+        uint8_t frameLen;
+        demux->_route(buf, buflen, &frameLen);
+        buflen = frameLen;
+        return(false);
+        }
+
+
+    }
+
+#endif
@@ -68,6 +68,9 @@ namespace OTRadioLink
     const static uint8_t V0P2_MESSAGING_FS20_MIN_BYTES = 35;
     const static uint8_t V0P2_MESSAGING_FS20_MAX_BYTES = 45;
 
+    // Length of all minimal central-control V1 (CC1) frames, including trailing CRC7.
+    const static uint8_t V0P2_MESSAGING_CC1_BYTES = 8;
+
     // V0p2 Full Stats Message (short ID)
     // ==================================
     // Can be sent on its own or as a trailer for (say) an FS20/FHT8V message (from V0p2 device).
@@ -35,6 +35,12 @@ namespace OTRadioLink
 // ISR-/thread- safe.
 uint8_t ISRRXQueueVarLenMsgBase::isFull() const
     { ATOMIC_BLOCK(ATOMIC_RESTORESTATE) { return(_isFull()); } }
+#else
+// True if the queue is full.
+// True iff _getRXBufForInbound() would return NULL.
+// Not thread-safe off AVR: the caller must exclude other access, eg with a mutex.
+uint8_t ISRRXQueueVarLenMsgBase::isFull() const
+    { return(_isFull()); }
 #endif // ARDUINO_ARCH_AVR
 
 #ifdef ARDUINO_ARCH_AVR
@@ -57,6 +63,18 @@ void ISRRXQueueVarLenMsgBase::removeRXMsg()
         --queuedRXedMessageCount;
         }
     }
+#else
+// Remove the first (oldest) queued RX message.
+// Does nothing if the queue is empty.
+// Not thread-safe off AVR: the caller must exclude other access, eg with a mutex.
+void ISRRXQueueVarLenMsgBase::removeRXMsg()
+    {
+    // Nothing to do if empty.
+    if(isEmpty()) { return; }
+    const uint8_t o = oldest; // Cache volatile value.
+    oldest = newIndex(o, b[o]);
+    --queuedRXedMessageCount;
+    }
 #endif // ARDUINO_ARCH_AVR
 
 
@@ -33,6 +33,7 @@ Author(s) / Copyright (s): Damon Hart-Davis 2015
 #endif
 
 #include "OTV0P2BASE_Util.h"
+#include <OTV0p2Base.h>
 
 // Use namespaces to help avoid collisions.
 namespace OTRadioLink
@@ -49,8 +50,13 @@ namespace OTRadioLink
         {
         protected:
             // Current count of received messages queued.
-            // Marked volatile for ISR-/thread- safe access without a lock.
+            // Marked volatile for ISR-/thread- safe access without a lock,
+            // and atomic where available so that it can be updated from several threads.
+#ifdef OTV0P2BASE_PLATFORM_HAS_atomic
+            std::atomic<uint8_t> queuedRXedMessageCount;
+#else
             volatile uint8_t queuedRXedMessageCount;
+#endif
 
             // Initialise state and only allow deriving classes to instantiate.
             ISRRXQueue() : queuedRXedMessageCount(0) { }
@@ -151,7 +157,8 @@ namespace OTRadioLink
             // 1-deep RX queue and buffer used to accept data during RX.
             // Frame is preceded in memory by its length.
             // Marked as volatile for ISR-/thread- safe (sometimes lock-free) access.
-            volatile uint8_t fullBuf[1 + maxRXBytes];
+            // Mutable so that the const _getRXBufForInbound() can hand it out for loading.
+            mutable volatile uint8_t fullBuf[1 + maxRXBytes];
 //            volatile uint8_t *const bufferRX = fullBuf + 1; // Alias for frame itself.
 
         public:
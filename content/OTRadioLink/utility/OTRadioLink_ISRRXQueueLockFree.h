@@ -0,0 +1,273 @@
+/*
+The OpenTRV project licenses this file to you
+under the Apache Licence, Version 2.0 (the "Licence");
+you may not use this file except in compliance
+with the Licence. You may obtain a copy of the Licence at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing,
+software distributed under the Licence is distributed on an
+"AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+KIND, either express or implied. See the Licence for the
+specific language governing permissions and limitations
+under the Licence.
+
+Author(s) / Copyright (s): Damon Hart-Davis 2016
+*/
+
+/*
+ * Lock-free RX queue for hosted platforms with std::atomic,
+ * eg multi-radio gateways with one thread per radio feeding one decoder.
+ *
+ * Keywords: C++ lock-free atomic MPSC SPSC radio RX receive queue ring buffer low-copy
+ */
+
+#ifndef ARDUINO_LIB_OTRADIOLINK_ISRRXQUEUELOCKFREE_H
+#define ARDUINO_LIB_OTRADIOLINK_ISRRXQUEUELOCKFREE_H
+
+#include "OTRadioLink_ISRRXQueue.h"
+
+#ifdef OTV0P2BASE_PLATFORM_HAS_atomic
+
+// Use namespaces to help avoid collisions.
+namespace OTRadioLink
+    {
+    // Cells of the given size needed for a (length, frame) record of the given frame length.
+    constexpr uint8_t ISRRXQueueLockFreeCellsFor(const uint8_t frameLen, const uint8_t cellSize)
+        { return((uint8_t)((1 + (int)frameLen + cellSize - 1) / cellSize)); }
+    // Smallest power of two >= n, for n in [1,128].
+    constexpr uint8_t ISRRXQueueLockFreePow2Ceil(const int n, const uint8_t p = 1)
+        { return((p >= n) ? p : ISRRXQueueLockFreePow2Ceil(n, (uint8_t)(p << 1))); }
+
+    // Lock-free queue that can efficiently store variable-length messages,
+    // with the same usage contract as ISRRXQueueVarLenMsg but safe without interrupt locking.
+    //
+    // In the default single-producer (SPSC) mode one thread (or ISR equivalent)
+    // calls _getRXBufForInbound()/_loadedBuf() while one other calls peekRXMsg()/removeRXMsg().
+    //
+    // In multi-producer (MPSC) mode any number of threads may be loading frames at once.
+    // _getRXBufForInbound() atomically reserves space for a maximum-size frame
+    // and _loadedBuf() trims the reservation to the actual frame size if no other thread has reserved since.
+    // Each producer thread may have only one upload in progress at a time,
+    // ie must call _loadedBuf() (possibly with 0) before its next _getRXBufForInbound() on any queue of this type.
+    //
+    // Messages are stored in 8-byte cells, the first byte of the first being the frame length,
+    // so the frame length is in the byte before the start of the frame as for other queues.
+    // Each record's first cell has a matching atomic state byte holding the record size in cells,
+    // which is zero until the record is fully loaded (and again once consumed).
+    // Space is only reclaimed in order, so a slow producer holds up frames queued behind it.
+    // There are at most 128 cells, so the queued message count always fits in a uint8_t.
+    //
+    //   * maxRXBytes  a frame to be queued can be up to maxRXBytes bytes long; in the range [1,255]
+    //   * targetISRRXMinQueueCapacity  target number of max-sized frames queueable [1,255], usually [2,4]
+    //   * multiProducer  if true, allow concurrent producers (MPSC), else single producer (SPSC)
+    template<uint8_t maxRXBytes, uint8_t targetISRRXMinQueueCapacity = 2, bool multiProducer = false>
+    class ISRRXQueueVarLenMsgLockFree final : public ISRRXQueue
+        {
+        private:
+            // Size of allocation unit in bytes.
+            static const uint8_t cellSize = 8;
+            // Cells needed for a (length, frame) record of the given frame length.
+            static uint8_t cellsFor(const uint8_t frameLen) { return(ISRRXQueueLockFreeCellsFor(frameLen, cellSize)); }
+            // Cells reserved for a maximum-size record.
+            static const uint8_t maxRecordCells = ISRRXQueueLockFreeCellsFor(maxRXBytes, cellSize);
+            // Number of cells in the ring: a power of two so that positions can simply wrap.
+            // At least enough for two maximum-size records so that one always fits after wrapping.
+            static const uint8_t cells = ISRRXQueueLockFreePow2Ceil(OTV0P2BASE::fnmax(2 * (int)maxRecordCells,
+                                                                    OTV0P2BASE::fnmin(128, (int)maxRecordCells * (1 + (int)targetISRRXMinQueueCapacity))));
+            static_assert(cells <= 128, "too many cells");
+            static const uint8_t cellMask = cells - 1;
+            // Flag in cell state marking a record with no frame to deliver, ie padding at the end of the ring or an abandoned upload.
+            static const uint8_t skipFlag = 0x80;
+
+            // Ring buffer of cells holding (length, frame) records.
+            volatile uint8_t buf[cells * cellSize];
+            // State of each cell; non-zero only for the first cell of each loaded record not yet consumed.
+            // Mutable so that peekRXMsg() can reclaim skip records.
+            mutable std::atomic<uint8_t> cellState[cells];
+            // Free-running positions in cells: tail is the oldest record,
+            // head is the next unreserved cell; tail <= head <= tail + cells.
+            // Mutable so that the SPSC producer can work from a const _getRXBufForInbound().
+            mutable std::atomic<uint32_t> head;
+            mutable std::atomic<uint32_t> tail;
+
+            // An upload in progress.
+            struct Reservation
+                {
+                const void *q; // Queue reserved in, or NULL if none.
+                uint32_t start; // Start of record.
+                uint8_t reserved; // Cells reserved, excluding any padding before start.
+                uint8_t pad; // Padding cells (SPSC only: not yet claimed).
+                };
+            // SPSC: single in-progress upload.
+            mutable Reservation spscReservation;
+            // MPSC: in-progress upload for each producer thread.
+            static Reservation &threadReservation() { static thread_local Reservation r = { NULL, 0, 0, 0 }; return(r); }
+
+            // Padding cells needed before a maximum-size record starting at h.
+            static uint8_t padFor(const uint32_t h)
+                {
+                const uint8_t pos = h & cellMask;
+                return(((int)pos + maxRecordCells > cells) ? (uint8_t)(cells - pos) : 0);
+                }
+
+            // True if a maximum-size record plus any padding would not fit starting at h with the given tail.
+            static bool noSpace(const uint32_t h, const uint32_t t)
+                { return((h - t) + padFor(h) + maxRecordCells > cells); }
+
+            // Publish a record of the given size (including skipFlag if a skip record) at position p.
+            void publish(const uint32_t p, const uint8_t state) const
+                { cellState[p & cellMask].store(state, std::memory_order_release); }
+
+            // Pointer to the length byte of the record at position p.
+            volatile uint8_t *recordAt(const uint32_t p) const
+                { return(const_cast<volatile uint8_t *>(buf) + (p & cellMask) * (uint16_t)cellSize); }
+
+        public:
+            ISRRXQueueVarLenMsgLockFree() : head(0), tail(0)
+                {
+                for(uint8_t i = 0; i < cells; ++i) { cellState[i].store(0, std::memory_order_relaxed); }
+                spscReservation.q = NULL;
+                }
+
+            /*Guaranteed minimum number of (full-length) messages that can be queued, allowing for padding at the wrap. */
+            static const uint8_t MinQueueCapacityMsgs = (cells / maxRecordCells) - 1;
+
+            // Fetches the current inbound RX minimum queue capacity and maximum RX raw message size.
+            virtual void getRXCapacity(uint8_t &queueRXMsgsMin, uint8_t &maxRXMsgLen) const override
+                { queueRXMsgsMin = MinQueueCapacityMsgs; maxRXMsgLen = maxRXBytes; }
+
+            // True if the queue is full.
+            // True iff _getRXBufForInbound() would return NULL, though may change at any time with concurrent activity.
+            // Thread-safe.
+            virtual uint8_t isFull() const override
+                {
+                const uint32_t t = tail.load(std::memory_order_acquire);
+                return(noSpace(head.load(std::memory_order_acquire), t));
+                }
+
+            // Get pointer for inbound/RX frame able to accommodate max frame size; NULL if no space.
+            // Call this to get a pointer to load an inbound frame (<=maxRXBytes bytes) into;
+            // after uploading the frame call _loadedBuf() to queue the new frame
+            // or abandon an upload on this occasion.
+            // In MPSC mode may be called concurrently from several threads,
+            // each of which must then call _loadedBuf() before its next call to this.
+            // _loadedBuf() should not be called if this returns NULL.
+            virtual volatile uint8_t *_getRXBufForInbound() const override
+                {
+                if(!multiProducer)
+                    {
+                    // Only this thread moves head, so nothing is claimed until _loadedBuf().
+                    const uint32_t t = tail.load(std::memory_order_acquire);
+                    const uint32_t h = head.load(std::memory_order_relaxed);
+                    if(noSpace(h, t)) { return(NULL); }
+                    const uint8_t pad = padFor(h);
+                    spscReservation.q = this;
+                    spscReservation.start = h + pad;
+                    spscReservation.reserved = maxRecordCells;
+                    spscReservation.pad = pad;
+                    return(recordAt(h + pad) + 1);
+                    }
+                // Claim space for padding plus a maximum-size record, retrying if another producer got in first.
+                // Load tail before head: as head never falls below tail the difference cannot underflow.
+                uint32_t t = tail.load(std::memory_order_acquire);
+                uint32_t h = head.load(std::memory_order_acquire);
+                for( ; ; )
+                    {
+                    if(noSpace(h, t)) { return(NULL); }
+                    if(head.compare_exchange_weak(h, h + padFor(h) + maxRecordCells, std::memory_order_acq_rel, std::memory_order_acquire)) { break; }
+                    t = tail.load(std::memory_order_acquire);
+                    }
+                const uint8_t pad = padFor(h);
+                // The padding can be released to the consumer immediately.
+                if(0 != pad) { publish(h, skipFlag | pad); }
+                Reservation &r = threadReservation();
+                r.q = this;
+                r.start = h + pad;
+                r.reserved = maxRecordCells;
+                r.pad = 0;
+                return(recordAt(h + pad) + 1);
+                }
+
+            // Call after loading an RXed frame into the buffer indicated by _getRXBufForInbound().
+            // The argument is the size of the frame loaded into the buffer to be queued.
+            // The frame can be no larger than maxRXBytes bytes.
+            // It is possible to formally abandon an upload attempt by calling this with 0.
+            // Must be called from the same thread as the matching _getRXBufForInbound().
+            virtual void _loadedBuf(uint8_t frameLen) override
+                {
+                Reservation &r = multiProducer ? threadReservation() : spscReservation;
+                if(this != r.q) { return; } // No upload in progress.
+                r.q = NULL;
+                if(frameLen > maxRXBytes) { frameLen = maxRXBytes; } // Be safe...
+                if(!multiProducer)
+                    {
+                    if(0 == frameLen) { return; } // Nothing was claimed.
+                    const uint8_t size = cellsFor(frameLen);
+                    *recordAt(r.start) = frameLen;
+                    ++queuedRXedMessageCount; // Count first so that it never goes negative.
+                    // Advance head before publishing anything that the consumer can take,
+                    // else tail could briefly pass head and (head - tail) wrap, making the queue look full.
+                    head.store(r.start + size, std::memory_order_release);
+                    publish(r.start, size);
+                    if(0 != r.pad) { publish(r.start - r.pad, skipFlag | r.pad); }
+                    return;
+                    }
+                // Give back unused space if no other producer has reserved after this one.
+                // Even an abandoned upload keeps one cell as a skip record, so head never returns to a previous value.
+                uint8_t size = r.reserved;
+                const uint8_t needed = (0 == frameLen) ? 1 : cellsFor(frameLen);
+                uint32_t expected = r.start + r.reserved;
+                if((needed < size) && head.compare_exchange_strong(expected, r.start + needed, std::memory_order_acq_rel, std::memory_order_relaxed))
+                    { size = needed; }
+                if(0 == frameLen) { publish(r.start, skipFlag | size); return; }
+                *recordAt(r.start) = frameLen;
+                ++queuedRXedMessageCount; // Count first so that it never goes negative.
+                publish(r.start, size);
+                }
+
+            // Peek at first (oldest) queued RX message, returning a pointer or NULL if no message waiting.
+            // The pointer returned is NULL if there is no message,
+            // else the pointer is to the start of the message/frame
+            // and the length is in the byte before the start of the frame.
+            // This allows a message to be decoded directly from the queue buffer
+            // without copying or the use of another buffer.
+            // The returned pointer and length are valid until the next
+            //     peekRXMessage() or removeRXMessage()
+            // This does not remove the message, but reclaims any padding or abandoned space before it.
+            // The buffer pointed to MUST NOT be altered.
+            // Must only be called from the single consumer thread.
+            virtual const volatile uint8_t *peekRXMsg() const override
+                {
+                for( ; ; )
+                    {
+                    const uint32_t t = tail.load(std::memory_order_relaxed);
+                    const uint8_t s = cellState[t & cellMask].load(std::memory_order_acquire);
+                    if(0 == s) { return(NULL); } // Next record (if any) not yet loaded.
+                    if(0 == (s & skipFlag)) { return(recordAt(t) + 1); }
+                    // Clear state before releasing the space to producers.
+                    cellState[t & cellMask].store(0, std::memory_order_relaxed);
+                    tail.store(t + (s & ~skipFlag), std::memory_order_release);
+                    }
+                }
+
+            // Remove the first (oldest) queued RX message.
+            // Typically used after peekRXMessage().
+            // Does nothing if the queue is empty.
+            // Must only be called from the single consumer thread.
+            virtual void removeRXMsg() override
+                {
+                if(NULL == peekRXMsg()) { return; }
+                const uint32_t t = tail.load(std::memory_order_relaxed);
+                const uint8_t s = cellState[t & cellMask].load(std::memory_order_relaxed);
+                cellState[t & cellMask].store(0, std::memory_order_relaxed);
+                --queuedRXedMessageCount;
+                tail.store(t + s, std::memory_order_release);
+                }
+        };
+    }
+
+#endif // OTV0P2BASE_PLATFORM_HAS_atomic
+
+#endif
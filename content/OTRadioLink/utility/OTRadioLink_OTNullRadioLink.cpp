@@ -66,4 +66,22 @@ bool OTNullRadioLink::sendRaw(const uint8_t *buf, uint8_t buflen, int8_t , TXpow
     return(true);
 }
 
+/**
+ * @brief   Simulate reception of a frame, applying any RX filter as the RX ISR would.
+ * @param   buf        Pointer to the frame
+ * @param   buflen     Length of the frame
+ * @retval  true if the frame passed the filter (then dropped for lack of an RX queue)
+ */
+bool OTNullRadioLink::_injectRX(const uint8_t *buf, uint8_t buflen)
+{
+    volatile uint8_t len = buflen;
+    quickFrameFilter_t *const f = filterRXISR;
+    if((NULL != f) && !f(buf, len)) {
+        ++filteredRXedMessageCountRecent;
+        return(false);
+    }
+    ++droppedRXedMessageCountRecent;
+    return(true);
+}
+
 } // OTNullRadioLink
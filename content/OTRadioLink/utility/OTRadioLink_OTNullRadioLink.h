@@ -43,6 +43,10 @@ public:
     void removeRXMsg();
     // Should always be sent null-terminated strings.
     bool sendRaw(const uint8_t *buf, uint8_t buflen, int8_t channel = 0, TXpower power = TXnormal, bool listenAfter = false);
+    // Simulate reception of a frame as the RX ISR would, eg to drive RX filters with synthetic traffic in tests.
+    // Applies any RX filter; as there is no RX queue any frame passing the filter is then dropped.
+    // Returns true if the frame passed the filter.
+    bool _injectRX(const uint8_t *buf, uint8_t buflen);
 private:
     void _dolisten() {};
 };
@@ -117,6 +117,11 @@ namespace OTRadioLink
         ATOMIC_BLOCK (ATOMIC_RESTORESTATE)
             { filterRXISR = filterRX; }
         }
+#else
+    // Set (or clear) the optional fast filter for RX ISR/poll; NULL to clear.
+    // Assumes that the (aligned) pointer store is atomic on hosted platforms.
+    void OTRadioLink::setFilterRXISR(quickFrameFilter_t *const filterRX)
+        { filterRXISR = filterRX; }
 #endif // ARDUINO_ARCH_AVR
     }
 
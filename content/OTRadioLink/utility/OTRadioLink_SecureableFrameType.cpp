@@ -182,16 +182,52 @@ uint8_t SecurableFrameHeader::checkAndDecodeSmallFrameHeader(const uint8_t *cons
     // Make frame 'invalid' until everything is finished and checks out.
     fl = 0;
 
+    // Do all the checks in place.
+    SecurableFrameView sfv;
+    const uint8_t hlifl = sfv.checkAndDecodeSmallFrameHeader(buf, buflen);
+    if(0 == hlifl) { return(0); } // ERROR
+
+    // Capture the header fields, and the ID bytes in the storage in the instance, if any.
+    fType = sfv.getFType();
+    seqIl = sfv.getSeqIl();
+    const uint8_t il_ = sfv.getIl();
+    if(il_ > 0) { memcpy(id, sfv.getID(), il_); }
+    bl = sfv.getBl();
+
+    // Set fl field to valid value as last action / side-effect.
+    fl = sfv.getFl();
+
+    // Return decoded header length including frame-length byte; body should immediately follow.
+    return(hlifl); // SUCCESS!
+    }
+
+// Decode header and check parameters/validity in place for inbound short secureable frame.
+// The buffer starts with the fl frame length byte.
+// Applies all the checks of SecurableFrameHeader::checkAndDecodeSmallFrameHeader().
+//
+// The buffer may be (eg) a volatile RX queue slot as returned by peekRXMsg():
+// once a frame is fully queued it is not written to again until removed
+// so it is accessed thereafter through an ordinary (non-volatile) pointer.
+//
+// Returns number of bytes of decoded header including nominally-leading fl length byte; 0 in case of error.
+// On error the view is left invalid.
+uint8_t SecurableFrameView::checkAndDecodeSmallFrameHeader(const volatile uint8_t *const vbuf, const uint8_t buflen_)
+    {
+    // Make view 'invalid' until everything is finished and checks out.
+    fl = 0;
+    frame = NULL;
+
     // If buf is NULL or clearly too small to contain a valid header then return an error.
-    if(NULL == buf) { return(0); } // ERROR
-    if(buflen < 4) { return(0); } // ERROR
+    if(NULL == vbuf) { return(0); } // ERROR
+    if(buflen_ < 4) { return(0); } // ERROR
+    const uint8_t *const buf = (const uint8_t *)vbuf;
 
     // Quick integrity checks from spec.
     //  1) fl >= 4 (type, seq/il, bl, trailer bytes)
     const uint8_t fl_ = buf[0];
     if(fl_ < 4) { return(0); } // ERROR
     //  2) fl may be further constrained by system limits, typically to < 64, eg for 'small' frame.
-    if(fl_ > maxSmallFrameSize) { return(0); } // ERROR
+    if(fl_ > SecurableFrameHeader::maxSmallFrameSize) { return(0); } // ERROR
     //  3) type (the first frame byte) is never 0x00, 0x80, 0x7f, 0xff.
     fType = buf[1];
     const bool secure_ = isSecure();
@@ -200,21 +236,19 @@ uint8_t SecurableFrameHeader::checkAndDecodeSmallFrameHeader(const uint8_t *cons
     //  4) il <= 8 for initial implementations (internal node ID is 8 bytes)
     seqIl = buf[2];
     const uint8_t il_ = getIl();
-    if(il_ > maxIDLength) { return(0); } // ERROR
+    if(il_ > SecurableFrameHeader::maxIDLength) { return(0); } // ERROR
     //  5) il <= fl - 4 (ID length; minimum of 4 bytes of other overhead)
     if(il_ > fl_ - 4) { return(0); } // ERROR
     // Header length including frame length byte.
     const uint8_t hlifl = 4 + il_;
     // If buffer doesn't contain enough data for the full header then return an error.
-    if(hlifl > buflen) { return(0); } // ERROR
-    // Capture the ID bytes, in the storage in the instance, if any.
-    if(il_ > 0) { memcpy(id, buf+3, il_); }
+    if(hlifl > buflen_) { return(0); } // ERROR
     //  6) bl <= fl - 4 - il (body length; minimum of 4 bytes of other overhead)
     const uint8_t bl_ = buf[hlifl - 1];
     if(bl_ > fl_ - hlifl) { return(0); } // ERROR
     bl = bl_;
     //  7) ONLY CHECKED IF FULL FRAME AVAILABLE: the final frame byte (the final trailer byte) is never 0x00 nor 0xff
-    if(buflen > fl_)
+    if(buflen_ > fl_)
         {
         const uint8_t lastByte = buf[fl_];
         if((0x00 == lastByte) || (0xff == lastByte)) { return(0); } // ERROR
@@ -225,6 +259,8 @@ uint8_t SecurableFrameHeader::checkAndDecodeSmallFrameHeader(const uint8_t *cons
     else if(0 == tl_) { return(0); } // ERROR
 
     // Set fl field to valid value as last action / side-effect.
+    frame = buf;
+    buflen = buflen_;
     fl = fl_;
 
     // Return decoded header length including frame-length byte; body should immediately follow.
@@ -248,10 +284,8 @@ uint8_t SecurableFrameHeader::computeNonSecureFrameCRC(const uint8_t *const buf,
     // Check that buffer is at least large enough for all but the CRC byte itself.
     if(buflen < fl) { return(0); } // ERROR
     // Initialise CRC with 0x7f;
-    uint8_t crc = 0x7f;
-    const uint8_t *p = buf;
     // Include in calc all bytes up to but not including the trailer/CRC byte.
-    for(uint8_t i = fl; i > 0; --i) { crc = OTV0P2BASE::crc7_5B_update(crc, *p++); }
+    uint8_t crc = OTV0P2BASE::crc7_5B_update_buf(0x7f, buf, fl);
     // Ensure 0x00 result is converted to avoid forbidden value.
     if(0 == crc) { crc = 0x80; }
     return(crc);
@@ -425,6 +459,47 @@ uint8_t SimpleSecureFrame32or0BodyTXBase::encodeSecureSmallFrameRaw(uint8_t *con
     return(fl + 1);
     }
 
+// Common part of decodeSecureSmallFrameRaw() for a structurally-validated frame at buf;
+// the remaining args are as for decodeSecureSmallFrameRaw().
+//  * fl / hl / bl / tl / seq  decoded frame length, header length, body length, trailer length and sequence number
+static uint8_t _decodeSecureSmallFrameRaw(const uint8_t *const buf, const uint8_t buflen,
+                                const uint8_t fl, const uint8_t hl, const uint8_t bl, const uint8_t tl, const uint8_t seq,
+                                const SimpleSecureFrame32or0BodyRXBase::fixed32BTextSize12BNonce16BTagSimpleDec_ptr_t d,
+                                void *const state, const uint8_t *const key, const uint8_t *const iv,
+                                uint8_t *const decryptedBodyOut, const uint8_t decryptedBodyOutBuflen, uint8_t &decryptedBodyOutSize)
+    {
+    if((NULL == buf) || (NULL == d) ||
+        (NULL == key) || (NULL == iv)) { return(0); } // ERROR
+    // Abort if expected constraints for simple fixed-size secure frame are not met.
+    if(fl >= buflen) { return(0); } // ERROR
+    if(23 != tl) { return(0); } // ERROR
+    if(0x80 != buf[fl]) { return(0); } // ERROR
+    if((0 != bl) && (ENC_BODY_SMALL_FIXED_CTEXT_SIZE != bl)) { return(0); } // ERROR
+    // Check that header sequence number lsbs match nonce counter 4 lsbs.
+    if(seq != (iv[11] & 0xf)) { return(0); } // ERROR
+    // Note if plaintext is actually wanted/expected.
+    const bool plaintextWanted = (NULL != decryptedBodyOut);
+    // Attempt to authenticate and decrypt.
+    uint8_t decryptBuf[ENC_BODY_SMALL_FIXED_CTEXT_SIZE];
+    if(!d(state, key, iv, buf, hl,
+                (0 == bl) ? NULL : buf + hl, buf + fl - 16,
+                decryptBuf)) { return(0); } // ERROR
+    if(plaintextWanted && (0 != bl))
+        {
+        // Unpad the decrypted text in place.
+        const uint8_t upbl = SimpleSecureFrame32or0BodyRXBase::removePaddingTo32BTrailing0sAndPadCount(decryptBuf);
+        if(upbl > ENC_BODY_SMALL_FIXED_PTEXT_MAX_SIZE) { return(0); } // ERROR
+        if(upbl > decryptedBodyOutBuflen) { return(0); } // ERROR
+        memcpy(decryptedBodyOut, decryptBuf, upbl);
+        decryptedBodyOutSize = upbl;
+        // TODO: optimise later if plaintext not required but ciphertext present.
+        }
+    // Ensure that decryptedBodyOutSize is not left initialised even if no frame body RXed/wanted.
+    else { decryptedBodyOutSize = 0; }
+    // Done.
+    return(fl + 1);
+    }
+
 // Decode entire secure small frame from raw frame bytes and crypto support.
 // This is a raw/partial impl that requires the IV/nonce to be supplied.
 // This uses fixed32BTextSize12BNonce16BTagSimpleDec_ptr_t style encryption/authentication.
@@ -471,40 +546,28 @@ uint8_t SimpleSecureFrame32or0BodyRXBase::decodeSecureSmallFrameRaw(const Secura
                                 void *const state, const uint8_t *const key, const uint8_t *const iv,
                                 uint8_t *const decryptedBodyOut, const uint8_t decryptedBodyOutBuflen, uint8_t &decryptedBodyOutSize)
     {
-    if((NULL == sfh) || (NULL == buf) || (NULL == d) ||
-        (NULL == key) || (NULL == iv)) { return(0); } // ERROR
+    if(NULL == sfh) { return(0); } // ERROR
     // Abort if header was not decoded properly.
     if(sfh->isInvalid()) { return(0); } // ERROR
-    // Abort if expected constraints for simple fixed-size secure frame are not met.
-    const uint8_t fl = sfh->fl;
-    if(fl >= buflen) { return(0); } // ERROR
-    if(23 != sfh->getTl()) { return(0); } // ERROR
-    if(0x80 != buf[fl]) { return(0); } // ERROR
-    const uint8_t bl = sfh->bl;
-    if((0 != bl) && (ENC_BODY_SMALL_FIXED_CTEXT_SIZE != bl)) { return(0); } // ERROR
-    // Check that header sequence number lsbs match nonce counter 4 lsbs.
-    if(sfh->getSeq() != (iv[11] & 0xf)) { return(0); } // ERROR
-    // Note if plaintext is actually wanted/expected.
-    const bool plaintextWanted = (NULL != decryptedBodyOut);
-    // Attempt to authenticate and decrypt.
-    uint8_t decryptBuf[ENC_BODY_SMALL_FIXED_CTEXT_SIZE];
-    if(!d(state, key, iv, buf, sfh->getHl(),
-                (0 == bl) ? NULL : buf + sfh->getBodyOffset(), buf + fl - 16,
-                decryptBuf)) { return(0); } // ERROR
-    if(plaintextWanted && (0 != bl))
-        {
-        // Unpad the decrypted text in place.
-        const uint8_t upbl = removePaddingTo32BTrailing0sAndPadCount(decryptBuf);
-        if(upbl > ENC_BODY_SMALL_FIXED_PTEXT_MAX_SIZE) { return(0); } // ERROR
-        if(upbl > decryptedBodyOutBuflen) { return(0); } // ERROR
-        memcpy(decryptedBodyOut, decryptBuf, upbl);
-        decryptedBodyOutSize = upbl;
-        // TODO: optimise later if plaintext not required but ciphertext present.
-        }
-    // Ensure that decryptedBodyOutSize is not left initialised even if no frame body RXed/wanted.
-    else { decryptedBodyOutSize = 0; }
-    // Done.
-    return(fl + 1);
+    return(_decodeSecureSmallFrameRaw(buf, buflen,
+                                sfh->fl, sfh->getHl(), sfh->bl, sfh->getTl(), sfh->getSeq(),
+                                d, state, key, iv,
+                                decryptedBodyOut, decryptedBodyOutBuflen, decryptedBodyOutSize));
+    }
+// As above, but for a frame validated in place, eg in an RX queue slot, so without a separate buffer.
+//  * sfv  valid view of the entire frame including trailer; never NULL
+uint8_t SimpleSecureFrame32or0BodyRXBase::decodeSecureSmallFrameRaw(const SecurableFrameView *const sfv,
+                                const fixed32BTextSize12BNonce16BTagSimpleDec_ptr_t d,
+                                void *const state, const uint8_t *const key, const uint8_t *const iv,
+                                uint8_t *const decryptedBodyOut, const uint8_t decryptedBodyOutBuflen, uint8_t &decryptedBodyOutSize)
+    {
+    if(NULL == sfv) { return(0); } // ERROR
+    // Abort if header was not decoded properly.
+    if(sfv->isInvalid()) { return(0); } // ERROR
+    return(_decodeSecureSmallFrameRaw(sfv->getFrame(), sfv->getBuflen(),
+                                sfv->getFl(), sfv->getHl(), sfv->getBl(), sfv->getTl(), sfv->getSeq(),
+                                d, state, key, iv,
+                                decryptedBodyOut, decryptedBodyOutBuflen, decryptedBodyOutSize));
     }
 
 // Pads plain-text in place prior to encryption with 32-byte fixed length padded output.
@@ -557,6 +620,166 @@ bool SimpleSecureFrame32or0BodyRXBase::validateRXMessageCount(const uint8_t *ID,
     return(msgcountercmp(counter, currentCounter) > 0);
     }
 
+// As for decodeSecureSmallFrameRaw() but passed a candidate node/counterparty ID
+// derived from the frame ID in the incoming header,
+// plus possible other adjustments such has forcing bit values for reverse flows.
+// This routine constructs an IV from this expanded ID
+// (which must be at least length 6 for 'O' / 0x80 style enc/auth)
+// and other information in the header
+// and then returns the result of calling decodeSecureSmallFrameRaw().
+// Returns the total number of bytes read for the frame
+// (including, and with a value one higher than the first 'fl' bytes).
+// Returns zero in case of error, eg because authentication failed.
+//
+// If several candidate nodes share the ID prefix in the frame header
+// (in the extreme case with a zero-length header ID for an anonymous frame)
+// then they may all have to be tested in turn until one succeeds.
+//
+// Generally a call to this should be done AFTER checking that
+// the aggregate RXed message counter is higher than for the last successful receive
+// (for this node and flow direction)
+// and after a success those message counters should be updated
+// (which may involve more than a simple increment)
+// to the new values to prevent replay attacks.
+//
+//   * adjID / adjIDLen  adjusted candidate ID (never NULL)
+//         and available length (must be >= 6)
+//         based on the received ID in (the already structurally validated) header
+//
+// TO AVOID RELAY ATTACKS: verify the counter is higher than any previous authed message from this sender
+// then update the RX message counter after a successful auth with this routine.
+uint8_t SimpleSecureFrame32or0BodyRXBase::_decodeSecureSmallFrameFromID(const SecurableFrameHeader *const sfh,
+                                const uint8_t *const buf, const uint8_t buflen,
+                                const fixed32BTextSize12BNonce16BTagSimpleDec_ptr_t d,
+                                const uint8_t *const adjID, const uint8_t adjIDLen,
+                                void *const state, const uint8_t *const key,
+                                uint8_t *const decryptedBodyOut, const uint8_t decryptedBodyOutBuflen, uint8_t &decryptedBodyOutSize)
+    {
+    // Rely on decodeSecureSmallFrameRaw() for validation of items not directly needed here.
+    if((NULL == sfh) || (NULL == buf) || (NULL == adjID)) { return(0); } // ERROR
+    if(adjIDLen < 6) { return(0); } // ERROR
+    // Abort if header was not decoded properly.
+    if(sfh->isInvalid()) { return(0); } // ERROR
+    // Abort if expected constraints for simple fixed-size secure frame are not met.
+    if(23 != sfh->getTl()) { return(0); } // ERROR
+//    const uint8_t fl = sfh->fl;
+//    if(0x80 != buf[fl]) { return(0); } // ERROR
+    if(sfh->getTrailerOffset() + 6 > buflen) { return(0); } // ERROR
+    // Construct IV from supplied (possibly adjusted) ID + counters from (start of) trailer.
+    uint8_t iv[12];
+    memcpy(iv, adjID, 6);
+    memcpy(iv + 6, buf + sfh->getTrailerOffset(), SimpleSecureFrame32or0BodyBase::fullMessageCounterBytes);
+    // Now do actual decrypt/auth.
+    return(decodeSecureSmallFrameRaw(sfh,
+                                buf, buflen,
+                                d,
+                                state, key, iv,
+                                decryptedBodyOut, decryptedBodyOutBuflen, decryptedBodyOutSize));
+    }
+
+// From a structurally correct secure frame, looks up the ID, checks the message counter, decodes, and updates the counter if successful.
+// THIS IS THE PREFERRED ENTRY POINT FOR DECODING AND RECEIVING SECURE FRAMES.
+// (Pre-filtering by type and ID and message counter may already have happened.)
+// Note that this is for frames being send from the ID in the header,
+// not for lightweight return traffic to the specified ID.
+// Returns the total number of bytes read for the frame
+// (including, and with a value one higher than the first 'fl' bytes).
+// Returns zero in case of error, eg because authentication failed or this is a duplicate message.
+// If this returns true then the frame is authenticated,
+// and the decrypted body is available if present and a buffer was provided.
+// If the 'firstMatchIDOnly' is true (the default)
+// then this only checks the first ID prefix match found if any,
+// else all possible entries may be tried depending on the implementation
+// and, for example, time/resource limits.
+// This overloading accepts the decryption function, state and key explicitly.
+//
+//  * ID if non-NULL is filled in with the full authenticated sender ID, so must be >= 8 bytes
+uint8_t SimpleSecureFrame32or0BodyRXBase::decodeSecureSmallFrameSafely(const SecurableFrameHeader *const sfh,
+                                const uint8_t *const buf, const uint8_t buflen,
+                                const fixed32BTextSize12BNonce16BTagSimpleDec_ptr_t d,
+                                void *const state, const uint8_t *const key,
+                                uint8_t *const decryptedBodyOut, const uint8_t decryptedBodyOutBuflen, uint8_t &decryptedBodyOutSize,
+                                uint8_t *const ID,
+                                bool /*firstIDMatchOnly*/)
+    {
+    // Rely on _decodeSecureSmallFrameFromID() for validation of items not directly needed here.
+    if((NULL == sfh) || (NULL == buf)) { return(0); } // ERROR
+    // Abort if header was not decoded properly.
+    if(sfh->isInvalid()) { return(0); } // ERROR
+//    // Abort if frame is not secure.
+//    if(sfh->isSecure()) { return(0); } // ERROR
+    // Abort if trailer not large enough to extract message counter from safely (and not expected size/flavour).
+    if(23 != sfh->getTl()) { return(0); } // ERROR
+    // Look up the full node ID of the sender in the associations table.
+    // NOTE: this only tries the first match, ignoring firstIDMatchOnly.
+    uint8_t senderNodeID[OTV0P2BASE::OpenTRV_Node_ID_Bytes];
+    const int16_t index = _getNextMatchingNodeID(0, sfh->id, sfh->getIl(), senderNodeID);
+    if(index < 0) { return(0); } // ERROR
+    // Extract the message counter and validate it (that it is higher than previously seen)...
+    uint8_t messageCounter[SimpleSecureFrame32or0BodyBase::fullMessageCounterBytes];
+    // Assume counter positioning as for 0x80 type trailer, ie 6 bytes at start of trailer.
+    memcpy(messageCounter, buf + sfh->getTrailerOffset(), SimpleSecureFrame32or0BodyBase::fullMessageCounterBytes);
+    if(!validateRXMessageCount(senderNodeID, messageCounter)) { return(0); } // ERROR
+    // Now attempt to decrypt.
+    // Assumed no need to 'adjust' ID for this form of RX.
+    const uint8_t decodeResult =_decodeSecureSmallFrameFromID(sfh,
+                                                        buf, buflen,
+                                                        d,
+                                                        senderNodeID, OTV0P2BASE::OpenTRV_Node_ID_Bytes,
+                                                        state, key,
+                                                        decryptedBodyOut, decryptedBodyOutBuflen, decryptedBodyOutSize);
+    if(0 == decodeResult) { return(0); } // ERROR
+    // Successfully decoded: update the RX message counter to avoid duplicates/replays.
+    if(!updateRXMessageCountAfterAuthentication(senderNodeID, messageCounter)) { return(0); } // ERROR
+    // Success: copy sender ID to output buffer (if non-NULL) as last action.
+    if(ID != NULL) { memcpy(ID, senderNodeID, OTV0P2BASE::OpenTRV_Node_ID_Bytes); }
+    return(decodeResult);
+    }
+
+// As above, but decoding directly from a frame validated in place, eg in an RX queue slot,
+// avoiding copying the frame to a separate buffer and the ID into a header.
+// Only the first ID prefix match is tried.
+//
+//  * sfv  valid view of the entire frame including trailer; never NULL
+uint8_t SimpleSecureFrame32or0BodyRXBase::decodeSecureSmallFrameSafely(const SecurableFrameView *const sfv,
+                                const fixed32BTextSize12BNonce16BTagSimpleDec_ptr_t d,
+                                void *const state, const uint8_t *const key,
+                                uint8_t *const decryptedBodyOut, const uint8_t decryptedBodyOutBuflen, uint8_t &decryptedBodyOutSize,
+                                uint8_t *const ID)
+    {
+    // Rely on decodeSecureSmallFrameRaw() for validation of items not directly needed here.
+    if(NULL == sfv) { return(0); } // ERROR
+    // Abort if header was not decoded properly.
+    if(sfv->isInvalid()) { return(0); } // ERROR
+    // Abort if trailer not large enough to extract message counter from safely (and not expected size/flavour).
+    if(23 != sfv->getTl()) { return(0); } // ERROR
+    // Abort if the trailer is not all present.
+    if(!sfv->isComplete()) { return(0); } // ERROR
+    // Look up the full node ID of the sender in the associations table, straight from the frame.
+    uint8_t senderNodeID[OTV0P2BASE::OpenTRV_Node_ID_Bytes];
+    const int16_t index = _getNextMatchingNodeID(0, sfv->getID(), sfv->getIl(), senderNodeID);
+    if(index < 0) { return(0); } // ERROR
+    // Validate the message counter (that it is higher than previously seen)
+    // assuming counter positioning as for 0x80 type trailer, ie 6 bytes at start of trailer.
+    const uint8_t *const messageCounter = sfv->getTrailer();
+    if(!validateRXMessageCount(senderNodeID, messageCounter)) { return(0); } // ERROR
+    // Construct IV from ID + counters from (start of) trailer.
+    uint8_t iv[12];
+    memcpy(iv, senderNodeID, 6);
+    memcpy(iv + 6, messageCounter, SimpleSecureFrame32or0BodyBase::fullMessageCounterBytes);
+    // Now attempt to decrypt.
+    const uint8_t decodeResult = decodeSecureSmallFrameRaw(sfv,
+                                                        d,
+                                                        state, key, iv,
+                                                        decryptedBodyOut, decryptedBodyOutBuflen, decryptedBodyOutSize);
+    if(0 == decodeResult) { return(0); } // ERROR
+    // Successfully decoded: update the RX message counter to avoid duplicates/replays.
+    if(!updateRXMessageCountAfterAuthentication(senderNodeID, messageCounter)) { return(0); } // ERROR
+    // Success: copy sender ID to output buffer (if non-NULL) as last action.
+    if(ID != NULL) { memcpy(ID, senderNodeID, OTV0P2BASE::OpenTRV_Node_ID_Bytes); }
+    return(decodeResult);
+    }
+
 // NULL basic fixed-size text 'encryption' function.
 // DOES NOT ENCRYPT OR AUTHENTICATE SO DO NOT USE IN PRODUCTION SYSTEMS.
 // Emulates some aspects of the process to test real implementations against,
@@ -298,6 +298,88 @@ namespace OTRadioLink
         uint8_t computeNonSecureFrameCRC(const uint8_t *buf, uint8_t buflen) const;
         };
 
+    // Read-only view of a small secureable frame held elsewhere, eg in an RX queue slot.
+    // Validates the header in place with the same checks as
+    // SecurableFrameHeader::checkAndDecodeSmallFrameHeader()
+    // and then gives access to the ID, body and trailer by pointer
+    // without copying the frame or the ID.
+    // Holds only a pointer and a few bytes of decoded lengths.
+    //
+    // The viewed bytes must not change and must remain valid while the view is in use,
+    // eg until removeRXMsg() is called for a frame from peekRXMsg().
+    //
+    // Typical RX workflow, decoding directly from the queue:
+    //     const volatile uint8_t *const msg = rl.peekRXMsg();
+    //     SecurableFrameView sfv;
+    //     if((NULL != msg) && (0 != sfv.checkAndDecodeRXMsg(msg))) { ... decode using sfv ... }
+    //     rl.removeRXMsg();
+    class SecurableFrameView
+        {
+        private:
+            // Start of frame (the fl byte); NULL if invalid.
+            const uint8_t *frame;
+            // Available bytes from frame, including the fl byte.
+            uint8_t buflen;
+            // Copies of the single-byte header fields; fl is 0 if invalid.
+            uint8_t fl;
+            uint8_t fType;
+            uint8_t seqIl;
+            uint8_t bl;
+
+        public:
+            // Create an instance as an invalid view.
+            SecurableFrameView() : frame(NULL), buflen(0), fl(0), fType(0), seqIl(0), bl(0) { }
+
+            // Decode header and check parameters/validity in place for inbound short secureable frame.
+            // The buffer starts with the fl frame length byte.
+            // Applies all the checks of SecurableFrameHeader::checkAndDecodeSmallFrameHeader().
+            //
+            // The buffer may be (eg) a volatile RX queue slot as returned by peekRXMsg():
+            // once a frame is fully queued it is not written to again until removed
+            // so it is accessed thereafter through an ordinary (non-volatile) pointer.
+            //
+            // Returns number of bytes of decoded header including nominally-leading fl length byte; 0 in case of error.
+            // On error the view is left invalid.
+            uint8_t checkAndDecodeSmallFrameHeader(const volatile uint8_t *buf, uint8_t buflen);
+
+            // Decode header of message as returned by peekRXMsg(), ie with its length in the byte before the start.
+            // Returns as for checkAndDecodeSmallFrameHeader(); 0 for a NULL msg.
+            uint8_t checkAndDecodeRXMsg(const volatile uint8_t *msg)
+                { if(NULL == msg) { fl = 0; frame = NULL; return(0); } return(checkAndDecodeSmallFrameHeader(msg, msg[-1])); }
+
+            // Returns true if the view is invalid, ie has not successfully decoded a header.
+            bool isInvalid() const { return(0 == fl); }
+
+            // Header fields as for SecurableFrameHeader.
+            uint8_t getFl() const { return(fl); }
+            uint8_t getFType() const { return(fType); }
+            bool isSecure() const { return(0 != (0x80 & fType)); }
+            uint8_t getSeqIl() const { return(seqIl); }
+            uint8_t getSeq() const { return((seqIl >> 4) & 0xf); }
+            uint8_t getIl() const { return(seqIl & 0xf); }
+            uint8_t getHl() const { return(4 + getIl()); }
+            uint8_t getBl() const { return(bl); }
+            uint8_t getBodyOffset() const { return(getHl()); }
+            uint8_t getTl() const { return(fl - 3 - getIl() - bl); }
+            uint8_t getTrailerOffset() const { return(4 + getIl() + bl); }
+
+            // Available length of the viewed buffer, including the fl byte.
+            uint8_t getBuflen() const { return(buflen); }
+            // True if the whole frame including trailer is within the viewed buffer.
+            bool isComplete() const { return(!isInvalid() && (buflen > fl)); }
+
+            // Pointers into the viewed frame; only meaningful while the view is valid.
+            // The trailer pointer is only safe to dereference if isComplete().
+            // Whole frame starting with the fl byte.
+            const uint8_t *getFrame() const { return(frame); }
+            // getIl() ID bytes.
+            const uint8_t *getID() const { return(frame + 3); }
+            // getBl() body bytes.
+            const uint8_t *getBody() const { return(frame + getBodyOffset()); }
+            // getTl() trailer bytes.
+            const uint8_t *getTrailer() const { return(frame + getTrailerOffset()); }
+        };
+
     // Compose (encode) entire non-secure small frame from header params, body and CRC trailer.
     // Returns the total number of bytes written out for the frame
     // (including, and with a value one higher than the first 'fl' bytes).
@@ -644,6 +726,12 @@ namespace OTRadioLink
                                             fixed32BTextSize12BNonce16BTagSimpleDec_ptr_t d,
                                             void *state, const uint8_t *key, const uint8_t *iv,
                                             uint8_t *decryptedBodyOut, uint8_t decryptedBodyOutBuflen, uint8_t &decryptedBodyOutSize);
+            // As above, but for a frame validated in place, eg in an RX queue slot, so without a separate buffer.
+            //  * sfv  valid view of the entire frame including trailer; never NULL
+            static uint8_t decodeSecureSmallFrameRaw(const SecurableFrameView *sfv,
+                                            fixed32BTextSize12BNonce16BTagSimpleDec_ptr_t d,
+                                            void *state, const uint8_t *key, const uint8_t *iv,
+                                            uint8_t *decryptedBodyOut, uint8_t decryptedBodyOutBuflen, uint8_t &decryptedBodyOutSize);
 
             // Design notes on use of message counters vs non-volatile storage life, eg for ATMega328P.
             //
@@ -677,6 +765,16 @@ namespace OTRadioLink
             // Must only be called once the RXed message has passed authentication.
             virtual bool updateRXMessageCountAfterAuthentication(const uint8_t *ID, const uint8_t *newCounterValue) = 0;
 
+            // Look up the full node ID of the sender of a frame from the ID prefix in its header.
+            // Returns the association index of the first match at or after index, or -1 if none.
+            // Anonymous (zero-length ID) frames match any association.
+            //
+            //  * prefix / prefixLen  ID bytes from a structurally-validated frame header;
+            //        prefix may be NULL only if prefixLen is 0
+            //  * ID  if non-NULL is filled in with the full matching node ID, so must be >= 8 bytes;
+            //        not preserved if -1 is returned
+            virtual int16_t _getNextMatchingNodeID(uint16_t index, const uint8_t *prefix, uint8_t prefixLen, uint8_t *ID) const = 0;
+
             // As for decodeSecureSmallFrameRaw() but passed a candidate node/counterparty ID
             // derived from the frame ID in the incoming header,
             // plus possible other adjustments such has forcing bit values for reverse flows.
@@ -710,7 +808,7 @@ namespace OTRadioLink
                                             fixed32BTextSize12BNonce16BTagSimpleDec_ptr_t d,
                                             const uint8_t *adjID, uint8_t adjIDLen,
                                             void *state, const uint8_t *key,
-                                            uint8_t *decryptedBodyOut, uint8_t decryptedBodyOutBuflen, uint8_t &decryptedBodyOutSize) = 0;
+                                            uint8_t *decryptedBodyOut, uint8_t decryptedBodyOutBuflen, uint8_t &decryptedBodyOutSize);
 
             // From a structurally correct secure frame, looks up the ID, checks the message counter, decodes, and updates the counter if successful.
             // THIS IS THE PREFERRED ENTRY POINT FOR DECODING AND RECEIVING SECURE FRAMES.
@@ -735,7 +833,17 @@ namespace OTRadioLink
                                             void *state, const uint8_t *key,
                                             uint8_t *decryptedBodyOut, uint8_t decryptedBodyOutBuflen, uint8_t &decryptedBodyOutSize,
                                             uint8_t *ID,
-                                            bool firstIDMatchOnly = true) = 0;
+                                            bool firstIDMatchOnly = true);
+            // As above, but decoding directly from a frame validated in place, eg in an RX queue slot,
+            // avoiding copying the frame to a separate buffer and the ID into a header.
+            // Only the first ID prefix match is tried.
+            //
+            //  * sfv  valid view of the entire frame including trailer; never NULL
+            uint8_t decodeSecureSmallFrameSafely(const SecurableFrameView *sfv,
+                                            fixed32BTextSize12BNonce16BTagSimpleDec_ptr_t d,
+                                            void *state, const uint8_t *key,
+                                            uint8_t *decryptedBodyOut, uint8_t decryptedBodyOutBuflen, uint8_t &decryptedBodyOutSize,
+                                            uint8_t *ID);
         };
 
 
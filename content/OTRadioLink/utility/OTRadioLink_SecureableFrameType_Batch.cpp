@@ -0,0 +1,155 @@
+/*
+The OpenTRV project licenses this file to you
+under the Apache Licence, Version 2.0 (the "Licence");
+you may not use this file except in compliance
+with the Licence. You may obtain a copy of the Licence at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing,
+software distributed under the Licence is distributed on an
+"AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+KIND, either express or implied. See the Licence for the
+specific language governing permissions and limitations
+under the Licence.
+
+Author(s) / Copyright (s): Damon Hart-Davis 2016
+*/
+
+/*
+ * Batch decode of secure frames, eg for hubs/concentrators
+ * receiving bursts of traffic from many leaf nodes.
+ */
+
+#include <string.h>
+
+#include "OTRadioLink_SecureableFrameType_Batch.h"
+
+
+namespace OTRadioLink
+    {
+
+
+// Marker for no earlier duplicate frame in the batch.
+static const uint16_t noDuplicate = 0xffff;
+// How far back to look for an earlier copy of a frame;
+// repeat transmissions for noise immunity are normally back to back.
+static const uint8_t duplicateWindow = 8;
+
+// Decode a batch of raw secure small frames, with the same overall semantics
+// as calling decodeSecureSmallFrameSafely() on each frame in order,
+// including rejection of duplicates and replays within the batch.
+//
+// While the passes are in progress SBRX_OK marks a frame still eligible for decode;
+// decodedLength is only set non-zero once a frame has been authenticated.
+uint16_t decodeSecureSmallFramesSafelyBatch(SimpleSecureFrame32or0BodyRXBase &rx,
+                                            SecureBatchRXFrame *const frames, const uint16_t n,
+                                            const SimpleSecureFrame32or0BodyRXBase::fixed32BTextSize12BNonce16BTagSimpleDec_ptr_t d,
+                                            void *const state, const uint8_t *const key)
+    {
+    if((NULL == frames) || (0 == n)) { return(0); } // Nothing to do.
+    if((NULL == d) || (NULL == key))
+        {
+        // Reject everything without touching the raw frames.
+        for(uint16_t i = 0; i < n; ++i) { frames[i].status = SBRX_AUTH_FAILED; frames[i].decodedLength = 0; frames[i].decryptedBodyOutSize = 0; }
+        return(0); // ERROR
+        }
+
+    // Pass 1: structural checks on the header and trailer,
+    // rejecting anything that cannot be a secure frame with a 0x80-style trailer.
+    for(uint16_t i = 0; i < n; ++i)
+        {
+        SecureBatchRXFrame &f = frames[i];
+        f.decodedLength = 0;
+        f.decryptedBodyOutSize = 0;
+        f._duplicateOf = noDuplicate;
+        f.status = SBRX_BAD_HEADER;
+        if(NULL == f.buf) { continue; }
+        if(0 == f.sfh.checkAndDecodeSmallFrameHeader(f.buf, f.buflen)) { continue; }
+        if(!f.sfh.isSecure()) { continue; }
+        // Must be able to extract the message counter and see the trailing format byte.
+        const uint8_t fl = f.sfh.fl;
+        if((23 != f.sfh.getTl()) || (fl >= f.buflen) || (0x80 != f.buf[fl])) { continue; }
+        f.status = SBRX_OK;
+        }
+
+    // Pass 2: node association lookup and message counter extraction.
+    // NOTE: as for decodeSecureSmallFrameSafely() only the first ID prefix match is tried.
+    for(uint16_t i = 0; i < n; ++i)
+        {
+        SecureBatchRXFrame &f = frames[i];
+        if(SBRX_OK != f.status) { continue; }
+        if(rx._getNextMatchingNodeID(0, f.sfh.id, f.sfh.getIl(), f.ID) < 0) { f.status = SBRX_UNKNOWN_ID; continue; }
+        // Assume counter positioning as for 0x80 type trailer, ie 6 bytes at start of trailer.
+        memcpy(f.messageCounter, f.buf + f.sfh.getTrailerOffset(), SimpleSecureFrame32or0BodyBase::fullMessageCounterBytes);
+        }
+
+    // Pass 3: check message counters against the last authenticated values,
+    // and spot byte-identical repeats of earlier frames still in play.
+    // Repeats defer to the outcome of the first copy and so skip authentication.
+    // Repeats further apart than duplicateWindow are still rejected by the counter update in pass 5.
+    for(uint16_t i = 0; i < n; ++i)
+        {
+        SecureBatchRXFrame &f = frames[i];
+        if(SBRX_OK != f.status) { continue; }
+        const uint8_t fl = f.sfh.fl;
+        for(uint16_t j = (i > duplicateWindow) ? (i - duplicateWindow) : 0; j < i; ++j)
+            {
+            const SecureBatchRXFrame &e = frames[j];
+            if((SBRX_OK != e.status) || (noDuplicate != e._duplicateOf)) { continue; }
+            if((fl != e.sfh.fl) ||
+               (0 != memcmp(f.messageCounter, e.messageCounter, sizeof(f.messageCounter))) ||
+               (0 != memcmp(f.buf, e.buf, fl + 1))) { continue; }
+            f._duplicateOf = j;
+            break;
+            }
+        if(noDuplicate != f._duplicateOf) { continue; }
+        if(!rx.validateRXMessageCount(f.ID, f.messageCounter)) { f.status = SBRX_STALE_COUNTER; }
+        }
+
+    // Pass 4: authenticate and decrypt everything still in play, back to back.
+    for(uint16_t i = 0; i < n; ++i)
+        {
+        SecureBatchRXFrame &f = frames[i];
+        if((SBRX_OK != f.status) || (noDuplicate != f._duplicateOf)) { continue; }
+        // Assumed no need to 'adjust' ID for this form of RX.
+        f.decodedLength = rx._decodeSecureSmallFrameFromID(&f.sfh,
+                                                        f.buf, f.buflen,
+                                                        d,
+                                                        f.ID, OTV0P2BASE::OpenTRV_Node_ID_Bytes,
+                                                        state, key,
+                                                        f.decryptedBody, sizeof(f.decryptedBody), f.decryptedBodyOutSize);
+        if(0 == f.decodedLength) { f.status = SBRX_AUTH_FAILED; f.decryptedBodyOutSize = 0; }
+        }
+
+    // Pass 5: in frame order, update the RX message counters for authenticated frames.
+    // This rejects frames overtaken by a later counter value from an earlier frame in the batch,
+    // as the single-frame path would.
+    uint16_t decoded = 0;
+    for(uint16_t i = 0; i < n; ++i)
+        {
+        SecureBatchRXFrame &f = frames[i];
+        if(SBRX_OK != f.status) { continue; }
+        if(noDuplicate != f._duplicateOf)
+            {
+            // A repeat of a frame that authenticated (or was overtaken) is now stale;
+            // a repeat of a frame that failed authentication fails likewise.
+            const SecureBatchRXStatus firstStatus = frames[f._duplicateOf].status;
+            f.status = (SBRX_AUTH_FAILED == firstStatus) ? SBRX_AUTH_FAILED : SBRX_STALE_COUNTER;
+            continue;
+            }
+        if(!rx.updateRXMessageCountAfterAuthentication(f.ID, f.messageCounter))
+            {
+            f.status = SBRX_COUNTER_UPDATE_FAILED;
+            f.decodedLength = 0;
+            f.decryptedBodyOutSize = 0;
+            continue;
+            }
+        ++decoded;
+        }
+
+    return(decoded);
+    }
+
+
+    }
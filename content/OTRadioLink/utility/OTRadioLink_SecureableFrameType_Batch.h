@@ -0,0 +1,110 @@
+/*
+The OpenTRV project licenses this file to you
+under the Apache Licence, Version 2.0 (the "Licence");
+you may not use this file except in compliance
+with the Licence. You may obtain a copy of the Licence at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing,
+software distributed under the Licence is distributed on an
+"AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+KIND, either express or implied. See the Licence for the
+specific language governing permissions and limitations
+under the Licence.
+
+Author(s) / Copyright (s): Damon Hart-Davis 2016
+*/
+
+/*
+ * Batch decode of secure frames, eg for hubs/concentrators
+ * receiving bursts of traffic from many leaf nodes.
+ *
+ * Mainly intended for hosted (non-AVR) use as each frame slot takes ~130 bytes of RAM.
+ */
+
+#ifndef ARDUINO_LIB_OTRADIOLINK_SECUREABLEFRAMETYPE_BATCH_H
+#define ARDUINO_LIB_OTRADIOLINK_SECUREABLEFRAMETYPE_BATCH_H
+
+#include <stdint.h>
+#include <OTV0p2Base.h>
+
+#include "OTRadioLink_SecureableFrameType.h"
+
+
+namespace OTRadioLink
+    {
+
+
+    // Per-frame outcome of a batch secure frame decode.
+    // SBRX_OK is the only success value; all others indicate that the frame must be discarded.
+    enum SecureBatchRXStatus
+        {
+        SBRX_OK = 0,                // Authenticated, decrypted, and RX message counter updated.
+        SBRX_BAD_HEADER,            // Not a structurally-valid secure small frame with a 0x80-style trailer.
+        SBRX_UNKNOWN_ID,            // No node association matches the ID prefix in the header.
+        SBRX_STALE_COUNTER,         // Message counter not above last authenticated value, eg duplicate or replay.
+        SBRX_AUTH_FAILED,           // Authentication/decryption failed.
+        SBRX_COUNTER_UPDATE_FAILED, // Authenticated but counter could not be advanced, eg overtaken within the batch.
+        };
+
+    // One frame slot for batch decode.
+    // The caller fills in buf and buflen (eg with set()); all other fields are outputs.
+    // The raw frame bytes must remain valid and unchanged until the batch decode returns.
+    struct SecureBatchRXFrame
+        {
+        // Raw frame starting with the fl frame length byte, and the available length.
+        const uint8_t *buf;
+        uint8_t buflen;
+
+        // Outcome for this frame.
+        SecureBatchRXStatus status;
+        // Total number of bytes read for the frame as for decodeSecureSmallFrameSafely(); 0 unless status is SBRX_OK.
+        uint8_t decodedLength;
+        // Decoded header; valid once past SBRX_BAD_HEADER.
+        SecurableFrameHeader sfh;
+        // Full sender ID; valid once past SBRX_UNKNOWN_ID.
+        uint8_t ID[OTV0P2BASE::OpenTRV_Node_ID_Bytes];
+        // Message counter from the trailer; valid once past SBRX_UNKNOWN_ID.
+        uint8_t messageCounter[SimpleSecureFrame32or0BodyBase::fullMessageCounterBytes];
+        // Decrypted (unpadded) body and its size; valid only if status is SBRX_OK.
+        uint8_t decryptedBodyOutSize;
+        uint8_t decryptedBody[ENC_BODY_SMALL_FIXED_PTEXT_MAX_SIZE];
+
+        // Index of an earlier byte-identical frame in the same batch, else 0xffff.
+        // Used internally to avoid re-authenticating repeated transmissions.
+        uint16_t _duplicateOf;
+
+        // Set the raw frame to decode.
+        void set(const uint8_t *buf_, uint8_t buflen_) { buf = buf_; buflen = buflen_; }
+        };
+
+    // Decode a batch of raw secure small frames, with the same overall semantics
+    // as calling decodeSecureSmallFrameSafely() on each frame in order,
+    // including rejection of duplicates and replays within the batch.
+    //
+    // Work is done in separate passes over the whole batch
+    // (header validation, ID lookup, message counter check, authentication, counter update)
+    // so that (for example) the crypto function is run over many frames in a row,
+    // and so that frames failing the cheap checks never reach it.
+    // Frames that are byte-for-byte repeats of a recent earlier frame in the batch
+    // (eg sent more than once for noise immunity) are not authenticated again.
+    //
+    // Returns the number of frames with SBRX_OK status.
+    //
+    // Parameters:
+    //  * rx  RX message counter and node association state; updated as for single-frame decode
+    //  * frames  array of n frame slots with buf and buflen filled in; never NULL unless n is 0
+    //  * d  decryption function; never NULL
+    //  * state  pointer to state for d, if required, else NULL
+    //  * key  secret key; never NULL
+    uint16_t decodeSecureSmallFramesSafelyBatch(SimpleSecureFrame32or0BodyRXBase &rx,
+                                                SecureBatchRXFrame *frames, uint16_t n,
+                                                SimpleSecureFrame32or0BodyRXBase::fixed32BTextSize12BNonce16BTagSimpleDec_ptr_t d,
+                                                void *state, const uint8_t *key);
+
+
+    }
+
+
+#endif
@@ -0,0 +1,244 @@
+/*
+The OpenTRV project licenses this file to you
+under the Apache Licence, Version 2.0 (the "Licence");
+you may not use this file except in compliance
+with the Licence. You may obtain a copy of the Licence at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing,
+software distributed under the Licence is distributed on an
+"AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+KIND, either express or implied. See the Licence for the
+specific language governing permissions and limitations
+under the Licence.
+
+Author(s) / Copyright (s): Damon Hart-Davis 2016
+*/
+
+/*
+ * RAM cache of last-authenticated RX message counters
+ * for ISR-safe rejection of duplicate and replayed secure frames
+ * before they take up RX queue space.
+ */
+
+#ifndef ARDUINO_LIB_OTRADIOLINK_SECUREABLEFRAMETYPE_RXCOUNTERCACHE_H
+#define ARDUINO_LIB_OTRADIOLINK_SECUREABLEFRAMETYPE_RXCOUNTERCACHE_H
+
+#include <stdint.h>
+#include <OTV0p2Base.h>
+
+#include "OTRadioLink_SecureableFrameType.h"
+
+
+namespace OTRadioLink
+    {
+
+
+    // Cache in RAM of the last-authenticated RX message counter for up to maxNodes associated nodes.
+    // Allows secure frames whose counter is not above the cached value,
+    // ie duplicates or replays that would fail validateRXMessageCount() anyway,
+    // to be dropped in the RX ISR by a quickFrameFilter_t such as frameFilterStaleRXMessageCounter().
+    //
+    // This is only a pre-filter: frames that pass must still go through the full
+    // decodeSecureSmallFrameSafely() (or batch) path, which remains the authority.
+    // So the filter fails open: a frame is rejected only if every cached node matching its ID prefix
+    // has a cached counter at least as high as the frame's,
+    // and anonymous frames, frames from uncached nodes, and frames racing an update are let through.
+    // The cache never lowers a counter, so it can at worst lag the persistent store,
+    // in which case a few stale frames get through to be rejected by the full check.
+    //
+    // Lock-free: one foreground writer (the main loop/decode thread) and any number of ISR/thread readers.
+    // Each entry carries a sequence number that is odd while the entry is being written
+    // and changes on each write, so a reader can tell if it may have seen a torn entry.
+    //
+    // Typical workflow:
+    //   * at start-up (and on (dis)association) set() or prime() an entry per associated node,
+    //     in association order
+    //   * install the filter, eg rl.setFilterRXISR(frameFilterStaleRXMessageCounter<cache_t, &cache>)
+    //   * after each successful decodeSecureSmallFrameSafely() call update() with the sender ID and frame
+    //
+    // Takes ~16 bytes of RAM per node.
+    template<uint8_t maxNodes>
+    class SecureRXMessageCounterCache final
+        {
+        private:
+            static const uint8_t idBytes = OTV0P2BASE::OpenTRV_Node_ID_Bytes;
+            static const uint8_t counterBytes = SimpleSecureFrame32or0BodyBase::fullMessageCounterBytes;
+            // Trailer length for 0x80-style (AES-GCM) secure frames, starting with the message counter.
+            static const uint8_t trailerBytes = 23;
+
+            struct Entry
+                {
+                // Odd while being written; changed by each write.
+                OTV0P2BASE::Atomic_UInt8T seq;
+                // True if this entry holds a node.
+                bool used;
+                uint8_t ID[idBytes];
+                uint8_t counter[counterBytes];
+                };
+            volatile Entry entries[maxNodes];
+
+            // Order accesses to the entry contents against its sequence number.
+            // On AVR the ISR cannot be interrupted by the writer
+            // and all accesses are volatile so are not reordered by the compiler.
+            static void barrier()
+                {
+#ifdef OTV0P2BASE_PLATFORM_HAS_atomic
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+#endif
+                }
+
+            // Write entry i, which must be in range; foreground only.
+            void write(const uint8_t i, const bool used, const uint8_t *const ID, const uint8_t *const counter)
+                {
+                volatile Entry &e = entries[i];
+                const uint8_t s = e.seq.load();
+                e.seq.store((uint8_t)(s + 1));
+                barrier();
+                e.used = used;
+                for(uint8_t j = 0; j < idBytes; ++j) { e.ID[j] = (NULL == ID) ? 0 : ID[j]; }
+                for(uint8_t j = 0; j < counterBytes; ++j) { e.counter[j] = (NULL == counter) ? 0 : counter[j]; }
+                barrier();
+                e.seq.store((uint8_t)(s + 2));
+                }
+
+            // Find entry index with the given full ID, or -1 if none; foreground only.
+            int8_t find(const uint8_t *const ID) const
+                {
+                for(uint8_t i = 0; i < maxNodes; ++i)
+                    {
+                    const volatile Entry &e = entries[i];
+                    if(!e.used) { continue; }
+                    uint8_t j = 0;
+                    while((j < idBytes) && (e.ID[j] == ID[j])) { ++j; }
+                    if(idBytes == j) { return((int8_t)i); }
+                    }
+                return(-1);
+                }
+
+        public:
+            static_assert((maxNodes > 0) && (maxNodes <= 127), "maxNodes out of range");
+
+            // Create an empty cache.
+            SecureRXMessageCounterCache()
+                {
+                for(uint8_t i = 0; i < maxNodes; ++i) { entries[i].seq.store(0); }
+                clearAll();
+                }
+
+            // Maximum number of nodes that can be cached.
+            static constexpr uint8_t getMaxNodes() { return(maxNodes); }
+
+            // Set entry index to the given full (8-byte) node ID and last authenticated (6-byte) counter.
+            // Returns false if index is out of range or either pointer is NULL.
+            // Foreground only.
+            bool set(const uint8_t index, const uint8_t *const ID, const uint8_t *const counter)
+                {
+                if((index >= maxNodes) || (NULL == ID) || (NULL == counter)) { return(false); } // ERROR
+                write(index, true, ID, counter);
+                return(true);
+                }
+
+            // Set entry index from the persistent RX message counter for the given node held by rx.
+            // Returns false if index is out of range, ID is NULL or the counter cannot be read.
+            // Foreground only.
+            bool prime(const uint8_t index, const uint8_t *const ID, const SimpleSecureFrame32or0BodyRXBase &rx)
+                {
+                uint8_t counter[counterBytes];
+                if(NULL == ID) { return(false); } // ERROR
+                if(!rx.getLastRXMessageCounter(ID, counter)) { return(false); } // FAIL
+                return(set(index, ID, counter));
+                }
+
+            // Empty entry index, eg on dissociation; does nothing if out of range.
+            // Foreground only.
+            void clear(const uint8_t index) { if(index < maxNodes) { write(index, false, NULL, NULL); } }
+            // Empty all entries.
+            // Foreground only.
+            void clearAll() { for(uint8_t i = 0; i < maxNodes; ++i) { clear(i); } }
+
+            // Raise the cached counter for the given full node ID after successful authentication.
+            // Never lowers the cached value.
+            // Returns false if the node is not cached (or ID/counter is NULL).
+            // Foreground only.
+            bool update(const uint8_t *const ID, const uint8_t *const counter)
+                {
+                if((NULL == ID) || (NULL == counter)) { return(false); } // ERROR
+                const int8_t i = find(ID);
+                if(i < 0) { return(false); } // FAIL
+                uint8_t current[counterBytes];
+                for(uint8_t j = 0; j < counterBytes; ++j) { current[j] = entries[i].counter[j]; }
+                if(SimpleSecureFrame32or0BodyBase::msgcountercmp(counter, current) > 0) { write((uint8_t)i, true, ID, counter); }
+                return(true);
+                }
+            // As above, taking the counter from the trailer of the frame just authenticated.
+            // Returns false if the frame is not a complete secure frame with a 0x80-style trailer.
+            bool update(const uint8_t *const ID, const SecurableFrameView &sfv)
+                {
+                if(!sfv.isComplete() || !sfv.isSecure() || (trailerBytes != sfv.getTl())) { return(false); } // ERROR
+                return(update(ID, sfv.getTrailer()));
+                }
+
+            // Copy the cached counter for the given full node ID; false if not cached.
+            // Primarily public to allow whitebox unit testing.
+            // Foreground only.
+            bool get(const uint8_t *const ID, uint8_t *const counter) const
+                {
+                if((NULL == ID) || (NULL == counter)) { return(false); } // ERROR
+                const int8_t i = find(ID);
+                if(i < 0) { return(false); } // FAIL
+                for(uint8_t j = 0; j < counterBytes; ++j) { counter[j] = entries[i].counter[j]; }
+                return(true);
+                }
+
+            // Returns true if the frame at the start of buf is definitely a stale secure frame,
+            // ie its message counter is not above the cached value for any cached node matching its ID prefix.
+            // Returns false for anything else, including invalid, incomplete, non-secure and anonymous frames,
+            // frames from uncached nodes, and where an entry being checked is concurrently updated.
+            // ISR-safe and thread-safe; does not block or allocate.
+            bool isStale(const volatile uint8_t *const buf, const uint8_t buflen) const
+                {
+                SecurableFrameView sfv;
+                if(0 == sfv.checkAndDecodeSmallFrameHeader(buf, buflen)) { return(false); }
+                if(!sfv.isComplete() || !sfv.isSecure() || (trailerBytes != sfv.getTl())) { return(false); }
+                const uint8_t il = sfv.getIl();
+                if(0 == il) { return(false); }
+                const uint8_t *const id = sfv.getID();
+                const uint8_t *const frameCounter = sfv.getTrailer();
+                bool matched = false;
+                for(uint8_t i = 0; i < maxNodes; ++i)
+                    {
+                    const volatile Entry &e = entries[i];
+                    const uint8_t s = e.seq.load();
+                    if(0 != (s & 1)) { return(false); } // Entry being written: let the frame through.
+                    barrier();
+                    if(!e.used) { continue; }
+                    uint8_t j = 0;
+                    while((j < il) && (e.ID[j] == id[j])) { ++j; }
+                    if(il != j) { continue; }
+                    uint8_t cached[counterBytes];
+                    for(j = 0; j < counterBytes; ++j) { cached[j] = e.counter[j]; }
+                    barrier();
+                    if(s != e.seq.load()) { return(false); } // Torn read: let the frame through.
+                    if(SimpleSecureFrame32or0BodyBase::msgcountercmp(frameCounter, cached) > 0) { return(false); }
+                    matched = true;
+                    }
+                return(matched);
+                }
+        };
+
+    // Quick ISR-safe filter rejecting stale secure frames with the message counter cache at *cache.
+    // The cache must have static storage duration, eg:
+    //     typedef SecureRXMessageCounterCache<8> RXCounterCache_t;
+    //     static RXCounterCache_t rxCounterCache;
+    //     rl.setFilterRXISR(frameFilterStaleRXMessageCounter<RXCounterCache_t, &rxCounterCache>);
+    // Never alters buflen.
+    template<class cache_t, const cache_t *cache>
+    bool frameFilterStaleRXMessageCounter(const volatile uint8_t *const buf, volatile uint8_t &buflen)
+        { return(!cache->isStale(buf, buflen)); }
+
+
+    }
+
+#endif
@@ -259,8 +259,13 @@ namespace OTRadioLink
     class SimpleSecureFrame32or0BodyRXV0p2 : public SimpleSecureFrame32or0BodyRXBase
         {
         private:
+            // Default node association lookup direct from EEPROM.
+            OTV0P2BASE::NodeAssociationLookupEEPROM eepromAssociations;
+            // Current node association lookup; never NULL.
+            const OTV0P2BASE::NodeAssociationLookupBase *associations;
+
             // Constructor is private to force use of factory method to return singleton.
-            SimpleSecureFrame32or0BodyRXV0p2() { }
+            SimpleSecureFrame32or0BodyRXV0p2() : associations(&eepromAssociations) { }
 
         public:
             // Factory method to get singleton instance.
@@ -279,62 +284,19 @@ namespace OTRadioLink
             // Must only be called once the RXed message has passed authentication.
             virtual bool updateRXMessageCountAfterAuthentication(const uint8_t *ID, const uint8_t *newCounterValue);
 
-            // As for decodeSecureSmallFrameRaw() but passed a candidate node/counterparty ID
-            // derived from the frame ID in the incoming header,
-            // plus possible other adjustments such has forcing bit values for reverse flows.
-            // This routine constructs an IV from this expanded ID
-            // (which must be at least length 6 for 'O' / 0x80 style enc/auth)
-            // and other information in the header
-            // and then returns the result of calling decodeSecureSmallFrameRaw().
-            //
-            // If several candidate nodes share the ID prefix in the frame header
-            // (in the extreme case with a zero-length header ID for an anonymous frame)
-            // then they may all have to be tested in turn until one succeeds.
-            //
-            // Generally a call to this should be done AFTER checking that
-            // the aggregate RXed message counter is higher than for the last successful receive
-            // (for this node and flow direction)
-            // and after a success those message counters should be updated
-            // (which may involve more than a simple increment)
-            // to the new values to prevent replay attacks.
-            //
-            //   * adjID / adjIDLen  adjusted candidate ID (never NULL)
-            //         and available length (must be >= 6)
-            //         based on the received ID in (the already structurally validated) header
-            //
-            // TO AVOID RELAY ATTACKS: verify the counter is higher than any previous authed message from this sender
-            // then update the RX message counter after a successful auth with this routine.
-            virtual uint8_t _decodeSecureSmallFrameFromID(const SecurableFrameHeader *sfh,
-                                            const uint8_t *buf, uint8_t buflen,
-                                            fixed32BTextSize12BNonce16BTagSimpleDec_ptr_t d,
-                                            const uint8_t *adjID, uint8_t adjIDLen,
-                                            void *state, const uint8_t *key,
-                                            uint8_t *decryptedBodyOut, uint8_t decryptedBodyOutBuflen, uint8_t &decryptedBodyOutSize);
-
-            // From a structurally correct secure frame, looks up the ID, checks the message counter, decodes, and updates the counter if successful.
-            // THIS IS THE PREFERRED ENTRY POINT FOR DECODING AND RECEIVING SECURE FRAMES.
-            // (Pre-filtering by type and ID and message counter may already have happened.)
-            // Note that this is for frames being send from the ID in the header,
-            // not for lightweight return traffic to the specified ID.
-            // Returns the total number of bytes read for the frame
-            // (including, and with a value one higher than the first 'fl' bytes).
-            // Returns zero in case of error, eg because authentication failed or this is a duplicate message.
-            // If this returns true then the frame is authenticated,
-            // and the decrypted body is available if present and a buffer was provided.
-            // If the 'firstMatchIDOnly' is true (the default)
-            // then this only checks the first ID prefix match found if any,
-            // else all possible entries may be tried depending on the implementation
-            // and, for example, time/resource limits.
-            // This overloading accepts the decryption function, state and key explicitly.
-            //
-            //  * ID if non-NULL is filled in with the full authenticated sender ID, so must be >= 8 bytes
-            virtual uint8_t decodeSecureSmallFrameSafely(const SecurableFrameHeader *sfh,
-                                            const uint8_t *buf, uint8_t buflen,
-                                            fixed32BTextSize12BNonce16BTagSimpleDec_ptr_t d,
-                                            void *state, const uint8_t *key,
-                                            uint8_t *decryptedBodyOut, uint8_t decryptedBodyOutBuflen, uint8_t &decryptedBodyOutSize,
-                                            uint8_t *ID,
-                                            bool firstIDMatchOnly = true);
+            // Look up the full node ID of the sender of a frame from the ID prefix in its header.
+            // Returns the association index of the first match at or after index, or -1 if none.
+            // Uses the current node association lookup.
+            virtual int16_t _getNextMatchingNodeID(uint16_t index, const uint8_t *prefix, uint8_t prefixLen, uint8_t *ID) const
+                { return(associations->getNextMatchingNodeID(index, prefix, prefixLen, ID)); }
+
+            // Set the node association lookup, eg a RAM-resident NodeAssociationIndex loaded from EEPROM,
+            // to avoid scanning the EEPROM associations table for every frame received.
+            // The lookup must return the same association indexes as the EEPROM table,
+            // and must be kept in sync with it, eg with loadFromEEPROM() after any change.
+            // NULL reverts to the default direct EEPROM lookup.
+            void setNodeAssociationLookup(const OTV0P2BASE::NodeAssociationLookupBase *const l)
+                { associations = (NULL == l) ? &eepromAssociations : l; }
         };
 
 #endif // ARDUINO_ARCH_AVR
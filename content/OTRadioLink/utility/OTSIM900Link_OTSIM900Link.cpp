@@ -29,6 +29,8 @@ namespace OTSIM900Link
 {
 
 
+constexpr uint8_t OTSIM900ATParser::MAX_INFO_CHARS;
+
 //const char *AT_ = "";
 const char *OTSIM900LinkBase::AT_START = "AT";
 const char *OTSIM900LinkBase::AT_SIGNAL = "+CSQ";
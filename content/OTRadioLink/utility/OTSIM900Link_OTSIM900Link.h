@@ -38,6 +38,7 @@
 
 #include <OTRadioLink.h>
 #include <OTV0p2Base.h>
+#include <stddef.h>
 #include <string.h>
 #include <stdint.h>
 
@@ -71,6 +72,9 @@
  *             - pass pointer to radiolink structure to OTSIM900Link::configure()
  *             - begin starts radio and sets up PGP instance, before returning to GPRS off mode
  *             - queueToSend starts GPRS, opens UDP, sends message then deactivates GPRS. Process takes 5-10 seconds
+ *             - poll() never waits for the SIM900: AT commands are queued and their responses parsed as they arrive
+ *             - optionally queue several frames, and coalesce them into fewer UDP datagrams
+ *               to be split again at the server with OTSIM900CoalescedFrameReader
  */
 
 namespace OTSIM900Link
@@ -163,6 +167,142 @@ namespace OTSIM900Link
         PANIC
         };
 
+    /**
+     * @brief   Splits a datagram sent by OTSIM900Link with TX coalescing back into its frames, eg at the server.
+     * @note    Each frame in the datagram is preceded by a single byte giving its length.
+     *          Does no allocation and does not copy; frames point into the datagram.
+     */
+    class OTSIM900CoalescedFrameReader final
+        {
+        private:
+            const uint8_t *pos;
+            const uint8_t *const end;
+            bool bMalformed;
+
+        public:
+            OTSIM900CoalescedFrameReader(const uint8_t *datagram, const size_t length)
+              : pos(datagram), end(datagram + ((NULL == datagram) ? 0 : length)), bMalformed(false) { }
+
+            /**
+             * @brief   Get the next frame from the datagram.
+             * @param   frame:  set to the start of the frame.
+             * @param   length: set to the length of the frame.
+             * @retval  False at the end of the datagram, or if the remainder is truncated (see isMalformed()).
+             */
+            bool next(const uint8_t *&frame, uint8_t &length)
+                {
+                if(pos >= end) { return(false); }
+                const uint8_t l = *pos;
+                if(l > (size_t)(end - pos - 1)) { bMalformed = true; pos = end; return(false); } // FAIL
+                frame = pos + 1;
+                length = l;
+                pos += 1 + l;
+                return(true);
+                }
+
+            // True if a truncated frame has been encountered.
+            bool isMalformed() const { return(bMalformed); }
+        };
+
+    /**
+     * @brief   Outcome of an AT command transaction with the SIM900.
+     */
+    enum OTSIM900ATResult : uint8_t
+        {
+        AT_PENDING = 0, // Not yet complete.
+        AT_OK,          // Completed as expected.
+        AT_ERROR,       // Module replied with an error.
+        AT_TIMEOUT      // Module did not complete its reply in time.
+        };
+
+    /**
+     * @brief   What completes an AT command transaction, once the echo of the command has been seen.
+     */
+    enum OTSIM900ATEnd : uint8_t
+        {
+        AT_END_OK = 0,  // Final OK, eg: b'AT+CREG?\r\n\r\n+CREG: 0,5\r\n\r\nOK\r\n'
+        AT_END_INFO,    // First information line, after any OK, eg: b'AT+CIPSTATUS\r\n\r\nOK\r\n\r\nSTATE: IP START\r\n'
+        AT_END_PROMPT   // Data prompt, eg: b'AT+CIPSEND=62\r\n\r\n>'
+        };
+
+    /**
+     * @brief   Incremental parser for the SIM900 response to one AT command, fed a byte at a time.
+     * @note    Lines before the echo of the command are ignored, eg late 'SEND OK' from a previous command.
+     *          An ERROR line always completes the transaction.
+     *          The first information line (not the echo, OK nor ERROR) is kept, truncated if need be.
+     */
+    class OTSIM900ATParser final
+        {
+        public:
+            // Maximum significant chars of information line kept.
+            static const constexpr uint8_t MAX_INFO_CHARS = 24;
+
+        private:
+            OTSIM900ATEnd end;
+            OTSIM900ATResult result;
+            bool bEchoSeen;
+            bool bHaveInfo;
+            // Length of current line so far, saturating.
+            uint8_t lineLen;
+            // Start of current line, and first information line; '\0' terminated.
+            char line[MAX_INFO_CHARS + 1];
+            char info[MAX_INFO_CHARS + 1];
+
+            // True if the current line starts with s.
+            bool lineStartsWith(const char *s) const { return(0 == strncmp(line, s, strlen(s))); }
+
+            // Classify the current non-empty line.
+            void endLine()
+                {
+                line[(lineLen < MAX_INFO_CHARS) ? lineLen : MAX_INFO_CHARS] = '\0';
+                if(!bEchoSeen) { bEchoSeen = lineStartsWith("AT"); return; }
+                if((2 == lineLen) && lineStartsWith("OK")) { if(AT_END_OK == end) { result = AT_OK; } return; }
+                if(lineStartsWith("ERROR") || lineStartsWith("+CME ERROR")) { result = AT_ERROR; return; }
+                if(!bHaveInfo) { memcpy(info, line, sizeof(info)); bHaveInfo = true; }
+                if(AT_END_INFO == end) { result = AT_OK; }
+                }
+
+        public:
+            OTSIM900ATParser() { start(AT_END_OK); }
+
+            // Start parsing the response to a new command.
+            void start(const OTSIM900ATEnd e)
+                {
+                end = e;
+                result = AT_PENDING;
+                bEchoSeen = false;
+                bHaveInfo = false;
+                lineLen = 0;
+                line[0] = '\0';
+                info[0] = '\0';
+                }
+
+            // Feed the next byte of the response; returns true once the transaction is complete.
+            bool feed(const char c)
+                {
+                if(AT_PENDING != result) { return(true); }
+                if(('\r' == c) || ('\n' == c))
+                    {
+                    if(0 != lineLen) { endLine(); lineLen = 0; }
+                    }
+                else if(('>' == c) && (0 == lineLen) && bEchoSeen && (AT_END_PROMPT == end)) { result = AT_OK; }
+                else
+                    {
+                    if(lineLen < MAX_INFO_CHARS) { line[lineLen] = c; }
+                    if(lineLen < 255) { ++lineLen; }
+                    }
+                return(AT_PENDING != result);
+                }
+
+            // Give up waiting for the rest of the response.
+            void timeout() { if(AT_PENDING == result) { result = AT_TIMEOUT; } }
+
+            // Result so far.
+            OTSIM900ATResult getResult() const { return(result); }
+            // First information line received, or "" if none.
+            const char *getInfo() const { return(info); }
+        };
+
 // Includes string constants.
     class OTSIM900LinkBase: public OTRadioLink::OTRadioLink
         {
@@ -200,6 +340,11 @@ namespace OTSIM900Link
      *             - Not sure how much power reduced
      *             - If not sending often may be more efficient to power up and wait for connect each time
      *             Make OTSIM900LinkBase to abstract serial interface and allow templating?
+     * @param   txQueueSlots  number of frames that can be queued for TX, each taking maxTxMsgLen bytes of RAM;
+     *          when full the oldest queued frame is dropped so that the freshest is always sent.
+     * @param   coalesceTX  if true, pack as many queued frames as fit into each UDP datagram,
+     *          each preceded by a length byte, saving an AT+CIPSEND round trip per frame;
+     *          the server must split them with OTSIM900CoalescedFrameReader.
      */
 #define OTSIM900Link_DEFINED
     template<uint8_t rxPin, uint8_t txPin, uint8_t PWR_PIN,
@@ -207,9 +352,12 @@ namespace OTSIM900Link
 #ifdef OTSoftSerial2_DEFINED
         = OTV0P2BASE::OTSoftSerial2<rxPin, txPin, OTSIM900LinkBase::SIM900_MAX_baud>
 #endif
+    , uint8_t txQueueSlots = 1, bool coalesceTX = false
     >
     class OTSIM900Link final : public OTSIM900LinkBase
         {
+            static_assert(txQueueSlots > 0, "must have at least one TX slot");
+
             // Maximum number of significant chars in the SIM900 response.
             // Minimising this reduces stack and/or global space pressures.
             static const int MAX_SIM900_RESPONSE_CHARS = 64;
@@ -259,10 +407,18 @@ namespace OTSIM900Link
                 config = NULL;
                 state = IDLE;
                 memset(txQueue, 0, sizeof(txQueue));
-                txMsgLen = 0;
+                memset(txMsgLen, 0, sizeof(txMsgLen));
+                txQueueHead = 0;
                 txMessageQueue = 0;
+                txDatagramFrames = 0;
+                txDatagramLen = 0;
                 messageCounter = 0;
                 retryCounter = 0;
+                signalQuality = 99;
+                atQueueHead = 0;
+                atQueued = 0;
+                bATInFlight = false;
+                atTimer = 0;
                 }
 
             /************************* Public Methods *****************************/
@@ -298,15 +454,14 @@ namespace OTSIM900Link
              * @param   Txpower ignored
              * @retval  returns true if send process inited.
              * @note    requires calling of poll() to check if message sent successfully
+             * @note    As the SIM900 is only talked to from poll(), this queues the message as queueToSend() does.
              */
             virtual bool sendRaw(const uint8_t *buf, uint8_t buflen,
                     int8_t channel = 0, TXpower power = TXnormal,
                     bool listenAfter = false) override
                 {
-                bool bSent = false;
                 OTSIM900LINK_DEBUG_SERIAL_PRINTLN_FLASHSTRING("Send Raw")
-                bSent = UDPSend((const char *) buf, buflen);
-                return bSent;
+                return queueToSend(buf, buflen, channel, power);
                 }
 
             /**
@@ -317,22 +472,38 @@ namespace OTSIM900Link
              * @param   Txpower ignored.
              * @retval  returns true if send process inited.
              * @note    requires calling of poll() to check if message sent successfully.
+             * @note    if the queue is full the oldest message is dropped, ensuring freshest message is sent,
+             *          unless that message is already being sent in which case this fails.
              */
             virtual bool queueToSend(const uint8_t *buf, uint8_t buflen, int8_t,
                     TXpower) override
                 {
-                if ((buf == NULL) || (buflen > sizeof(txQueue)))
-                    return false;    //
-//        if ((buf == NULL) || (buflen > sizeof(txQueue)) || (txMessageQueue >= maxTxQueueLength)) return false;    //
-//        // Increment message queue
-//        txMessageQueue++; //
-                    // copy into queue here?
-                txMessageQueue = 1;
-                memcpy(txQueue, buf, buflen); // Last message queued is copied to buffer, ensuring freshest message is sent.
-                txMsgLen = buflen;
+                if ((buf == NULL) || (buflen > maxTxMsgLen))
+                    return false;    // FAIL
+                if (txMessageQueue >= maxTxQueueLength)
+                    {
+                    if (0 != txDatagramFrames)
+                        return false;    // FAIL
+                    popTXQueue();
+                    }
+                const uint8_t slot = (txQueueHead + txMessageQueue) % maxTxQueueLength;
+                memcpy(txQueue[slot], buf, buflen);
+                txMsgLen[slot] = buflen;
+                ++txMessageQueue;
                 return true;
                 }
 
+            /**
+             * @brief   Number of messages currently queued for TX.
+             */
+            uint8_t getTXMsgsQueued() const { return(txMessageQueue); }
+
+            /**
+             * @brief   Last signal quality reported by the SIM900.
+             * @retval  RSSI [0,31] as from AT+CSQ, or 99 if not known.
+             */
+            uint8_t getSignalQuality() const { return(signalQuality); }
+
             virtual bool isAvailable() const override
                 {
                 return bAvailable;
@@ -341,12 +512,14 @@ namespace OTSIM900Link
 
             /**
              * @brief   Polling routine steps through 4 stage state machine
+             * @note    Never waits for the SIM900: each state queues its AT commands,
+             *          and the state changes when they complete in this or a later poll().
              */
             virtual void poll() override
                 {
                 if (bPowerLock == false)
                     {
-                    if (nearStartOfMajorCycle())
+                    if (nearStartOfMajorCycle() && !isATBusy())
                         {
                         if (messageCounter == 255)
                             { // FIXME an attempt at forcing a hard restart every 255 messages.
@@ -356,113 +529,72 @@ namespace OTSIM900Link
                             }
                         switch (state)
                             {
-                            case GET_STATE: // Check SIM900 is present and can be talked to. Takes up to 220 ticks?
+                            case GET_STATE: // Check SIM900 is present and can be talked to.
                                 OTSIM900LINK_DEBUG_SERIAL_PRINTLN_FLASHSTRING("*GET_STATE")
                                 memset(txQueue, 0, sizeof(txQueue));
                                 messageCounter = 0;
                                 retryCounter = 0;
-                                txMsgLen = 0;
+                                memset(txMsgLen, 0, sizeof(txMsgLen));
+                                txQueueHead = 0;
                                 txMessageQueue = 0;
+                                txDatagramFrames = 0;
                                 bAvailable = false;
                                 bPowered = false;
-                                if (isSIM900Replying())
-                                    {
-                                    bAvailable = true;
-                                    bPowered = true;
-                                    state = START_UP;
-                                    }
-                                else
-                                    {
-                                    state = RETRY_GET_STATE;
-                                    }
-                                powerToggle(); // Power down for START_UP/toggle for RETRY_GET_STATE.
+                                queueAT(ATCMD_PING, &OTSIM900Link::onGetState);
                                 break;
                             case RETRY_GET_STATE:
                                 OTSIM900LINK_DEBUG_SERIAL_PRINTLN_FLASHSTRING("*RETRY_GET_STATE")
-                                if (isSIM900Replying())
-                                    {
-                                    bAvailable = true;
-                                    bPowered = true;
-                                    state = START_UP;
-                                    }
-//                                else  // Removed to attempt SIM900 reset forever if not present.
-//                                    state = PANIC;
-                                powerToggle(); // Power down for START_UP
+                                queueAT(ATCMD_PING, &OTSIM900Link::onRetryGetState);
                                 break;
-                            case START_UP: // takes up to 150 ticks
+                            case START_UP:
                                 OTSIM900LINK_DEBUG_SERIAL_PRINTLN_FLASHSTRING("*START_UP")
                                 if (++retryCounter > maxRetries)
-                                    state = RESET;
-                                else if (isSIM900Replying())
                                     {
-                                    state = CHECK_PIN;
-                                    retryCounter = 0;
+                                    state = RESET;
+                                    powerOn();
                                     }
-                                powerOn();
-//                    else state = RESET;                     // FIXME Testing whether this will make sure the device is on.
+                                else
+                                    queueAT(ATCMD_PING, &OTSIM900Link::onStartUp);
                                 break;
-                            case CHECK_PIN: // Set pin if required. Takes ~100 ticks to exit.
+                            case CHECK_PIN: // Set pin if required.
                                 OTSIM900LINK_DEBUG_SERIAL_PRINTLN_FLASHSTRING("*CHECK_PIN")
                                 if (++retryCounter > maxRetries)
                                     state = RESET;
-                                else if (isPINRequired())
-                                    {
-                                    state = WAIT_FOR_REGISTRATION;
-                                    retryCounter = 0;
-                                    }
-                                //                if(setPIN()) state = PANIC;// TODO make sure setPin returns true or false
+                                else
+                                    queueAT(ATCMD_PIN_QUERY, &OTSIM900Link::onCheckPIN);
                                 break;
-                            case WAIT_FOR_REGISTRATION: // Wait for registration to GSM network. Stuck in this state until success. Takes ~150 ticks to exit.
+                            case WAIT_FOR_REGISTRATION: // Wait for registration to GSM network. Stuck in this state until success.
                                 OTSIM900LINK_DEBUG_SERIAL_PRINTLN_FLASHSTRING("*WAIT_FOR_REG")
-//                    if(++retryCounter > maxRetries) state = RESET; // FIXME Turned this off as it affects registering
-                                if (isRegistered())
-                                    {
-                                    state = SET_APN;
-//                        retryCounter = 0;
-                                    }
+                                queueAT(ATCMD_REGISTRATION_QUERY, &OTSIM900Link::onRegistration);
                                 break;
-                            case SET_APN: // Attempt to set the APN. Stuck in this state until success. Takes up to 200 ticks to exit.
+                            case SET_APN: // Attempt to set the APN. Stuck in this state until success.
                                 OTSIM900LINK_DEBUG_SERIAL_PRINTLN_FLASHSTRING("*SET_APN")
                                 if (++retryCounter > maxRetries)
                                     state = RESET;
-                                else if (setAPN())
-                                    {
-                                    messageCounter = 0;
-                                    state = START_GPRS;
-                                    }
+                                else
+                                    queueAT(ATCMD_SET_APN, &OTSIM900Link::onSetAPN);
                                 break;
                             case START_GPRS:  // Start GPRS context.
                                 OTSIM900LINK_DEBUG_SERIAL_PRINTLN("*START_GPRS")
                                 if (++retryCounter > maxRetries)
                                     state = RESET;
-                                else if (checkUDPStatus() == 3)
-                                    {
-                                    state = GET_IP;
-                                    retryCounter = 0;
-                                    }
                                 else
-                                    startGPRS();
-                                //                if(!startGPRS()) state = GET_IP;  // TODO: Add retries, Option to shut GPRS here (probably needs a new state)
+                                    queueAT(ATCMD_STATUS, &OTSIM900Link::onStartGPRSStatus);
                                 // FIXME 20160505: Need to work out how to handle this. If signal is marginal this will fail.
                                 break;
-                            case GET_IP: // Takes up to 200 ticks to exit.
+                            case GET_IP:
                                 // For some reason, AT+CIFSR must done to be able to do any networking.
                                 // It is the way recommended in SIM900_Appication_Note.pdf section 3: Single Connections.
                                 // This was not necessary when opening and shutting GPRS as in OTSIM900Link v1.0
                                 OTSIM900LINK_DEBUG_SERIAL_PRINTLN_FLASHSTRING("*GET IP")
-//                    if(getIP()) state = OPEN_UDP;
-                                getIP();
-                                state = OPEN_UDP;
+                                queueAT(ATCMD_GET_IP, &OTSIM900Link::onGetIP);
                                 break;
-                            case OPEN_UDP: // Open a udp socket. Takes ~200 ticks to exit.
+                            case OPEN_UDP: // Open a udp socket.
                                 OTSIM900LINK_DEBUG_SERIAL_PRINTLN_FLASHSTRING("*OPEN UDP")
                                 if (++retryCounter > maxRetries)
                                     state = RESET;
-                                else if (openUDPSocket())
-                                    {
-                                    state = IDLE;
-                                    retryCounter = 0;
-                                    }
+                                else
+                                    queueAT(ATCMD_OPEN_UDP, &OTSIM900Link::onOpenUDP);
                                 break;
                             case IDLE:  // Waiting for outbound message.
                                 if (txMessageQueue > 0)
@@ -470,30 +602,18 @@ namespace OTSIM900Link
                                     state = WAIT_FOR_UDP; // TODO-748
                                     }
                                 break;
-                            case WAIT_FOR_UDP: // Make sure UDP context is open. Takes up to 200 ticks to exit.
-                            OTSIM900LINK_DEBUG_SERIAL_PRINTLN_FLASHSTRING("*WAIT_FOR_UDP")
-                                {
-                                uint8_t udpState = checkUDPStatus();
-                                if (++retryCounter > maxRetries)
-                                    state = RESET;
-                                if (udpState == 1)
-                                    {
-                                    state = SENDING;
-                                    retryCounter = 0;
-                                    }
-//                        else if (udpState == 0) state = GET_STATE; // START_GPRS; // TODO needed for optional wake GPRS to send. FIXME normally commented, set to get_state for testing reset.
-                                else if (udpState == 2)
-                                    state = RESET;
-                                }
+                            case WAIT_FOR_UDP: // Make sure UDP context is open.
+                                OTSIM900LINK_DEBUG_SERIAL_PRINTLN_FLASHSTRING("*WAIT_FOR_UDP")
+                                queueAT(ATCMD_STATUS, &OTSIM900Link::onWaitForUDP);
+                                queueAT(ATCMD_SIGNAL, &OTSIM900Link::onSignal); // Pipelined to follow immediately.
                                 break;
-                            case SENDING: // Attempt to send a message. Takes ~100 ticks to exit.
+                            case SENDING: // Attempt to send a message.
                                 OTSIM900LINK_DEBUG_SERIAL_PRINTLN_FLASHSTRING("*SENDING")
                                 if (txMessageQueue > 0)
-                                    { // Check to make sure it is near the start of the subcycle to avoid overrunning.
+                                    {
                                     // TODO logic to check if send attempt successful
-                                    sendRaw(txQueue, txMsgLen); /// @note can't use strlen with encrypted/binary packets
-                                    if (!(--txMessageQueue))
-                                        state = IDLE; // // Once done, decrement number of messages in queue and return to IDLE
+                                    prepareDatagram();
+                                    queueAT(ATCMD_SEND_UDP, &OTSIM900Link::onSendPrompt);
                                     }
                                 else if (txMessageQueue == 0)
                                     state = IDLE;
@@ -501,17 +621,7 @@ namespace OTSIM900Link
                             case RESET:
                                 OTSIM900LINK_DEBUG_SERIAL_PRINTLN_FLASHSTRING("*RESET")
                                 retryCounter = 0; // reset retry counter.
-                                if (!isSIM900Replying())
-                                    {
-                                    bAvailable = true;
-                                    bPowered = true;
-                                    }
-                                else
-                                    {
-                                    bPowered = false;
-                                    }
-                                state = START_UP;
-                                powerOff(); // Power down for START_UP.
+                                queueAT(ATCMD_PING, &OTSIM900Link::onReset);
                                 break;
                             case PANIC:
                                 OTSIM900LINK_DEBUG_SERIAL_PRINTLN_FLASHSTRING("SIM900_PANIC!");
@@ -520,9 +630,18 @@ namespace OTSIM900Link
                                 break;
                             }
                         }
+                    pollAT();
+                    }
+                else
+                    {
+                    if (waitedLongEnoughForPowerPulse())
+                        setPwrPinHigh(false); // End power toggle pulse.
+                    if (waitedLongEnoughForPower())
+                        {
+                        setPwrPinHigh(false);
+                        bPowerLock = false; // Check if ready to stop waiting after power toggled.
+                        }
                     }
-                else if (waitedLongEnoughForPower())
-                    bPowerLock = false; // Check if ready to stop waiting after power toggled.
                 }
 
             /**
@@ -540,7 +659,14 @@ namespace OTSIM900Link
 
             /***************** AT Commands and Private Constants and variables ******************/
             static const constexpr uint8_t duration = 10; // DE20160703:Increased duration due to startup issues.
-            static const constexpr uint8_t flushTimeOut = 10;
+            // Seconds (on AVR) or polls (otherwise) to wait for the SIM900 to complete a reply.
+#ifdef ARDUINO_ARCH_AVR
+            static const constexpr uint8_t atTimeout = 10;
+#else
+            static const constexpr uint8_t atTimeout = 2;
+#endif
+            // Maximum response bytes read in one poll(), to bound its time.
+            static const constexpr uint8_t maxATBytesPerPoll = MAX_SIM900_RESPONSE_CHARS;
 
             // Standard Responses
 
@@ -565,6 +691,7 @@ namespace OTSIM900Link
             uint8_t retryCounter;
             static const constexpr uint8_t maxRetries = 10;
             volatile uint8_t txMessageQueue; // Number of frames currently queued for TX.
+            uint8_t signalQuality; // RSSI from last AT+CSQ, 99 if unknown.
             const OTSIM900LinkConfig_t *config;
             /************************* Private Methods *******************************/
             // Power up/down
@@ -600,49 +727,17 @@ namespace OTSIM900Link
 
             /**
              * @brief   toggles power and sets power lock.
+             * @note    The power pin is released by poll() once the pulse is long enough.
              * @fixme   proper ovf testing not implemented so the SIM900 may not power on/off near the end of a 60 second cycle.
              */
             void powerToggle()
                 {
                 setPwrPinHigh(true);
-#ifdef ARDUINO_ARCH_AVR
-                delay(1500); // This is the minimum value that worked reliably.
-#endif // ARDUINO_ARCH_AVR
-                setPwrPinHigh(false);
                 bPowered = !bPowered;
-                //    delay(3000);
                 bPowerLock = true;
                 powerTimer = OTV0P2BASE::getSecondsLT();
                 }
 
-            // Serial functions
-            /**
-             * @brief   Enter blocking read. Fills buffer or times out after 100 ms.
-             * @param   data:   Data buffer to write to.
-             * @param   length: Length of data buffer.
-             * @retval  Number of characters received before time out.
-             */
-            uint8_t timedBlockingRead(char *data, uint8_t length)
-                {
-                // clear buffer, get time and init i to 0
-                uint8_t counter = 0;
-                uint8_t len = length;
-                char *pdata = data;
-                memset(data, 0, length);
-                while (len--)
-                    {
-                    char c = ser.read();
-                    if (c == -1)
-                        break;
-                    *pdata++ = c;
-                    counter++;
-                    }
-#if 0
-                OTSIM900LINK_DEBUG_SERIAL_PRINTLN_FLASHSTRING("\n--Buffer Length: ")
-                OTSIM900LINK_DEBUG_SERIAL_PRINTLN(i)
-#endif
-                return counter;
-                }
             /**
              * @brief   Utility function for printing from config structure.
              * @param   src:    Source to print from. Should be passed as a config-> pointer.
@@ -662,487 +757,507 @@ namespace OTSIM900Link
                     }
                 }
 
-            // write AT commands
+            /************************* AT transaction engine *******************************/
+            // Commands are queued with a completion callback and run one at a time, in order.
+            // pollAT() writes the next command when none is in progress,
+            // then feeds whatever response bytes are already available to the parser without waiting,
+            // calling back when the parser sees the end of the response or the command times out.
+            // Callbacks may queue further commands, which are started immediately.
+
+            // AT commands used.
+            enum ATCommand_t : uint8_t
+                {
+                ATCMD_PING = 0,             // b'AT\r\n\r\nOK\r\n'
+                ATCMD_PIN_QUERY,            // b'AT+CPIN?\r\n\r\n+CPIN: READY\r\n\r\nOK\r\n'
+                ATCMD_REGISTRATION_QUERY,   // b'AT+CREG?\r\n\r\n+CREG: 0,5\r\n\r\nOK\r\n'
+                ATCMD_SET_APN,              // b'AT+CSTT="mobiledata"\r\n\r\nOK\r\n'
+                ATCMD_START_GPRS,           // b'AT+CIICR\r\n\r\nOK\r\n'
+                ATCMD_GET_IP,               // b'AT+CIFSR\r\n\r\n172.16.101.199\r\n'
+                ATCMD_STATUS,               // b'AT+CIPSTATUS\r\n\r\nOK\r\n\r\nSTATE: IP GPRSACT\r\n'
+                ATCMD_OPEN_UDP,             // b'AT+CIPSTART="UDP","0.0.0.0","9999"\r\n\r\nOK\r\n\r\nCONNECT OK\r\n'
+                ATCMD_SEND_UDP,             // b'AT+CIPSEND=62\r\n\r\n>'
+                ATCMD_SIGNAL                // b'AT+CSQ\r\n\r\n+CSQ: 14,0\r\n\r\nOK\r\n'
+                };
+            // Called on completion of an AT command with the result and first information line ("" if none).
+            typedef void (OTSIM900Link::*ATCallback_t)(OTSIM900ATResult result, const char *info);
+            struct ATQueueEntry
+                {
+                ATCommand_t command;
+                ATCallback_t callback;
+                };
+            static const constexpr uint8_t maxATQueueLength = 4;
+            // Ring buffer of AT commands, oldest (and in progress if bATInFlight) at atQueueHead.
+            ATQueueEntry atQueue[maxATQueueLength];
+            uint8_t atQueueHead;
+            uint8_t atQueued;
+            bool bATInFlight;
+            // Start time in seconds (on AVR) or polls since start (otherwise) of the command in progress.
+            uint8_t atTimer;
+            OTSIM900ATParser atParser;
+
+#ifdef ARDUINO_ARCH_AVR
+            void startATTimer() { atTimer = OTV0P2BASE::getSecondsLT(); }
+            bool isATTimedOut() { return(OTV0P2BASE::getElapsedSecondsLT(atTimer) > atTimeout); }
+            // Power key pulse must be at least ~1s to toggle SIM900 power.
+            bool waitedLongEnoughForPowerPulse()
+                { return OTV0P2BASE::getElapsedSecondsLT(powerTimer) >= 2; }
+#else
+            // Count polls when not running embedded, for repeatable tests.
+            void startATTimer() { atTimer = 0; }
+            bool isATTimedOut() { return(++atTimer > atTimeout); }
+            // Instant for testing.
+            bool waitedLongEnoughForPowerPulse() { return(true); }
+#endif
+
             /**
-             * @brief   Checks module ID.
-             * @fixme    DOES NOT CHECK
-             * @param   name:   pointer to array to compare name with.
-             * @param   length: length of array name.
-             * @retval  True if ID recovered successfully.
+             * @brief   True if any AT command is queued or in progress.
              */
-            bool isModulePresent()
-                {
-                char data[OTV0P2BASE::fnmin(32, MAX_SIM900_RESPONSE_CHARS)];
-                ser.print(AT_START);
-                ser.println(ATc_GET_MODULE);
-                //    ser.print(AT_END);
-                timedBlockingRead(data, sizeof(data));
-                OTSIM900LINK_DEBUG_SERIAL_PRINT(data)
-                OTSIM900LINK_DEBUG_SERIAL_PRINTLN()
-                return true;
-                }
+            bool isATBusy() const { return(0 != atQueued); }
+
             /**
-             * @brief   Checks connected network.
-             * @fixme   DOES NOT CHECK
-             * @param   buffer: pointer to array to store network name in.
-             * @param   length: length of buffer.
-             * @param   True if connected to network.
-             * @note
+             * @brief   Queue an AT command.
+             * @param   command:    Command to send.
+             * @param   callback:   Member function to call on completion.
+             * @retval  True if queued, false if queue full.
              */
-            bool isNetworkCorrect()
+            bool queueAT(const ATCommand_t command, const ATCallback_t callback)
                 {
-                char data[MAX_SIM900_RESPONSE_CHARS];
-                ser.print(AT_START);
-                ser.print(AT_NETWORK);
-                ser.println(ATc_QUERY);
-                //    ser.print(AT_END);
-                timedBlockingRead(data, sizeof(data));
+                if (atQueued >= maxATQueueLength)
+                    return false;    // FAIL
+                ATQueueEntry &e = atQueue[(atQueueHead + atQueued) % maxATQueueLength];
+                e.command = command;
+                e.callback = callback;
+                ++atQueued;
                 return true;
                 }
+
             /**
-             * @brief   Check if module connected and registered (GSM and GPRS).
-             * @retval  True if registered.
-             * @note    reply: b'AT+CREG?\r\n\r\n+CREG: 0,5\r\n\r\n'OK\r\n'
+             * @brief   Advance AT commands without blocking, calling back for each one completed.
+             * @note    Reads at most maxATBytesPerPoll response bytes.
              */
-            bool isRegistered()
+            void pollAT()
                 {
-                //  Check the GSM registration via AT commands ( "AT+CREG?" returns "+CREG:x,1" or "+CREG:x,5"; where "x" is 0, 1 or 2).
-                //  Check the GPRS registration via AT commands ("AT+CGATT?" returns "+CGATT:1" and "AT+CGREG?" returns "+CGREG:x,1" or "+CGREG:x,5"; where "x" is 0, 1 or 2).
-                char data[MAX_SIM900_RESPONSE_CHARS];
-                ser.print(AT_START);
-                ser.print(AT_REGISTRATION);
-                ser.println(ATc_QUERY);
-                //    ser.print(AT_END);
-                timedBlockingRead(data, sizeof(data));
-                // response stuff
-                uint8_t dataCutLength = 0;
-                const char *dataCut = getResponse(dataCutLength, data, sizeof(data), ' '); // first ' ' appears right before useful part of message
-                if(NULL == dataCut) { return(false); }
-                // Expected response '1' or '5'.
-                return((dataCut[2] == '1') || (dataCut[2] == '5'));
+                uint8_t budget = maxATBytesPerPoll;
+                while (0 != atQueued)
+                    {
+                    const ATQueueEntry e = atQueue[atQueueHead];
+                    if (!bATInFlight)
+                        {
+                        atParser.start(getATEnd(e.command));
+                        writeATCommand(e.command);
+                        bATInFlight = true;
+                        startATTimer();
+                        }
+                    while ((budget > 0) && (AT_PENDING == atParser.getResult()))
+                        {
+                        const int c = ser.read();
+                        if (c < 0)
+                            break;
+                        --budget;
+                        atParser.feed((char) c);
+                        }
+                    if (AT_PENDING == atParser.getResult())
+                        {
+                        if ((0 == budget) || !isATTimedOut())
+                            return; // Continue in a later poll.
+                        atParser.timeout();
+                        }
+                    // Remove before calling back so that the callback can queue more.
+                    atQueueHead = (atQueueHead + 1) % maxATQueueLength;
+                    --atQueued;
+                    bATInFlight = false;
+                    (this->*(e.callback))(atParser.getResult(), atParser.getInfo());
+                    if (0 == budget)
+                        return;
+                    }
                 }
 
             /**
-             * @brief   Set Access Point Name and start task.
-             * @retval  True if APN set.
-             * @note    reply: b'AT+CSTT="mobiledata"\r\n\r\nOK\r\n'
+             * @brief   What ends the response to each command.
              */
-            bool setAPN()
+            static OTSIM900ATEnd getATEnd(const ATCommand_t command)
                 {
-                char data[MAX_SIM900_RESPONSE_CHARS]; // FIXME: was 96: that's a LOT of stack!
-                ser.print(AT_START);
-                ser.print(AT_SET_APN);
-                ser.print(ATc_SET);
-                printConfig(config->APN);
-                ser.println();
-                timedBlockingRead(data, sizeof(data));
-                // response stuff
-                uint8_t dataCutLength = 0;
-                const char *dataCut = getResponse(dataCutLength, data, sizeof(data), 0x0A);
-                if(NULL == dataCut) { return(-1); }
-                //    OTSIM900LINK_DEBUG_SERIAL_PRINTLN(dataCut)
-                // Expected response 'OK'.
-                return(dataCut[2] == 'O');
+                switch (command)
+                    {
+                    case ATCMD_GET_IP:
+                    case ATCMD_STATUS:
+                    case ATCMD_OPEN_UDP:
+                        return AT_END_INFO;
+                    case ATCMD_SEND_UDP:
+                        return AT_END_PROMPT;
+                    default:
+                        return AT_END_OK;
+                    }
                 }
-            /**
-             * @brief   Start GPRS connection.
-             * @retval  True if connected.
-             * @note    check power, check registered, check gprs active.
-             * @note    reply: b'AT+CIICR\r\n\r\nOK\r\nAT+CIICR\r\n\r\nERROR\r\n' (not sure why OK then ERROR happens.)
-             */
-            bool startGPRS()
-                {
-                char data[OTV0P2BASE::fnmin(16, MAX_SIM900_RESPONSE_CHARS)];
-                ser.print(AT_START);
-                ser.println(AT_START_GPRS);
-                //    ser.print(AT_END);
-                timedBlockingRead(data, sizeof(data));
 
-                // response stuff
-                uint8_t dataCutLength = 0;
-                const char *dataCut = getResponse(dataCutLength, data, sizeof(data), 0x0A); // unreliable
-                if(NULL == dataCut) { return(-1); }
-                return ((dataCut[0] == 'O') & (dataCut[1] == 'K'));
-                }
             /**
-             * @brief   Shut GPRS connection.
-             * @retval  True if shut.
+             * @brief   Write an AT command to the SIM900.
              */
-            bool shutGPRS()
+            void writeATCommand(const ATCommand_t command)
                 {
-                char data[MAX_SIM900_RESPONSE_CHARS]; // Was 96: that's a LOT of stack!
                 ser.print(AT_START);
-                ser.println(AT_SHUT_GPRS);
-                //    ser.print(AT_END);
-                timedBlockingRead(data, sizeof(data));
-
-                // response stuff
-                uint8_t dataCutLength = 0;
-                const char *dataCut = getResponse(dataCutLength, data, sizeof(data), 0x0A);
-                if(NULL == dataCut) { return(-1); }
-                // Expected response 'SHUT OK'.
-                return (*dataCut == 'S');
+                switch (command)
+                    {
+                    case ATCMD_PING:
+                        break;
+                    case ATCMD_PIN_QUERY:
+                        ser.print(AT_PIN);
+                        ser.print(ATc_QUERY);
+                        break;
+                    case ATCMD_REGISTRATION_QUERY:
+                        //  Check the GSM registration via AT commands ( "AT+CREG?" returns "+CREG:x,1" or "+CREG:x,5"; where "x" is 0, 1 or 2).
+                        ser.print(AT_REGISTRATION);
+                        ser.print(ATc_QUERY);
+                        break;
+                    case ATCMD_SET_APN:
+                        ser.print(AT_SET_APN);
+                        ser.print(ATc_SET);
+                        printConfig(config->APN);
+                        break;
+                    case ATCMD_START_GPRS:
+                        ser.print(AT_START_GPRS);
+                        break;
+                    case ATCMD_GET_IP:
+                        ser.print(AT_GET_IP);
+                        break;
+                    case ATCMD_STATUS:
+                        ser.print(AT_STATUS);
+                        break;
+                    case ATCMD_OPEN_UDP:
+                        ser.print(AT_START_UDP);
+                        ser.print("=\"UDP\",");
+                        ser.print('\"');
+                        printConfig(config->UDP_Address);
+                        ser.print("\",\"");
+                        printConfig(config->UDP_Port);
+                        ser.print('\"');
+                        break;
+                    case ATCMD_SEND_UDP:
+                        messageCounter++; // increment counter
+                        ser.print(AT_SEND_UDP);
+                        ser.print('=');
+                        ser.print(txDatagramLen);
+                        break;
+                    case ATCMD_SIGNAL:
+                        ser.print(AT_SIGNAL);
+                        break;
+                    }
+                ser.println();
                 }
+
             /**
-             * @brief   Get IP address
-             * @todo    How should I return the string?
-             * @retval  return length of IP address. Return 0 if no connection
-             * @note    reply: b'AT+CIFSR\r\n\r\n172.16.101.199\r\n'
+             * @brief   Returns the part of an information line after its first space, eg "0,5" from "+CREG: 0,5".
+             * @retval  NULL if no space.
              */
-            uint8_t getIP()
+            static const char *afterSpace(const char *info)
                 {
-                char data[MAX_SIM900_RESPONSE_CHARS];
-                ser.print(AT_START);
-                ser.println(AT_GET_IP);
-                //  ser.print(AT_END);
-                timedBlockingRead(data, sizeof(data));
-                // response stuff
-                uint8_t dataCutLength = 0;
-                const char *dataCut = getResponse(dataCutLength, data, sizeof(data), 0x0A);
-                if(NULL == dataCut) { return(0); }
-                // All error messages will start with a '+'.
-                if (*dataCut == '+')
-                    { return(0); }
-                else
-                    { return(dataCutLength); }
+                const char *p = strchr(info, ' ');
+                return((NULL == p) ? NULL : (p + 1));
                 }
+
             /**
-             * @brief   Check if UDP open.
+             * @brief   Interprets AT+CIPSTATUS information line.
              * @retval  0 if GPRS closed.
              * @retval  1 if UDP socket open.
              * @retval  2 if in dead end state.
              * @retval  3 if GPRS is active but no UDP socket.
-             * @note    GPRS inactive:      b'AT+CIPSTATUS\r\n\r\nOK\r\n\r\nSTATE: IP START\r\n'
-             * @note    GPRS active:   b'AT+CIPSTATUS\r\n\r\nOK\r\n\r\nSTATE: IP GPRSACT\r\n'
-             * @note    UDP running:       b'AT+CIPSTATUS\r\n\r\nOK\r\nSTATE: CONNECT OK\r\n'
+             * @note    GPRS inactive:  'STATE: IP START'
+             * @note    GPRS active:    'STATE: IP GPRSACT'
+             * @note    UDP running:    'STATE: CONNECT OK'
              */
-            uint8_t checkUDPStatus()
+            static uint8_t getUDPStatus(const char *info)
                 {
-                char data[MAX_SIM900_RESPONSE_CHARS];
-                ser.print(AT_START);
-                ser.println(AT_STATUS);
-                //    ser.print(AT_END);
-                timedBlockingRead(data, sizeof(data));
-
-                // response stuff
-                uint8_t dataCutLength = 0;
-                // First ' ' appears right before useful part of message.
-                const char *dataCut = getResponse(dataCutLength, data, sizeof(data), ' ');
+                const char *dataCut = afterSpace(info);
                 if(NULL == dataCut) { return(0); }
                 if (*dataCut == 'C')
                     return 1; // expected string is 'CONNECT OK'. no other possible string begins with C
                 else if (*dataCut == 'P')
                     return 2;
-                else if (dataCut[3] == 'G')
+                else if ((strlen(dataCut) > 3) && (dataCut[3] == 'G'))
                     return 3;
                 else
                     return 0;
                 }
+
+            // AT command callbacks, by state.
+            void onGetState(const OTSIM900ATResult result, const char *)
+                {
+                if (AT_OK == result)
+                    {
+                    bAvailable = true;
+                    bPowered = true;
+                    state = START_UP;
+                    }
+                else
+                    {
+                    state = RETRY_GET_STATE;
+                    }
+                powerToggle(); // Power down for START_UP/toggle for RETRY_GET_STATE.
+                }
+            void onRetryGetState(const OTSIM900ATResult result, const char *)
+                {
+                if (AT_OK == result)
+                    {
+                    bAvailable = true;
+                    bPowered = true;
+                    state = START_UP;
+                    }
+//                else  // Removed to attempt SIM900 reset forever if not present.
+//                    state = PANIC;
+                powerToggle(); // Power down for START_UP
+                }
+            void onStartUp(const OTSIM900ATResult result, const char *)
+                {
+                if (AT_OK == result)
+                    {
+                    state = CHECK_PIN;
+                    retryCounter = 0;
+                    }
+                powerOn();
+                }
+            void onCheckPIN(const OTSIM900ATResult, const char *info)
+                {
+                // Expected string is 'READY'. no other possible string begins with R.
+                const char *dataCut = afterSpace(info);
+                if ((NULL != dataCut) && ('R' == *dataCut))
+                    {
+                    state = WAIT_FOR_REGISTRATION;
+                    retryCounter = 0;
+                    }
+                }
+            void onRegistration(const OTSIM900ATResult, const char *info)
+                {
+                // Expected response '1' or '5'.
+                const char *dataCut = afterSpace(info);
+                if ((NULL != dataCut) && (strlen(dataCut) > 2) && ((dataCut[2] == '1') || (dataCut[2] == '5')))
+                    state = SET_APN;
+                }
+            void onSetAPN(const OTSIM900ATResult result, const char *)
+                {
+                if (AT_OK == result)
+                    {
+                    messageCounter = 0;
+                    state = START_GPRS;
+                    }
+                }
+            void onStartGPRSStatus(const OTSIM900ATResult, const char *info)
+                {
+                if (getUDPStatus(info) == 3)
+                    {
+                    state = GET_IP;
+                    retryCounter = 0;
+                    }
+                else
+                    queueAT(ATCMD_START_GPRS, &OTSIM900Link::onStartGPRS);
+                }
+            void onStartGPRS(const OTSIM900ATResult, const char *)
+                {
+                // TODO: Add retries, Option to shut GPRS here (probably needs a new state)
+                }
+            void onGetIP(const OTSIM900ATResult, const char *)
+                {
+                state = OPEN_UDP;
+                }
+            void onOpenUDP(const OTSIM900ATResult result, const char *)
+                {
+                // Returns ERROR on fail, else successfully opened UDP.
+                if (AT_OK == result)
+                    {
+                    state = IDLE;
+                    retryCounter = 0;
+                    }
+                }
+            void onWaitForUDP(const OTSIM900ATResult, const char *info)
+                {
+                const uint8_t udpState = getUDPStatus(info);
+                if (++retryCounter > maxRetries)
+                    state = RESET;
+                if (udpState == 1)
+                    {
+                    state = SENDING;
+                    retryCounter = 0;
+                    }
+//                else if (udpState == 0) state = GET_STATE; // START_GPRS; // TODO needed for optional wake GPRS to send. FIXME normally commented, set to get_state for testing reset.
+                else if (udpState == 2)
+                    state = RESET;
+                }
+            void onSignal(const OTSIM900ATResult result, const char *info)
+                {
+                // Expected response '+CSQ: <rssi>,<ber>'.
+                const char *dataCut = afterSpace(info);
+                if ((AT_OK != result) || (NULL == dataCut))
+                    return;
+                uint8_t rssi = 0;
+                while ((*dataCut >= '0') && (*dataCut <= '9') && (rssi < 100))
+                    rssi = (rssi * 10) + (*dataCut++ - '0');
+                signalQuality = rssi;
+                }
+            void onReset(const OTSIM900ATResult result, const char *)
+                {
+                if (AT_OK != result)
+                    {
+                    bAvailable = true;
+                    bPowered = true;
+                    }
+                else
+                    {
+                    bPowered = false;
+                    }
+                state = START_UP;
+                powerOff(); // Power down for START_UP.
+                }
+            void onSendPrompt(const OTSIM900ATResult result, const char *)
+                {
+                if (AT_OK == result)
+                    {  // '>' indicates module is ready for UDP frame
+                    writeDatagram();
+                    OTSIM900LINK_DEBUG_SERIAL_PRINTLN_FLASHSTRING("*success")
+                    }
+                else
+                    {
+                    OTSIM900LINK_DEBUG_SERIAL_PRINTLN_FLASHSTRING("*fail")
+                    }
+                // Frames are removed from the queue whether or not the send succeeds.
+                while (txDatagramFrames > 0)
+                    {
+                    popTXQueue();
+                    --txDatagramFrames;
+                    }
+                if (0 == txMessageQueue)
+                    state = IDLE; // Once queue is empty return to IDLE.
+                else if (AT_OK != result)
+                    state = WAIT_FOR_UDP; // Recheck the connection rather than keep failing while the queue stays full.
+                }
+
             /**
-             * @brief   Get signal strength.
-             * @todo    Return /print something?
+             * @brief   Close UDP connection.
+             * @todo    Implement checks.
+             * @retval  True if UDP closed.
+             * @note    Check UDP open?
              */
-            uint8_t getSignalStrength()
+            bool UDPClose()
                 {
-                char data[OTV0P2BASE::fnmin(32, MAX_SIM900_RESPONSE_CHARS)];
                 ser.print(AT_START);
-                ser.println(AT_SIGNAL);
+                ser.println(AT_CLOSE_UDP);
                 //    ser.print(AT_END);
-                timedBlockingRead(data, sizeof(data));
-                OTSIM900LINK_DEBUG_SERIAL_PRINTLN(data)
-                // response stuff
-                uint8_t dataCutLength = 0;
-                getResponse(dataCutLength, data, sizeof(data), ' '); // first ' ' appears right before useful part of message
-                return 0;
+                return true;
                 }
 
             /**
-             * @brief   Set verbose errors
-             * @param   level: 0 is no error codes, 1 is with codes, 2 is human readable descriptions.
+             * @brief   Choose the frames to send in the next UDP datagram, setting txDatagramFrames and txDatagramLen.
+             * @note    Unless coalescing this is the oldest queued frame,
+             *          else as many queued frames as fit, oldest first, each preceded by its length.
              */
-            void verbose(uint8_t level)
+            void prepareDatagram()
                 {
-                char data[MAX_SIM900_RESPONSE_CHARS];
-                ser.print(AT_START);
-                ser.print(AT_VERBOSE_ERRORS);
-                ser.print(ATc_SET);
-                ser.println((char) (level + '0'));
-                //    ser.print(AT_END);
-                timedBlockingRead(data, sizeof(data));
-            OTSIM900LINK_DEBUG_SERIAL_PRINTLN(data)
-            }
-        /**
-         * @brief   Enter PIN code
-         * @todo    Check return value?
-         * @retval  True if pin set successfully.
-         */
-        bool setPIN()
-            {
-            if (NULL == config->PIN)
+                if (!coalesceTX)
+                    {
+                    txDatagramFrames = 1;
+                    txDatagramLen = txMsgLen[txQueueHead];
+                    return;
+                    }
+                uint8_t n = 0;
+                uint16_t length = 0;
+                while (n < txMessageQueue)
+                    {
+                    const uint16_t l = length + 1 + txMsgLen[(txQueueHead + n) % maxTxQueueLength];
+                    if (l > maxCoalescedLen)
+                        break;
+                    length = l;
+                    ++n;
+                    }
+                txDatagramFrames = n;
+                txDatagramLen = (uint8_t) length;
+                }
+            /**
+             * @brief   Write the body of the datagram chosen by prepareDatagram(), straight from the queue.
+             */
+            void writeDatagram()
                 {
-                return 0;
-                } // do not attempt to set PIN if NULL pointer.
-            char data[MAX_SIM900_RESPONSE_CHARS];
-            ser.print(AT_START);
-            ser.print(AT_PIN);
-            ser.print(ATc_SET);
-            printConfig(config->PIN);
-            ser.println();
-//        timedBlockingRead(data, sizeof(data));  // todo redundant until function properly implemented.
-            OTSIM900LINK_DEBUG_SERIAL_PRINTLN(data)
-            return true;
-            }
-        /**
-         * @brief   Check if PIN required
-         * @retval  True if SIM card unlocked.
-         * @note    reply: b'AT+CPIN?\r\n\r\n+CPIN: READY\r\n\r\nOK\r\n'
-         */
-        bool isPINRequired()
-            {
-            char data[OTV0P2BASE::fnmin(40, MAX_SIM900_RESPONSE_CHARS)];
-            ser.print(AT_START);
-            ser.print(AT_PIN);
-            ser.println(ATc_QUERY);
-            //    ser.print(AT_END);
-            timedBlockingRead(data, sizeof(data));
-
-            // response stuff
-            uint8_t dataCutLength = 0;
-            // First ' ' appears right before useful part of message
-            const char *dataCut = getResponse(dataCutLength, data, sizeof(data), ' ');
-            if(NULL == dataCut) { return(false); }
-            // Expected string is 'READY'. no other possible string begins with R.
-            return('R' == *dataCut);
-            }
-
-        /**
-         * @brief   Blocks process until terminatingChar received.
-         * @param   terminatingChar:    Character to block until.
-         * @todo    Make sure this doesn't block longer than 250 ms.
-         * @retval  True if character found, or false on 1000ms timeout
-         */
-        bool flushUntil(uint8_t _terminatingChar)
-            {
-            const uint8_t terminatingChar = _terminatingChar;
-            const uint8_t endTime = OTV0P2BASE::getSecondsLT() + flushTimeOut;
-            while (OTV0P2BASE::getSecondsLT() <= endTime)
-                { // FIXME Replace this logic
-                const uint8_t c = ser.read();
-                if (c == terminatingChar)
+                for (uint8_t i = 0; i < txDatagramFrames; ++i)
+                    {
+                    const uint8_t slot = (txQueueHead + i) % maxTxQueueLength;
+                    if (coalesceTX)
+                        ser.write(txMsgLen[slot]);
+                    (static_cast<Print *>(&ser))->write((const char *) txQueue[slot], txMsgLen[slot]); /// @note can't use strlen with encrypted/binary packets
+                    }
+                }
+            /**
+             * @brief   Drop the oldest queued message, if any.
+             */
+            void popTXQueue()
+                {
+                if (0 == txMessageQueue)
+                    return;
+                txQueueHead = (txQueueHead + 1) % maxTxQueueLength;
+                --txMessageQueue;
+                }
+
+            /**
+             * @brief     Assigns OTSIM900LinkConfig config. Must be called before begin()
+             * @retval    returns true if assigned or false if config is NULL
+             */
+            virtual bool _doconfig() override
+                {
+                if (channelConfig->config == NULL)
+                    return false;
+                else
+                    {
+                    config = (const OTSIM900LinkConfig_t *) channelConfig->config;
                     return true;
+                    }
                 }
-#if 0
-            OTSIM900LINK_DEBUG_SERIAL_PRINTLN_FLASHSTRING(" Timeout")
-            OTSIM900LINK_DEBUG_SERIAL_PRINTLN(OTV0P2BASE::getSecondsLT())
-#endif
-            return false;
-            }
-
-        /**
-         * @brief   Returns a pointer to section of response containing important data
-         *          and sets its length to a variable
-         * @param   newLength:  length of useful data.
-         * @param   data:       pointer to array containing response from device.
-         * @param   dataLength: length of array.
-         * @param   startChar:  Ignores everything up to and including this character.
-         * @retval  pointer to start of useful data; NULL if not found
-         *
-         * MUST CHECK RESPONSE AGAINST NULL FIRST
-         */
-        const char *getResponse(uint8_t &newLength, const char *data,
-                uint8_t dataLength, char _startChar)
-            {
-            char startChar = _startChar;
-            const char *newPtr = NULL;
-            uint8_t i = 0;    // 'AT' + command + 0x0D
-            uint8_t i0 = 0; // start index
-            newLength = 0;
-            // Ignore echo of command
-            while (*data != startChar)
+
+            volatile OTSIM900LinkState state = GET_STATE; // TODO check this is in correct place
+            static const constexpr uint8_t maxTxMsgLen = 64; // From OTRadioLink.
+            static const constexpr uint8_t maxTxQueueLength = txQueueSlots; // TODO Could this be moved out into OTRadioLink
+            // Maximum coalesced datagram length, to fit AT+CIPSEND length in one byte; well within SIM900 limit.
+            static const constexpr uint8_t maxCoalescedLen = 255;
+            // Ring buffer of frames queued for TX, oldest at txQueueHead, txMessageQueue in use.
+            uint8_t txQueue[txQueueSlots][maxTxMsgLen];
+            uint8_t txMsgLen[txQueueSlots]; // Length of each queued frame.
+            uint8_t txQueueHead;
+            // Frames from the head of the queue in the datagram being sent, else 0, and its length.
+            uint8_t txDatagramFrames;
+            uint8_t txDatagramLen;
+
+        public:
+            // define abstract methods here
+            // These are unused as no RX
+            virtual void _dolisten() override
                 {
-                data++;
-                i++;
-                if (i >= dataLength)
-                    return NULL;
                 }
-            data++;
-            i++;
-            // Set pointer to start of and index
-            newPtr = data;
-            i0 = i;
-            // Find end of response
-            while (*data != 0x0D)
-                {    // find end of response
-                data++;
-                i++;
-                if (i >= dataLength)
-                    return NULL;
+            /**
+             * @todo    function to get maxTXMsgLen?
+             */
+            virtual void getCapacity(uint8_t &queueRXMsgsMin, uint8_t &maxRXMsgLen,
+                    uint8_t &maxTXMsgLen) const override
+                {
+                queueRXMsgsMin = 0;
+                maxRXMsgLen = 0;
+                maxTXMsgLen = maxTxMsgLen;
                 }
-            newLength = i - i0;
-#if 0 && defined(OTSIM900LINK_DEBUG)
-            char *stringEnd = (char *)data;
-            *stringEnd = '\0';
-            OTV0P2BASE::serialPrintAndFlush(newPtr);
-            OTV0P2BASE::serialPrintlnAndFlush();
-#endif // OTSIM900LINK_DEBUG
-            return newPtr;    // return length of new array
-            }
-
-        /**
-         * @brief   Open UDP socket.
-         * @todo    Find better way of printing this (maybe combine as in APN).
-         * @param   array containing server IP
-         * @retval  True if UDP opened
-         * @note    reply: b'AT+CIPSTART="UDP","0.0.0.0","9999"\r\n\r\nOK\r\n\r\nCONNECT OK\r\n'
-         */
-        bool openUDPSocket()
-            {
-            char data[MAX_SIM900_RESPONSE_CHARS];
-            memset(data, 0, sizeof(data));
-            ser.print(AT_START);
-            ser.print(AT_START_UDP);
-            ser.print("=\"UDP\",");
-            ser.print('\"');
-            printConfig(config->UDP_Address);
-            ser.print("\",\"");
-            printConfig(config->UDP_Port);
-            ser.println('\"');
-            //    ser.print(AT_END);
-            // Implement check here
-            timedBlockingRead(data, sizeof(data));
-
-            // response stuff
-            uint8_t dataCutLength = 0;
-            const char *dataCut = getResponse(dataCutLength, data, sizeof(data), 0x0A);
-            if(NULL == dataCut) { return(false); }
-            OTSIM900LINK_DEBUG_SERIAL_PRINTLN(dataCut)
-            // Returns ERROR on fail, else successfully opened UDP.
-            return ~('E' == *dataCut);
-            }
-        /**
-         * @brief   Close UDP connection.
-         * @todo    Implement checks.
-         * @retval  True if UDP closed.
-         * @note    Check UDP open?
-         */
-        bool UDPClose()
-            {
-            ser.print(AT_START);
-            ser.println(AT_CLOSE_UDP);
-            //    ser.print(AT_END);
-            return true;
-            }
-        /**
-         * @brief   Send a UDP frame.
-         * @todo    Split this into init sending and write message? Need to check how long it blocks.
-         * @param   frame:  Pointer to array containing frame to send.
-         * @param   length: Length of frame.
-         * @retval  True if send successful.
-         * @note    On Success: b'AT+CIPSEND=62\r\n\r\n>' echos back input b'\r\nSEND OK\r\n'
-         */
-        bool UDPSend(const char *frame, uint8_t length)
-            {
-            messageCounter++; // increment counter
-            ser.print(AT_START);
-            ser.print(AT_SEND_UDP);
-            ser.print('=');
-            ser.println(length);
-            //    ser.print(AT_END);
-            if (flushUntil('>'))
-                {  // '>' indicates module is ready for UDP frame
-                (static_cast<Print *>(&ser))->write(frame, length);
-                OTSIM900LINK_DEBUG_SERIAL_PRINTLN_FLASHSTRING("*success")
-                return true;
+            ;
+            virtual uint8_t getRXMsgsQueued() const override
+                {
+                return 0;
                 }
-            else
+            virtual const volatile uint8_t *peekRXMsg() const override
                 {
-                OTSIM900LINK_DEBUG_SERIAL_PRINTLN_FLASHSTRING("*fail")
-                return false;
+                return 0;
                 }
-            }
-
-        /**
-         * @brief   Checks module for response.
-         * @retval  True if correct response.
-         * @note     reply: b'AT\r\n\r\nOK\r\n'
-         */
-        bool isSIM900Replying()
-            {
-            ser.println(AT_START);
-            //    ser.print(AT_END);
-            //    uint8_t c = 0;
-            // Debug code...
-            //    uint8_t startTime = OTV0P2BASE::getSecondsLT();
-            //    c = ser.read();
-            //    uint8_t endTime = OTV0P2BASE::getSecondsLT();
-            //    OTSIM900LINK_DEBUG_SERIAL_PRINT("T: ")
-            //    OTSIM900LINK_DEBUG_SERIAL_PRINT(startTime)
-            //  OTSIM900LINK_DEBUG_SERIAL_PRINT("\t")
-            //    OTSIM900LINK_DEBUG_SERIAL_PRINT(endTime)
-            //  OTSIM900LINK_DEBUG_SERIAL_PRINT("\t")
-            //    OTSIM900LINK_DEBUG_SERIAL_PRINTFMT(c, HEX)
-            //    OTSIM900LINK_DEBUG_SERIAL_PRINTLN()
-            //    if (c == 'A') {
-            return (ser.read() == 'A');
-            }
-
-        /**
-         * @brief     Assigns OTSIM900LinkConfig config. Must be called before begin()
-         * @retval    returns true if assigned or false if config is NULL
-         */
-        virtual bool _doconfig() override
-            {
-            if (channelConfig->config == NULL)
-                return false;
-            else
+            virtual void removeRXMsg() override
                 {
-                config = (const OTSIM900LinkConfig_t *) channelConfig->config;
-                return true;
                 }
-            }
-
-        volatile OTSIM900LinkState state = GET_STATE; // TODO check this is in correct place
-        uint8_t txQueue[64]; // 64 is maxTxMsgLen (from OTRadioLink)
-        uint8_t txMsgLen; // This stores the length of the tx message. will have to be redone for multiple txQueue
-        static const uint8_t maxTxQueueLength = 1; // TODO Could this be moved out into OTRadioLink
-
-    public:
-        // define abstract methods here
-        // These are unused as no RX
-        virtual void _dolisten() override
-            {
-            }
-        /**
-         * @todo    function to get maxTXMsgLen?
-         */
-        virtual void getCapacity(uint8_t &queueRXMsgsMin, uint8_t &maxRXMsgLen,
-                uint8_t &maxTXMsgLen) const override
-            {
-            queueRXMsgsMin = 0;
-            maxRXMsgLen = 0;
-            maxTXMsgLen = 64;
-            }
-        ;
-        virtual uint8_t getRXMsgsQueued() const override
-            {
-            return 0;
-            }
-        virtual const volatile uint8_t *peekRXMsg() const override
-            {
-            return 0;
-            }
-        virtual void removeRXMsg() override
-            {
-            }
-
-        /* other methods (copied from OTRadioLink as is)
-         virtual void preinit(const void *preconfig) {}    // not really relevant?
-         virtual void panicShutdown() { preinit(NULL); }    // see above
-         */
-
-        // Provided to assist with "white-box" unit testing.
-        OTSIM900LinkState _getState() { return(state); }
-    };
+
+            /* other methods (copied from OTRadioLink as is)
+             virtual void preinit(const void *preconfig) {}    // not really relevant?
+             virtual void panicShutdown() { preinit(NULL); }    // see above
+             */
+
+            // Provided to assist with "white-box" unit testing.
+            OTSIM900LinkState _getState() { return(state); }
+        };
 
 }    // namespace OTSIM900Link
 
@@ -24,6 +24,41 @@ namespace OTV0P2BASE
     {
 
 
+#ifndef OTV0P2BASE_CRC7_5B_BITWISE
+    // Table-driven implementation.
+    //
+    // The tables work on the CRC left-aligned in an 8-bit register (ie crc << 1),
+    // for which the polynomial is 0x37 << 1 = 0x6e,
+    // so that the next data byte can be XORed straight in before each lookup.
+    // Table s maps a register value to its value after being fed through s+1 bytes,
+    // the first XORed with the register and the rest zero, allowing slice-by-8 operation.
+    // The tables are generated at compile time from the same bitwise definition.
+
+    // Left-aligned register r after shifting n more bits through it.
+    static constexpr uint8_t crc7_5B_leftAlignedShift(const uint8_t r, const uint8_t n)
+        { return((0 == n) ? r : crc7_5B_leftAlignedShift((uint8_t)((0 != (r & 0x80)) ? ((r << 1) ^ 0x6e) : (r << 1)), n - 1)); }
+    // Entry x of table s.
+    static constexpr uint8_t crc7_5B_tableEntry(const uint8_t s, const uint8_t x)
+        { return(crc7_5B_leftAlignedShift((0 == s) ? x : crc7_5B_tableEntry(s - 1, x), 8)); }
+
+#define OTV0P2BASE_CRC7_5B_T4(s, x) crc7_5B_tableEntry(s, (x)), crc7_5B_tableEntry(s, (x)+1), crc7_5B_tableEntry(s, (x)+2), crc7_5B_tableEntry(s, (x)+3)
+#define OTV0P2BASE_CRC7_5B_T16(s, x) OTV0P2BASE_CRC7_5B_T4(s, (x)), OTV0P2BASE_CRC7_5B_T4(s, (x)+4), OTV0P2BASE_CRC7_5B_T4(s, (x)+8), OTV0P2BASE_CRC7_5B_T4(s, (x)+12)
+#define OTV0P2BASE_CRC7_5B_T64(s, x) OTV0P2BASE_CRC7_5B_T16(s, (x)), OTV0P2BASE_CRC7_5B_T16(s, (x)+16), OTV0P2BASE_CRC7_5B_T16(s, (x)+32), OTV0P2BASE_CRC7_5B_T16(s, (x)+48)
+#define OTV0P2BASE_CRC7_5B_T256(s) { OTV0P2BASE_CRC7_5B_T64(s, 0), OTV0P2BASE_CRC7_5B_T64(s, 64), OTV0P2BASE_CRC7_5B_T64(s, 128), OTV0P2BASE_CRC7_5B_T64(s, 192) }
+    static constexpr uint8_t crc7_5B_table[8][256] =
+        {
+        OTV0P2BASE_CRC7_5B_T256(0), OTV0P2BASE_CRC7_5B_T256(1), OTV0P2BASE_CRC7_5B_T256(2), OTV0P2BASE_CRC7_5B_T256(3),
+        OTV0P2BASE_CRC7_5B_T256(4), OTV0P2BASE_CRC7_5B_T256(5), OTV0P2BASE_CRC7_5B_T256(6), OTV0P2BASE_CRC7_5B_T256(7),
+        };
+#undef OTV0P2BASE_CRC7_5B_T256
+#undef OTV0P2BASE_CRC7_5B_T64
+#undef OTV0P2BASE_CRC7_5B_T16
+#undef OTV0P2BASE_CRC7_5B_T4
+    // Spot-check the generated table: a single trailing 1 bit yields the polynomial.
+    static_assert((0x37 << 1) == crc7_5B_table[0][0x01], "bad CRC table");
+    static_assert(0 == crc7_5B_table[7][0], "bad CRC table");
+#endif // OTV0P2BASE_CRC7_5B_BITWISE
+
     /**Update 7-bit CRC with next byte; result always has top bit zero.
      * Polynomial 0x5B (1011011, Koopman) = (x+1)(x^6 + x^5 + x^3 + x^2 + 1) = 0x37 (0110111, Normal)
      * <p>
@@ -37,10 +72,20 @@ namespace OTV0P2BASE
      * <p>
      * For 2 or 3 byte payloads this should have a Hamming distance of 4 and be within a factor of 2 of optimal error detection.
      * <p>
-     * TODO: provide table-driven optimised alternative,
-     *     eg see http://www.tty1.net/pycrc/index_en.html
+     * Table-driven unless OTV0P2BASE_CRC7_5B_BITWISE is defined (as on AVR),
+     * eg see http://www.tty1.net/pycrc/index_en.html
      */
-    uint8_t crc7_5B_update(uint8_t crc, const uint8_t datum)
+    uint8_t crc7_5B_update(const uint8_t crc, const uint8_t datum)
+        {
+#ifdef OTV0P2BASE_CRC7_5B_BITWISE
+        return(crc7_5B_update_bitwise(crc, datum));
+#else
+        return(crc7_5B_table[0][(uint8_t)(crc << 1) ^ datum] >> 1);
+#endif
+        }
+
+    // Reference bit-at-a-time implementation of crc7_5B_update(), always available; same results.
+    uint8_t crc7_5B_update_bitwise(uint8_t crc, const uint8_t datum)
         {
         for(uint8_t i = 0x80; i != 0; i >>= 1)
             {
@@ -52,6 +97,30 @@ namespace OTV0P2BASE
         return(crc & 0x7f);
         }
 
+    /**Update 7-bit CRC with len bytes from buf; result always has top bit zero.
+     * Same result as calling crc7_5B_update() on each byte in turn.
+     * Uses slice-by-8 for the bulk of the data unless OTV0P2BASE_CRC7_5B_BITWISE is defined.
+     */
+    uint8_t crc7_5B_update_buf(uint8_t crc, const uint8_t *buf, size_t len)
+        {
+#ifdef OTV0P2BASE_CRC7_5B_BITWISE
+        while(len-- > 0) { crc = crc7_5B_update_bitwise(crc, *buf++); }
+        return(crc & 0x7f);
+#else
+        uint8_t r = (uint8_t)(crc << 1);
+        // As the register is only 8 bits, only the first byte of each 8 interacts with it.
+        for( ; len >= 8; len -= 8, buf += 8)
+            {
+            r = crc7_5B_table[7][r ^ buf[0]] ^ crc7_5B_table[6][buf[1]] ^
+                crc7_5B_table[5][buf[2]] ^ crc7_5B_table[4][buf[3]] ^
+                crc7_5B_table[3][buf[4]] ^ crc7_5B_table[2][buf[5]] ^
+                crc7_5B_table[1][buf[6]] ^ crc7_5B_table[0][buf[7]];
+            }
+        while(len-- > 0) { r = crc7_5B_table[0][r ^ *buf++]; }
+        return(r >> 1);
+#endif
+        }
+
     /**As crc7_5B_update() but if the output would be 0, this returns 0x80 instead.
      * This allows use where 0x00 (and 0xff) is not allowed or preferred,
      * but without weakening the CRC protection (eg all result values are distinct).
@@ -24,6 +24,16 @@ Author(s) / Copyright (s): Damon Hart-Davis 2015--2016
 #define ARDUINO_LIB_OTV0P2BASE_CRC_H
 
 #include <stdint.h>
+#include <stddef.h>
+
+// CRC7/0x5B implementation selection.
+// By default hosted builds use a 256-entry lookup table generated at compile time
+// for crc7_5B_update(), and slice-by-8 (2kB of tables in total) for crc7_5B_update_buf(),
+// while AVR builds keep the bit-at-a-time loop to save Flash and RAM.
+// Define OTV0P2BASE_CRC7_5B_BITWISE to force the bit-at-a-time version everywhere.
+#if defined(ARDUINO_ARCH_AVR) && !defined(OTV0P2BASE_CRC7_5B_BITWISE)
+#define OTV0P2BASE_CRC7_5B_BITWISE
+#endif
 
 // Use namespaces to help avoid collisions.
 namespace OTV0P2BASE
@@ -46,6 +56,16 @@ namespace OTV0P2BASE
      */
     extern uint8_t crc7_5B_update(uint8_t crc, uint8_t datum);
 
+    // Reference bit-at-a-time implementation of crc7_5B_update(), always available; same results.
+    extern uint8_t crc7_5B_update_bitwise(uint8_t crc, uint8_t datum);
+
+    /**Update 7-bit CRC with len bytes from buf; result always has top bit zero.
+     * Same result as calling crc7_5B_update() on each byte in turn,
+     * but faster for longer buffers on hosted builds.
+     *   * buf  data to add to CRC; may be NULL iff len is 0
+     */
+    extern uint8_t crc7_5B_update_buf(uint8_t crc, const uint8_t *buf, size_t len);
+
     // Value to use in place of 0 for final CRC value, eg for crc7_5B_update_nz_final();
     static const uint8_t crc7_5B_update_nz_ALT = 0x80;
 
@@ -29,6 +29,7 @@ Author(s) / Copyright (s): Damon Hart-Davis 2013--2016
 #define OTV0P2BASE_EEPROM_H
 
 #include <stdint.h>
+#include <string.h>
 
 #ifdef ARDUINO_ARCH_AVR
 #include <avr/eeprom.h>
@@ -146,6 +147,258 @@ class NULLByHourByteStatsBase final : public NVByHourByteStatsBase
 #define V0P2BASE_EE_STATS_SETS 14 // Number of stats sets in range [0,V0P2BASE_EE_STATS_SETS-1].
 
 
+// Implementation over stats sets held contiguously in memory (eg RAM or a mapped file),
+// V0P2BASE_EE_STATS_SETS sets of 24 bytes in the same layout as in EEPROM.
+// Answers queries by scanning the samples exactly as EEPROMByHourByteStats does.
+// Behaves as if all values are unset if the storage is NULL.
+// The current hour is set explicitly rather than taken from the RTC.
+class NVByHourByteStatsScanningBase : public NVByHourByteStatsBase
+  {
+  private:
+    // Storage for all sets; may be NULL.
+    const uint8_t *const stats;
+    // Hour taken as current [0,23].
+    uint8_t currentHour = 0;
+
+    // Resolve current/next hour as EEPROMByHourByteStats does.
+    uint8_t hh(const uint8_t hour) const
+      { return((STATS_SPECIAL_HOUR_CURRENT_HOUR == hour) ? currentHour : ((hour > 23) ? ((currentHour >= 23) ? 0 : (currentHour + 1)) : hour)); }
+    // Start of a set, or NULL if the set number is invalid or there is no storage.
+    const uint8_t *set(const uint8_t statsSet) const
+      { return(((NULL == stats) || (statsSet >= V0P2BASE_EE_STATS_SETS)) ? NULL : (stats + (statsSet * 24))); }
+
+  protected:
+    explicit NVByHourByteStatsScanningBase(const uint8_t *const _stats) : stats(_stats) { }
+
+  public:
+    // Set the hour to be taken as current [0,23].
+    void setHour(const uint8_t hour) { currentHour = hour % 24; }
+
+    virtual uint8_t getByHourStat(const uint8_t statsSet, const uint8_t hour = 0xff) const override
+      {
+      const uint8_t *const s = set(statsSet);
+      if(NULL == s) { return(UNSET_BYTE); } // Invalid set.
+      return(s[hh(hour)]);
+      }
+    virtual uint8_t getMinByHourStat(const uint8_t statsSet) const override
+      {
+      const uint8_t *const s = set(statsSet);
+      if(NULL == s) { return(UNSET_BYTE); } // Invalid set.
+      uint8_t result = UNSET_BYTE;
+      for(int8_t h = 24; --h >= 0; ) { const uint8_t v = s[h]; if(v < result) { result = v; } }
+      return(result);
+      }
+    virtual uint8_t getMaxByHourStat(const uint8_t statsSet) const override
+      {
+      const uint8_t *const s = set(statsSet);
+      if(NULL == s) { return(UNSET_BYTE); } // Invalid set.
+      uint8_t result = UNSET_BYTE;
+      for(int8_t h = 24; --h >= 0; )
+        {
+        const uint8_t v = s[h];
+        if((UNSET_BYTE != v) && ((UNSET_BYTE == result) || (v > result))) { result = v; }
+        }
+      return(result);
+      }
+    virtual bool inOutlierQuartile(const bool inTop, const uint8_t statsSet, const uint8_t hour = STATS_SPECIAL_HOUR_CURRENT_HOUR) const override
+      {
+      const uint8_t sample = getByHourStat(statsSet, hour);
+      if(UNSET_BYTE == sample) { return(false); }
+      const uint8_t *const s = set(statsSet);
+      uint8_t n = 0;
+      for(uint8_t h = 0; h < 24; ++h)
+        {
+        const uint8_t v = s[h];
+        if(UNSET_BYTE == v) { return(false); } // Abort if not a full set of stats.
+        if(inTop ? (v < sample) : (v > sample)) { if(++n >= 18) { return(true); } } // Stop as soon as known to be in quartile.
+        }
+      return(false);
+      }
+    virtual int8_t countStatSamplesBelow(const uint8_t statsSet, const uint8_t value) const override
+      {
+      const uint8_t *const s = set(statsSet);
+      if(NULL == s) { return(-1); } // Invalid set.
+      int8_t result = 0;
+      for(int8_t h = 24; --h >= 0; ) { if(s[h] < value) { ++result; } }
+      return(result);
+      }
+  };
+
+// Simple RAM-backed implementation primarily to support mocking and unit tests.
+// Holds V0P2BASE_EE_STATS_SETS sets, initially all unset.
+class NVByHourByteStatsMock : public NVByHourByteStatsScanningBase
+  {
+  private:
+    uint8_t store[V0P2BASE_EE_STATS_SETS * 24];
+
+  public:
+    NVByHourByteStatsMock() : NVByHourByteStatsScanningBase(store) { zapStats(); }
+
+    // Set the value for a stats set and hour [0,23]; ignored if either is out of range.
+    void setByHourStat(const uint8_t statsSet, const uint8_t hour, const uint8_t value)
+      { if((statsSet < V0P2BASE_EE_STATS_SETS) && (hour <= 23)) { store[(statsSet * 24) + hour] = value; } }
+
+    virtual bool zapStats(uint16_t = 0) override { memset(store, UNSET_BYTE, sizeof(store)); return(true); }
+  };
+
+// Caching decorator for another (eg EEPROM-backed) stats implementation.
+// Holds the first cachedSets stats sets in RAM, each with its values sorted,
+// so that min/max, rank (countStatSamplesBelow()) and quartile queries need no scan of the underlying store;
+// others (and invalid sets) are passed straight through.
+// Each set is read in from the underlying store when first queried,
+// and must then be kept up to date by calling noteByHourStatWritten() for each value written,
+// which updates the sorted values incrementally.
+// Gives exactly the same answers as the underlying store when kept up to date.
+// Takes about 50 bytes of RAM per cached set, so on AVR cache only the sets needed,
+// eg up to and including V0P2BASE_EE_STATS_SET_OCCPC_BY_HOUR_SMOOTHED for ModelledRadValveComputeTargetTempBasic.
+// Not thread-/ISR- safe.
+#define NVByHourByteStatsCache_DEFINED
+template<uint8_t cachedSets = V0P2BASE_EE_STATS_SETS>
+class NVByHourByteStatsCache final : public NVByHourByteStatsBase
+  {
+  static_assert(cachedSets <= V0P2BASE_EE_STATS_SETS, "cannot cache more sets than exist");
+
+  private:
+    // Underlying store.
+    NVByHourByteStatsBase &backing;
+
+    // In-RAM copy of one stats set.
+    struct cachedSet
+      {
+      // True once loaded from the underlying store.
+      bool loaded;
+      // Maximum set value, or UNSET_BYTE if none.
+      uint8_t max;
+      // First hour with an unset value, or 24 if none.
+      uint8_t firstUnset;
+      // Values by hour.
+      uint8_t byHour[24];
+      // Values in ascending order, so unset values last.
+      // The lower and upper quartile boundaries (for a full set) are sorted[6] and sorted[17].
+      uint8_t sorted[24];
+      };
+    mutable cachedSet cache[cachedSets];
+
+    // Recompute max and firstUnset after a change.
+    static void updateSummary(cachedSet &c)
+      {
+      int8_t i = 23;
+      while((i >= 0) && (UNSET_BYTE == c.sorted[i])) { --i; }
+      c.max = (i < 0) ? UNSET_BYTE : c.sorted[i];
+      uint8_t h = 0;
+      while((h < 24) && (UNSET_BYTE != c.byHour[h])) { ++h; }
+      c.firstUnset = h;
+      }
+
+    // Get the given cached stats set [0,cachedSets-1], loading it if need be.
+    const cachedSet &get(const uint8_t statsSet) const
+      {
+      cachedSet &c = cache[statsSet];
+      if(!c.loaded)
+        {
+        // Read and insertion sort.
+        for(uint8_t h = 0; h < 24; ++h)
+          {
+          const uint8_t v = backing.getByHourStat(statsSet, h);
+          c.byHour[h] = v;
+          int8_t i = h;
+          while((i > 0) && (c.sorted[i-1] > v)) { c.sorted[i] = c.sorted[i-1]; --i; }
+          c.sorted[i] = v;
+          }
+        updateSummary(c);
+        c.loaded = true;
+        }
+      return(c);
+      }
+
+    // Number of values in a cached set less than value.
+    static int8_t rank(const cachedSet &c, const uint8_t value)
+      {
+      int8_t lo = 0, hi = 24;
+      while(lo < hi) { const int8_t mid = (lo + hi) >> 1; if(c.sorted[mid] < value) { lo = mid + 1; } else { hi = mid; } }
+      return(lo);
+      }
+
+  public:
+    explicit NVByHourByteStatsCache(NVByHourByteStatsBase &underlying) : backing(underlying) { invalidate(); }
+
+    // Discard all cached values, to be reloaded as needed.
+    // Use if the underlying store may have been altered other than as notified via noteByHourStatWritten().
+    void invalidate() { for(uint8_t i = 0; i < cachedSets; ++i) { cache[i].loaded = false; } }
+
+    // Update the cache after value has been written to the underlying store for the given set and hour [0,23].
+    // Costs at most a few short passes over the set, and nothing if the set is not (yet) cached.
+    void noteByHourStatWritten(const uint8_t statsSet, const uint8_t hour, const uint8_t value)
+      {
+      if((statsSet >= cachedSets) || (hour > 23)) { return; }
+      cachedSet &c = cache[statsSet];
+      if(!c.loaded) { return; }
+      const uint8_t old = c.byHour[hour];
+      if(old == value) { return; }
+      c.byHour[hour] = value;
+      // Move the old value's entry to the new value's place in order.
+      int8_t i = rank(c, old);
+      if(value > old) { while((i < 23) && (c.sorted[i+1] < value)) { c.sorted[i] = c.sorted[i+1]; ++i; } }
+      else { while((i > 0) && (c.sorted[i-1] > value)) { c.sorted[i] = c.sorted[i-1]; --i; } }
+      c.sorted[i] = value;
+      updateSummary(c);
+      }
+
+    // Clear the underlying store and discard all cached values.
+    virtual bool zapStats(const uint16_t maxBytesToErase = 0) override
+      {
+      const bool result = backing.zapStats(maxBytesToErase);
+      invalidate();
+      return(result);
+      }
+
+    // Current and next hour are resolved by the underlying store.
+    virtual uint8_t getByHourStat(const uint8_t statsSet, const uint8_t hour = 0xff) const override
+      {
+      if((statsSet >= cachedSets) || (hour > 23)) { return(backing.getByHourStat(statsSet, hour)); }
+      return(get(statsSet).byHour[hour]);
+      }
+
+    virtual uint8_t getMinByHourStat(const uint8_t statsSet) const override
+      {
+      if(statsSet >= cachedSets) { return(backing.getMinByHourStat(statsSet)); }
+      return(get(statsSet).sorted[0]);
+      }
+    virtual uint8_t getMaxByHourStat(const uint8_t statsSet) const override
+      {
+      if(statsSet >= cachedSets) { return(backing.getMaxByHourStat(statsSet)); }
+      return(get(statsSet).max);
+      }
+
+    // As for EEPROMByHourByteStats, true if the quartile membership is established
+    // from the hours before any unset value, scanning from hour 0;
+    // the (rare) case of an incomplete set with at least 18 values set before the first unset one is rescanned.
+    virtual bool inOutlierQuartile(const bool inTop, const uint8_t statsSet, const uint8_t hour = STATS_SPECIAL_HOUR_CURRENT_HOUR) const override
+      {
+      if(statsSet >= cachedSets) { return(backing.inOutlierQuartile(inTop, statsSet, hour)); }
+      const uint8_t sample = getByHourStat(statsSet, hour);
+      if(UNSET_BYTE == sample) { return(false); }
+      const cachedSet &c = get(statsSet);
+      if(24 == c.firstUnset) { return(inTop ? (c.sorted[17] < sample) : (c.sorted[6] > sample)); }
+      if(c.firstUnset < 18) { return(false); }
+      uint8_t n = 0;
+      for(uint8_t h = 0; h < c.firstUnset; ++h)
+        {
+        const uint8_t v = c.byHour[h];
+        if(inTop ? (v < sample) : (v > sample)) { ++n; }
+        }
+      return(n >= 18);
+      }
+
+    virtual int8_t countStatSamplesBelow(const uint8_t statsSet, const uint8_t value) const override
+      {
+      if(statsSet >= cachedSets) { return(backing.countStatSamplesBelow(statsSet, value)); }
+      if(0 == value) { return(0); } // Optimisation for common value.
+      return(rank(get(statsSet), value));
+      }
+  };
+
+
 #ifdef ARDUINO_ARCH_AVR
 
 // ATmega328P has 1kByte of EEPROM, with an underlying page size (datasheet section 27.5) of 4 bytes for wear purposes.
@@ -212,6 +465,22 @@ int8_t eeprom_unary_2byte_decode(uint8_t vm, uint8_t vl);
 // First arg is most significant byte.
 inline int8_t eeprom_unary_2byte_decode(uint16_t v) { return(eeprom_unary_2byte_decode((uint8_t)(v >> 8), (uint8_t)v)); }
 
+#else
+
+// Hosted equivalents of the AVR EEPROM primitives and smart helpers,
+// acting on the EEPROMFile selected with EEPROMFile::setDefault() (see OTV0P2BASE_EEPROMFile.h).
+// With none selected reads return 0xff (erased) and updates do nothing, returning false.
+// Addresses are EEPROM offsets cast to pointers, as on AVR.
+uint8_t eeprom_read_byte(const uint8_t *p);
+bool eeprom_smart_update_byte(uint8_t *p, uint8_t value);
+bool eeprom_smart_erase_byte(uint8_t *p);
+bool eeprom_smart_clear_bits(uint8_t *p, uint8_t mask);
+
+#endif // ARDUINO_ARCH_AVR
+
+
+// EEPROM layout.
+// Also used by hosted non-volatile store emulation (see OTV0P2BASE_EEPROMFile.h).
 
 // Unit test location for erase/write.
 // Also may be more vulnerable to damage during resets/brown-outs.
@@ -366,6 +635,9 @@ static const uint8_t V0P2BASE_EE_NODE_ASSOCIATIONS_MAX_SETS = 8;
 // INCLUSIVE END OF NODE ASSOCIATIONS AREA: must point to last byte used.
 static const intptr_t V0P2BASE_EE_END_NODE_ASSOCIATIONS = ((V0P2BASE_EE_NODE_ASSOCIATIONS_MAX_SETS * V0P2BASE_EE_NODE_ASSOCIATIONS_SET_SIZE)-1);
 
+
+#ifdef ARDUINO_ARCH_AVR
+
 // Clear all collected statistics, eg when moving device to a new room or at a major time change.
 // Requires 1.8ms per byte for each byte that actually needs erasing.
 //   * maxBytesToErase limit the number of bytes erased to this; strictly positive, else 0 to allow 65536
@@ -0,0 +1,203 @@
+/*
+The OpenTRV project licenses this file to you
+under the Apache Licence, Version 2.0 (the "Licence");
+you may not use this file except in compliance
+with the Licence. You may obtain a copy of the Licence at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing,
+software distributed under the Licence is distributed on an
+"AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+KIND, either express or implied. See the Licence for the
+specific language governing permissions and limitations
+under the Licence.
+
+Author(s) / Copyright (s): Damon Hart-Davis 2016
+*/
+
+/*
+ * Hosted non-volatile store emulating the V0p2/AVR EEPROM in a memory-mapped file.
+ */
+
+#ifndef ARDUINO_ARCH_AVR
+
+#include "OTV0P2BASE_EEPROMFile.h"
+#include "OTV0P2BASE_EEPROM.h"
+
+#ifdef OTV0P2BASE_PLATFORM_HAS_mmap
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+
+namespace OTV0P2BASE
+{
+
+
+#ifdef OTV0P2BASE_PLATFORM_HAS_mmap
+
+constexpr size_t EEPROMFile::DEFAULT_SIZE;
+constexpr uint16_t EEPROMFile::DEFAULT_SYNC_INTERVAL;
+
+EEPROMFile *EEPROMFile::defaultInstance;
+
+// Map size bytes (strictly positive) of the named file, closing any currently open first; returns true on success.
+// Remains the default instance if it was.
+bool EEPROMFile::open(const char *const path, const size_t _size)
+  {
+  unmap();
+  if((NULL == path) || (0 == _size)) { return(false); } // FAIL
+  const int fd = ::open(path, O_RDWR | O_CREAT, 0644);
+  if(fd < 0) { return(false); } // FAIL
+  struct stat st;
+  if((0 != fstat(fd, &st)) || (st.st_size < 0)) { ::close(fd); return(false); } // FAIL
+  // Extend with erased bytes.
+  uint8_t ff[64];
+  memset(ff, 0xff, sizeof(ff));
+  for(size_t len = (size_t)st.st_size; len < _size; )
+    {
+    const size_t n = (_size - len < sizeof(ff)) ? (_size - len) : sizeof(ff);
+    const ssize_t w = pwrite(fd, ff, n, (off_t)len);
+    if(w <= 0) { ::close(fd); return(false); } // FAIL
+    len += (size_t)w;
+    }
+  void *const p = mmap(NULL, _size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  // The mapping remains valid once the descriptor is closed.
+  ::close(fd);
+  if(MAP_FAILED == p) { return(false); } // FAIL
+  data = (uint8_t *)p;
+  size = _size;
+  erases.assign(size, 0);
+  writes.assign(size, 0);
+  unsynced = 0;
+  return(true);
+  }
+
+// Flush and unmap any open file; idempotent.
+// Deselects this as the default instance if it was.
+void EEPROMFile::close()
+  {
+  if(this == defaultInstance) { defaultInstance = NULL; }
+  unmap();
+  }
+
+// Flush and unmap any open file, leaving the default instance alone; idempotent.
+void EEPROMFile::unmap()
+  {
+  if(NULL == data) { return; }
+  sync();
+  munmap(data, size);
+  data = NULL;
+  size = 0;
+  erases.clear();
+  writes.clear();
+  }
+
+// Flush any outstanding changes to the file; returns false on error.
+bool EEPROMFile::sync()
+  {
+  if((NULL == data) || (0 == unsynced)) { return(true); }
+  unsynced = 0;
+  return(0 == msync(data, size, MS_SYNC));
+  }
+
+// Record an erase and/or write at addr and sync if the batch is complete.
+void EEPROMFile::noteOp(const size_t addr, const bool erased, const bool written)
+  {
+  if(erased) { ++erases[addr]; }
+  if(written) { ++writes[addr]; }
+  if(unsynced < 0xffff) { ++unsynced; }
+  if((0 != syncInterval) && (unsynced >= syncInterval)) { sync(); }
+  }
+
+// Erase and/or write only as needed to set the byte at addr to value.
+bool EEPROMFile::smartUpdateByte(const size_t addr, const uint8_t value)
+  {
+  // If target byte is 0xff then erase only.
+  if(0xff == value) { return(smartEraseByte(addr)); }
+  if(addr >= size) { return(false); } // FAIL
+  const uint8_t oldValue = data[addr];
+  if(value == oldValue) { return(false); } // No change needed.
+  if(value == (value & oldValue)) { return(smartClearBits(addr, value)); } // Can use pure write to clear bits to zero.
+  // Needs to set some (but not all) bits to 1, so needs erase and write.
+  data[addr] = value;
+  noteOp(addr, true, true);
+  return(true);
+  }
+
+// Set the byte at addr to 0xff, only erasing if needed.
+bool EEPROMFile::smartEraseByte(const size_t addr)
+  {
+  if((addr >= size) || (0xff == data[addr])) { return(false); }
+  data[addr] = 0xff;
+  noteOp(addr, true, false);
+  return(true);
+  }
+
+// AND mask into the byte at addr with a write (no erase) only if needed.
+bool EEPROMFile::smartClearBits(const size_t addr, const uint8_t mask)
+  {
+  if(addr >= size) { return(false); }
+  const uint8_t oldValue = data[addr];
+  const uint8_t newValue = oldValue & mask;
+  if(oldValue == newValue) { return(false); } // No change/write needed.
+  data[addr] = newValue;
+  noteOp(addr, false, true);
+  return(true);
+  }
+
+// Set the value for a stats set and hour [0,23] with minimal erases/writes; ignored if either is out of range.
+bool EEPROMFileByHourByteStats::setByHourStat(const uint8_t statsSet, const uint8_t hour, const uint8_t value)
+  {
+  if((statsSet >= V0P2BASE_EE_STATS_SETS) || (hour > 23)) { return(false); }
+  return(f.smartUpdateByte(V0P2BASE_EE_STATS_START_ADDR(statsSet) + hour, value));
+  }
+
+// Clear all collected statistics, as on AVR.
+bool EEPROMFileByHourByteStats::zapStats(uint16_t maxBytesToErase)
+  {
+  for(size_t a = V0P2BASE_EE_START_STATS; a <= V0P2BASE_EE_END_STATS; ++a)
+    { if(f.smartEraseByte(a)) { if(--maxBytesToErase == 0) { return(false); } } } // Stop if out of time...
+  return(true); // All done.
+  }
+
+// Hosted EEPROM primitives acting on the default EEPROMFile.
+uint8_t eeprom_read_byte(const uint8_t *const p)
+  {
+  const EEPROMFile *const f = EEPROMFile::getDefault();
+  return((NULL == f) ? 0xff : f->readByte((size_t)p));
+  }
+bool eeprom_smart_update_byte(uint8_t *const p, const uint8_t value)
+  {
+  EEPROMFile *const f = EEPROMFile::getDefault();
+  return((NULL != f) && f->smartUpdateByte((size_t)p, value));
+  }
+bool eeprom_smart_erase_byte(uint8_t *const p)
+  {
+  EEPROMFile *const f = EEPROMFile::getDefault();
+  return((NULL != f) && f->smartEraseByte((size_t)p));
+  }
+bool eeprom_smart_clear_bits(uint8_t *const p, const uint8_t mask)
+  {
+  EEPROMFile *const f = EEPROMFile::getDefault();
+  return((NULL != f) && f->smartClearBits((size_t)p, mask));
+  }
+
+#else
+
+// No backing store: reads see erased EEPROM and updates are ignored.
+uint8_t eeprom_read_byte(const uint8_t *) { return(0xff); }
+bool eeprom_smart_update_byte(uint8_t *, uint8_t) { return(false); }
+bool eeprom_smart_erase_byte(uint8_t *) { return(false); }
+bool eeprom_smart_clear_bits(uint8_t *, uint8_t) { return(false); }
+
+#endif // OTV0P2BASE_PLATFORM_HAS_mmap
+
+
+}
+
+#endif // ARDUINO_ARCH_AVR
@@ -0,0 +1,161 @@
+/*
+The OpenTRV project licenses this file to you
+under the Apache Licence, Version 2.0 (the "Licence");
+you may not use this file except in compliance
+with the Licence. You may obtain a copy of the Licence at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing,
+software distributed under the Licence is distributed on an
+"AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+KIND, either express or implied. See the Licence for the
+specific language governing permissions and limitations
+under the Licence.
+
+Author(s) / Copyright (s): Damon Hart-Davis 2016
+*/
+
+/*
+ * Hosted non-volatile store emulating the V0p2/AVR EEPROM in a memory-mapped file,
+ * with the same V0P2BASE_EE_* layout, so that hosted controllers and simulators
+ * can persist stats, RTC state, counters, etc, across restarts.
+ *
+ * Emulates the ATmega328P split erase/write behaviour,
+ * ie an erase sets all bits of a byte to 1 and a write can only clear bits,
+ * and counts erases and writes per byte to help assess wear.
+ *
+ * Only available where POSIX mmap() is, flagged by OTV0P2BASE_PLATFORM_HAS_mmap.
+ */
+
+#ifndef OTV0P2BASE_EEPROMFILE_H
+#define OTV0P2BASE_EEPROMFILE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "OTV0P2BASE_MappedFile.h"
+
+#ifdef OTV0P2BASE_PLATFORM_HAS_mmap
+
+#include <vector>
+#include "OTV0P2BASE_EEPROM.h"
+
+
+namespace OTV0P2BASE
+{
+
+
+// EEPROM image mapped read/write from a file; unmapped (and synced) on destruction.
+// The file is created if need be and extended with erased (0xff) bytes to the requested size.
+// Changes are flushed to the file with msync() in batches, and on sync() and close().
+// Wear counts are since open().
+// Not copyable; not thread-safe.
+class EEPROMFile final
+  {
+  public:
+    // Default size in bytes, as for the ATmega328P.
+    static constexpr size_t DEFAULT_SIZE = 1024;
+    // Default number of erase/write operations between msync() calls.
+    static constexpr uint16_t DEFAULT_SYNC_INTERVAL = 64;
+
+  private:
+    // Start of mapped data; NULL if none.
+    uint8_t *data;
+    // Size of mapped data in bytes.
+    size_t size;
+    // Erase and write counts per byte.
+    std::vector<uint32_t> erases;
+    std::vector<uint32_t> writes;
+    // Erase/write operations since the last msync().
+    uint16_t unsynced;
+    // Erase/write operations between msync() calls; 0 for only explicit sync().
+    uint16_t syncInterval;
+
+    // Record an erase and/or write at addr and sync if the batch is complete.
+    void noteOp(size_t addr, bool erased, bool written);
+    // Flush and unmap any open file, leaving the default instance alone; idempotent.
+    void unmap();
+
+    // Instance used by the hosted eeprom_XXX() routines; may be NULL.
+    static EEPROMFile *defaultInstance;
+
+  public:
+    EEPROMFile() : data(NULL), size(0), unsynced(0), syncInterval(DEFAULT_SYNC_INTERVAL) { }
+    // Open the named file, testing isOpen() for success.
+    explicit EEPROMFile(const char *const path, const size_t _size = DEFAULT_SIZE)
+      : data(NULL), size(0), unsynced(0), syncInterval(DEFAULT_SYNC_INTERVAL) { open(path, _size); }
+    ~EEPROMFile() { close(); }
+    EEPROMFile(const EEPROMFile &) = delete;
+    EEPROMFile &operator=(const EEPROMFile &) = delete;
+
+    // Map size bytes (strictly positive) of the named file, closing any currently open first; returns true on success.
+    // Remains the default instance if it was, eg to switch the hosted eeprom_XXX() routines to another file.
+    bool open(const char *path, size_t size = DEFAULT_SIZE);
+
+    // Flush and unmap any open file; idempotent.
+    // Deselects this as the default instance if it was.
+    void close();
+
+    // True if a file is open.
+    bool isOpen() const { return(NULL != data); }
+    // Size in bytes; 0 if not open.
+    size_t getSize() const { return(size); }
+    // Read-only view of the whole image; NULL if not open.
+    const uint8_t *getData() const { return(data); }
+
+    // Set the number of erase/write operations between msync() calls; 0 for only explicit sync().
+    void setSyncInterval(const uint16_t ops) { syncInterval = ops; }
+    // Flush any outstanding changes to the file; returns false on error.
+    bool sync();
+
+    // Read byte at addr; 0xff if out of range or not open.
+    uint8_t readByte(const size_t addr) const { return((addr < size) ? data[addr] : 0xff); }
+
+    // As eeprom_smart_update_byte(): erase and/or write only as needed to set the byte at addr to value.
+    // Returns true iff an erase and/or write was performed.
+    bool smartUpdateByte(size_t addr, uint8_t value);
+    // As eeprom_smart_erase_byte(): set the byte at addr to 0xff, only erasing if needed.
+    // Returns true iff an erase was performed.
+    bool smartEraseByte(size_t addr);
+    // As eeprom_smart_clear_bits(): AND mask into the byte at addr with a write (no erase) only if needed.
+    // Returns true iff a write was performed.
+    bool smartClearBits(size_t addr, uint8_t mask);
+
+    // Erases and writes of the byte at addr since open(); 0 if out of range.
+    uint32_t getEraseCount(const size_t addr) const { return((addr < size) ? erases[addr] : 0); }
+    uint32_t getWriteCount(const size_t addr) const { return((addr < size) ? writes[addr] : 0); }
+
+    // Select the instance used by the hosted eeprom_XXX() routines, or NULL for none.
+    static void setDefault(EEPROMFile *const f) { defaultInstance = f; }
+    static EEPROMFile *getDefault() { return(defaultInstance); }
+  };
+
+// By-hour stats held in an EEPROMFile with the EEPROM layout.
+// The file must be open and at least DEFAULT_SIZE bytes at construction, else all stats appear unset,
+// and must stay open for the life of this instance.
+// The current hour is set explicitly with setHour() rather than taken from the RTC.
+class EEPROMFileByHourByteStats final : public NVByHourByteStatsScanningBase
+  {
+  private:
+    EEPROMFile &f;
+
+  public:
+    explicit EEPROMFileByHourByteStats(EEPROMFile &file)
+      : NVByHourByteStatsScanningBase((file.getSize() > V0P2BASE_EE_STATS_START_ADDR(V0P2BASE_EE_STATS_SETS)) ? (file.getData() + V0P2BASE_EE_START_STATS) : NULL),
+        f(file)
+      { }
+
+    // Set the value for a stats set and hour [0,23] with minimal erases/writes; ignored if either is out of range.
+    // Returns true iff an erase and/or write was performed.
+    bool setByHourStat(uint8_t statsSet, uint8_t hour, uint8_t value);
+
+    // Clear all collected statistics, as on AVR.
+    virtual bool zapStats(uint16_t maxBytesToErase = 0) override;
+  };
+
+
+}
+
+#endif // OTV0P2BASE_PLATFORM_HAS_mmap
+
+#endif
@@ -191,16 +191,32 @@ bool isValidSimpleStatsKey(const SimpleStatsKey key)
 
 // Returns pointer to stats tuple with given (non-NULL) key if present, else NULL.
 // Does a simple linear search.
+// Keys are usually static strings so a pointer match is tried first to save a strcmp().
 SimpleStatsRotationBase::DescValueTuple * SimpleStatsRotationBase::findByKey(const SimpleStatsKey key) const
   {
   for(int i = 0; i < nStats; ++i)
     {
     DescValueTuple * const p = stats + i;
-    if(0 == strcmp(p->descriptor.key, key)) { return(p); }
+    if((key == p->descriptor.key) || (0 == strcmp(p->descriptor.key, key))) { return(p); }
     }
   return(NULL); // Not found.
   }
 
+// Add new default stat at the end with a fresh handle; returns NULL if full.
+SimpleStatsRotationBase::DescValueTuple *SimpleStatsRotationBase::append()
+  {
+  if(nStats >= capacity) { return(NULL); } // Full.
+  // Find the lowest free handle; there must be one as there is a free slot.
+  SimpleStatsHandle h = 0;
+  while(NULL != findByHandle(h)) { ++h; }
+  const uint8_t i = nStats++;
+  DescValueTuple * const p = stats + i;
+  *p = DescValueTuple();
+  p->handle = h;
+  handleIndex[h] = i;
+  return(p);
+  }
+
 // Remove given stat and properties.
 // True iff the item existed and was removed.
 bool SimpleStatsRotationBase::remove(const SimpleStatsKey key)
@@ -210,7 +226,7 @@ bool SimpleStatsRotationBase::remove(const SimpleStatsKey key)
   // If it needs to be removed and is not the last item
   // then move the last item down into its slot.
   const bool lastItem = ((p - stats) == (nStats - 1));
-  if(!lastItem) { *p = stats[nStats-1]; }
+  if(!lastItem) { *p = stats[nStats-1]; handleIndex[p->handle] = (uint8_t)(p - stats); }
   // We got rid of one!
   // TODO: possibly explicitly destroy/overwrite the removed one at the end.
   --nStats;
@@ -224,13 +240,21 @@ bool SimpleStatsRotationBase::putDescriptor(const GenericStatsDescriptor &descri
   if(!isValidSimpleStatsKey(descriptor.key)) { return(false); }
   DescValueTuple *p = findByKey(descriptor.key);
   // If item already exists, update its properties.
-  if(NULL != p) { p->descriptor = descriptor; }
+  // The key text may have changed so force the fragment to be rendered again.
+  // Likewise the binary delta base and schema ID.
+  if(NULL != p)
+    {
+    p->descriptor = descriptor;
+    p->fragmentLength = 0;
+#ifdef OTV0P2BASE_SIMPLESTATSROTATION_BINARY
+    p->deltaRun = DescValueTuple::NO_DELTA_BASE;
+    p->schemaID = DescValueTuple::SCHEMA_ID_UNKNOWN;
+#endif
+    }
   // Else if not yet at capacity then add this new item at the end.
   // Don't mark it as changed since its value may not yet be meaningful
-  else if(nStats < capacity)
+  else if(NULL != (p = append()))
     {
-    p = stats + (nStats++);
-    *p = DescValueTuple();
     p->descriptor = descriptor;
     }
   // Else failed: no space to add a new item.
@@ -238,6 +262,37 @@ bool SimpleStatsRotationBase::putDescriptor(const GenericStatsDescriptor &descri
   return(true); // OK
   }
 
+// Get handle for given stat/key, creating the stat if need be as for putDescriptor().
+// Returns SIMPLE_STATS_HANDLE_NONE if the key is invalid or capacity is already reached.
+SimpleStatsHandle SimpleStatsRotationBase::intern(const SimpleStatsKey key, const bool statLowPriority)
+  {
+  if(!isValidSimpleStatsKey(key)) { return(SIMPLE_STATS_HANDLE_NONE); }
+  DescValueTuple *p = findByKey(key);
+  if(NULL == p)
+    {
+    p = append();
+    if(NULL == p) { return(SIMPLE_STATS_HANDLE_NONE); } // FAILED: full.
+    p->descriptor = GenericStatsDescriptor(key, statLowPriority);
+    }
+  return(p->handle);
+  }
+
+// Create/update value for stat with given handle from intern().
+// True if successful, false otherwise (eg handle not valid).
+bool SimpleStatsRotationBase::put(const SimpleStatsHandle handle, const int newValue)
+  {
+  DescValueTuple * const p = findByHandle(handle);
+  if(NULL == p) { return(false); }
+  // Update the value and mark as changed if changed.
+  if(p->value != newValue)
+    {
+    p->value = newValue;
+    p->flags.changed = true;
+    p->fragmentLength = 0;
+    }
+  return(true);
+  }
+
 // Create/update value for given stat/key.
 // If properties not already set and not supplied then stat will get defaults.
 // If descriptor is supplied then its key must match (and the descriptor will be copied).
@@ -263,6 +318,7 @@ DEBUG_SERIAL_PRINTLN();
       {
       p->value = newValue;
       p->flags.changed = true;
+      p->fragmentLength = 0;
       }
     // Update done!
     return(true);
@@ -270,10 +326,8 @@ DEBUG_SERIAL_PRINTLN();
 
   // If not yet at capacity then add this new item at the end.
   // Mark it as changed to prioritise seeing it in the JSON output.
-  if(nStats < capacity)
+  if(NULL != (p = append()))
     {
-    p = stats + (nStats++);
-    *p = DescValueTuple();
     p->value = newValue;
     p->flags.changed = true;
     // Copy descriptor .
@@ -291,16 +345,62 @@ DEBUG_SERIAL_PRINTLN();
   }
 
 //#if defined(ALLOW_JSON_OUTPUT)
+// Render "key":value to buf, which must be large enough, returning the length.
+// Renders nothing but still computes the length if buf is NULL.
+// Key is assumed not to need escaping in any way.
+static size_t renderFragment(char * const buf, const SimpleStatsKey key, const int value)
+  {
+  // Render the value least-significant digit first into a scratch buffer.
+  char digits[3 * sizeof(int) + 1];
+  char *d = digits + sizeof(digits);
+  unsigned int u = (value < 0) ? (0U - (unsigned int)value) : (unsigned int)value;
+  do { *--d = (char)('0' + (u % 10)); u /= 10; } while(0 != u);
+  if(value < 0) { *--d = '-'; }
+  const size_t dl = (digits + sizeof(digits)) - d;
+  const size_t kl = strlen(key);
+  if(NULL != buf)
+    {
+    char *p = buf;
+    *p++ = '"';
+    memcpy(p, key, kl); p += kl;
+    *p++ = '"';
+    *p++ = ':';
+    memcpy(p, d, dl);
+    }
+  return(kl + 3 + dl);
+  }
+
+// Get length of rendered "key":value text, computing and caching it if need be.
+// Lengths over 255 are not cached and reported as 255, which is too long to fit in any message anyway.
+uint8_t SimpleStatsRotationBase::getFragmentLength(SimpleStatsRotationBase::DescValueTuple &s)
+  {
+  if(0 != s.fragmentLength) { return(s.fragmentLength); }
+  const size_t l = renderFragment(NULL, s.descriptor.key, s.value);
+#ifdef OTV0P2BASE_SIMPLESTATSROTATION_FRAGMENT_CACHE
+  if(l <= sizeof(s.fragment)) { renderFragment(s.fragment, s.descriptor.key, s.value); }
+#endif
+  if(l > 0xff) { return(0xff); }
+  s.fragmentLength = (uint8_t)l;
+  return(s.fragmentLength);
+  }
+
 // Print an object field "name":value to the given buffer.
-size_t SimpleStatsRotationBase::print(BufPrint &bp, const SimpleStatsRotationBase::DescValueTuple &s, bool &commaPending) const
+size_t SimpleStatsRotationBase::print(BufPrint &bp, SimpleStatsRotationBase::DescValueTuple &s, bool &commaPending)
   {
   size_t w = 0;
   if(commaPending) { w += bp.print(','); }
-  w += bp.print('"');
-  w += bp.print(s.descriptor.key); // Assumed not to need escaping in any way.
-  w += bp.print('"');
-  w += bp.print(':');
-  w += bp.print(s.value);
+#ifdef OTV0P2BASE_SIMPLESTATSROTATION_FRAGMENT_CACHE
+  const uint8_t l = getFragmentLength(s);
+  if(l <= sizeof(s.fragment)) { w += bp.write((const uint8_t *)s.fragment, l); }
+  else
+#endif
+    {
+    w += bp.print('"');
+    w += bp.print(s.descriptor.key); // Assumed not to need escaping in any way.
+    w += bp.print('"');
+    w += bp.print(':');
+    w += bp.print(s.value);
+    }
   commaPending = true;
   return(w);
   }
@@ -316,73 +416,44 @@ bool SimpleStatsRotationBase::changedValue()
   return(false);
   }
 
-// Write stats in JSON format to provided buffer; returns the non-zero JSON length if successful.
-// Output starts with an "@" (ID) string field,
-// then and optional count (if enabled),
-// then the tracked stats as space permits,
-// attempting to give priority to high-priority and changed values,
-// allowing a potentially large set of values to my multiplexed over time
-// into a constrained size/bandwidth message.
-//
-//   * buf  is the byte/char buffer to write the JSON to; never NULL
-//   * bufSize is the capacity of the buffer starting at buf in bytes;
-//       should be two (2) greater than the largest JSON output to be generated
-//       to allow for a trailing null and one extra byte/char to ensure that the message is not over-large
-//   * sensitivity  CURRENTLY IGNORED threshold below which (sensitive) stats will not be included; 0 means include everything
-//   * maximise  if true attempt to maximise the number of stats squeezed into each frame,
-//       potentially at the cost of significant CPU time
-//   * suppressClearChanged  if true then 'changed' flag for included fields is not cleared by this
-//       allowing them to continue to be treated as higher priority
-uint8_t SimpleStatsRotationBase::writeJSON(uint8_t *const buf, const uint8_t bufSize, const uint8_t sensitivity,
-                                           const bool maximise, const bool suppressClearChanged)
+// Output adaptor for selectStats() writing JSON fields.
+class SimpleStatsRotationBase::JSONOutput final
   {
-  if(NULL == buf) { return(0); } // Should never happen, but be graceful if given a NULL buffer.
-
-// Minimum size is for {"@":""} plus null plus extra padding char/byte to check for overrun.
-  if(bufSize < 10) { return(0); } // Failed.
-
-  // Write/print to buffer passed in.
-  BufPrint bp((char *)buf, bufSize);
-  // True if field has been written and will need a ',' if another field is written.
-  bool commaPending = false;
-
-  // Start object.
-  bp.print('{');
-
-  // Write ID first unless disabled entirely by being set to an empty string.
-  if((NULL == id) || ('\0' != *id))
-    {
-    // If an explicit ID is supplied then use it
-    // else use the first two bytes of the node ID if accessible.
-    bp.print(F("\"@\":\""));
-    if(NULL != id) { bp.print(id); } // Value has to be 'safe' (eg no " nor \ in it).
-#ifdef V0P2BASE_EE_START_ID // TODO: improve logic/portability
-    else
-      {
-      const uint8_t id1 = eeprom_read_byte(0 + (uint8_t *)V0P2BASE_EE_START_ID);
-      const uint8_t id2 = eeprom_read_byte(1 + (uint8_t *)V0P2BASE_EE_START_ID);
-      bp.print(hexDigit(id1 >> 4));
-      bp.print(hexDigit(id1));
-      bp.print(hexDigit(id2 >> 4));
-      bp.print(hexDigit(id2));
-      }
+  private:
+    SimpleStatsRotationBase &ssr;
+    BufPrint &bp;
+    bool &commaPending;
+  public:
+    JSONOutput(SimpleStatsRotationBase &_ssr, BufPrint &_bp, bool &_commaPending) : ssr(_ssr), bp(_bp), commaPending(_commaPending) { }
+    // Output so far.
+    int size() const { return(bp.getSize()); }
+    // Length that writing s would add, including any separator.
+    int length(DescValueTuple &s) { return((commaPending ? 1 : 0) + ssr.getFragmentLength(s)); }
+    void write(DescValueTuple &s) { ssr.print(bp, s, commaPending); }
+  };
+
+#ifdef OTV0P2BASE_SIMPLESTATSROTATION_BINARY
+// Output adaptor for selectStats() writing binary stats.
+class SimpleStatsRotationBase::BinaryOutput final
+  {
+  private:
+    SimpleStatsRotationBase &ssr;
+    uint8_t * const buf;
+    uint8_t n;
+  public:
+    BinaryOutput(SimpleStatsRotationBase &_ssr, uint8_t *const _buf, const uint8_t used) : ssr(_ssr), buf(_buf), n(used) { }
+    int size() const { return(n); }
+    int length(DescValueTuple &s) { return(ssr.encodeBinary(s, NULL)); }
+    void write(DescValueTuple &s) { n += ssr.encodeBinary(s, buf + n); }
+  };
 #endif
-    bp.print('"');
-    commaPending = true;
-    }
-
-  // Write count next iff enabled.
-  if(c.enabled)
-    {
-    if(commaPending) { bp.print(','); commaPending = false; }
-    bp.print(F("\"+\":"));
-    bp.print(c.count);
-    commaPending = true;
-    }
-
-  // Be prepared to rewind back to logical start of buffer.
-  bp.setMark();
 
+// Select and write stats in priority/rotation order to out while they fit within limit bytes in total,
+// attempting to give priority to high-priority and changed values.
+// Shared by all output formats so that they rotate through the stats identically.
+template<class Output>
+void SimpleStatsRotationBase::selectStats(Output &out, const int limit, const bool maximise, const bool suppressClearChanged)
+  {
   bool gotHiPri = false;
   uint8_t hiPriIndex = 0;
 //  bool gotLoPri = false;  // (DE20161010) Commented to fix 'unused variable' warning. Goes out of scope without anything ever reading it.
@@ -408,14 +479,12 @@ uint8_t SimpleStatsRotationBase::writeJSON(uint8_t *const buf, const uint8_t buf
         // Found suitable stat to include in output.
         hiPriIndex = next;
         gotHiPri = true;
-        // Add to JSON output.
-        print(bp, s, commaPending);
-        // If successful, ie still space for the closing "}\0" without running over-length,
-        // then mark this as a fall-back, else rewind and discard this item.
-        if(bp.getSize() > bufSize - 3) { bp.rewind(); break; }
+        // Add to output iff there is still space,
+        // using the precomputed length to avoid writing and then rewinding.
+        if(out.size() + out.length(s) > limit) { break; }
         else
           {
-          bp.setMark();
+          out.write(s);
           lastTXed = lastTXedHiPri = hiPriIndex;
           if(!suppressClearChanged) { stats[hiPriIndex].flags.changed = false; }
           break;
@@ -449,15 +518,12 @@ uint8_t SimpleStatsRotationBase::writeJSON(uint8_t *const buf, const uint8_t buf
         // Found suitable stat to include in output.
         loPriIndex = next;
 //        gotLoPri = true;  // (DE20161010) Commented to fix 'unused variable' warning. Goes out of scope without anything ever reading it.
-        // Add to JSON output.
-        print(bp, s, commaPending);
-        // If successful then mark this as a fall-back, else rewind and discard this item.
-        // If successful, ie still space for the closing "}\0" without running over-length
-        // then mark this as a fall-back, else rewind and discard this item.
-        if(bp.getSize() > bufSize - 3) { bp.rewind(); break; }
+        // Add to output iff there is still space,
+        // using the precomputed length to avoid writing and then rewinding.
+        if(out.size() + out.length(s) > limit) { break; }
         else
           {
-          bp.setMark();
+          out.write(s);
           lastTXed = lastTXedLoPri = loPriIndex;
           if(!suppressClearChanged) { stats[loPriIndex].flags.changed = false; }
           }
@@ -465,6 +531,75 @@ uint8_t SimpleStatsRotationBase::writeJSON(uint8_t *const buf, const uint8_t buf
         }
       }
     }
+  }
+
+// Write stats in JSON format to provided buffer; returns the non-zero JSON length if successful.
+// Output starts with an "@" (ID) string field,
+// then and optional count (if enabled),
+// then the tracked stats as space permits,
+// attempting to give priority to high-priority and changed values,
+// allowing a potentially large set of values to my multiplexed over time
+// into a constrained size/bandwidth message.
+//
+//   * buf  is the byte/char buffer to write the JSON to; never NULL
+//   * bufSize is the capacity of the buffer starting at buf in bytes;
+//       should be two (2) greater than the largest JSON output to be generated
+//       to allow for a trailing null and one extra byte/char to ensure that the message is not over-large
+//   * sensitivity  CURRENTLY IGNORED threshold below which (sensitive) stats will not be included; 0 means include everything
+//   * maximise  if true attempt to maximise the number of stats squeezed into each frame,
+//       potentially at the cost of significant CPU time
+//   * suppressClearChanged  if true then 'changed' flag for included fields is not cleared by this
+//       allowing them to continue to be treated as higher priority
+uint8_t SimpleStatsRotationBase::writeJSON(uint8_t *const buf, const uint8_t bufSize, const uint8_t sensitivity,
+                                           const bool maximise, const bool suppressClearChanged)
+  {
+  if(NULL == buf) { return(0); } // Should never happen, but be graceful if given a NULL buffer.
+
+// Minimum size is for {"@":""} plus null plus extra padding char/byte to check for overrun.
+  if(bufSize < 10) { return(0); } // Failed.
+
+  // Write/print to buffer passed in.
+  BufPrint bp((char *)buf, bufSize);
+  // True if field has been written and will need a ',' if another field is written.
+  bool commaPending = false;
+
+  // Start object.
+  bp.print('{');
+
+  // Write ID first unless disabled entirely by being set to an empty string.
+  if((NULL == id) || ('\0' != *id))
+    {
+    // If an explicit ID is supplied then use it
+    // else use the first two bytes of the node ID if accessible.
+    bp.print(F("\"@\":\""));
+    if(NULL != id) { bp.print(id); } // Value has to be 'safe' (eg no " nor \ in it).
+#ifdef V0P2BASE_EE_START_ID // TODO: improve logic/portability
+    else
+      {
+      const uint8_t id1 = eeprom_read_byte(0 + (uint8_t *)V0P2BASE_EE_START_ID);
+      const uint8_t id2 = eeprom_read_byte(1 + (uint8_t *)V0P2BASE_EE_START_ID);
+      bp.print(hexDigit(id1 >> 4));
+      bp.print(hexDigit(id1));
+      bp.print(hexDigit(id2 >> 4));
+      bp.print(hexDigit(id2));
+      }
+#endif
+    bp.print('"');
+    commaPending = true;
+    }
+
+  // Write count next iff enabled.
+  if(c.enabled)
+    {
+    if(commaPending) { bp.print(','); commaPending = false; }
+    bp.print(F("\"+\":"));
+    bp.print(c.count & 7);
+    commaPending = true;
+    }
+
+  JSONOutput out(*this, bp, commaPending);
+  // Leave space for the closing "}\0" without running over-length.
+  selectStats(out, bufSize - 3, maximise, suppressClearChanged);
 
   // TODO: maximise.
 
@@ -490,5 +625,222 @@ uint8_t SimpleStatsRotationBase::writeJSON(uint8_t *const buf, const uint8_t buf
   return(bp.getSize()); // Success!
   }
 
+// Zig-zag decode a value so that small magnitudes of either sign are small.
+static inline int32_t unzigzag(const uint32_t u) { return((int32_t)(u >> 1) ^ -(int32_t)(u & 1)); }
+
+#ifdef OTV0P2BASE_SIMPLESTATSROTATION_BINARY
+// Zig-zag encode a signed value so that small magnitudes of either sign are small.
+static inline uint32_t zigzag(const int32_t v) { return((((uint32_t)v) << 1) ^ (uint32_t)(v >> 31)); }
+
+// Write v as a LEB128 varint to out if non-NULL, returning the length.
+static uint8_t putVarint(uint8_t *const out, uint32_t v)
+  {
+  uint8_t n = 0;
+  do
+    {
+    const uint8_t b = (uint8_t)(v & 0x7f);
+    v >>= 7;
+    if(NULL != out) { out[n] = (0 == v) ? b : (b | 0x80); }
+    ++n;
+    } while(0 != v);
+  return(n);
+  }
+
+// Encode a stat for writeBinary() to out if non-NULL, returning the length.
+// Lengths over 255 are reported as 255, which is too long to fit in any message anyway.
+uint8_t SimpleStatsRotationBase::encodeBinary(DescValueTuple &s, uint8_t *const out)
+  {
+  if(DescValueTuple::SCHEMA_ID_UNKNOWN == s.schemaID) { s.schemaID = getSimpleStatsSchemaID(s.descriptor.key); }
+  const bool literal = (SIMPLE_STATS_SCHEMA_ID_NONE == s.schemaID);
+  const uint32_t absolute = zigzag(s.value);
+  uint32_t v = absolute;
+  bool delta = false;
+  // Use a delta from the last value sent if that is shorter, for schema keys only.
+  if(!literal && (s.deltaRun < SIMPLE_STATS_BINARY_MAX_DELTAS))
+    {
+    const uint32_t d = zigzag((int32_t)s.value - (int32_t)s.lastSent);
+    if(putVarint(NULL, d) < putVarint(NULL, absolute)) { v = d; delta = true; }
+    }
+  const size_t kl = literal ? strlen(s.descriptor.key) : 0;
+  if(kl > SIMPLE_STATS_SCHEMA_ID_NONE) { return(0xff); } // Key too long to send.
+  const uint8_t l = (uint8_t)(1 + (literal ? (1 + kl) : 0) + putVarint(NULL, v));
+  if(NULL == out) { return(l); }
+  uint8_t *p = out;
+  *p++ = (uint8_t)((delta ? 0x80 : 0) | s.schemaID);
+  if(literal) { *p++ = (uint8_t)kl; memcpy(p, s.descriptor.key, kl); p += kl; }
+  putVarint(p, v);
+  // Record what the receiver now has.
+  s.lastSent = s.value;
+  s.deltaRun = delta ? (uint8_t)(s.deltaRun + 1) : 0;
+  return(l);
+  }
+
+// Write stats in compact binary format to provided buffer; returns the non-zero length if successful.
+uint8_t SimpleStatsRotationBase::writeBinary(uint8_t *const buf, const uint8_t bufSize, const uint8_t sensitivity,
+                                             const bool maximise, const bool suppressClearChanged)
+  {
+  if(NULL == buf) { return(0); } // Should never happen, but be graceful if given a NULL buffer.
+  // Work out the ID, packing hex digits into bytes where possible.
+  const bool idPresent = ((NULL == id) || ('\0' != *id));
+  uint8_t idBytes[2];
+  const uint8_t *idData = NULL;
+  uint8_t idLen = 0;
+  bool idHex = true;
+  if(NULL == id)
+    {
+#ifdef V0P2BASE_EE_START_ID // TODO: improve logic/portability
+    idBytes[0] = eeprom_read_byte(0 + (uint8_t *)V0P2BASE_EE_START_ID);
+    idBytes[1] = eeprom_read_byte(1 + (uint8_t *)V0P2BASE_EE_START_ID);
+    idData = idBytes;
+    idLen = 2;
+#endif
+    }
+  else if(idPresent)
+    {
+    const size_t l = strlen(id);
+    if(l > 2 * SIMPLE_STATS_SCHEMA_ID_NONE) { return(0); } // ID too long.
+    for(size_t i = 0; i < l; ++i)
+      {
+      const char c = id[i];
+      if(!(((c >= '0') && (c <= '9')) || ((c >= 'a') && (c <= 'f')))) { idHex = false; break; }
+      }
+    if(0 != (l & 1)) { idHex = false; }
+    if(!idHex && (l > SIMPLE_STATS_SCHEMA_ID_NONE)) { return(0); } // ID too long.
+    idData = (const uint8_t *)id;
+    idLen = (uint8_t)(idHex ? (l / 2) : l);
+    }
+  const uint8_t headerLen = idPresent ? (uint8_t)(3 + idLen) : 2;
+  if(bufSize < headerLen) { return(0); } // Failed.
+
+  uint8_t *p = buf;
+  *p++ = (uint8_t)(MSG_BINARY_STATS_HEADER | (idPresent ? MSG_BINARY_STATS_HEADER_ID_PRESENT : 0));
+  *p++ = c.count;
+  if(idPresent)
+    {
+    *p++ = (uint8_t)((idHex ? 0x80 : 0) | idLen);
+    if((NULL == id) || !idHex) { if(idLen > 0) { memcpy(p, idData, idLen); } p += idLen; }
+    else
+      {
+      // Pack pairs of hex digits.
+      for(uint8_t i = 0; i < idLen; ++i)
+        {
+        const char h = id[2*i], l = id[2*i + 1];
+        *p++ = (uint8_t)(((h <= '9') ? (h - '0') : (h - 'a' + 10)) << 4) | ((l <= '9') ? (l - '0') : (l - 'a' + 10));
+        }
+      }
+    }
+
+  BinaryOutput out(*this, buf, headerLen);
+  selectStats(out, bufSize, maximise, suppressClearChanged);
+
+  // On successfully creating output, update some internal state including success count.
+  ++c.count;
+
+  return((uint8_t)out.size()); // Success!
+  }
+#endif // OTV0P2BASE_SIMPLESTATSROTATION_BINARY
+
+// Decode binary stats from one sender to JSON text, updating that sender's state.
+uint8_t decodeBinaryStats(const uint8_t *const buf, const uint8_t buflen, BinaryStatsDecodeState &state,
+                          char *const json, const uint8_t jsonSize, uint8_t *const skipped)
+  {
+  if((NULL == buf) || (NULL == json) || (jsonSize < 3)) { return(0); } // ERROR
+  json[0] = '\0';
+  if(skipped) { *skipped = 0; }
+  if((buflen < 2) || ((MSG_BINARY_STATS_HEADER | MSG_BINARY_STATS_HEADER_ID_PRESENT) != (buf[0] | MSG_BINARY_STATS_HEADER_ID_PRESENT))) { return(0); } // ERROR
+  const uint8_t * const end = buf + buflen;
+  const uint8_t *p = buf;
+  const uint8_t header = *p++;
+  const uint8_t count = *p++;
+  // Apply to a scratch copy of the state, only committed if the whole message is good.
+  BinaryStatsDecodeState s = state;
+  // A missing frame, spotted by a gap in the count, invalidates all delta bases.
+  if(s.haveCount && (count != (uint8_t)(s.lastCount + 1))) { s.haveLast = 0; }
+
+  BufPrint bp(json, jsonSize);
+  bp.print('{');
+  if(0 != (header & MSG_BINARY_STATS_HEADER_ID_PRESENT))
+    {
+    if(p >= end) { json[0] = '\0'; return(0); } // ERROR
+    const uint8_t il = *p++;
+    const bool hex = (0 != (il & 0x80));
+    const uint8_t n = il & 0x7f;
+    if(end - p < n) { json[0] = '\0'; return(0); } // ERROR
+    bp.print(F("\"@\":\""));
+    for(uint8_t i = 0; i < n; ++i)
+      {
+      const uint8_t b = *p++;
+      if(hex) { bp.print(hexDigit(b >> 4)); bp.print(hexDigit(b)); }
+      else if((b < 32) || (b > 126) || ('"' == b) || ('\\' == b)) { json[0] = '\0'; return(0); } // ERROR: unsafe.
+      else { bp.print((char)b); }
+      }
+    bp.print(F("\","));
+    }
+  bp.print(F("\"+\":"));
+  bp.print(count);
+
+  uint8_t nSkipped = 0;
+  while(p < end)
+    {
+    const uint8_t k = *p++;
+    const bool delta = (0 != (k & 0x80));
+    const uint8_t schemaID = k & 0x7f;
+    const char *key = NULL;
+    uint8_t kl = 0;
+    if(SIMPLE_STATS_SCHEMA_ID_NONE == schemaID)
+      {
+      if(delta || (p >= end)) { json[0] = '\0'; return(0); } // ERROR: literal keys are never deltas.
+      kl = *p++;
+      if(end - p < kl) { json[0] = '\0'; return(0); } // ERROR
+      key = (const char *)p;
+      for(uint8_t i = 0; i < kl; ++i)
+        {
+        const char c = key[i];
+        if((c < 32) || (c > 126) || ('"' == c) || ('\\' == c)) { json[0] = '\0'; return(0); } // ERROR: unsafe.
+        }
+      p += kl;
+      }
+    else if(schemaID >= SimpleStatsSchemaSize) { json[0] = '\0'; return(0); } // ERROR: unknown key.
+    else { key = SimpleStatsSchema[schemaID]; kl = (uint8_t)strlen(key); }
+    // Value.
+    uint32_t u = 0;
+    uint8_t shift = 0;
+    bool more = true;
+    while(more && (p < end) && (shift < 35))
+      {
+      const uint8_t b = *p++;
+      u |= (uint32_t)(b & 0x7f) << shift;
+      shift += 7;
+      more = (0 != (b & 0x80));
+      }
+    if(more) { json[0] = '\0'; return(0); } // ERROR: truncated.
+    int32_t v = unzigzag(u);
+    if(SIMPLE_STATS_SCHEMA_ID_NONE != schemaID)
+      {
+      const uint32_t bit = (uint32_t)1 << schemaID;
+      if(delta)
+        {
+        if(0 == (s.haveLast & bit)) { ++nSkipped; continue; } // No base to apply the delta to.
+        v = (int32_t)((uint32_t)s.last[schemaID] + (uint32_t)v);
+        }
+      s.last[schemaID] = v;
+      s.haveLast |= bit;
+      }
+    bp.print(',');
+    bp.print('"');
+    bp.write((const uint8_t *)key, kl);
+    bp.print(F("\":"));
+    bp.print((long)v);
+    }
+  bp.print('}');
+  if(bp.isFull()) { json[0] = '\0'; return(0); } // ERROR: JSON buffer too small.
+
+  s.lastCount = count;
+  s.haveCount = true;
+  state = s;
+  if(skipped) { *skipped = nSkipped; }
+  return(bp.getSize());
+  }
+
 
 } // OTV0P2BASE
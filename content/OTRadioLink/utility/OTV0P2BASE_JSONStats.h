@@ -63,6 +63,73 @@ static const uint8_t MSG_JSON_LEADING_CHAR = ('{');
 // Key used for SimpleStatsRotation items.
 typedef const char *SimpleStatsKey;
 
+// Small integer handle for an interned SimpleStatsRotation key.
+// Valid from SimpleStatsRotationBase::intern() until the stat is removed.
+typedef uint8_t SimpleStatsHandle;
+static const SimpleStatsHandle SIMPLE_STATS_HANDLE_NONE = 0xff;
+
+// If defined, SimpleStatsRotation caches the rendered "key":value text of each stat
+// so that unchanged stats can be copied straight into the output.
+// This costs MSG_JSON_ABS_MAX_LENGTH bytes of RAM per stat
+// so by default is only enabled where RAM is plentiful, ie not on AVR.
+#if !defined(ARDUINO_ARCH_AVR) && !defined(OTV0P2BASE_SIMPLESTATSROTATION_NO_FRAGMENT_CACHE)
+#define OTV0P2BASE_SIMPLESTATSROTATION_FRAGMENT_CACHE
+#endif
+
+// If defined, SimpleStatsRotation can write compact binary stats with writeBinary().
+// This costs 4 bytes of RAM per stat for the delta base and cached schema ID
+// so by default is only enabled where RAM is plentiful, ie not on AVR.
+// decodeBinaryStats() is always available.
+#if !defined(ARDUINO_ARCH_AVR) && !defined(OTV0P2BASE_SIMPLESTATSROTATION_NO_BINARY)
+#define OTV0P2BASE_SIMPLESTATSROTATION_BINARY
+#endif
+
+// Compact binary stats, as an alternative to JSON where frame space is tight,
+// as written by SimpleStatsRotationBase::writeBinary() and decoded by decodeBinaryStats().
+//
+//   header byte:  MSG_BINARY_STATS_HEADER | (ID present ? 8 : 0), low 3 bits reserved as 0
+//   write count byte:  increments on each successful write, wrapping after 255
+//   ID (if present):  length byte n, with bit 7 set if hex-packed, then n bytes
+//     (hex-packed bytes are shown as two lower-case hex digits each, as for the "@" JSON field)
+//   then zero or more stats, each:
+//     key byte:  bit 7 set if the value is a delta from the last value sent for this key,
+//       bits 6..0 the key's ID in SimpleStatsSchema, or SIMPLE_STATS_SCHEMA_ID_NONE
+//       followed by a length byte and the key text
+//     value:  zig-zag LEB128 varint, eg 0 -> 0, -1 -> 1, 1 -> 2, 63 -> 126, 64 -> 0x80 0x01
+//
+// A delta is used only where shorter, only for keys in the schema,
+// and at most SIMPLE_STATS_BINARY_MAX_DELTAS times in a row for each key,
+// so that a receiver that has lost a frame gets an absolute value again soon.
+// The receiver uses the write count to spot lost frames,
+// and ignores deltas until it has an absolute value again.
+// The full byte of count means that only a run of exactly a multiple of 256 lost frames goes unseen
+// (unlike the 3-bit JSON "+" count, which would miss a run of 8).
+static const uint8_t MSG_BINARY_STATS_HEADER = 0xb0;
+static const uint8_t MSG_BINARY_STATS_HEADER_MASK = 0xf0;
+static const uint8_t MSG_BINARY_STATS_HEADER_ID_PRESENT = 8;
+static const uint8_t SIMPLE_STATS_BINARY_MAX_DELTAS = 3;
+
+// Compiled schema of well-known stats keys for binary stats, mapping each key to a small ID by position.
+// IDs go on the wire, so entries may only be appended, never reordered or removed.
+// Stats with other keys are sent with their key text.
+static constexpr SimpleStatsKey SimpleStatsSchema[] =
+  { "T|C16", "H|%", "L", "O", "B|cV", "B|mV", "v|%", "vC|%", "tT|C", "tS|C", "occ|%", "vac|h", "av", "H" };
+static constexpr uint8_t SimpleStatsSchemaSize = sizeof(SimpleStatsSchema) / sizeof(SimpleStatsSchema[0]);
+// ID marking a key not in the schema.
+static const uint8_t SIMPLE_STATS_SCHEMA_ID_NONE = 0x7f;
+static_assert(SimpleStatsSchemaSize < SIMPLE_STATS_SCHEMA_ID_NONE, "schema too large");
+
+// True if the keys are the same text; usable at compile time.
+constexpr bool simpleStatsKeysEqual(const char *const a, const char *const b)
+  { return((*a == *b) && (('\0' == *a) || simpleStatsKeysEqual(a + 1, b + 1))); }
+// Get schema ID of the given key, or SIMPLE_STATS_SCHEMA_ID_NONE if absent (or NULL); usable at compile time,
+// eg static_assert(0 == getSimpleStatsSchemaID("T|C16"), "...").
+constexpr uint8_t getSimpleStatsSchemaID(const char *const key, const uint8_t i = 0)
+  {
+  return(((NULL == key) || (i >= SimpleStatsSchemaSize)) ? SIMPLE_STATS_SCHEMA_ID_NONE :
+    (simpleStatsKeysEqual(key, SimpleStatsSchema[i]) ? i : getSimpleStatsSchemaID(key, (uint8_t)(i + 1))));
+  }
+
 // Returns true iff if a valid key for our subset of JSON.
 // Rejects keys containing " or \ or any chars outside the range [32,126]
 // to avoid having to escape anything.
@@ -121,6 +188,16 @@ class BufPrint final : public Print
     // Print a single char to a bounded buffer; returns 1 if successful, else 0 if full.
     virtual size_t write(uint8_t c) override
         { if(size < capacity) { b[size++] = c; b[size] = '\0'; return(1); } else { return(0); } }
+    // Print as many chars as will fit from buf to a bounded buffer; returns the number printed.
+    virtual size_t write(const uint8_t *buf, size_t n) override
+        {
+        const size_t space = capacity - size;
+        if(n > space) { n = space; }
+        memcpy(b + size, buf, n);
+        size += (uint8_t)n;
+        b[size] = '\0';
+        return(n);
+        }
     // True if buffer is completely full.
     bool isFull() const { return(size == capacity); }
     // Get size/chars already in the buffer, not including trailing '\0'.
@@ -148,6 +225,17 @@ class SimpleStatsRotationBase
     // True if successful, false otherwise (eg capacity already reached).
     bool put(SimpleStatsKey key, int newValue, bool statLowPriority = false);
 
+    // Create/update value for stat with given handle from intern().
+    // Does no key lookup or validation so is fast, eg for frequent updates.
+    // True if successful, false otherwise (eg handle not valid).
+    bool put(SimpleStatsHandle handle, int newValue);
+
+    // Get handle for given stat/key, creating the stat if need be as for putDescriptor().
+    // Returns SIMPLE_STATS_HANDLE_NONE if the key is invalid or capacity is already reached.
+    // The handle remains valid until the stat is removed;
+    // it may then be reused for a different stat.
+    SimpleStatsHandle intern(SimpleStatsKey key, bool statLowPriority = false);
+
     // Create/update value for the given sensor.
     // True if successful, false otherwise (eg capacity already reached).
     template <class T> bool put(const OTV0P2BASE::Sensor<T> &s, bool statLowPriority = false)
@@ -209,10 +297,36 @@ class SimpleStatsRotationBase
                       const bool maximise = false, const bool suppressClearChanged = false);
 //#endif
 
+#ifdef OTV0P2BASE_SIMPLESTATSROTATION_BINARY
+    // Write stats in compact binary format (see MSG_BINARY_STATS_HEADER) to provided buffer;
+    // returns the non-zero length if successful.
+    // Stats are selected as for writeJSON(), with the same rotation state,
+    // so typically many more fit in a frame.
+    // The ID is included unless set to an empty string; the write count is always included.
+    // Each successful write should be transmitted, else the receiver may see deltas it cannot apply.
+    //
+    //   * buf  is the byte buffer to write to; never NULL
+    //   * bufSize is the capacity of the buffer starting at buf in bytes, ie the maximum output length
+    //   * other parameters as for writeJSON()
+    uint8_t writeBinary(uint8_t * const buf, const uint8_t bufSize, const uint8_t sensitivity,
+                        const bool maximise = false, const bool suppressClearChanged = false);
+#endif
+
   protected:
     struct DescValueTuple final
       {
-      DescValueTuple() : descriptor(NULL), value(0) { }
+      DescValueTuple() : descriptor(NULL), value(0), handle(SIMPLE_STATS_HANDLE_NONE), fragmentLength(0)
+#ifdef OTV0P2BASE_SIMPLESTATSROTATION_BINARY
+        , lastSent(0), deltaRun(NO_DELTA_BASE), schemaID(SCHEMA_ID_UNKNOWN)
+#endif
+        { }
+
+#ifdef OTV0P2BASE_SIMPLESTATSROTATION_BINARY
+      // deltaRun value when there is no last-sent binary value.
+      static const uint8_t NO_DELTA_BASE = 0xff;
+      // schemaID value when not yet looked up.
+      static const uint8_t SCHEMA_ID_UNKNOWN = 0xff;
+#endif
 
       // Descriptor of this stat.
       GenericStatsDescriptor descriptor;
@@ -220,6 +334,26 @@ class SimpleStatsRotationBase
       // Value.
       int value;
 
+      // Handle for this stat; fixed while the stat exists.
+      SimpleStatsHandle handle;
+
+      // Length of rendered "key":value text, or 0 if not yet computed since last change.
+      uint8_t fragmentLength;
+#ifdef OTV0P2BASE_SIMPLESTATSROTATION_FRAGMENT_CACHE
+      // Rendered "key":value text (not null-terminated)
+      // valid iff fragmentLength is non-zero and no larger than this buffer.
+      char fragment[MSG_JSON_ABS_MAX_LENGTH];
+#endif
+
+#ifdef OTV0P2BASE_SIMPLESTATSROTATION_BINARY
+      // Value last sent by writeBinary(), valid unless deltaRun is NO_DELTA_BASE.
+      int lastSent;
+      // Number of deltas sent in a row by writeBinary() since the last absolute value.
+      uint8_t deltaRun;
+      // Cached ID in SimpleStatsSchema, SIMPLE_STATS_SCHEMA_ID_NONE, or SCHEMA_ID_UNKNOWN.
+      uint8_t schemaID;
+#endif
+
       // Various run-time flags.
       struct Flags
         {
@@ -244,8 +378,9 @@ class SimpleStatsRotationBase
     DescValueTuple *findByKey(SimpleStatsKey key) const;
 
     // Initialise base with appropriate storage (non-NULL) and capacity knowledge.
-    SimpleStatsRotationBase(DescValueTuple *_stats, const uint8_t _capacity)
-      : capacity(_capacity), stats(_stats), nStats(0),
+    // The handle index must have space for capacity entries, all zeroed (eg value-initialised) before use.
+    SimpleStatsRotationBase(DescValueTuple *_stats, uint8_t *_handleIndex, const uint8_t _capacity)
+      : capacity(_capacity), stats(_stats), handleIndex(_handleIndex), nStats(0),
         lastTXed(~0), lastTXedLoPri(~0), lastTXedHiPri(~0), // Show the first item on the first pass...
         id(NULL)
       { }
@@ -255,6 +390,12 @@ class SimpleStatsRotationBase
     // The initial nStats slots are used.
     DescValueTuple * const stats;
 
+    // Position in stats[] of the stat for each handle; never NULL.
+    // An entry is only valid if it points to a live stat with that handle,
+    // so needs no clearing on removal, but must be zeroed by the owner before first use
+    // as findByHandle() reads (and then validates) entries before their handles are issued.
+    uint8_t * const handleIndex;
+
     // Number of stats being managed (packed at the start of the stats[] array).
     uint8_t nStats;
 
@@ -278,8 +419,9 @@ class SimpleStatsRotationBase
 
     // Small write counter (and flag to enable its display).
     // Helps to track lost transmissions of generated stats.
-    // Count field increments after a successful write,
-    // and wraps back to zero after 7 (to limit space on the wire);
+    // Count field increments after a successful write;
+    // the JSON "+" field shows only the bottom 3 bits (to limit space on the wire)
+    // and writeBinary() sends all 8;
     // is displayed immediately after the @/ID field when enabled,
     // and missing count values suggest a lost transmission somewhere.
     // Takes minimal space (1 byte).
@@ -287,11 +429,41 @@ class SimpleStatsRotationBase
       {
       WriteCount() : enabled(0), count(0) { }
       bool enabled /* : 1 */; // 1 if display of counter is enabled, else 0.
-      uint8_t count : 3; // Increments on each successful write.
+      uint8_t count; // Increments on each successful write.
       } c;
 
+    // Returns stat for given handle if valid, else NULL.
+    DescValueTuple *findByHandle(SimpleStatsHandle handle) const
+      {
+      if(handle >= capacity) { return(NULL); }
+      const uint8_t i = handleIndex[handle];
+      if((i >= nStats) || (handle != stats[i].handle)) { return(NULL); }
+      return(stats + i);
+      }
+
+    // Add new default stat at the end with a fresh handle; returns NULL if full.
+    DescValueTuple *append();
+
+    // Get length of rendered "key":value text, computing and caching it if need be.
+    uint8_t getFragmentLength(DescValueTuple &dvt);
+
     // Print an object field "name":value to the given buffer.
-    size_t print(BufPrint &bp, const DescValueTuple &dvt, bool &commaPending) const;
+    size_t print(BufPrint &bp, DescValueTuple &dvt, bool &commaPending);
+
+#ifdef OTV0P2BASE_SIMPLESTATSROTATION_BINARY
+    // Encode a stat for writeBinary() to out if non-NULL, returning the length.
+    // If writing, also records the value sent.
+    uint8_t encodeBinary(DescValueTuple &dvt, uint8_t *out);
+#endif
+
+    // Output format adaptors for selectStats().
+    class JSONOutput;
+#ifdef OTV0P2BASE_SIMPLESTATSROTATION_BINARY
+    class BinaryOutput;
+#endif
+
+    // Select and write stats in priority/rotation order to out while they fit within limit bytes in total.
+    template<class Output> void selectStats(Output &out, int limit, bool maximise, bool suppressClearChanged);
   };
 
 template<uint8_t MaxStats>
@@ -302,14 +474,41 @@ class SimpleStatsRotation final : public SimpleStatsRotationBase
     // A copy is taken of the user-supplied set of descriptions, preserving order.
     DescValueTuple stats[MaxStats];
 
+    // Position in stats[] for each handle.
+    // Zeroed on construction as findByHandle() reads it (and then validates the result) before any handle is issued.
+    uint8_t handleIndex[MaxStats];
+
   public:
-    SimpleStatsRotation() : SimpleStatsRotationBase(stats, MaxStats) { }
+    SimpleStatsRotation() : SimpleStatsRotationBase(stats, handleIndex, MaxStats), handleIndex() { }
 
     // Get capacity.
     uint8_t getCapacity() { return(MaxStats); }
   };
 
 
+// Receiver state for decodeBinaryStats() for one sender: the last value of each schema key.
+// Initially empty.
+struct BinaryStatsDecodeState final
+  {
+  // Last value received for each schema key, valid iff its bit is set in haveLast.
+  int32_t last[SimpleStatsSchemaSize];
+  uint32_t haveLast = 0;
+  // Write count byte of the last frame, valid iff haveCount.
+  uint8_t lastCount = 0;
+  bool haveCount = false;
+  static_assert(SimpleStatsSchemaSize <= 32, "haveLast too small");
+  };
+
+// Decode binary stats at buf[0,buflen) from one sender to JSON text in json[0,jsonSize) with a trailing '\0',
+// updating that sender's state.
+// The JSON has an "@" field if the ID is present, then a "+" field with the full write count byte,
+// then the stats in the order sent.
+// Stats sent as deltas that cannot be applied, eg after a lost frame, are omitted,
+// and the number of such stats is put in skipped if non-NULL.
+// Returns the non-zero JSON length if successful, else 0 (eg malformed message or json too small).
+uint8_t decodeBinaryStats(const uint8_t *buf, uint8_t buflen, BinaryStatsDecodeState &state,
+                          char *json, uint8_t jsonSize, uint8_t *skipped = NULL);
+
 // Returns true unless the buffer clearly does not contain a possible valid raw JSON message.
 // This message is expected to be one object wrapped in '{' and '}'
 // and containing only ASCII printable/non-control characters in the range [32,126].
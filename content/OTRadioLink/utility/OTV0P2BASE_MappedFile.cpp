@@ -0,0 +1,75 @@
+/*
+The OpenTRV project licenses this file to you
+under the Apache Licence, Version 2.0 (the "Licence");
+you may not use this file except in compliance
+with the Licence. You may obtain a copy of the Licence at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing,
+software distributed under the Licence is distributed on an
+"AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+KIND, either express or implied. See the Licence for the
+specific language governing permissions and limitations
+under the Licence.
+
+Author(s) / Copyright (s): Damon Hart-Davis 2016
+*/
+
+/*
+ * Read-only memory-mapped file for hosted tools and tests.
+ */
+
+#include "OTV0P2BASE_MappedFile.h"
+
+#ifdef OTV0P2BASE_PLATFORM_HAS_mmap
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+namespace OTV0P2BASE
+{
+
+
+// Map the named file, closing any currently open first; returns true on success.
+bool MappedFile::open(const char *const path)
+  {
+  close();
+  if(NULL == path) { return(false); } // FAIL
+  const int fd = ::open(path, O_RDONLY);
+  if(fd < 0) { return(false); } // FAIL
+  struct stat st;
+  if((0 != fstat(fd, &st)) || (st.st_size < 0)) { ::close(fd); return(false); } // FAIL
+  const size_t len = (size_t)st.st_size;
+  if(0 != len)
+    {
+    void *const p = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(MAP_FAILED == p) { ::close(fd); return(false); } // FAIL
+#ifdef MADV_SEQUENTIAL
+    madvise(p, len, MADV_SEQUENTIAL);
+#endif
+    data = (const uint8_t *)p;
+    }
+  // The mapping remains valid once the descriptor is closed.
+  ::close(fd);
+  size = len;
+  opened = true;
+  return(true);
+  }
+
+// Unmap any open file; idempotent.
+void MappedFile::close()
+  {
+  if(NULL != data) { munmap((void *)data, size); }
+  data = NULL;
+  size = 0;
+  opened = false;
+  }
+
+
+}
+
+#endif // OTV0P2BASE_PLATFORM_HAS_mmap
@@ -0,0 +1,83 @@
+/*
+The OpenTRV project licenses this file to you
+under the Apache Licence, Version 2.0 (the "Licence");
+you may not use this file except in compliance
+with the Licence. You may obtain a copy of the Licence at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing,
+software distributed under the Licence is distributed on an
+"AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+KIND, either express or implied. See the Licence for the
+specific language governing permissions and limitations
+under the Licence.
+
+Author(s) / Copyright (s): Damon Hart-Davis 2016
+*/
+
+/*
+ * Read-only memory-mapped file for hosted tools and tests,
+ * eg for streaming through large recorded data sets without copying.
+ *
+ * Only available where POSIX mmap() is, flagged by OTV0P2BASE_PLATFORM_HAS_mmap.
+ */
+
+#ifndef OTV0P2BASE_MAPPEDFILE_H
+#define OTV0P2BASE_MAPPEDFILE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if !defined(ARDUINO) && (defined(__unix__) || defined(__APPLE__))
+#define OTV0P2BASE_PLATFORM_HAS_mmap
+#endif
+
+#ifdef OTV0P2BASE_PLATFORM_HAS_mmap
+
+namespace OTV0P2BASE
+{
+
+
+// Whole file mapped read-only into memory; closed on destruction.
+// An empty file opens successfully with a size of zero and NULL data.
+// Not copyable.
+class MappedFile final
+  {
+  private:
+    // Start of mapped data; NULL if none.
+    const uint8_t *data;
+    // Size of mapped data in bytes.
+    size_t size;
+    // True if open.
+    bool opened;
+
+  public:
+    MappedFile() : data(NULL), size(0), opened(false) { }
+    // Open the named file, testing isOpen() for success.
+    explicit MappedFile(const char *const path) : data(NULL), size(0), opened(false) { open(path); }
+    ~MappedFile() { close(); }
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    // Map the named file, closing any currently open first; returns true on success.
+    // Advises the OS that access will mainly be sequential.
+    bool open(const char *path);
+
+    // Unmap any open file; idempotent.
+    void close();
+
+    // True if a file is open.
+    bool isOpen() const { return(opened); }
+
+    // Mapped data and its size in bytes.
+    const uint8_t *getData() const { return(data); }
+    size_t getSize() const { return(size); }
+  };
+
+
+}
+
+#endif // OTV0P2BASE_PLATFORM_HAS_mmap
+
+#endif
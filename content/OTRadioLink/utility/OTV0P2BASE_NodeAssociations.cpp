@@ -0,0 +1,119 @@
+/*
+The OpenTRV project licenses this file to you
+under the Apache Licence, Version 2.0 (the "Licence");
+you may not use this file except in compliance
+with the Licence. You may obtain a copy of the Licence at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing,
+software distributed under the Licence is distributed on an
+"AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+KIND, either express or implied. See the Licence for the
+specific language governing permissions and limitations
+under the Licence.
+
+Author(s) / Copyright (s): Damon Hart-Davis 2016
+*/
+
+/*
+ Pluggable node association lookup, including a RAM-resident sorted index.
+ */
+
+#include <string.h>
+
+#include "OTV0P2BASE_NodeAssociations.h"
+
+
+namespace OTV0P2BASE
+{
+
+
+// Returns the position in sorted of the first entry whose ID (first prefixLen bytes) is not less than prefix.
+uint16_t NodeAssociationIndexBase::lowerBound(const uint8_t *const prefix, const uint8_t prefixLen) const
+    {
+    uint16_t lo = 0;
+    uint16_t hi = nodes;
+    while(lo < hi)
+        {
+        const uint16_t mid = lo + ((hi - lo) >> 1);
+        if(memcmp(ids[sorted[mid]], prefix, prefixLen) < 0) { lo = mid + 1; }
+        else { hi = mid; }
+        }
+    return(lo);
+    }
+
+// Returns the lowest association index >= index whose node ID starts with the given prefix, or -1 if none.
+int16_t NodeAssociationIndexBase::getNextMatchingNodeID(const uint16_t index, const uint8_t *const prefix, const uint8_t prefixLen, uint8_t *const nodeID) const
+    {
+    // Validate inputs.
+    if(index >= nodes) { return(-1); }
+    if(prefixLen > OpenTRV_Node_ID_Bytes) { return(-1); }
+    if((NULL == prefix) && (0 != prefixLen)) { return(-1); }
+
+    int16_t result = -1;
+    if(0 == prefixLen)
+        {
+        // Everything matches, so the first candidate is the answer.
+        result = (int16_t)index;
+        }
+    else
+        {
+        // All matches are contiguous in sorted order but not necessarily in index order,
+        // so pick the lowest qualifying index from the run of matches.
+        for(uint16_t pos = lowerBound(prefix, prefixLen); pos < nodes; ++pos)
+            {
+            const uint16_t i = sorted[pos];
+            if(0 != memcmp(ids[i], prefix, prefixLen)) { break; } // Past the end of the matches.
+            if((i >= index) && ((result < 0) || (i < (uint16_t)result))) { result = (int16_t)i; }
+            }
+        if(result < 0) { return(-1); }
+        }
+
+    if(NULL != nodeID) { memcpy(nodeID, ids[result], OpenTRV_Node_ID_Bytes); }
+    return(result);
+    }
+
+// Append a new association, returning its index or -1 if full or ID is NULL.
+int16_t NodeAssociationIndexBase::addNodeAssociation(const uint8_t *const nodeID)
+    {
+    if(NULL == nodeID) { return(-1); } // FAIL: bad args.
+    if(nodes >= maxNodes) { return(-1); } // FAIL: no space.
+    const uint16_t i = nodes;
+    memcpy(ids[i], nodeID, OpenTRV_Node_ID_Bytes);
+    // Insert after any equal IDs so that equal IDs stay in index order.
+    uint16_t pos = lowerBound(nodeID, OpenTRV_Node_ID_Bytes);
+    while((pos < nodes) && (0 == memcmp(ids[sorted[pos]], nodeID, OpenTRV_Node_ID_Bytes))) { ++pos; }
+    memmove(sorted + pos + 1, sorted + pos, (nodes - pos) * sizeof(sorted[0]));
+    sorted[pos] = i;
+    ++nodes;
+    return((int16_t)i);
+    }
+
+// Get node ID of association at specified index; returns true if successful.
+bool NodeAssociationIndexBase::getNodeAssociation(const uint16_t index, uint8_t *const nodeID) const
+    {
+    if((NULL == nodeID) || (index >= nodes)) { return(false); } // FAIL: bad args.
+    memcpy(nodeID, ids[index], OpenTRV_Node_ID_Bytes);
+    return(true);
+    }
+
+#ifdef ARDUINO_ARCH_AVR
+// Reload the index from the EEPROM node associations table.
+// Returns false if not all the EEPROM associations would fit, though the index is still usable.
+bool NodeAssociationIndexBase::loadFromEEPROM()
+    {
+    clear();
+    const uint8_t n = OTV0P2BASE::countNodeAssociations();
+    for(uint8_t i = 0; i < n; ++i)
+        {
+        uint8_t id[OpenTRV_Node_ID_Bytes];
+        if(!OTV0P2BASE::getNodeAssociation(i, id)) { return(false); } // FAIL
+        if(addNodeAssociation(id) < 0) { return(false); } // FAIL: out of space.
+        }
+    return(true);
+    }
+#endif // ARDUINO_ARCH_AVR
+
+
+}
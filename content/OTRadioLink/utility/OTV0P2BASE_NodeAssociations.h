@@ -0,0 +1,138 @@
+/*
+The OpenTRV project licenses this file to you
+under the Apache Licence, Version 2.0 (the "Licence");
+you may not use this file except in compliance
+with the Licence. You may obtain a copy of the Licence at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing,
+software distributed under the Licence is distributed on an
+"AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+KIND, either express or implied. See the Licence for the
+specific language governing permissions and limitations
+under the Licence.
+
+Author(s) / Copyright (s): Damon Hart-Davis 2016
+*/
+
+/*
+ Pluggable node association lookup, including a RAM-resident sorted index.
+
+ The association index (the position of an entry in the table)
+ is the same as for the EEPROM node associations table
+ so that per-association state such as RX message counters can be found from it.
+ */
+
+#ifndef OTV0P2BASE_NODEASSOCIATIONS_H
+#define OTV0P2BASE_NODEASSOCIATIONS_H
+
+#include <stdint.h>
+
+#include "OTV0P2BASE_Security.h"
+
+
+namespace OTV0P2BASE
+{
+
+
+// Abstract node association lookup by (partial) node ID.
+class NodeAssociationLookupBase
+    {
+    public:
+        // Returns the lowest association index >= index whose node ID starts with the given prefix, or -1 if none.
+        //   * index  index to start searching from
+        //   * prefix  prefix to match; can be NULL iff prefixLen == 0
+        //   * prefixLen  length of prefix, [0,8] bytes
+        //   * nodeID  if non-NULL, 8-byte buffer filled with the full matching ID; not preserved if -1 is returned
+        virtual int16_t getNextMatchingNodeID(uint16_t index, const uint8_t *prefix, uint8_t prefixLen, uint8_t *nodeID) const = 0;
+
+        // Returns the number of associations present.
+        virtual uint16_t countNodeAssociations() const = 0;
+    };
+
+#ifdef ARDUINO_ARCH_AVR
+// Lookup directly against the EEPROM node associations table,
+// with a linear scan of the EEPROM on each lookup.
+// Needs no RAM, but each lookup may read many EEPROM bytes.
+#define NodeAssociationLookupEEPROM_DEFINED
+class NodeAssociationLookupEEPROM final : public NodeAssociationLookupBase
+    {
+    public:
+        virtual int16_t getNextMatchingNodeID(const uint16_t index, const uint8_t *const prefix, const uint8_t prefixLen, uint8_t *const nodeID) const override
+            { return((index > 127) ? -1 : OTV0P2BASE::getNextMatchingNodeID((uint8_t)index, prefix, prefixLen, nodeID)); }
+        virtual uint16_t countNodeAssociations() const override { return(OTV0P2BASE::countNodeAssociations()); }
+    };
+#endif // ARDUINO_ARCH_AVR
+
+// RAM-resident node association index, with IDs kept sorted for O(log n) prefix lookup.
+// Lookup cost is O(log n + m) where m is the number of entries matching the prefix,
+// which is usually 1 for prefixes of 4 or more bytes as used in secure frame headers.
+// Adding an entry is O(n), so bulk loading is O(n^2), which is acceptable for thousands of entries.
+// Storage is supplied by the derived class so that this logic is not duplicated per size.
+// Not thread-/ISR- safe.
+class NodeAssociationIndexBase : public NodeAssociationLookupBase
+    {
+    private:
+        // Node IDs in association index order; maxNodes entries.
+        uint8_t (*const ids)[OpenTRV_Node_ID_Bytes];
+        // Association indexes in ascending node ID order; maxNodes entries, nodes valid.
+        uint16_t *const sorted;
+        // Maximum and current number of associations.
+        const uint16_t maxNodes;
+        uint16_t nodes;
+
+        // Returns the position in sorted of the first entry whose ID (first prefixLen bytes) is not less than prefix.
+        uint16_t lowerBound(const uint8_t *prefix, uint8_t prefixLen) const;
+
+    protected:
+        NodeAssociationIndexBase(uint8_t (*const ids_)[OpenTRV_Node_ID_Bytes], uint16_t *const sorted_, const uint16_t maxNodes_)
+          : ids(ids_), sorted(sorted_), maxNodes(maxNodes_), nodes(0) { }
+
+    public:
+        virtual int16_t getNextMatchingNodeID(uint16_t index, const uint8_t *prefix, uint8_t prefixLen, uint8_t *nodeID) const override;
+        virtual uint16_t countNodeAssociations() const override { return(nodes); }
+
+        // Returns maximum number of associations that can be held.
+        uint16_t maxNodeAssociations() const { return(maxNodes); }
+
+        // Remove all associations.
+        void clear() { nodes = 0; }
+
+        // Append a new association, returning its index or -1 if full or ID is NULL.
+        // As for the EEPROM table, does not check for an existing association with the same ID.
+        int16_t addNodeAssociation(const uint8_t *nodeID);
+
+        // Get node ID of association at specified index; returns true if successful.
+        //   * nodeID  8-byte buffer to receive ID; never NULL
+        bool getNodeAssociation(uint16_t index, uint8_t *nodeID) const;
+
+#ifdef ARDUINO_ARCH_AVR
+        // Reload the index from the EEPROM node associations table.
+        // Must be called after the EEPROM table is changed (eg by addNodeAssociation()) to keep in sync.
+        // Returns false if not all the EEPROM associations would fit, though the index is still usable.
+        bool loadFromEEPROM();
+#endif // ARDUINO_ARCH_AVR
+    };
+
+// RAM-resident node association index with capacity for maxAssociations associations.
+// Needs 10 bytes of RAM per association plus a little overhead,
+// so on AVR maxAssociations should normally be V0P2BASE_EE_NODE_ASSOCIATIONS_MAX_SETS,
+// but hosted builds (eg hubs) can use thousands.
+#define NodeAssociationIndex_DEFINED
+template<uint16_t maxAssociations>
+class NodeAssociationIndex final : public NodeAssociationIndexBase
+    {
+    static_assert(maxAssociations > 0, "must allow at least one association");
+    static_assert(maxAssociations <= 0x7fff, "association index must fit in int16_t");
+    private:
+        uint8_t _ids[maxAssociations][OpenTRV_Node_ID_Bytes];
+        uint16_t _sorted[maxAssociations];
+    public:
+        NodeAssociationIndex() : NodeAssociationIndexBase(_ids, _sorted, maxAssociations) { }
+    };
+
+
+}
+
+#endif
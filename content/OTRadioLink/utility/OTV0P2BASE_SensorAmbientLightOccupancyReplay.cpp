@@ -0,0 +1,221 @@
+/*
+The OpenTRV project licenses this file to you
+under the Apache Licence, Version 2.0 (the "Licence");
+you may not use this file except in compliance
+with the Licence. You may obtain a copy of the Licence at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing,
+software distributed under the Licence is distributed on an
+"AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+KIND, either express or implied. See the Licence for the
+specific language governing permissions and limitations
+under the Licence.
+
+Author(s) / Copyright (s): Damon Hart-Davis 2016
+*/
+
+/*
+ Hosted replay of recorded ambient light traces through an occupancy detector.
+ */
+
+#ifndef ARDUINO_ARCH_AVR
+
+#include <limits.h>
+#include <string.h>
+#include <deque>
+#include "OTV0P2BASE_SensorAmbientLightOccupancyReplay.h"
+
+
+namespace OTV0P2BASE
+{
+
+
+constexpr uint16_t SensorAmbientLightOccupancyReplay::DEFAULT_MAX_HOLD_M;
+constexpr uint8_t SensorAmbientLightOccupancyReplay::DEFAULT_TOLERANCE_M;
+constexpr uint8_t SensorAmbientLightOccupancyReplay::OCCUPIED_MIN;
+
+// Parse buf[0,len), selecting only records from the given node if nodeIDOrNULL is non-NULL.
+SensorAmbientLightTraceParser::SensorAmbientLightTraceParser(const char *const buf, const size_t len, const char *const nodeIDOrNULL)
+  : pos(buf), end(buf + ((NULL == buf) ? 0 : len)),
+    nodeID(nodeIDOrNULL), nodeIDLen((NULL == nodeIDOrNULL) ? 0 : strlen(nodeIDOrNULL))
+  { }
+
+// Convert a UTC date and time to minutes since 1970-01-01T00:00Z; proleptic Gregorian calendar.
+// Days are computed in 400-year eras starting in March so that leap days fall at the end of each year.
+long SensorAmbientLightTraceParser::toMinutes(int year, const uint8_t month, const uint8_t day, const uint8_t hour, const uint8_t minute)
+  {
+  if(month <= 2) { --year; }
+  const long era = ((year >= 0) ? year : (year - 399)) / 400;
+  const long yoe = year - (era * 400); // [0,399]
+  const long doy = ((153 * (month + ((month > 2) ? -3 : 9))) + 2) / 5 + day - 1; // [0,365]
+  const long doe = (yoe * 365) + (yoe / 4) - (yoe / 100) + doy; // [0,146096]
+  const long days = (era * 146097) + doe - 719468;
+  return((((days * 24) + hour) * 60) + minute);
+  }
+
+// Parse n ASCII decimal digits at p; returns -1 if any is not a digit.
+static int parseDigits(const char *const p, const uint8_t n)
+  {
+  int v = 0;
+  for(uint8_t i = 0; i < n; ++i)
+    {
+    const char c = p[i];
+    if((c < '0') || (c > '9')) { return(-1); }
+    v = (v * 10) + (c - '0');
+    }
+  return(v);
+  }
+
+static inline bool isBlank(const char c) { return((' ' == c) || ('\t' == c)); }
+
+// Get the next valid record, returning false at the end of the trace.
+bool SensorAmbientLightTraceParser::next(long &minute, uint8_t &value)
+  {
+  while(pos < end)
+    {
+    const char *const line = pos;
+    const char *eol = (const char *)memchr(line, '\n', end - line);
+    if(NULL == eol) { eol = end; }
+    pos = (eol < end) ? (eol + 1) : end;
+
+    // Timestamp: YYYY-MM-DDTHH:MM with any seconds and zone ignored.
+    if(eol - line < 16) { continue; }
+    const int Y = parseDigits(line, 4);
+    const int mo = parseDigits(line + 5, 2);
+    const int d = parseDigits(line + 8, 2);
+    const int H = parseDigits(line + 11, 2);
+    const int M = parseDigits(line + 14, 2);
+    if((Y < 0) || (mo < 1) || (mo > 12) || (d < 1) || (d > 31) || (H < 0) || (H > 23) || (M < 0) || (M > 59)) { continue; }
+    if(('-' != line[4]) || ('-' != line[7]) || ('T' != line[10]) || (':' != line[13])) { continue; }
+    const char *p = line + 16;
+    while((p < eol) && !isBlank(*p)) { ++p; }
+
+    // Node ID.
+    while((p < eol) && isBlank(*p)) { ++p; }
+    const char *const id = p;
+    while((p < eol) && !isBlank(*p)) { ++p; }
+    if(p == id) { continue; }
+    if((NULL != nodeID) && (((size_t)(p - id) != nodeIDLen) || (0 != memcmp(id, nodeID, nodeIDLen)))) { continue; }
+
+    // Value.
+    while((p < eol) && isBlank(*p)) { ++p; }
+    const char *const v = p;
+    int val = 0;
+    while((p < eol) && (*p >= '0') && (*p <= '9') && (val <= 255)) { val = (val * 10) + (*p++ - '0'); }
+    if((p == v) || (val > 255)) { continue; }
+    while((p < eol) && (isBlank(*p) || ('\r' == *p))) { ++p; }
+    if(p != eol) { continue; }
+
+    minute = toMinutes(Y, (uint8_t)mo, (uint8_t)d, (uint8_t)H, (uint8_t)M);
+    value = (uint8_t)val;
+    return(true);
+    }
+  return(false);
+  }
+
+// Replay light trace lTrace[0,lLen) through detector scoring against occupancy trace oTrace[0,oLen).
+SensorAmbientLightOccupancyReplayScore SensorAmbientLightOccupancyReplay::replay(SensorAmbientLightOccupancyDetectorInterface &detector,
+        const char *const lTrace, const size_t lLen,
+        const char *const oTrace, const size_t oLen,
+        const char *const nodeIDOrNULL) const
+  {
+  SensorAmbientLightOccupancyReplayScore score;
+
+  // Ground truth is read just far enough ahead to match each detection.
+  // Pending occupied records are those not yet too old to match a detection, with a flag set once matched.
+  SensorAmbientLightTraceParser gt(oTrace, oLen, nodeIDOrNULL);
+  long gtMinute;
+  uint8_t gtValue;
+  bool gtHave = gt.next(gtMinute, gtValue);
+  std::deque<std::pair<long, bool> > pending;
+  auto pullGroundTruth = [&](const long upTo)
+    {
+    while(gtHave && (gtMinute <= upTo))
+      {
+      if(gtValue >= OCCUPIED_MIN) { pending.push_back(std::make_pair(gtMinute, false)); ++score.groundTruthOccupied; }
+      gtHave = gt.next(gtMinute, gtValue);
+      }
+    };
+  auto retireGroundTruth = [&](const long before)
+    {
+    while(!pending.empty() && (pending.front().first < before))
+      {
+      if(pending.front().second) { ++score.groundTruthDetected; }
+      pending.pop_front();
+      }
+    };
+
+  // Smoothed typical level by hour of day from previous days, 0xff if not yet known.
+  uint8_t byHour[24];
+  memset(byHour, 0xff, sizeof(byHour));
+  // Hour (since the epoch) being accumulated, and its running level sum and count.
+  long hour = -1;
+  uint32_t hourSum = 0;
+  uint16_t hourCount = 0;
+
+  // Run the detector for one minute.
+  auto tick = [&](const long minute, const uint8_t level)
+    {
+    const long h = minute / 60;
+    if(h != hour)
+      {
+      // Fold the completed hour into the smoothed typical levels, keeping 0xff as 'not known'.
+      if((hour >= 0) && (0 != hourCount))
+        {
+        const uint8_t mean = (uint8_t)fnmin((hourSum + (hourCount >> 1)) / hourCount, (uint32_t)254);
+        uint8_t &s = byHour[hour % 24];
+        s = (0xff == s) ? mean : (uint8_t)(((7 * (uint16_t)s) + mean + 4) >> 3);
+        }
+      hour = h;
+      hourSum = 0;
+      hourCount = 0;
+      uint8_t mn = 0xff, mx = 0;
+      for(uint8_t i = 0; i < 24; ++i) { if(0xff != byHour[i]) { mn = fnmin(mn, byHour[i]); mx = fnmax(mx, byHour[i]); } }
+      detector.setTypMinMax(byHour[h % 24], mn, (0xff == mn) ? 0xff : mx, sensitive);
+      }
+    hourSum += level;
+    ++hourCount;
+
+    ++score.updates;
+    if(!detector.update(level)) { return; }
+    ++score.detections;
+    pullGroundTruth(minute + toleranceM);
+    retireGroundTruth(minute - toleranceM);
+    if(!pending.empty())
+      {
+      ++score.truePositives;
+      for(auto &p : pending) { p.second = true; }
+      }
+    };
+
+  SensorAmbientLightTraceParser lt(lTrace, lLen, nodeIDOrNULL);
+  long minute;
+  uint8_t value;
+  long prevMinute = LONG_MIN;
+  uint8_t prevLevel = 0;
+  while(lt.next(minute, value))
+    {
+    // Out-of-order records are dropped.
+    if(minute < prevMinute) { continue; }
+    const uint8_t level = fnmin(value, (uint8_t)254);
+    // Hold the previous level for each minute of any short gap.
+    if((LONG_MIN != prevMinute) && (minute - prevMinute <= maxHoldM))
+      { for(long m = prevMinute + 1; m < minute; ++m) { tick(m, prevLevel); } }
+    tick(minute, level);
+    ++score.samples;
+    prevMinute = minute;
+    prevLevel = level;
+    }
+
+  // Account for all remaining ground truth.
+  pullGroundTruth(LONG_MAX);
+  retireGroundTruth(LONG_MAX);
+  return(score);
+  }
+
+
+}
+
+#endif // ARDUINO_ARCH_AVR
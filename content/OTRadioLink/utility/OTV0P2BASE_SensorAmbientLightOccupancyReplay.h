@@ -0,0 +1,148 @@
+/*
+The OpenTRV project licenses this file to you
+under the Apache Licence, Version 2.0 (the "Licence");
+you may not use this file except in compliance
+with the Licence. You may obtain a copy of the Licence at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing,
+software distributed under the Licence is distributed on an
+"AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+KIND, either express or implied. See the Licence for the
+specific language governing permissions and limitations
+under the Licence.
+
+Author(s) / Copyright (s): Damon Hart-Davis 2016
+*/
+
+/*
+ Hosted replay of recorded ambient light traces through an occupancy detector,
+ scored against recorded occupancy, to evaluate detector variants
+ over long periods and many rooms.
+
+ Traces are text with one record per line as extracted from the general logs, eg:
+
+     2016-10-08T09:33:12Z 96F0CED3B4E690E8 134
+
+ ie UTC timestamp, node ID and value, as in portableUnitTests/OTV0p2Base/20161009TestData/.
+ Light (L) traces carry levels [0,254]; occupancy (O) traces carry [0,3].
+
+ Not for AVR: uses heap allocation.
+ */
+
+#ifndef OTV0P2BASE_SENSORAMBLIGHTOCCUPANCYREPLAY_H
+#define OTV0P2BASE_SENSORAMBLIGHTOCCUPANCYREPLAY_H
+
+#ifndef ARDUINO_ARCH_AVR
+
+#include <stddef.h>
+#include <stdint.h>
+#include "OTV0P2BASE_SensorAmbientLightOccupancy.h"
+
+
+namespace OTV0P2BASE
+{
+
+
+// Streaming parser over an in-memory (eg memory-mapped) text trace.
+// Does no allocation and does not require the buffer to be terminated.
+// Silently skips malformed lines and (if a node ID is given) other nodes' records.
+class SensorAmbientLightTraceParser final
+  {
+  private:
+    const char *pos;
+    const char *const end;
+    // Node ID to select, or NULL for all.
+    const char *const nodeID;
+    const size_t nodeIDLen;
+
+  public:
+    // Parse buf[0,len), selecting only records from the given node if nodeIDOrNULL is non-NULL.
+    SensorAmbientLightTraceParser(const char *buf, size_t len, const char *nodeIDOrNULL = NULL);
+
+    // Get the next valid record, returning false at the end of the trace.
+    //   * minute  minutes since 1970-01-01T00:00Z (UTC), seconds discarded
+    //   * value  recorded value [0,255]
+    bool next(long &minute, uint8_t &value);
+
+    // Convert a UTC date and time to minutes since 1970-01-01T00:00Z; proleptic Gregorian calendar.
+    static long toMinutes(int year, uint8_t month, uint8_t day, uint8_t hour, uint8_t minute);
+  };
+
+// Result of a replay.
+//
+// A detection is counted as correct (a true positive)
+// if within the tolerance of at least one occupied ground-truth record,
+// and an occupied ground-truth record counts as detected
+// if within the tolerance of at least one detection.
+struct SensorAmbientLightOccupancyReplayScore final
+  {
+  // Light-level records replayed.
+  uint32_t samples = 0;
+  // Calls to update(), including for minutes between records.
+  uint32_t updates = 0;
+  // Occupancy detections, ie update() calls returning true.
+  uint32_t detections = 0;
+  // Detections close to an occupied ground-truth record.
+  uint32_t truePositives = 0;
+  // Ground-truth records indicating occupancy.
+  uint32_t groundTruthOccupied = 0;
+  // Occupied ground-truth records close to a detection.
+  uint32_t groundTruthDetected = 0;
+
+  uint32_t falsePositives() const { return(detections - truePositives); }
+  // Fraction of detections that are true positives, or 0 if none.
+  float precision() const { return((0 == detections) ? 0 : (truePositives / (float)detections)); }
+  // Fraction of occupied ground-truth records detected, or 0 if none.
+  float recall() const { return((0 == groundTruthOccupied) ? 0 : (groundTruthDetected / (float)groundTruthOccupied)); }
+
+  // Accumulate another score, eg from another room.
+  SensorAmbientLightOccupancyReplayScore &operator+=(const SensorAmbientLightOccupancyReplayScore &o)
+    {
+    samples += o.samples; updates += o.updates; detections += o.detections; truePositives += o.truePositives;
+    groundTruthOccupied += o.groundTruthOccupied; groundTruthDetected += o.groundTruthDetected;
+    return(*this);
+    }
+  };
+
+// Replays one room's light trace through a detector, one update() per minute, scoring against its occupancy trace.
+//
+// As on the device, the level is held between records, with update() called once per minute
+// (though gaps longer than maxHoldM are not filled in, eg across logging outages),
+// and setTypMinMax() is called as each hour starts.
+// The typical level for each hour is smoothed over previous days only, as would be available to the device,
+// and is not known (0xff) for an hour until a day's data for that hour has been seen.
+// The long-term min and max are those of the smoothed hourly levels.
+class SensorAmbientLightOccupancyReplay final
+  {
+  public:
+    // Default maximum gap between light records to fill with held values, minutes.
+    static constexpr uint16_t DEFAULT_MAX_HOLD_M = 60;
+    // Default tolerance when matching detections to ground truth, minutes.
+    // Occupancy is logged only every few minutes.
+    static constexpr uint8_t DEFAULT_TOLERANCE_M = 15;
+    // Minimum ground-truth (O) value taken to indicate occupancy.
+    static constexpr uint8_t OCCUPIED_MIN = 2;
+
+    // Replay parameters.
+    bool sensitive = false;
+    uint16_t maxHoldM = DEFAULT_MAX_HOLD_M;
+    uint8_t toleranceM = DEFAULT_TOLERANCE_M;
+
+    // Replay light trace lTrace[0,lLen) through detector scoring against occupancy trace oTrace[0,oLen).
+    // The occupancy trace may be empty/NULL for timing runs.
+    // Records from nodes other than nodeIDOrNULL are ignored if it is non-NULL.
+    // The detector should be freshly constructed for each room.
+    SensorAmbientLightOccupancyReplayScore replay(SensorAmbientLightOccupancyDetectorInterface &detector,
+        const char *lTrace, size_t lLen,
+        const char *oTrace, size_t oLen,
+        const char *nodeIDOrNULL = NULL) const;
+  };
+
+
+}
+
+#endif // ARDUINO_ARCH_AVR
+
+#endif
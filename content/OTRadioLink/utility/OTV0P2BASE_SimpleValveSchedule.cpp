@@ -38,21 +38,83 @@ namespace OTV0P2BASE
 {
 
 
-#ifdef SimpleValveScheduleEEPROM_DEFINED
-
-// Maximum mins-after-midnight compacted value in one byte.
-static const uint8_t MAX_COMPRESSED_MINS_AFTER_MIDNIGHT = ((OTV0P2BASE::MINS_PER_DAY / SimpleValveScheduleEEPROM::SIMPLE_SCHEDULE_GRANULARITY_MINS) - 1);
+constexpr uint8_t SimpleValveScheduleCompiled::SIMPLE_SCHEDULE_GRANULARITY_MINS;
+constexpr uint8_t SimpleValveScheduleCompiled::MAX_COMPRESSED_MINS_AFTER_MIDNIGHT;
+constexpr uint8_t SimpleValveScheduleCompiled::BASIC_SCHEDULED_ON_TIME_MINS;
+constexpr uint8_t SimpleValveScheduleCompiled::PREWARM_MINS;
+constexpr uint8_t SimpleValveScheduleCompiled::PREPREWARM_MINS;
+
+// Start values in ascending order of (wound-back) on time are offset by the pre-warm time.
+static_assert(0 == (SimpleValveScheduleCompiled::PREWARM_MINS % SimpleValveScheduleCompiled::SIMPLE_SCHEDULE_GRANULARITY_MINS), "pre-warm must be whole schedule units");
+static_assert(0 == (OTV0P2BASE::MINS_PER_DAY % SimpleValveScheduleCompiled::SIMPLE_SCHEDULE_GRANULARITY_MINS), "day must be whole schedule units");
+
+// Rebuild the transition list for the given (strictly positive) on time.
+// Costs one pass over the slots and one over the possible start values.
+void SimpleValveScheduleCompiled::compile(const uint8_t onTimeM) const
+  {
+  constexpr uint8_t units = MAX_COMPRESSED_MINS_AFTER_MIDNIGHT + 1;
+  constexpr uint8_t prewarmUnits = PREWARM_MINS / SIMPLE_SCHEDULE_GRANULARITY_MINS;
+  // Mark the start values in use, which also sorts them and merges duplicates.
+  uint8_t used[(units + 7) / 8];
+  memset(used, 0, sizeof(used));
+  for(uint8_t which = 0; which < slots; ++which)
+    {
+    const uint8_t startMM = getStoredStart(which);
+    if(startMM <= MAX_COMPRESSED_MINS_AFTER_MIDNIGHT) { used[startMM >> 3] |= (uint8_t)(1 << (startMM & 7)); }
+    }
+  // Merge overlapping/abutting intervals [on,on+len) in ascending order of on time,
+  // where unit u is on at u*SIMPLE_SCHEDULE_GRANULARITY_MINS after winding back by PREWARM_MINS.
+  const uint_least16_t len = PREWARM_MINS + onTimeM;
+  uint8_t n = 0;
+  for(uint8_t u = 0; u < units; ++u)
+    {
+    uint8_t startMM = u + prewarmUnits;
+    if(startMM >= units) { startMM -= units; }
+    if(0 == (used[startMM >> 3] & (1 << (startMM & 7)))) { continue; }
+    const uint_least16_t on = u * (uint_least16_t)SIMPLE_SCHEDULE_GRANULARITY_MINS;
+    // All intervals are the same length so a later one always ends later.
+    if((0 != n) && (on <= transitions[n-1])) { transitions[n-1] = on + len; }
+    else { transitions[n++] = on; transitions[n++] = on + len; }
+    }
+  // Fold any part of the last interval past midnight back onto the start of the day,
+  // absorbing the intervals that it reaches.
+  if((0 != n) && (transitions[n-1] > OTV0P2BASE::MINS_PER_DAY))
+    {
+    const uint_least16_t wrapOff = transitions[n-1] - OTV0P2BASE::MINS_PER_DAY;
+    transitions[n-1] = OTV0P2BASE::MINS_PER_DAY;
+    uint8_t absorbed = 0; // Intervals starting within [0,wrapOff].
+    while((absorbed < n) && (transitions[absorbed] <= wrapOff)) { absorbed += 2; }
+    if(0 == absorbed)
+      {
+      // Insert a new first interval.
+      for(uint8_t i = n; i-- > 0; ) { transitions[i+2] = transitions[i]; }
+      transitions[0] = 0;
+      transitions[1] = wrapOff;
+      n += 2;
+      }
+    else
+      {
+      // Replace the absorbed intervals with one.
+      const uint_least16_t off = OTV0P2BASE::fnmax(wrapOff, transitions[absorbed-1]);
+      transitions[0] = 0;
+      transitions[1] = off;
+      const uint8_t gap = absorbed - 2;
+      if(0 != gap) { for(uint8_t i = absorbed; i < n; ++i) { transitions[i-gap] = transitions[i]; } }
+      n -= gap;
+      }
+    }
+  nTransitions = n;
+  compiledOnTime = onTimeM;
+  }
 
 // Get the simple/primary schedule on time, as minutes after midnight [0,1439]; invalid (eg ~0) if none set.
 // Will usually include a pre-warm time before the actual time set.
 // Note that unprogrammed EEPROM value will result in invalid time, ie schedule not set.
 //   * which  schedule number, counting from 0
-uint_least16_t SimpleValveScheduleEEPROM::getSimpleScheduleOn(const uint8_t which) const
+uint_least16_t SimpleValveScheduleCompiled::getSimpleScheduleOn(const uint8_t which) const
   {
-  if(which >= MAX_SIMPLE_SCHEDULES) { return(~0); } // Invalid schedule number.
-  uint8_t startMM;
-  ATOMIC_BLOCK (ATOMIC_RESTORESTATE)
-    { startMM = eeprom_read_byte((uint8_t*)(V0P2BASE_EE_START_SIMPLE_SCHEDULE0_ON + which)); }
+  if(which >= slots) { return(~0); } // Invalid schedule number.
+  const uint8_t startMM = getStoredStart(which);
   if(startMM > MAX_COMPRESSED_MINS_AFTER_MIDNIGHT) { return(~0); } // No schedule set.
   // Compute start time from stored schedule value.
   uint_least16_t startTime = SIMPLE_SCHEDULE_GRANULARITY_MINS * startMM;
@@ -68,7 +130,7 @@ uint_least16_t SimpleValveScheduleEEPROM::getSimpleScheduleOn(const uint8_t whic
 // Get the simple/primary schedule off time, as minutes after midnight [0,1439]; invalid (eg ~0) if none set.
 // This is based on specified start time and some element of the current eco/comfort bias.
 //   * which  schedule number, counting from 0
-uint_least16_t SimpleValveScheduleEEPROM::getSimpleScheduleOff(const uint8_t which) const
+uint_least16_t SimpleValveScheduleCompiled::getSimpleScheduleOff(const uint8_t which) const
   {
   const uint_least16_t startMins = getSimpleScheduleOn(which);
   if(startMins == (uint_least16_t)~0) { return(~0); }
@@ -84,87 +146,66 @@ uint_least16_t SimpleValveScheduleEEPROM::getSimpleScheduleOff(const uint8_t whi
 // Invalid parameters will be ignored and false returned,
 // else this will return true and isSimpleScheduleSet() will return true after this.
 // NOTE: over-use of this routine may prematurely wear out the EEPROM.
-bool SimpleValveScheduleEEPROM::setSimpleSchedule(const uint_least16_t startMinutesSinceMidnightLT, const uint8_t which)
+bool SimpleValveScheduleCompiled::setSimpleSchedule(const uint_least16_t startMinutesSinceMidnightLT, const uint8_t which)
   {
-  if(which >= MAX_SIMPLE_SCHEDULES) { return(false); } // Invalid schedule number.
+  if(which >= slots) { return(false); } // Invalid schedule number.
   if(startMinutesSinceMidnightLT >= OTV0P2BASE::MINS_PER_DAY) { return(false); } // Invalid time.
-
-  // Set the schedule, minimising wear.
   const uint8_t startMM = startMinutesSinceMidnightLT / SIMPLE_SCHEDULE_GRANULARITY_MINS; // Round down...
-  ATOMIC_BLOCK (ATOMIC_RESTORESTATE)
-    { OTV0P2BASE::eeprom_smart_update_byte((uint8_t*)(V0P2BASE_EE_START_SIMPLE_SCHEDULE0_ON + which), startMM); }
-  return(true); // Assume EEPROM programmed OK...
+  setStoredStart(which, startMM);
+  invalidate();
+  return(true); // Assume store updated OK...
   }
 
 // Clear a simple schedule.
 // There will be neither on nor off events from the selected simple schedule once this is called.
 //   * which  schedule number, counting from 0
-void SimpleValveScheduleEEPROM::clearSimpleSchedule(const uint8_t which)
+void SimpleValveScheduleCompiled::clearSimpleSchedule(const uint8_t which)
   {
-  if(which >= MAX_SIMPLE_SCHEDULES) { return; } // Invalid schedule number.
-  // Clear the schedule back to 'unprogrammed' values, minimising wear.
-  ATOMIC_BLOCK (ATOMIC_RESTORESTATE)
-    { OTV0P2BASE::eeprom_smart_erase_byte((uint8_t*)(V0P2BASE_EE_START_SIMPLE_SCHEDULE0_ON + which)); }
+  if(which >= slots) { return; } // Invalid schedule number.
+  setStoredStart(which, 0xff);
+  invalidate();
   }
 
-// Returns true if any simple schedule is set, false otherwise.
-// This implementation just checks for any valid schedule 'on' time.
-// In unit-test override mode is true for soon/now, false for off.
-bool SimpleValveScheduleEEPROM::isAnySimpleScheduleSet() const
+// True iff any schedule is 'on'/'WARM' at the given minutes after midnight [0,1439].
+// A time is WARM iff an odd number of transitions are at or before it.
+bool SimpleValveScheduleCompiled::isAnyScheduleOnWARMAt(const uint_least16_t mm) const
   {
-  ATOMIC_BLOCK (ATOMIC_RESTORESTATE)
-    {
-    for(uint8_t which = 0; which < MAX_SIMPLE_SCHEDULES; ++which)
-      {
-      if(eeprom_read_byte((uint8_t*)(V0P2BASE_EE_START_SIMPLE_SCHEDULE0_ON + which)) <= MAX_COMPRESSED_MINS_AFTER_MIDNIGHT)
-        { return(true); }
-      }
-    }
-  return(false);
+  if(mm >= OTV0P2BASE::MINS_PER_DAY) { return(false); } // Invalid time.
+  update();
+  uint8_t lo = 0, hi = nTransitions;
+  while(lo < hi) { const uint8_t mid = (lo + hi) >> 1; if(transitions[mid] <= mm) { lo = mid + 1; } else { hi = mid; } }
+  return(0 != (lo & 1));
   }
 
-
-// True iff any schedule is currently 'on'/'WARM' even when schedules overlap.
-// May be relatively slow/expensive.
-// Can be used to suppress all 'off' activity except for the final one.
-// Can be used to suppress set-backs during on times.
-// In unit-test override mode is true for now, false for soon/off.
-bool SimpleValveScheduleEEPROM::isAnyScheduleOnWARMNow() const
+// True iff any schedule is due 'on'/'WARM' soon (within PREPREWARM_MINS) of the given minutes after midnight [0,1439].
+bool SimpleValveScheduleCompiled::isAnyScheduleOnWARMSoonAt(const uint_least16_t minutesSinceMidnightLT) const
   {
-  const uint_least16_t mm = OTV0P2BASE::getMinutesSinceMidnightLT();
+  if(minutesSinceMidnightLT >= OTV0P2BASE::MINS_PER_DAY) { return(false); } // Invalid time.
+  const uint_least16_t mm0 = minutesSinceMidnightLT + PREPREWARM_MINS; // Look forward...
+  const uint_least16_t mm = (mm0 >= OTV0P2BASE::MINS_PER_DAY) ? (mm0 - OTV0P2BASE::MINS_PER_DAY) : mm0;
+  return(isAnyScheduleOnWARMAt(mm));
+  }
 
-  for(uint8_t which = 0; which < MAX_SIMPLE_SCHEDULES; ++which)
-    {
-    const uint_least16_t s = getSimpleScheduleOn(which);
-    if(mm < s) { continue; } // Also deals with case where this schedule is not set at all (s == ~0);
-    uint_least16_t e = getSimpleScheduleOff(which);
-    if(e < s) { e += OTV0P2BASE::MINS_PER_DAY; } // Cope with schedule wrap around midnight.
-    if(mm < e) { return(true); }
-    }
 
-  return(false);
-  }
+#ifdef SimpleValveScheduleEEPROM_DEFINED
 
-// True iff any schedule is due 'on'/'WARM' soon even when schedules overlap.
-// May be relatively slow/expensive.
-// Can be used to allow room to be brought up to at least a set-back temperature
-// if very cold when a WARM period is due soon (to help ensure that WARM target is met on time).
-// In unit-test override mode is true for soon, false for now/off.
-bool SimpleValveScheduleEEPROM::isAnyScheduleOnWARMSoon() const
+// Get the stored start value for a valid slot from EEPROM.
+uint8_t SimpleValveScheduleEEPROM::getStoredStart(const uint8_t which) const
   {
-  const uint_least16_t mm0 = OTV0P2BASE::getMinutesSinceMidnightLT() + PREPREWARM_MINS; // Look forward...
-  const uint_least16_t mm = (mm0 >= OTV0P2BASE::MINS_PER_DAY) ? (mm0 - OTV0P2BASE::MINS_PER_DAY) : mm0;
+  uint8_t startMM;
+  ATOMIC_BLOCK (ATOMIC_RESTORESTATE)
+    { startMM = eeprom_read_byte((uint8_t*)(V0P2BASE_EE_START_SIMPLE_SCHEDULE0_ON + which)); }
+  return(startMM);
+  }
 
-  for(uint8_t which = 0; which < MAX_SIMPLE_SCHEDULES; ++which)
+// Set (or with 0xff clear back to 'unprogrammed') the start value for a valid slot in EEPROM, minimising wear.
+void SimpleValveScheduleEEPROM::setStoredStart(const uint8_t which, const uint8_t startMM)
+  {
+  ATOMIC_BLOCK (ATOMIC_RESTORESTATE)
     {
-    const uint_least16_t s = getSimpleScheduleOn(which);
-    if(mm < s) { continue; } // Also deals with case where this schedule is not set at all (s == ~0);
-    uint_least16_t e = getSimpleScheduleOff(which);
-    if(e < s) { e += OTV0P2BASE::MINS_PER_DAY; } // Cope with schedule wrap around midnight.
-    if(mm < e) { return(true); }
+    if(0xff == startMM) { OTV0P2BASE::eeprom_smart_erase_byte((uint8_t*)(V0P2BASE_EE_START_SIMPLE_SCHEDULE0_ON + which)); }
+    else { OTV0P2BASE::eeprom_smart_update_byte((uint8_t*)(V0P2BASE_EE_START_SIMPLE_SCHEDULE0_ON + which), startMM); }
     }
-
-  return(false);
   }
 
 #endif // SimpleValveScheduleEEPROM_DEFINED
@@ -19,13 +19,16 @@ Author(s) / Copyright (s): Damon Hart-Davis 2015
 /*
  Simple schedule support for TRV.
 
- V0p2/AVR only for now.
+ EEPROM-backed schedules are V0p2/AVR only for now.
  */
 
 #ifndef OTV0P2BASE_SIMPLEVALVESCHEDULE_H
 #define OTV0P2BASE_SIMPLEVALVESCHEDULE_H
 
+#include <string.h>
+
 #include "OTV0P2BASE_EEPROM.h"
+#include "OTV0P2BASE_RTC.h"
 #include "OTV0P2BASE_Util.h"
 #include "OTV0P2BASE_SensorOccupancy.h"
 
@@ -92,87 +95,157 @@ class SimpleValveScheduleBase
    };
 
 
+// Base for simple single-button (per programme) schedulers, for individual TRVs,
+// storing each schedule's start time in one byte (in SIMPLE_SCHEDULE_GRANULARITY_MINS units).
+// Has an on-time that may be varied by, for example, comfort level.
+//
+// Answers the WARM now/soon queries from a compiled form of the schedules
+// rather than recomputing every schedule's on/off times from the store on each call:
+// a sorted list of on/off transitions within the day, ie of disjoint WARM intervals [on,off)
+// with a schedule wrapping past midnight split in two,
+// so that a time is WARM iff an odd number of transitions are at or before it.
+// The list is rebuilt only after setSimpleSchedule()/clearSimpleSchedule()
+// or when onTime() (eg with the eco/comfort bias) differs from that it was built with,
+// so each query costs one onTime() call and a binary search of at most 2*(slots+1) entries,
+// whatever the number of slots.
+// Derived classes provide the schedule store and room for the compiled list.
+// Not thread-/ISR- safe.
+#define SimpleValveScheduleCompiled_DEFINED
+class SimpleValveScheduleCompiled : public SimpleValveScheduleBase
+  {
+  public:
+    // Granularity of simple schedule in minutes (values may be rounded/truncated to nearest); strictly positive.
+    static constexpr uint8_t SIMPLE_SCHEDULE_GRANULARITY_MINS = 6;
+
+    // Maximum mins-after-midnight compacted value in one byte; larger values (eg unprogrammed EEPROM) mean unset.
+    static constexpr uint8_t MAX_COMPRESSED_MINS_AFTER_MIDNIGHT = ((OTV0P2BASE::MINS_PER_DAY / SIMPLE_SCHEDULE_GRANULARITY_MINS) - 1);
+
+    // Target basic scheduled on time for heating in minutes (typically 1h); strictly positive.
+    static constexpr uint8_t BASIC_SCHEDULED_ON_TIME_MINS = 60;
+
+    // Pre-warm time before learned/scheduled WARM period,
+    // based on basic scheduled on time and allowing for some wobble in the timing resolution.
+    // DHD20151122: even half an hour may not be enough if very cold and heating system not good.
+    // DHD20160112: with 60m BASIC_SCHEDULED_ON_TIME_MINS this should yield ~36m.
+    static constexpr uint8_t PREWARM_MINS = OTV0P2BASE::fnmax(30, (SIMPLE_SCHEDULE_GRANULARITY_MINS + (BASIC_SCHEDULED_ON_TIME_MINS/2)));
+
+    // Setback period before WARM period to help ensure that the WARM target can be reached on time.
+    // Important for slow-to-heat rooms that have become very cold.
+    // Similar to or a little longer than PREWARM_MINS
+    // so that we can safely use this without causing distress, eg waking people up.
+    // DHD20160112: with 36m PREWARM_MINS this should yield ~54m for a total run-up of 90m.
+    static constexpr uint8_t PREPREWARM_MINS = (3*(PREWARM_MINS/2));
+
+  private:
+    // Number of schedule slots.
+    const uint8_t slots;
+    // Compiled transitions, ascending, with room for 2*(slots+1) entries; even entries are on times, odd off.
+    // As each interval is longer than PREWARM_MINS and overlapping ones are merged, never more than 70 are in use.
+    uint_least16_t *const transitions;
+    // Number of valid entries in transitions.
+    mutable uint8_t nTransitions;
+    // onTime() that transitions was compiled with, or 0 if it needs (re)compiling.
+    mutable uint8_t compiledOnTime;
+
+    // Rebuild the transition list for the given (strictly positive) on time.
+    void compile(uint8_t onTimeM) const;
+    // Ensure that the transition list is up to date.
+    void update() const { const uint8_t ot = onTime(); if(ot != compiledOnTime) { compile(ot); } }
+
+  protected:
+    //   * nSlots  number of schedule slots
+    //   * transitionStore  space for 2*(nSlots+1) transitions
+    SimpleValveScheduleCompiled(const uint8_t nSlots, uint_least16_t *const transitionStore)
+      : slots(nSlots), transitions(transitionStore), nTransitions(0), compiledOnTime(0) { }
+
+    // Get the stored start value for a valid slot; unset if > MAX_COMPRESSED_MINS_AFTER_MIDNIGHT.
+    virtual uint8_t getStoredStart(uint8_t which) const = 0;
+    // Set the stored start value for a valid slot, or with 0xff clear it.
+    virtual void setStoredStart(uint8_t which, uint8_t startMM) = 0;
+
+  public:
+    // Returns maximum number of schedules supported.
+    virtual uint8_t maxSchedules() const override { return(slots); }
+
+    // Returns the basic on-time for the program, in minutes; strictly positive.
+    // Does not include pre-warm (not pre-pre-warm time).
+    // Overriding may vary with arbitrary external parameters.
+    // This implementation provides a very simple fixed time.
+    virtual uint8_t onTime() const override { return(BASIC_SCHEDULED_ON_TIME_MINS); }
+
+    // Get the simple schedule off time, as minutes after midnight [0,1439]; invalid (eg ~0) if none set.
+    // This is based on specified start time and some element of the current eco/comfort bias.
+    //   * which  schedule number, counting from 0
+    virtual uint_least16_t getSimpleScheduleOff(uint8_t which) const override;
+
+    // Get the simple schedule on time, as minutes after midnight [0,1439]; invalid (eg ~0) if none set.
+    // Will usually include a pre-warm time before the actual time set.
+    // Note that unprogrammed EEPROM value will result in invalid time, ie schedule not set.
+    //   * which  schedule number, counting from 0
+    virtual uint_least16_t getSimpleScheduleOn(uint8_t which) const override;
+
+    // Set the simple simple on time.
+    //   * startMinutesSinceMidnightLT  is start/on time in minutes after midnight [0,1439]
+    //   * which  schedule number, counting from 0
+    // Invalid parameters will be ignored and false returned,
+    // else this will return true and isSimpleScheduleSet() will return true after this.
+    // NOTE: over-use of this routine can prematurely wear out the EEPROM.
+    virtual bool setSimpleSchedule(uint_least16_t startMinutesSinceMidnightLT, uint8_t which) override;
+
+    // Clear a simple schedule.
+    // There will be neither on nor off events from the selected simple schedule once this is called.
+    //   * which  schedule number, counting from 0
+    virtual void clearSimpleSchedule(uint8_t which) override;
+
+    // True iff any simple schedule is set.
+    virtual bool isAnySimpleScheduleSet() const override { update(); return(0 != nTransitions); }
+
+    // True iff any schedule is 'on'/'WARM' at the given minutes after midnight [0,1439].
+    bool isAnyScheduleOnWARMAt(uint_least16_t minutesSinceMidnightLT) const;
+
+    // True iff any schedule is due 'on'/'WARM' soon (within PREPREWARM_MINS) of the given minutes after midnight [0,1439].
+    bool isAnyScheduleOnWARMSoonAt(uint_least16_t minutesSinceMidnightLT) const;
+
+    // Force the transition list to be recompiled on next use.
+    // Use if the store may have been altered other than by setSimpleSchedule()/clearSimpleSchedule().
+    void invalidate() { compiledOnTime = 0; }
+  };
+
 #ifdef ARDUINO_ARCH_AVR
 // Simple single-button (per programme) on-time scheduler, for individual TRVs.
 // Uses one EEPROM byte per program.
 // Has an on-time that may be varied by, for example, comfort level.
 #define SimpleValveScheduleEEPROM_DEFINED
-class SimpleValveScheduleEEPROM : public SimpleValveScheduleBase
+class SimpleValveScheduleEEPROM : public SimpleValveScheduleCompiled
     {
     public:
-        // Granularity of simple schedule in minutes (values may be rounded/truncated to nearest); strictly positive.
-        static constexpr uint8_t SIMPLE_SCHEDULE_GRANULARITY_MINS = 6;
-
         // Number of supported schedules.
         // Can be more than the number of buttons, but later schedules will be CLI-only.
         // Depends on space reserved in EEPROM for programmes, one byte per programme.
         static constexpr uint8_t MAX_SIMPLE_SCHEDULES = V0P2BASE_EE_START_MAX_SIMPLE_SCHEDULES;
 
-        // Returns maximum number of schedules supported.
-        virtual uint8_t maxSchedules() const override { return(MAX_SIMPLE_SCHEDULES); }
-
-        // Target basic scheduled on time for heating in minutes (typically 1h); strictly positive.
-        static constexpr uint8_t BASIC_SCHEDULED_ON_TIME_MINS = 60;
-
-        // Pre-warm time before learned/scheduled WARM period,
-        // based on basic scheduled on time and allowing for some wobble in the timing resolution.
-        // DHD20151122: even half an hour may not be enough if very cold and heating system not good.
-        // DHD20160112: with 60m BASIC_SCHEDULED_ON_TIME_MINS this should yield ~36m.
-        static constexpr uint8_t PREWARM_MINS = OTV0P2BASE::fnmax(30, (SIMPLE_SCHEDULE_GRANULARITY_MINS + (BASIC_SCHEDULED_ON_TIME_MINS/2)));
-
-        // Setback period before WARM period to help ensure that the WARM target can be reached on time.
-        // Important for slow-to-heat rooms that have become very cold.
-        // Similar to or a little longer than PREWARM_MINS
-        // so that we can safely use this without causing distress, eg waking people up.
-        // DHD20160112: with 36m PREWARM_MINS this should yield ~54m for a total run-up of 90m.
-        static constexpr uint8_t PREPREWARM_MINS = (3*(PREWARM_MINS/2));
-
-        // Returns the basic on-time for the program, in minutes; strictly positive.
-        // Does not include pre-warm (not pre-pre-warm time).
-        // Overriding may vary with arbitrary external parameters.
-        // This implementation provides a very simple fixed time.
-        virtual uint8_t onTime() const override { return(BASIC_SCHEDULED_ON_TIME_MINS); }
-
-        // Get the simple schedule off time, as minutes after midnight [0,1439]; invalid (eg ~0) if none set.
-        // This is based on specified start time and some element of the current eco/comfort bias.
-        //   * which  schedule number, counting from 0
-        virtual uint_least16_t getSimpleScheduleOff(uint8_t which) const override;
-
-        // Get the simple schedule on time, as minutes after midnight [0,1439]; invalid (eg ~0) if none set.
-        // Will usually include a pre-warm time before the actual time set.
-        // Note that unprogrammed EEPROM value will result in invalid time, ie schedule not set.
-        //   * which  schedule number, counting from 0
-        virtual /*static*/ uint_least16_t getSimpleScheduleOn(uint8_t which) const override;
+    private:
+        // Compiled schedule transitions.
+        uint_least16_t transitionStore[2*(MAX_SIMPLE_SCHEDULES+1)];
 
-        // Set the simple simple on time.
-        //   * startMinutesSinceMidnightLT  is start/on time in minutes after midnight [0,1439]
-        //   * which  schedule number, counting from 0
-        // Invalid parameters will be ignored and false returned,
-        // else this will return true and isSimpleScheduleSet() will return true after this.
-        // NOTE: over-use of this routine can prematurely wear out the EEPROM.
-        virtual bool setSimpleSchedule(uint_least16_t startMinutesSinceMidnightLT, uint8_t which) override;
+    protected:
+        virtual uint8_t getStoredStart(uint8_t which) const override;
+        virtual void setStoredStart(uint8_t which, uint8_t startMM) override;
 
-        // Clear a simple schedule.
-        // There will be neither on nor off events from the selected simple schedule once this is called.
-        //   * which  schedule number, counting from 0
-        virtual void clearSimpleSchedule(uint8_t which) override;
+    public:
+        SimpleValveScheduleEEPROM() : SimpleValveScheduleCompiled(MAX_SIMPLE_SCHEDULES, transitionStore) { }
 
         // True iff any schedule is 'on'/'WARN' even when schedules overlap.
         // Can be used to suppress all 'off' activity except for the final one.
         // Can be used to suppress set-backs during on times.
-        virtual bool isAnyScheduleOnWARMNow() const override;
+        virtual bool isAnyScheduleOnWARMNow() const override
+            { return(isAnyScheduleOnWARMAt(OTV0P2BASE::getMinutesSinceMidnightLT())); }
 
         // True iff any schedule is due 'on'/'WARM' soon even when schedules overlap.
-        // May be relatively slow/expensive.
         // Can be used to allow room to be brought up to at least a set-back temperature
         // if very cold when a WARM period is due soon (to help ensure that WARM target is met on time).
-        virtual bool isAnyScheduleOnWARMSoon() const override;
-
-        // True iff any schedule is currently 'on'/'WARM' even when schedules overlap.
-        // May be relatively slow/expensive.
-        // Can be used to suppress all 'off' activity except for the final one.
-        // Can be used to suppress set-backs during on times.
-        virtual bool isAnySimpleScheduleSet() const override;
+        virtual bool isAnyScheduleOnWARMSoon() const override
+            { return(isAnyScheduleOnWARMSoonAt(OTV0P2BASE::getMinutesSinceMidnightLT())); }
     };
 
 // Customised scheduler implementation for OpenTRV V0p2 circa REV2.
@@ -210,6 +283,37 @@ class SimpleValveSchedule final : public SimpleValveScheduleEEPROM
 
 #endif // ARDUINO_ARCH_AVR
 
+// Simple RAM-backed scheduler primarily to support mocking, unit tests and simulations,
+// with any number of slots (eg many more than fit in EEPROM) all initially unset.
+// The current time and on time are set explicitly rather than taken from the RTC and eco/comfort bias.
+template<uint8_t nSlots>
+class SimpleValveScheduleMock final : public SimpleValveScheduleCompiled
+  {
+  private:
+    uint8_t store[nSlots];
+    uint_least16_t transitionStore[2*(nSlots+1)];
+    // Minutes after midnight taken as now [0,1439].
+    uint_least16_t currentMinutes = 0;
+    // On time; strictly positive.
+    uint8_t onTimeM = BASIC_SCHEDULED_ON_TIME_MINS;
+
+  protected:
+    virtual uint8_t getStoredStart(const uint8_t which) const override { return(store[which]); }
+    virtual void setStoredStart(const uint8_t which, const uint8_t startMM) override { store[which] = startMM; }
+
+  public:
+    SimpleValveScheduleMock() : SimpleValveScheduleCompiled(nSlots, transitionStore) { memset(store, 0xff, sizeof(store)); }
+
+    // Set the minutes after midnight to be taken as now [0,1439].
+    void setMinutesSinceMidnightLT(const uint_least16_t m) { currentMinutes = m % OTV0P2BASE::MINS_PER_DAY; }
+    // Set the on time; zero is ignored.
+    void setOnTime(const uint8_t m) { if(0 != m) { onTimeM = m; } }
+
+    virtual uint8_t onTime() const override { return(onTimeM); }
+    virtual bool isAnyScheduleOnWARMNow() const override { return(isAnyScheduleOnWARMAt(currentMinutes)); }
+    virtual bool isAnyScheduleOnWARMSoon() const override { return(isAnyScheduleOnWARMSoonAt(currentMinutes)); }
+  };
+
 
 // Empty type-correct substitute for SimpleValveScheduleBase
 // for when no Scheduler is require to simplify coding.
@@ -293,3 +293,203 @@ TEST(CurrentSenseValveMotorDirect,initStateWalkthrough)
         EXPECT_EQ(low, csvmd1.shouldDeferCalibration());
         }
 }
+
+// Test refinement of the calibration from end-stop hits.
+TEST(CurrentSenseValveMotorDirect,updateFromEndStop)
+{
+    const uint8_t minTicks = 35;
+    OTRadValve::CurrentSenseValveMotorDirect::CalibrationParameters cp;
+    ASSERT_TRUE(cp.updateAndCompute(1600U, 1100U, minTicks));
+
+    // Clean run closing to the closed end-stop, 10% slower: half way there.
+    EXPECT_TRUE(cp.updateFromEndStop(true, false, 1760U, 0, minTicks));
+    EXPECT_EQ(1680, cp.getTicksFromOpenToClosed());
+    EXPECT_EQ(1155, cp.getTicksFromClosedToOpen()); // Ratio kept.
+    // Same travel with reversals on the way: a quarter of the way.
+    ASSERT_TRUE(cp.updateAndCompute(1600U, 1100U, minTicks));
+    EXPECT_TRUE(cp.updateFromEndStop(true, false, 1760U + 1600U, 1100U, minTicks));
+    EXPECT_EQ(1640, cp.getTicksFromOpenToClosed());
+    EXPECT_EQ(1128, cp.getTicksFromClosedToOpen());
+    // Clean run opening to the open end-stop, 10% faster.
+    ASSERT_TRUE(cp.updateAndCompute(1600U, 1100U, minTicks));
+    EXPECT_TRUE(cp.updateFromEndStop(false, true, 0, 990U, minTicks));
+    EXPECT_EQ(1045, cp.getTicksFromClosedToOpen());
+    EXPECT_EQ(1520, cp.getTicksFromOpenToClosed());
+
+    // Back to the open end-stop after substantial travel each way refines the ratio only.
+    ASSERT_TRUE(cp.updateAndCompute(1600U, 1100U, minTicks));
+    EXPECT_TRUE(cp.updateFromEndStop(true, true, 800U, 600U, minTicks));
+    EXPECT_EQ(1600, cp.getTicksFromOpenToClosed());
+    EXPECT_EQ(1100 + (1200 - 1100) / 4, cp.getTicksFromClosedToOpen());
+    // Too little travel to learn from, eg seating again at the same end-stop.
+    ASSERT_TRUE(cp.updateAndCompute(1600U, 1100U, minTicks));
+    EXPECT_TRUE(cp.updateFromEndStop(true, true, 0, 35U, minTicks));
+    EXPECT_TRUE(cp.updateFromEndStop(false, false, 300U, 200U, minTicks));
+    EXPECT_EQ(1600, cp.getTicksFromOpenToClosed());
+    EXPECT_EQ(1100, cp.getTicksFromClosedToOpen());
+
+    // Implausible travel, eg from an obstruction, leaves the model unchanged.
+    EXPECT_FALSE(cp.updateFromEndStop(true, false, 800U, 0, minTicks));
+    EXPECT_FALSE(cp.updateFromEndStop(false, true, 0, 2000U, minTicks));
+    EXPECT_FALSE(cp.updateFromEndStop(true, false, 500U, 1100U, minTicks));
+    EXPECT_EQ(1600, cp.getTicksFromOpenToClosed());
+    EXPECT_EQ(1100, cp.getTicksFromClosedToOpen());
+    EXPECT_EQ(25, cp.getTfotcSmall());
+    EXPECT_EQ(17, cp.getTfctoSmall());
+    // Not calibrated.
+    OTRadValve::CurrentSenseValveMotorDirect::CalibrationParameters cp0;
+    EXPECT_FALSE(cp0.updateFromEndStop(true, false, 1600U, 0, minTicks));
+}
+
+// Simple model of the valve motor and pin for simulation.
+// The pin moves at a speed per sub-cycle tick that differs by direction (closing works against the valve spring),
+// scaled for supply voltage droop and with some random variation from run to run.
+// Runs until the requested ticks are done, the sub-cycle limit is reached or an end-stop is hit.
+class SimValveMotor final : public OTRadValve::HardwareMotorDriverInterface
+  {
+  public:
+    // Full travel, in arbitrary units; 0 is fully open (pin withdrawn).
+    static const uint32_t TRAVEL = 1000000;
+    // Nominal speeds, units per tick: a little under 1600 ticks to close and 1100 to open.
+    static const uint32_t CLOSING_SPEED = 625;
+    static const uint32_t OPENING_SPEED = 900;
+    // Sub-cycle limit for motor runs, as for REV7.
+    static const uint8_t SCT_LIMIT = 230;
+
+    // Speed relative to nominal, eg reduced as the battery voltage droops.
+    double speedScale = 1;
+    // Maximum random variation in speed from run to run, as a fraction.
+    double jitter = 0.03;
+
+    // Pin position in [0,TRAVEL].
+    uint32_t pos = 0;
+    // Current sub-cycle time; reset by the caller for each sub-cycle.
+    uint8_t sct = 0;
+    // Total ticks that the motor has been running.
+    uint32_t ticksRun = 0;
+    // End-stop hits by direction.
+    uint32_t hitsOpen = 0, hitsClosed = 0;
+
+    uint8_t percentOpen() const { return((uint8_t)(100 - ((pos * 100ULL) + (TRAVEL / 2)) / TRAVEL)); }
+    // Ticks for full travel in each direction at the current speed.
+    uint32_t ticksToClose() const { return((uint32_t)(TRAVEL / (CLOSING_SPEED * speedScale))); }
+    uint32_t ticksToOpen() const { return((uint32_t)(TRAVEL / (OPENING_SPEED * speedScale))); }
+
+    virtual bool isCurrentHigh(OTRadValve::HardwareMotorDriverInterface::motor_drive) const override { return(false); }
+    virtual void motorRun(const uint8_t maxRunTicks, const motor_drive dir, OTRadValve::HardwareMotorDriverInterfaceCallbackHandler &callback) override
+      {
+      if(motorOff == dir) { return; }
+      const bool opening = (motorDriveOpening == dir);
+      seed = (seed * 1103515245U) + 12345U;
+      const double r = ((seed >> 8) & 0xffff) / 32768.0 - 1;
+      const uint32_t step = (uint32_t)((opening ? OPENING_SPEED : CLOSING_SPEED) * speedScale * (1 + (jitter * r)));
+      for(uint8_t n = 0; (n < maxRunTicks) && (sct < SCT_LIMIT); ++n)
+        {
+        ++sct;
+        ++ticksRun;
+        callback.signalRunSCTTick(opening);
+        if(opening)
+          {
+          if(pos <= step) { pos = 0; ++hitsOpen; callback.signalHittingEndStop(true); return; }
+          pos -= step;
+          }
+        else
+          {
+          if(pos + step >= TRAVEL) { pos = TRAVEL; ++hitsClosed; callback.signalHittingEndStop(false); return; }
+          pos += step;
+          }
+        }
+      }
+
+  private:
+    uint32_t seed = 1;
+  };
+static SimValveMotor *simMotor;
+static uint8_t simGetSubCycleTime() { return(simMotor->sct); }
+
+// Simulate months of use with the motor slowing as the battery voltage droops,
+// checking that position tracking and the calibration follow the motor
+// with partial recalibrations only, and estimating the motor time saved.
+TEST(CurrentSenseValveMotorDirect,simulateDrift)
+{
+    // If true then be more verbose.
+    const static bool verbose = false;
+
+    const uint8_t subcycleTicksRoundedDown_ms = 7; // For REV7: OTV0P2BASE::SUBCYCLE_TICK_MS_RD.
+    const uint8_t gsct_max = 255; // For REV7: OTV0P2BASE::GSCT_MAX.
+    const uint8_t minimumMotorRunupTicks = 4; // For REV7: OTRadValve::ValveMotorDirectV1HardwareDriverBase::minMotorRunupTicks.
+    SimValveMotor motor;
+    simMotor = &motor;
+    OTRadValve::CurrentSenseValveMotorDirect csv(&motor, simGetSubCycleTime,
+        OTRadValve::CurrentSenseValveMotorDirect::computeMinMotorDRTicks(subcycleTicksRoundedDown_ms),
+        OTRadValve::CurrentSenseValveMotorDirect::computeSctAbsLimit(subcycleTicksRoundedDown_ms,
+                                                                     gsct_max,
+                                                                     minimumMotorRunupTicks));
+    auto poll = [&]() { motor.sct = 0; csv.poll(); };
+
+    // Power up, fit and calibrate.
+    for(int i = 0; (i < 1000) && !csv.isWaitingForValveToBeFitted(); ++i) { poll(); }
+    ASSERT_TRUE(csv.isWaitingForValveToBeFitted());
+    csv.signalValveFitted();
+    const uint32_t ticksBeforeCalibration = motor.ticksRun;
+    for(int i = 0; (i < 1000) && !csv.isInNormalRunState(); ++i) { poll(); }
+    ASSERT_TRUE(csv.isInNormalRunState());
+    ASSERT_FALSE(csv.inNonProprtionalMode());
+    const uint32_t fullCalibrationTicks = motor.ticksRun - ticksBeforeCalibration;
+
+    // Run for 60 days with a new target every 30 minutes, polling every 2s,
+    // while the motor slows by a fifth.
+    const int days = 60;
+    const int targetsPerDay = 48;
+    const int pollsPerTarget = 900;
+    uint32_t seed = 42;
+    uint8_t target = 50;
+    const uint16_t initialTicksToClose = csv.getCalibrationParameters().getTicksFromOpenToClosed();
+    int fullCalibrations = 0, rehomes = 0;
+    uint32_t rehomeTicks = 0;
+    uint32_t trackingErrorSum = 0, trackingErrorMax = 0, samples = 0;
+    const uint32_t ticksBeforeRun = motor.ticksRun;
+    for(int t = 0; t < days * targetsPerDay; ++t)
+        {
+        motor.speedScale = 1 - (0.2 * t) / (days * targetsPerDay);
+        // Mostly intermediate targets drifting with demand, occasionally fully open or closed.
+        seed = (seed * 1103515245U) + 12345U;
+        const uint8_t r = (seed >> 16) % 100;
+        if(r < 5) { target = 0; }
+        else if(r < 10) { target = 100; }
+        else { target = (uint8_t)OTV0P2BASE::fnconstrain((int)target + (int)((seed >> 8) % 41) - 20, 20, 80); }
+        csv.setTargetPC(target);
+        for(int p = 0; p < pollsPerTarget; ++p)
+            {
+            const bool wasNormal = csv.isInNormalRunState();
+            const bool wasRehoming = csv.isRehoming();
+            const uint32_t ticks0 = motor.ticksRun;
+            poll();
+            if(wasNormal && (OTRadValve::CurrentSenseValveMotorDirect::valveCalibrating == csv.getState())) { ++fullCalibrations; }
+            if(wasRehoming) { rehomeTicks += motor.ticksRun - ticks0; if(!csv.isRehoming()) { ++rehomes; } }
+            }
+        ASSERT_TRUE(csv.isInNormalRunState());
+        const uint32_t err = (uint32_t)abs((int)csv.getCurrentPC() - (int)motor.percentOpen());
+        trackingErrorSum += err;
+        trackingErrorMax = OTV0P2BASE::fnmax(trackingErrorMax, err);
+        ++samples;
+        }
+    const uint32_t runTicks = motor.ticksRun - ticksBeforeRun;
+
+    // The calibration has followed the motor slowing down, without full recalibration.
+    EXPECT_EQ(0, fullCalibrations);
+    const OTRadValve::CurrentSenseValveMotorDirect::CalibrationParameters &cp = csv.getCalibrationParameters();
+    EXPECT_NEAR((double)motor.ticksToClose(), cp.getTicksFromOpenToClosed(), motor.ticksToClose() * 0.05);
+    EXPECT_NEAR((double)motor.ticksToOpen(), cp.getTicksFromClosedToOpen(), motor.ticksToOpen() * 0.05);
+    // Position tracking remains reasonable.
+    EXPECT_GT(8U, trackingErrorSum / samples);
+    // Without refinement the model would now be out by the full droop, needing at least one full recalibration;
+    // each partial recalibration instead costs only a fraction of a full one.
+    const uint32_t drift = (100 * (uint32_t)abs((int)motor.ticksToClose() - (int)initialTicksToClose)) / initialTicksToClose;
+    const uint32_t meanRehomeTicks = (0 == rehomes) ? 0 : (rehomeTicks / rehomes);
+    if(verbose)
+        {
+        fprintf(stderr, "Valve motor over %d days: %u ticks run, %u%% speed drift tracked, tracking error mean %u%% max %u%%; %d partial recalibrations at ~%u ticks vs %u ticks for full calibration, %u ticks saved per full recalibration avoided\n",
+            days, runTicks, drift, trackingErrorSum / samples, trackingErrorMax, rehomes, meanRehomeTicks, fullCalibrationTicks, fullCalibrationTicks - OTV0P2BASE::fnmin(meanRehomeTicks, fullCalibrationTicks));
+        }
+}
@@ -0,0 +1,132 @@
+/*
+The OpenTRV project licenses this file to you
+under the Apache Licence, Version 2.0 (the "Licence");
+you may not use this file except in compliance
+with the Licence. You may obtain a copy of the Licence at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing,
+software distributed under the Licence is distributed on an
+"AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+KIND, either express or implied. See the Licence for the
+specific language governing permissions and limitations
+under the Licence.
+
+Author(s) / Copyright (s): Damon Hart-Davis 2016
+*/
+
+/*
+ * OTRadValve FHT8VBulkEncoder tests.
+ */
+
+#include <gtest/gtest.h>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <chrono>
+
+#include "OTRadValve_FHT8VBulkEncoder.h"
+
+
+// Check every pre-encoded frame for a few house codes decodes back to its command
+// and is byte-for-byte as from direct encoding.
+TEST(FHT8VBulkEncoder,RoundTrip)
+{
+    typedef OTRadValve::FHT8VRadValveUtil U;
+    static const uint8_t hcs[][2] = { { 0, 0 }, { 13, 73 }, { 99, 99 }, { 42, 7 } };
+    const size_t n = sizeof(hcs) / sizeof(hcs[0]);
+    OTRadValve::FHT8VBulkEncoder be;
+    for(size_t i = 0; i < n; ++i) { EXPECT_EQ(i, be.addHouseCode(hcs[i][0], hcs[i][1])); }
+    EXPECT_EQ(n, be.getHouseCodeCount());
+    uint8_t buf[U::MIN_FHT8V_200US_BIT_STREAM_BUF_SIZE];
+    uint8_t direct[U::MIN_FHT8V_200US_BIT_STREAM_BUF_SIZE];
+    for(size_t i = 0; i < n; ++i)
+        {
+        for(int v = 0; v <= 255; ++v)
+            {
+            uint8_t len;
+            const uint8_t *const f = be.getFrame(i, (uint8_t)v, len);
+            EXPECT_LE(35, len);
+            EXPECT_GE(45, len);
+            EXPECT_EQ(0xff, f[len]);
+            memset(buf, 0, sizeof(buf));
+            uint8_t *const end = be.emit(buf, i, (uint8_t)v);
+            ASSERT_EQ(len, end - buf);
+            EXPECT_EQ(0, memcmp(f, buf, len + 1));
+            U::fht8v_msg_t decoded;
+            ASSERT_TRUE(NULL != U::FHT8VDecodeBitStream(buf, end, &decoded)) << i << " " << v;
+            EXPECT_EQ(hcs[i][0], decoded.hc1);
+            EXPECT_EQ(hcs[i][1], decoded.hc2);
+            EXPECT_EQ(0x26, decoded.command);
+            EXPECT_EQ(v, decoded.extension);
+            U::fht8v_msg_t command;
+            command.hc1 = hcs[i][0];
+            command.hc2 = hcs[i][1];
+#ifdef OTV0P2BASE_FHT8V_ADR_USED
+            command.address = 0;
+#endif
+            command.command = 0x26;
+            command.extension = (uint8_t)v;
+            EXPECT_EQ(end, buf + (U::FHT8VCreate200usBitStreamBptr(direct, &command) - direct));
+            EXPECT_EQ(0, memcmp(direct, buf, len + 1));
+            }
+        }
+    // Percentage is mapped as by the valve.
+    uint8_t len;
+    const uint8_t *const f = be.getFrame(1, U::convertPercentTo255Scale(67), len);
+    EXPECT_EQ(buf + len, be.emitPercent(buf, 1, 67));
+    EXPECT_EQ(0, memcmp(f, buf, len + 1));
+}
+
+// Crude benchmark of emitting valve-set commands across many valves, encoding vs pre-encoded.
+TEST(FHT8VBulkEncoder,Benchmark)
+{
+    // If true then be more verbose.
+    const static bool verbose = false;
+
+    typedef OTRadValve::FHT8VRadValveUtil U;
+    typedef std::chrono::steady_clock clock;
+    const int valves = 1000;
+    const int rounds = 100;
+    OTRadValve::FHT8VBulkEncoder be;
+    const clock::time_point t0 = clock::now();
+    for(int i = 0; i < valves; ++i) { be.addHouseCode((uint8_t)(i % 100), (uint8_t)(i / 10)); }
+    const clock::time_point t1 = clock::now();
+
+    uint8_t buf[U::MIN_FHT8V_200US_BIT_STREAM_BUF_SIZE];
+    U::fht8v_msg_t command;
+#ifdef OTV0P2BASE_FHT8V_ADR_USED
+    command.address = 0;
+#endif
+    command.command = 0x26;
+    uint32_t checkEncoded = 0;
+    for(int r = 0; r < rounds; ++r)
+        {
+        for(int i = 0; i < valves; ++i)
+            {
+            command.hc1 = (uint8_t)(i % 100);
+            command.hc2 = (uint8_t)(i / 10);
+            command.extension = U::convertPercentTo255Scale((uint8_t)((r + i) % 101));
+            checkEncoded += (uint32_t)(U::FHT8VCreate200usBitStreamBptr(buf, &command) - buf) + buf[7];
+            }
+        }
+    const clock::time_point t2 = clock::now();
+    uint32_t checkCopied = 0;
+    for(int r = 0; r < rounds; ++r)
+        {
+        for(int i = 0; i < valves; ++i)
+            { checkCopied += (uint32_t)(be.emitPercent(buf, i, (uint8_t)((r + i) % 101)) - buf) + buf[7]; }
+        }
+    const clock::time_point t3 = clock::now();
+    EXPECT_EQ(checkEncoded, checkCopied);
+    const double n = (double)valves * rounds;
+    if(verbose)
+        {
+        fprintf(stderr, "FHT8V: precompute %d house codes %.3gs, encode %.3g frames/s, pre-encoded %.3g frames/s\n",
+            valves,
+            std::chrono::duration<double>(t1 - t0).count(),
+            n / std::chrono::duration<double>(t2 - t1).count(),
+            n / std::chrono::duration<double>(t3 - t2).count());
+        }
+}
@@ -25,6 +25,7 @@ Author(s) / Copyright (s): Damon Hart-Davis 2016
 #include <gtest/gtest.h>
 #include <cstdint>
 #include <cstdio>
+#include <cstring>
 
 #include "OTRadValve_FHT8VRadValve.h"
 
@@ -422,3 +423,54 @@ TEST(FHT8VRadValve,FHTEncodingHeadAndTail)
 //    #endif
 //    #endif
 }
+
+// Test that the encoded frame cache emits exactly what direct encoding does, hitting where expected.
+TEST(FHT8VRadValve,FHT8VEncodedFrameCache)
+{
+    typedef OTRadValve::FHT8VRadValveUtil U;
+    OTRadValve::FHT8VEncodedFrameCache<2> cache;
+    uint8_t bufDirect[U::MIN_FHT8V_200US_BIT_STREAM_BUF_SIZE];
+    uint8_t bufCached[U::MIN_FHT8V_200US_BIT_STREAM_BUF_SIZE];
+    U::fht8v_msg_t command;
+#ifdef OTV0P2BASE_FHT8V_ADR_USED
+    command.address = 0;
+#endif
+    command.command = 0x26;
+    // Run through a mix of house codes and values several times, with collisions.
+    for(int pass = 0; pass < 3; ++pass)
+        {
+        for(int i = 0; i < 300; ++i)
+            {
+            command.hc1 = (uint8_t)(i % 100);
+            command.hc2 = (uint8_t)((i * 7) % 100);
+            command.extension = (uint8_t)(i * 13);
+            memset(bufDirect, 0, sizeof(bufDirect));
+            memset(bufCached, 0x55, sizeof(bufCached));
+            const uint8_t *const endDirect = U::FHT8VCreate200usBitStreamBptr(bufDirect, &command);
+            const uint8_t *const endCached = cache.emit(bufCached, &command);
+            ASSERT_EQ(endDirect - bufDirect, endCached - bufCached);
+            EXPECT_EQ(0xff, *endCached);
+            EXPECT_EQ(0, memcmp(bufDirect, bufCached, endDirect - bufDirect + 1));
+            }
+        }
+    EXPECT_EQ(0, cache.getHits());
+    EXPECT_EQ(900, cache.getMisses());
+    // A valve alternating between two settings hits after the first encodings.
+    command.hc1 = 13;
+    command.hc2 = 73;
+    cache.clear();
+    for(int i = 0; i < 10; ++i)
+        {
+        command.extension = (i & 1) ? 255 : 0;
+        memset(bufCached, 0x55, sizeof(bufCached));
+        const uint8_t *const endCached = cache.emit(bufCached, &command);
+        U::fht8v_msg_t decoded;
+        ASSERT_TRUE(NULL != U::FHT8VDecodeBitStream(bufCached, endCached, &decoded));
+        EXPECT_EQ(13, decoded.hc1);
+        EXPECT_EQ(73, decoded.hc2);
+        EXPECT_EQ(0x26, decoded.command);
+        EXPECT_EQ(command.extension, decoded.extension);
+        }
+    EXPECT_EQ(8, cache.getHits());
+    EXPECT_EQ(902, cache.getMisses());
+}
@@ -0,0 +1,294 @@
+/*
+The OpenTRV project licenses this file to you
+under the Apache Licence, Version 2.0 (the "Licence");
+you may not use this file except in compliance
+with the Licence. You may obtain a copy of the Licence at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing,
+software distributed under the Licence is distributed on an
+"AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+KIND, either express or implied. See the Licence for the
+specific language governing permissions and limitations
+under the Licence.
+
+Author(s) / Copyright (s): Damon Hart-Davis 2016
+*/
+
+/*
+ * OTRadValve ModelledRadValveFleet tests.
+ */
+
+#include <gtest/gtest.h>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <OTV0P2BASE_QuickPRNG.h>
+
+#include "OTRadValve_ModelledRadValve.h"
+#include "OTRadValve_ModelledRadValveFleet.h"
+
+
+// Randomly wander the input state for one room, with occasional big jumps and control changes,
+// to exercise filtering, the draught detector, BAKE, fast response, etc.
+static void wanderInputState(OTRadValve::ModelledRadValveInputState &is, int_fast16_t &tempC16)
+{
+    const uint8_t r = OTV0P2BASE::randRNG8();
+    if(r < 8) { tempC16 -= 8 + (OTV0P2BASE::randRNG8() & 0xf); } // Draught.
+    else if(r < 16) { tempC16 += 4 + (OTV0P2BASE::randRNG8() & 0x7); } // Jitter.
+    else { tempC16 += (int)(OTV0P2BASE::randRNG8() % 5) - 2; }
+    tempC16 = OTV0P2BASE::fnconstrain(tempC16, (int_fast16_t)(5 << 4), (int_fast16_t)(30 << 4));
+    is.setReferenceTemperatures(tempC16);
+    if(0 == (OTV0P2BASE::randRNG8() & 0x3f))
+        {
+        is.targetTempC = 12 + (OTV0P2BASE::randRNG8() % 12);
+        is.minPCOpen = 1 + (OTV0P2BASE::randRNG8() % 20);
+        is.maxPCOpen = OTV0P2BASE::randRNG8NextBoolean() ? 100 : (is.minPCOpen + (OTV0P2BASE::randRNG8() % (101 - is.minPCOpen)));
+        const uint8_t f = OTV0P2BASE::randRNG8();
+        is.widenDeadband = (0 != (f & 1));
+        is.glacial = (0 == (f & 0x1e));
+        is.hasEcoBias = (0 != (f & 0x20));
+        is.inBakeMode = (0 == (f & 0xc0));
+        is.fastResponseRequired = !is.widenDeadband && (0 == (f & 0x6));
+        }
+}
+
+// Check that every room in a fleet stays bit-exact with an individually-ticked ModelledRadValveState.
+static void checkBitExact(const bool alwaysGlacial)
+{
+    const size_t rooms = 64;
+    const int ticks = 2000;
+    OTRadValve::ModelledRadValveFleet fleet(rooms, alwaysGlacial);
+    std::vector<OTRadValve::ModelledRadValveState> scalar(rooms, OTRadValve::ModelledRadValveState(alwaysGlacial));
+    std::vector<OTRadValve::ModelledRadValveInputState> is(rooms);
+    std::vector<int_fast16_t> tempC16(rooms);
+    std::vector<uint8_t> valvePC(rooms);
+    for(size_t r = 0; r < rooms; ++r)
+        {
+        tempC16[r] = (10 << 4) + (OTV0P2BASE::randRNG8() % (15 << 4));
+        is[r].targetTempC = 12 + (OTV0P2BASE::randRNG8() % 12);
+        valvePC[r] = OTV0P2BASE::randRNG8() % 101;
+        fleet.setValvePCOpen(r, valvePC[r]);
+        }
+    for(int t = 0; t < ticks; ++t)
+        {
+        for(size_t r = 0; r < rooms; ++r)
+            {
+            wanderInputState(is[r], tempC16[r]);
+            fleet.setInputState(r, is[r]);
+            volatile uint8_t v = valvePC[r];
+            scalar[r].tick(v, is[r]);
+            valvePC[r] = v;
+            }
+        fleet.tick();
+        for(size_t r = 0; r < rooms; ++r)
+            {
+            const OTRadValve::ModelledRadValveState &s = scalar[r];
+            ASSERT_EQ(valvePC[r], fleet.getValvePCOpen(r)) << "tick " << t << " room " << r;
+            ASSERT_EQ(s.isFiltering, fleet.getIsFiltering(r));
+            ASSERT_EQ(s.valveMoved, fleet.getValveMoved(r));
+            ASSERT_EQ(s.lastEvent, fleet.getLastEvent(r));
+            ASSERT_EQ(s.cumulativeMovementPC, fleet.getCumulativeMovementPC(r));
+            ASSERT_EQ(s.valveTurndownCountdownM, fleet.getValveTurndownCountdownM(r));
+            ASSERT_EQ(s.valveTurnupCountdownM, fleet.getValveTurnupCountdownM(r));
+            ASSERT_EQ(s.getSmoothedRecent(), fleet.getSmoothedRecent(r));
+            ASSERT_EQ(s.getRawDelta(), fleet.getRawDelta(r));
+            for(size_t i = 0; i < OTRadValve::ModelledRadValveState::filterLength; ++i)
+                { ASSERT_EQ(s.getRawTempC16(i), fleet.getRawTempC16(r, i)); }
+            }
+        }
+}
+
+// Test that the fleet is bit-exact with ModelledRadValveState::tick() for each room.
+TEST(ModelledRadValveFleet,BitExact)
+{
+    checkBitExact(false);
+    checkBitExact(true);
+}
+
+// Test that input state round-trips through the fleet's parallel arrays.
+TEST(ModelledRadValveFleet,InputState)
+{
+    OTRadValve::ModelledRadValveFleet fleet(3);
+    OTRadValve::ModelledRadValveInputState is(19 << 4);
+    is.targetTempC = 21;
+    is.minPCOpen = 12;
+    is.maxPCOpen = 80;
+    is.hasEcoBias = true;
+    is.inBakeMode = true;
+    fleet.setInputState(1, is);
+    const OTRadValve::ModelledRadValveInputState o = fleet.getInputState(1);
+    EXPECT_EQ(21, o.targetTempC);
+    EXPECT_EQ(12, o.minPCOpen);
+    EXPECT_EQ(80, o.maxPCOpen);
+    EXPECT_FALSE(o.widenDeadband);
+    EXPECT_FALSE(o.glacial);
+    EXPECT_TRUE(o.hasEcoBias);
+    EXPECT_TRUE(o.inBakeMode);
+    EXPECT_FALSE(o.fastResponseRequired);
+    EXPECT_EQ(is.refTempC16, o.refTempC16);
+    // Neighbours untouched.
+    EXPECT_EQ(OTRadValve::ModelledRadValveInputState().targetTempC, fleet.getInputState(0).targetTempC);
+    EXPECT_FALSE(fleet.getInputState(2).inBakeMode);
+    EXPECT_FALSE(fleet.isInitialised(1));
+    fleet.tick();
+    EXPECT_TRUE(fleet.isInitialised(1));
+    EXPECT_EQ(19 << 4, fleet.getSmoothedRecent(1));
+}
+
+// Crude benchmark of fleet against individual instances, in rooms*ticks per second.
+TEST(ModelledRadValveFleet,Benchmark)
+{
+    // If true then be more verbose.
+    const static bool verbose = false;
+
+    typedef std::chrono::steady_clock clock;
+    const size_t rooms = 4096;
+    const int ticks = 60;
+    std::vector<int_fast16_t> tempC16(rooms);
+    for(size_t r = 0; r < rooms; ++r) { tempC16[r] = (15 << 4) + (OTV0P2BASE::randRNG8() % (8 << 4)); }
+
+    OTRadValve::ModelledRadValveFleet fleet(rooms);
+    std::vector<OTRadValve::ModelledRadValveState> scalar(rooms);
+    std::vector<OTRadValve::ModelledRadValveInputState> is(rooms);
+    std::vector<uint8_t> valvePC(rooms);
+    for(size_t r = 0; r < rooms; ++r) { is[r].targetTempC = 18; fleet.setTargetTempC(r, 18); }
+
+    const clock::time_point t0 = clock::now();
+    for(int t = 0; t < ticks; ++t)
+        {
+        for(size_t r = 0; r < rooms; ++r)
+            {
+            is[r].setReferenceTemperatures(tempC16[r] + (t & 7));
+            volatile uint8_t v = valvePC[r];
+            scalar[r].tick(v, is[r]);
+            valvePC[r] = v;
+            }
+        }
+    const clock::time_point t1 = clock::now();
+    for(int t = 0; t < ticks; ++t)
+        {
+        for(size_t r = 0; r < rooms; ++r) { fleet.setReferenceTemperatures(r, tempC16[r] + (t & 7)); }
+        fleet.tick();
+        }
+    const clock::time_point t2 = clock::now();
+    for(size_t r = 0; r < rooms; ++r) { ASSERT_EQ(valvePC[r], fleet.getValvePCOpen(r)); }
+
+    const double n = (double)rooms * ticks;
+    const double scalarS = std::chrono::duration<double>(t1 - t0).count();
+    const double fleetS = std::chrono::duration<double>(t2 - t1).count();
+    if(verbose) { fprintf(stderr, "ModelledRadValve: scalar %.3g, fleet %.3g room-ticks/s\n", n / scalarS, n / fleetS); }
+}
+
+// The original shift-register ModelledRadValveState filter and tick(), for comparison.
+// Shifts the whole filter each tick and recomputes the mean and jump check from scratch.
+class ShiftFilterValveState final
+{
+public:
+    static constexpr size_t filterLength = OTRadValve::ModelledRadValveState::filterLength;
+    bool initialised = false;
+    bool isFiltering = false;
+    uint8_t valveTurndownCountdownM = 0;
+    uint8_t valveTurnupCountdownM = 0;
+    int_fast16_t prevRawTempC16[filterLength];
+    int_fast16_t getSmoothedRecent() const
+        {
+        int sum = 0;
+        for(int8_t i = filterLength; --i >= 0; ) { sum += prevRawTempC16[i]; }
+        return((sum + (int)(filterLength/2)) / (int)filterLength);
+        }
+    void tick(volatile uint8_t &valvePCOpenRef, const OTRadValve::ModelledRadValveInputState &inputState)
+        {
+        const int_fast16_t rawTempC16 = inputState.refTempC16 - OTRadValve::ModelledRadValveInputState::refTempOffsetC16;
+        if(!initialised)
+            {
+            for(int i = filterLength; --i >= 0; ) { prevRawTempC16[i] = rawTempC16; }
+            initialised = true;
+            }
+        for(int i = filterLength; --i > 0; ) { prevRawTempC16[i] = prevRawTempC16[i-1]; }
+        prevRawTempC16[0] = rawTempC16;
+        if(isFiltering)
+            { if(abs(getSmoothedRecent() - rawTempC16) <= OTRadValve::ModelledRadValveState::MAX_TEMP_JUMP_C16) { isFiltering = false; } }
+        else
+            {
+            for(unsigned int i = 1; i < filterLength; ++i) { if(abs(prevRawTempC16[i] - prevRawTempC16[i-1]) > OTRadValve::ModelledRadValveState::MAX_TEMP_JUMP_C16) { isFiltering = true; break; } }
+            }
+        if(valveTurndownCountdownM > 0) { --valveTurndownCountdownM; }
+        if(valveTurnupCountdownM > 0) { --valveTurnupCountdownM; }
+        OTRadValve::ModelledRadValveState::Snapshot s;
+        s.alwaysGlacial = false;
+        s.isFiltering = isFiltering;
+        s.dontTurnup = (0 != valveTurndownCountdownM);
+        s.dontTurndown = (0 != valveTurnupCountdownM);
+        s.smoothedRecentC16 = isFiltering ? getSmoothedRecent() : 0;
+        s.rawDeltaC16 = prevRawTempC16[0] - prevRawTempC16[1];
+        s.rawDeltaWindowOpenC16 = prevRawTempC16[0] - prevRawTempC16[OTRadValve::ModelledRadValveState::MIN_WINDOW_OPEN_TEMP_FALL_M];
+        OTRadValve::ModelledRadValveState::event_t event = OTRadValve::ModelledRadValveState::MRVE_NONE;
+        const uint8_t newValvePC = OTRadValve::ModelledRadValveState::computeRequiredTRVPercentOpen(valvePCOpenRef, inputState, s, event);
+        if(newValvePC > valvePCOpenRef) { valveTurnupCountdownM = OTRadValve::DEFAULT_ANTISEEK_VALVE_RECLOSE_DELAY_M; }
+        else if(newValvePC < valvePCOpenRef) { valveTurndownCountdownM = OTRadValve::DEFAULT_ANTISEEK_VALVE_REOPEN_DELAY_M; }
+        valvePCOpenRef = newValvePC;
+        }
+};
+
+// Crude before/after benchmark of ModelledRadValveState::tick(), in ticks per second,
+// of the ring-buffer filter against the original shift-register filter.
+// Also checks that both give the same valve positions and filter state.
+TEST(ModelledRadValveFleet,ScalarFilterBenchmark)
+{
+    // If true then be more verbose.
+    const static bool verbose = false;
+
+    typedef std::chrono::steady_clock clock;
+    const int rooms = 256;
+    const int ticks = 400;
+    std::vector<OTRadValve::ModelledRadValveInputState> is(rooms);
+    std::vector<std::vector<int_fast16_t> > tempsC16(rooms);
+    for(int r = 0; r < rooms; ++r)
+        {
+        is[r].targetTempC = 12 + (OTV0P2BASE::randRNG8() % 12);
+        int_fast16_t tempC16 = (10 << 4) + (OTV0P2BASE::randRNG8() % (15 << 4));
+        for(int t = 0; t < ticks; ++t)
+            {
+            wanderInputState(is[r], tempC16);
+            tempsC16[r].push_back(tempC16);
+            }
+        }
+
+    std::vector<ShiftFilterValveState> before(rooms);
+    std::vector<uint8_t> beforeValvePC(rooms);
+    const clock::time_point t0 = clock::now();
+    for(int r = 0; r < rooms; ++r)
+        {
+        volatile uint8_t v = 0;
+        for(int t = 0; t < ticks; ++t) { is[r].setReferenceTemperatures(tempsC16[r][t]); before[r].tick(v, is[r]); }
+        beforeValvePC[r] = v;
+        }
+    const clock::time_point t1 = clock::now();
+    std::vector<OTRadValve::ModelledRadValveState> after(rooms);
+    std::vector<uint8_t> afterValvePC(rooms);
+    for(int r = 0; r < rooms; ++r)
+        {
+        volatile uint8_t v = 0;
+        for(int t = 0; t < ticks; ++t) { is[r].setReferenceTemperatures(tempsC16[r][t]); after[r].tick(v, is[r]); }
+        afterValvePC[r] = v;
+        }
+    const clock::time_point t2 = clock::now();
+
+    for(int r = 0; r < rooms; ++r)
+        {
+        ASSERT_EQ(beforeValvePC[r], afterValvePC[r]);
+        ASSERT_EQ(before[r].isFiltering, after[r].isFiltering);
+        ASSERT_EQ(before[r].getSmoothedRecent(), after[r].getSmoothedRecent());
+        for(uint8_t i = 0; i < OTRadValve::ModelledRadValveState::filterLength; ++i)
+            { ASSERT_EQ(before[r].prevRawTempC16[i], after[r].getRawTempC16(i)); }
+        }
+
+    const double n = (double)rooms * ticks;
+    const double beforeS = std::chrono::duration<double>(t1 - t0).count();
+    const double afterS = std::chrono::duration<double>(t2 - t1).count();
+    if(verbose) { fprintf(stderr, "ModelledRadValveState::tick(): shift filter %.3g, ring filter %.3g ticks/s\n", n / beforeS, n / afterS); }
+}
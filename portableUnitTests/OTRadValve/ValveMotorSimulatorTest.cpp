@@ -0,0 +1,282 @@
+/*
+The OpenTRV project licenses this file to you
+under the Apache Licence, Version 2.0 (the "Licence");
+you may not use this file except in compliance
+with the Licence. You may obtain a copy of the Licence at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing,
+software distributed under the Licence is distributed on an
+"AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+KIND, either express or implied. See the Licence for the
+specific language governing permissions and limitations
+under the Licence.
+
+Author(s) / Copyright (s): Damon Hart-Davis 2016
+*/
+
+/*
+ * OTRadValve ValveMotorSimulator tests, and regression/performance runs of the valve motor logic against it.
+ */
+
+#include <gtest/gtest.h>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+
+#include <OTRadValve.h>
+#include "OTRadValve_ValveMotorSimulator.h"
+
+
+// Callback handler recording ticks and end-stops.
+class SimCallbacks final : public OTRadValve::HardwareMotorDriverInterfaceCallbackHandler
+  {
+  public:
+    uint32_t ticksOpening = 0, ticksClosing = 0;
+    uint32_t endStops = 0;
+    virtual void signalHittingEndStop(bool) override { ++endStops; }
+    virtual void signalShaftEncoderMarkStart(bool) override { }
+    virtual void signalRunSCTTick(const bool opening) override { if(opening) { ++ticksOpening; } else { ++ticksClosing; } }
+  };
+
+// Run the simulated motor for full travel in one direction, one sub-cycle at a time as the valve logic would;
+// returns ticks called back, or 0 if the end-stop is not signalled.
+static uint32_t fullTravelTicks(OTRadValve::ValveMotorSimulator &sim, const bool opening)
+{
+    SimCallbacks cb;
+    const OTRadValve::HardwareMotorDriverInterface::motor_drive dir = opening ?
+        OTRadValve::HardwareMotorDriverInterface::motorDriveOpening : OTRadValve::HardwareMotorDriverInterface::motorDriveClosing;
+    for(int i = 0; (i < 100) && (0 == cb.endStops); ++i)
+        {
+        sim.startSubCycle();
+        sim.motorRun(~0, dir, cb);
+        sim.motorRun(0, OTRadValve::HardwareMotorDriverInterface::motorOff, cb);
+        }
+    if(0 == cb.endStops) { return(0); }
+    return(opening ? cb.ticksOpening : cb.ticksClosing);
+}
+
+// Test the basic physics: speed vs supply voltage and load, and end-stop current.
+TEST(ValveMotorSimulator,basics)
+{
+    OTRadValve::ValveMotorSimulator sim;
+    const OTRadValve::ValveMotorSimulator::Params &p = sim.getParams();
+    sim.setSupplyMV(3000);
+    // Full travel takes roughly the time seen on REV7 with fresh batteries, and closing is slower.
+    const uint32_t tc3 = fullTravelTicks(sim, false);
+    EXPECT_NEAR(p.travelUm, sim.getPositionUm(), 0.001);
+    EXPECT_EQ(0, sim.getPositionPC());
+    const uint32_t to3 = fullTravelTicks(sim, true);
+    EXPECT_EQ(0, sim.getPositionUm());
+    EXPECT_EQ(100, sim.getPositionPC());
+    EXPECT_LT(1000U, to3);
+    EXPECT_LT(to3, tc3);
+    EXPECT_GT(2000U, tc3);
+    // Slower at lower voltage, especially closing against the valve spring.
+    sim.setSupplyMV(2200);
+    const uint32_t tc2 = fullTravelTicks(sim, false);
+    const uint32_t to2 = fullTravelTicks(sim, true);
+    EXPECT_LT(tc3, tc2);
+    EXPECT_LT(to3, to2);
+    EXPECT_LT((double)to2 / to3, (double)tc2 / tc3);
+    EXPECT_EQ(4U, sim.getStats().endStopSignals);
+    EXPECT_EQ(0U, sim.getStats().falseEndStops);
+    EXPECT_LT(0, sim.getStats().energyJ);
+
+    // Current is high when stalled at an end-stop.
+    SimCallbacks cb;
+    sim.startSubCycle();
+    sim.motorRun(0, OTRadValve::HardwareMotorDriverInterface::motorDriveOpening, cb);
+    EXPECT_TRUE(sim.isCurrentHigh(OTRadValve::HardwareMotorDriverInterface::motorDriveOpening));
+    EXPECT_LT(p.maxCurrentReadingOpening, sim.getCurrentReading());
+    sim.motorRun(0, OTRadValve::HardwareMotorDriverInterface::motorOff, cb);
+    EXPECT_EQ(0, sim.getCurrentReading());
+    // A short pulse from stopped is not mistaken for an end-stop despite the start-up current surge,
+    // and the pin coasts on a little when power is removed.
+    sim.setSupplyMV(3000);
+    sim.setPositionUm(p.travelUm / 2);
+    cb = SimCallbacks();
+    sim.startSubCycle();
+    sim.motorRun(0, OTRadValve::HardwareMotorDriverInterface::motorDriveClosing, cb);
+    EXPECT_FALSE(sim.isCurrentHigh(OTRadValve::HardwareMotorDriverInterface::motorDriveClosing));
+    const double driven = sim.getPositionUm();
+    EXPECT_LT(p.travelUm / 2, driven);
+    sim.motorRun(0, OTRadValve::HardwareMotorDriverInterface::motorOff, cb);
+    EXPECT_LT(driven, sim.getPositionUm());
+    EXPECT_EQ(0U, cb.endStops);
+    EXPECT_EQ((uint32_t)p.minMotorRunupTicks * 2, cb.ticksClosing);
+}
+
+// Test the sub-cycle time budget: no start too late in the sub-cycle, and no overrun.
+TEST(ValveMotorSimulator,subCycleBudget)
+{
+    OTRadValve::ValveMotorSimulator sim;
+    const OTRadValve::ValveMotorSimulator::Params &p = sim.getParams();
+    sim.setPositionUm(p.travelUm / 2);
+    SimCallbacks cb;
+    // Too late to start at all.
+    sim.startSubCycle(p.sctAbsLimit);
+    sim.motorRun(~0, OTRadValve::HardwareMotorDriverInterface::motorDriveOpening, cb);
+    EXPECT_EQ(p.travelUm / 2, sim.getPositionUm());
+    EXPECT_EQ(0U, cb.ticksOpening);
+    // A long run stops at the limit, including the nap on starting.
+    sim.motorRun(0, OTRadValve::HardwareMotorDriverInterface::motorOff, cb);
+    sim.startSubCycle(10);
+    sim.motorRun(~0, OTRadValve::HardwareMotorDriverInterface::motorDriveOpening, cb);
+    EXPECT_EQ(p.sctAbsLimit, sim.getSubCycleTime());
+    EXPECT_EQ((uint32_t)(p.sctAbsLimit - 10 - (int)(p.dirChangeNapMS / p.tickMS)), cb.ticksOpening);
+    sim.motorRun(0, OTRadValve::HardwareMotorDriverInterface::motorOff, cb);
+    EXPECT_GT(255, sim.getSubCycleTime());
+    EXPECT_EQ(0U, sim.getStats().subCycleOverruns);
+}
+
+// Manufacturing variance is deterministic by seed and within the stated tolerances.
+TEST(ValveMotorSimulator,variance)
+{
+    const OTRadValve::ValveMotorSimulator::Params nominal;
+    for(uint32_t seed = 0; seed < 100; ++seed)
+        {
+        const OTRadValve::ValveMotorSimulator::Params v = nominal.withVariance(seed);
+        EXPECT_EQ(v.travelUm, nominal.withVariance(seed).travelUm);
+        EXPECT_NEAR(nominal.travelUm, v.travelUm, nominal.travelUm * 0.1);
+        EXPECT_NEAR(nominal.springNm, v.springNm, nominal.springNm * 0.2);
+        EXPECT_NEAR(nominal.kE, v.kE, nominal.kE * 0.05);
+        }
+    EXPECT_NE(nominal.withVariance(1).travelUm, nominal.withVariance(2).travelUm);
+}
+
+// Sub-cycle time source for the logic under test.
+static OTRadValve::ValveMotorSimulator *lifetimeSim;
+static uint8_t lifetimeSimGetSubCycleTime() { return(lifetimeSim->getSubCycleTime()); }
+
+// Results of simulated valve lifetimes.
+struct LifetimeResults
+  {
+  uint32_t lifetimes = 0;
+  // Lifetimes ending in (or failing to leave) error or calibration states.
+  uint32_t failures = 0;
+  // Motor ticks and energy.
+  uint64_t motorTicks = 0;
+  double energyJ = 0;
+  // Entries into the calibrating state, including the first.
+  uint32_t calibrations = 0;
+  // Sums and counts of absolute error of the estimated position vs actual, and of the actual position vs target, %.
+  uint64_t trackingErrorSum = 0, targetErrorSum = 0, samples = 0;
+  uint32_t trackingErrorMax = 0;
+  // False end-stops seen, and sub-cycle overruns.
+  uint32_t falseEndStops = 0, overruns = 0;
+  };
+
+// Run one valve lifetime, ie one set of batteries, of the given logic driving a simulated valve body.
+// Batteries droop from 3.2V to 2.2V over the lifetime, the target changes targets times,
+// and each target is polled (every 2s) until the motor has been idle in normal running for two polls.
+template <class Logic>
+static void runLifetime(LifetimeResults &r, const uint32_t seed, const int targets)
+{
+    static const OTRadValve::ValveMotorSimulator::Params nominal;
+    OTRadValve::ValveMotorSimulator sim(nominal.withVariance(seed));
+    lifetimeSim = &sim;
+    const uint8_t subcycleTicksRoundedDown_ms = 7; // For REV7: OTV0P2BASE::SUBCYCLE_TICK_MS_RD.
+    const uint8_t gsct_max = 255; // For REV7: OTV0P2BASE::GSCT_MAX.
+    Logic logic(&sim, lifetimeSimGetSubCycleTime,
+        OTRadValve::CurrentSenseValveMotorDirect::computeMinMotorDRTicks(subcycleTicksRoundedDown_ms),
+        OTRadValve::CurrentSenseValveMotorDirect::computeSctAbsLimit(subcycleTicksRoundedDown_ms, gsct_max, sim.getParams().minMotorRunupTicks));
+    // Polls start a little way into the sub-cycle, after other work.
+    uint32_t rng = seed + 1;
+    auto next = [&rng]() { rng = (rng * 1103515245U) + 12345U; return(rng >> 16); };
+    int calibrations = 0;
+    auto poll = [&]()
+      {
+      const bool wasCalibrating = (OTRadValve::CurrentSenseValveMotorDirect::valveCalibrating == logic.getState());
+      sim.startSubCycle((uint8_t)(next() & 0x3f));
+      logic.poll();
+      if(!wasCalibrating && (OTRadValve::CurrentSenseValveMotorDirect::valveCalibrating == logic.getState())) { ++calibrations; }
+      };
+
+    sim.setSupplyMV(3200);
+    for(int i = 0; (i < 1000) && !logic.isWaitingForValveToBeFitted(); ++i) { poll(); }
+    logic.signalValveFitted();
+    for(int i = 0; (i < 1000) && !logic.isInNormalRunState() && !logic.isInErrorState(); ++i) { poll(); }
+    bool failed = !logic.isInNormalRunState();
+    uint8_t target = 50;
+    for(int t = 0; !failed && (t < targets); ++t)
+        {
+        sim.setSupplyMV((uint16_t)(3200 - ((1000L * t) / targets)));
+        // Mostly intermediate targets drifting with demand, occasionally fully open or closed.
+        const uint32_t r8 = next() % 100;
+        if(r8 < 5) { target = 0; }
+        else if(r8 < 10) { target = 100; }
+        else { target = (uint8_t)OTV0P2BASE::fnconstrain((int)target + (int)(next() % 41) - 20, 0, 100); }
+        logic.setTargetPC(target);
+        int idle = 0;
+        for(int i = 0; (i < 500) && (idle < 2); ++i)
+            {
+            const uint32_t ticks = sim.getStats().motorTicks;
+            poll();
+            idle = ((ticks == sim.getStats().motorTicks) && logic.isInNormalRunState()) ? (idle + 1) : 0;
+            }
+        if(!logic.isInNormalRunState()) { failed = true; break; }
+        const uint8_t actual = sim.getPositionPC();
+        const uint32_t trackingError = (uint32_t)abs((int)logic.getCurrentPC() - (int)actual);
+        r.trackingErrorSum += trackingError;
+        r.targetErrorSum += (uint32_t)abs((int)target - (int)actual);
+        r.trackingErrorMax = OTV0P2BASE::fnmax(r.trackingErrorMax, trackingError);
+        ++r.samples;
+        }
+
+    ++r.lifetimes;
+    if(failed) { ++r.failures; }
+    r.calibrations += calibrations;
+    r.motorTicks += sim.getStats().motorTicks;
+    r.energyJ += sim.getStats().energyJ;
+    r.falseEndStops += sim.getStats().falseEndStops;
+    r.overruns += sim.getStats().subCycleOverruns;
+}
+
+template <class Logic>
+static LifetimeResults runLifetimes(const char *const name, const int lifetimes, const int targets, const bool verbose)
+{
+    typedef std::chrono::steady_clock clock;
+    LifetimeResults r;
+    const clock::time_point t0 = clock::now();
+    for(int i = 0; i < lifetimes; ++i) { runLifetime<Logic>(r, (uint32_t)i, targets); }
+    const double s = std::chrono::duration<double>(clock::now() - t0).count();
+    if(verbose) fprintf(stderr, "%s: %u lifetimes (%.3gs): %.0f motor ticks and %.1fJ per lifetime, %.2f calibrations per lifetime, tracking error mean %.1f%% max %u%%, target error mean %.1f%%, %u false end-stops, %u failures, %u overruns\n",
+        name, r.lifetimes, s, (double)r.motorTicks / r.lifetimes, r.energyJ / r.lifetimes, (double)r.calibrations / r.lifetimes,
+        (double)r.trackingErrorSum / r.samples, r.trackingErrorMax, (double)r.targetErrorSum / r.samples,
+        r.falseEndStops, r.failures, r.overruns);
+    return(r);
+}
+
+// Regression and performance run of the valve logic variants used by ValveMotorDirectV1
+// over simulated valve lifetimes with manufacturing variance.
+// By default runs just a few lifetimes to check the regression limits quickly.
+// Set OTRADVALVE_SIM_LIFETIMES in the environment to the number of lifetimes to run,
+// eg 1000 for the full performance run (about 16s),
+// which also reports energy, positional error and calibration frequency.
+TEST(ValveMotorSimulator,lifetimes)
+{
+    const char *const env = getenv("OTRADVALVE_SIM_LIFETIMES");
+    const int lifetimes = (NULL != env) ? OTV0P2BASE::fnmax(1, atoi(env)) : 10;
+    const bool verbose = (NULL != env);
+    const int targets = 200;
+    const LifetimeResults prop = runLifetimes<OTRadValve::CurrentSenseValveMotorDirect>("CurrentSenseValveMotorDirect", lifetimes, targets, verbose);
+    const LifetimeResults binary = runLifetimes<OTRadValve::CurrentSenseValveMotorDirectBinaryOnly>("CurrentSenseValveMotorDirectBinaryOnly", lifetimes, targets, verbose);
+
+    // Regression limits, with some headroom.
+    EXPECT_EQ(0U, prop.failures);
+    EXPECT_EQ(0U, binary.failures);
+    EXPECT_EQ(0U, prop.overruns);
+    EXPECT_EQ(0U, binary.overruns);
+    // Rarely more than the initial calibration.
+    EXPECT_GT(1.1, (double)prop.calibrations / prop.lifetimes);
+    // Proportional control tracks position and hits targets reasonably well,
+    // though dead-reckoning drifts between end-stop hits as the valve spring makes speed vary along the travel.
+    EXPECT_GT(10.0, (double)prop.trackingErrorSum / prop.samples);
+    EXPECT_GT(10.0, (double)prop.targetErrorSum / prop.samples);
+    // Binary-only knows where it is but only goes fully open or closed.
+    EXPECT_GT(1.0, (double)binary.trackingErrorSum / binary.samples);
+    EXPECT_LT((double)prop.targetErrorSum / prop.samples, (double)binary.targetErrorSum / binary.samples);
+}
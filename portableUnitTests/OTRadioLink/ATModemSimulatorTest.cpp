@@ -0,0 +1,375 @@
+/*
+The OpenTRV project licenses this file to you
+under the Apache Licence, Version 2.0 (the "Licence");
+you may not use this file except in compliance
+with the Licence. You may obtain a copy of the Licence at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing,
+software distributed under the Licence is distributed on an
+"AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+KIND, either express or implied. See the Licence for the
+specific language governing permissions and limitations
+under the Licence.
+
+Author(s) / Copyright (s): Damon Hart-Davis 2016
+*/
+
+/*
+ * AT modem simulator tests, and link benchmarks against it.
+ */
+
+#include <gtest/gtest.h>
+#include <stdio.h>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "OTSIM900Link.h"
+#include "OTRadioLink_ATModemSimulator.h"
+
+namespace ATSimTest
+{
+// Write s to sim as a command line, let virtual time pass, and return everything then readable.
+std::string converse(OTRadioLink::ATModemSimulator &sim, const std::string &s, const uint64_t waitUs = 1000000)
+    {
+    sim.print(s.c_str());
+    sim.print("\r\n");
+    sim.advance(waitUs);
+    std::string r;
+    for(int c; (c = sim.read()) >= 0; ) { r += (char)c; }
+    return(r);
+    }
+}
+
+// Test rule matching, echo and the default reply.
+TEST(ATModemSimulator,rules)
+{
+    OTRadioLink::ATModemSimulator sim;
+    sim.addRule("AT", "\r\nOK\r\n");
+    sim.addRule("AT+X=*", [](OTRadioLink::ATModemSimulator &, const std::string &c) { return("\r\n" + c.substr(5) + "\r\n"); });
+    sim.setDefaultReply("\r\nERROR\r\n");
+    EXPECT_EQ("\r\nOK\r\n", ATSimTest::converse(sim, "AT"));
+    EXPECT_EQ("\r\n42\r\n", ATSimTest::converse(sim, "AT+X=42"));
+    EXPECT_EQ("\r\nERROR\r\n", ATSimTest::converse(sim, "AT+X"));
+    EXPECT_EQ("\r\nERROR\r\n", ATSimTest::converse(sim, "ATX"));
+    sim.setEcho(true);
+    EXPECT_EQ("AT\r\n\r\nOK\r\n", ATSimTest::converse(sim, "AT"));
+    // Empty lines are ignored, and bare LF ends a line too.
+    sim.print("\r\n\r\nAT\n");
+    sim.advance(1);
+    EXPECT_EQ(10, sim.available());
+    EXPECT_EQ('A', sim.peek());
+    EXPECT_EQ(6U, sim.getStats().commands);
+    // A dead simulator hears nothing.
+    sim.flushOutput();
+    sim.setResponsive(false);
+    EXPECT_EQ("", ATSimTest::converse(sim, "AT"));
+    EXPECT_EQ(6U, sim.getStats().commands);
+}
+
+// Test that replies arrive only after the latency and paced at the baud rate.
+TEST(ATModemSimulator,timing)
+{
+    OTRadioLink::ATModemSimulator sim;
+    sim.addRule("AT", "\r\nOK\r\n");
+    sim.setLatency(5000, 5000);
+    sim.print("AT\r\n");
+    EXPECT_EQ(0U, sim.now());
+    sim.advance(4999);
+    EXPECT_EQ(0, sim.available());
+    sim.advance(1);
+    EXPECT_EQ(6, sim.available());
+    while(sim.read() >= 0) { }
+
+    // At 9600 baud each byte takes 1041us each way.
+    // The reply is timed from the CR, so overlaps the LF.
+    sim.setBaud(9600);
+    const uint64_t t0 = sim.now();
+    sim.print("AT\r\n");
+    EXPECT_EQ(t0 + (4 * 1041), sim.now());
+    sim.advance(5000 - 1);
+    EXPECT_EQ(0, sim.available());
+    sim.advance(1);
+    EXPECT_EQ(1, sim.available());
+    sim.advance(5 * 1041);
+    EXPECT_EQ(6, sim.available());
+
+    // Random latency stays within its bounds.
+    sim.setBaud(0);
+    sim.setLatency(1000, 2000);
+    for(int i = 0; i < 100; ++i)
+        {
+        while(sim.read() >= 0) { }
+        sim.print("AT\r\n");
+        sim.advance(999);
+        EXPECT_EQ(0, sim.available());
+        sim.advance(1001);
+        EXPECT_EQ(6, sim.available());
+        }
+}
+
+// Test command loss and reply corruption, which must be repeatable for a given seed.
+TEST(ATModemSimulator,impairments)
+{
+    OTRadioLink::ATModemSimulator sim;
+    sim.addRule("AT", "\r\nOK\r\n");
+    sim.setLossRate(1);
+    EXPECT_EQ("", ATSimTest::converse(sim, "AT"));
+    EXPECT_EQ(1U, sim.getStats().lost);
+    sim.setLossRate(0.5f);
+    int replies = 0;
+    for(int i = 0; i < 1000; ++i) { if(!ATSimTest::converse(sim, "AT").empty()) { ++replies; } }
+    EXPECT_LT(400, replies);
+    EXPECT_GT(600, replies);
+    EXPECT_EQ(1001U, sim.getStats().lost + replies);
+
+    std::string g[2];
+    for(int run = 0; run < 2; ++run)
+        {
+        OTRadioLink::ATModemSimulator s;
+        s.setSeed(1234);
+        s.addRule("AT", "\r\nOK\r\n");
+        s.setGarbageRate(0.3f);
+        for(int i = 0; i < 100; ++i) { g[run] += ATSimTest::converse(s, "AT"); }
+        EXPECT_EQ(600U, g[run].size());
+        EXPECT_LT(100U, s.getStats().corrupted);
+        EXPECT_GT(260U, s.getStats().corrupted);
+        }
+    EXPECT_EQ(g[0], g[1]);
+    sim.setLossRate(0);
+    sim.injectGarbage(10, 100);
+    sim.advance(99);
+    EXPECT_EQ(0, sim.available());
+    sim.advance(1);
+    EXPECT_EQ(10, sim.available());
+}
+
+// Test binary data after a command, and that unsolicited output from a handler follows its reply.
+TEST(ATModemSimulator,dataAndUnsolicited)
+{
+    OTRadioLink::ATModemSimulator sim;
+    std::string got;
+    sim.addRule("SEND=*", [&got](OTRadioLink::ATModemSimulator &m, const std::string &c)
+        {
+        m.expectData((size_t)atoi(c.c_str() + 5), [&got](OTRadioLink::ATModemSimulator &, const std::string &d) { got = d; return(std::string("SENT\r\n")); });
+        m.sendUnsolicited("LATE\r\n");
+        return(std::string(">"));
+        });
+    sim.print("SEND=4\r\n");
+    sim.advance(1);
+    // The LF after the CR is not data.
+    sim.print("a\r\nb");
+    sim.advance(1);
+    EXPECT_EQ("a\r\nb", got);
+    std::string r;
+    for(int c; (c = sim.read()) >= 0; ) { r += (char)c; }
+    EXPECT_EQ(">LATE\r\nSENT\r\n", r);
+    EXPECT_EQ(1U, sim.getStats().dataBlocks);
+
+    // A port with no simulator is a dead line.
+    typedef OTRadioLink::ATModemSimulatorPort<99> P;
+    P p;
+    EXPECT_EQ(1U, p.write('A'));
+    EXPECT_EQ(-1, p.read());
+    P::sim = &sim;
+    p.print("SEND=1\r\nx");
+    sim.advance(1);
+    EXPECT_EQ("x", got);
+    EXPECT_EQ('>', p.read());
+    P::sim = NULL;
+}
+
+// Test the RN2483 command set through a typical session, including duty cycle limits.
+TEST(ATModemSimulator,RN2483CommandSet)
+{
+    typedef OTRadioLink::RN2483CommandSet R;
+    // Time on air for 10 application bytes, from the Semtech LoRa calculator.
+    EXPECT_EQ(61696U, R::airtimeUs(10, 5));
+    EXPECT_EQ(1482752U, R::airtimeUs(10, 0));
+    EXPECT_LT(R::airtimeUs(10, 5), R::airtimeUs(50, 5));
+
+    OTRadioLink::ATModemSimulator sim;
+    sim.setBaud(57600);
+    sim.setLatency(1000, 10000);
+    R rn;
+    rn.install(sim);
+    EXPECT_EQ(0U, ATSimTest::converse(sim, "sys get ver").find("RN2483"));
+    EXPECT_EQ("not_joined\r\n", ATSimTest::converse(sim, "mac tx uncnf 1 0102"));
+    EXPECT_EQ("ok\r\n", ATSimTest::converse(sim, "Umac set devaddr 02011123"));
+    EXPECT_EQ("invalid_param\r\n", ATSimTest::converse(sim, "mac set dr 9"));
+    EXPECT_EQ("ok\r\n", ATSimTest::converse(sim, "mac set dr 4"));
+    EXPECT_EQ("4\r\n", ATSimTest::converse(sim, "mac get dr"));
+    EXPECT_EQ("0000\r\n", ATSimTest::converse(sim, "mac get status"));
+    EXPECT_EQ("ok\r\naccepted\r\n", ATSimTest::converse(sim, "mac join abp"));
+    EXPECT_EQ("0001\r\n", ATSimTest::converse(sim, "mac get status"));
+    EXPECT_EQ("invalid_param\r\n", ATSimTest::converse(sim, "mac tx uncnf 1 0g"));
+    EXPECT_EQ("invalid_param\r\n", ATSimTest::converse(sim, "mac tx uncnf 0 00"));
+    EXPECT_EQ("ok\r\nmac_tx_ok\r\n", ATSimTest::converse(sim, "mac tx uncnf 2 0a0B"));
+    ASSERT_EQ(1U, rn.payloads.size());
+    EXPECT_EQ(std::string("\x0a\x0b"), rn.payloads[0]);
+    EXPECT_EQ(2, rn.ports[0]);
+    // At 1% duty cycle the channel is then busy for 100 times the time on air.
+    const uint64_t busyUs = (uint64_t)R::airtimeUs(2, 4) * 100;
+    EXPECT_EQ("no_free_ch\r\n", ATSimTest::converse(sim, "mac tx uncnf 1 00"));
+    EXPECT_EQ(1U, rn.noFreeChannel);
+    sim.advance(busyUs);
+    EXPECT_EQ("ok\r\n", ATSimTest::converse(sim, "mac tx cnf 1 00", 20000));
+    EXPECT_EQ("mac_tx_ok\r\n", ATSimTest::converse(sim, "", 1000000));
+    EXPECT_EQ(2U, rn.payloads.size());
+    // Sleep replies once done.
+    EXPECT_EQ("", ATSimTest::converse(sim, "sys sleep 100", 50000));
+    EXPECT_EQ("ok\r\n", ATSimTest::converse(sim, "", 100000));
+    EXPECT_EQ(0U, ATSimTest::converse(sim, "sys reset").find("RN2483"));
+    EXPECT_FALSE(rn.isJoined());
+}
+
+namespace ATSimTest
+{
+const char SIM900_PIN[] = "1111";
+const char SIM900_APN[] = "apn";
+const char SIM900_UDP_ADDR[] = "0.0.0.0";
+const char SIM900_UDP_PORT[] = "9999";
+const OTSIM900Link::OTSIM900LinkConfig_t SIM900Config(false, SIM900_PIN, SIM900_APN, SIM900_UDP_ADDR, SIM900_UDP_PORT);
+const OTRadioLink::OTRadioChannelConfig l0Config(&SIM900Config, true);
+
+// Interval between link polls, in virtual time.
+// Note that off the AVR the link times out AT commands after a couple of polls.
+static const uint32_t pollUs = 100000;
+
+// A SIM900 on a 9600 baud line, with a coalescing link in front of it, running in virtual time.
+// As power key toggles cannot be seen by the simulator, the modem is rebooted whenever the link resets it.
+class SIM900Bench final
+    {
+    public:
+        typedef OTSIM900Link::OTSIM900Link<0, 0, 0, OTRadioLink::ATModemSimulatorPort<1>, 8, true> Link;
+        OTRadioLink::ATModemSimulator sim;
+        OTRadioLink::SIM900CommandSet sim900;
+        Link l;
+        // Frames queued and delivered in datagrams.
+        std::set<std::string> sent;
+        unsigned long framesQueued = 0, framesDelivered = 0;
+        size_t datagramsSeen = 0;
+
+        SIM900Bench(const uint32_t seed, const float loss, const float garbage)
+            {
+            sim.setSeed(seed);
+            sim.setBaud(9600);
+            sim.setLatency(10000, 50000);
+            sim.setLossRate(loss);
+            sim.setGarbageRate(garbage);
+            sim900.registrationDelayUs = 3000000;
+            sim900.gprsDelayUs = 20000;
+            sim900.connectDelayUs = 20000;
+            sim900.reboot();
+            sim900.install(sim);
+            OTRadioLink::ATModemSimulatorPort<1>::sim = &sim;
+            EXPECT_TRUE(l.configure(1, &l0Config));
+            EXPECT_TRUE(l.begin());
+            }
+        ~SIM900Bench() { OTRadioLink::ATModemSimulatorPort<1>::sim = NULL; }
+
+        // Advance one poll interval, optionally keeping the TX queue topped up.
+        void step(const bool feed)
+            {
+            sim.advance(pollUs);
+            const OTSIM900Link::OTSIM900LinkState before = l._getState();
+            l.poll();
+            if((OTSIM900Link::RESET == l._getState()) && (OTSIM900Link::RESET != before)) { sim900.reboot(); }
+            while(feed && (l.getTXMsgsQueued() < 8))
+                {
+                char frame[64];
+                const int len = snprintf(frame, sizeof(frame), "{\"@\":\"414a\",\"T|C16\":%lu,\"b\":1}", framesQueued);
+                if(!l.queueToSend((const uint8_t *)frame, (uint8_t)len, 0, OTRadioLink::OTRadioLink::TXnormal)) { break; }
+                sent.insert(std::string(frame, len));
+                ++framesQueued;
+                }
+            for( ; datagramsSeen < sim900.datagrams.size(); ++datagramsSeen)
+                {
+                const std::string &d = sim900.datagrams[datagramsSeen];
+                OTSIM900Link::OTSIM900CoalescedFrameReader r((const uint8_t *)d.data(), d.size());
+                const uint8_t *f;
+                uint8_t len;
+                while(r.next(f, len)) { if(sent.count(std::string((const char *)f, len))) { ++framesDelivered; } }
+                }
+            }
+
+        // Step until the link is idle, up to maxS virtual seconds; returns seconds taken, or -1 if not.
+        double converge(const double maxS)
+            {
+            const uint64_t t0 = sim.now();
+            while(OTSIM900Link::IDLE != l._getState())
+                {
+                if(sim.now() - t0 > maxS * 1e6) { return(-1); } // FAIL
+                step(false);
+                }
+            return((sim.now() - t0) / 1e6);
+            }
+
+        // Step with traffic until the link is idle, eg to inject a fault between sends.
+        void untilIdle()
+            { do { step(true); } while(OTSIM900Link::IDLE != l._getState()); }
+
+        // Step with traffic until a datagram arrives, up to maxS virtual seconds; returns seconds taken, or -1 if not.
+        double untilDatagram(const double maxS)
+            {
+            const uint64_t t0 = sim.now();
+            const size_t n = sim900.datagrams.size();
+            while(sim900.datagrams.size() == n)
+                {
+                if(sim.now() - t0 > maxS * 1e6) { return(-1); } // FAIL
+                step(true);
+                }
+            return((sim.now() - t0) / 1e6);
+            }
+    };
+}
+
+// Benchmark OTSIM900Link against a simulated SIM900 on increasingly poor lines, in virtual time:
+//   * convergence, from begin() to IDLE with registration taking 3s
+//   * throughput of frames delivered with the TX queue kept full
+//   * recovery after the GPRS context drops, and after the modem restarts unprompted, to the next datagram.
+TEST(ATModemSimulator,SIM900LinkBenchmark)
+{
+    // If true then be more verbose.
+    const static bool verbose = false;
+
+    struct Line { float loss, garbage; };
+    static const Line lines[] = { { 0, 0 }, { 0.02f, 0.0005f }, { 0.1f, 0.002f } };
+    const double runS = 300;
+    for(size_t i = 0; i < sizeof(lines)/sizeof(lines[0]); ++i)
+        {
+        ATSimTest::SIM900Bench b(42 + i, lines[i].loss, lines[i].garbage);
+        const double convergeS = b.converge(600);
+        ASSERT_LT(0, convergeS);
+        const uint64_t t0 = b.sim.now();
+        const unsigned long f0 = b.framesDelivered;
+        while(b.sim.now() - t0 < runS * 1e6) { b.step(true); }
+        const double msgsPerS = (b.framesDelivered - f0) / runS;
+        EXPECT_LT(0, msgsPerS);
+        b.untilIdle();
+        b.sim900.dropGPRS();
+        const double dropS = b.untilDatagram(600);
+        EXPECT_LT(0, dropS);
+        b.untilIdle();
+        b.sim900.reboot();
+        const double rebootS = b.untilDatagram(600);
+        EXPECT_LT(0, rebootS);
+        if(0 == i)
+            {
+            // On a clean line every frame queued is delivered, bar any in flight or dropped across a reset.
+            EXPECT_LT(convergeS, 10);
+            EXPECT_LT(dropS, 30);
+            EXPECT_LT(rebootS, 30);
+            EXPECT_LE(b.framesDelivered, b.framesQueued);
+            EXPECT_EQ(0U, b.sim.getStats().lost);
+            }
+        if(verbose)
+            {
+            fprintf(stderr, "SIM900 link, loss %g, garbage %g: converge %.3gs, %.3g msgs/s, recover %.3gs after PDP deact, %.3gs after modem reset; %u cmds, %u lost, %u bytes corrupted\n",
+                lines[i].loss, lines[i].garbage, convergeS, msgsPerS, dropS, rebootS,
+                b.sim.getStats().commands, b.sim.getStats().lost, b.sim.getStats().corrupted);
+            }
+        }
+}
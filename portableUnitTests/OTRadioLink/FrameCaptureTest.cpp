@@ -0,0 +1,394 @@
+/*
+The OpenTRV project licenses this file to you
+under the Apache Licence, Version 2.0 (the "Licence");
+you may not use this file except in compliance
+with the Licence. You may obtain a copy of the Licence at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing,
+software distributed under the Licence is distributed on an
+"AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+KIND, either express or implied. See the Licence for the
+specific language governing permissions and limitations
+under the Licence.
+
+Author(s) / Copyright (s): Damon Hart-Davis 2016
+*/
+
+/*
+ * OTRadioLink frame capture/replay tests and benchmark.
+ */
+
+#include <gtest/gtest.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include <OTRadioLink.h>
+#include "OTV0P2BASE_MappedFile.h"
+#include "OTRadioLink_FrameCapture.h"
+
+#ifdef OTV0P2BASE_PLATFORM_HAS_mmap
+
+namespace {
+
+// All-zeros key; the NULL crypto implementation ignores the key value.
+const uint8_t zeroKey[16] = { };
+
+// Synthetic valid frame for node n, of kind k: 0 secure, 1 non-secure, 2 full stats, 3 JSON, 4 CC1.
+// Returns the frame length.
+uint8_t makeFrame(uint8_t *const buf, const uint8_t buflen, const uint8_t n, const uint8_t k)
+    {
+    const uint8_t id[] = { n, 0x81, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87 };
+    const uint8_t body[] = { 0x7f, 0x11 };
+    switch(k)
+        {
+        case 0:
+            {
+            uint8_t iv[12] = { n, 0x81, 0x82, 0x83, 0x84, 0x85, 0, 0, 0, 1, 0, 1 };
+            return(OTRadioLink::SimpleSecureFrame32or0BodyTXBase::encodeSecureSmallFrameRaw(buf, buflen,
+                OTRadioLink::FTS_BasicSensorOrValve, id, 4, body, sizeof(body), iv,
+                OTRadioLink::fixed32BTextSize12BNonce16BTagSimpleEnc_NULL_IMPL, NULL, zeroKey));
+            }
+        case 1:
+            { return(OTRadioLink::encodeNonsecureSmallFrame(buf, buflen, OTRadioLink::FTS_BasicSensorOrValve, 0, id, 4, body, sizeof(body))); }
+        case 2:
+            {
+            OTV0P2BASE::FullStatsMessageCore_t content;
+            OTV0P2BASE::clearFullStatsMessageCore(&content);
+            content.containsID = true;
+            content.id0 = n | 0x80;
+            content.id1 = 0x81;
+            content.containsAmbL = true;
+            content.ambL = 42;
+            const uint8_t *const e = OTV0P2BASE::encodeFullStatsMessageCore(buf, buflen, OTV0P2BASE::stTXalwaysAll, false, &content);
+            return((NULL == e) ? 0 : (uint8_t)(e - buf));
+            }
+        case 3:
+            {
+            char json[OTV0P2BASE::MSG_JSON_ABS_MAX_LENGTH + 2] = { };
+            snprintf(json, sizeof(json), "{\"@\":\"%02x81\",\"T|C16\":%d}", n, 300 + n);
+            const uint8_t crc = OTV0P2BASE::adjustJSONMsgForTXAndComputeCRC(json);
+            const uint8_t l = (uint8_t)strlen(json);
+            if((crc & 0x80) || (l + 1 > buflen)) { return(0); }
+            memcpy(buf, json, l);
+            buf[l] = crc;
+            return(l + 1);
+            }
+        default:
+            {
+            memset(buf, 0x10, 8);
+            buf[0] = OTRadioLink::FTp2_CC1Alert;
+            buf[1] = n;
+            return(8);
+            }
+        }
+    }
+
+// Creates an empty temporary file, returning its path in path.
+void makeTempFile(char (&path)[32])
+    {
+    strcpy(path, "/tmp/FrameCaptureTestXXXXXX");
+    const int fd = mkstemp(path);
+    ASSERT_LE(0, fd);
+    close(fd);
+    }
+
+// Per-bucket state for checking replay order; each bucket is only touched by one shard thread.
+struct OrderCheck
+    {
+    bool outOfOrder[OTRadioLink::FrameCaptureNodeBuckets];
+    uint64_t lastMS[OTRadioLink::FrameCaptureNodeBuckets];
+    };
+void checkOrder(void *const context, const OTRadioLink::FrameCaptureRecord &r, OTRadioLink::FrameDemuxClass, bool)
+    {
+    OrderCheck &oc = *static_cast<OrderCheck *>(context);
+    const uint8_t b = OTRadioLink::getFrameCaptureNodeBucket(r.frame, r.len);
+    if(r.timeMS < oc.lastMS[b]) { oc.outOfOrder[b] = true; }
+    oc.lastMS[b] = r.timeMS;
+    }
+
+}
+
+
+// Test classification, decoding and node buckets of captured frames.
+TEST(FrameCapture,decodeFrame)
+{
+    uint8_t buf[64];
+    bool decoded;
+    uint8_t bucket;
+    const OTRadioLink::FrameDemuxClass expected[] =
+        { OTRadioLink::FDC_SECURE, OTRadioLink::FDC_SECUREABLE, OTRadioLink::FDC_FULL_STATS, OTRadioLink::FDC_JSON, OTRadioLink::FDC_CC1 };
+    for(uint8_t k = 0; k < 5; ++k)
+        {
+        const uint8_t l = makeFrame(buf, sizeof(buf), 0xa3, k);
+        ASSERT_LT(0, l) << (int)k;
+        EXPECT_EQ(expected[k], OTRadioLink::FrameCaptureReplay::decodeFrame(buf, l, decoded, bucket)) << (int)k;
+        // All but CC1 are fully checked.
+        EXPECT_EQ(k != 4, decoded) << (int)k;
+        // All frames from node 0xa3 are in the same bucket.
+        EXPECT_EQ(0xa3 % OTRadioLink::FrameCaptureNodeBuckets, bucket) << (int)k;
+        EXPECT_EQ(bucket, OTRadioLink::getFrameCaptureNodeBucket(buf, l));
+        // Corruption is caught.
+        if(k < 4)
+            {
+            buf[l - 1] ^= 0x5a;
+            EXPECT_EQ(expected[k], OTRadioLink::FrameCaptureReplay::decodeFrame(buf, l, decoded, bucket)) << (int)k;
+            EXPECT_EQ(0 == k, decoded) << (int)k; // Secure frames are not authenticated.
+            }
+        }
+    EXPECT_EQ(OTRadioLink::FDC_UNKNOWN, OTRadioLink::FrameCaptureReplay::decodeFrame(buf, 0, decoded, bucket));
+    EXPECT_FALSE(decoded);
+    EXPECT_EQ(0, bucket);
+}
+
+// Test writing, appending to, reading back and splitting a capture, including when damaged.
+TEST(FrameCapture,roundTrip)
+{
+    char path[32];
+    makeTempFile(path);
+    // Small segments to exercise the index.
+    OTRadioLink::FrameCaptureWriter w(5);
+    ASSERT_TRUE(w.open(path));
+    uint8_t buf[64];
+    std::vector<uint64_t> times;
+    std::vector<std::vector<uint8_t> > frames;
+    uint64_t t = 1475900000000ULL;
+    for(int i = 0; i < 23; ++i)
+        {
+        // Time goes backwards once, eg on a clock correction.
+        t = (11 == i) ? (t - 5000) : (t + 100 + (i * 37));
+        const uint8_t l = makeFrame(buf, sizeof(buf), (uint8_t)i, (uint8_t)(i % 5));
+        ASSERT_TRUE(w.append(t, (uint8_t)(i & 1), (uint8_t)(0x80 + i), buf, l));
+        times.push_back(t);
+        frames.push_back(std::vector<uint8_t>(buf, buf + l));
+        }
+    ASSERT_TRUE(w.close());
+    // Append more after reopening.
+    ASSERT_TRUE(w.open(path));
+    for(int i = 23; i < 30; ++i)
+        {
+        t += 1000;
+        const uint8_t l = makeFrame(buf, sizeof(buf), (uint8_t)i, (uint8_t)(i % 5));
+        ASSERT_TRUE(w.append(t, (uint8_t)(i & 1), (uint8_t)(0x80 + i), buf, l));
+        times.push_back(t);
+        frames.push_back(std::vector<uint8_t>(buf, buf + l));
+        }
+    ASSERT_TRUE(w.close());
+    EXPECT_FALSE(w.isOpen());
+
+    const OTV0P2BASE::MappedFile m(path);
+    ASSERT_TRUE(m.isOpen());
+    EXPECT_EQ(m.getSize(), (size_t)w.getSize());
+    OTRadioLink::FrameCaptureReader r(m.getData(), m.getSize());
+    ASSERT_TRUE(r.isValid());
+    OTRadioLink::FrameCaptureRecord rec;
+    size_t n = 0;
+    while(r.next(rec))
+        {
+        ASSERT_LT(n, frames.size());
+        EXPECT_EQ(times[n], rec.timeMS) << n;
+        EXPECT_EQ(n & 1, rec.channel);
+        EXPECT_EQ(0x80 + n, rec.rssi);
+        EXPECT_EQ(OTRadioLink::getFrameCaptureNodeBucket(rec.frame, rec.len), rec.bucket);
+        ASSERT_EQ(frames[n].size(), rec.len);
+        EXPECT_EQ(0, memcmp(&frames[n][0], rec.frame, rec.len));
+        ++n;
+        }
+    EXPECT_EQ(frames.size(), n);
+    EXPECT_FALSE(r.isDamaged());
+
+    // Segments from the index chain: 5+5+1 frames, then 5+5+2 after the backwards step, then 5+2 after reopening.
+    std::vector<OTRadioLink::FrameCaptureSegment> segments;
+    ASSERT_TRUE(OTRadioLink::FrameCaptureReader::getSegments(m.getData(), m.getSize(), segments));
+    const uint32_t expectedFrames[] = { 5, 5, 1, 5, 5, 2, 5, 2 };
+    ASSERT_EQ(sizeof(expectedFrames)/sizeof(expectedFrames[0]), segments.size());
+    n = 0;
+    for(size_t i = 0; i < segments.size(); ++i)
+        {
+        const OTRadioLink::FrameCaptureSegment &s = segments[i];
+        EXPECT_EQ(expectedFrames[i], s.frames) << i;
+        EXPECT_EQ(times[n], s.firstMS) << i;
+        OTRadioLink::FrameCaptureReader sr(m.getData(), m.getSize(), s);
+        uint32_t count = 0;
+        uint32_t mask = 0;
+        while(sr.next(rec))
+            {
+            EXPECT_EQ(times[n], rec.timeMS) << n;
+            mask |= 1U << OTRadioLink::getFrameCaptureNodeBucket(rec.frame, rec.len);
+            ++count;
+            ++n;
+            }
+        EXPECT_EQ(s.frames, count);
+        EXPECT_EQ(mask, s.bucketMask);
+        EXPECT_EQ(times[n-1], s.lastMS) << i;
+        }
+
+    // Cut short mid-record, eg by a crash: everything complete is still readable.
+    const size_t cut = m.getSize() - OTRadioLink::FrameCaptureIndexBytes - 3;
+    OTRadioLink::FrameCaptureReader rc(m.getData(), cut);
+    n = 0;
+    while(rc.next(rec)) { ++n; }
+    EXPECT_EQ(frames.size() - 1, n);
+    EXPECT_TRUE(rc.isDamaged());
+    ASSERT_TRUE(OTRadioLink::FrameCaptureReader::getSegments(m.getData(), cut, segments));
+    ASSERT_EQ(sizeof(expectedFrames)/sizeof(expectedFrames[0]), segments.size());
+    EXPECT_EQ(1U, segments.back().frames);
+    EXPECT_EQ(~0U, segments.back().bucketMask); // Not indexed.
+    OTRadioLink::FrameCaptureReplay replay;
+    const OTRadioLink::FrameCaptureReplayStats stats = replay.replay(m.getData(), cut);
+    EXPECT_EQ(frames.size() - 1, stats.frames);
+
+    // A truncated file is not extended, nor is a non-capture.
+    ASSERT_EQ(0, truncate(path, (off_t)cut));
+    EXPECT_FALSE(w.open(path));
+    FILE *const f = fopen(path, "wb");
+    ASSERT_TRUE(NULL != f);
+    fputs("2016-10-08T09:33:12Z |8 !\n", f);
+    fclose(f);
+    EXPECT_FALSE(w.open(path));
+    unlink(path);
+    EXPECT_FALSE(OTRadioLink::FrameCaptureReader(NULL, 0).isValid());
+}
+
+// Test that sharded replay across threads matches a single-threaded one,
+// with each node handled by one shard, in capture order.
+TEST(FrameCapture,shardedReplay)
+{
+    char path[32];
+    makeTempFile(path);
+    OTRadioLink::FrameCaptureWriter w(64);
+    ASSERT_TRUE(w.open(path));
+    uint8_t buf[64];
+    uint64_t t = 1475900000000ULL;
+    for(int i = 0; i < 5000; ++i)
+        {
+        const uint8_t n = (uint8_t)((i * 7) % 97);
+        t += 50 + (i % 13);
+        const uint8_t l = makeFrame(buf, sizeof(buf), n, (uint8_t)(i % 5));
+        ASSERT_TRUE(w.append(t, 0, 0, buf, l));
+        }
+    // One damaged frame.
+    const uint8_t l = makeFrame(buf, sizeof(buf), 1, 3);
+    buf[3] ^= 1;
+    ASSERT_TRUE(w.append(t, 0, 0, buf, l));
+    ASSERT_TRUE(w.close());
+    const OTV0P2BASE::MappedFile m(path);
+    unlink(path);
+    ASSERT_TRUE(m.isOpen());
+
+    OTRadioLink::FrameCaptureReplay replay;
+    const OTRadioLink::FrameCaptureReplayStats one = replay.replay(m.getData(), m.getSize());
+    EXPECT_EQ(5001U, one.frames);
+    EXPECT_FALSE(one.damaged);
+    EXPECT_EQ(1000U, one.byClass[OTRadioLink::FDC_SECURE]);
+    EXPECT_EQ(1000U, one.decoded[OTRadioLink::FDC_SECUREABLE]);
+    EXPECT_EQ(1000U, one.decoded[OTRadioLink::FDC_FULL_STATS]);
+    EXPECT_EQ(1001U, one.byClass[OTRadioLink::FDC_JSON]);
+    EXPECT_EQ(1000U, one.decoded[OTRadioLink::FDC_JSON]);
+    EXPECT_EQ(1000U, one.byClass[OTRadioLink::FDC_CC1]);
+    EXPECT_EQ(t, one.lastMS);
+
+    for(uint8_t shards = 2; shards <= OTRadioLink::FrameCaptureNodeBuckets; shards *= 2)
+        {
+        OrderCheck oc;
+        memset(&oc, 0, sizeof(oc));
+        replay.threads = shards;
+        replay.handler = checkOrder;
+        replay.context = &oc;
+        const OTRadioLink::FrameCaptureReplayStats s = replay.replay(m.getData(), m.getSize());
+        EXPECT_EQ(one.frames, s.frames);
+        EXPECT_EQ(one.bytes, s.bytes);
+        EXPECT_EQ(one.firstMS, s.firstMS);
+        EXPECT_EQ(one.lastMS, s.lastMS);
+        for(uint8_t c = 0; c < OTRadioLink::FDC_COUNT; ++c)
+            {
+            EXPECT_EQ(one.byClass[c], s.byClass[c]);
+            EXPECT_EQ(one.decoded[c], s.decoded[c]);
+            }
+        for(uint8_t b = 0; b < OTRadioLink::FrameCaptureNodeBuckets; ++b) { EXPECT_FALSE(oc.outOfOrder[b]) << (int)b; }
+        }
+
+    // Each shard sees only its own buckets.
+    std::vector<OTRadioLink::FrameCaptureSegment> segments;
+    ASSERT_TRUE(OTRadioLink::FrameCaptureReader::getSegments(m.getData(), m.getSize(), segments));
+    OTRadioLink::FrameCaptureReplay single;
+    uint64_t total = 0;
+    for(uint8_t shard = 0; shard < 3; ++shard)
+        {
+        single.handler = [](void *const context, const OTRadioLink::FrameCaptureRecord &r, OTRadioLink::FrameDemuxClass, bool)
+            {
+            uint8_t *const shardOf = static_cast<uint8_t *>(context);
+            shardOf[OTRadioLink::getFrameCaptureNodeBucket(r.frame, r.len)] = shardOf[OTRadioLink::FrameCaptureNodeBuckets];
+            };
+        uint8_t shardOf[OTRadioLink::FrameCaptureNodeBuckets + 1];
+        memset(shardOf, 0xff, sizeof(shardOf));
+        shardOf[OTRadioLink::FrameCaptureNodeBuckets] = shard;
+        single.context = shardOf;
+        total += single.replayShard(m.getData(), m.getSize(), segments, shard, 3).frames;
+        for(uint8_t b = 0; b < OTRadioLink::FrameCaptureNodeBuckets; ++b)
+            { if(0xff != shardOf[b]) { EXPECT_EQ(b % 3, shardOf[b]); } }
+        }
+    EXPECT_EQ(one.frames, total);
+}
+
+// Benchmark capture size and replay speed for a few months of traffic from a house-sized deployment.
+TEST(FrameCapture,benchmark)
+{
+    // If true then be more verbose.
+    const static bool verbose = false;
+
+    const int nodes = 20;
+    const int days = 90;
+    // One frame per node every 4 minutes.
+    const uint64_t stepMS = 4 * 60 * 1000ULL / nodes;
+    char path[32];
+    makeTempFile(path);
+    OTRadioLink::FrameCaptureWriter w;
+    ASSERT_TRUE(w.open(path));
+    uint8_t frames[nodes][5][64];
+    uint8_t lens[nodes][5];
+    for(int n = 0; n < nodes; ++n)
+        { for(int k = 0; k < 5; ++k) { lens[n][k] = makeFrame(frames[n][k], sizeof(frames[n][k]), (uint8_t)(0x10 + n), (uint8_t)k); } }
+    const uint64_t start = 1475900000000ULL;
+    const uint64_t count = days * 24ULL * 60 * 60 * 1000 / stepMS;
+    // Text log size, approximating a timestamp and printRXMsg() output at ~2.5 chars per byte.
+    uint64_t textBytes = 0;
+    for(uint64_t i = 0; i < count; ++i)
+        {
+        const int n = (int)(i % nodes);
+        const int k = (int)((i / nodes) % 5);
+        ASSERT_TRUE(w.append(start + (i * stepMS), 0, (uint8_t)(i & 0x7f), frames[n][k], lens[n][k]));
+        textBytes += 21 + 4 + ((lens[n][k] * 5) / 2) + 1;
+        }
+    ASSERT_TRUE(w.close());
+
+    typedef std::chrono::steady_clock clock;
+    const OTV0P2BASE::MappedFile m(path);
+    unlink(path);
+    ASSERT_TRUE(m.isOpen());
+    OTRadioLink::FrameCaptureReplay replay;
+    const clock::time_point t0 = clock::now();
+    const OTRadioLink::FrameCaptureReplayStats one = replay.replay(m.getData(), m.getSize());
+    const double s1 = std::chrono::duration<double>(clock::now() - t0).count();
+    replay.threads = 4;
+    const clock::time_point t1 = clock::now();
+    const OTRadioLink::FrameCaptureReplayStats four = replay.replay(m.getData(), m.getSize());
+    const double s4 = std::chrono::duration<double>(clock::now() - t1).count();
+    EXPECT_EQ(count, one.frames);
+    EXPECT_EQ(count, four.frames);
+    EXPECT_EQ(count - one.byClass[OTRadioLink::FDC_CC1], one.decoded[OTRadioLink::FDC_SECURE] +
+        one.decoded[OTRadioLink::FDC_SECUREABLE] + one.decoded[OTRadioLink::FDC_FULL_STATS] + one.decoded[OTRadioLink::FDC_JSON]);
+    if(verbose)
+        {
+        fprintf(stderr, "Frame capture: %d nodes x %d days, %llu frames, %.3g bytes/frame (text ~%.3g), replay %.3g frames/s (1 thread), %.3g frames/s (4 threads, %u cores)\n",
+            nodes, days, (unsigned long long)count, m.getSize() / (double)count, textBytes / (double)count, count / s1, count / s4, std::thread::hardware_concurrency());
+        }
+}
+
+#endif // OTV0P2BASE_PLATFORM_HAS_mmap
@@ -0,0 +1,413 @@
+/*
+The OpenTRV project licenses this file to you
+under the Apache Licence, Version 2.0 (the "Licence");
+you may not use this file except in compliance
+with the Licence. You may obtain a copy of the Licence at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing,
+software distributed under the Licence is distributed on an
+"AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+KIND, either express or implied. See the Licence for the
+specific language governing permissions and limitations
+under the Licence.
+
+Author(s) / Copyright (s): Damon Hart-Davis 2016
+*/
+
+/*
+ * OTRadioLink frame demultiplexer tests and benchmark, with synthetic traffic through OTNullRadioLink.
+ */
+
+#include <gtest/gtest.h>
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include <deque>
+#include <vector>
+
+#include <OTRadioLink.h>
+
+
+namespace {
+
+// All-zeros key; the NULL crypto implementation ignores the key value.
+const uint8_t zeroKey[16] = { };
+
+// Synthetic frames of each class.
+struct Frames
+    {
+    uint8_t cc1[8];
+    uint8_t json[55];
+    uint8_t fs20[45];
+    uint8_t stats[8];
+    uint8_t secure[OTRadioLink::SecurableFrameHeader::maxSmallFrameSize + 1];
+    uint8_t secureLen;
+    uint8_t plain[OTRadioLink::SecurableFrameHeader::maxSmallFrameSize + 1];
+    uint8_t plainLen;
+    Frames()
+        {
+        memset(cc1, 0x10, sizeof(cc1));
+        cc1[0] = OTRadioLink::FTp2_CC1Alert;
+        memset(json, 'a', sizeof(json));
+        json[0] = OTRadioLink::FTp2_JSONRaw;
+        json[sizeof(json)-2] = '}' | 0x80;
+        memset(fs20, OTRadioLink::FTp2_FS20_native, sizeof(fs20));
+        memset(stats, 0x11, sizeof(stats));
+        stats[0] = OTRadioLink::FTp2_FullStatsIDH;
+        const uint8_t id[] = { 0x80, 0x81, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87 };
+        uint8_t iv[12] = { 0x80, 0x81, 0x82, 0x83, 0x84, 0x85, 0, 0, 0, 1, 0, 1 };
+        const uint8_t body[] = { 0x7f, 0x11 };
+        secureLen = OTRadioLink::SimpleSecureFrame32or0BodyTXBase::encodeSecureSmallFrameRaw(secure, sizeof(secure),
+                                    OTRadioLink::FTS_BasicSensorOrValve, id, 4, body, sizeof(body), iv,
+                                    OTRadioLink::fixed32BTextSize12BNonce16BTagSimpleEnc_NULL_IMPL, NULL, zeroKey);
+        plainLen = OTRadioLink::encodeNonsecureSmallFrame(plain, sizeof(plain), OTRadioLink::FTS_BasicSensorOrValve, 0, id, 4, body, sizeof(body));
+        }
+    };
+
+// Records the classes of dispatched frames, in order.
+void recordClass(void *const context, const volatile uint8_t *const msg, const uint8_t msglen)
+    {
+    static_cast<std::vector<OTRadioLink::FrameDemuxClass> *>(context)->push_back(OTRadioLink::classifyFrame(msg, msglen));
+    }
+
+}
+
+
+// Test classification of each kind of frame.
+TEST(FrameDemux,classify)
+{
+    const Frames f;
+    ASSERT_NE(0, f.secureLen);
+    ASSERT_NE(0, f.plainLen);
+    EXPECT_EQ(OTRadioLink::FDC_CC1, OTRadioLink::classifyFrame(f.cc1, sizeof(f.cc1)));
+    EXPECT_EQ(OTRadioLink::FDC_JSON, OTRadioLink::classifyFrame(f.json, sizeof(f.json)));
+    EXPECT_EQ(OTRadioLink::FDC_FS20, OTRadioLink::classifyFrame(f.fs20, sizeof(f.fs20)));
+    EXPECT_EQ(OTRadioLink::FDC_FULL_STATS, OTRadioLink::classifyFrame(f.stats, sizeof(f.stats)));
+    EXPECT_EQ(OTRadioLink::FDC_SECURE, OTRadioLink::classifyFrame(f.secure, f.secureLen));
+    EXPECT_EQ(OTRadioLink::FDC_SECUREABLE, OTRadioLink::classifyFrame(f.plain, f.plainLen));
+    // Trailing bytes, eg from a fixed-size OOK buffer, do not matter.
+    uint8_t buf[64];
+    memset(buf, 0, sizeof(buf));
+    memcpy(buf, f.plain, f.plainLen);
+    EXPECT_EQ(OTRadioLink::FDC_SECUREABLE, OTRadioLink::classifyFrame(buf, sizeof(buf)));
+    memcpy(buf, f.cc1, sizeof(f.cc1));
+    EXPECT_EQ(OTRadioLink::FDC_CC1, OTRadioLink::classifyFrame(buf, sizeof(buf)));
+    // A truncated secureable frame is not recognised as such.
+    EXPECT_EQ(OTRadioLink::FDC_UNKNOWN, OTRadioLink::classifyFrame(f.secure, f.secureLen - 1));
+    const uint8_t junk[] = { 0x01, 0x02 };
+    EXPECT_EQ(OTRadioLink::FDC_UNKNOWN, OTRadioLink::classifyFrame(junk, sizeof(junk)));
+    EXPECT_EQ(OTRadioLink::FDC_UNKNOWN, OTRadioLink::classifyFrame(junk, 0));
+    EXPECT_EQ(OTRadioLink::FDC_UNKNOWN, OTRadioLink::classifyFrame(NULL, 8));
+}
+
+// Demultiplexer installed as the RX filter; must have static storage duration and linkage.
+static OTRadioLink::FrameDemux routingDemux;
+
+// Test routing through the RX filter hook, drop counting, and dispatch in priority order.
+TEST(FrameDemux,routeAndDispatch)
+{
+    const Frames f;
+    OTRadioLink::FrameDemux &d = routingDemux;
+    d = OTRadioLink::FrameDemux();
+    OTRadioLink::ISRRXQueue1Deep<8> cc1Q;
+    OTRadioLink::ISRRXQueueVarLenMsg<64, 2> secureQ;
+    OTRadioLink::ISRRXQueueVarLenMsg<32, 2> shortQ;
+    std::vector<OTRadioLink::FrameDemuxClass> seen;
+    EXPECT_TRUE(d.setRoute(OTRadioLink::FDC_CC1, &cc1Q, recordClass, &seen));
+    EXPECT_TRUE(d.setRoute(OTRadioLink::FDC_SECURE, &secureQ, recordClass, &seen));
+    EXPECT_TRUE(d.setRoute(OTRadioLink::FDC_JSON, &shortQ, recordClass, &seen)); // Too small for JSON frames.
+    EXPECT_FALSE(d.setRoute(OTRadioLink::FDC_COUNT, &shortQ, recordClass, &seen));
+    OTRadioLink::OTNullRadioLink rl;
+    rl.setFilterRXISR(OTRadioLink::frameFilterDemux<&routingDemux>);
+
+    // Lowest priority first on the air.
+    EXPECT_FALSE(rl._injectRX(f.json, sizeof(f.json)));
+    EXPECT_FALSE(rl._injectRX(f.fs20, sizeof(f.fs20)));
+    EXPECT_FALSE(rl._injectRX(f.secure, f.secureLen));
+    EXPECT_FALSE(rl._injectRX(f.secure, f.secureLen));
+    EXPECT_FALSE(rl._injectRX(f.cc1, sizeof(f.cc1)));
+    EXPECT_FALSE(rl._injectRX(f.cc1, sizeof(f.cc1)));
+    EXPECT_EQ(6, rl.getRXMsgsFilteredRecent());
+    EXPECT_EQ(0, rl.getRXMsgsDroppedRecent());
+    EXPECT_EQ(1, d.getDroppedRecent(OTRadioLink::FDC_JSON));
+    EXPECT_EQ(1, d.getDroppedRecent(OTRadioLink::FDC_FS20));
+    EXPECT_EQ(2, d.getRoutedRecent(OTRadioLink::FDC_SECURE));
+    EXPECT_EQ(0, d.getDroppedRecent(OTRadioLink::FDC_SECURE));
+    EXPECT_EQ(1, d.getRoutedRecent(OTRadioLink::FDC_CC1));
+    EXPECT_EQ(1, d.getDroppedRecent(OTRadioLink::FDC_CC1)) << "1-deep queue full";
+    EXPECT_EQ(3, d.getQueued());
+    EXPECT_EQ(2, d.getQueued(OTRadioLink::FDC_SECURE));
+    EXPECT_EQ(0, d.getQueued(OTRadioLink::FDC_FS20));
+
+    EXPECT_EQ(1, d.dispatch());
+    ASSERT_EQ(1U, seen.size());
+    EXPECT_EQ(OTRadioLink::FDC_CC1, seen[0]);
+    // A new CC1 frame overtakes the remaining secure frames.
+    EXPECT_FALSE(rl._injectRX(f.cc1, sizeof(f.cc1)));
+    EXPECT_EQ(3, d.dispatch(10));
+    ASSERT_EQ(4U, seen.size());
+    EXPECT_EQ(OTRadioLink::FDC_CC1, seen[1]);
+    EXPECT_EQ(OTRadioLink::FDC_SECURE, seen[2]);
+    EXPECT_EQ(OTRadioLink::FDC_SECURE, seen[3]);
+    EXPECT_EQ(0, d.getQueued());
+    EXPECT_EQ(0, d.dispatch(10));
+    rl.setFilterRXISR(NULL);
+}
+
+// Test explicit priorities, round-robin between equal priorities, and routes without handlers.
+TEST(FrameDemux,priorities)
+{
+    const Frames f;
+    OTRadioLink::FrameDemux d;
+    OTRadioLink::ISRRXQueueVarLenMsg<64, 3> jsonQ, secureQ;
+    OTRadioLink::ISRRXQueueVarLenMsg<8, 3> cc1Q, statsQ;
+    std::vector<OTRadioLink::FrameDemuxClass> seen;
+    // JSON raised above secure frames, and CC1 and stats sharing the lowest priority.
+    EXPECT_TRUE(d.setRoute(OTRadioLink::FDC_JSON, &jsonQ, recordClass, &seen, 0));
+    EXPECT_TRUE(d.setRoute(OTRadioLink::FDC_SECURE, &secureQ, recordClass, &seen, 1));
+    EXPECT_TRUE(d.setRoute(OTRadioLink::FDC_CC1, &cc1Q, recordClass, &seen, 2));
+    EXPECT_TRUE(d.setRoute(OTRadioLink::FDC_FULL_STATS, &statsQ, recordClass, &seen, 2));
+    for(int i = 0; i < 2; ++i)
+        {
+        EXPECT_TRUE(d._route(f.cc1, sizeof(f.cc1)));
+        EXPECT_TRUE(d._route(f.stats, sizeof(f.stats)));
+        EXPECT_TRUE(d._route(f.secure, f.secureLen));
+        EXPECT_TRUE(d._route(f.json, sizeof(f.json)));
+        }
+    EXPECT_EQ(8, d.dispatch(255));
+    const OTRadioLink::FrameDemuxClass expected[] = {
+        OTRadioLink::FDC_JSON, OTRadioLink::FDC_JSON, OTRadioLink::FDC_SECURE, OTRadioLink::FDC_SECURE,
+        OTRadioLink::FDC_FULL_STATS, OTRadioLink::FDC_CC1, OTRadioLink::FDC_FULL_STATS, OTRadioLink::FDC_CC1 };
+    ASSERT_EQ(8U, seen.size());
+    for(size_t i = 0; i < seen.size(); ++i) { EXPECT_EQ(expected[i], seen[i]) << i; }
+
+    // Without a handler frames are still removed when dispatched.
+    EXPECT_TRUE(d.setRoute(OTRadioLink::FDC_JSON, &jsonQ, NULL));
+    EXPECT_TRUE(d._route(f.json, sizeof(f.json)));
+    EXPECT_EQ(1, d.dispatch());
+    EXPECT_EQ(0, d.getQueued());
+    EXPECT_EQ(8U, seen.size());
+    // Clearing a route drops the class.
+    EXPECT_TRUE(d.setRoute(OTRadioLink::FDC_JSON, NULL, NULL));
+    EXPECT_FALSE(d._route(f.json, sizeof(f.json)));
+    EXPECT_EQ(1, d.getDroppedRecent(OTRadioLink::FDC_JSON));
+}
+
+// Records the lengths of dispatched frames, in order.
+void recordLength(void *const context, const volatile uint8_t *const, const uint8_t msglen)
+    { static_cast<std::vector<uint8_t> *>(context)->push_back(msglen); }
+
+// Test that frames handed over padded to a whole radio buffer,
+// as by the RFM23B without packet handling (the whole 64-byte FIFO),
+// are trimmed to their own length before the size check and copy.
+TEST(FrameDemux,paddedFrames)
+{
+    const Frames f;
+    const uint8_t MaxRXMsgLen = 64; // As for OTRFM23BLink.
+    OTRadioLink::FrameDemux d;
+    OTRadioLink::ISRRXQueue1Deep<8> cc1Q;
+    OTRadioLink::ISRRXQueueVarLenMsg<64, 2> secureQ, jsonQ;
+    OTRadioLink::ISRRXQueueVarLenMsg<16, 2> statsQ;
+    std::vector<uint8_t> lens;
+    EXPECT_TRUE(d.setRoute(OTRadioLink::FDC_CC1, &cc1Q, recordLength, &lens));
+    EXPECT_TRUE(d.setRoute(OTRadioLink::FDC_SECURE, &secureQ, recordLength, &lens));
+    EXPECT_TRUE(d.setRoute(OTRadioLink::FDC_JSON, &jsonQ, recordLength, &lens));
+    EXPECT_TRUE(d.setRoute(OTRadioLink::FDC_FULL_STATS, &statsQ, recordLength, &lens));
+    uint8_t buf[MaxRXMsgLen];
+    struct { const uint8_t *frame; uint8_t len; OTRadioLink::FrameDemuxClass c; } cases[] = {
+        { f.cc1, sizeof(f.cc1), OTRadioLink::FDC_CC1 },
+        { f.secure, f.secureLen, OTRadioLink::FDC_SECURE },
+        { f.json, sizeof(f.json), OTRadioLink::FDC_JSON },
+        { f.stats, sizeof(f.stats), OTRadioLink::FDC_FULL_STATS },
+        };
+    for(const auto &tc : cases)
+        {
+        // Padded with junk and with zeros.
+        for(int junk = 0; junk <= 1; ++junk)
+            {
+            memset(buf, junk ? 0x55 : 0, sizeof(buf));
+            memcpy(buf, tc.frame, tc.len);
+            // FS20-carrier frames other than CC1 and JSON cannot be told from junk after them.
+            if(junk && (OTRadioLink::FDC_FULL_STATS == tc.c)) { continue; }
+            EXPECT_EQ(tc.len, OTRadioLink::getFrameDemuxLength(buf, sizeof(buf), tc.c)) << tc.c;
+            uint8_t frameLen = 0;
+            EXPECT_TRUE(d._route(buf, sizeof(buf), &frameLen)) << tc.c;
+            EXPECT_EQ(tc.len, frameLen);
+            lens.clear();
+            EXPECT_EQ(1, d.dispatch());
+            ASSERT_EQ(1U, lens.size());
+            EXPECT_EQ(tc.len, lens[0]) << tc.c;
+            }
+        EXPECT_EQ(0, d.getDroppedRecent(tc.c));
+        }
+    // Trailing zeros are trimmed from other frames, leaving one.
+    memset(buf, 0, sizeof(buf));
+    memcpy(buf, f.fs20, sizeof(f.fs20));
+    EXPECT_EQ(sizeof(f.fs20) + 1, OTRadioLink::getFrameDemuxLength(buf, sizeof(buf), OTRadioLink::FDC_FS20));
+    // A JSON frame without its closing '}' is only trimmed.
+    memset(buf, 0, sizeof(buf));
+    memcpy(buf, f.json, 10);
+    EXPECT_EQ(11, OTRadioLink::getFrameDemuxLength(buf, sizeof(buf), OTRadioLink::FDC_JSON));
+    EXPECT_EQ(0, OTRadioLink::getFrameDemuxLength(buf, 0, OTRadioLink::FDC_JSON));
+
+    // Through the radio's RX filter hook, which gets the trimmed length back.
+    routingDemux = OTRadioLink::FrameDemux();
+    EXPECT_TRUE(routingDemux.setRoute(OTRadioLink::FDC_CC1, &cc1Q, recordLength, &lens));
+    OTRadioLink::OTNullRadioLink rl;
+    rl.setFilterRXISR(OTRadioLink::frameFilterDemux<&routingDemux>);
+    memset(buf, 0, sizeof(buf));
+    memcpy(buf, f.cc1, sizeof(f.cc1));
+    EXPECT_FALSE(rl._injectRX(buf, sizeof(buf)));
+    EXPECT_EQ(1, routingDemux.getRoutedRecent(OTRadioLink::FDC_CC1));
+    EXPECT_EQ(0, routingDemux.getDroppedRecent(OTRadioLink::FDC_CC1));
+    volatile uint8_t buflen = sizeof(buf);
+    routingDemux.dispatch();
+    EXPECT_FALSE(OTRadioLink::frameFilterDemux<&routingDemux>(buf, buflen));
+    EXPECT_EQ(sizeof(f.cc1), buflen);
+    rl.setFilterRXISR(NULL);
+}
+
+
+// Single RX FIFO, as in a radio driver, for comparison; fed through its own filter.
+static OTRadioLink::ISRRXQueueVarLenMsg<64, 4> fifo;
+static bool frameFilterFIFO(const volatile uint8_t *const buf, volatile uint8_t &buflen)
+    {
+    volatile uint8_t *const b = fifo._getRXBufForInbound();
+    if(NULL == b) { return(true); } // Not queued: let the radio count the drop.
+    for(uint8_t i = 0; i < buflen; ++i) { b[i] = buf[i]; }
+    fifo._loadedBuf(buflen);
+    return(false);
+    }
+
+// Demultiplexer for the benchmark.
+static OTRadioLink::FrameDemux benchDemux;
+
+// Per-class outcome of a synthetic traffic run.
+struct ClassStats
+    {
+    int sent = 0, delivered = 0;
+    long waitSum = 0;
+    int maxWait = 0;
+    };
+
+// Synthetic traffic: mostly long JSON and FS20 frames with some CC1 alerts, secure valve frames and stats,
+// arriving in bursts of one per step for 12 steps then quiet for 20,
+// with the main loop dispatching one frame every other step,
+// so keeping up on average but not during bursts.
+// Frame arrival steps are tracked per class (FIFO within each class) to measure waiting time in steps.
+TEST(FrameDemux,benchmarkSyntheticTraffic)
+{
+    // If true then be more verbose.
+    const static bool verbose = false;
+
+    const Frames f;
+    const int steps = 20000;
+    const int serviceEvery = 2;
+    const OTRadioLink::FrameDemuxClass classes[] =
+        { OTRadioLink::FDC_JSON, OTRadioLink::FDC_FS20, OTRadioLink::FDC_JSON, OTRadioLink::FDC_CC1,
+          OTRadioLink::FDC_JSON, OTRadioLink::FDC_SECURE, OTRadioLink::FDC_FS20, OTRadioLink::FDC_FULL_STATS };
+    auto frameFor = [&](const OTRadioLink::FrameDemuxClass c, uint8_t &len) -> const uint8_t *
+        {
+        switch(c)
+            {
+            case OTRadioLink::FDC_CC1: { len = sizeof(f.cc1); return(f.cc1); }
+            case OTRadioLink::FDC_SECURE: { len = f.secureLen; return(f.secure); }
+            case OTRadioLink::FDC_FULL_STATS: { len = sizeof(f.stats); return(f.stats); }
+            case OTRadioLink::FDC_FS20: { len = sizeof(f.fs20); return(f.fs20); }
+            default: { len = sizeof(f.json); return(f.json); }
+            }
+        };
+
+    // Queues for the demultiplexer, using about as much RAM as the single FIFO.
+    OTRadioLink::ISRRXQueueVarLenMsg<8, 2> cc1Q, statsQ;
+    OTRadioLink::ISRRXQueueVarLenMsg<64, 1> secureQ;
+    OTRadioLink::ISRRXQueue1Deep<45> fs20Q;
+    OTRadioLink::ISRRXQueue1Deep<55> jsonQ;
+    const size_t demuxRAM = sizeof(cc1Q) + sizeof(statsQ) + sizeof(secureQ) + sizeof(fs20Q) + sizeof(jsonQ);
+
+    ClassStats results[2][OTRadioLink::FDC_COUNT];
+    for(int useDemux = 0; useDemux <= 1; ++useDemux)
+        {
+        ClassStats *const cs = results[useDemux];
+        std::deque<int> arrivals[OTRadioLink::FDC_COUNT];
+        int now = 0;
+        // Handler noting the waiting time of the frame of the given class.
+        auto delivered = [&](const OTRadioLink::FrameDemuxClass c)
+            {
+            const int w = now - arrivals[c].front();
+            arrivals[c].pop_front();
+            ++cs[c].delivered;
+            cs[c].waitSum += w;
+            if(w > cs[c].maxWait) { cs[c].maxWait = w; }
+            };
+        struct Ctx { decltype(delivered) *fn; } ctx = { &delivered };
+        OTRadioLink::FrameDemux::FrameHandler_t *const h = [](void *const context, const volatile uint8_t *const msg, const uint8_t msglen)
+            { (*static_cast<Ctx *>(context)->fn)(OTRadioLink::classifyFrame(msg, msglen)); };
+
+        OTRadioLink::OTNullRadioLink rl;
+        benchDemux = OTRadioLink::FrameDemux();
+        benchDemux.setRoute(OTRadioLink::FDC_CC1, &cc1Q, h, &ctx);
+        benchDemux.setRoute(OTRadioLink::FDC_SECURE, &secureQ, h, &ctx);
+        benchDemux.setRoute(OTRadioLink::FDC_FULL_STATS, &statsQ, h, &ctx);
+        benchDemux.setRoute(OTRadioLink::FDC_FS20, &fs20Q, h, &ctx);
+        benchDemux.setRoute(OTRadioLink::FDC_JSON, &jsonQ, h, &ctx);
+        while(!fifo.isEmpty()) { fifo.removeRXMsg(); }
+        rl.setFilterRXISR(useDemux ? OTRadioLink::frameFilterDemux<&benchDemux> : frameFilterFIFO);
+
+        const auto t0 = std::chrono::steady_clock::now();
+        int sent = 0;
+        for(now = 0; now < steps; ++now)
+            {
+            if((now % 32) < 12)
+                {
+                const OTRadioLink::FrameDemuxClass c = classes[(sent++) % (sizeof(classes)/sizeof(classes[0]))];
+                uint8_t len;
+                const uint8_t *const buf = frameFor(c, len);
+                ++cs[c].sent;
+                const uint8_t q0 = useDemux ? benchDemux.getRoutedRecent(c) : fifo.getRXMsgsQueued();
+                rl._injectRX(buf, len);
+                const bool queued = useDemux ? (q0 != benchDemux.getRoutedRecent(c)) : (q0 != fifo.getRXMsgsQueued());
+                if(queued) { arrivals[c].push_back(now); }
+                }
+            if(0 != (now % serviceEvery)) { continue; }
+            if(useDemux) { benchDemux.dispatch(); }
+            else if(!fifo.isEmpty())
+                {
+                const volatile uint8_t *const m = fifo.peekRXMsg();
+                h(&ctx, m, m[-1]);
+                fifo.removeRXMsg();
+                }
+            }
+        const double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count();
+        rl.setFilterRXISR(NULL);
+
+        if(verbose)
+            {
+            fprintf(stderr, "Frame RX %s (%u bytes of queues): ", useDemux ? "demux" : "FIFO", (unsigned)(useDemux ? demuxRAM : sizeof(fifo)));
+            static const char *const names[] = { "CC1", "secure", "secureable", "stats", "FS20", "JSON", "unknown" };
+            for(uint8_t c = 0; c < OTRadioLink::FDC_COUNT; ++c)
+                {
+                if(0 == cs[c].sent) { continue; }
+                fprintf(stderr, "%s %d/%d wait %.1f max %d; ", names[c], cs[c].delivered, cs[c].sent,
+                    (0 == cs[c].delivered) ? 0.0 : (cs[c].waitSum / (double)cs[c].delivered), cs[c].maxWait);
+                }
+            fprintf(stderr, "%.0fns/frame\n", ns / sent);
+            }
+        }
+
+    // With the demultiplexer high-priority traffic is never lost and is served promptly,
+    // whereas in the FIFO it waits behind long frames and may be lost with them.
+    const ClassStats &fifoCC1 = results[0][OTRadioLink::FDC_CC1];
+    const ClassStats &demuxCC1 = results[1][OTRadioLink::FDC_CC1];
+    EXPECT_EQ(demuxCC1.sent, demuxCC1.delivered);
+    EXPECT_GE(serviceEvery, demuxCC1.maxWait);
+    EXPECT_LT(demuxCC1.maxWait, fifoCC1.maxWait);
+    EXPECT_LT(demuxCC1.waitSum / (double)demuxCC1.delivered, fifoCC1.waitSum / (double)fifoCC1.delivered);
+    const ClassStats &demuxSecure = results[1][OTRadioLink::FDC_SECURE];
+    EXPECT_EQ(demuxSecure.sent, demuxSecure.delivered);
+    int fifoSent = 0, fifoDelivered = 0;
+    for(const ClassStats &c : results[0]) { fifoSent += c.sent; fifoDelivered += c.delivered; }
+    EXPECT_GT(fifoSent, fifoDelivered);
+}
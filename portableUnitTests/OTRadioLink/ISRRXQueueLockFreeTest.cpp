@@ -0,0 +1,309 @@
+/*
+The OpenTRV project licenses this file to you
+under the Apache Licence, Version 2.0 (the "Licence");
+you may not use this file except in compliance
+with the Licence. You may obtain a copy of the Licence at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing,
+software distributed under the Licence is distributed on an
+"AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+KIND, either express or implied. See the Licence for the
+specific language governing permissions and limitations
+under the Licence.
+
+Author(s) / Copyright (s): Damon Hart-Davis 2016
+*/
+
+/*
+ * OTRadioLink lock-free RX queue tests and benchmark.
+ */
+
+#include <gtest/gtest.h>
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "OTRadioLink_ISRRXQueue.h"
+#include "OTRadioLink_ISRRXQueueLockFree.h"
+
+
+namespace {
+
+// Frame layout used for the threaded tests:
+//   byte 0: producer number
+//   bytes 1-4: per-producer sequence number (little-endian)
+//   bytes 5-12: enqueue time in ns (little-endian) for latency measurement
+//   remaining bytes: (sequence + index) pattern to check integrity
+const uint8_t minTestFrameLen = 13;
+
+// Fill in a test frame; the length varies with the sequence number.
+uint8_t fillTestFrame(volatile uint8_t *const p, const uint8_t producer, const uint32_t seq, const uint64_t ns, const uint8_t maxLen)
+    {
+    const uint8_t len = minTestFrameLen + (uint8_t)(seq % (maxLen - minTestFrameLen + 1));
+    p[0] = producer;
+    for(int i = 0; i < 4; ++i) { p[1 + i] = (uint8_t)(seq >> (8 * i)); }
+    for(int i = 0; i < 8; ++i) { p[5 + i] = (uint8_t)(ns >> (8 * i)); }
+    for(uint8_t i = minTestFrameLen; i < len; ++i) { p[i] = (uint8_t)(seq + i); }
+    return(len);
+    }
+
+// Check a test frame, extracting producer, sequence number and enqueue time; returns false if corrupt.
+bool checkTestFrame(const volatile uint8_t *const p, const uint8_t len, const uint8_t maxLen, uint8_t &producer, uint32_t &seq, uint64_t &ns)
+    {
+    producer = p[0];
+    seq = 0;
+    for(int i = 0; i < 4; ++i) { seq |= ((uint32_t)p[1 + i]) << (8 * i); }
+    ns = 0;
+    for(int i = 0; i < 8; ++i) { ns |= ((uint64_t)p[5 + i]) << (8 * i); }
+    if(len != minTestFrameLen + (uint8_t)(seq % (maxLen - minTestFrameLen + 1))) { return(false); }
+    for(uint8_t i = minTestFrameLen; i < len; ++i) { if(p[i] != (uint8_t)(seq + i)) { return(false); } }
+    return(true);
+    }
+
+uint64_t nowNs()
+    {
+    return((uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+    }
+
+// ISRRXQueueVarLenMsg made thread-safe with a mutex, for comparison.
+template<uint8_t maxRXBytes, uint8_t targetISRRXMinQueueCapacity>
+class MutexISRRXQueue
+    {
+    private:
+        OTRadioLink::ISRRXQueueVarLenMsg<maxRXBytes, targetISRRXMinQueueCapacity> q;
+        std::mutex m;
+    public:
+        // Queue a frame via the given fill function; returns false if full.
+        template<class F> bool push(F fill)
+            {
+            std::lock_guard<std::mutex> lock(m);
+            volatile uint8_t *const p = q._getRXBufForInbound();
+            if(NULL == p) { return(false); }
+            q._loadedBuf(fill(p));
+            return(true);
+            }
+        // Copy out and remove the oldest frame; returns its length, or 0 if none.
+        uint8_t pop(uint8_t *const out)
+            {
+            std::lock_guard<std::mutex> lock(m);
+            const volatile uint8_t *const p = q.peekRXMsg();
+            if(NULL == p) { return(0); }
+            const uint8_t len = p[-1];
+            for(uint8_t i = 0; i < len; ++i) { out[i] = p[i]; }
+            q.removeRXMsg();
+            return(len);
+            }
+    };
+
+// Lock-free queue with the same interface as MutexISRRXQueue.
+template<uint8_t maxRXBytes, uint8_t targetISRRXMinQueueCapacity, bool multiProducer>
+class LockFreeISRRXQueue
+    {
+    private:
+        OTRadioLink::ISRRXQueueVarLenMsgLockFree<maxRXBytes, targetISRRXMinQueueCapacity, multiProducer> q;
+    public:
+        template<class F> bool push(F fill)
+            {
+            volatile uint8_t *const p = q._getRXBufForInbound();
+            if(NULL == p) { return(false); }
+            q._loadedBuf(fill(p));
+            return(true);
+            }
+        uint8_t pop(uint8_t *const out)
+            {
+            const volatile uint8_t *const p = q.peekRXMsg();
+            if(NULL == p) { return(0); }
+            const uint8_t len = p[-1];
+            for(uint8_t i = 0; i < len; ++i) { out[i] = p[i]; }
+            q.removeRXMsg();
+            return(len);
+            }
+    };
+
+// Results from runThreaded().
+struct ThreadedResults
+    {
+    uint32_t received;
+    uint32_t corrupt;
+    uint32_t outOfOrder;
+    double seconds;
+    double meanLatencyNs;
+    };
+
+// Run producers each sending framesEach frames through queue Q to a single consumer,
+// checking integrity and per-producer ordering.
+template<class Q, uint8_t maxLen>
+ThreadedResults runThreaded(Q &q, const int producers, const uint32_t framesEach)
+    {
+    ThreadedResults r = { 0, 0, 0, 0, 0 };
+    std::vector<uint32_t> nextSeq(producers, 0);
+    double totalLatencyNs = 0;
+    const uint64_t t0 = nowNs();
+    std::vector<std::thread> threads;
+    for(int i = 0; i < producers; ++i)
+        {
+        threads.push_back(std::thread([&q, i, framesEach]()
+            {
+            for(uint32_t seq = 0; seq < framesEach; )
+                {
+                if(q.push([i, seq](volatile uint8_t *p) { return(fillTestFrame(p, (uint8_t)i, seq, nowNs(), maxLen)); }))
+                    { ++seq; }
+                else
+                    { std::this_thread::yield(); } // Queue full.
+                }
+            }));
+        }
+    const uint32_t total = producers * framesEach;
+    uint8_t frame[256];
+    while(r.received < total)
+        {
+        const uint8_t len = q.pop(frame);
+        if(0 == len) { std::this_thread::yield(); continue; }
+        ++r.received;
+        uint8_t producer;
+        uint32_t seq;
+        uint64_t ns;
+        if(!checkTestFrame(frame, len, maxLen, producer, seq, ns) || (producer >= producers)) { ++r.corrupt; continue; }
+        if(seq != nextSeq[producer]) { ++r.outOfOrder; }
+        nextSeq[producer] = seq + 1;
+        totalLatencyNs += (double)(nowNs() - ns);
+        }
+    for(size_t i = 0; i < threads.size(); ++i) { threads[i].join(); }
+    r.seconds = (nowNs() - t0) / 1e9;
+    r.meanLatencyNs = totalLatencyNs / total;
+    return(r);
+    }
+
+}
+
+
+// Basic single-threaded behaviour: capacity, FIFO order, variable lengths, wrapping and abandoned uploads.
+TEST(ISRRXQueueLockFree,Basics)
+{
+    typedef OTRadioLink::ISRRXQueueVarLenMsgLockFree<64, 2> Q;
+    Q q;
+    uint8_t minCap, maxLen;
+    q.getRXCapacity(minCap, maxLen);
+    EXPECT_LE(2, minCap);
+    EXPECT_EQ(64, maxLen);
+    EXPECT_TRUE(q.isEmpty());
+    EXPECT_FALSE(q.isFull());
+    EXPECT_EQ(NULL, q.peekRXMsg());
+    q.removeRXMsg(); // Harmless when empty.
+    // Abandoned upload leaves the queue empty.
+    ASSERT_NE((volatile uint8_t *)NULL, q._getRXBufForInbound());
+    q._loadedBuf(0);
+    EXPECT_TRUE(q.isEmpty());
+    EXPECT_EQ(NULL, q.peekRXMsg());
+    // Fill with max-size frames until full.
+    int n = 0;
+    for(volatile uint8_t *p; NULL != (p = q._getRXBufForInbound()); ++n)
+        { for(int i = 0; i < 64; ++i) { p[i] = (uint8_t)(n + i); } q._loadedBuf(64); }
+    EXPECT_LE(minCap, n);
+    EXPECT_EQ(n, q.getRXMsgsQueued());
+    EXPECT_TRUE(q.isFull());
+    for(int i = 0; i < n; ++i)
+        {
+        const volatile uint8_t *p = q.peekRXMsg();
+        ASSERT_NE((const volatile uint8_t *)NULL, p);
+        EXPECT_EQ(64, p[-1]);
+        EXPECT_EQ((uint8_t)i, p[0]);
+        EXPECT_EQ((uint8_t)(i + 63), p[63]);
+        q.removeRXMsg();
+        }
+    EXPECT_TRUE(q.isEmpty());
+    // Many rounds of varying-length frames, wrapping the ring many times.
+    uint8_t nextIn = 0, nextOut = 0;
+    for(int round = 0; round < 1000; ++round)
+        {
+        const int toAdd = 1 + (round % 5);
+        for(int i = 0; i < toAdd; ++i)
+            {
+            volatile uint8_t *p = q._getRXBufForInbound();
+            if(NULL == p) { break; }
+            const uint8_t len = 1 + ((nextIn * 7) % 64);
+            for(uint8_t j = 0; j < len; ++j) { p[j] = nextIn; }
+            q._loadedBuf(len);
+            ++nextIn;
+            }
+        const int toRemove = 1 + ((round * 3) % 5);
+        for(int i = 0; i < toRemove; ++i)
+            {
+            const volatile uint8_t *p = q.peekRXMsg();
+            if(NULL == p) { break; }
+            ASSERT_EQ(1 + ((nextOut * 7) % 64), p[-1]);
+            for(uint8_t j = 0; j < p[-1]; ++j) { ASSERT_EQ(nextOut, p[j]); }
+            q.removeRXMsg();
+            ++nextOut;
+            }
+        ASSERT_EQ((uint8_t)(nextIn - nextOut), q.getRXMsgsQueued());
+        }
+}
+
+// Short frames take less space than long ones.
+TEST(ISRRXQueueLockFree,ShortFramesPackTightly)
+{
+    OTRadioLink::ISRRXQueueVarLenMsgLockFree<64, 2> q;
+    OTRadioLink::ISRRXQueueVarLenMsgLockFree<64, 2, true> qm;
+    int n = 0, nm = 0;
+    for(volatile uint8_t *p; NULL != (p = q._getRXBufForInbound()); ++n) { p[0] = 1; q._loadedBuf(5); }
+    for(volatile uint8_t *p; NULL != (p = qm._getRXBufForInbound()); ++nm) { p[0] = 1; qm._loadedBuf(5); }
+    uint8_t minCap, maxLen;
+    q.getRXCapacity(minCap, maxLen);
+    EXPECT_LT(4 * minCap, n);
+    EXPECT_EQ(n, nm); // Uncontended MPSC reservations are trimmed to size.
+}
+
+// Multiple producer threads with one consumer: no frame lost, corrupted or reordered per producer.
+TEST(ISRRXQueueLockFree,MPSCStress)
+{
+    static LockFreeISRRXQueue<64, 4, true> q;
+    const ThreadedResults r = runThreaded<LockFreeISRRXQueue<64, 4, true>, 64>(q, 4, 20000);
+    EXPECT_EQ(80000U, r.received);
+    EXPECT_EQ(0U, r.corrupt);
+    EXPECT_EQ(0U, r.outOfOrder);
+}
+
+// One producer thread with one consumer in SPSC mode.
+TEST(ISRRXQueueLockFree,SPSCStress)
+{
+    static LockFreeISRRXQueue<64, 4, false> q;
+    const ThreadedResults r = runThreaded<LockFreeISRRXQueue<64, 4, false>, 64>(q, 1, 50000);
+    EXPECT_EQ(50000U, r.received);
+    EXPECT_EQ(0U, r.corrupt);
+    EXPECT_EQ(0U, r.outOfOrder);
+}
+
+// Report throughput and mean enqueue-to-dequeue latency
+// for the lock-free queue against a mutex-wrapped ISRRXQueueVarLenMsg,
+// with one and with several producers.
+TEST(ISRRXQueueLockFree,Benchmark)
+{
+    // If true then be more verbose.
+    const static bool verbose = false;
+
+    const uint32_t frames = 40000;
+    for(int producers = 1; producers <= 4; producers *= 4)
+        {
+        static MutexISRRXQueue<64, 3> mq;
+        static LockFreeISRRXQueue<64, 3, true> lq;
+        const ThreadedResults m = runThreaded<MutexISRRXQueue<64, 3>, 64>(mq, producers, frames / producers);
+        const ThreadedResults l = runThreaded<LockFreeISRRXQueue<64, 3, true>, 64>(lq, producers, frames / producers);
+        EXPECT_EQ(0U, m.corrupt + m.outOfOrder);
+        EXPECT_EQ(0U, l.corrupt + l.outOfOrder);
+        if(verbose)
+            {
+            fprintf(stderr, "RX queue, %d producer(s): mutex %.0f frames/s %.0fns mean latency, lock-free MPSC %.0f frames/s %.0fns mean latency\n",
+                producers,
+                m.received / m.seconds, m.meanLatencyNs,
+                l.received / l.seconds, l.meanLatencyNs);
+            }
+        }
+}
@@ -0,0 +1,452 @@
+/*
+The OpenTRV project licenses this file to you
+under the Apache Licence, Version 2.0 (the "Licence");
+you may not use this file except in compliance
+with the Licence. You may obtain a copy of the Licence at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing,
+software distributed under the Licence is distributed on an
+"AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+KIND, either express or implied. See the Licence for the
+specific language governing permissions and limitations
+under the Licence.
+
+Author(s) / Copyright (s): Damon Hart-Davis 2016
+*/
+
+/*
+ * OTRFM23BLink tests, against a simulated RFM23B.
+ */
+
+#include <gtest/gtest.h>
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+
+#include "OTRFM23BLink.h"
+#include "OTRFM23BLink_RFM23BSimulator.h"
+
+typedef OTRFM23BLink::RFM23BSimulator Sim;
+typedef OTRFM23BLink::RFM23BSimulatorSPI<0> SPI0;
+// Radio with an interrupt line and the default RX queue.
+typedef OTRFM23BLink::OTRFM23BLink<0, 0, OTRFM23BLink::DEFAULT_RFM23B_RX_QUEUE_CAPACITY, true, SPI0> Radio;
+
+static const OTRadioLink::OTRadioChannelConfig GFSK(OTRFM23BLink::StandardRegSettingsGFSK57600, true);
+static const OTRadioLink::OTRadioChannelConfig OOK(OTRFM23BLink::StandardRegSettingsOOK5000, true);
+
+// Attach the simulator to SPI0 for the life of the object.
+class SimOnSPI0 final
+    {
+    public:
+        Sim sim;
+        SimOnSPI0() { SPI0::sim = &sim; }
+        ~SimOnSPI0() { SPI0::sim = NULL; }
+    };
+
+// Bring up the radio on the given channel config and listen.
+static void startListening(Radio &r, Sim &sim, const OTRadioLink::OTRadioChannelConfig &config)
+    {
+    r.preinit(NULL);
+    r.configure(1, &config);
+    ASSERT_TRUE(r.begin());
+    r.listen(true);
+    sim.advance(sim.settleUs);
+    ASSERT_TRUE(sim.isRX());
+    }
+
+// Test set-up, configuration and RSSI.
+TEST(OTRFM23BLink,basics)
+{
+    // No device on the bus.
+        {
+        Radio r;
+        r.preinit(NULL);
+        r.configure(1, &GFSK);
+        EXPECT_FALSE(r.begin());
+        }
+
+    SimOnSPI0 s;
+    Sim &sim = s.sim;
+    Radio r;
+    r.preinit(NULL);
+    r.configure(1, &GFSK);
+    ASSERT_TRUE(r.begin());
+    EXPECT_EQ(0x88, sim.peekReg(Sim::REG_DATA_ACCESS_CONTROL));
+    EXPECT_EQ(57602U, sim.dataRate());
+    EXPECT_EQ(0, r.getMode()); // Standby.
+    EXPECT_FALSE(sim.irq());
+    EXPECT_FALSE(sim.isRX());
+
+    r.listen(true);
+    EXPECT_TRUE(sim.isRX());
+    EXPECT_EQ((int)Sim::IPKVALID, sim.peekReg(Sim::REG_INT_ENABLE1));
+    EXPECT_EQ((int)Radio::MAX_RX_FRAME_DEFAULT, sim.peekReg(Sim::REG_RX_FIFO_CTRL));
+    sim.advance(1000);
+    EXPECT_EQ(sim.noiseRSSI, r.getRSSI());
+    // RSSI of a frame being received.
+    uint8_t buf[60];
+    memset(buf, 0x55, sizeof(buf));
+    sim.sendOnAir(buf, sizeof(buf), 200);
+    sim.advance(sim.frameAirtimeUs(sizeof(buf)) / 2);
+    EXPECT_EQ(200, r.getRSSI());
+    EXPECT_FALSE(r.handleInterruptSimple()); // nIRQ not asserted.
+
+    r.listen(false);
+    EXPECT_FALSE(sim.isRX());
+    EXPECT_EQ(1U, sim.getStats().aborted);
+    EXPECT_EQ(0U, sim.getStats().busErrors);
+}
+
+// Test sendRaw() in packet mode, including double TX and reverting to listening.
+TEST(OTRFM23BLink,sendRaw)
+{
+    SimOnSPI0 s;
+    Sim &sim = s.sim;
+    Radio r;
+    r.preinit(NULL);
+    r.configure(1, &GFSK);
+    ASSERT_TRUE(r.begin());
+
+    const uint8_t frame[] = { 'h', 'e', 'l', 'l', 'o', 0, 0xff };
+    const uint64_t t0 = sim.now();
+    EXPECT_TRUE(r.sendRaw(frame, sizeof(frame)));
+    ASSERT_EQ(1U, sim.sent.size());
+    EXPECT_EQ(std::vector<uint8_t>(frame, frame + sizeof(frame)), sim.sent[0].data);
+    EXPECT_EQ(sizeof(frame), sim.peekReg(Sim::REG_TX_PACKET_LENGTH));
+    // Takes at least the time on air, and at most a poll interval longer plus SPI overheads.
+    const uint64_t airtime = sim.frameAirtimeUs(sizeof(frame));
+    EXPECT_LE(t0 + airtime, sim.sent[0].at);
+    EXPECT_GE(t0 + airtime + 3000, sim.now());
+    EXPECT_FALSE(sim.isRX());
+
+    // Double TX at maximum power, then back to listening.
+    r.listen(true);
+    EXPECT_TRUE(r.sendRaw(frame, 3, 0, OTRadioLink::OTRadioLink::TXmax));
+    ASSERT_EQ(3U, sim.sent.size());
+    EXPECT_EQ(sim.sent[1].data, sim.sent[2].data);
+    EXPECT_EQ(3U, sim.sent[2].data.size());
+    EXPECT_LE(sim.sent[1].at + 15000, sim.sent[2].at);
+    EXPECT_TRUE(sim.isRX());
+
+    // Fails (after the timeout) with no radio.
+    SPI0::sim = NULL;
+    EXPECT_FALSE(r.sendRaw(frame, sizeof(frame)));
+    SPI0::sim = &sim;
+    EXPECT_EQ(0U, sim.getStats().busErrors);
+}
+
+// Test packet reception through the ISR into the RX queue.
+TEST(OTRFM23BLink,receive)
+{
+    SimOnSPI0 s;
+    Sim &sim = s.sim;
+    Radio r;
+    startListening(r, sim, GFSK);
+
+    uint8_t frame[20];
+    for(uint8_t i = 0; i < sizeof(frame); ++i) { frame[i] = i * 7; }
+    sim.sendOnAir(frame, sizeof(frame));
+    ASSERT_TRUE(sim.advanceUntilIRQ(100000));
+    EXPECT_FALSE(sim.isRX()); // Reverted to ready after the packet.
+    EXPECT_TRUE(r.handleInterruptSimple());
+    EXPECT_FALSE(sim.irq());
+    EXPECT_TRUE(sim.isRX()); // Listening again.
+    ASSERT_EQ(1, r.getRXMsgsQueued());
+    const volatile uint8_t *const m = r.peekRXMsg();
+    ASSERT_TRUE(NULL != m);
+    EXPECT_EQ(sizeof(frame), m[-1]);
+    for(uint8_t i = 0; i < sizeof(frame); ++i) { EXPECT_EQ(frame[i], m[i]); }
+    r.removeRXMsg();
+    EXPECT_EQ(0, r.getRXMsgsQueued());
+    EXPECT_EQ(0, r.getRXErr());
+
+    // The same by polling, once the receiver has settled.
+    sim.sendOnAir(sim.now() + sim.settleUs, frame, 5);
+    sim.advance(100000);
+    r.poll();
+    ASSERT_EQ(1, r.getRXMsgsQueued());
+    EXPECT_EQ(5, r.peekRXMsg()[-1]);
+    r.removeRXMsg();
+
+    // Frames rejected by the filter are counted and not queued.
+    r.setFilterRXISR([](const volatile uint8_t *buf, volatile uint8_t &) { return(0 != buf[0]); });
+    frame[0] = 0;
+    sim.sendOnAir(sim.now() + sim.settleUs, frame, sizeof(frame));
+    ASSERT_TRUE(sim.advanceUntilIRQ(100000));
+    r.handleInterruptSimple();
+    EXPECT_EQ(0, r.getRXMsgsQueued());
+    EXPECT_EQ(1, r.getRXMsgsFilteredRecent());
+    EXPECT_EQ(0, r.getRXErr());
+    EXPECT_EQ(3U, sim.getStats().rxFrames);
+    EXPECT_EQ(0U, sim.getStats().busErrors);
+}
+
+// Test a burst of frames faster than the RX queue is drained.
+// Frames that do not fit in the queue are dropped and reported (once) by getRXErr().
+TEST(OTRFM23BLink,burstOverflowsQueue)
+{
+    SimOnSPI0 s;
+    Sim &sim = s.sim;
+    Radio r;
+    startListening(r, sim, GFSK);
+    uint8_t queueMin, maxRX, maxTX;
+    r.getCapacity(queueMin, maxRX, maxTX);
+    EXPECT_EQ(3, queueMin);
+    EXPECT_EQ(64, maxRX);
+
+    // Full-size frames, spaced to allow the ISR to complete between them.
+    const int n = 8;
+    const uint8_t len = 60;
+    const uint64_t period = sim.frameAirtimeUs(len) + 4000;
+    const uint64_t start = sim.now() + 100;
+    uint8_t frame[len];
+    for(int i = 0; i < n; ++i)
+        {
+        memset(frame, i, len);
+        sim.sendOnAir(start + (i * period), frame, len);
+        }
+    for(int i = 0; i < n; ++i)
+        {
+        ASSERT_TRUE(sim.advanceUntilIRQ(2 * period));
+        EXPECT_TRUE(r.handleInterruptSimple());
+        }
+    EXPECT_EQ((uint32_t)n, sim.getStats().rxFrames);
+    EXPECT_EQ(0U, sim.getStats().missed);
+    const uint8_t queued = r.getRXMsgsQueued();
+    EXPECT_LE(queueMin, queued);
+    EXPECT_GT(n, queued);
+    EXPECT_EQ(n - queued, r.getRXMsgsDroppedRecent());
+    EXPECT_EQ(OTRadioLink::OTRadioLink::RXErr_DroppedFrame, r.getRXErr());
+    EXPECT_EQ(0, r.getRXErr()); // Cleared by reading.
+    // The oldest frames are kept, in order.
+    for(int i = 0; i < queued; ++i)
+        {
+        const volatile uint8_t *const m = r.peekRXMsg();
+        ASSERT_TRUE(NULL != m);
+        EXPECT_EQ(len, m[-1]);
+        EXPECT_EQ(i, m[0]);
+        EXPECT_EQ(i, m[len-1]);
+        r.removeRXMsg();
+        }
+
+    // Short frames pack into the same queue space.
+    for(int i = 0; i < n; ++i)
+        {
+        memset(frame, i, 8);
+        sim.sendOnAir(sim.now() + sim.settleUs, frame, 8);
+        ASSERT_TRUE(sim.advanceUntilIRQ(period));
+        r.handleInterruptSimple();
+        }
+    EXPECT_EQ(n, r.getRXMsgsQueued());
+    EXPECT_EQ(0, r.getRXErr());
+}
+
+// Test frames arriving while the ISR has the receiver out of RX mode.
+// These are lost on the air, and not reported by getRXErr().
+TEST(OTRFM23BLink,burstMissedInTurnaround)
+{
+    SimOnSPI0 s;
+    Sim &sim = s.sim;
+    Radio r;
+    startListening(r, sim, GFSK);
+
+    const int n = 6;
+    const uint8_t len = 16;
+    // Back-to-back frames with a gap much shorter than the ISR.
+    const uint64_t period = sim.frameAirtimeUs(len) + 200;
+    const uint64_t start = sim.now() + 100;
+    uint8_t frame[len];
+    memset(frame, 0xaa, len);
+    for(int i = 0; i < n; ++i) { sim.sendOnAir(start + (i * period), frame, len); }
+    while(sim.advanceUntilIRQ(4 * period))
+        {
+        r.handleInterruptSimple();
+        while(0 != r.getRXMsgsQueued()) { r.removeRXMsg(); }
+        }
+    const Sim::Stats &st = sim.getStats();
+    EXPECT_EQ((uint32_t)n, st.rxFrames + st.missed);
+    EXPECT_LT(0U, st.missed);
+    EXPECT_LT(0U, st.rxFrames);
+    EXPECT_EQ(0, r.getRXMsgsDroppedRecent());
+    EXPECT_EQ(0, r.getRXErr());
+}
+
+// Test RX FIFO overrun without the packet handler (FS20/FHT8V OOK).
+TEST(OTRFM23BLink,OOKOverrun)
+{
+    SimOnSPI0 s;
+    Sim &sim = s.sim;
+    Radio r;
+    startListening(r, sim, OOK);
+    EXPECT_EQ(0, sim.peekReg(Sim::REG_DATA_ACCESS_CONTROL));
+    EXPECT_EQ(5000U, sim.dataRate());
+    EXPECT_EQ(0x10, sim.peekReg(Sim::REG_INT_ENABLE1)); // RX FIFO almost full.
+
+    uint8_t frame[Radio::MAX_RX_FRAME_FHT8V];
+    for(uint8_t i = 0; i < sizeof(frame); ++i) { frame[i] = 0xcc ^ i; }
+    // Serviced when the FIFO reaches the threshold: frame followed by noise.
+    sim.sendOnAir(frame, sizeof(frame));
+    ASSERT_TRUE(sim.advanceUntilIRQ(1000000));
+    EXPECT_EQ((size_t)Radio::MAX_RX_FRAME_DEFAULT, sim.rxFIFOLevel());
+    EXPECT_TRUE(r.handleInterruptSimple());
+    ASSERT_EQ(1, r.getRXMsgsQueued());
+    EXPECT_EQ((int)Radio::MaxRXMsgLen, r.peekRXMsg()[-1]);
+    EXPECT_EQ(0, memcmp((const uint8_t *)r.peekRXMsg(), frame, sizeof(frame)));
+    r.removeRXMsg();
+    EXPECT_EQ(0, r.getRXErr());
+
+    // Serviced too late: the FIFO overflows and the frame is lost.
+    sim.sendOnAir(sim.now() + sim.settleUs, frame, sizeof(frame));
+    sim.advance(sim.frameAirtimeUs(Sim::FIFO_SIZE + 4));
+    EXPECT_EQ(1U, sim.getStats().rxOverflows);
+    r.poll();
+    EXPECT_EQ(0, r.getRXMsgsQueued());
+    EXPECT_EQ(OTRadioLink::OTRadioLink::RXErr_RXOverrun, r.getRXErr());
+    EXPECT_TRUE(sim.isRX());
+    EXPECT_EQ(0U, sim.getStats().busErrors);
+}
+
+// Test that the ISR reads each frame with one SPI burst of just the frame's bytes,
+// so that frames with short gaps between them can be received back-to-back.
+TEST(OTRFM23BLink,burstFIFO)
+{
+    SimOnSPI0 s;
+    Sim &sim = s.sim;
+    Radio r;
+    startListening(r, sim, GFSK);
+
+    // Status, length, standby, FIFO, clear FIFOs, clear interrupts, RX.
+    const uint32_t isrTransactions = 8;
+    const uint32_t isrOverheadBytes = 3 + 2 + 2 + 1 + 4 + 3 + 2;
+    uint8_t frame[63];
+    memset(frame, 0x33, sizeof(frame));
+    static const uint8_t lens[] = { 1, 8, 63 };
+    for(const uint8_t len : lens)
+        {
+        sim.sendOnAir(sim.now() + sim.settleUs, frame, len);
+        ASSERT_TRUE(sim.advanceUntilIRQ(100000));
+        const Sim::Stats before = sim.getStats();
+        ASSERT_TRUE(r.handleInterruptSimple());
+        const Sim::Stats &after = sim.getStats();
+        EXPECT_EQ(isrTransactions, after.spiTransactions - before.spiTransactions);
+        EXPECT_EQ(isrOverheadBytes + len, after.spiBytes - before.spiBytes);
+        EXPECT_EQ((uint64_t)(isrTransactions * sim.spiSelectCycles) + ((isrOverheadBytes + len) * sim.spiByteCycles), after.cycles - before.cycles);
+        ASSERT_EQ(1, r.getRXMsgsQueued());
+        EXPECT_EQ(len, r.peekRXMsg()[-1]);
+        EXPECT_EQ(0, memcmp((const uint8_t *)r.peekRXMsg(), frame, len));
+        r.removeRXMsg();
+        EXPECT_TRUE(sim.isRX());
+        }
+
+    // A frame that there is no room for is not read at all.
+    for(int i = 0; i < 4; ++i)
+        {
+        sim.sendOnAir(sim.now() + sim.settleUs, frame, 60);
+        ASSERT_TRUE(sim.advanceUntilIRQ(100000));
+        const uint32_t b0 = sim.getStats().spiBytes;
+        r.handleInterruptSimple();
+        if(3 == i) { EXPECT_EQ(isrOverheadBytes - 1, sim.getStats().spiBytes - b0); }
+        }
+    EXPECT_EQ(1, r.getRXMsgsDroppedRecent());
+    EXPECT_EQ(OTRadioLink::OTRadioLink::RXErr_DroppedFrame, r.getRXErr());
+    while(0 != r.getRXMsgsQueued()) { r.removeRXMsg(); }
+
+    // Short frames with gaps of only a few ms are all received.
+    const int n = 20;
+    const uint64_t period = sim.frameAirtimeUs(8) + 1000;
+    const uint64_t start = sim.now() + sim.settleUs;
+    for(int i = 0; i < n; ++i) { sim.sendOnAir(start + (i * period), frame, 8); }
+    int queued = 0;
+    while(sim.advanceUntilIRQ(2 * period))
+        {
+        r.handleInterruptSimple();
+        while(0 != r.getRXMsgsQueued()) { ++queued; r.removeRXMsg(); }
+        }
+    EXPECT_EQ(n, queued);
+    EXPECT_EQ(0, r.getRXErr());
+    EXPECT_EQ(0U, sim.getStats().busErrors);
+}
+
+// Time from nIRQ to the frame being queued is taken by the RX filter, called just before queueing.
+static uint64_t queuedAt;
+static bool noteQueued(const volatile uint8_t *, volatile uint8_t &)
+    {
+    queuedAt = SPI0::sim->now();
+    return(true);
+    }
+
+// Receive n frames of len bytes starting every periodUs, servicing each interrupt at once
+// and draining the queue each time; returns the number of frames queued.
+static int receiveStream(Radio &r, Sim &sim, const uint8_t len, const uint64_t periodUs, const int n)
+    {
+    uint8_t frame[64];
+    memset(frame, 0x5a, len);
+    const uint64_t start = sim.now() + 1000;
+    for(int i = 0; i < n; ++i) { sim.sendOnAir(start + (i * periodUs), frame, len); }
+    int queued = 0;
+    while(sim.advanceUntilIRQ(2 * periodUs + 10000))
+        {
+        r.handleInterruptSimple();
+        while(0 != r.getRXMsgsQueued()) { ++queued; r.removeRXMsg(); }
+        }
+    return(queued);
+    }
+
+// Benchmark ISR-to-queue latency and CPU cycles, and the maximum sustained RX frame rate,
+// in virtual time with SPI at 500kHz as for V0p2 with a 1MHz CPU.
+TEST(OTRFM23BLink,benchmark)
+{
+    // If true then be more verbose.
+    const static bool verbose = false;
+
+    SimOnSPI0 s;
+    Sim &sim = s.sim;
+    Radio r;
+    startListening(r, sim, GFSK);
+    r.setFilterRXISR(noteQueued);
+
+    static const uint8_t lens[] = { 8, 32, 63 };
+    for(const uint8_t len : lens)
+        {
+        // Latency, over several frames.
+        const int reps = 100;
+        uint64_t toQueue = 0, isr = 0;
+        uint32_t spiBytes = 0;
+        uint64_t cycles = 0;
+        double hostNs = 0;
+        uint8_t frame[64];
+        memset(frame, len, len);
+        for(int i = 0; i < reps; ++i)
+            {
+            sim.sendOnAir(sim.now() + sim.settleUs, frame, len);
+            ASSERT_TRUE(sim.advanceUntilIRQ(100000));
+            const uint64_t irqAt = sim.getIRQAt();
+            const uint32_t b0 = sim.getStats().spiBytes;
+            const uint64_t c0 = sim.getStats().cycles;
+            const auto h0 = std::chrono::steady_clock::now();
+            ASSERT_TRUE(r.handleInterruptSimple());
+            hostNs += std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - h0).count();
+            toQueue += queuedAt - irqAt;
+            isr += sim.now() - irqAt;
+            spiBytes += sim.getStats().spiBytes - b0;
+            cycles += sim.getStats().cycles - c0;
+            ASSERT_EQ(1, r.getRXMsgsQueued());
+            r.removeRXMsg();
+            }
+
+        // Sustained rate: shortest frame period with no frames lost.
+        const uint64_t airtime = sim.frameAirtimeUs(len);
+        const int n = 50;
+        uint64_t period = airtime;
+        while(receiveStream(r, sim, len, period, n) < n) { period += 50; }
+        EXPECT_EQ(0U, sim.getStats().busErrors);
+        if(verbose)
+            {
+            fprintf(stderr, "RFM23B RX %2u-byte frames: IRQ to queued %lluus, ISR %lluus, %u SPI bytes, %llu cycles, host %.0fns; max sustained %.1f frames/s (airtime %lluus, limit %.1f frames/s)\n",
+                (unsigned)len, (unsigned long long)(toQueue / reps), (unsigned long long)(isr / reps), spiBytes / reps, (unsigned long long)(cycles / reps), hostNs / reps,
+                1e6 / period, (unsigned long long)airtime, 1e6 / airtime);
+            }
+        }
+}
@@ -0,0 +1,277 @@
+/*
+The OpenTRV project licenses this file to you
+under the Apache Licence, Version 2.0 (the "Licence");
+you may not use this file except in compliance
+with the Licence. You may obtain a copy of the Licence at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing,
+software distributed under the Licence is distributed on an
+"AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+KIND, either express or implied. See the Licence for the
+specific language governing permissions and limitations
+under the Licence.
+
+Author(s) / Copyright (s): Damon Hart-Davis 2016
+*/
+
+/*
+ * OTRN2483Link tests, against a simulated RN2483.
+ */
+
+#include <gtest/gtest.h>
+#include <stdio.h>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "OTRN2483Link.h"
+#include "OTSIM900Link.h"
+#include "OTRadioLink_ATModemSimulator.h"
+
+// Test the time on air calculation against the simulator's independent one.
+TEST(OTRN2483Link,airtime)
+{
+    typedef OTRN2483Link::OTRN2483LinkBase B;
+    for(uint8_t dr = 0; dr <= 5; ++dr)
+        {
+        for(int len = 0; len <= B::getMaxPayload(dr); ++len)
+            { ASSERT_EQ(OTRadioLink::RN2483CommandSet::airtimeUs((uint8_t)len, dr), B::getAirtimeUs((uint8_t)len, dr)) << len << " " << (int)dr; }
+        }
+    EXPECT_EQ(51, B::getMaxPayload(0));
+    EXPECT_EQ(115, B::getMaxPayload(3));
+    EXPECT_EQ(222, B::getMaxPayload(5));
+}
+
+// Test the per-channel duty cycle budget.
+TEST(OTRN2483Link,dutyCycleScheduler)
+{
+    OTRN2483Link::OTRN2483DutyCycleScheduler<3> s;
+    EXPECT_TRUE(s.canSend());
+    // 62ms on air at 0.33% is 18.6s, rounded up plus a second.
+    s.sent(61696);
+    EXPECT_TRUE(s.canSend());
+    s.tick(5);
+    s.sent(61696);
+    s.sent(61696);
+    EXPECT_FALSE(s.canSend());
+    EXPECT_EQ(15, s.getWaitS());
+    s.tick(14);
+    EXPECT_FALSE(s.canSend());
+    s.tick(1);
+    EXPECT_TRUE(s.canSend());
+    EXPECT_EQ(0, OTRN2483Link::OTRN2483DutyCycleScheduler<3>().getWaitS());
+    s.holdOff(30);
+    EXPECT_EQ(30, s.getWaitS());
+    s.reset();
+    EXPECT_TRUE(s.canSend());
+}
+
+namespace RN2483Test
+{
+// An RN2483 on a 9600 baud line, with both the simulator and the RTC driven in virtual time.
+template<uint8_t slots, bool coalesce>
+class Bench final
+    {
+    public:
+        typedef OTRN2483Link::OTRN2483Link<0, 0, 0, 9600, OTRadioLink::ATModemSimulatorPort<2>, slots, coalesce> Link;
+        OTRadioLink::ATModemSimulator sim;
+        OTRadioLink::RN2483CommandSet rn;
+        Link l;
+        // Interval between link polls.
+        uint32_t pollUs = 100000;
+
+        Bench()
+            {
+            sim.setBaud(9600);
+            sim.setLatency(1000, 5000);
+            rn.channels = 3;
+            rn.rxWindowsUs = 2000000;
+            rn.install(sim);
+            OTRadioLink::ATModemSimulatorPort<2>::sim = &sim;
+            OTV0P2BASE::setSeconds(0);
+            EXPECT_TRUE(l.begin());
+            }
+        ~Bench() { OTRadioLink::ATModemSimulatorPort<2>::sim = NULL; OTV0P2BASE::setSeconds(0); }
+
+        void step()
+            {
+            sim.advance(pollUs);
+            OTV0P2BASE::setSeconds((uint8_t)((sim.now() / 1000000) % 60));
+            l.poll();
+            }
+        // Step until the link is idle with nothing queued, up to maxS virtual seconds; false if not.
+        bool settle(const double maxS)
+            {
+            const uint64_t t0 = sim.now();
+            while((OTRN2483Link::IDLE != l._getState()) || (0 != l.getTXMsgsQueued()))
+                {
+                if(sim.now() - t0 > maxS * 1e6) { return(false); } // FAIL
+                step();
+                }
+            return(true);
+            }
+    };
+
+// Split a coalesced payload into its frames.
+std::vector<std::string> split(const std::string &p)
+    {
+    std::vector<std::string> frames;
+    OTSIM900Link::OTSIM900CoalescedFrameReader r((const uint8_t *)p.data(), p.size());
+    const uint8_t *f;
+    uint8_t len;
+    while(r.next(f, len)) { frames.push_back(std::string((const char *)f, len)); }
+    EXPECT_FALSE(r.isMalformed());
+    return(frames);
+    }
+}
+
+// Test configuration and joining, then that each frame is sent in its own uplink on port 1,
+// without poll() waiting for the module.
+TEST(OTRN2483Link,basics)
+{
+    RN2483Test::Bench<2, false> b;
+    EXPECT_FALSE(b.l.isAvailable());
+    ASSERT_TRUE(b.settle(10));
+    EXPECT_TRUE(b.l.isAvailable());
+    EXPECT_TRUE(b.rn.isJoined());
+    uint8_t q, rx, tx;
+    b.l.getCapacity(q, rx, tx);
+    EXPECT_EQ(51, tx);
+    const uint8_t f1[] = { 0x10, 0xab, 0x00 };
+    const uint8_t f2[] = { 'x' };
+    EXPECT_TRUE(b.l.queueToSend(f1, sizeof(f1)));
+    EXPECT_TRUE(b.l.sendRaw(f2, sizeof(f2)));
+    EXPECT_EQ(2, b.l.getTXMsgsQueued());
+    uint8_t big[52] = { };
+    EXPECT_FALSE(b.l.queueToSend(big, sizeof(big)));
+    EXPECT_TRUE(b.l.queueToSend(big, sizeof(big) - 1));
+    EXPECT_EQ(2, b.l.getTXMsgsQueued());
+    ASSERT_TRUE(b.settle(60));
+    ASSERT_EQ(2U, b.rn.payloads.size());
+    EXPECT_EQ(std::string("x"), b.rn.payloads[0]);
+    EXPECT_EQ(std::string(51, '\0'), b.rn.payloads[1]);
+    EXPECT_EQ(1, b.rn.ports[0]);
+    EXPECT_EQ(5, b.l.getDataRate());
+    // Never ran over the duty cycle.
+    EXPECT_EQ(0U, b.rn.noFreeChannel);
+    EXPECT_EQ(0U, b.rn.busy);
+}
+
+// Test that queued frames are coalesced into as few uplinks as fit at the data rate.
+TEST(OTRN2483Link,coalesce)
+{
+    RN2483Test::Bench<8, true> b;
+    ASSERT_TRUE(b.settle(10));
+    std::vector<std::string> sent;
+    for(int i = 0; i < 8; ++i)
+        {
+        const std::string f(40, (char)('a' + i));
+        EXPECT_TRUE(b.l.queueToSend((const uint8_t *)f.data(), (uint8_t)f.size()));
+        sent.push_back(f);
+        }
+    ASSERT_TRUE(b.settle(60));
+    // At DR5 up to 222 bytes, ie 5 frames of 41 bytes each with the length.
+    ASSERT_EQ(2U, b.rn.payloads.size());
+    EXPECT_EQ(205U, b.rn.payloads[0].size());
+    std::vector<std::string> received;
+    for(const std::string &p : b.rn.payloads) { for(const std::string &f : RN2483Test::split(p)) { received.push_back(f); } }
+    EXPECT_EQ(sent, received);
+}
+
+// Test recovery when the module restarts, and when it stops responding.
+TEST(OTRN2483Link,recovery)
+{
+    RN2483Test::Bench<2, false> b;
+    ASSERT_TRUE(b.settle(10));
+    b.rn.reboot();
+    const uint8_t f[] = { 1, 2, 3 };
+    EXPECT_TRUE(b.l.queueToSend(f, sizeof(f)));
+    ASSERT_TRUE(b.settle(60));
+    ASSERT_EQ(1U, b.rn.payloads.size());
+    EXPECT_TRUE(b.rn.isJoined());
+
+    // A dead module causes a timeout and resync, but the frame is kept.
+    b.sim.setResponsive(false);
+    EXPECT_TRUE(b.l.queueToSend(f, sizeof(f)));
+    for(int i = 0; i < 200; ++i) { b.step(); }
+    EXPECT_FALSE(b.l.isAvailable());
+    EXPECT_EQ(1, b.l.getTXMsgsQueued());
+    b.sim.setResponsive(true);
+    ASSERT_TRUE(b.settle(60));
+    EXPECT_EQ(2U, b.rn.payloads.size());
+}
+
+namespace RN2483Test
+{
+// Run the link with frames offered every intervalS virtual seconds (or with the queue kept full if 0) for runS virtual seconds.
+// Returns frames delivered, and sets the mean and max latency from being queued to the uplink, s.
+template<uint8_t slots, bool coalesce>
+unsigned long runLoad(const double intervalS, const double runS, double &meanLatencyS, double &maxLatencyS)
+    {
+    Bench<slots, coalesce> b;
+    EXPECT_TRUE(b.settle(10));
+    std::map<std::string, uint64_t> queuedAt;
+    unsigned long n = 0, delivered = 0;
+    double totalLatency = 0;
+    maxLatencyS = 0;
+    size_t seen = 0;
+    const uint64_t t0 = b.sim.now();
+    uint64_t nextAt = t0;
+    while(b.sim.now() - t0 < runS * 1e6)
+        {
+        while((0 == intervalS) ? (b.l.getTXMsgsQueued() < slots) : (b.sim.now() >= nextAt))
+            {
+            char frame[24];
+            const int len = snprintf(frame, sizeof(frame), "{\"@\":\"414a\",\"n\":%lu}", n++);
+            b.l.queueToSend((const uint8_t *)frame, (uint8_t)len);
+            queuedAt[std::string(frame, len)] = b.sim.now();
+            nextAt += (uint64_t)(intervalS * 1e6);
+            }
+        b.step();
+        for( ; seen < b.rn.payloads.size(); ++seen)
+            {
+            const std::vector<std::string> frames = coalesce ? split(b.rn.payloads[seen]) : std::vector<std::string>(1, b.rn.payloads[seen]);
+            for(const std::string &f : frames)
+                {
+                const auto q = queuedAt.find(f);
+                if(queuedAt.end() == q) { ADD_FAILURE() << "unexpected frame"; continue; }
+                const double latency = (b.sim.now() - q->second) / 1e6;
+                totalLatency += latency;
+                if(latency > maxLatencyS) { maxLatencyS = latency; }
+                ++delivered;
+                }
+            }
+        }
+    EXPECT_EQ(0U, b.rn.noFreeChannel);
+    meanLatencyS = (0 == delivered) ? 0 : (totalLatency / delivered);
+    return(delivered);
+    }
+}
+
+// Benchmark uplink throughput with the queue kept full, and latency at a light load, in virtual time,
+// sending each frame individually and coalesced, at DR5 with 3 channels sharing the 1% duty cycle.
+TEST(OTRN2483Link,benchmark)
+{
+    // If true then be more verbose.
+    const static bool verbose = false;
+
+    const double runS = 3600;
+    double mean[4], max[4];
+    const unsigned long fullIndividual = RN2483Test::runLoad<8, false>(0, runS, mean[0], max[0]);
+    const unsigned long fullCoalesced = RN2483Test::runLoad<8, true>(0, runS, mean[1], max[1]);
+    const unsigned long lightIndividual = RN2483Test::runLoad<8, false>(30, runS, mean[2], max[2]);
+    const unsigned long lightCoalesced = RN2483Test::runLoad<8, true>(30, runS, mean[3], max[3]);
+    EXPECT_LT(fullIndividual * 2, fullCoalesced);
+    // A light load is all delivered, bar any still queued at the end.
+    EXPECT_LE(runS / 30 - 2, lightIndividual);
+    EXPECT_LE(runS / 30 - 2, lightCoalesced);
+    if(verbose)
+        {
+        fprintf(stderr, "RN2483 link, queue full: individually %.3g msgs/s (latency mean %.3gs, max %.3gs), coalesced %.3g msgs/s (mean %.3gs, max %.3gs); "
+            "1 frame/30s: individually latency mean %.3gs, max %.3gs, coalesced mean %.3gs, max %.3gs\n",
+            fullIndividual / runS, mean[0], max[0], fullCoalesced / runS, mean[1], max[1],
+            mean[2], max[2], mean[3], max[3]);
+        }
+}
@@ -23,6 +23,9 @@ Author(s) / Copyright (s): Damon Hart-Davis 2016
 #include <gtest/gtest.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <chrono>
+#include <string>
+#include <vector>
 
 #include "OTSIM900Link.h"
 
@@ -86,6 +89,11 @@ class GoodSimulator final : public Stream
   public:
     // Events exposed.
     static bool haveSeenCommandStart;
+    // Bodies of UDP datagrams sent, and count of bytes written to the simulated SIM900.
+    static std::vector<std::string> datagrams;
+    static unsigned long bytesWritten;
+    // Count of calls to read().
+    static unsigned long readCalls;
 
   private:
     // Command being collected from OTSIM900Link.
@@ -100,6 +108,11 @@ class GoodSimulator final : public Stream
     // Keep track (crudely) of state. Corresponds to OTSIM900LinkState values.
     uint8_t sim900LinkState = 0;
 
+    // Bytes of UDP datagram body still expected after AT+CIPSEND; the body may be binary.
+    size_t datagramRemaining = 0;
+    // True immediately after a CR ending a command, to discard any following LF.
+    bool afterCR = false;
+
   public:
     void begin(unsigned long) { }
     void begin(unsigned long, uint8_t);
@@ -108,7 +121,16 @@ class GoodSimulator final : public Stream
     virtual size_t write(uint8_t uc) override
       {
       const char c = (char)uc;
-      if(waitingForCommand)
+      ++bytesWritten;
+      const bool skipLF = afterCR && ('\n' == c);
+      afterCR = false;
+      if(skipLF) { }
+      else if(0 != datagramRemaining)
+        {
+        datagrams.back() += c;
+        --datagramRemaining;
+        }
+      else if(waitingForCommand)
         {
         // Look for leading 'A' of 'AT' to start a command.
         if('A' == c)
@@ -126,6 +148,7 @@ class GoodSimulator final : public Stream
           {
           waitingForCommand = true;
           collectingCommand = false;
+          afterCR = ('\r' == c);
           if(verbose) { fprintf(stderr, "command received: %s\n", command.c_str()); }
           // Respond to particular commands...
           if("AT" == command) { // Relevant states: GET_STATE, RETRY_GET_STATE, START_UP
@@ -135,7 +158,7 @@ class GoodSimulator final : public Stream
               } else reply = "AT\r\n\r\nOK\r\n";
           }
           else if("AT+CPIN?" == command) { reply = /* (random() & 1) ? "No PIN\r" : */ "AT+CPIN?\r\n\r\n+CPIN: READY\r\n\r\nOK\r\n"; }  // Relevant states: CHECK_PIN
-          else if("AT+CREG?" == command) { reply = /* (random() & 1) ? "+CREG: 0,0\r" : */ "AT+CREG?\r\n\r\n+CREG: 0,5\r\n\r\n'OK\r\n"; } // Relevant states: WAIT_FOR_REGISTRATION
+          else if("AT+CREG?" == command) { reply = /* (random() & 1) ? "+CREG: 0,0\r" : */ "AT+CREG?\r\n\r\n+CREG: 0,5\r\n\r\nOK\r\n"; } // Relevant states: WAIT_FOR_REGISTRATION
           else if("AT+CSTT=apn" == command) { reply =  "AT+CSTT\r\n\r\nOK\r"; } // Relevant states: SET_APN
           else if("AT+CIPSTATUS" == command) {
               switch (sim900LinkState){
@@ -153,10 +176,15 @@ class GoodSimulator final : public Stream
                   default: break;
               }
           }  // Relevant states: START_GPRS, WAIT_FOR_UDP
+          else if("AT+CSQ" == command) { reply = "AT+CSQ\r\n\r\n+CSQ: 14,0\r\n\r\nOK\r\n"; }  // Relevant states: WAIT_FOR_UDP
           else if("AT+CIICR" == command) { reply = "AT+CIICR\r\n\r\nOK\r\n"; }  // Relevant states: START_GPRS
           else if("AT+CIFSR" == command) { reply = "AT+CIFSR\r\n\r\n172.16.101.199\r\n"; }  // Relevant States: GET_IP
           else if("AT+CIPSTART=\"UDP\",\"0.0.0.0\",\"9999\"" == command) { reply = "AT+CIPSTART=\"UDP\",\"0.0.0.0\",\"9999\"\r\n\r\nOK\r\n\r\nCONNECT OK\r\n"; }  // Relevant states: OPEN_UDP
-          else if("AT+CIPSEND=3" == command) { reply = "AT+CIPSEND=3\r\n\r\n>"; }  // Relevant states:  SENDING
+          else if(0 == command.compare(0, 11, "AT+CIPSEND=")) {  // Relevant states:  SENDING
+              reply = command + "\r\n\r\n>";
+              datagramRemaining = (size_t)atoi(command.c_str() + 11);
+              datagrams.push_back(std::string());
+          }
           else if("123" == command) { reply = "123\r\nSEND OK\r\n"; }  // Relevant states: SENDING
           }
         else if(collectingCommand) { command += c; }
@@ -166,6 +194,7 @@ class GoodSimulator final : public Stream
       }
     virtual int read() override
         {
+        ++readCalls;
         if(0 == reply.size()) { return(-1); }
         const char c = reply[0];
         if(verbose) { if(isprint(c)) { fprintf(stderr, ">%c\n", c); } else { fprintf(stderr, "> %d\n", (int)c); } }
@@ -178,6 +207,9 @@ class GoodSimulator final : public Stream
   };
 // Events exposed.
 bool GoodSimulator::haveSeenCommandStart;
+std::vector<std::string> GoodSimulator::datagrams;
+unsigned long GoodSimulator::bytesWritten;
+unsigned long GoodSimulator::readCalls;
 }
 TEST(OTSIM900Link,basicsSimpleSimulator)
 {
@@ -215,4 +247,236 @@ TEST(OTSIM900Link,basicsSimpleSimulator)
     l0.end();
 }
 
+// Test splitting of coalesced datagrams, including truncated ones.
+TEST(OTSIM900Link,coalescedFrameReader)
+{
+    const uint8_t d[] = { 3, 'a', 'b', 'c', 0, 1, 'z', 5, 'x' };
+    const uint8_t *f;
+    uint8_t l;
+    OTSIM900Link::OTSIM900CoalescedFrameReader r(d, sizeof(d));
+    ASSERT_TRUE(r.next(f, l)); EXPECT_EQ(3, l); EXPECT_EQ(0, memcmp(f, "abc", 3));
+    ASSERT_TRUE(r.next(f, l)); EXPECT_EQ(0, l);
+    ASSERT_TRUE(r.next(f, l)); EXPECT_EQ(1, l); EXPECT_EQ('z', *f);
+    EXPECT_FALSE(r.isMalformed());
+    EXPECT_FALSE(r.next(f, l)) << "last frame is truncated";
+    EXPECT_TRUE(r.isMalformed());
+    EXPECT_FALSE(r.next(f, l));
+    OTSIM900Link::OTSIM900CoalescedFrameReader e(NULL, 0);
+    EXPECT_FALSE(e.next(f, l));
+    EXPECT_FALSE(e.isMalformed());
+}
+
+namespace B2
+{
+const char SIM900_PIN[] = "1111";
+const char SIM900_APN[] = "apn";
+const char SIM900_UDP_ADDR[] = "0.0.0.0"; // ORS server
+const char SIM900_UDP_PORT[] = "9999";
+const OTSIM900Link::OTSIM900LinkConfig_t SIM900Config(false, SIM900_PIN, SIM900_APN, SIM900_UDP_ADDR, SIM900_UDP_PORT);
+const OTRadioLink::OTRadioChannelConfig l0Config(&SIM900Config, true);
+
+// Bring link up to IDLE then queue and send bursts of distinct frames of varying lengths.
+// Returns the number of poll() calls taken to empty the queue after each burst; frames sent are appended to sent.
+template<class L>
+unsigned long runBursts(L &l0, const int bursts, const int burstLength, std::vector<std::string> &sent)
+    {
+    EXPECT_TRUE(l0.configure(1, &l0Config));
+    EXPECT_TRUE(l0.begin());
+    for(int i = 0; i < 100; ++i) { l0.poll(); if(l0._getState() == OTSIM900Link::IDLE) break; }
+    EXPECT_EQ(OTSIM900Link::IDLE, l0._getState());
+    unsigned long polls = 0;
+    for(int b = 0; b < bursts; ++b)
+        {
+        for(int i = 0; i < burstLength; ++i)
+            {
+            char frame[64];
+            const int len = snprintf(frame, sizeof(frame), "{\"@\":\"%04x\",\"T|C16\":%d,\"b\":%d}", b, 300 + i, i);
+            EXPECT_TRUE(l0.queueToSend((const uint8_t *)frame, (uint8_t)len, 0, OTRadioLink::OTRadioLink::TXnormal));
+            sent.push_back(std::string(frame, len));
+            }
+        for(int i = 0; (i < 100) && ((0 != l0.getTXMsgsQueued()) || (l0._getState() != OTSIM900Link::IDLE)); ++i) { l0.poll(); ++polls; }
+        EXPECT_EQ(0, l0.getTXMsgsQueued());
+        }
+    return(polls);
+    }
+}
+
+// Test that a multi-slot queue sends every frame of a burst, in order, one per datagram,
+// and that when full the oldest frames are dropped.
+TEST(OTSIM900Link,multiSlotQueue)
+{
+    B1::GoodSimulator::datagrams.clear();
+    std::vector<std::string> sent;
+    OTSIM900Link::OTSIM900Link<0, 0, 0, B1::GoodSimulator, 4> l0;
+    B2::runBursts(l0, 3, 4, sent);
+    EXPECT_EQ(sent, B1::GoodSimulator::datagrams);
+
+    // Overfill the queue: only the last 4 frames survive.
+    B1::GoodSimulator::datagrams.clear();
+    sent.clear();
+    OTSIM900Link::OTSIM900Link<0, 0, 0, B1::GoodSimulator, 4> l1;
+    B2::runBursts(l1, 1, 7, sent);
+    ASSERT_EQ(4U, B1::GoodSimulator::datagrams.size());
+    EXPECT_TRUE(std::equal(sent.begin() + 3, sent.end(), B1::GoodSimulator::datagrams.begin()));
+
+    // The default single slot keeps only the freshest frame.
+    B1::GoodSimulator::datagrams.clear();
+    sent.clear();
+    OTSIM900Link::OTSIM900Link<0, 0, 0, B1::GoodSimulator> l2;
+    B2::runBursts(l2, 1, 3, sent);
+    ASSERT_EQ(1U, B1::GoodSimulator::datagrams.size());
+    EXPECT_EQ(sent.back(), B1::GoodSimulator::datagrams[0]);
+    B1::GoodSimulator::haveSeenCommandStart = false;
+}
+
+// Test that coalesced datagrams decode back to every frame in order,
+// and report throughput against sending frames individually.
+TEST(OTSIM900Link,coalescedThroughput)
+{
+    // If true then be more verbose.
+    const static bool verbose = false;
+
+    typedef std::chrono::steady_clock clock;
+    const int runs = 20;
+    const int bursts = 10;
+    const int burstLength = 8;
+
+    unsigned long polls[2] = { 0, 0 }, datagrams[2] = { 0, 0 }, bytes[2] = { 0, 0 };
+    double seconds[2] = { 0, 0 };
+    for(int coalesce = 0; coalesce <= 1; ++coalesce)
+        {
+        for(int run = 0; run < runs; ++run)
+            {
+            B1::GoodSimulator::datagrams.clear();
+            B1::GoodSimulator::bytesWritten = 0;
+            std::vector<std::string> sent;
+            std::vector<std::string> received;
+            const clock::time_point t0 = clock::now();
+            if(coalesce)
+                {
+                OTSIM900Link::OTSIM900Link<0, 0, 0, B1::GoodSimulator, burstLength, true> l0;
+                polls[1] += B2::runBursts(l0, bursts, burstLength, sent);
+                }
+            else
+                {
+                OTSIM900Link::OTSIM900Link<0, 0, 0, B1::GoodSimulator, burstLength> l0;
+                polls[0] += B2::runBursts(l0, bursts, burstLength, sent);
+                }
+            seconds[coalesce] += std::chrono::duration<double>(clock::now() - t0).count();
+            datagrams[coalesce] += B1::GoodSimulator::datagrams.size();
+            bytes[coalesce] += B1::GoodSimulator::bytesWritten;
+            if(!coalesce) { received = B1::GoodSimulator::datagrams; }
+            else
+                {
+                for(const std::string &d : B1::GoodSimulator::datagrams)
+                    {
+                    EXPECT_GE(255U, d.size());
+                    OTSIM900Link::OTSIM900CoalescedFrameReader r((const uint8_t *)d.data(), d.size());
+                    const uint8_t *f;
+                    uint8_t l;
+                    while(r.next(f, l)) { received.push_back(std::string((const char *)f, l)); }
+                    EXPECT_FALSE(r.isMalformed());
+                    }
+                }
+            ASSERT_EQ(sent, received);
+            }
+        }
+    EXPECT_LT(datagrams[1] * 2, datagrams[0]);
+    EXPECT_LT(polls[1], polls[0]);
+    const unsigned long frames = (unsigned long)runs * bursts * burstLength;
+    if(verbose)
+        {
+        fprintf(stderr, "SIM900 TX %lu frames: individually %lu datagrams, %.3g polls/frame, %.3g serial bytes/frame, %.3g frames/s; coalesced %lu datagrams, %.3g polls/frame, %.3g serial bytes/frame, %.3g frames/s\n",
+            frames,
+            datagrams[0], polls[0] / (double)frames, bytes[0] / (double)frames, frames / seconds[0],
+            datagrams[1], polls[1] / (double)frames, bytes[1] / (double)frames, frames / seconds[1]);
+        }
+    B1::GoodSimulator::haveSeenCommandStart = false;
+}
+
+// Test incremental parsing of SIM900 responses, fed a byte at a time.
+TEST(OTSIM900Link,ATParser)
+{
+    OTSIM900Link::OTSIM900ATParser p;
+    auto feed = [&p](const char *s) { while(*s) { if(p.feed(*s++)) { return(true); } } return(false); };
+
+    // Result line before OK; anything before the echo is ignored.
+    p.start(OTSIM900Link::AT_END_OK);
+    EXPECT_FALSE(feed("\r\nSEND OK\r\nAT+CREG?\r\n\r\n+CREG: 0,5\r\n"));
+    EXPECT_EQ(OTSIM900Link::AT_PENDING, p.getResult());
+    EXPECT_TRUE(feed("\r\nOK\r\n"));
+    EXPECT_EQ(OTSIM900Link::AT_OK, p.getResult());
+    EXPECT_STREQ("+CREG: 0,5", p.getInfo());
+
+    // Information after OK.
+    p.start(OTSIM900Link::AT_END_INFO);
+    EXPECT_FALSE(feed("AT+CIPSTATUS\r\n\r\nOK\r\n"));
+    EXPECT_TRUE(feed("\r\nSTATE: IP GPRSACT\r\n"));
+    EXPECT_EQ(OTSIM900Link::AT_OK, p.getResult());
+    EXPECT_STREQ("STATE: IP GPRSACT", p.getInfo());
 
+    // Prompt, not ended by a line end.
+    p.start(OTSIM900Link::AT_END_PROMPT);
+    EXPECT_FALSE(feed("AT+CIPSEND=3\r\n\r\n"));
+    EXPECT_TRUE(feed(">"));
+    EXPECT_EQ(OTSIM900Link::AT_OK, p.getResult());
+
+    // Errors end any command; long lines are truncated.
+    p.start(OTSIM900Link::AT_END_PROMPT);
+    EXPECT_TRUE(feed("AT+CIPSEND=3\r\n\r\nERROR\r\n"));
+    EXPECT_EQ(OTSIM900Link::AT_ERROR, p.getResult());
+    p.start(OTSIM900Link::AT_END_OK);
+    EXPECT_TRUE(feed("AT+CPIN?\r\n+CPIN: SIM PIN REQUIRED AND THEN SOME\r\n+CME ERROR: 11\r\n"));
+    EXPECT_EQ(OTSIM900Link::AT_ERROR, p.getResult());
+    EXPECT_EQ(OTSIM900Link::OTSIM900ATParser::MAX_INFO_CHARS, strlen(p.getInfo()));
+
+    // Garbage and silence wait for a timeout.
+    p.start(OTSIM900Link::AT_END_OK);
+    EXPECT_FALSE(feed("vfd"));
+    p.timeout();
+    EXPECT_EQ(OTSIM900Link::AT_TIMEOUT, p.getResult());
+    EXPECT_STREQ("", p.getInfo());
+}
+
+// Measure the worst-case time and serial reads of any poll() through start-up and bursts of sends.
+// poll() must never wait for the SIM900, so reads per poll() are bounded by the response bytes read per poll()
+// plus one unsuccessful read() for each AT command completed.
+TEST(OTSIM900Link,pollLatency)
+{
+    // If true then be more verbose.
+    const static bool verbose = false;
+
+    typedef std::chrono::steady_clock clock;
+    OTSIM900Link::OTSIM900Link<0, 0, 0, B1::GoodSimulator, 8, true> l0;
+    EXPECT_TRUE(l0.configure(1, &B2::l0Config));
+    EXPECT_TRUE(l0.begin());
+    double worst = 0, total = 0;
+    unsigned long worstReads = 0;
+    int polls = 0;
+    int sent = 0;
+    for(int i = 0; i < 1000; ++i)
+        {
+        if((OTSIM900Link::IDLE == l0._getState()) && (0 == (i & 7)))
+            {
+            for(int j = 0; j < 8; ++j)
+                {
+                const char frame[] = "{\"@\":\"abcd\",\"T|C16\":321,\"b\":1}";
+                if(l0.queueToSend((const uint8_t *)frame, sizeof(frame) - 1, 0, OTRadioLink::OTRadioLink::TXnormal)) { ++sent; }
+                }
+            }
+        const unsigned long reads0 = B1::GoodSimulator::readCalls;
+        const clock::time_point t0 = clock::now();
+        l0.poll();
+        const double t = std::chrono::duration<double>(clock::now() - t0).count();
+        worst = std::max(worst, t);
+        total += t;
+        worstReads = std::max(worstReads, B1::GoodSimulator::readCalls - reads0);
+        ++polls;
+        }
+    EXPECT_LT(0, sent);
+    EXPECT_LT(0U, B1::GoodSimulator::datagrams.size());
+    EXPECT_EQ(14, l0.getSignalQuality());
+    EXPECT_GE(64U + 4U, worstReads);
+    if(verbose) { fprintf(stderr, "SIM900 poll(): worst %.3gus, mean %.3gus, worst %lu serial reads\n", worst * 1e6, total * 1e6 / polls, worstReads); }
+    B1::GoodSimulator::haveSeenCommandStart = false;
+}
@@ -0,0 +1,124 @@
+/*
+The OpenTRV project licenses this file to you
+under the Apache Licence, Version 2.0 (the "Licence");
+you may not use this file except in compliance
+with the Licence. You may obtain a copy of the Licence at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing,
+software distributed under the Licence is distributed on an
+"AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+KIND, either express or implied. See the Licence for the
+specific language governing permissions and limitations
+under the Licence.
+
+Author(s) / Copyright (s): Damon Hart-Davis 2016
+*/
+
+/*
+ * Shared helpers for OTRadioLink secure frame tests:
+ * RAM-only RX state and builders for node IDs and secure frames.
+ */
+
+#ifndef PORTABLEUNITTESTS_OTRADIOLINK_SECUREFRAMETESTHELPERS_H
+#define PORTABLEUNITTESTS_OTRADIOLINK_SECUREFRAMETESTHELPERS_H
+
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+#include <OTRadioLink.h>
+
+
+namespace {
+
+// Simple RAM-only RX state, eg as a hub might hold, for hosted tests.
+// Node IDs are added with addNode(); counters start at zero.
+class RAMSecureRX final : public OTRadioLink::SimpleSecureFrame32or0BodyRXBase
+    {
+    public:
+        std::vector<std::vector<uint8_t> > ids;
+        std::vector<std::vector<uint8_t> > counters;
+
+        void addNode(const uint8_t *id)
+            {
+            ids.push_back(std::vector<uint8_t>(id, id + OTV0P2BASE::OpenTRV_Node_ID_Bytes));
+            counters.push_back(std::vector<uint8_t>(fullMessageCounterBytes, 0));
+            }
+
+        int find(const uint8_t *const ID) const
+            {
+            for(size_t i = 0; i < ids.size(); ++i)
+                { if(0 == memcmp(ID, &ids[i][0], OTV0P2BASE::OpenTRV_Node_ID_Bytes)) { return((int)i); } }
+            return(-1);
+            }
+
+        virtual bool getLastRXMessageCounter(const uint8_t * const ID, uint8_t *counter) const override
+            {
+            if((NULL == ID) || (NULL == counter)) { return(false); }
+            const int i = find(ID);
+            if(i < 0) { return(false); }
+            memcpy(counter, &counters[i][0], fullMessageCounterBytes);
+            return(true);
+            }
+
+        virtual bool updateRXMessageCountAfterAuthentication(const uint8_t *ID, const uint8_t *newCounterValue) override
+            {
+            if(!validateRXMessageCount(ID, newCounterValue)) { return(false); }
+            memcpy(&counters[find(ID)][0], newCounterValue, fullMessageCounterBytes);
+            return(true);
+            }
+
+        virtual int16_t _getNextMatchingNodeID(const uint16_t index, const uint8_t *const prefix, const uint8_t prefixLen, uint8_t *const ID) const override
+            {
+            for(size_t i = index; i < ids.size(); ++i)
+                {
+                if(0 != memcmp(prefix, &ids[i][0], prefixLen)) { continue; }
+                if(NULL != ID) { memcpy(ID, &ids[i][0], OTV0P2BASE::OpenTRV_Node_ID_Bytes); }
+                return((int16_t)i);
+                }
+            return(-1);
+            }
+    };
+
+// All-zeros key; the NULL crypto implementation ignores the key value.
+const uint8_t zeroKey[16] = { };
+
+// Make a distinct valid node ID from n [0,4095].
+inline void makeID(const uint16_t n, uint8_t *const id)
+    {
+    for(uint8_t i = 0; i < OTV0P2BASE::OpenTRV_Node_ID_Bytes; ++i) { id[i] = 0x80 | (uint8_t)(0x55 ^ i); }
+    id[0] = 0x80 | (uint8_t)(n & 0x3f);
+    id[1] = 0x80 | (uint8_t)((n >> 6) & 0x3f);
+    }
+
+// Make the full message counter for the given small counter value.
+inline void makeCounter(const uint16_t c, uint8_t *const counter)
+    {
+    memset(counter, 0, OTRadioLink::SimpleSecureFrame32or0BodyBase::fullMessageCounterBytes);
+    counter[3] = 0x01; // Keep well clear of the all-zeros initial counter.
+    counter[4] = (uint8_t)(c >> 8);
+    counter[5] = (uint8_t)c;
+    }
+
+// Encode secure 'O' frame from the given node with the given small counter value and body byte;
+// returns frame length.
+inline uint8_t makeFrame(uint8_t *const buf, const uint8_t *const id, const uint16_t c, const uint8_t bodyByte)
+    {
+    uint8_t iv[12];
+    memcpy(iv, id, 6);
+    makeCounter(c, iv + 6);
+    const uint8_t body[] = { 0x7f, 0x11, bodyByte };
+    return(OTRadioLink::SimpleSecureFrame32or0BodyTXBase::encodeSecureSmallFrameRaw(buf, OTRadioLink::SecurableFrameHeader::maxSmallFrameSize + 1,
+                                    OTRadioLink::FTS_BasicSensorOrValve,
+                                    id, OTRadioLink::ENC_BODY_DEFAULT_ID_BYTES,
+                                    body, sizeof(body),
+                                    iv,
+                                    OTRadioLink::fixed32BTextSize12BNonce16BTagSimpleEnc_NULL_IMPL,
+                                    NULL, zeroKey));
+    }
+
+}
+
+#endif
@@ -0,0 +1,225 @@
+/*
+The OpenTRV project licenses this file to you
+under the Apache Licence, Version 2.0 (the "Licence");
+you may not use this file except in compliance
+with the Licence. You may obtain a copy of the Licence at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing,
+software distributed under the Licence is distributed on an
+"AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+KIND, either express or implied. See the Licence for the
+specific language governing permissions and limitations
+under the Licence.
+
+Author(s) / Copyright (s): Damon Hart-Davis 2016
+*/
+
+/*
+ * OTRadioLink batch secure frame decode tests and benchmark.
+ */
+
+#include <gtest/gtest.h>
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include <vector>
+
+#include <OTRadioLink.h>
+#include "SecureFrameTestHelpers.h"
+
+
+namespace {
+
+// Decode one frame at a time via the preferred single-frame entry point; returns true on success.
+bool decodeOne(RAMSecureRX &rx, const uint8_t *const buf, const uint8_t buflen)
+    {
+    OTRadioLink::SecurableFrameHeader sfh;
+    if(0 == sfh.checkAndDecodeSmallFrameHeader(buf, buflen)) { return(false); }
+    uint8_t body[OTRadioLink::ENC_BODY_SMALL_FIXED_PTEXT_MAX_SIZE];
+    uint8_t bodySize;
+    uint8_t ID[OTV0P2BASE::OpenTRV_Node_ID_Bytes];
+    return(0 != rx.decodeSecureSmallFrameSafely(&sfh, buf, buflen,
+                                    OTRadioLink::fixed32BTextSize12BNonce16BTagSimpleDec_NULL_IMPL,
+                                    NULL, zeroKey,
+                                    body, sizeof(body), bodySize,
+                                    ID));
+    }
+
+// Raw frame buffer, wrapped to allow copying and storage in a vector.
+struct rawFrame_t { uint8_t b[OTRadioLink::SecurableFrameHeader::maxSmallFrameSize + 1]; };
+
+}
+
+
+// Check that a simple batch of good frames from several nodes all decode.
+TEST(SecureableFrameTypeBatch,AllGood)
+{
+    RAMSecureRX rx;
+    const uint8_t nodes = 5;
+    uint8_t id[OTV0P2BASE::OpenTRV_Node_ID_Bytes];
+    for(uint8_t i = 0; i < nodes; ++i) { makeID(i, id); rx.addNode(id); }
+
+    const uint8_t n = 3 * nodes;
+    rawFrame_t raw[n];
+    OTRadioLink::SecureBatchRXFrame frames[n];
+    for(uint8_t i = 0; i < n; ++i)
+        {
+        makeID(i % nodes, id);
+        const uint8_t l = makeFrame(raw[i].b, id, 1 + i, i);
+        ASSERT_NE(0, l);
+        frames[i].set(raw[i].b, l);
+        }
+    EXPECT_EQ(n, OTRadioLink::decodeSecureSmallFramesSafelyBatch(rx, frames, n,
+                OTRadioLink::fixed32BTextSize12BNonce16BTagSimpleDec_NULL_IMPL, NULL, zeroKey));
+    for(uint8_t i = 0; i < n; ++i)
+        {
+        EXPECT_EQ(OTRadioLink::SBRX_OK, frames[i].status) << (int)i;
+        EXPECT_EQ(frames[i].buflen, frames[i].decodedLength);
+        ASSERT_EQ(3, frames[i].decryptedBodyOutSize);
+        EXPECT_EQ(i, frames[i].decryptedBody[2]);
+        makeID(i % nodes, id);
+        EXPECT_EQ(0, memcmp(id, frames[i].ID, sizeof(id)));
+        }
+    // Last counter from each node should have been recorded.
+    for(uint8_t i = 0; i < nodes; ++i) { EXPECT_EQ(1 + 2*nodes + i, rx.counters[i][5]); }
+    // Replaying the whole batch should fail entirely as stale.
+    EXPECT_EQ(0, OTRadioLink::decodeSecureSmallFramesSafelyBatch(rx, frames, n,
+                OTRadioLink::fixed32BTextSize12BNonce16BTagSimpleDec_NULL_IMPL, NULL, zeroKey));
+    for(uint8_t i = 0; i < n; ++i) { EXPECT_EQ(OTRadioLink::SBRX_STALE_COUNTER, frames[i].status); }
+}
+
+// Check each kind of per-frame failure is reported.
+TEST(SecureableFrameTypeBatch,PerFrameStatus)
+{
+    RAMSecureRX rx;
+    uint8_t id0[OTV0P2BASE::OpenTRV_Node_ID_Bytes], id1[OTV0P2BASE::OpenTRV_Node_ID_Bytes], idX[OTV0P2BASE::OpenTRV_Node_ID_Bytes];
+    makeID(0, id0); rx.addNode(id0);
+    makeID(1, id1); rx.addNode(id1);
+    makeID(99, idX); // Not associated.
+    rx.counters[1][3] = 0x01; rx.counters[1][5] = 50; // Node 1 has already seen counter ...0x01 0 50.
+
+    const uint8_t n = 9;
+    rawFrame_t raw[n];
+    uint8_t len[n];
+    len[0] = makeFrame(raw[0].b, id0, 10, 0);                         // OK.
+    len[1] = makeFrame(raw[1].b, id0, 10, 0);                         // Repeat of 0: stale.
+    len[2] = makeFrame(raw[2].b, id1, 40, 2);                         // Below stored counter: stale.
+    len[3] = makeFrame(raw[3].b, idX, 10, 3);                         // Unknown ID.
+    len[4] = makeFrame(raw[4].b, id0, 20, 4); raw[4].b[1] = 0;          // Bad frame type.
+    len[5] = makeFrame(raw[5].b, id1, 60, 5); raw[5].b[len[5]-17] ^= 1; // Tag mangled: auth fails.
+    raw[6] = raw[5]; len[6] = len[5];                                 // Repeat of failed frame.
+    len[7] = makeFrame(raw[7].b, id0, 30, 7);                         // OK: overtakes 8.
+    len[8] = makeFrame(raw[8].b, id0, 25, 8);                         // Authentic but overtaken within batch.
+    OTRadioLink::SecureBatchRXFrame frames[n];
+    for(uint8_t i = 0; i < n; ++i) { ASSERT_NE(0, len[i]); frames[i].set(raw[i].b, len[i]); }
+    EXPECT_EQ(2, OTRadioLink::decodeSecureSmallFramesSafelyBatch(rx, frames, n,
+                OTRadioLink::fixed32BTextSize12BNonce16BTagSimpleDec_NULL_IMPL, NULL, zeroKey));
+    EXPECT_EQ(OTRadioLink::SBRX_OK, frames[0].status);
+    EXPECT_EQ(OTRadioLink::SBRX_STALE_COUNTER, frames[1].status);
+    EXPECT_EQ(OTRadioLink::SBRX_STALE_COUNTER, frames[2].status);
+    EXPECT_EQ(OTRadioLink::SBRX_UNKNOWN_ID, frames[3].status);
+    EXPECT_EQ(OTRadioLink::SBRX_BAD_HEADER, frames[4].status);
+    EXPECT_EQ(OTRadioLink::SBRX_AUTH_FAILED, frames[5].status);
+    EXPECT_EQ(OTRadioLink::SBRX_AUTH_FAILED, frames[6].status);
+    EXPECT_EQ(OTRadioLink::SBRX_OK, frames[7].status);
+    EXPECT_EQ(OTRadioLink::SBRX_COUNTER_UPDATE_FAILED, frames[8].status);
+    for(uint8_t i = 1; i < 7; ++i) { EXPECT_EQ(0, frames[i].decodedLength); }
+    EXPECT_EQ(0, frames[8].decodedLength);
+    EXPECT_EQ(30, rx.counters[0][5]);
+    EXPECT_EQ(50, rx.counters[1][5]);
+}
+
+// Check that batch and per-frame decode accept exactly the same frames
+// for a random mix of good, repeated, replayed, reordered and corrupted traffic.
+TEST(SecureableFrameTypeBatch,MatchesSingleFrameDecode)
+{
+    const uint8_t nodes = 7;
+    RAMSecureRX rxSingle, rxBatch;
+    uint8_t id[OTV0P2BASE::OpenTRV_Node_ID_Bytes];
+    for(uint8_t i = 0; i < nodes; ++i) { makeID(i, id); rxSingle.addNode(id); rxBatch.addNode(id); }
+    makeID(nodes, id); rxSingle.addNode(id); rxBatch.addNode(id); // Associated but silent.
+
+    const int n = 200;
+    std::vector<rawFrame_t> raw(n);
+    std::vector<uint8_t> len(n);
+    uint8_t lastCounter[nodes] = { };
+    for(int i = 0; i < n; ++i)
+        {
+        const uint8_t r = OTV0P2BASE::randRNG8();
+        if((i > 0) && (r < 40)) { raw[i] = raw[i-1]; len[i] = len[i-1]; continue; } // Repeat for noise immunity.
+        const uint8_t node = OTV0P2BASE::randRNG8() % (nodes + 1); // Includes an unknown node.
+        makeID((node == nodes) ? 200 : node, id);
+        uint8_t c = (node < nodes) ? lastCounter[node] : 0;
+        if(r < 200) { c += 1 + (r & 3); } else { c -= (r & 3); } // Mostly forward, some replays.
+        if(node < nodes) { lastCounter[node] = c; }
+        len[i] = makeFrame(raw[i].b, id, c, (uint8_t)i);
+        ASSERT_NE(0, len[i]);
+        if(r > 245) { raw[i].b[OTV0P2BASE::randRNG8() % len[i]] ^= 0x40; } // Corrupt.
+        }
+
+    std::vector<bool> singleOK(n);
+    for(int i = 0; i < n; ++i) { singleOK[i] = decodeOne(rxSingle, raw[i].b, len[i]); }
+    std::vector<OTRadioLink::SecureBatchRXFrame> frames(n);
+    for(int i = 0; i < n; ++i) { frames[i].set(raw[i].b, len[i]); }
+    const uint16_t decoded = OTRadioLink::decodeSecureSmallFramesSafelyBatch(rxBatch, &frames[0], n,
+                OTRadioLink::fixed32BTextSize12BNonce16BTagSimpleDec_NULL_IMPL, NULL, zeroKey);
+    uint16_t expected = 0;
+    for(int i = 0; i < n; ++i)
+        {
+        EXPECT_EQ(singleOK[i], OTRadioLink::SBRX_OK == frames[i].status) << i;
+        if(singleOK[i]) { ++expected; }
+        }
+    EXPECT_EQ(expected, decoded);
+    EXPECT_LT(0, decoded);
+    EXPECT_TRUE(rxSingle.counters == rxBatch.counters);
+}
+
+// Report frames/sec for batch decode against the per-frame path
+// for a burst of traffic from many nodes with each frame sent twice.
+TEST(SecureableFrameTypeBatch,Benchmark)
+{
+    // If true then be more verbose.
+    const static bool verbose = false;
+
+    const int nodes = 100;
+    const int n = 2000;
+    const int rounds = 5;
+    uint8_t id[OTV0P2BASE::OpenTRV_Node_ID_Bytes];
+    std::vector<rawFrame_t> raw(n);
+    std::vector<uint8_t> len(n);
+    for(int i = 0; i < n; ++i)
+        {
+        const int frame = i / 2;
+        makeID(frame % nodes, id);
+        len[i] = makeFrame(raw[i].b, id, (uint8_t)(1 + frame / nodes), (uint8_t)i);
+        if(i & 1) { raw[i] = raw[i-1]; len[i] = len[i-1]; }
+        }
+
+    typedef std::chrono::steady_clock clock;
+    double singleS = 0, batchS = 0;
+    std::vector<OTRadioLink::SecureBatchRXFrame> frames(n);
+    for(int round = 0; round < rounds; ++round)
+        {
+        RAMSecureRX rxSingle, rxBatch;
+        for(int i = 0; i < nodes; ++i) { makeID(i, id); rxSingle.addNode(id); rxBatch.addNode(id); }
+        int singleDecoded = 0;
+        const clock::time_point t0 = clock::now();
+        for(int i = 0; i < n; ++i) { if(decodeOne(rxSingle, raw[i].b, len[i])) { ++singleDecoded; } }
+        const clock::time_point t1 = clock::now();
+        for(int i = 0; i < n; ++i) { frames[i].set(raw[i].b, len[i]); }
+        const uint16_t batchDecoded = OTRadioLink::decodeSecureSmallFramesSafelyBatch(rxBatch, &frames[0], n,
+                    OTRadioLink::fixed32BTextSize12BNonce16BTagSimpleDec_NULL_IMPL, NULL, zeroKey);
+        const clock::time_point t2 = clock::now();
+        EXPECT_EQ(n/2, singleDecoded);
+        EXPECT_EQ(n/2, batchDecoded);
+        singleS += std::chrono::duration<double>(t1 - t0).count();
+        batchS += std::chrono::duration<double>(t2 - t1).count();
+        }
+    if(verbose)
+        {
+        fprintf(stderr, "Secure frame decode (NULL crypto, %d nodes): per-frame %.0f frames/s, batch %.0f frames/s\n",
+            nodes, (n * rounds) / singleS, (n * rounds) / batchS);
+        }
+}
@@ -0,0 +1,345 @@
+/*
+The OpenTRV project licenses this file to you
+under the Apache Licence, Version 2.0 (the "Licence");
+you may not use this file except in compliance
+with the Licence. You may obtain a copy of the Licence at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing,
+software distributed under the Licence is distributed on an
+"AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+KIND, either express or implied. See the Licence for the
+specific language governing permissions and limitations
+under the Licence.
+
+Author(s) / Copyright (s): Damon Hart-Davis 2016
+*/
+
+/*
+ * OTRadioLink RX message counter cache and stale-frame ISR filter tests and benchmark.
+ */
+
+#include <gtest/gtest.h>
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include <vector>
+
+#include <OTRadioLink.h>
+#include "OTRFM23BLink.h"
+#include "OTRFM23BLink_RFM23BSimulator.h"
+#include "SecureFrameTestHelpers.h"
+
+
+typedef OTRadioLink::SecureRXMessageCounterCache<4> Cache;
+
+
+// Test setting, updating and clearing cache entries.
+TEST(SecureableFrameTypeRXCounterCache,basics)
+{
+    Cache cache;
+    EXPECT_EQ(4, Cache::getMaxNodes());
+    uint8_t id[OTV0P2BASE::OpenTRV_Node_ID_Bytes];
+    uint8_t c[OTRadioLink::SimpleSecureFrame32or0BodyBase::fullMessageCounterBytes];
+    uint8_t out[sizeof(c)];
+    makeID(1, id);
+    EXPECT_FALSE(cache.get(id, out));
+    makeCounter(10, c);
+    EXPECT_FALSE(cache.update(id, c)) << "not cached";
+    EXPECT_FALSE(cache.set(4, id, c)) << "out of range";
+    EXPECT_FALSE(cache.set(0, NULL, c));
+    EXPECT_FALSE(cache.set(0, id, NULL));
+    EXPECT_TRUE(cache.set(2, id, c));
+    ASSERT_TRUE(cache.get(id, out));
+    EXPECT_EQ(0, memcmp(c, out, sizeof(c)));
+    // Raised but never lowered.
+    makeCounter(20, c);
+    EXPECT_TRUE(cache.update(id, c));
+    makeCounter(15, c);
+    EXPECT_TRUE(cache.update(id, c));
+    ASSERT_TRUE(cache.get(id, out));
+    EXPECT_EQ(20, out[5]);
+    // Set can lower, eg when reloading from the persistent store.
+    makeCounter(5, c);
+    EXPECT_TRUE(cache.set(2, id, c));
+    ASSERT_TRUE(cache.get(id, out));
+    EXPECT_EQ(5, out[5]);
+    cache.clear(2);
+    EXPECT_FALSE(cache.get(id, out));
+
+    // Prime from persistent RX state.
+    RAMSecureRX rx;
+    rx.addNode(id);
+    rx.counters[0][5] = 42;
+    uint8_t other[sizeof(id)];
+    makeID(2, other);
+    EXPECT_FALSE(cache.prime(0, other, rx));
+    EXPECT_TRUE(cache.prime(0, id, rx));
+    ASSERT_TRUE(cache.get(id, out));
+    EXPECT_EQ(42, out[5]);
+    cache.clearAll();
+    EXPECT_FALSE(cache.get(id, out));
+}
+
+// Cache used by the ISR filter; must have static storage duration and linkage.
+static Cache filterCache;
+
+// Test the ISR filter on fresh, duplicate, older, uncached and non-secure frames.
+TEST(SecureableFrameTypeRXCounterCache,filter)
+{
+    Cache &cache = filterCache;
+    cache.clearAll();
+    OTRadioLink::quickFrameFilter_t *const filter = OTRadioLink::frameFilterStaleRXMessageCounter<Cache, &filterCache>;
+    uint8_t id[OTV0P2BASE::OpenTRV_Node_ID_Bytes];
+    uint8_t c[OTRadioLink::SimpleSecureFrame32or0BodyBase::fullMessageCounterBytes];
+    uint8_t buf[OTRadioLink::SecurableFrameHeader::maxSmallFrameSize + 1];
+    makeID(1, id);
+    makeCounter(10, c);
+    ASSERT_TRUE(cache.set(0, id, c));
+
+    uint8_t l = makeFrame(buf, id, 11, 0);
+    ASSERT_NE(0, l);
+    volatile uint8_t vl = l;
+    EXPECT_TRUE(filter(buf, vl));
+    EXPECT_EQ(l, vl);
+    l = makeFrame(buf, id, 10, 0);
+    vl = l;
+    EXPECT_FALSE(filter(buf, vl)) << "duplicate";
+    EXPECT_EQ(l, vl);
+    l = makeFrame(buf, id, 3, 0);
+    vl = l;
+    EXPECT_FALSE(filter(buf, vl)) << "replay";
+    // Trailing junk in the RX buffer is ignored.
+    vl = sizeof(buf);
+    EXPECT_FALSE(filter(buf, vl));
+    // A truncated frame is let through for the full decode to reject.
+    vl = l - 1;
+    EXPECT_TRUE(filter(buf, vl));
+
+    // Uncached node.
+    uint8_t other[sizeof(id)];
+    makeID(2, other);
+    l = makeFrame(buf, other, 3, 0);
+    vl = l;
+    EXPECT_TRUE(filter(buf, vl));
+
+    // Non-secure frame.
+    const uint8_t body[] = { 0x7f, 0x11 };
+    l = OTRadioLink::encodeNonsecureSmallFrame(buf, sizeof(buf), OTRadioLink::FTS_BasicSensorOrValve, 0, id, 4, body, sizeof(body));
+    ASSERT_NE(0, l);
+    vl = l;
+    EXPECT_TRUE(filter(buf, vl));
+
+    // Another node sharing the header ID prefix: stale only if stale for both.
+    uint8_t twin[sizeof(id)];
+    memcpy(twin, id, sizeof(twin));
+    twin[7] ^= 1;
+    makeCounter(2, c);
+    ASSERT_TRUE(cache.set(1, twin, c));
+    l = makeFrame(buf, id, 3, 0);
+    vl = l;
+    EXPECT_TRUE(filter(buf, vl));
+    makeCounter(30, c);
+    ASSERT_TRUE(cache.update(twin, c));
+    EXPECT_FALSE(filter(buf, vl));
+}
+
+// Test the filter with update() after decode, as in the typical workflow, against the full decode result.
+TEST(SecureableFrameTypeRXCounterCache,matchesFullDecode)
+{
+    Cache cache;
+    RAMSecureRX rx;
+    uint8_t id[OTV0P2BASE::OpenTRV_Node_ID_Bytes];
+    for(uint8_t i = 0; i < Cache::getMaxNodes(); ++i)
+        {
+        makeID(i, id);
+        rx.addNode(id);
+        ASSERT_TRUE(cache.prime(i, id, rx));
+        }
+    // Random-ish mix of frames with counters going backwards and forwards.
+    uint8_t buf[OTRadioLink::SecurableFrameHeader::maxSmallFrameSize + 1];
+    for(int i = 0; i < 500; ++i)
+        {
+        makeID(OTV0P2BASE::randRNG8() % Cache::getMaxNodes(), id);
+        const uint8_t l = makeFrame(buf, id, OTV0P2BASE::randRNG8(), 0);
+        const bool stale = cache.isStale(buf, l);
+        OTRadioLink::SecurableFrameView sfv;
+        ASSERT_NE(0, sfv.checkAndDecodeSmallFrameHeader(buf, l));
+        uint8_t body[OTRadioLink::ENC_BODY_SMALL_FIXED_PTEXT_MAX_SIZE];
+        uint8_t bodySize;
+        uint8_t sender[OTV0P2BASE::OpenTRV_Node_ID_Bytes];
+        const bool ok = (0 != rx.decodeSecureSmallFrameSafely(&sfv,
+                                    OTRadioLink::fixed32BTextSize12BNonce16BTagSimpleDec_NULL_IMPL,
+                                    NULL, zeroKey,
+                                    body, sizeof(body), bodySize,
+                                    sender));
+        // Never rejects a frame that would authenticate, and with an up-to-date cache rejects all that would not.
+        EXPECT_EQ(!ok, stale) << i;
+        if(ok) { EXPECT_TRUE(cache.update(sender, sfv)); }
+        }
+}
+
+
+// Radio and simulator for the flood benchmark.
+typedef OTRFM23BLink::RFM23BSimulator Sim;
+typedef OTRFM23BLink::RFM23BSimulatorSPI<0> SPI0;
+typedef OTRFM23BLink::OTRFM23BLink<0, 0, OTRFM23BLink::DEFAULT_RFM23B_RX_QUEUE_CAPACITY, true, SPI0> Radio;
+static const OTRadioLink::OTRadioChannelConfig GFSK(OTRFM23BLink::StandardRegSettingsGFSK57600, true);
+
+// Cache used by the radio's ISR filter.
+static Cache floodCache;
+
+// Outcome of one flood run.
+struct FloodResult
+    {
+    int fresh = 0, freshAuthenticated = 0;
+    int queued = 0, filtered = 0, dropped = 0;
+    int decodeAttempts = 0;
+    double queuedSum = 0;
+    int maxQueued = 0;
+    double isrNs = 0, decodeNs = 0;
+    uint64_t isrCycles = 0;
+    };
+
+// Receive a flood of n frames mostly replaying one captured frame, with 1 in 8 fresh frames from 4 nodes,
+// with the main loop only servicing the queue after every third interrupt.
+static FloodResult flood(const bool filter, const int n)
+    {
+    FloodResult res;
+    Sim sim;
+    SPI0::sim = &sim;
+    Radio r;
+    r.preinit(NULL);
+    r.configure(1, &GFSK);
+    EXPECT_TRUE(r.begin());
+    r.listen(true);
+    sim.advance(sim.settleUs);
+    r.setFilterRXISR(filter ? OTRadioLink::frameFilterStaleRXMessageCounter<Cache, &floodCache> : NULL);
+
+    RAMSecureRX rx;
+    floodCache.clearAll();
+    uint8_t id[OTV0P2BASE::OpenTRV_Node_ID_Bytes];
+    for(uint8_t i = 0; i < Cache::getMaxNodes(); ++i)
+        {
+        makeID(i, id);
+        rx.addNode(id);
+        EXPECT_TRUE(floodCache.prime(i, id, rx));
+        }
+
+    // Decode the frame at the head of the queue as the main loop would, noting the counter if authenticated.
+    auto decodeOne = [&]()
+        {
+        const auto t0 = std::chrono::steady_clock::now();
+        OTRadioLink::SecurableFrameView sfv;
+        if(0 != sfv.checkAndDecodeRXMsg(r.peekRXMsg()))
+            {
+            ++res.decodeAttempts;
+            uint8_t body[OTRadioLink::ENC_BODY_SMALL_FIXED_PTEXT_MAX_SIZE];
+            uint8_t bodySize;
+            uint8_t sender[OTV0P2BASE::OpenTRV_Node_ID_Bytes];
+            if(0 != rx.decodeSecureSmallFrameSafely(&sfv,
+                                    OTRadioLink::fixed32BTextSize12BNonce16BTagSimpleDec_NULL_IMPL,
+                                    NULL, zeroKey,
+                                    body, sizeof(body), bodySize,
+                                    sender))
+                {
+                floodCache.update(sender, sfv);
+                if(bodySize > 2) { ++res.freshAuthenticated; }
+                }
+            }
+        r.removeRXMsg();
+        res.decodeNs += std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count();
+        };
+
+    // The captured frame, authenticated once before the flood; its body is too short to count as fresh.
+    uint8_t replay[OTRadioLink::SecurableFrameHeader::maxSmallFrameSize + 1];
+    makeID(0, id);
+    uint8_t iv[12];
+    memcpy(iv, id, 6);
+    makeCounter(1, iv + 6);
+    const uint8_t body[] = { 0x7f, 0x11 };
+    const uint8_t replayLen = OTRadioLink::SimpleSecureFrame32or0BodyTXBase::encodeSecureSmallFrameRaw(replay, sizeof(replay),
+                                    OTRadioLink::FTS_BasicSensorOrValve, id, OTRadioLink::ENC_BODY_DEFAULT_ID_BYTES,
+                                    body, sizeof(body), iv, OTRadioLink::fixed32BTextSize12BNonce16BTagSimpleEnc_NULL_IMPL, NULL, zeroKey);
+    EXPECT_NE(0, replayLen);
+    sim.sendOnAir(sim.now() + sim.settleUs, replay, replayLen);
+    EXPECT_TRUE(sim.advanceUntilIRQ(100000));
+    r.handleInterruptSimple();
+    EXPECT_EQ(1, r.getRXMsgsQueued());
+    decodeOne();
+    res.decodeAttempts = 0;
+    res.decodeNs = 0;
+
+    // Frames back to back, with time for the ISR between them.
+    const uint64_t period = sim.frameAirtimeUs(replayLen) + 4000;
+    const uint64_t start = sim.now() + 1000;
+    uint8_t frame[OTRadioLink::SecurableFrameHeader::maxSmallFrameSize + 1];
+    for(int i = 0; i < n; ++i)
+        {
+        if(0 != (i & 7)) { sim.sendOnAir(start + (i * period), replay, replayLen); continue; }
+        ++res.fresh;
+        makeID((i >> 3) % Cache::getMaxNodes(), id);
+        const uint8_t l = makeFrame(frame, id, (uint16_t)(2 + i), 0);
+        sim.sendOnAir(start + (i * period), frame, l);
+        }
+    uint8_t filtered = r.getRXMsgsFilteredRecent(), dropped = r.getRXMsgsDroppedRecent();
+    int irqs = 0;
+    while(sim.advanceUntilIRQ(2 * period))
+        {
+        const uint8_t before = r.getRXMsgsQueued();
+        const uint64_t c0 = sim.getStats().cycles;
+        const auto t0 = std::chrono::steady_clock::now();
+        r.handleInterruptSimple();
+        res.isrNs += std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count();
+        res.isrCycles += sim.getStats().cycles - c0;
+        const uint8_t q = r.getRXMsgsQueued();
+        res.queued += q - before;
+        res.filtered += (uint8_t)(r.getRXMsgsFilteredRecent() - filtered);
+        res.dropped += (uint8_t)(r.getRXMsgsDroppedRecent() - dropped);
+        filtered = r.getRXMsgsFilteredRecent();
+        dropped = r.getRXMsgsDroppedRecent();
+        res.queuedSum += q;
+        if(q > res.maxQueued) { res.maxQueued = q; }
+        if((0 == (++irqs % 3)) && (0 != q)) { decodeOne(); }
+        }
+    while(0 != r.getRXMsgsQueued()) { decodeOne(); }
+    EXPECT_EQ(n, irqs);
+    EXPECT_EQ(n, res.queued + res.filtered + res.dropped);
+    SPI0::sim = NULL;
+    return(res);
+    }
+
+// Benchmark a replay flood through the RFM23B ISR into the RX queue, with and without the filter,
+// showing queue occupancy, frames lost, and CPU per frame in the ISR and main-loop decode.
+// The ISR does more work per frame with the filter, since without it most frames find the queue full
+// and are discarded unread, but main-loop decode work is only spent on fresh frames, none of which are lost.
+TEST(SecureableFrameTypeRXCounterCache,floodBenchmark)
+{
+    // If true then be more verbose.
+    const static bool verbose = false;
+
+    const int n = 800;
+    const FloodResult before = flood(false, n);
+    const FloodResult after = flood(true, n);
+    // Without the filter the replays crowd fresh frames out of the queue.
+    EXPECT_LT(0, before.dropped);
+    EXPECT_GT(before.fresh, before.freshAuthenticated);
+    // With it all replays are dropped in the ISR, and nothing else.
+    EXPECT_EQ(n - after.fresh, after.filtered);
+    EXPECT_EQ(0, after.dropped);
+    EXPECT_EQ(after.fresh, after.freshAuthenticated);
+    EXPECT_EQ(after.fresh, after.decodeAttempts);
+    EXPECT_LT(after.queuedSum, before.queuedSum);
+    const FloodResult *const rs[] = { &before, &after };
+    for(const FloodResult *const p : rs)
+        {
+        if(verbose)
+            {
+            fprintf(stderr, "RX replay flood %d frames (%d fresh), %s: queue mean %.2f max %d, %d filtered, %d dropped, %d/%d fresh authenticated, %d decodes; ISR %llu target cycles/frame; host %.0fns/frame (ISR %.0fns + decode %.0fns)\n",
+                n, p->fresh, (p == &before) ? "no filter" : "counter filter",
+                p->queuedSum / n, p->maxQueued, p->filtered, p->dropped, p->freshAuthenticated, p->fresh, p->decodeAttempts,
+                (unsigned long long)(p->isrCycles / n), (p->isrNs + p->decodeNs) / n, p->isrNs / n, p->decodeNs / n);
+            }
+        }
+}
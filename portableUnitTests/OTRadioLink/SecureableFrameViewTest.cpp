@@ -0,0 +1,250 @@
+/*
+The OpenTRV project licenses this file to you
+under the Apache Licence, Version 2.0 (the "Licence");
+you may not use this file except in compliance
+with the Licence. You may obtain a copy of the Licence at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing,
+software distributed under the Licence is distributed on an
+"AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+KIND, either express or implied. See the Licence for the
+specific language governing permissions and limitations
+under the Licence.
+
+Author(s) / Copyright (s): Damon Hart-Davis 2016
+*/
+
+/*
+ * OTRadioLink in-place secure frame view tests, decoding from an RX queue.
+ */
+
+#include <gtest/gtest.h>
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include <vector>
+
+#include <OTRadioLink.h>
+#include "OTRadioLink_ISRRXQueue.h"
+#include "SecureFrameTestHelpers.h"
+
+
+namespace {
+
+// Queue a copy of the frame as an ISR would; returns false if the queue is full.
+bool enqueue(OTRadioLink::ISRRXQueue &q, const uint8_t *const buf, const uint8_t len)
+    {
+    volatile uint8_t *const p = q._getRXBufForInbound();
+    if(NULL == p) { return(false); }
+    for(uint8_t i = 0; i < len; ++i) { p[i] = buf[i]; }
+    q._loadedBuf(len);
+    return(true);
+    }
+
+}
+
+
+// Check that the view accepts and rejects exactly what SecurableFrameHeader does,
+// and agrees on all decoded fields, for valid frames and random/mutated bytes.
+TEST(SecureableFrameView,MatchesHeader)
+{
+    // Invalid by default and with bad args.
+    OTRadioLink::SecurableFrameView sfv;
+    EXPECT_TRUE(sfv.isInvalid());
+    EXPECT_EQ(0, sfv.checkAndDecodeSmallFrameHeader(NULL, 64));
+    EXPECT_EQ(0, sfv.checkAndDecodeRXMsg(NULL));
+    EXPECT_TRUE(sfv.isInvalid());
+
+    uint8_t id[OTV0P2BASE::OpenTRV_Node_ID_Bytes];
+    makeID(1, id);
+    uint8_t good[2][OTRadioLink::SecurableFrameHeader::maxSmallFrameSize + 1];
+    const uint8_t goodLen[2] =
+        {
+        makeFrame(good[0], id, 1, 42),
+        OTRadioLink::encodeNonsecureSmallFrame(good[1], sizeof(good[1]), OTRadioLink::FTS_ALIVE, 0, id, 2, NULL, 0)
+        };
+    ASSERT_NE(0, goodLen[0]);
+    ASSERT_NE(0, goodLen[1]);
+
+    uint8_t buf[OTRadioLink::SecurableFrameHeader::maxSmallFrameSize + 1];
+    for(int t = 0; t < 100000; ++t)
+        {
+        const uint8_t g = t & 1;
+        memcpy(buf, good[g], goodLen[g]);
+        uint8_t buflen = goodLen[g];
+        // Leave some frames intact, else mutate a byte or two and/or truncate.
+        if(0 != (t & 6))
+            {
+            buf[OTV0P2BASE::randRNG8() % buflen] ^= (1 << (OTV0P2BASE::randRNG8() & 7));
+            if(0 != (t & 8)) { buf[OTV0P2BASE::randRNG8() % 4] = OTV0P2BASE::randRNG8(); }
+            if(0 == (t & 48)) { buflen = OTV0P2BASE::randRNG8() % (buflen + 1); }
+            }
+        OTRadioLink::SecurableFrameHeader sfh;
+        const uint8_t hl = sfh.checkAndDecodeSmallFrameHeader(buf, buflen);
+        const uint8_t vhl = sfv.checkAndDecodeSmallFrameHeader(buf, buflen);
+        ASSERT_EQ(hl, vhl) << t;
+        ASSERT_EQ(sfh.isInvalid(), sfv.isInvalid());
+        if(0 == hl) { continue; }
+        ASSERT_EQ(sfh.fl, sfv.getFl());
+        ASSERT_EQ(sfh.fType, sfv.getFType());
+        ASSERT_EQ(sfh.isSecure(), sfv.isSecure());
+        ASSERT_EQ(sfh.getSeq(), sfv.getSeq());
+        ASSERT_EQ(sfh.getIl(), sfv.getIl());
+        ASSERT_EQ(sfh.bl, sfv.getBl());
+        ASSERT_EQ(sfh.getTl(), sfv.getTl());
+        ASSERT_EQ(sfh.getTrailerOffset(), sfv.getTrailerOffset());
+        // Pointers are into the original buffer.
+        ASSERT_EQ(buf, sfv.getFrame());
+        ASSERT_EQ(0, memcmp(sfh.id, sfv.getID(), sfh.getIl()));
+        ASSERT_EQ(buf + sfh.getBodyOffset(), sfv.getBody());
+        ASSERT_EQ(buf + sfh.getTrailerOffset(), sfv.getTrailer());
+        ASSERT_EQ(buflen > sfh.fl, sfv.isComplete());
+        }
+}
+
+// Decode secure frames straight from RX queue slots,
+// checking for the same results as decoding copies via SecurableFrameHeader.
+TEST(SecureableFrameView,DecodeFromQueue)
+{
+    RAMSecureRX rx, rxCopy;
+    uint8_t id0[OTV0P2BASE::OpenTRV_Node_ID_Bytes], id1[OTV0P2BASE::OpenTRV_Node_ID_Bytes], idX[OTV0P2BASE::OpenTRV_Node_ID_Bytes];
+    makeID(0, id0); rx.addNode(id0); rxCopy.addNode(id0);
+    makeID(1, id1); rx.addNode(id1); rxCopy.addNode(id1);
+    makeID(9, idX); // Not associated.
+
+    // Frames: good, good, replay of first, unknown ID, corrupted tag, truncated, good.
+    std::vector<std::vector<uint8_t> > frames;
+    const bool expectedOK[] = { true, true, false, false, false, false, true };
+    uint8_t buf[OTRadioLink::SecurableFrameHeader::maxSmallFrameSize + 1];
+    uint8_t l;
+    l = makeFrame(buf, id0, 1, 10); frames.push_back(std::vector<uint8_t>(buf, buf + l));
+    l = makeFrame(buf, id1, 1, 11); frames.push_back(std::vector<uint8_t>(buf, buf + l));
+    frames.push_back(frames[0]);
+    l = makeFrame(buf, idX, 1, 12); frames.push_back(std::vector<uint8_t>(buf, buf + l));
+    l = makeFrame(buf, id0, 2, 13); buf[l - 17] ^= 1; frames.push_back(std::vector<uint8_t>(buf, buf + l));
+    l = makeFrame(buf, id0, 3, 14); frames.push_back(std::vector<uint8_t>(buf, buf + l - 1));
+    l = makeFrame(buf, id1, 2, 15); frames.push_back(std::vector<uint8_t>(buf, buf + l));
+    ASSERT_EQ(sizeof(expectedOK), frames.size());
+
+    OTRadioLink::ISRRXQueueVarLenMsg<OTRadioLink::SecurableFrameHeader::maxSmallFrameSize + 1, 2> q;
+    size_t next = 0;
+    for(size_t i = 0; i < frames.size(); ++i)
+        {
+        // Keep the queue topped up.
+        while((next < frames.size()) && enqueue(q, &frames[next][0], (uint8_t)frames[next].size())) { ++next; }
+
+        const volatile uint8_t *const msg = q.peekRXMsg();
+        ASSERT_TRUE(NULL != msg);
+        ASSERT_EQ(frames[i].size(), msg[-1]);
+        uint8_t body[OTRadioLink::ENC_BODY_SMALL_FIXED_PTEXT_MAX_SIZE];
+        uint8_t bodySize = 0;
+        uint8_t ID[OTV0P2BASE::OpenTRV_Node_ID_Bytes];
+        OTRadioLink::SecurableFrameView sfv;
+        const uint8_t result = (0 == sfv.checkAndDecodeRXMsg(msg)) ? 0 :
+            rx.decodeSecureSmallFrameSafely(&sfv,
+                                    OTRadioLink::fixed32BTextSize12BNonce16BTagSimpleDec_NULL_IMPL,
+                                    NULL, zeroKey,
+                                    body, sizeof(body), bodySize,
+                                    ID);
+        // Decoding worked in place.
+        if(0 != result) { EXPECT_EQ((const uint8_t *)msg, sfv.getFrame()); }
+        q.removeRXMsg();
+
+        // Same outcome via the copying path.
+        OTRadioLink::SecurableFrameHeader sfh;
+        uint8_t bodyCopy[OTRadioLink::ENC_BODY_SMALL_FIXED_PTEXT_MAX_SIZE];
+        uint8_t bodyCopySize = 0;
+        uint8_t IDCopy[OTV0P2BASE::OpenTRV_Node_ID_Bytes];
+        const uint8_t len = (uint8_t)frames[i].size();
+        const uint8_t resultCopy = (0 == sfh.checkAndDecodeSmallFrameHeader(&frames[i][0], len)) ? 0 :
+            rxCopy.decodeSecureSmallFrameSafely(&sfh, &frames[i][0], len,
+                                    OTRadioLink::fixed32BTextSize12BNonce16BTagSimpleDec_NULL_IMPL,
+                                    NULL, zeroKey,
+                                    bodyCopy, sizeof(bodyCopy), bodyCopySize,
+                                    IDCopy);
+
+        EXPECT_EQ(expectedOK[i], 0 != result) << i;
+        EXPECT_EQ(resultCopy, result) << i;
+        if(0 == result) { continue; }
+        EXPECT_EQ(len, result);
+        ASSERT_EQ(3, bodySize);
+        EXPECT_EQ(bodyCopySize, bodySize);
+        EXPECT_EQ(0, memcmp(bodyCopy, body, bodySize));
+        EXPECT_EQ(0, memcmp(IDCopy, ID, sizeof(ID)));
+        }
+    EXPECT_TRUE(q.isEmpty());
+    EXPECT_EQ(0, memcmp(&rx.counters[0][0], &rxCopy.counters[0][0], rx.counters[0].size()));
+    EXPECT_EQ(0, memcmp(&rx.counters[1][0], &rxCopy.counters[1][0], rx.counters[1].size()));
+    // Raw decode of a view with the wrong IV fails.
+    OTRadioLink::SecurableFrameView sfv;
+    ASSERT_NE(0, sfv.checkAndDecodeSmallFrameHeader(&frames[0][0], (uint8_t)frames[0].size()));
+    uint8_t iv[12] = { };
+    uint8_t bodySize;
+    EXPECT_EQ(0, OTRadioLink::SimpleSecureFrame32or0BodyRXBase::decodeSecureSmallFrameRaw(&sfv,
+                                    OTRadioLink::fixed32BTextSize12BNonce16BTagSimpleDec_NULL_IMPL,
+                                    NULL, zeroKey, iv,
+                                    NULL, 0, bodySize));
+}
+
+// Report the cost per frame of copying each queued frame out before decoding
+// against decoding it in place in the queue, with the NULL crypto implementation.
+TEST(SecureableFrameView,Benchmark)
+{
+    // If true then be more verbose.
+    const static bool verbose = false;
+
+    typedef std::chrono::steady_clock clock;
+    const int n = 20000;
+    uint8_t id[OTV0P2BASE::OpenTRV_Node_ID_Bytes];
+    makeID(3, id);
+    RAMSecureRX rxs[2];
+    rxs[0].addNode(id);
+    rxs[1].addNode(id);
+    OTRadioLink::ISRRXQueueVarLenMsg<OTRadioLink::SecurableFrameHeader::maxSmallFrameSize + 1, 2> q;
+    double ns[2];
+    int ok[2] = { 0, 0 };
+    for(int inPlace = 0; inPlace < 2; ++inPlace)
+        {
+        RAMSecureRX &rx = rxs[inPlace];
+        clock::duration elapsed = clock::duration::zero();
+        for(int i = 0; i < n; ++i)
+            {
+            uint8_t buf[OTRadioLink::SecurableFrameHeader::maxSmallFrameSize + 1];
+            const uint8_t l = makeFrame(buf, id, (uint16_t)(1 + i), 0);
+            ASSERT_TRUE(enqueue(q, buf, l));
+            const clock::time_point t0 = clock::now();
+            const volatile uint8_t *const msg = q.peekRXMsg();
+            uint8_t body[OTRadioLink::ENC_BODY_SMALL_FIXED_PTEXT_MAX_SIZE];
+            uint8_t bodySize;
+            uint8_t result;
+            if(inPlace)
+                {
+                OTRadioLink::SecurableFrameView sfv;
+                result = (0 == sfv.checkAndDecodeRXMsg(msg)) ? 0 :
+                    rx.decodeSecureSmallFrameSafely(&sfv,
+                        OTRadioLink::fixed32BTextSize12BNonce16BTagSimpleDec_NULL_IMPL, NULL, zeroKey,
+                        body, sizeof(body), bodySize, NULL);
+                }
+            else
+                {
+                uint8_t copy[OTRadioLink::SecurableFrameHeader::maxSmallFrameSize + 1];
+                const uint8_t len = msg[-1];
+                for(uint8_t j = 0; j < len; ++j) { copy[j] = msg[j]; }
+                OTRadioLink::SecurableFrameHeader sfh;
+                result = (0 == sfh.checkAndDecodeSmallFrameHeader(copy, len)) ? 0 :
+                    rx.decodeSecureSmallFrameSafely(&sfh, copy, len,
+                        OTRadioLink::fixed32BTextSize12BNonce16BTagSimpleDec_NULL_IMPL, NULL, zeroKey,
+                        body, sizeof(body), bodySize, NULL);
+                }
+            q.removeRXMsg();
+            elapsed += clock::now() - t0;
+            if(0 != result) { ++ok[inPlace]; }
+            }
+        ns[inPlace] = std::chrono::duration<double, std::nano>(elapsed).count() / n;
+        }
+    EXPECT_EQ(n, ok[0]);
+    EXPECT_EQ(n, ok[1]);
+    if(verbose) { fprintf(stderr, "Secure frame RX from queue: copy+header %.1fns/frame, in-place view %.1fns/frame\n", ns[0], ns[1]); }
+}
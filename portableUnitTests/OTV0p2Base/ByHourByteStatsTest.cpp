@@ -21,8 +21,11 @@ Author(s) / Copyright (s): Damon Hart-Davis 2016
  */
 
 #include <stdint.h>
+#include <stdio.h>
+#include <chrono>
 #include <gtest/gtest.h>
 #include <OTV0p2Base.h>
+#include <OTRadValve.h>
 
 // Test handling of ByHourByteStats stats.
 //
@@ -39,3 +42,113 @@ TEST(ByHourByteStats,SmoothStatsValue)
         { EXPECT_EQ(i, OTV0P2BASE::NVByHourByteStatsBase::smoothStatsValue((uint8_t)i, (uint8_t)i)); }
 
 }
+
+// Check that the caching decorator gives exactly the same answers as the scanning implementation,
+// through random writes (including unsetting values) and hour changes.
+template<uint8_t cachedSets>
+static void checkCacheMatchesScanning()
+{
+    OTV0P2BASE::NVByHourByteStatsMock ms;
+    OTV0P2BASE::NVByHourByteStatsCache<cachedSets> cs(ms);
+    const uint8_t hours[] = { 0, 5, 23, 24, 0xfe, 0xff };
+    for(int i = 0; i < 2000; ++i)
+        {
+        // Write mainly to a few sets to get full sets, with a narrow range of values to get ties.
+        const uint8_t set = OTV0P2BASE::randRNG8() % ((i & 1) ? 3 : V0P2BASE_EE_STATS_SETS);
+        const uint8_t hour = OTV0P2BASE::randRNG8() % 24;
+        const uint8_t r = OTV0P2BASE::randRNG8();
+        const uint8_t value = (r < 8) ? OTV0P2BASE::STATS_UNSET_BYTE : (uint8_t)(r % 40);
+        ms.setByHourStat(set, hour, value);
+        cs.noteByHourStatWritten(set, hour, value);
+        if(0 == (i % 97)) { ms.setHour(OTV0P2BASE::randRNG8()); }
+        if(0 == (i % 499)) { cs.invalidate(); }
+        for(uint8_t s = 0; s <= V0P2BASE_EE_STATS_SETS; ++s)
+            {
+            SCOPED_TRACE(s);
+            ASSERT_EQ(ms.getMinByHourStat(s), cs.getMinByHourStat(s));
+            ASSERT_EQ(ms.getMaxByHourStat(s), cs.getMaxByHourStat(s));
+            for(uint8_t h : hours)
+                {
+                ASSERT_EQ(ms.getByHourStat(s, h), cs.getByHourStat(s, h)) << (int)h;
+                ASSERT_EQ(ms.inOutlierQuartile(false, s, h), cs.inOutlierQuartile(false, s, h)) << (int)h;
+                ASSERT_EQ(ms.inOutlierQuartile(true, s, h), cs.inOutlierQuartile(true, s, h)) << (int)h;
+                }
+            for(int v = 0; v <= 42; v += 3)
+                { ASSERT_EQ(ms.countStatSamplesBelow(s, (uint8_t)v), cs.countStatSamplesBelow(s, (uint8_t)v)) << v; }
+            ASSERT_EQ(ms.countStatSamplesBelow(s, 0xff), cs.countStatSamplesBelow(s, 0xff));
+            }
+        }
+    // Quartiles were exercised on full sets.
+    for(uint8_t h = 0; h < 24; ++h) { ms.setByHourStat(0, h, h); cs.noteByHourStatWritten(0, h, h); }
+    EXPECT_TRUE(cs.inOutlierQuartile(false, 0, 2));
+    EXPECT_FALSE(cs.inOutlierQuartile(false, 0, 12));
+    EXPECT_TRUE(cs.inOutlierQuartile(true, 0, 21));
+    EXPECT_EQ(12, cs.countStatSamplesBelow(0, 12));
+    EXPECT_TRUE(cs.zapStats());
+    EXPECT_EQ(OTV0P2BASE::STATS_UNSET_BYTE, cs.getMaxByHourStat(0));
+}
+TEST(ByHourByteStats,CacheMatchesScanning)
+{
+    checkCacheMatchesScanning<V0P2BASE_EE_STATS_SETS>();
+    checkCacheMatchesScanning<V0P2BASE_EE_STATS_SET_OCCPC_BY_HOUR_SMOOTHED+1>();
+    checkCacheMatchesScanning<1>();
+}
+
+// Instances with linkage for ModelledRadValveComputeTargetTempBasic.
+namespace BHBSB
+    {
+    static OTRadValve::ValveMode valveMode;
+    static OTV0P2BASE::TemperatureC16Mock roomTemp;
+    static OTRadValve::TempControlSimpleVCP<OTRadValve::DEFAULT_ValveControlParameters> tempControl;
+    static OTV0P2BASE::PseudoSensorOccupancyTracker occupancy;
+    static OTV0P2BASE::SensorAmbientLightMock ambLight;
+    static OTRadValve::NULLActuatorPhysicalUI physicalUI;
+    static OTV0P2BASE::NULLValveSchedule schedule;
+    static OTV0P2BASE::NVByHourByteStatsMock scanning;
+    static OTV0P2BASE::NVByHourByteStatsCache<V0P2BASE_EE_STATS_SET_OCCPC_BY_HOUR_SMOOTHED+1> cached(scanning);
+    template<class S, const S *const stats>
+    using cttb = OTRadValve::ModelledRadValveComputeTargetTempBasic<
+        OTRadValve::DEFAULT_ValveControlParameters,
+        &valveMode,
+        decltype(roomTemp),     &roomTemp,
+        decltype(tempControl),  &tempControl,
+        decltype(occupancy),    &occupancy,
+        decltype(ambLight),     &ambLight,
+        decltype(physicalUI),   &physicalUI,
+        decltype(schedule),     &schedule,
+        S,                      stats>;
+    }
+// Crude benchmark of target-temperature evaluations per second with scanning and cached stats.
+TEST(ByHourByteStats,CacheBenchmark)
+{
+    // If true then be more verbose.
+    const static bool verbose = false;
+
+    typedef std::chrono::steady_clock clock;
+    for(uint8_t h = 0; h < 24; ++h)
+        {
+        const uint8_t o = (uint8_t)(((h >= 7) && (h < 23)) ? (10 + 4*h) : 0);
+        BHBSB::scanning.setByHourStat(V0P2BASE_EE_STATS_SET_OCCPC_BY_HOUR, h, o);
+        BHBSB::scanning.setByHourStat(V0P2BASE_EE_STATS_SET_OCCPC_BY_HOUR_SMOOTHED, h, o);
+        }
+    BHBSB::cached.invalidate();
+    BHBSB::valveMode.setWarmModeDebounced(true);
+    BHBSB::ambLight.set(0, 30U, false);
+    BHBSB::ambLight.read();
+    const BHBSB::cttb<OTV0P2BASE::NVByHourByteStatsMock, &BHBSB::scanning> ctScanning;
+    const BHBSB::cttb<decltype(BHBSB::cached), &BHBSB::cached> ctCached;
+    const int n = 1000000;
+    uint32_t sumScanning = 0, sumCached = 0;
+    const clock::time_point t0 = clock::now();
+    for(int i = 0; i < n; ++i) { BHBSB::scanning.setHour((uint8_t)(i / 64)); sumScanning += ctScanning.computeTargetTemp(); }
+    const clock::time_point t1 = clock::now();
+    for(int i = 0; i < n; ++i) { BHBSB::scanning.setHour((uint8_t)(i / 64)); sumCached += ctCached.computeTargetTemp(); }
+    const clock::time_point t2 = clock::now();
+    EXPECT_EQ(sumScanning, sumCached);
+    if(verbose)
+        {
+        fprintf(stderr, "ByHourByteStats: computeTargetTemp scanning %.3g/s, cached %.3g/s\n",
+            n / std::chrono::duration<double>(t1 - t0).count(),
+            n / std::chrono::duration<double>(t2 - t1).count());
+        }
+}
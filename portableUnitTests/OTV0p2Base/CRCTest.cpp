@@ -0,0 +1,111 @@
+/*
+The OpenTRV project licenses this file to you
+under the Apache Licence, Version 2.0 (the "Licence");
+you may not use this file except in compliance
+with the Licence. You may obtain a copy of the Licence at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing,
+software distributed under the Licence is distributed on an
+"AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+KIND, either express or implied. See the Licence for the
+specific language governing permissions and limitations
+under the Licence.
+
+Author(s) / Copyright (s): Damon Hart-Davis 2016
+*/
+
+/*
+ * Driver for OTV0p2Base CRC tests.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <chrono>
+#include <vector>
+#include <gtest/gtest.h>
+#include <OTV0p2Base.h>
+
+
+// Check crc7_5B_update() against the bitwise reference for every CRC and data byte value,
+// including initial CRC values with the top bit set (eg crc7_5B_update_nz_ALT).
+TEST(CRC,CRC7_5BExhaustive)
+{
+    for(int crc = 0; crc < 256; ++crc)
+        {
+        for(int datum = 0; datum < 256; ++datum)
+            {
+            const uint8_t expected = OTV0P2BASE::crc7_5B_update_bitwise((uint8_t)crc, (uint8_t)datum);
+            ASSERT_EQ(0, expected & 0x80);
+            ASSERT_EQ(expected, OTV0P2BASE::crc7_5B_update((uint8_t)crc, (uint8_t)datum)) << crc << " " << datum;
+            }
+        }
+    // Some known values.
+    EXPECT_EQ(0, OTV0P2BASE::crc7_5B_update(0, 0));
+    EXPECT_EQ(0x37, OTV0P2BASE::crc7_5B_update(0, 1));
+    EXPECT_EQ(OTV0P2BASE::crc7_5B_update_nz_ALT, OTV0P2BASE::crc7_5B_update_nz_final(0, 0));
+}
+
+// Check crc7_5B_update_buf() against the bytewise reference
+// for all lengths and alignments around the slice size, and every initial CRC.
+TEST(CRC,CRC7_5BBuf)
+{
+    uint8_t buf[80];
+    for(size_t i = 0; i < sizeof(buf); ++i) { buf[i] = OTV0P2BASE::randRNG8(); }
+    EXPECT_EQ(0x5a, OTV0P2BASE::crc7_5B_update_buf(0x5a, NULL, 0));
+    for(int crc = 0; crc < 256; ++crc)
+        {
+        for(size_t offset = 0; offset < 8; ++offset)
+            {
+            uint8_t expected = (uint8_t)crc;
+            for(size_t len = 0; len + offset <= sizeof(buf); ++len)
+                {
+                // expected is the CRC for len bytes at this point.
+                ASSERT_EQ(expected & 0x7f, OTV0P2BASE::crc7_5B_update_buf((uint8_t)crc, buf + offset, len)) << crc << " " << offset << " " << len;
+                if(len + offset < sizeof(buf)) { expected = OTV0P2BASE::crc7_5B_update_bitwise(expected, buf[offset + len]); }
+                }
+            }
+        }
+}
+
+// Report throughput of the CRC7/0x5B implementations
+// over a short frame-sized buffer and a long buffer.
+TEST(CRC,CRC7_5BBenchmark)
+{
+    // If true then be more verbose.
+    const static bool verbose = false;
+
+    typedef std::chrono::steady_clock clock;
+    const size_t sizes[] = { 16, 4096 };
+    for(size_t s = 0; s < sizeof(sizes)/sizeof(sizes[0]); ++s)
+        {
+        const size_t len = sizes[s];
+        std::vector<uint8_t> buf(len);
+        for(size_t i = 0; i < len; ++i) { buf[i] = OTV0P2BASE::randRNG8(); }
+        const size_t totalBytes = 1 << 19;
+        const size_t reps = totalBytes / len;
+        uint8_t c0 = 0x7f, c1 = 0x7f, c2 = 0x7f;
+        const clock::time_point t0 = clock::now();
+        for(size_t r = 0; r < reps; ++r)
+            { for(size_t i = 0; i < len; ++i) { c0 = OTV0P2BASE::crc7_5B_update_bitwise(c0, buf[i]); } }
+        const clock::time_point t1 = clock::now();
+        for(size_t r = 0; r < reps; ++r)
+            { for(size_t i = 0; i < len; ++i) { c1 = OTV0P2BASE::crc7_5B_update(c1, buf[i]); } }
+        const clock::time_point t2 = clock::now();
+        for(size_t r = 0; r < reps; ++r)
+            { c2 = OTV0P2BASE::crc7_5B_update_buf(c2, &buf[0], len); }
+        const clock::time_point t3 = clock::now();
+        EXPECT_EQ(c0, c1);
+        EXPECT_EQ(c0, c2);
+        const double MB = (reps * len) / 1e6;
+        if(verbose)
+            {
+            fprintf(stderr, "CRC7/0x5B %4u-byte buffers: bitwise %.1fMB/s, update %.1fMB/s, update_buf %.1fMB/s\n",
+                (unsigned)len,
+                MB / std::chrono::duration<double>(t1 - t0).count(),
+                MB / std::chrono::duration<double>(t2 - t1).count(),
+                MB / std::chrono::duration<double>(t3 - t2).count());
+            }
+        }
+}
@@ -0,0 +1,181 @@
+/*
+The OpenTRV project licenses this file to you
+under the Apache Licence, Version 2.0 (the "Licence");
+you may not use this file except in compliance
+with the Licence. You may obtain a copy of the Licence at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing,
+software distributed under the Licence is distributed on an
+"AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+KIND, either express or implied. See the Licence for the
+specific language governing permissions and limitations
+under the Licence.
+
+Author(s) / Copyright (s): Damon Hart-Davis 2016
+*/
+
+/*
+ * Driver for OTV0P2BASE_EEPROMFile tests.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <gtest/gtest.h>
+#include <OTV0p2Base.h>
+#include "OTV0P2BASE_EEPROMFile.h"
+
+#ifdef OTV0P2BASE_PLATFORM_HAS_mmap
+
+// Temporary file name, removed on destruction.
+class TempPath final
+    {
+    public:
+        char path[32];
+        TempPath()
+            {
+            strcpy(path, "/tmp/EEPROMFileTestXXXXXX");
+            const int fd = mkstemp(path);
+            if(fd >= 0) { ::close(fd); unlink(path); }
+            }
+        ~TempPath() { unlink(path); }
+    };
+
+// Test erase/write rules, wear counts and persistence.
+TEST(EEPROMFile,SmartUpdates)
+{
+    TempPath tp;
+    {
+        OTV0P2BASE::EEPROMFile f(tp.path);
+        ASSERT_TRUE(f.isOpen());
+        EXPECT_EQ(OTV0P2BASE::EEPROMFile::DEFAULT_SIZE, f.getSize());
+        // A new file is all erased.
+        for(size_t a = 0; a < f.getSize(); ++a) { ASSERT_EQ(0xff, f.readByte(a)); }
+        EXPECT_EQ(0xff, f.readByte(f.getSize()));
+        // No-op updates do nothing.
+        EXPECT_FALSE(f.smartUpdateByte(10, 0xff));
+        EXPECT_FALSE(f.smartEraseByte(10));
+        EXPECT_FALSE(f.smartClearBits(10, 0xff));
+        EXPECT_EQ(0U, f.getEraseCount(10));
+        EXPECT_EQ(0U, f.getWriteCount(10));
+        // Clearing bits only needs a write.
+        EXPECT_TRUE(f.smartUpdateByte(10, 0xf0));
+        EXPECT_EQ(0xf0, f.readByte(10));
+        EXPECT_EQ(0U, f.getEraseCount(10));
+        EXPECT_EQ(1U, f.getWriteCount(10));
+        EXPECT_TRUE(f.smartClearBits(10, 0x3f));
+        EXPECT_EQ(0x30, f.readByte(10));
+        EXPECT_EQ(2U, f.getWriteCount(10));
+        // Setting any bit needs an erase and a write.
+        EXPECT_TRUE(f.smartUpdateByte(10, 0x41));
+        EXPECT_EQ(0x41, f.readByte(10));
+        EXPECT_EQ(1U, f.getEraseCount(10));
+        EXPECT_EQ(3U, f.getWriteCount(10));
+        // Setting all bits needs only an erase.
+        EXPECT_TRUE(f.smartUpdateByte(10, 0xff));
+        EXPECT_EQ(2U, f.getEraseCount(10));
+        EXPECT_EQ(3U, f.getWriteCount(10));
+        EXPECT_TRUE(f.smartUpdateByte(V0P2BASE_EE_START_FHT8V_HC1, 13));
+        // Out of range is ignored.
+        EXPECT_FALSE(f.smartUpdateByte(f.getSize(), 0));
+        EXPECT_EQ(0U, f.getWriteCount(f.getSize()));
+    }
+    // Contents persist but wear counts do not.
+    OTV0P2BASE::EEPROMFile f(tp.path);
+    ASSERT_TRUE(f.isOpen());
+    EXPECT_EQ(0xff, f.readByte(10));
+    EXPECT_EQ(13, f.readByte(V0P2BASE_EE_START_FHT8V_HC1));
+    EXPECT_EQ(0U, f.getWriteCount(V0P2BASE_EE_START_FHT8V_HC1));
+    // Syncing only on request still persists on close.
+    f.setSyncInterval(0);
+    EXPECT_TRUE(f.smartUpdateByte(V0P2BASE_EE_START_FHT8V_HC2, 73));
+    f.close();
+    EXPECT_FALSE(f.isOpen());
+    const OTV0P2BASE::MappedFile m(tp.path);
+    ASSERT_EQ(OTV0P2BASE::EEPROMFile::DEFAULT_SIZE, m.getSize());
+    EXPECT_EQ(73, m.getData()[V0P2BASE_EE_START_FHT8V_HC2]);
+}
+
+// Test that the hosted EEPROM routines act on the default instance with the device layout.
+TEST(EEPROMFile,Default)
+{
+    TempPath tp;
+    uint8_t *const txe = (uint8_t *)V0P2BASE_EE_START_STATS_TX_ENABLE;
+    // Without a default EEPROM all reads are erased and updates are ignored.
+    ASSERT_TRUE(NULL == OTV0P2BASE::EEPROMFile::getDefault());
+    EXPECT_EQ(0xff, OTV0P2BASE::eeprom_read_byte(txe));
+    EXPECT_FALSE(OTV0P2BASE::eeprom_smart_update_byte(txe, 0));
+    EXPECT_EQ(OTV0P2BASE::stTXnever, OTV0P2BASE::getStatsTXLevel());
+    {
+        OTV0P2BASE::EEPROMFile f(tp.path);
+        ASSERT_TRUE(f.isOpen());
+        OTV0P2BASE::EEPROMFile::setDefault(&f);
+        EXPECT_TRUE(OTV0P2BASE::eeprom_smart_update_byte(txe, OTV0P2BASE::stTXmostUnsec));
+        EXPECT_EQ(OTV0P2BASE::stTXmostUnsec, OTV0P2BASE::getStatsTXLevel());
+        EXPECT_TRUE(OTV0P2BASE::eeprom_smart_clear_bits(txe, 0));
+        EXPECT_EQ(OTV0P2BASE::stTXalwaysAll, OTV0P2BASE::getStatsTXLevel());
+        EXPECT_EQ(0U, f.getEraseCount(V0P2BASE_EE_START_STATS_TX_ENABLE));
+        EXPECT_EQ(2U, f.getWriteCount(V0P2BASE_EE_START_STATS_TX_ENABLE));
+        EXPECT_TRUE(OTV0P2BASE::eeprom_smart_erase_byte(txe));
+        EXPECT_EQ(0xff, f.readByte(V0P2BASE_EE_START_STATS_TX_ENABLE));
+        // Reopening keeps the default selection, now acting on the reopened file.
+        EXPECT_TRUE(OTV0P2BASE::eeprom_smart_update_byte(txe, OTV0P2BASE::stTXmostUnsec));
+        ASSERT_TRUE(f.open(tp.path));
+        EXPECT_TRUE(&f == OTV0P2BASE::EEPROMFile::getDefault());
+        EXPECT_EQ(OTV0P2BASE::stTXmostUnsec, OTV0P2BASE::getStatsTXLevel());
+        EXPECT_TRUE(OTV0P2BASE::eeprom_smart_erase_byte(txe));
+        EXPECT_EQ(0xff, f.readByte(V0P2BASE_EE_START_STATS_TX_ENABLE));
+    }
+    // Closing deselects the default.
+    EXPECT_TRUE(NULL == OTV0P2BASE::EEPROMFile::getDefault());
+}
+
+// Test by-hour stats in the file against the RAM mock, also with the caching decorator.
+TEST(EEPROMFile,ByHourByteStats)
+{
+    TempPath tp;
+    OTV0P2BASE::EEPROMFile f(tp.path);
+    ASSERT_TRUE(f.isOpen());
+    OTV0P2BASE::EEPROMFileByHourByteStats fs(f);
+    OTV0P2BASE::NVByHourByteStatsMock ms;
+    OTV0P2BASE::NVByHourByteStatsCache<> cs(fs);
+    for(int i = 0; i < 1000; ++i)
+        {
+        const uint8_t set = OTV0P2BASE::randRNG8() % 3;
+        const uint8_t hour = OTV0P2BASE::randRNG8() % 24;
+        const uint8_t value = OTV0P2BASE::randRNG8() % 50;
+        fs.setByHourStat(set, hour, value);
+        cs.noteByHourStatWritten(set, hour, value);
+        ms.setByHourStat(set, hour, value);
+        ASSERT_EQ(value, f.readByte(V0P2BASE_EE_STATS_START_ADDR(set) + hour));
+        }
+    for(uint8_t s = 0; s <= V0P2BASE_EE_STATS_SETS; ++s)
+        {
+        EXPECT_EQ(ms.getMinByHourStat(s), fs.getMinByHourStat(s));
+        EXPECT_EQ(ms.getMaxByHourStat(s), cs.getMaxByHourStat(s));
+        for(uint8_t h = 0; h < 24; ++h)
+            {
+            EXPECT_EQ(ms.getByHourStat(s, h), fs.getByHourStat(s, h));
+            EXPECT_EQ(ms.inOutlierQuartile(true, s, h), fs.inOutlierQuartile(true, s, h));
+            EXPECT_EQ(ms.inOutlierQuartile(false, s, h), cs.inOutlierQuartile(false, s, h));
+            EXPECT_EQ(ms.countStatSamplesBelow(s, h), fs.countStatSamplesBelow(s, h));
+            }
+        }
+    // Zapping is limited to the number of erases allowed, and eventually completes.
+    EXPECT_FALSE(cs.zapStats(10));
+    while(!cs.zapStats(10)) { }
+    for(uint8_t s = 0; s < V0P2BASE_EE_STATS_SETS; ++s) { EXPECT_EQ(0xff, cs.getMaxByHourStat(s)); }
+    EXPECT_EQ(0, cs.countStatSamplesBelow(0, 0xff));
+    // Too small a file gives no stats.
+    TempPath tp2;
+    OTV0P2BASE::EEPROMFile small(tp2.path, 16);
+    ASSERT_TRUE(small.isOpen());
+    OTV0P2BASE::EEPROMFileByHourByteStats ss(small);
+    EXPECT_FALSE(ss.setByHourStat(0, 0, 1));
+    EXPECT_EQ(0xff, ss.getByHourStat(0, 0));
+}
+
+#endif // OTV0P2BASE_PLATFORM_HAS_mmap
@@ -21,6 +21,11 @@ Author(s) / Copyright (s): Damon Hart-Davis 2016
  */
 
 #include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include <map>
+#include <string>
 #include <gtest/gtest.h>
 #include <OTV0p2Base.h>
 
@@ -72,6 +77,406 @@ TEST(JSONStats,JSONStats)
     EXPECT_TRUE(OTV0P2BASE::quickValidateRawSimpleJSONMessage(buf));
 }
 
+// Test interned stat handles.
+TEST(JSONStats,Handles)
+{
+    OTV0P2BASE::SimpleStatsRotation<3> ss1;
+    ss1.setID("1234");
+    char buf[OTV0P2BASE::MSG_JSON_MAX_LENGTH + 2];
+    EXPECT_EQ(OTV0P2BASE::SIMPLE_STATS_HANDLE_NONE, ss1.intern(NULL));
+    EXPECT_EQ(OTV0P2BASE::SIMPLE_STATS_HANDLE_NONE, ss1.intern("bad\"\\"));
+    EXPECT_FALSE(ss1.put((OTV0P2BASE::SimpleStatsHandle)0, 1));
+    EXPECT_FALSE(ss1.put(OTV0P2BASE::SIMPLE_STATS_HANDLE_NONE, 1));
+    const OTV0P2BASE::SimpleStatsHandle h1 = ss1.intern("f1");
+    ASSERT_NE(OTV0P2BASE::SIMPLE_STATS_HANDLE_NONE, h1);
+    EXPECT_EQ(1, ss1.size());
+    // Interning creates the stat without marking it as changed.
+    EXPECT_EQ(19, ss1.writeJSON((uint8_t*)buf, sizeof(buf), 0, false));
+    EXPECT_STREQ(buf, "{\"@\":\"1234\",\"f1\":0}");
+    // Interning again, or via a different pointer to the same text, gives the same handle.
+    const char f1copy[] = "f1";
+    EXPECT_EQ(h1, ss1.intern("f1"));
+    EXPECT_EQ(h1, ss1.intern(f1copy));
+    EXPECT_TRUE(ss1.put(h1, 42));
+    EXPECT_EQ(20, ss1.writeJSON((uint8_t*)buf, sizeof(buf), 0, false));
+    EXPECT_STREQ(buf, "{\"@\":\"1234\",\"f1\":42}");
+    // Updates by key and by handle are to the same stat.
+    EXPECT_TRUE(ss1.put("f1", -7));
+    EXPECT_EQ(20, ss1.writeJSON((uint8_t*)buf, sizeof(buf), 0, false));
+    EXPECT_STREQ(buf, "{\"@\":\"1234\",\"f1\":-7}");
+    // Fill up, checking handles stay distinct and valid across removal.
+    EXPECT_TRUE(ss1.put("f2", 2));
+    const OTV0P2BASE::SimpleStatsHandle h2 = ss1.intern("f2");
+    const OTV0P2BASE::SimpleStatsHandle h3 = ss1.intern("f3", true);
+    ASSERT_NE(OTV0P2BASE::SIMPLE_STATS_HANDLE_NONE, h3);
+    EXPECT_NE(h1, h2);
+    EXPECT_NE(h1, h3);
+    EXPECT_NE(h2, h3);
+    EXPECT_EQ(OTV0P2BASE::SIMPLE_STATS_HANDLE_NONE, ss1.intern("f4"));
+    EXPECT_TRUE(ss1.remove("f1"));
+    EXPECT_FALSE(ss1.put(h1, 1));
+    // f3 has been moved into f1's slot but its handle must still work.
+    EXPECT_TRUE(ss1.put(h3, 333));
+    EXPECT_TRUE(ss1.put(h2, 222));
+    ss1.setID("");
+    EXPECT_EQ(19, ss1.writeJSON((uint8_t*)buf, sizeof(buf), 0, true));
+    EXPECT_TRUE(NULL != strstr(buf, "\"f3\":333")) << buf;
+    EXPECT_TRUE(NULL != strstr(buf, "\"f2\":222")) << buf;
+    // The freed handle is reused.
+    EXPECT_EQ(h1, ss1.intern("f4"));
+    EXPECT_TRUE(ss1.put(h1, 4));
+    EXPECT_TRUE(ss1.put(h3, 3));
+    EXPECT_TRUE(ss1.put(h2, 2));
+    EXPECT_EQ(22, ss1.writeJSON((uint8_t*)buf, sizeof(buf), 0, true));
+    EXPECT_TRUE(NULL != strstr(buf, "\"f2\":2")) << buf;
+    EXPECT_TRUE(NULL != strstr(buf, "\"f3\":3")) << buf;
+    EXPECT_TRUE(NULL != strstr(buf, "\"f4\":4")) << buf;
+}
+
+// Check that output is unaffected by the mix of updates by key and by handle,
+// and that stats too long to cache still render correctly.
+TEST(JSONStats,HandlesMatchKeys)
+{
+    static const char * const keys[] =
+        { "a", "B|cV", "T|C16", "H|%", "vac|h", "L", "O", "v|%", "tT|C", "b", "gE", "x" };
+    const uint8_t nKeys = sizeof(keys) / sizeof(keys[0]);
+    OTV0P2BASE::SimpleStatsRotation<nKeys> byKey, byHandle;
+    byKey.setID("ab12");
+    byHandle.setID("ab12");
+    OTV0P2BASE::SimpleStatsHandle h[nKeys];
+    for(uint8_t k = 0; k < nKeys; ++k) { h[k] = byHandle.intern(keys[k]); ASSERT_NE(OTV0P2BASE::SIMPLE_STATS_HANDLE_NONE, h[k]); byKey.putDescriptor(OTV0P2BASE::GenericStatsDescriptor(keys[k])); }
+    for(int t = 0; t < 2000; ++t)
+        {
+        for(int u = OTV0P2BASE::randRNG8() & 7; --u >= 0; )
+            {
+            const uint8_t k = OTV0P2BASE::randRNG8() % nKeys;
+            const int v = (int)(((uint16_t)OTV0P2BASE::randRNG8() << 8) | OTV0P2BASE::randRNG8()) - 32768;
+            ASSERT_TRUE(byKey.put(keys[k], v));
+            ASSERT_TRUE(byHandle.put(h[k], v));
+            }
+        char buf1[OTV0P2BASE::MSG_JSON_MAX_LENGTH + 2];
+        char buf2[OTV0P2BASE::MSG_JSON_MAX_LENGTH + 2];
+        const bool maximise = (0 != (t & 1));
+        const uint8_t size = (uint8_t)(10 + (t % (sizeof(buf1) - 9)));
+        const uint8_t l1 = byKey.writeJSON((uint8_t*)buf1, size, 0, maximise);
+        const uint8_t l2 = byHandle.writeJSON((uint8_t*)buf2, size, 0, maximise);
+        ASSERT_EQ(l1, l2) << t;
+        ASSERT_STREQ(buf1, buf2) << t;
+        ASSERT_TRUE(l1 <= size - 2);
+        }
+
+    // Long key, which cannot be cached but will fit in a big enough buffer.
+    static const char longKey[] = "0123456789012345678901234567890123456789012345678901234567890123456789";
+    OTV0P2BASE::SimpleStatsRotation<1> ss;
+    ss.setID("");
+    ASSERT_TRUE(ss.put(longKey, -12345));
+    char bigBuf[100];
+    EXPECT_EQ(sizeof(longKey) - 1 + 11, ss.writeJSON((uint8_t*)bigBuf, sizeof(bigBuf), 0));
+    EXPECT_EQ(0, memcmp(bigBuf, "{\"0123", 6));
+    EXPECT_STREQ(bigBuf + sizeof(longKey) + 1, "\":-12345}");
+    // Too long for a normal buffer, so omitted.
+    char buf[OTV0P2BASE::MSG_JSON_MAX_LENGTH + 2];
+    EXPECT_EQ(2, ss.writeJSON((uint8_t*)buf, sizeof(buf), 0));
+    EXPECT_STREQ(buf, "{}");
+}
+
+// Report the cost of updating stats by key and by handle,
+// and of writing maximised JSON frames.
+TEST(JSONStats,Benchmark)
+{
+    // If true then be more verbose.
+    const static bool verbose = false;
+
+    typedef std::chrono::steady_clock clock;
+    static const char * const keys[] =
+        { "a", "B|cV", "T|C16", "H|%", "vac|h", "L", "O", "v|%", "tT|C", "b", "gE", "x", "tS|C", "vC|%", "occ", "M" };
+    const uint8_t nKeys = sizeof(keys) / sizeof(keys[0]);
+    OTV0P2BASE::SimpleStatsRotation<nKeys> ss;
+    OTV0P2BASE::SimpleStatsHandle h[nKeys];
+    for(uint8_t k = 0; k < nKeys; ++k) { h[k] = ss.intern(keys[k]); }
+    const int n = 200000;
+    // Use copies of the keys so that the key-based put() has to compare strings as for dynamically-built keys.
+    char keyCopies[nKeys][8];
+    for(uint8_t k = 0; k < nKeys; ++k) { strcpy(keyCopies[k], keys[k]); }
+    const clock::time_point t0 = clock::now();
+    for(int i = 0; i < n; ++i) { ss.put(keyCopies[i % nKeys], i & 0x3ff); }
+    const clock::time_point t1 = clock::now();
+    for(int i = 0; i < n; ++i) { ss.put(h[i % nKeys], i & 0x3ff); }
+    const clock::time_point t2 = clock::now();
+    const int frames = 20000;
+    char buf[OTV0P2BASE::MSG_JSON_MAX_LENGTH + 2];
+    int totalLen = 0;
+    for(int i = 0; i < frames; ++i)
+        {
+        ss.put(h[i % nKeys], i);
+        totalLen += ss.writeJSON((uint8_t*)buf, sizeof(buf), 0, true);
+        }
+    const clock::time_point t3 = clock::now();
+    EXPECT_LT(frames * 10, totalLen);
+    if(verbose)
+        {
+        fprintf(stderr, "SimpleStatsRotation: put(key) %.1fns, put(handle) %.1fns, writeJSON(maximise) %.1fns\n",
+            std::chrono::duration<double, std::nano>(t1 - t0).count() / n,
+            std::chrono::duration<double, std::nano>(t2 - t1).count() / n,
+            std::chrono::duration<double, std::nano>(t3 - t2).count() / frames);
+        }
+}
+
+// Test the compiled stats key schema.
+TEST(JSONStats,BinarySchema)
+{
+    static_assert(0 == OTV0P2BASE::getSimpleStatsSchemaID("T|C16"), "T|C16 must be ID 0");
+    static_assert(OTV0P2BASE::SIMPLE_STATS_SCHEMA_ID_NONE == OTV0P2BASE::getSimpleStatsSchemaID("T|C1"), "prefix must not match");
+    static_assert(OTV0P2BASE::SIMPLE_STATS_SCHEMA_ID_NONE == OTV0P2BASE::getSimpleStatsSchemaID("T|C166"), "extension must not match");
+    for(uint8_t i = 0; i < OTV0P2BASE::SimpleStatsSchemaSize; ++i)
+        {
+        const char *const key = OTV0P2BASE::SimpleStatsSchema[i];
+        EXPECT_TRUE(OTV0P2BASE::isValidSimpleStatsKey(key));
+        EXPECT_EQ(i, OTV0P2BASE::getSimpleStatsSchemaID(key)) << key;
+        // Runtime lookup of a copy, not just the same pointer.
+        const std::string copy(key);
+        EXPECT_EQ(i, OTV0P2BASE::getSimpleStatsSchemaID(copy.c_str())) << key;
+        }
+    EXPECT_EQ(OTV0P2BASE::SIMPLE_STATS_SCHEMA_ID_NONE, OTV0P2BASE::getSimpleStatsSchemaID(NULL));
+    EXPECT_EQ(OTV0P2BASE::SIMPLE_STATS_SCHEMA_ID_NONE, OTV0P2BASE::getSimpleStatsSchemaID("f1"));
+}
+
+#ifdef OTV0P2BASE_SIMPLESTATSROTATION_BINARY
+// Parse the "key":value fields of simple JSON as from writeJSON() or decodeBinaryStats(), skipping "@".
+static std::map<std::string, long> parseSimpleJSON(const char *json)
+{
+    std::map<std::string, long> fields;
+    const char *p = json;
+    while(NULL != (p = strchr(p, '"')))
+        {
+        const char *const keyEnd = strchr(p + 1, '"');
+        if((NULL == keyEnd) || (':' != keyEnd[1])) { break; }
+        const std::string key(p + 1, keyEnd);
+        p = keyEnd + 2;
+        if('"' == *p) { p = strchr(p + 1, '"') + 1; continue; } // String value.
+        fields[key] = strtol(p, NULL, 10);
+        }
+    return(fields);
+}
+
+// Test binary stats output and decoding back to JSON.
+TEST(JSONStats,Binary)
+{
+    OTV0P2BASE::SimpleStatsRotation<3> ss1;
+    ss1.setID("1234");
+    uint8_t buf[OTV0P2BASE::MSG_JSON_MAX_LENGTH_SECURE];
+    char json[OTV0P2BASE::MSG_JSON_MAX_LENGTH + 2];
+    OTV0P2BASE::BinaryStatsDecodeState state;
+    EXPECT_EQ(0, ss1.writeBinary(NULL, sizeof(buf), 0));
+    // Header, count, hex-packed ID.
+    ASSERT_EQ(5, ss1.writeBinary(buf, sizeof(buf), 0));
+    EXPECT_EQ(OTV0P2BASE::MSG_BINARY_STATS_HEADER | OTV0P2BASE::MSG_BINARY_STATS_HEADER_ID_PRESENT, buf[0]);
+    EXPECT_EQ(0, buf[1]);
+    EXPECT_EQ(0x82, buf[2]);
+    EXPECT_EQ(0x12, buf[3]);
+    EXPECT_EQ(0x34, buf[4]);
+    EXPECT_EQ(18, OTV0P2BASE::decodeBinaryStats(buf, 5, state, json, sizeof(json)));
+    EXPECT_STREQ("{\"@\":\"1234\",\"+\":0}", json);
+    // Schema key: ID then zig-zag varint.
+    ss1.put("T|C16", 301);
+    ASSERT_EQ(8, ss1.writeBinary(buf, sizeof(buf), 0));
+    EXPECT_EQ(1, buf[1]); // Count.
+    EXPECT_EQ(0, buf[5]);
+    EXPECT_EQ(0xda, buf[6]); // 602 = 0x25a
+    EXPECT_EQ(0x04, buf[7]);
+    EXPECT_LT(0, OTV0P2BASE::decodeBinaryStats(buf, 8, state, json, sizeof(json)));
+    EXPECT_STREQ("{\"@\":\"1234\",\"+\":1,\"T|C16\":301}", json);
+    // Small change: sent as a shorter delta.
+    ss1.put("T|C16", 299);
+    ASSERT_EQ(7, ss1.writeBinary(buf, sizeof(buf), 0));
+    EXPECT_EQ(0x80, buf[5]);
+    EXPECT_EQ(3, buf[6]); // -2
+    EXPECT_LT(0, OTV0P2BASE::decodeBinaryStats(buf, 7, state, json, sizeof(json)));
+    EXPECT_STREQ("{\"@\":\"1234\",\"+\":2,\"T|C16\":299}", json);
+    // Non-schema key sent with its text, and negative values; non-hex ID sent as text.
+    ss1.setID("X1");
+    ss1.put("f1", -111);
+    ss1.remove("T|C16");
+    const uint8_t l = ss1.writeBinary(buf, sizeof(buf), 0);
+    ASSERT_EQ(2 + 3 + 1 + 3 + 2, l);
+    EXPECT_EQ(0x02, buf[2]);
+    EXPECT_EQ(OTV0P2BASE::SIMPLE_STATS_SCHEMA_ID_NONE, buf[5]);
+    EXPECT_LT(0, OTV0P2BASE::decodeBinaryStats(buf, l, state, json, sizeof(json)));
+    EXPECT_STREQ("{\"@\":\"X1\",\"+\":3,\"f1\":-111}", json);
+    // No ID.
+    ss1.setID("");
+    ASSERT_EQ(8, ss1.writeBinary(buf, sizeof(buf), 0));
+    EXPECT_EQ(0, buf[0] & OTV0P2BASE::MSG_BINARY_STATS_HEADER_ID_PRESENT);
+    EXPECT_LT(0, OTV0P2BASE::decodeBinaryStats(buf, 8, state, json, sizeof(json)));
+    EXPECT_STREQ("{\"+\":4,\"f1\":-111}", json);
+    // Too small for even the header.
+    EXPECT_EQ(0, ss1.writeBinary(buf, 1, 0));
+    // Malformed input is rejected without changing the state.
+    const uint8_t bad1[] = { 0x7b, 0, 0 };
+    const uint8_t bad2[] = { OTV0P2BASE::MSG_BINARY_STATS_HEADER, 5, 0, 0x80 };
+    const uint8_t bad3[] = { OTV0P2BASE::MSG_BINARY_STATS_HEADER, 5, OTV0P2BASE::SimpleStatsSchemaSize, 0 };
+    const uint8_t bad4[] = { OTV0P2BASE::MSG_BINARY_STATS_HEADER, 5, OTV0P2BASE::SIMPLE_STATS_SCHEMA_ID_NONE, 1, '"', 0 };
+    const uint8_t bad5[] = { OTV0P2BASE::MSG_BINARY_STATS_HEADER | 1, 5 }; // Reserved bits set.
+    const uint8_t bad6[] = { OTV0P2BASE::MSG_BINARY_STATS_HEADER }; // No count.
+    EXPECT_EQ(0, OTV0P2BASE::decodeBinaryStats(bad1, sizeof(bad1), state, json, sizeof(json)));
+    EXPECT_EQ(0, OTV0P2BASE::decodeBinaryStats(bad2, sizeof(bad2), state, json, sizeof(json)));
+    EXPECT_EQ(0, OTV0P2BASE::decodeBinaryStats(bad3, sizeof(bad3), state, json, sizeof(json)));
+    EXPECT_EQ(0, OTV0P2BASE::decodeBinaryStats(bad4, sizeof(bad4), state, json, sizeof(json)));
+    EXPECT_EQ(0, OTV0P2BASE::decodeBinaryStats(bad5, sizeof(bad5), state, json, sizeof(json)));
+    EXPECT_EQ(0, OTV0P2BASE::decodeBinaryStats(bad6, sizeof(bad6), state, json, sizeof(json)));
+    EXPECT_EQ(4, state.lastCount);
+    EXPECT_EQ(0, OTV0P2BASE::decodeBinaryStats(buf, 8, state, json, 5));
+}
+
+// Losing exactly 8 frames, which a 3-bit count would not spot, must not yield wrong values.
+TEST(JSONStats,BinaryLoseEight)
+{
+    OTV0P2BASE::SimpleStatsRotation<1> ss;
+    ss.setID("");
+    OTV0P2BASE::BinaryStatsDecodeState state;
+    uint8_t buf[OTV0P2BASE::MSG_JSON_MAX_LENGTH_SECURE];
+    char json[OTV0P2BASE::MSG_JSON_MAX_LENGTH + 2];
+    for(int t = 0; t <= 9; ++t)
+        {
+        // Change by a little each time so that deltas are used where allowed.
+        const int v = 300 + 3*t;
+        ss.put("T|C16", v);
+        const uint8_t l = ss.writeBinary(buf, sizeof(buf), 0);
+        ASSERT_LT(0, l);
+        if((t >= 1) && (t <= 8)) { continue; } // Lose frames 1 to 8.
+        uint8_t skipped;
+        ASSERT_LT(0, OTV0P2BASE::decodeBinaryStats(buf, l, state, json, sizeof(json), &skipped));
+        const std::map<std::string, long> fields = parseSimpleJSON(json);
+        EXPECT_EQ(t, fields.at("+"));
+        if(0 == t) { EXPECT_EQ(v, fields.at("T|C16")); continue; }
+        // The last frame carries a delta from the lost frame 8, so must be skipped rather than misapplied.
+        EXPECT_NE(0, buf[2] & 0x80);
+        EXPECT_EQ(0U, fields.count("T|C16")) << json;
+        EXPECT_EQ(1, skipped);
+        }
+}
+
+// Check that decoded binary stats are always correct, even with lost frames,
+// and that the rotation matches JSON output in the same space.
+TEST(JSONStats,BinaryRoundTrip)
+{
+    static const char * const keys[] =
+        { "T|C16", "H|%", "L", "O", "B|cV", "v|%", "vC|%", "tT|C", "occ|%", "vac|h", "f1", "gE" };
+    const uint8_t nKeys = sizeof(keys) / sizeof(keys[0]);
+    OTV0P2BASE::SimpleStatsRotation<nKeys> ss;
+    ss.setID("");
+    std::map<std::string, long> current;
+    OTV0P2BASE::BinaryStatsDecodeState state;
+    uint8_t buf[OTV0P2BASE::MSG_JSON_MAX_LENGTH_SECURE];
+    char json[255];
+    uint32_t received = 0, skipped = 0, lost = 0;
+    for(int t = 0; t < 5000; ++t)
+        {
+        for(int u = OTV0P2BASE::randRNG8() & 3; --u >= 0; )
+            {
+            const uint8_t k = OTV0P2BASE::randRNG8() % nKeys;
+            // Mostly small changes, some large jumps.
+            long v = current.count(keys[k]) ? current[keys[k]] : 0;
+            v = (0 == (OTV0P2BASE::randRNG8() & 7)) ? ((long)OTV0P2BASE::randRNG8() * 200 - 25000) : (v + (OTV0P2BASE::randRNG8() & 7) - 3);
+            ASSERT_TRUE(ss.put(keys[k], (int)v));
+            current[keys[k]] = v;
+            }
+        const uint8_t l = ss.writeBinary(buf, sizeof(buf), 0, 0 != (t & 1));
+        ASSERT_LT(0, l);
+        ASSERT_GE(sizeof(buf), l);
+        // Lose some frames.
+        if(0 == (OTV0P2BASE::randRNG8() % 23)) { ++lost; continue; }
+        uint8_t s;
+        ASSERT_LT(0, OTV0P2BASE::decodeBinaryStats(buf, l, state, json, sizeof(json), &s)) << t;
+        skipped += s;
+        const std::map<std::string, long> fields = parseSimpleJSON(json);
+        for(const auto &f : fields)
+            {
+            if("+" == f.first) { EXPECT_EQ(t & 0xff, f.second); continue; }
+            ASSERT_EQ(current[f.first], f.second) << f.first << " at " << t << ": " << json;
+            ++received;
+            }
+        }
+    EXPECT_LT(0U, lost);
+    EXPECT_LT(0U, skipped);
+    // Each loss costs at most a few deltas per key before an absolute value is sent again.
+    EXPECT_GE(lost * nKeys * OTV0P2BASE::SIMPLE_STATS_BINARY_MAX_DELTAS, skipped);
+}
+
+// Measure bytes and frames needed to send every stat after all change,
+// for JSON and binary stats in a secure frame body.
+TEST(JSONStats,BinaryBytesPerCycle)
+{
+    // If true then be more verbose.
+    const static bool verbose = false;
+
+    // Typical valve stats, with the ID from the secure frame header.
+    static const char * const keys[] =
+        { "T|C16", "H|%", "L", "O", "B|cV", "v|%", "vC|%", "tT|C", "tS|C", "occ|%", "vac|h" };
+    static const int base[] = { 304, 55, 140, 1, 331, 35, 1260, 19, 0, 20, 0 };
+    static const bool lowPriority[] = { false, false, false, false, true, false, true, false, false, false, true };
+    const uint8_t nKeys = sizeof(keys) / sizeof(keys[0]);
+    OTV0P2BASE::SimpleStatsRotation<nKeys> sj, sb;
+    sj.setID("");
+    sb.setID("");
+    for(uint8_t k = 0; k < nKeys; ++k)
+        {
+        sj.putDescriptor(OTV0P2BASE::GenericStatsDescriptor(keys[k], lowPriority[k]));
+        sb.putDescriptor(OTV0P2BASE::GenericStatsDescriptor(keys[k], lowPriority[k]));
+        }
+    const int cycles = 200;
+    long framesJ = 0, bytesJ = 0, framesB = 0, bytesB = 0;
+    OTV0P2BASE::BinaryStatsDecodeState state;
+    for(int c = 0; c < cycles; ++c)
+        {
+        // Everything drifts a little.
+        for(uint8_t k = 0; k < nKeys; ++k)
+            {
+            const int v = base[k] + ((c * (k + 1)) % 5) - 2;
+            sj.put(keys[k], v);
+            sb.put(keys[k], v);
+            }
+        // JSON, sized as for secure frames (plus the trailing '\0' and spare byte).
+        std::map<std::string, long> seen;
+        while(seen.size() < nKeys)
+            {
+            char buf[OTV0P2BASE::MSG_JSON_MAX_LENGTH_SECURE + 2];
+            const uint8_t l = sj.writeJSON((uint8_t *)buf, sizeof(buf), 0, true);
+            ASSERT_LT(2, l);
+            ++framesJ;
+            bytesJ += l;
+            const std::map<std::string, long> f = parseSimpleJSON(buf);
+            seen.insert(f.begin(), f.end());
+            ASSERT_GT(100 * nKeys, framesJ / (c + 1));
+            }
+        // Binary in the same space.
+        seen.clear();
+        while(seen.size() < nKeys + 1) // Including "+".
+            {
+            uint8_t buf[OTV0P2BASE::MSG_JSON_MAX_LENGTH_SECURE];
+            char json[255];
+            const uint8_t l = sb.writeBinary(buf, sizeof(buf), 0, true);
+            ASSERT_LT(1, l);
+            ++framesB;
+            bytesB += l;
+            ASSERT_LT(0, OTV0P2BASE::decodeBinaryStats(buf, l, state, json, sizeof(json)));
+            const std::map<std::string, long> f = parseSimpleJSON(json);
+            seen.insert(f.begin(), f.end());
+            ASSERT_GT(100 * nKeys, framesB / (c + 1));
+            }
+        }
+    EXPECT_LT(framesB, framesJ);
+    EXPECT_LT(bytesB, bytesJ);
+    if(verbose)
+        {
+        fprintf(stderr, "SimpleStatsRotation: full cycle of %d stats in %d bytes: JSON %.2f frames %.1f bytes, binary %.2f frames %.1f bytes\n",
+            (int)nKeys, (int)OTV0P2BASE::MSG_JSON_MAX_LENGTH_SECURE,
+            framesJ / (double)cycles, bytesJ / (double)cycles, framesB / (double)cycles, bytesB / (double)cycles);
+        }
+}
+
+#endif // OTV0P2BASE_SIMPLESTATSROTATION_BINARY
+
 // Test handling of JSON messages for transmission and reception.
 // Includes bit-twiddling, CRC computation, and other error checking.
 //
@@ -0,0 +1,162 @@
+/*
+The OpenTRV project licenses this file to you
+under the Apache Licence, Version 2.0 (the "Licence");
+you may not use this file except in compliance
+with the Licence. You may obtain a copy of the Licence at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing,
+software distributed under the Licence is distributed on an
+"AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+KIND, either express or implied. See the Licence for the
+specific language governing permissions and limitations
+under the Licence.
+
+Author(s) / Copyright (s): Damon Hart-Davis 2016
+*/
+
+/*
+ * Driver for OTV0p2Base node association index tests.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include <gtest/gtest.h>
+#include <OTV0p2Base.h>
+
+
+namespace {
+
+// Reference lookup: linear scan in index order as for the EEPROM table.
+int16_t linearLookup(const uint8_t (*const ids)[OTV0P2BASE::OpenTRV_Node_ID_Bytes], const uint16_t n,
+                     const uint16_t index, const uint8_t *const prefix, const uint8_t prefixLen)
+    {
+    for(uint16_t i = index; i < n; ++i)
+        { if(0 == memcmp(ids[i], prefix, prefixLen)) { return((int16_t)i); } }
+    return(-1);
+    }
+
+// Fill in a random valid node ID.
+void randomID(uint8_t *const id)
+    {
+    for(uint8_t i = 0; i < OTV0P2BASE::OpenTRV_Node_ID_Bytes; ++i)
+        { id[i] = 0x80 | (OTV0P2BASE::randRNG8() % 0x7f); }
+    }
+
+}
+
+// Basic behaviour, including argument validation.
+TEST(NodeAssociations,Basics)
+{
+    OTV0P2BASE::NodeAssociationIndex<4> idx;
+    EXPECT_EQ(4, idx.maxNodeAssociations());
+    EXPECT_EQ(0, idx.countNodeAssociations());
+    const uint8_t id0[] = { 0x90, 0x91, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97 };
+    const uint8_t id1[] = { 0x88, 0x89, 0x8a, 0x8b, 0x8c, 0x8d, 0x8e, 0x8f };
+    const uint8_t id2[] = { 0x90, 0x91, 0xa0, 0xa1, 0xa2, 0xa3, 0xa4, 0xa5 };
+    uint8_t buf[OTV0P2BASE::OpenTRV_Node_ID_Bytes];
+    EXPECT_EQ(-1, idx.getNextMatchingNodeID(0, NULL, 0, buf));
+    EXPECT_EQ(-1, idx.addNodeAssociation(NULL));
+    EXPECT_EQ(0, idx.addNodeAssociation(id0));
+    EXPECT_EQ(1, idx.addNodeAssociation(id1));
+    EXPECT_EQ(2, idx.addNodeAssociation(id2));
+    EXPECT_EQ(3, idx.countNodeAssociations());
+    // Anonymous lookup matches everything in index order.
+    EXPECT_EQ(0, idx.getNextMatchingNodeID(0, NULL, 0, buf));
+    EXPECT_EQ(0, memcmp(id0, buf, sizeof(buf)));
+    EXPECT_EQ(2, idx.getNextMatchingNodeID(2, NULL, 0, buf));
+    EXPECT_EQ(-1, idx.getNextMatchingNodeID(3, NULL, 0, buf));
+    // Prefix lookups.
+    EXPECT_EQ(1, idx.getNextMatchingNodeID(0, id1, 1, buf));
+    EXPECT_EQ(0, memcmp(id1, buf, sizeof(buf)));
+    EXPECT_EQ(0, idx.getNextMatchingNodeID(0, id0, 2, buf));
+    EXPECT_EQ(2, idx.getNextMatchingNodeID(1, id0, 2, buf));
+    EXPECT_EQ(0, memcmp(id2, buf, sizeof(buf)));
+    EXPECT_EQ(0, idx.getNextMatchingNodeID(0, id0, 8, NULL));
+    EXPECT_EQ(-1, idx.getNextMatchingNodeID(1, id0, 8, NULL));
+    EXPECT_EQ(2, idx.getNextMatchingNodeID(0, id2, 3, NULL));
+    const uint8_t missing[] = { 0x90, 0x92 };
+    EXPECT_EQ(-1, idx.getNextMatchingNodeID(0, missing, 2, NULL));
+    // Bad arguments.
+    EXPECT_EQ(-1, idx.getNextMatchingNodeID(0, NULL, 1, NULL));
+    EXPECT_EQ(-1, idx.getNextMatchingNodeID(0, id0, 9, NULL));
+    EXPECT_FALSE(idx.getNodeAssociation(3, buf));
+    EXPECT_TRUE(idx.getNodeAssociation(1, buf));
+    EXPECT_EQ(0, memcmp(id1, buf, sizeof(buf)));
+    // Fill up.
+    EXPECT_EQ(3, idx.addNodeAssociation(id0)); // Duplicates are allowed, as for EEPROM.
+    EXPECT_EQ(-1, idx.addNodeAssociation(id1));
+    EXPECT_EQ(3, idx.getNextMatchingNodeID(1, id0, 8, NULL));
+    idx.clear();
+    EXPECT_EQ(0, idx.countNodeAssociations());
+    EXPECT_EQ(-1, idx.getNextMatchingNodeID(0, id0, 1, NULL));
+}
+
+// Check that the sorted index gives the same answers as a linear scan
+// for many random IDs, prefix lengths and start indexes.
+TEST(NodeAssociations,MatchesLinearScan)
+{
+    const uint16_t n = 500;
+    static OTV0P2BASE::NodeAssociationIndex<n> idx;
+    idx.clear();
+    static uint8_t ids[n][OTV0P2BASE::OpenTRV_Node_ID_Bytes];
+    for(uint16_t i = 0; i < n; ++i)
+        {
+        randomID(ids[i]);
+        // Force many shared prefixes.
+        ids[i][0] = 0x80 | (ids[i][0] & 3);
+        if(0 == (i % 7)) { memcpy(ids[i], ids[i/2], 3); }
+        if(0 == (i % 50)) { memcpy(ids[i], ids[i/3], sizeof(ids[i])); }
+        ASSERT_EQ(i, idx.addNodeAssociation(ids[i]));
+        }
+    for(int t = 0; t < 20000; ++t)
+        {
+        uint8_t prefix[OTV0P2BASE::OpenTRV_Node_ID_Bytes];
+        const uint16_t from = OTV0P2BASE::randRNG8() % n;
+        memcpy(prefix, ids[(from * 7 + t) % n], sizeof(prefix));
+        const uint8_t prefixLen = OTV0P2BASE::randRNG8() % (sizeof(prefix) + 1);
+        if(0 == (t & 15)) { prefix[prefixLen ? prefixLen - 1 : 0] ^= 1; } // Sometimes miss.
+        const uint16_t index = (0 == (t & 1)) ? 0 : ((((uint16_t)OTV0P2BASE::randRNG8() << 8) | OTV0P2BASE::randRNG8()) % (n + 2));
+        uint8_t buf[OTV0P2BASE::OpenTRV_Node_ID_Bytes];
+        const int16_t expected = linearLookup(ids, n, index, prefix, prefixLen);
+        ASSERT_EQ(expected, idx.getNextMatchingNodeID(index, prefix, prefixLen, buf)) << t;
+        if(expected >= 0) { ASSERT_EQ(0, memcmp(ids[expected], buf, sizeof(buf))); }
+        }
+}
+
+// Report the cost of prefix lookup, as done for each secure frame received,
+// for the sorted index against a linear scan of the same table in RAM,
+// for table sizes from 8 (the V0p2 EEPROM table size) to 4096.
+// The linear scan of RAM is a lower bound on the cost of scanning EEPROM.
+TEST(NodeAssociations,LookupBenchmark)
+{
+    // If true then be more verbose.
+    const static bool verbose = false;
+
+    const uint16_t maxN = 4096;
+    static OTV0P2BASE::NodeAssociationIndex<maxN> idx;
+    static uint8_t ids[maxN][OTV0P2BASE::OpenTRV_Node_ID_Bytes];
+    typedef std::chrono::steady_clock clock;
+    for(uint16_t n = 8; n <= maxN; n *= 2)
+        {
+        idx.clear();
+        for(uint16_t i = 0; i < n; ++i) { randomID(ids[i]); ASSERT_EQ(i, idx.addNodeAssociation(ids[i])); }
+        const int lookups = 20000;
+        // Use 4-byte prefixes as for typical secure frame headers.
+        volatile int32_t sink = 0;
+        const clock::time_point t0 = clock::now();
+        for(int l = 0; l < lookups; ++l)
+            { sink += linearLookup(ids, n, 0, ids[(l * 37) % n], 4); }
+        const clock::time_point t1 = clock::now();
+        for(int l = 0; l < lookups; ++l)
+            { sink += idx.getNextMatchingNodeID(0, ids[(l * 37) % n], 4, NULL); }
+        const clock::time_point t2 = clock::now();
+        const double linearNs = std::chrono::duration<double, std::nano>(t1 - t0).count() / lookups;
+        const double indexNs = std::chrono::duration<double, std::nano>(t2 - t1).count() / lookups;
+        if(verbose) { fprintf(stderr, "Node association lookup, %4u nodes: linear %8.1fns, index %6.1fns\n", (unsigned)n, linearNs, indexNs); }
+        (void)sink;
+        }
+}
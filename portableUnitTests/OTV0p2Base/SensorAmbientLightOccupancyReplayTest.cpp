@@ -0,0 +1,240 @@
+/*
+The OpenTRV project licenses this file to you
+under the Apache Licence, Version 2.0 (the "Licence");
+you may not use this file except in compliance
+with the Licence. You may obtain a copy of the Licence at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing,
+software distributed under the Licence is distributed on an
+"AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+KIND, either express or implied. See the Licence for the
+specific language governing permissions and limitations
+under the Licence.
+
+Author(s) / Copyright (s): Damon Hart-Davis 2016
+*/
+
+/*
+ * Driver for OTV0P2BASE_SensorAmbientLightOccupancyReplay tests.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <chrono>
+#include <string>
+#include <gtest/gtest.h>
+#include <OTV0p2Base.h>
+#include "OTV0P2BASE_MappedFile.h"
+#include "OTV0P2BASE_SensorAmbientLightOccupancyReplay.h"
+
+
+// Directory of recorded test data, with trailing '/', or empty if not found.
+// Taken from (in order of preference) the OTV0P2BASE_TEST_DATA_DIR environment variable,
+// the OTV0P2BASE_TEST_DATA_DIR macro if defined by the build,
+// or the 20161009TestData directory alongside this source file,
+// with __FILE__ taken as is (absolute or relative to the current directory)
+// then relative to each directory above the current one, eg when run from a build directory in the tree.
+static std::string testDataDir()
+{
+    std::string candidates[2];
+    const char *const env = getenv("OTV0P2BASE_TEST_DATA_DIR");
+    if(NULL != env) { candidates[0] = env; }
+#ifdef OTV0P2BASE_TEST_DATA_DIR
+    candidates[1] = OTV0P2BASE_TEST_DATA_DIR;
+#endif
+    for(std::string &d : candidates)
+        {
+        if(d.empty()) { continue; }
+        if('/' != d.back()) { d += '/'; }
+        if(0 == access((d + "2b.L.dat").c_str(), R_OK)) { return(d); }
+        }
+    const std::string f(__FILE__);
+    const size_t slash = f.rfind('/');
+    const std::string alongside = ((std::string::npos == slash) ? std::string(".") : f.substr(0, slash)) + "/20161009TestData/";
+    std::string up;
+    for(int depth = 0; depth < 8; ++depth, up += "../")
+        {
+        const std::string d = up + alongside;
+        if(0 == access((d + "2b.L.dat").c_str(), R_OK)) { return(d); }
+        if('/' == alongside[0]) { break; } // Absolute: no point looking further up.
+        }
+    return(std::string());
+}
+
+// Test timestamp conversion and record parsing, including skipping bad lines and other nodes.
+TEST(SensorAmbientLightOccupancyReplay,Parser)
+{
+    typedef OTV0P2BASE::SensorAmbientLightTraceParser P;
+    EXPECT_EQ(0, P::toMinutes(1970, 1, 1, 0, 0));
+    EXPECT_EQ(1440, P::toMinutes(1970, 1, 2, 0, 0));
+    // 2016-10-08T00:00Z is 17082 days after the epoch.
+    EXPECT_EQ(17082L * 1440, P::toMinutes(2016, 10, 8, 0, 0));
+    // Across a leap day, and year end.
+    EXPECT_EQ(P::toMinutes(2016, 2, 29, 23, 59) + 1, P::toMinutes(2016, 3, 1, 0, 0));
+    EXPECT_EQ(P::toMinutes(2016, 12, 31, 23, 59) + 1, P::toMinutes(2017, 1, 1, 0, 0));
+    EXPECT_EQ(P::toMinutes(2100, 2, 28, 0, 0) + 1440, P::toMinutes(2100, 3, 1, 0, 0));
+
+    const char trace[] =
+        "2016-10-08T09:33:12Z 96F0CED3B4E690E8 134\n"
+        "garbage\n"
+        "2016-10-08T09:37:12Z 91ACF3CFF388D4E0 3\r\n"
+        "2016-10-08T09:41:12Z 96F0CED3B4E690E8 256\n"
+        "2016-10-08T09:45:12Z 96F0CED3B4E690E8 12x\n"
+        "2016-10-08T09:49:00Z 96F0CED3B4E690E8\n"
+        "\n"
+        "2016-10-08T09:53:12Z 96F0CED3B4E690E8 0"; // No trailing newline.
+    const long base = P::toMinutes(2016, 10, 8, 0, 0);
+    long m;
+    uint8_t v;
+    P all(trace, sizeof(trace) - 1);
+    ASSERT_TRUE(all.next(m, v)); EXPECT_EQ(base + 9*60 + 33, m); EXPECT_EQ(134, v);
+    ASSERT_TRUE(all.next(m, v)); EXPECT_EQ(base + 9*60 + 37, m); EXPECT_EQ(3, v);
+    ASSERT_TRUE(all.next(m, v)); EXPECT_EQ(base + 9*60 + 53, m); EXPECT_EQ(0, v);
+    EXPECT_FALSE(all.next(m, v));
+    P one(trace, sizeof(trace) - 1, "91ACF3CFF388D4E0");
+    ASSERT_TRUE(one.next(m, v)); EXPECT_EQ(3, v);
+    EXPECT_FALSE(one.next(m, v));
+    P none(NULL, 0);
+    EXPECT_FALSE(none.next(m, v));
+}
+
+// Test detection scoring against ground truth with a synthetic trace.
+TEST(SensorAmbientLightOccupancyReplay,Scoring)
+{
+    // Lights on at 07:00 and 19:00; ground truth has occupancy at 07:04 and 13:00 only.
+    const char l[] =
+        "2016-10-08T06:00:00Z A 2\n"
+        "2016-10-08T07:00:00Z A 100\n"
+        "2016-10-08T08:00:00Z A 100\n"
+        "2016-10-08T18:00:00Z A 2\n"
+        "2016-10-08T19:00:00Z A 100\n";
+    const char o[] =
+        "2016-10-08T07:04:00Z A 2\n"
+        "2016-10-08T08:04:00Z A 1\n"
+        "2016-10-08T13:00:00Z A 3\n";
+    OTV0P2BASE::SensorAmbientLightOccupancyDetectorSimple ds;
+    OTV0P2BASE::SensorAmbientLightOccupancyReplay r;
+    const OTV0P2BASE::SensorAmbientLightOccupancyReplayScore s = r.replay(ds, l, sizeof(l) - 1, o, sizeof(o) - 1);
+    EXPECT_EQ(5U, s.samples);
+    // 06:00 to 08:00 held, then a gap, then 18:00 to 19:00 held.
+    EXPECT_EQ(121U + 61U, s.updates);
+    EXPECT_EQ(2U, s.detections);
+    EXPECT_EQ(1U, s.truePositives);
+    EXPECT_EQ(1U, s.falsePositives());
+    EXPECT_EQ(2U, s.groundTruthOccupied);
+    EXPECT_EQ(1U, s.groundTruthDetected);
+    EXPECT_FLOAT_EQ(0.5f, s.precision());
+    EXPECT_FLOAT_EQ(0.5f, s.recall());
+}
+
+#ifdef OTV0P2BASE_PLATFORM_HAS_mmap
+
+// Replay the recorded traces for each room, mapped from file.
+TEST(SensorAmbientLightOccupancyReplay,RecordedTraces)
+{
+    static const char *const rooms[] = { "2b", "3l", "5s", "6k" };
+    static const int lRecords[] = { 282, 198, 191, 199 };
+    const std::string dir(testDataDir());
+    ASSERT_FALSE(dir.empty()) << "recorded traces not found: set OTV0P2BASE_TEST_DATA_DIR to portableUnitTests/OTV0p2Base/20161009TestData";
+    for(size_t i = 0; i < sizeof(rooms)/sizeof(rooms[0]); ++i)
+        {
+        const OTV0P2BASE::MappedFile l((dir + rooms[i] + ".L.dat").c_str());
+        const OTV0P2BASE::MappedFile o((dir + rooms[i] + ".O.dat").c_str());
+        ASSERT_TRUE(l.isOpen()) << rooms[i];
+        ASSERT_TRUE(o.isOpen()) << rooms[i];
+        OTV0P2BASE::SensorAmbientLightOccupancyReplayScore s[2];
+        for(int sensitive = 0; sensitive <= 1; ++sensitive)
+            {
+            OTV0P2BASE::SensorAmbientLightOccupancyDetectorSimple ds;
+            OTV0P2BASE::SensorAmbientLightOccupancyReplay r;
+            r.sensitive = (0 != sensitive);
+            s[sensitive] = r.replay(ds, (const char *)l.getData(), l.getSize(), (const char *)o.getData(), o.getSize());
+            EXPECT_EQ((uint32_t)lRecords[i], s[sensitive].samples);
+            EXPECT_LT(s[sensitive].samples, s[sensitive].updates);
+            // Not huge numbers of (false) positives.
+            EXPECT_LE(s[sensitive].detections, s[sensitive].samples / 4);
+            }
+        EXPECT_LE(s[0].detections, s[1].detections) << "expect sensitive never to generate fewer reports";
+        }
+}
+
+// A missing file fails cleanly; independent of the recorded data.
+TEST(SensorAmbientLightOccupancyReplay,MappedFileMissing)
+{
+    char path[] = "/tmp/ALReplayTestMXXXXXX";
+    const int fd = mkstemp(path);
+    ASSERT_LE(0, fd);
+    close(fd);
+    unlink(path);
+    const OTV0P2BASE::MappedFile missing(path);
+    EXPECT_FALSE(missing.isOpen());
+    EXPECT_TRUE(NULL == missing.getData());
+    EXPECT_EQ(0U, missing.getSize());
+}
+
+// Crude benchmark of replay over months of synthetic traces for many rooms, in light records and update() calls per second.
+TEST(SensorAmbientLightOccupancyReplay,Benchmark)
+{
+    // If true then be more verbose.
+    const static bool verbose = false;
+
+    const int rooms = 20;
+    const int days = 90;
+    char lPath[] = "/tmp/ALReplayTestLXXXXXX";
+    char oPath[] = "/tmp/ALReplayTestOXXXXXX";
+    const int lfd = mkstemp(lPath);
+    const int ofd = mkstemp(oPath);
+    ASSERT_LE(0, lfd);
+    ASSERT_LE(0, ofd);
+    FILE *const lf = fdopen(lfd, "w");
+    FILE *const of = fdopen(ofd, "w");
+    // Interleave rooms as in the general logs, with daylight, lights in the evening and some noise.
+    // Records every 8 minutes per room.
+    for(long m = 0; m < days * 1440L; m += 8)
+        {
+        const int d = (int)(m / 1440), H = (int)((m / 60) % 24), M = (int)(m % 60);
+        const bool day = (H >= 7) && (H < 18);
+        for(int room = 0; room < rooms; ++room)
+            {
+            const bool lit = (H >= 18) && (H < 22) && (((H + room) % 3) != 0);
+            const int level = (day ? 120 : (lit ? 60 : 2)) + (OTV0P2BASE::randRNG8() & 3);
+            fprintf(lf, "2016-%02d-%02dT%02d:%02d:00Z R%03d %d\n", 1 + (d / 28), 1 + (d % 28), H, M, room, level);
+            if(0 == (M & 0xf)) { fprintf(of, "2016-%02d-%02dT%02d:%02d:00Z R%03d %d\n", 1 + (d / 28), 1 + (d % 28), H, M, room, lit ? 2 : 1); }
+            }
+        }
+    fclose(lf);
+    fclose(of);
+
+    typedef std::chrono::steady_clock clock;
+    const OTV0P2BASE::MappedFile l(lPath);
+    const OTV0P2BASE::MappedFile o(oPath);
+    unlink(lPath);
+    unlink(oPath);
+    ASSERT_TRUE(l.isOpen());
+    ASSERT_TRUE(o.isOpen());
+    OTV0P2BASE::SensorAmbientLightOccupancyReplayScore total;
+    const clock::time_point t0 = clock::now();
+    for(int room = 0; room < rooms; ++room)
+        {
+        char id[8];
+        snprintf(id, sizeof(id), "R%03d", room);
+        OTV0P2BASE::SensorAmbientLightOccupancyDetectorSimple ds;
+        OTV0P2BASE::SensorAmbientLightOccupancyReplay r;
+        total += r.replay(ds, (const char *)l.getData(), l.getSize(), (const char *)o.getData(), o.getSize(), id);
+        }
+    const double s = std::chrono::duration<double>(clock::now() - t0).count();
+    EXPECT_LT(0U, total.detections);
+    EXPECT_LT(0U, total.truePositives);
+    if(verbose)
+        {
+        fprintf(stderr, "AL replay: %u rooms x %d days, %.3g records/s, %.3g updates/s, precision %.2f, recall %.2f\n",
+            (unsigned)rooms, days, total.samples / s, total.updates / s, total.precision(), total.recall());
+        }
+}
+
+#endif // OTV0P2BASE_PLATFORM_HAS_mmap
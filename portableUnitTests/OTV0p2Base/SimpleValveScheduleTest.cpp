@@ -0,0 +1,181 @@
+/*
+The OpenTRV project licenses this file to you
+under the Apache Licence, Version 2.0 (the "Licence");
+you may not use this file except in compliance
+with the Licence. You may obtain a copy of the Licence at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing,
+software distributed under the Licence is distributed on an
+"AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+KIND, either express or implied. See the Licence for the
+specific language governing permissions and limitations
+under the Licence.
+
+Author(s) / Copyright (s): Damon Hart-Davis 2016
+*/
+
+/*
+ * Driver for OTV0p2Base simple valve schedule tests.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <chrono>
+#include <gtest/gtest.h>
+#include <OTV0p2Base.h>
+
+typedef OTV0P2BASE::SimpleValveScheduleCompiled SVSC;
+
+// Reference WARM test recomputing every schedule's on/off times, wrapping past midnight.
+static bool referenceWARMAt(const OTV0P2BASE::SimpleValveScheduleBase &s, const uint_least16_t mm)
+{
+    for(uint8_t which = 0; which < s.maxSchedules(); ++which)
+        {
+        const uint_least16_t on = s.getSimpleScheduleOn(which);
+        if(on == (uint_least16_t)~0) { continue; }
+        const uint_least16_t off = s.getSimpleScheduleOff(which);
+        if((on < off) ? ((mm >= on) && (mm < off)) : ((mm >= on) || (mm < off))) { return(true); }
+        }
+    return(false);
+}
+
+// Check that the compiled schedule agrees with the reference at every minute of the day.
+static void checkAllMinutes(OTV0P2BASE::SimpleValveScheduleBase &s, OTV0P2BASE::SimpleValveScheduleCompiled &c)
+{
+    for(uint_least16_t mm = 0; mm < OTV0P2BASE::MINS_PER_DAY; ++mm)
+        {
+        ASSERT_EQ(referenceWARMAt(s, mm), c.isAnyScheduleOnWARMAt(mm)) << mm;
+        ASSERT_EQ(referenceWARMAt(s, (mm + SVSC::PREPREWARM_MINS) % OTV0P2BASE::MINS_PER_DAY), c.isAnyScheduleOnWARMSoonAt(mm)) << mm;
+        }
+}
+
+// Basic behaviour of the set/get/clear calls and queries.
+TEST(SimpleValveSchedule,Basics)
+{
+    OTV0P2BASE::SimpleValveScheduleMock<2> s;
+    EXPECT_EQ(2, s.maxSchedules());
+    EXPECT_FALSE(s.isAnySimpleScheduleSet());
+    EXPECT_EQ((uint_least16_t)~0, s.getSimpleScheduleOn(0));
+    EXPECT_EQ((uint_least16_t)~0, s.getSimpleScheduleOff(0));
+    EXPECT_FALSE(s.isAnyScheduleOnWARMNow());
+    // Invalid parameters are rejected.
+    EXPECT_FALSE(s.setSimpleSchedule(OTV0P2BASE::MINS_PER_DAY, 0));
+    EXPECT_FALSE(s.setSimpleSchedule(0, 2));
+    EXPECT_FALSE(s.isAnySimpleScheduleSet());
+    // 07:00, with pre-warm from 06:24 and off at 08:00.
+    EXPECT_TRUE(s.setSimpleSchedule(7*60 + 3, 1));
+    EXPECT_TRUE(s.isAnySimpleScheduleSet());
+    EXPECT_EQ(7*60 - SVSC::PREWARM_MINS, s.getSimpleScheduleOn(1));
+    EXPECT_EQ(8*60, s.getSimpleScheduleOff(1));
+    s.setMinutesSinceMidnightLT(7*60 - SVSC::PREWARM_MINS - 1);
+    EXPECT_FALSE(s.isAnyScheduleOnWARMNow());
+    EXPECT_TRUE(s.isAnyScheduleOnWARMSoon());
+    s.setMinutesSinceMidnightLT(7*60 - SVSC::PREWARM_MINS);
+    EXPECT_TRUE(s.isAnyScheduleOnWARMNow());
+    s.setMinutesSinceMidnightLT(8*60 - 1);
+    EXPECT_TRUE(s.isAnyScheduleOnWARMNow());
+    s.setMinutesSinceMidnightLT(8*60);
+    EXPECT_FALSE(s.isAnyScheduleOnWARMNow());
+    EXPECT_FALSE(s.isAnyScheduleOnWARMSoon());
+    // A change of on time (eg with eco bias) takes effect without setting the schedule again.
+    s.setOnTime(90);
+    EXPECT_EQ(8*60 + 30, s.getSimpleScheduleOff(1));
+    EXPECT_TRUE(s.isAnyScheduleOnWARMNow());
+    s.clearSimpleSchedule(1);
+    EXPECT_FALSE(s.isAnySimpleScheduleSet());
+    EXPECT_FALSE(s.isAnyScheduleOnWARMNow());
+}
+
+// A schedule wrapping past midnight is WARM on both sides of midnight.
+TEST(SimpleValveSchedule,WrapAtMidnight)
+{
+    OTV0P2BASE::SimpleValveScheduleMock<2> s;
+    EXPECT_TRUE(s.setSimpleSchedule(0, 0));
+    EXPECT_EQ(OTV0P2BASE::MINS_PER_DAY - SVSC::PREWARM_MINS, s.getSimpleScheduleOn(0));
+    EXPECT_EQ(60, s.getSimpleScheduleOff(0));
+    EXPECT_FALSE(s.isAnyScheduleOnWARMAt(OTV0P2BASE::MINS_PER_DAY - SVSC::PREWARM_MINS - 1));
+    EXPECT_TRUE(s.isAnyScheduleOnWARMAt(OTV0P2BASE::MINS_PER_DAY - 1));
+    EXPECT_TRUE(s.isAnyScheduleOnWARMAt(0));
+    EXPECT_TRUE(s.isAnyScheduleOnWARMAt(59));
+    EXPECT_FALSE(s.isAnyScheduleOnWARMAt(60));
+    EXPECT_FALSE(s.isAnyScheduleOnWARMAt(OTV0P2BASE::MINS_PER_DAY));
+    // Another schedule reached by the wrapped part merges with it.
+    EXPECT_TRUE(s.setSimpleSchedule(30, 1));
+    checkAllMinutes(s, s);
+}
+
+// The compiled schedule agrees with the reference for random sets of schedules and on times,
+// including far more slots than fit in EEPROM, and clustering to force overlaps.
+TEST(SimpleValveSchedule,CompiledMatchesReference)
+{
+    OTV0P2BASE::SimpleValveScheduleMock<2> s2;
+    OTV0P2BASE::SimpleValveScheduleMock<64> s64;
+    OTV0P2BASE::SimpleValveScheduleMock<255> s255;
+    for(int round = 0; round < 100; ++round)
+        {
+        OTV0P2BASE::SimpleValveScheduleCompiled *const all[] = { &s2, &s64, &s255 };
+        for(OTV0P2BASE::SimpleValveScheduleCompiled *const c : all)
+            {
+            const uint8_t n = c->maxSchedules();
+            const bool clustered = (0 != (round & 1));
+            for(uint8_t which = 0; which < n; ++which)
+                {
+                // Leave a good fraction unset, and sometimes all.
+                if((0 == (round % 10)) || (OTV0P2BASE::randRNG8() < 128)) { c->clearSimpleSchedule(which); continue; }
+                const uint_least16_t r = (uint_least16_t)((OTV0P2BASE::randRNG8() << 8) | OTV0P2BASE::randRNG8());
+                const uint_least16_t t = clustered ? ((OTV0P2BASE::MINS_PER_DAY - 90 + (r % 180)) % OTV0P2BASE::MINS_PER_DAY) : (r % OTV0P2BASE::MINS_PER_DAY);
+                ASSERT_TRUE(c->setSimpleSchedule(t, which));
+                }
+            checkAllMinutes(*c, *c);
+            }
+        // Vary the on time without touching the schedules.
+        const uint8_t onTime = 1 + (OTV0P2BASE::randRNG8() % 240);
+        s2.setOnTime(onTime); s64.setOnTime(onTime); s255.setOnTime(onTime);
+        checkAllMinutes(s2, s2);
+        checkAllMinutes(s64, s64);
+        }
+}
+
+// Benchmark the per-minute evaluation as done by computeTargetTemp(),
+// ie both WARM now and soon, against recomputing each slot's on/off times as before.
+TEST(SimpleValveSchedule,Benchmark)
+{
+    // If true then be more verbose.
+    const static bool verbose = false;
+
+    OTV0P2BASE::SimpleValveScheduleMock<2> s2;
+    OTV0P2BASE::SimpleValveScheduleMock<64> s64;
+    ASSERT_TRUE(s2.setSimpleSchedule(7*60, 0));
+    ASSERT_TRUE(s2.setSimpleSchedule(18*60, 1));
+    for(uint8_t which = 0; which < 64; ++which) { ASSERT_TRUE(s64.setSimpleSchedule((which * 97) % OTV0P2BASE::MINS_PER_DAY, which)); }
+    const int days = 200;
+    OTV0P2BASE::SimpleValveScheduleCompiled *const all[] = { &s2, &s64 };
+    for(OTV0P2BASE::SimpleValveScheduleCompiled *const c : all)
+        {
+        uint32_t warmC = 0, warmR = 0;
+        const auto t0 = std::chrono::steady_clock::now();
+        for(int d = 0; d < days; ++d)
+            {
+            for(uint_least16_t mm = 0; mm < OTV0P2BASE::MINS_PER_DAY; ++mm)
+                { warmC += c->isAnyScheduleOnWARMAt(mm) + c->isAnyScheduleOnWARMSoonAt(mm); }
+            }
+        const auto t1 = std::chrono::steady_clock::now();
+        for(int d = 0; d < days; ++d)
+            {
+            for(uint_least16_t mm = 0; mm < OTV0P2BASE::MINS_PER_DAY; ++mm)
+                { warmR += referenceWARMAt(*c, mm) + referenceWARMAt(*c, (mm + SVSC::PREPREWARM_MINS) % OTV0P2BASE::MINS_PER_DAY); }
+            }
+        const auto t2 = std::chrono::steady_clock::now();
+        EXPECT_EQ(warmR, warmC);
+        const double evals = (double)days * OTV0P2BASE::MINS_PER_DAY;
+        if(verbose)
+            {
+            fprintf(stderr, "SimpleValveSchedule %u slots: compiled %.1fns/min, recomputed %.1fns/min\n",
+                c->maxSchedules(),
+                std::chrono::duration<double, std::nano>(t1 - t0).count() / evals,
+                std::chrono::duration<double, std::nano>(t2 - t1).count() / evals);
+            }
+        }
+}